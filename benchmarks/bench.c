@@ -0,0 +1,492 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "gpuarray/buffer.h"
+#include "gpuarray/error.h"
+
+#include "bench.h"
+
+/*
+ * Driver for the benchmarks.
+ *
+ * Results are written as JSON with one result per line.  This keeps
+ * the file easy to diff and lets us read back a baseline without a
+ * full JSON parser.  pygpu.bench writes and reads the same format.
+ */
+
+#define MAX_FILTERS 16
+
+typedef struct _bench_result {
+  char *name;
+  char *params;
+  unsigned int samples;
+  unsigned int iters;
+  double min;
+  double median;
+  double mean;
+  size_t bytes;
+} bench_result;
+
+typedef struct _result_list {
+  bench_result *r;
+  size_t n;
+  size_t sz;
+} result_list;
+
+gpucontext *ctx;
+const char *bench_dev;
+size_t bench_max_bytes = 64 * 1024 * 1024;
+
+unsigned int bench_samples = 10;
+static double sample_target = 2000.0; /* us */
+static const char *filters[MAX_FILTERS];
+static unsigned int nfilters;
+static int failures;
+
+static result_list results;
+static result_list baseline;
+
+double bench_now(void) {
+#ifdef _WIN32
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER c;
+  if (freq.QuadPart == 0)
+    QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&c);
+  return (double)c.QuadPart * 1e6 / (double)freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+#endif
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static char *dupstr(const char *s) {
+  size_t l = strlen(s);
+  char *r = malloc(l + 1);
+  if (r != NULL)
+    memcpy(r, s, l + 1);
+  return r;
+}
+
+static int list_add(result_list *l, const bench_result *r) {
+  bench_result *tmp;
+  if (l->n == l->sz) {
+    tmp = realloc(l->r, sizeof(bench_result) * (l->sz ? l->sz * 2 : 64));
+    if (tmp == NULL)
+      return -1;
+    l->r = tmp;
+    l->sz = l->sz ? l->sz * 2 : 64;
+  }
+  l->r[l->n] = *r;
+  l->r[l->n].name = dupstr(r->name);
+  l->r[l->n].params = dupstr(r->params);
+  if (l->r[l->n].name == NULL || l->r[l->n].params == NULL) {
+    free(l->r[l->n].name);
+    free(l->r[l->n].params);
+    return -1;
+  }
+  l->n++;
+  return 0;
+}
+
+static void list_clear(result_list *l) {
+  size_t i;
+  for (i = 0; i < l->n; i++) {
+    free(l->r[i].name);
+    free(l->r[i].params);
+  }
+  free(l->r);
+  l->r = NULL;
+  l->n = l->sz = 0;
+}
+
+static const bench_result *list_find(const result_list *l, const char *name,
+                                     const char *params) {
+  size_t i;
+  for (i = 0; i < l->n; i++)
+    if (strcmp(l->r[i].name, name) == 0 &&
+        strcmp(l->r[i].params, params) == 0)
+      return &l->r[i];
+  return NULL;
+}
+
+int bench_enabled(const char *name) {
+  unsigned int i;
+  size_t ln, lf;
+  if (nfilters == 0)
+    return 1;
+  /* Either one can be a prefix of the other so that a group name
+     matches a filter for a single benchmark in that group */
+  ln = strlen(name);
+  for (i = 0; i < nfilters; i++) {
+    lf = strlen(filters[i]);
+    if (strncmp(name, filters[i], ln < lf ? ln : lf) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+void bench_skip(const char *name, const char *why) {
+  if (bench_enabled(name))
+    fprintf(stderr, "%-32s skipped: %s\n", name, why);
+}
+
+int bench_error(const char *name, int err) {
+  fprintf(stderr, "%-32s error: %s\n", name, gpucontext_error(ctx, err));
+  failures++;
+  return err;
+}
+
+int bench_run(const char *name, const char *params, bench_fn fn,
+              bench_fn sync, void *arg, size_t bytes, int flags) {
+  bench_result r;
+  double *t;
+  double start, one;
+  unsigned int i, j, iters = 1;
+  int err = GA_NO_ERROR;
+
+  if (!bench_enabled(name))
+    return GA_NO_ERROR;
+
+  t = calloc(bench_samples, sizeof(double));
+  if (t == NULL)
+    return bench_error(name, GA_MEMORY_ERROR);
+
+  if (!(flags & BENCH_ONCE)) {
+    /* Warm up, then size the samples from the time of a single call */
+    err = fn(arg);
+    if (err == GA_NO_ERROR && sync)
+      err = sync(arg);
+    if (err != GA_NO_ERROR)
+      goto fail;
+    start = bench_now();
+    err = fn(arg);
+    if (err == GA_NO_ERROR && sync)
+      err = sync(arg);
+    if (err != GA_NO_ERROR)
+      goto fail;
+    one = bench_now() - start;
+    if (one < sample_target)
+      iters = (unsigned int)(sample_target / (one > 1.0 ? one : 1.0));
+    if (iters > 10000)
+      iters = 10000;
+  }
+
+  for (i = 0; i < bench_samples; i++) {
+    start = bench_now();
+    for (j = 0; j < iters; j++) {
+      err = fn(arg);
+      if (err != GA_NO_ERROR)
+        goto fail;
+    }
+    if (sync && (err = sync(arg)) != GA_NO_ERROR)
+      goto fail;
+    t[i] = (bench_now() - start) / iters;
+  }
+
+  r.name = (char *)name;
+  r.params = (char *)params;
+  r.samples = bench_samples;
+  r.iters = iters;
+  r.bytes = bytes;
+  r.mean = 0;
+  for (i = 0; i < bench_samples; i++)
+    r.mean += t[i];
+  r.mean /= bench_samples;
+  qsort(t, bench_samples, sizeof(double), cmp_double);
+  r.min = t[0];
+  r.median = (bench_samples % 2) ? t[bench_samples / 2] :
+    (t[bench_samples / 2 - 1] + t[bench_samples / 2]) / 2;
+  free(t);
+
+  if (bytes != 0)
+    printf("%-32s %-28s %12.2f us %9.2f GB/s\n", name, params, r.median,
+           (double)bytes / (r.median * 1e3));
+  else
+    printf("%-32s %-28s %12.2f us\n", name, params, r.median);
+  fflush(stdout);
+
+  if (list_add(&results, &r) != 0)
+    return bench_error(name, GA_MEMORY_ERROR);
+  return GA_NO_ERROR;
+
+ fail:
+  free(t);
+  return bench_error(name, err);
+}
+
+static void json_str(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', f);
+    if ((unsigned char)*s < 0x20)
+      fprintf(f, "\\u%04x", (unsigned char)*s);
+    else
+      fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+static int write_json(const char *path) {
+  char devname[256];
+  FILE *f;
+  size_t i;
+
+  if (strcmp(path, "-") == 0)
+    f = stdout;
+  else if ((f = fopen(path, "w")) == NULL) {
+    perror(path);
+    return -1;
+  }
+  if (gpucontext_property(ctx, GA_CTX_PROP_DEVNAME, devname) != GA_NO_ERROR)
+    strcpy(devname, "unknown");
+  fputs("{\n  \"device\": ", f);
+  json_str(f, bench_dev);
+  fputs(",\n  \"devname\": ", f);
+  json_str(f, devname);
+  fputs(",\n  \"results\": [\n", f);
+  for (i = 0; i < results.n; i++) {
+    fputs("    {\"name\": ", f);
+    json_str(f, results.r[i].name);
+    fputs(", \"params\": ", f);
+    json_str(f, results.r[i].params);
+    fprintf(f, ", \"samples\": %u, \"iters\": %u, \"min_us\": %.3f, "
+            "\"median_us\": %.3f, \"mean_us\": %.3f, \"bytes\": %llu}%s\n",
+            results.r[i].samples, results.r[i].iters, results.r[i].min,
+            results.r[i].median, results.r[i].mean,
+            (unsigned long long)results.r[i].bytes,
+            i + 1 < results.n ? "," : "");
+  }
+  fputs("  ]\n}\n", f);
+  if (f != stdout && fclose(f) != 0) {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
+
+/* Copy the string value that follows `key` on the line into buf */
+static int json_field(const char *line, const char *key, char *buf,
+                      size_t sz) {
+  const char *p = strstr(line, key);
+  size_t i = 0;
+  if (p == NULL)
+    return -1;
+  p += strlen(key);
+  while (*p == ' ' || *p == ':')
+    p++;
+  if (*p++ != '"')
+    return -1;
+  while (*p && *p != '"' && i + 1 < sz) {
+    if (*p == '\\' && p[1])
+      p++;
+    buf[i++] = *p++;
+  }
+  buf[i] = '\0';
+  return *p == '"' ? 0 : -1;
+}
+
+static int load_baseline(const char *path) {
+  char line[1024];
+  char name[256];
+  char params[256];
+  bench_result r;
+  const char *p;
+  FILE *f;
+
+  if ((f = fopen(path, "r")) == NULL) {
+    perror(path);
+    return -1;
+  }
+  memset(&r, 0, sizeof(r));
+  r.name = name;
+  r.params = params;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (json_field(line, "\"name\"", name, sizeof(name)) != 0 ||
+        json_field(line, "\"params\"", params, sizeof(params)) != 0 ||
+        (p = strstr(line, "\"median_us\"")) == NULL)
+      continue;
+    p += strlen("\"median_us\"");
+    while (*p == ' ' || *p == ':')
+      p++;
+    r.median = strtod(p, NULL);
+    if (list_add(&baseline, &r) != 0) {
+      fclose(f);
+      return -1;
+    }
+  }
+  fclose(f);
+  if (baseline.n == 0) {
+    fprintf(stderr, "%s: no results found\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+/* Returns the number of regressions */
+static unsigned int compare(double threshold) {
+  const bench_result *b;
+  unsigned int slower = 0, faster = 0, missing = 0;
+  double ratio;
+  size_t i;
+
+  printf("\nComparison against baseline (threshold %.0f%%):\n",
+         threshold * 100);
+  for (i = 0; i < results.n; i++) {
+    b = list_find(&baseline, results.r[i].name, results.r[i].params);
+    if (b == NULL || b->median <= 0) {
+      missing++;
+      continue;
+    }
+    ratio = results.r[i].median / b->median;
+    if (ratio > 1 + threshold)
+      slower++;
+    else if (ratio < 1 - threshold)
+      faster++;
+    else
+      continue;
+    printf("%-32s %-28s %10.2f -> %10.2f us  %+6.1f%%%s\n",
+           results.r[i].name, results.r[i].params, b->median,
+           results.r[i].median, (ratio - 1) * 100,
+           ratio > 1 ? "  REGRESSION" : "");
+  }
+  printf("%u slower, %u faster, %u unchanged, %u not in baseline\n",
+         slower, faster,
+         (unsigned int)results.n - slower - faster - missing, missing);
+  return slower;
+}
+
+int bench_open(gpucontext **res, const char *cache_path) {
+  const char *dev = bench_dev;
+  gpucontext_props *p;
+  const char *name;
+  char *end;
+  long no, pl;
+  int err;
+
+  if ((err = gpucontext_props_new(&p)) != GA_NO_ERROR)
+    return err;
+  if (strncmp(dev, "cuda", 4) == 0) {
+    name = "cuda";
+    no = strtol(dev + 4, &end, 10);
+    if (end == dev + 4 || *end != '\0' || no < 0 || no > INT_MAX)
+      goto bad;
+    gpucontext_props_cuda_dev(p, (int)no);
+  } else if (strncmp(dev, "opencl", 6) == 0) {
+    name = "opencl";
+    pl = strtol(dev + 6, &end, 10);
+    if (end == dev + 6 || *end != ':' || pl < 0 || pl > 32768)
+      goto bad;
+    dev = end + 1;
+    no = strtol(dev, &end, 10);
+    if (end == dev || *end != '\0' || no < 0 || no > 32768)
+      goto bad;
+    gpucontext_props_opencl_dev(p, (int)pl, (int)no);
+  } else {
+    goto bad;
+  }
+  if (cache_path != NULL)
+    gpucontext_props_kernel_cache(p, cache_path);
+  /* This takes ownership of the props */
+  return gpucontext_init(res, name, p);
+ bad:
+  gpucontext_props_del(p);
+  return -1;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -d DEV     device to use (default $GPUARRAY_TEST_DEVICE or $DEVICE)\n"
+          "  -o FILE    write the results as JSON to FILE ('-' for stdout)\n"
+          "  -b FILE    compare against the results in FILE\n"
+          "  -t FRAC    relative slowdown reported as a regression (0.1)\n"
+          "  -n N       number of samples per benchmark (10)\n"
+          "  -m MB      largest buffer size to use in MiB (64)\n"
+          "  -f PREFIX  only run benchmarks starting with PREFIX (repeatable)\n",
+          prog);
+}
+
+int main(int argc, char *argv[]) {
+  const char *out = NULL;
+  const char *base = NULL;
+  double threshold = 0.1;
+  unsigned int regressions = 0;
+  int i, err;
+
+  bench_dev = getenv("GPUARRAY_TEST_DEVICE");
+  if (bench_dev == NULL)
+    bench_dev = getenv("DEVICE");
+
+  for (i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' ||
+        i + 1 == argc) {
+      usage(argv[0]);
+      return 2;
+    }
+    switch (argv[i][1]) {
+    case 'd': bench_dev = argv[++i]; break;
+    case 'o': out = argv[++i]; break;
+    case 'b': base = argv[++i]; break;
+    case 't': threshold = atof(argv[++i]); break;
+    case 'n': bench_samples = (unsigned int)atoi(argv[++i]); break;
+    case 'm': bench_max_bytes = (size_t)atol(argv[++i]) * 1024 * 1024; break;
+    case 'f':
+      if (nfilters == MAX_FILTERS) {
+        fprintf(stderr, "too many filters\n");
+        return 2;
+      }
+      filters[nfilters++] = argv[++i];
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (bench_dev == NULL || bench_samples == 0 || bench_max_bytes == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (base != NULL && load_baseline(base) != 0)
+    return 2;
+
+  err = bench_open(&ctx, NULL);
+  if (err != GA_NO_ERROR) {
+    fprintf(stderr, "Could not open device %s: %s\n", bench_dev,
+            err == -1 ? "invalid device name" : gpucontext_error(NULL, err));
+    return 2;
+  }
+
+  bench_buffer();
+  bench_kernel();
+  bench_array();
+  bench_blas();
+  bench_collectives();
+
+  if (out != NULL && write_json(out) != 0)
+    failures++;
+  if (base != NULL)
+    regressions = compare(threshold);
+
+  gpucontext_deref(ctx);
+  list_clear(&results);
+  list_clear(&baseline);
+  return (failures || regressions) ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+
+#include "gpuarray/buffer.h"
+
+/*
+ * Small benchmarking harness.
+ *
+ * Each benchmark is a function that performs the measured operation
+ * once.  bench_run() calls it enough times per sample that a sample
+ * lasts a reasonable time, synchronizes at the end of each sample and
+ * records the time per call.  Results are identified by their name
+ * and parameter string, which is also what a baseline is matched
+ * against.
+ */
+
+typedef int (*bench_fn)(void *arg);
+
+/* Don't warm up and make only one call per sample (for operations
+   that change state on each call, like cold compiles) */
+#define BENCH_ONCE 0x1
+
+extern gpucontext *ctx;
+extern const char *bench_dev;
+/* Number of timed samples taken by bench_run() */
+extern unsigned int bench_samples;
+/* Largest buffer size (in bytes) that the benchmarks should use */
+extern size_t bench_max_bytes;
+
+/*
+ * Returns non-zero if the benchmark with that name was selected on
+ * the command line.  Use this to skip expensive setup.
+ */
+int bench_enabled(const char *name);
+
+/*
+ * Measure `fn(arg)` and record the result.
+ *
+ * \param name benchmark name (`group.variant`)
+ * \param params parameter description (`n=1024` or similar)
+ * \param fn the operation to measure
+ * \param sync called at the end of each sample to wait for the
+ *             operations to complete (can be NULL)
+ * \param arg passed to fn and sync
+ * \param bytes memory moved by one call of fn (0 if not relevant)
+ * \param flags BENCH_* flags
+ *
+ * \returns 0 on success or the error code from fn or sync
+ */
+int bench_run(const char *name, const char *params, bench_fn fn,
+              bench_fn sync, void *arg, size_t bytes, int flags);
+
+/*
+ * Open a new context on the benchmark device.
+ *
+ * \param res the new context
+ * \param cache_path kernel cache directory (can be NULL)
+ */
+int bench_open(gpucontext **res, const char *cache_path);
+
+/* Report a benchmark that could not run */
+void bench_skip(const char *name, const char *why);
+
+/* Print an error coming from the library and return it */
+int bench_error(const char *name, int err);
+
+/* Monotonic time in microseconds */
+double bench_now(void);
+
+void bench_buffer(void);
+void bench_kernel(void);
+void bench_array(void);
+void bench_blas(void);
+void bench_collectives(void);
+
+#endif
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpuarray/array.h"
+#include "gpuarray/elemwise.h"
+#include "gpuarray/error.h"
+#include "gpuarray/reduction.h"
+
+#include "bench.h"
+
+/* Elementwise, reduction and take1 on float32 arrays */
+
+typedef struct _ew_arg {
+  GpuElemwise *ge;
+  GpuArray a, b, c;
+  int flags;
+} ew_arg;
+
+static int ew_call(void *p) {
+  ew_arg *e = (ew_arg *)p;
+  void *args[3];
+  args[0] = &e->a;
+  args[1] = &e->b;
+  args[2] = &e->c;
+  return GpuElemwise_call(e->ge, args, e->flags);
+}
+
+static int ew_sync(void *p) {
+  ew_arg *e = (ew_arg *)p;
+  return GpuArray_sync(&e->c);
+}
+
+static GpuElemwise *ew_new(void) {
+  gpuelemwise_arg args[3];
+
+  memset(args, 0, sizeof(args));
+  args[0].name = "a";
+  args[0].typecode = GA_FLOAT;
+  args[0].flags = GE_READ;
+  args[1].name = "b";
+  args[1].typecode = GA_FLOAT;
+  args[1].flags = GE_READ;
+  args[2].name = "c";
+  args[2].typecode = GA_FLOAT;
+  args[2].flags = GE_WRITE;
+  return GpuElemwise_new(ctx, "", "c = a + b", 3, args, 0, 0);
+}
+
+/* Contiguous 1d arrays */
+static int ew_contig(ew_arg *e, size_t n) {
+  int err;
+  if ((err = GpuArray_empty(&e->a, ctx, GA_FLOAT, 1, &n, GA_C_ORDER)) !=
+      GA_NO_ERROR)
+    return err;
+  if ((err = GpuArray_empty(&e->b, ctx, GA_FLOAT, 1, &n, GA_C_ORDER)) !=
+      GA_NO_ERROR)
+    goto fail_b;
+  if ((err = GpuArray_empty(&e->c, ctx, GA_FLOAT, 1, &n, GA_C_ORDER)) !=
+      GA_NO_ERROR)
+    goto fail_c;
+  e->flags = 0;
+  return GA_NO_ERROR;
+ fail_c:
+  GpuArray_clear(&e->b);
+ fail_b:
+  GpuArray_clear(&e->a);
+  return err;
+}
+
+/* Every other element of 1d arrays of size 2n */
+static int ew_strided(ew_arg *e, size_t n) {
+  GpuArray *views[3];
+  GpuArray base;
+  ssize_t start = 0, stop, step = 2;
+  size_t n2 = n * 2;
+  unsigned int i;
+  int err;
+
+  views[0] = &e->a;
+  views[1] = &e->b;
+  views[2] = &e->c;
+  stop = (ssize_t)n2;
+  for (i = 0; i < 3; i++) {
+    err = GpuArray_empty(&base, ctx, GA_FLOAT, 1, &n2, GA_C_ORDER);
+    if (err == GA_NO_ERROR) {
+      err = GpuArray_index(views[i], &base, &start, &stop, &step);
+      GpuArray_clear(&base);
+    }
+    if (err != GA_NO_ERROR) {
+      while (i-- > 0)
+        GpuArray_clear(views[i]);
+      return err;
+    }
+  }
+  e->flags = 0;
+  return GA_NO_ERROR;
+}
+
+/* A row vector added to every row of a matrix */
+static int ew_broadcast(ew_arg *e, size_t n) {
+  size_t dims[2];
+  int err;
+
+  dims[1] = 1024;
+  dims[0] = n / dims[1];
+  if ((err = GpuArray_empty(&e->a, ctx, GA_FLOAT, 2, dims, GA_C_ORDER)) !=
+      GA_NO_ERROR)
+    return err;
+  dims[0] = 1;
+  if ((err = GpuArray_empty(&e->b, ctx, GA_FLOAT, 2, dims, GA_C_ORDER)) !=
+      GA_NO_ERROR)
+    goto fail_b;
+  dims[0] = n / dims[1];
+  if ((err = GpuArray_empty(&e->c, ctx, GA_FLOAT, 2, dims, GA_C_ORDER)) !=
+      GA_NO_ERROR)
+    goto fail_c;
+  e->flags = GE_BROADCAST;
+  return GA_NO_ERROR;
+ fail_c:
+  GpuArray_clear(&e->b);
+ fail_b:
+  GpuArray_clear(&e->a);
+  return err;
+}
+
+static void bench_elemwise(void) {
+  static const struct {
+    const char *name;
+    int (*setup)(ew_arg *, size_t);
+    unsigned int full; /* number of full-size arrays */
+  } variants[] = {
+    {"elemwise.contig", ew_contig, 3},
+    {"elemwise.strided", ew_strided, 3},
+    {"elemwise.broadcast", ew_broadcast, 2},
+  };
+  char params[64];
+  ew_arg e;
+  size_t n;
+  unsigned int i;
+  int err;
+
+  if (!bench_enabled("elemwise"))
+    return;
+  e.ge = ew_new();
+  if (e.ge == NULL) {
+    bench_error("elemwise", GA_MISC_ERROR);
+    return;
+  }
+  for (i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+    if (!bench_enabled(variants[i].name))
+      continue;
+    /* The strided variant uses twice the memory */
+    for (n = 1 << 10; n * sizeof(float) * 2 <= bench_max_bytes; n <<= 3) {
+      err = variants[i].setup(&e, n);
+      if (err != GA_NO_ERROR) {
+        bench_error(variants[i].name, err);
+        break;
+      }
+      sprintf(params, "n=%llu", (unsigned long long)n);
+      bench_run(variants[i].name, params, ew_call, ew_sync, &e,
+                variants[i].full * n * sizeof(float), 0);
+      GpuArray_clear(&e.a);
+      GpuArray_clear(&e.b);
+      GpuArray_clear(&e.c);
+    }
+  }
+  GpuElemwise_free(e.ge);
+}
+
+typedef struct _red_arg {
+  GpuReduction *gr;
+  GpuArray src, dst;
+  unsigned int naxes;
+  unsigned int axes[3];
+} red_arg;
+
+static int red_call(void *p) {
+  red_arg *r = (red_arg *)p;
+  return GpuReduction_call(r->gr, &r->dst, &r->src, r->naxes, r->axes);
+}
+
+static int red_sync(void *p) {
+  red_arg *r = (red_arg *)p;
+  return GpuArray_sync(&r->dst);
+}
+
+static void bench_reduction(void) {
+  /* Bitmasks of the reduced axes */
+  static const unsigned int patterns[] = {1, 2, 4, 5, 6, 7};
+  char params[64];
+  char axes[8];
+  size_t dims[3], rdims[3];
+  red_arg r;
+  unsigned int i, j, rnd;
+  int err;
+
+  if (!bench_enabled("reduction"))
+    return;
+  r.gr = GpuReduction_new(ctx, NULL, NULL, "a + b", "0", GA_FLOAT, -1,
+                          GA_FLOAT);
+  if (r.gr == NULL) {
+    bench_error("reduction", GA_MISC_ERROR);
+    return;
+  }
+  dims[0] = 64;
+  dims[1] = 256;
+  dims[2] = 256;
+  while (dims[0] > 1 && dims[0] * dims[1] * dims[2] * sizeof(float) >
+         bench_max_bytes)
+    dims[0] /= 2;
+  err = GpuArray_empty(&r.src, ctx, GA_FLOAT, 3, dims, GA_C_ORDER);
+  if (err != GA_NO_ERROR) {
+    bench_error("reduction", err);
+    GpuReduction_free(r.gr);
+    return;
+  }
+  for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+    r.naxes = 0;
+    rnd = 0;
+    for (j = 0; j < 3; j++) {
+      if (patterns[i] & (1 << j)) {
+        axes[r.naxes * 2] = '0' + j;
+        axes[r.naxes * 2 + 1] = ',';
+        r.axes[r.naxes++] = j;
+      } else
+        rdims[rnd++] = dims[j];
+    }
+    err = GpuArray_empty(&r.dst, ctx, GA_FLOAT, rnd, rdims, GA_C_ORDER);
+    if (err != GA_NO_ERROR) {
+      bench_error("reduction.sum", err);
+      break;
+    }
+    axes[r.naxes * 2 - 1] = '\0';
+    sprintf(params, "shape=%llux%llux%llu,axes=%s",
+            (unsigned long long)dims[0], (unsigned long long)dims[1],
+            (unsigned long long)dims[2], axes);
+    bench_run("reduction.sum", params, red_call, red_sync, &r,
+              dims[0] * dims[1] * dims[2] * sizeof(float), 0);
+    GpuArray_clear(&r.dst);
+  }
+  GpuArray_clear(&r.src);
+  GpuReduction_free(r.gr);
+}
+
+typedef struct _take_arg {
+  GpuArray r, v, idx;
+  int check;
+} take_arg;
+
+static int take_call(void *p) {
+  take_arg *t = (take_arg *)p;
+  return GpuArray_take1(&t->r, &t->v, &t->idx, t->check);
+}
+
+static int take_sync(void *p) {
+  take_arg *t = (take_arg *)p;
+  return GpuArray_sync(&t->r);
+}
+
+static void bench_take1(void) {
+  static const struct {
+    const char *name;
+    int check;
+  } modes[] = {
+    {"take1.deferred", GA_CHECK_ERROR_DEFERRED},
+    {"take1.sync", GA_CHECK_ERROR_SYNC},
+  };
+  char params[64];
+  take_arg t;
+  long *hidx;
+  size_t dims[2], nidx;
+  size_t i;
+  unsigned int seed = 42, m;
+  int err;
+
+  if (!bench_enabled("take1"))
+    return;
+  dims[1] = 64;
+  for (dims[0] = 1024; dims[0] * dims[1] * sizeof(float) * 2 <=
+         bench_max_bytes; dims[0] *= 16) {
+    nidx = dims[0] / 2;
+    hidx = malloc(nidx * sizeof(long));
+    if (hidx == NULL) {
+      bench_error("take1", GA_MEMORY_ERROR);
+      return;
+    }
+    for (i = 0; i < nidx; i++) {
+      seed = seed * 1103515245 + 12345;
+      hidx[i] = (long)((seed >> 8) % dims[0]);
+    }
+    err = GpuArray_empty(&t.v, ctx, GA_FLOAT, 2, dims, GA_C_ORDER);
+    if (err != GA_NO_ERROR)
+      goto fail_v;
+    err = GpuArray_empty(&t.idx, ctx, GA_LONG, 1, &nidx, GA_C_ORDER);
+    if (err != GA_NO_ERROR)
+      goto fail_idx;
+    err = GpuArray_write(&t.idx, hidx, nidx * sizeof(long));
+    if (err != GA_NO_ERROR)
+      goto fail_r;
+    dims[0] = nidx;
+    err = GpuArray_empty(&t.r, ctx, GA_FLOAT, 2, dims, GA_C_ORDER);
+    dims[0] = nidx * 2;
+    if (err != GA_NO_ERROR)
+      goto fail_r;
+    sprintf(params, "rows=%llu,cols=%llu,n=%llu",
+            (unsigned long long)dims[0], (unsigned long long)dims[1],
+            (unsigned long long)nidx);
+    for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+      t.check = modes[m].check;
+      bench_run(modes[m].name, params, take_call, take_sync, &t,
+                2 * nidx * dims[1] * sizeof(float), 0);
+    }
+    GpuArray_clear(&t.r);
+    GpuArray_clear(&t.idx);
+    GpuArray_clear(&t.v);
+    free(hidx);
+    continue;
+  fail_r:
+    GpuArray_clear(&t.idx);
+  fail_idx:
+    GpuArray_clear(&t.v);
+  fail_v:
+    free(hidx);
+    bench_error("take1", err);
+    return;
+  }
+}
+
+void bench_array(void) {
+  bench_elemwise();
+  bench_reduction();
+  bench_take1();
+}
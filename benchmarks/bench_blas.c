@@ -0,0 +1,129 @@
+#include <stdio.h>
+
+#include "gpuarray/array.h"
+#include "gpuarray/blas.h"
+#include "gpuarray/error.h"
+
+#include "bench.h"
+
+/* float32 gemm and gemv on a few representative shapes */
+
+typedef struct _blas_arg {
+  GpuArray A, B, C;
+} blas_arg;
+
+static int gemm_call(void *p) {
+  blas_arg *b = (blas_arg *)p;
+  return GpuArray_rgemm(cb_no_trans, cb_no_trans, 1.0, &b->A, &b->B, 0.0,
+                        &b->C, 1);
+}
+
+static int gemv_call(void *p) {
+  blas_arg *b = (blas_arg *)p;
+  return GpuArray_rgemv(cb_no_trans, 1.0, &b->A, &b->B, 0.0, &b->C, 1);
+}
+
+static int blas_sync(void *p) {
+  blas_arg *b = (blas_arg *)p;
+  return GpuArray_sync(&b->C);
+}
+
+static int blas_setup(blas_arg *b, unsigned int nd, size_t m, size_t n,
+                      size_t k) {
+  size_t dims[2];
+  int err;
+
+  /* For gemv B and C are vectors and n is ignored */
+  dims[0] = m;
+  dims[1] = k;
+  if ((err = GpuArray_empty(&b->A, ctx, GA_FLOAT, 2, dims, GA_C_ORDER)) !=
+      GA_NO_ERROR)
+    return err;
+  dims[0] = k;
+  dims[1] = n;
+  if ((err = GpuArray_empty(&b->B, ctx, GA_FLOAT, nd, dims, GA_C_ORDER)) !=
+      GA_NO_ERROR)
+    goto fail_b;
+  dims[0] = m;
+  if ((err = GpuArray_empty(&b->C, ctx, GA_FLOAT, nd, dims, GA_C_ORDER)) !=
+      GA_NO_ERROR)
+    goto fail_c;
+  /* Don't time the multiplication of garbage (possibly NaNs) */
+  if ((err = GpuArray_memset(&b->A, 0)) != GA_NO_ERROR ||
+      (err = GpuArray_memset(&b->B, 0)) != GA_NO_ERROR)
+    goto fail;
+  return GA_NO_ERROR;
+ fail:
+  GpuArray_clear(&b->C);
+ fail_c:
+  GpuArray_clear(&b->B);
+ fail_b:
+  GpuArray_clear(&b->A);
+  return err;
+}
+
+static void blas_clear(blas_arg *b) {
+  GpuArray_clear(&b->A);
+  GpuArray_clear(&b->B);
+  GpuArray_clear(&b->C);
+}
+
+void bench_blas(void) {
+  /* m, n, k */
+  static const size_t gemm_shapes[][3] = {
+    {256, 256, 256},
+    {1024, 1024, 1024},
+    {2048, 2048, 2048},
+    {8192, 8192, 64},
+    {64, 64, 8192},
+    {8192, 64, 1024},
+  };
+  static const size_t gemv_sizes[] = {1024, 4096};
+  char params[64];
+  blas_arg b;
+  size_t m, n, k;
+  unsigned int i;
+  int err;
+
+  if (bench_enabled("blas.gemm")) {
+    for (i = 0; i < sizeof(gemm_shapes) / sizeof(gemm_shapes[0]); i++) {
+      m = gemm_shapes[i][0];
+      n = gemm_shapes[i][1];
+      k = gemm_shapes[i][2];
+      if ((m * k + k * n + m * n) * sizeof(float) > bench_max_bytes)
+        continue;
+      err = blas_setup(&b, 2, m, n, k);
+      if (err != GA_NO_ERROR) {
+        bench_error("blas.gemm", err);
+        break;
+      }
+      sprintf(params, "m=%llu,n=%llu,k=%llu", (unsigned long long)m,
+              (unsigned long long)n, (unsigned long long)k);
+      err = bench_run("blas.gemm", params, gemm_call, blas_sync, &b, 0, 0);
+      blas_clear(&b);
+      /* Probably no BLAS library for this device */
+      if (err != GA_NO_ERROR)
+        break;
+    }
+  }
+
+  if (bench_enabled("blas.gemv")) {
+    for (i = 0; i < sizeof(gemv_sizes) / sizeof(gemv_sizes[0]); i++) {
+      m = gemv_sizes[i];
+      if ((m * m + 2 * m) * sizeof(float) > bench_max_bytes)
+        continue;
+      err = blas_setup(&b, 1, m, 1, m);
+      if (err != GA_NO_ERROR) {
+        bench_error("blas.gemv", err);
+        break;
+      }
+      sprintf(params, "m=%llu,n=%llu", (unsigned long long)m,
+              (unsigned long long)m);
+      err = bench_run("blas.gemv", params, gemv_call, blas_sync, &b,
+                      m * m * sizeof(float), 0);
+      blas_clear(&b);
+      if (err != GA_NO_ERROR)
+        break;
+    }
+  }
+}
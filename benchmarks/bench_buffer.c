@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gpuarray/buffer.h"
+#include "gpuarray/error.h"
+
+#include "bench.h"
+
+/* Allocation churn and host/device transfers */
+
+#define CHURN_OPS 64
+
+typedef struct _alloc_arg {
+  size_t sz;
+  gpudata *live[CHURN_OPS];
+} alloc_arg;
+
+static int alloc_same(void *p) {
+  alloc_arg *a = (alloc_arg *)p;
+  int err;
+  gpudata *d = gpudata_alloc(ctx, a->sz, NULL, 0, &err);
+  if (d == NULL)
+    return err;
+  gpudata_release(d);
+  return GA_NO_ERROR;
+}
+
+/*
+ * Allocate CHURN_OPS buffers of varied sizes and release them in a
+ * different order, which is closer to what a framework does between
+ * two steps than a single alloc/free pair.
+ */
+static int alloc_mixed(void *p) {
+  alloc_arg *a = (alloc_arg *)p;
+  unsigned int seed = 12345;
+  unsigned int i, j;
+  int err;
+
+  for (i = 0; i < CHURN_OPS; i++) {
+    seed = seed * 1103515245 + 12345;
+    a->live[i] = gpudata_alloc(ctx, 256 + (seed >> 8) % a->sz, NULL, 0,
+                               &err);
+    if (a->live[i] == NULL) {
+      while (i-- > 0)
+        gpudata_release(a->live[i]);
+      return err;
+    }
+  }
+  for (i = 0; i < CHURN_OPS; i++) {
+    j = (i * 37) % CHURN_OPS;
+    gpudata_release(a->live[j]);
+  }
+  return GA_NO_ERROR;
+}
+
+typedef struct _xfer_arg {
+  gpudata *src;
+  gpudata *dst;
+  void *host;
+  size_t sz;
+} xfer_arg;
+
+static int xfer_htod(void *p) {
+  xfer_arg *a = (xfer_arg *)p;
+  return gpudata_write(a->dst, 0, a->host, a->sz);
+}
+
+static int xfer_dtoh(void *p) {
+  xfer_arg *a = (xfer_arg *)p;
+  return gpudata_read(a->host, a->src, 0, a->sz);
+}
+
+static int xfer_dtod(void *p) {
+  xfer_arg *a = (xfer_arg *)p;
+  return gpudata_move(a->dst, 0, a->src, 0, a->sz);
+}
+
+static int xfer_sync(void *p) {
+  xfer_arg *a = (xfer_arg *)p;
+  return gpudata_sync(a->dst);
+}
+
+void bench_buffer(void) {
+  static const size_t same_sizes[] = {256, 64 * 1024, 4 * 1024 * 1024};
+  char params[64];
+  alloc_arg aa;
+  xfer_arg xa;
+  unsigned int i;
+  int err;
+
+  for (i = 0; i < sizeof(same_sizes) / sizeof(same_sizes[0]); i++) {
+    aa.sz = same_sizes[i];
+    sprintf(params, "size=%llu", (unsigned long long)aa.sz);
+    bench_run("alloc.same", params, alloc_same, NULL, &aa, 0, 0);
+  }
+  for (aa.sz = 4096; aa.sz <= 16 * 1024 * 1024; aa.sz *= 64) {
+    sprintf(params, "ops=%u,max=%llu", CHURN_OPS * 2,
+            (unsigned long long)aa.sz);
+    bench_run("alloc.mixed", params, alloc_mixed, NULL, &aa, 0, 0);
+  }
+
+  if (!bench_enabled("transfer"))
+    return;
+  for (xa.sz = 4096; xa.sz <= bench_max_bytes; xa.sz *= 16) {
+    xa.dst = NULL;
+    xa.host = malloc(xa.sz);
+    xa.src = gpudata_alloc(ctx, xa.sz, NULL, 0, &err);
+    if (xa.src != NULL) {
+      xa.dst = gpudata_alloc(ctx, xa.sz, NULL, 0, &err);
+      if (xa.dst == NULL)
+        gpudata_release(xa.src);
+    }
+    if (xa.host == NULL || xa.src == NULL || xa.dst == NULL) {
+      free(xa.host);
+      bench_error("transfer", xa.host == NULL ? GA_MEMORY_ERROR : err);
+      return;
+    }
+    sprintf(params, "size=%llu", (unsigned long long)xa.sz);
+    bench_run("transfer.htod", params, xfer_htod, xfer_sync, &xa, xa.sz, 0);
+    bench_run("transfer.dtoh", params, xfer_dtoh, NULL, &xa, xa.sz, 0);
+    bench_run("transfer.dtod", params, xfer_dtod, xfer_sync, &xa,
+              2 * xa.sz, 0);
+    gpudata_release(xa.src);
+    gpudata_release(xa.dst);
+    free(xa.host);
+  }
+}
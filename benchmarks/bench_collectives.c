@@ -0,0 +1,95 @@
+#include <stdio.h>
+
+#include "gpuarray/buffer.h"
+#include "gpuarray/buffer_collectives.h"
+#include "gpuarray/error.h"
+#include "gpuarray/types.h"
+
+#include "bench.h"
+
+/*
+ * Collectives on a single-rank communicator.
+ *
+ * This doesn't measure the interconnect, but it catches regressions
+ * in the per-call overhead and the local part of the operations,
+ * which is what dominates for the small buffers of bucketed gradient
+ * reductions.
+ */
+
+typedef struct _coll_arg {
+  gpucomm *comm;
+  gpudata *src;
+  gpudata *dst;
+  size_t count;
+} coll_arg;
+
+static int all_reduce(void *p) {
+  coll_arg *c = (coll_arg *)p;
+  return gpucomm_all_reduce(c->src, 0, c->dst, 0, c->count, GA_FLOAT,
+                            GA_SUM, c->comm);
+}
+
+static int all_gather(void *p) {
+  coll_arg *c = (coll_arg *)p;
+  return gpucomm_all_gather(c->src, 0, c->dst, 0, c->count, GA_FLOAT,
+                            c->comm);
+}
+
+static int broadcast(void *p) {
+  coll_arg *c = (coll_arg *)p;
+  return gpucomm_broadcast(c->dst, 0, c->count, GA_FLOAT, 0, c->comm);
+}
+
+static int coll_sync(void *p) {
+  coll_arg *c = (coll_arg *)p;
+  return gpudata_sync(c->dst);
+}
+
+void bench_collectives(void) {
+  gpucommCliqueId id;
+  char params[64];
+  coll_arg c;
+  size_t sz;
+  int err;
+
+  if (!bench_enabled("collectives"))
+    return;
+  err = gpucomm_gen_clique_id(ctx, &id);
+  if (err == GA_NO_ERROR)
+    err = gpucomm_new(&c.comm, ctx, id, 1, 0);
+  if (err != GA_NO_ERROR) {
+    bench_skip("collectives", gpucontext_error(ctx, err));
+    return;
+  }
+  for (c.count = 1024; c.count * sizeof(float) <= bench_max_bytes;
+       c.count *= 16) {
+    sz = c.count * sizeof(float);
+    c.src = gpudata_alloc(ctx, sz, NULL, 0, &err);
+    if (c.src == NULL) {
+      bench_error("collectives", err);
+      break;
+    }
+    c.dst = gpudata_alloc(ctx, sz, NULL, 0, &err);
+    if (c.dst == NULL) {
+      gpudata_release(c.src);
+      bench_error("collectives", err);
+      break;
+    }
+    if ((err = gpudata_memset(c.src, 0, 0)) != GA_NO_ERROR) {
+      bench_error("collectives", err);
+      gpudata_release(c.src);
+      gpudata_release(c.dst);
+      break;
+    }
+    sprintf(params, "ranks=1,count=%llu", (unsigned long long)c.count);
+    bench_run("collectives.all_reduce", params, all_reduce, coll_sync, &c,
+              2 * sz, 0);
+    bench_run("collectives.all_gather", params, all_gather, coll_sync, &c,
+              2 * sz, 0);
+    bench_run("collectives.broadcast", params, broadcast, coll_sync, &c,
+              sz, 0);
+    gpudata_release(c.src);
+    gpudata_release(c.dst);
+  }
+  gpucomm_free(c.comm);
+}
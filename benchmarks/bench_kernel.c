@@ -0,0 +1,172 @@
+#ifndef _WIN32
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpuarray/buffer.h"
+#include "gpuarray/error.h"
+#include "gpuarray/kernel.h"
+
+#include "bench.h"
+
+/*
+ * Kernel compilation and launch.
+ *
+ * Every compile uses a source that differs by a comment so that it
+ * can't hit in the memory cache unless we want it to.  The nonce also
+ * includes the start time so that a disk cache left by a previous run
+ * (GPUARRAY_CACHE_PATH) doesn't turn cold compiles into disk hits.
+ */
+
+static const char kern_fmt[] =
+  "#include \"cluda.h\"\n"
+  "/* bench %lu.%u */\n"
+  "KERNEL void k(GLOBAL_MEM ga_float *a, ga_size n) {\n"
+  "  ga_size i;\n"
+  "  for (i = LID_0 + GID_0 * LDIM_0; i < n; i += LDIM_0 * GDIM_0)\n"
+  "    a[i] = a[i] * 2.0f + 1.0f;\n"
+  "}\n";
+
+static const int kern_types[] = {GA_BUFFER, GA_SIZE};
+
+typedef struct _kern_arg {
+  gpucontext *ctx;
+  unsigned long base;
+  unsigned int next;
+  GpuKernel k;
+  gpudata *buf;
+  size_t n;
+} kern_arg;
+
+static int compile(gpucontext *c, unsigned long base, unsigned int nonce,
+                   GpuKernel *k) {
+  char src[sizeof(kern_fmt) + 64];
+  const char *s = src;
+  int err;
+
+  sprintf(src, kern_fmt, base, nonce);
+  err = GpuKernel_init(k, c, 1, &s, NULL, "k", 2, kern_types, 0, NULL);
+  if (err != GA_NO_ERROR)
+    fprintf(stderr, "kernel: %s\n", gpucontext_error(c, err));
+  return err;
+}
+
+/* A new source each time */
+static int compile_cold(void *p) {
+  kern_arg *a = (kern_arg *)p;
+  GpuKernel k;
+  int err = compile(a->ctx, a->base, a->next++, &k);
+  if (err == GA_NO_ERROR)
+    GpuKernel_clear(&k);
+  return err;
+}
+
+/* The same source each time */
+static int compile_warm(void *p) {
+  kern_arg *a = (kern_arg *)p;
+  GpuKernel k;
+  int err = compile(a->ctx, a->base, 0, &k);
+  if (err == GA_NO_ERROR)
+    GpuKernel_clear(&k);
+  return err;
+}
+
+static int launch(void *p) {
+  kern_arg *a = (kern_arg *)p;
+  void *args[2];
+  size_t gs = 1, ls = 1;
+  args[0] = a->buf;
+  args[1] = &a->n;
+  return GpuKernel_call(&a->k, 1, &gs, &ls, 0, args);
+}
+
+static int launch_sync(void *p) {
+  kern_arg *a = (kern_arg *)p;
+  return gpudata_sync(a->buf);
+}
+
+#ifndef _WIN32
+static int rm_entry(const char *path, const struct stat *sb, int flag,
+                    struct FTW *ftw) {
+  return remove(path);
+}
+
+static void bench_disk(kern_arg *a) {
+  char dir[] = "/tmp/gpuarray_bench.XXXXXX";
+  gpucontext *c1, *c2;
+  unsigned int i;
+  int err;
+
+  if (strncmp(bench_dev, "cuda", 4) != 0) {
+    bench_skip("kernel.compile_disk", "no disk cache for this backend");
+    return;
+  }
+  if (mkdtemp(dir) == NULL) {
+    perror("kernel.compile_disk");
+    return;
+  }
+  /* Populate the disk cache from one context and read it from another */
+  err = bench_open(&c1, dir);
+  if (err != GA_NO_ERROR) {
+    bench_error("kernel.compile_disk", err);
+    goto out;
+  }
+  for (i = 0; i < bench_samples; i++) {
+    a->ctx = c1;
+    a->next = 100000 + i;
+    if ((err = compile_cold(a)) != GA_NO_ERROR)
+      break;
+  }
+  gpucontext_deref(c1);
+  if (err != GA_NO_ERROR)
+    goto out;
+  err = bench_open(&c2, dir);
+  if (err != GA_NO_ERROR) {
+    bench_error("kernel.compile_disk", err);
+    goto out;
+  }
+  a->ctx = c2;
+  a->next = 100000;
+  bench_run("kernel.compile_disk", "", compile_cold, NULL, a, 0, BENCH_ONCE);
+  gpucontext_deref(c2);
+ out:
+  nftw(dir, rm_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+#endif
+
+void bench_kernel(void) {
+  kern_arg a;
+  int err;
+
+  if (!bench_enabled("kernel"))
+    return;
+
+  a.ctx = ctx;
+  a.base = (unsigned long)bench_now();
+  a.next = 1;
+  bench_run("kernel.compile_cold", "", compile_cold, NULL, &a, 0, BENCH_ONCE);
+  bench_run("kernel.compile_warm", "", compile_warm, NULL, &a, 0, 0);
+
+  if (bench_enabled("kernel.launch")) {
+    a.n = 1;
+    a.buf = gpudata_alloc(ctx, sizeof(float), NULL, 0, &err);
+    if (a.buf == NULL) {
+      bench_error("kernel.launch", err);
+    } else {
+      if (compile(ctx, a.base, 0, &a.k) == GA_NO_ERROR) {
+        bench_run("kernel.launch", "", launch, launch_sync, &a, 0, 0);
+        GpuKernel_clear(&a.k);
+      }
+      gpudata_release(a.buf);
+    }
+  }
+
+#ifndef _WIN32
+  if (bench_enabled("kernel.compile_disk"))
+    bench_disk(&a);
+#endif
+}
@@ -4,7 +4,7 @@ def get_include():
     assert os.path.exists(os.path.join(p, 'gpuarray_api.h'))
     return p
 
-from . import gpuarray, elemwise, reduction
+from . import _stats, gpuarray, elemwise, reduction
 from .gpuarray import (init, set_default_context, get_default_context,
                        array, zeros, empty, asarray, ascontiguousarray,
                        asfortranarray, register_dtype)
@@ -16,6 +16,45 @@ from ._version import get_versions
 __version__ = get_versions()['version']
 del get_versions
 
+def stats(reset=False):
+    """
+    Returns the host time accounting collected so far.
+
+    The result is a dict with these keys:
+
+    enabled
+        whether the accounting is currently on
+    timers
+        `{site: {phase: summary}}` where a summary has the `count`,
+        `total`, `mean`, `min` and `max` times (in seconds) and a
+        `histogram` as a list of `(upper_bound, count)` with
+        power-of-two bounds starting at 1us
+    counters
+        event counts, like the hits and misses of the python-side
+        kernel caches
+
+    See :mod:`pygpu._stats` for the meaning of the sites and phases.
+    If `reset` is True, the data is cleared after being read.
+    """
+    return _stats.snapshot(reset)
+
+
+def enable_stats(flag=True):
+    """
+    Turn the host time accounting on or off.
+
+    It can also be turned on at import with the PYGPU_STATS
+    environment variable.  When off it costs a test per instrumented
+    phase.
+    """
+    _stats.enable(flag)
+
+
+def reset_stats():
+    """Clear the data collected for :func:`stats`."""
+    _stats.reset()
+
+
 def test():
     from . import tests
     from .tests import main
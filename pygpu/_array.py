@@ -2,7 +2,7 @@ from __future__ import division
 import numpy as np
 
 from .elemwise import elemwise1, elemwise2, ielemwise2, compare, arg, GpuElemwise, as_argument
-from .reduction import reduce1
+from .reduction import reduce1, scan1
 from .dtypes import dtype_to_ctype, get_np_obj, get_common_dtype
 from . import gpuarray
 
@@ -235,19 +235,7 @@ Since these functions are untested (thus probably wrong), we disable them.
         self[...] = value
 """
     # reductions
-    def all(self, axis=None, out=None):
-        if self.ndim == 0:
-            return self.copy()
-        return reduce1(self, '&&', '1', np.dtype('bool'),
-                       axis=axis, out=out)
-
-    def any(self, axis=None, out=None):
-        if self.ndim == 0:
-            return self.copy()
-        return reduce1(self, '||', '0', np.dtype('bool'),
-                       axis=axis, out=out)
-
-    def prod(self, axis=None, dtype=None, out=None):
+    def _acc_dtype(self, dtype):
         if dtype is None:
             dtype = self.dtype
             # we only upcast integers that are smaller than the plaform default
@@ -259,36 +247,70 @@ Since these functions are untested (thus probably wrong), we disable them.
                 di = np.dtype('uint')
                 if di.itemsize > dtype.itemsize:
                     dtype = di
-        return reduce1(self, '*', '1', dtype, axis=axis, out=out)
-
-#    def max(self, axis=None, out=None);
-#        nd = self.ndim
-#        if nd == 0:
-#            return self.copy()
-#        idx = (0,) * nd
-#        n = str(self.__getitem__(idx).__array__())
-#        return reduce1(self, '', n, self.dtype, axis=axis, out=out,
-#                       oper='max(a, b)')
-
-#    def min(self, axis=None, out=None):
-#        nd = self.ndim
-#        if nd == 0:
-#            return self.copy()
-#        idx = (0,) * nd
-#        n = str(self.__getitem__(idx).__array__())
-#        return reduce1(self, '', n, self.dtype, axis=axis, out=out,
-#                       oper='min(a, b)')
+        return dtype
+
+    def _bool_acc_dtype(self):
+        # accumulate in the input type so that the truth value isn't lost
+        # in the conversion to bool
+        if self.dtype == np.float16:
+            return np.dtype('float32')
+        return self.dtype
+
+    def _minmax_neutral(self, largest):
+        dtype = self.dtype
+        if dtype.kind == 'f':
+            return '-INFINITY' if largest else 'INFINITY'
+        if dtype.kind == 'b':
+            return '0' if largest else '1'
+        info = np.iinfo(dtype)
+        if largest and info.min < 0:
+            return '(%d - 1)' % (info.min + 1,)
+        if largest:
+            return str(info.min)
+        return ('%dU' if dtype.kind == 'u' else '%d') % (info.max,)
+
+    def _minmax_oper(self, cmp):
+        if self.dtype.kind == 'f':
+            # propagate NaNs like numpy
+            return '(a != a || a %s b) ? a : b' % (cmp,)
+        return 'a %s b ? a : b' % (cmp,)
+
+    def all(self, axis=None, out=None):
+        if self.ndim == 0:
+            return self.copy()
+        return reduce1(self, '&&', '1', np.dtype('bool'),
+                       axis=axis, out=out, acc_type=self._bool_acc_dtype())
+
+    def any(self, axis=None, out=None):
+        if self.ndim == 0:
+            return self.copy()
+        return reduce1(self, '||', '0', np.dtype('bool'),
+                       axis=axis, out=out, acc_type=self._bool_acc_dtype())
+
+    def prod(self, axis=None, dtype=None, out=None):
+        return reduce1(self, '*', '1', self._acc_dtype(dtype), axis=axis,
+                       out=out)
+
+    def max(self, axis=None, out=None):
+        if self.ndim == 0:
+            return self.copy()
+        return reduce1(self, '', self._minmax_neutral(True), self.dtype,
+                       axis=axis, out=out, oper=self._minmax_oper('>'))
+
+    def min(self, axis=None, out=None):
+        if self.ndim == 0:
+            return self.copy()
+        return reduce1(self, '', self._minmax_neutral(False), self.dtype,
+                       axis=axis, out=out, oper=self._minmax_oper('<'))
 
     def sum(self, axis=None, dtype=None, out=None):
-        if dtype is None:
-            dtype = self.dtype
-            # we only upcast integers that are smaller than the plaform default
-            if dtype.kind == 'i':
-                di = np.dtype('int')
-                if di.itemsize > dtype.itemsize:
-                    dtype = di
-            if dtype.kind == 'u':
-                di = np.dtype('uint')
-                if di.itemsize > dtype.itemsize:
-                    dtype = di
-        return reduce1(self, '+', '0', dtype, axis=axis, out=out)
+        return reduce1(self, '+', '0', self._acc_dtype(dtype), axis=axis,
+                       out=out)
+
+    def cumsum(self, axis=None, dtype=None, out=None):
+        return scan1(self, '+', '0', self._acc_dtype(dtype), axis=axis,
+                     out=out)
+
+    def cumprod(self, axis=None, dtype=None, out=None):
+        return scan1(self, '*', '1', self._acc_dtype(dtype), axis=axis,
+                     out=out)
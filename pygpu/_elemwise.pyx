@@ -1,12 +1,13 @@
 from pygpu.gpuarray import GpuArrayException, UnsupportedException
+from pygpu import _stats
 from pygpu.gpuarray cimport (gpucontext, GA_NO_ERROR, get_typecode,
                              typecode_to_dtype, GpuContext, GpuArray,
-                             get_exc, gpuarray_get_elsize)
+                             get_exc)
 from pygpu.gpuarray cimport (GA_BUFFER, GA_SIZE, GA_SSIZE, GA_ULONG, GA_LONG,
                              GA_UINT, GA_INT, GA_USHORT, GA_SHORT,
                              GA_UBYTE, GA_BYTE, GA_DOUBLE, GA_FLOAT)
 from libc.string cimport memset, memcpy, strdup
-from libc.stdlib cimport malloc, calloc, free
+from libc.stdlib cimport calloc, free
 
 cdef bytes to_bytes(s):
   if isinstance(s, bytes):
@@ -38,10 +39,11 @@ cdef extern from "gpuarray/elemwise.h":
                                   gpuelemwise_arg *args, unsigned int nd,
                                   int flags)
     void GpuElemwise_free(_GpuElemwise *ge)
-    int GpuElemwise_call(_GpuElemwise *ge, void **args, int flags)
+    int GpuElemwise_call(_GpuElemwise *ge, void **args, int flags) nogil
 
     cdef int GE_NOADDR64
     cdef int GE_CONVERT_F16
+    cdef int GE_SPECIALIZE
 
     cdef int GE_BROADCAST
     cdef int GE_NOCOLLAPSE
@@ -98,19 +100,19 @@ cdef class arg:
 cdef class GpuElemwise:
     cdef _GpuElemwise *ge
     cdef int *types
-    cdef void **callbuf
     cdef unsigned int n
 
     def __cinit__(self, GpuContext ctx, expr, args, unsigned int nd=0,
-                  preamble=b"", bint convert_f16=False):
+                  preamble=b"", bint convert_f16=False,
+                  bint specialize=False):
         cdef gpuelemwise_arg *_args;
         cdef unsigned int i
         cdef arg aa
 
         self.ge = NULL
         self.types = NULL
-        self.callbuf = NULL
 
+        t = _stats.start()
         preamble = to_bytes(preamble)
         expr = to_bytes(expr)
         self.n = len(args)
@@ -119,10 +121,6 @@ cdef class GpuElemwise:
         if self.types is NULL:
             raise MemoryError
 
-        self.callbuf = <void **>calloc(self.n, sizeof(void *))
-        if self.callbuf == NULL:
-            raise MemoryError
-
         _args = <gpuelemwise_arg *>calloc(self.n, sizeof(gpuelemwise_arg));
         if _args is NULL:
             raise MemoryError
@@ -134,17 +132,16 @@ cdef class GpuElemwise:
                 memcpy(&_args[i], &aa.a, sizeof(gpuelemwise_arg))
                 if aa.a.flags & GE_SCALAR:
                     self.types[i] = aa.a.typecode
-                    self.callbuf[i] = malloc(gpuarray_get_elsize(aa.a.typecode))
-                    if self.callbuf[i] is NULL:
-                        raise MemoryError
                 else:
                     self.types[i] = GA_BUFFER
 
             self.ge = GpuElemwise_new(ctx.ctx, preamble, expr, self.n,
                                       _args, nd,
-                                      GE_CONVERT_F16 if convert_f16 else 0)
+                                      (GE_CONVERT_F16 if convert_f16 else 0) |
+                                      (GE_SPECIALIZE if specialize else 0))
         finally:
             free(_args)
+        _stats.record('GpuElemwise', 'compile', t)
         if self.ge is NULL:
             error_message = gpucontext_error(ctx.ctx, 0).decode(encoding='latin-1')
             # getting the error type this way is fragile, but the alternative is breaking ABI
@@ -153,54 +150,50 @@ cdef class GpuElemwise:
              GpuArrayException)("Could not initialize C GpuElemwise instance: " + error_message)
 
     def __dealloc__(self):
-        cdef unsigned int i
-
         if self.ge is not NULL:
             GpuElemwise_free(self.ge)
             self.ge = NULL
-        for i in range(self.n):
-            if self.types[i] != GA_BUFFER:
-                free(self.callbuf[i])
-        free(self.callbuf)
         free(self.types)
 
-    cdef _setarg(self, unsigned int index, object o):
+    cdef _setarg(self, void **callbuf, unsigned int index, object o):
         cdef int typecode
         typecode = self.types[index]
 
         if typecode == GA_BUFFER:
             if not isinstance(o, GpuArray):
                 raise TypeError, "expected a GpuArray"
-            self.callbuf[index] = <void *>&(<GpuArray>o).ga
+            callbuf[index] = <void *>&(<GpuArray>o).ga
         elif typecode == GA_SIZE:
-            (<size_t *>self.callbuf[index])[0] = o
+            (<size_t *>callbuf[index])[0] = o
         elif typecode == GA_SSIZE:
-            (<ssize_t *>self.callbuf[index])[0] = o
+            (<ssize_t *>callbuf[index])[0] = o
         elif typecode == GA_FLOAT:
-            (<float *>self.callbuf[index])[0] = o
+            (<float *>callbuf[index])[0] = o
         elif typecode == GA_DOUBLE:
-            (<double *>self.callbuf[index])[0] = o
+            (<double *>callbuf[index])[0] = o
         elif typecode == GA_BYTE:
-            (<signed char *>self.callbuf[index])[0] = o
+            (<signed char *>callbuf[index])[0] = o
         elif typecode == GA_UBYTE:
-            (<unsigned char *>self.callbuf[index])[0] = o
+            (<unsigned char *>callbuf[index])[0] = o
         elif typecode == GA_SHORT:
-            (<short *>self.callbuf[index])[0] = o
+            (<short *>callbuf[index])[0] = o
         elif typecode == GA_USHORT:
-            (<unsigned short *>self.callbuf[index])[0] = o
+            (<unsigned short *>callbuf[index])[0] = o
         elif typecode == GA_INT:
-            (<int *>self.callbuf[index])[0] = o
+            (<int *>callbuf[index])[0] = o
         elif typecode == GA_UINT:
-            (<unsigned int *>self.callbuf[index])[0] = o
+            (<unsigned int *>callbuf[index])[0] = o
         elif typecode == GA_LONG:
-            (<long *>self.callbuf[index])[0] = o
+            (<long *>callbuf[index])[0] = o
         elif typecode == GA_ULONG:
-            (<unsigned long *>self.callbuf[index])[0] = o
+            (<unsigned long *>callbuf[index])[0] = o
         else:
             raise ValueError("Bad typecode in _setarg: %d "
                              "(please report this, it is a bug)" % (typecode,))
 
     def __call__(self, *args, **kwargs):
+        cdef void **callbuf
+        cdef long long *vals
         cdef unsigned int i
         cdef int err
         cdef int flags
@@ -214,8 +207,30 @@ cdef class GpuElemwise:
         if len(kwargs) != 0:
             raise TypeError("Unknown keyword argument: %s" % list(kwargs.keys())[0])
 
-        for i, arg in enumerate(args):
-            self._setarg(i, arg)
-        err = GpuElemwise_call(self.ge, self.callbuf, flags)
+        if len(args) != self.n:
+            raise TypeError("Expected %d arguments, got %d" % (self.n, len(args)))
+
+        # The argument buffer is per-call since other threads can use
+        # this object while we run without the GIL.  Scalars go in
+        # 8-byte slots which are big enough for any of the types.
+        callbuf = <void **>calloc(self.n + 1, sizeof(void *))
+        vals = <long long *>calloc(self.n + 1, sizeof(long long))
+        if callbuf is NULL or vals is NULL:
+            free(callbuf)
+            free(vals)
+            raise MemoryError
+        try:
+            t = _stats.start()
+            for i, arg in enumerate(args):
+                if self.types[i] != GA_BUFFER:
+                    callbuf[i] = <void *>&vals[i]
+                self._setarg(callbuf, i, arg)
+            t = _stats.record('GpuElemwise', 'setargs', t)
+            with nogil:
+                err = GpuElemwise_call(self.ge, callbuf, flags)
+            _stats.record('GpuElemwise', 'launch', t)
+        finally:
+            free(callbuf)
+            free(vals)
         if err != GA_NO_ERROR:
             raise get_exc(err)("Could not call GpuElemwise")
@@ -0,0 +1,101 @@
+from pygpu.gpuarray import GpuArrayException
+from pygpu import _stats
+from pygpu.gpuarray cimport (gpucontext, GA_NO_ERROR, get_typecode,
+                             GpuContext, GpuArray, _GpuArray, get_exc)
+from libc.stdlib cimport malloc, free
+
+cdef bytes to_bytes(s):
+  if isinstance(s, bytes):
+      return <bytes>s
+  if isinstance(s, unicode):
+      return <bytes>(<unicode>s).encode('ascii')
+  raise TypeError("Can't convert to bytes")
+
+cdef extern from "gpuarray/buffer.h":
+    ctypedef struct gpucontext:
+        pass
+    char *gpucontext_error(gpucontext *ctx, int err)
+
+cdef extern from "gpuarray/reduction.h":
+    ctypedef struct _GpuReduction "GpuReduction":
+        pass
+
+    _GpuReduction *GpuReduction_new(gpucontext *ctx, const char *preamble,
+                                    const char *map_expr,
+                                    const char *reduce_expr,
+                                    const char *neutral, int srctype,
+                                    int acctype, int dsttype)
+    void GpuReduction_free(_GpuReduction *gr)
+    int GpuReduction_call(_GpuReduction *gr, _GpuArray *dst,
+                          const _GpuArray *src, unsigned int reduxLen,
+                          const unsigned int *reduxList)
+
+
+cdef class GpuReduction:
+    """
+    GpuReduction(context, reduce_expr, neutral, src_type, dst_type,
+                 map_expr=None, acc_type=None, preamble="")
+
+    Reduction of arrays of `src_type` into arrays of `dst_type` over
+    any set of axes.
+
+    Each element, converted to `acc_type` (float32 for float16 inputs),
+    is transformed by `map_expr` (in terms of `a`) and combined with
+    `reduce_expr` (in terms of `a` and `b`), starting from `neutral`.
+    """
+    cdef _GpuReduction *gr
+    cdef GpuContext context
+
+    def __cinit__(self, GpuContext context, reduce_expr, neutral, src_type,
+                  dst_type, map_expr=None, acc_type=None, preamble=b""):
+        cdef bytes m
+        self.gr = NULL
+        self.context = context
+
+        t = _stats.start()
+        preamble = to_bytes(preamble)
+        reduce_expr = to_bytes(reduce_expr)
+        neutral = to_bytes(neutral)
+        if map_expr is not None:
+            m = to_bytes(map_expr)
+
+        self.gr = GpuReduction_new(context.ctx, preamble,
+                                   NULL if map_expr is None else <char *>m,
+                                   reduce_expr, neutral,
+                                   get_typecode(src_type),
+                                   -1 if acc_type is None else get_typecode(acc_type),
+                                   get_typecode(dst_type))
+        _stats.record('GpuReduction', 'compile', t)
+        if self.gr is NULL:
+            raise GpuArrayException("Could not initialize C GpuReduction instance: " +
+                                    gpucontext_error(context.ctx, 0).decode(encoding='latin-1'))
+
+    def __dealloc__(self):
+        if self.gr is not NULL:
+            GpuReduction_free(self.gr)
+            self.gr = NULL
+
+    def __call__(self, GpuArray out not None, GpuArray src not None, axes):
+        """
+        __call__(out, src, axes)
+
+        Reduce `src` over the axes in `axes` into `out`, which must have
+        the shape of `src` without those axes.
+        """
+        cdef unsigned int n = len(axes)
+        cdef unsigned int i
+        cdef int err
+        cdef unsigned int *redux = <unsigned int *>malloc(max(n, 1) * sizeof(unsigned int))
+        if redux is NULL:
+            raise MemoryError
+        try:
+            t = _stats.start()
+            for i in range(n):
+                redux[i] = axes[i]
+            t = _stats.record('GpuReduction', 'setargs', t)
+            err = GpuReduction_call(self.gr, &out.ga, &src.ga, n, redux)
+            _stats.record('GpuReduction', 'launch', t)
+        finally:
+            free(redux)
+        if err != GA_NO_ERROR:
+            raise get_exc(err)(gpucontext_error(self.context.ctx, err).decode(encoding='latin-1'))
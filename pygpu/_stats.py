@@ -0,0 +1,133 @@
+"""
+Accounting of the host time spent in pygpu calls.
+
+This is off by default.  Turn it on with :func:`pygpu.enable_stats` or
+by setting the PYGPU_STATS environment variable before importing
+pygpu, then look at the numbers with :func:`pygpu.stats`.
+
+Time is attributed to a call site (the pygpu function or class doing
+the work) and a phase of that call:
+
+check_args
+    argument validation and shape/stride computations
+codegen
+    building the kernel source and argument specs
+cache
+    looking up a previously built kernel
+compile
+    building a kernel object (this includes the lookups in the
+    library's kernel cache, so a high count here with a low time
+    usually means a kernel is being rebuilt on each call)
+setargs
+    converting the python arguments for a kernel call
+launch
+    the call into the library to run the kernel
+
+Sites nest: the time of `elemwise2` for the `compile` phase also
+shows up as the `compile` phase of `GpuElemwise`.
+"""
+import os
+import threading
+from timeit import default_timer as now
+
+__all__ = ['enabled', 'start', 'record', 'count', 'enable', 'reset',
+           'snapshot']
+
+enabled = bool(os.environ.get('PYGPU_STATS'))
+
+# Histogram bucket i counts durations in [2**(i-1), 2**i) microseconds,
+# with everything below 1us in bucket 0 and everything above the top
+# in the last one.
+NBUCKETS = 26
+
+_lock = threading.Lock()
+_timers = {}
+_counters = {}
+
+
+class _Timer(object):
+    __slots__ = ('count', 'total', 'min', 'max', 'hist')
+
+    def __init__(self):
+        self.count = 0
+        self.total = 0.0
+        self.min = None
+        self.max = 0.0
+        self.hist = [0] * NBUCKETS
+
+    def add(self, dt):
+        self.count += 1
+        self.total += dt
+        if self.min is None or dt < self.min:
+            self.min = dt
+        if dt > self.max:
+            self.max = dt
+        b = int(dt * 1e6).bit_length()
+        self.hist[min(b, NBUCKETS - 1)] += 1
+
+    def summary(self):
+        return dict(count=self.count, total=self.total,
+                    mean=self.total / self.count, min=self.min,
+                    max=self.max,
+                    histogram=[((1 << i) * 1e-6, c)
+                               for i, c in enumerate(self.hist) if c])
+
+
+def start():
+    """
+    Returns a start time to pass to :func:`record` or None if the
+    accounting is disabled.
+    """
+    if enabled:
+        return now()
+    return None
+
+
+def record(site, phase, t):
+    """
+    Account the time since `t` to `phase` of `site`.
+
+    Returns the current time so that consecutive phases can be
+    chained, or None if `t` is None.
+    """
+    if t is None:
+        return None
+    n = now()
+    key = (site, phase)
+    with _lock:
+        tm = _timers.get(key)
+        if tm is None:
+            tm = _timers[key] = _Timer()
+        tm.add(n - t)
+    return n
+
+
+def count(name, n=1):
+    """Add `n` to the counter `name` if the accounting is enabled."""
+    if enabled:
+        with _lock:
+            _counters[name] = _counters.get(name, 0) + n
+
+
+def enable(flag=True):
+    global enabled
+    enabled = bool(flag)
+
+
+def reset():
+    with _lock:
+        _timers.clear()
+        _counters.clear()
+
+
+def snapshot(reset=False):
+    with _lock:
+        timers = {}
+        for (site, phase), tm in _timers.items():
+            timers.setdefault(site, {})[phase] = tm.summary()
+        res = dict(enabled=enabled, timers=timers,
+                   counters=dict(_counters))
+        if reset:
+            _timers.clear()
+            _counters.clear()
+    return res
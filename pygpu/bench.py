@@ -0,0 +1,473 @@
+"""
+Benchmarks for pygpu.
+
+Run them with::
+
+    python -m pygpu.bench -d cuda0 -o new.json
+    python -m pygpu.bench -d cuda0 -b old.json
+
+The results are written in the same format as the gpuarray_bench
+program from the C library, one result per line, and are matched to a
+baseline by benchmark name and parameters.  The exit status is 1 if a
+benchmark failed or got slower than the baseline by more than the
+threshold.
+"""
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import shutil
+import sys
+import tempfile
+from timeit import default_timer
+
+import numpy
+
+from . import gpuarray
+from ._array import ndgpuarray
+from .elemwise import GpuElemwise, arg
+from .reduction import reduce1
+
+__all__ = ['Runner', 'run_all', 'write_results', 'load_results', 'compare',
+           'main']
+
+
+class Runner(object):
+    """
+    Times benchmarks and collects the results.
+
+    Parameters
+    ----------
+    samples: int
+        Number of timed samples per benchmark.
+    filters: list of str
+        Only run the benchmarks whose name starts with one of these.
+    max_bytes: int
+        Largest buffer size the benchmarks should use.
+    sample_time: float
+        Target duration of a sample in seconds.  Fast operations are
+        repeated to reach it.
+    """
+    def __init__(self, samples=10, filters=(), max_bytes=64 << 20,
+                 sample_time=0.002, out=sys.stdout):
+        self.samples = samples
+        self.filters = list(filters)
+        self.max_bytes = max_bytes
+        self.sample_time = sample_time
+        self.out = out
+        self.results = []
+        self.failures = 0
+
+    def enabled(self, name):
+        """
+        Returns True if `name` was selected.  A group name is selected
+        if any benchmark in it may be.
+        """
+        if not self.filters:
+            return True
+        return any(name.startswith(f) or f.startswith(name)
+                   for f in self.filters)
+
+    def skip(self, name, why):
+        if self.enabled(name):
+            print("%-32s skipped: %s" % (name, why), file=sys.stderr)
+
+    def error(self, name, e):
+        print("%-32s error: %s" % (name, e), file=sys.stderr)
+        self.failures += 1
+
+    def run(self, name, params, fn, sync=None, nbytes=0, once=False):
+        """
+        Time `fn()` and record the result.
+
+        `sync()` is called at the end of each sample to wait for the
+        queued work.  If `once` is True, there is no warm-up and each
+        sample is a single call.
+        """
+        if not self.enabled(name):
+            return None
+        try:
+            iters = 1
+            if not once:
+                fn()
+                if sync:
+                    sync()
+                start = default_timer()
+                fn()
+                if sync:
+                    sync()
+                one = default_timer() - start
+                if one < self.sample_time:
+                    iters = min(int(self.sample_time / max(one, 1e-6)),
+                                10000)
+            times = []
+            for _ in range(self.samples):
+                start = default_timer()
+                for _ in range(iters):
+                    fn()
+                if sync:
+                    sync()
+                times.append((default_timer() - start) * 1e6 / iters)
+        except Exception as e:
+            self.error(name, e)
+            return None
+
+        times.sort()
+        n = len(times)
+        median = (times[n // 2] if n % 2 else
+                  (times[n // 2 - 1] + times[n // 2]) / 2)
+        res = dict(name=name, params=params, samples=n, iters=iters,
+                   min_us=times[0], median_us=median,
+                   mean_us=sum(times) / n, bytes=nbytes)
+        self.results.append(res)
+        if nbytes:
+            print("%-32s %-28s %12.2f us %9.2f GB/s" %
+                  (name, params, median, nbytes / (median * 1e3)),
+                  file=self.out)
+        else:
+            print("%-32s %-28s %12.2f us" % (name, params, median),
+                  file=self.out)
+        self.out.flush()
+        return res
+
+
+def _sizes(start, limit, factor):
+    n = start
+    while n <= limit:
+        yield n
+        n *= factor
+
+
+def _keep_last(fn):
+    """
+    Returns a `(fn, sync)` pair for an operation that returns a new
+    array, where sync waits for the last array returned.
+    """
+    last = [None]
+
+    def call():
+        last[0] = fn()
+
+    return call, lambda: last[0].sync()
+
+
+def bench_buffer(r, ctx):
+    for sz in (256, 64 << 10, 4 << 20):
+        r.run('alloc.same', 'size=%d' % (sz,),
+              lambda: gpuarray.empty((sz,), dtype='int8', context=ctx))
+
+    if not r.enabled('transfer'):
+        return
+    for sz in _sizes(4096, r.max_bytes, 16):
+        host = numpy.empty((sz,), dtype='int8')
+        src = gpuarray.empty((sz,), dtype='int8', context=ctx)
+        dst = gpuarray.empty((sz,), dtype='int8', context=ctx)
+        params = 'size=%d' % (sz,)
+        r.run('transfer.htod', params, lambda: dst.write(host), dst.sync,
+              nbytes=sz)
+        r.run('transfer.dtoh', params, lambda: src.read(host), nbytes=sz)
+        r.run('transfer.dtod', params, lambda: dst.__setitem__(Ellipsis, src),
+              dst.sync, nbytes=2 * sz)
+
+
+_kern_src = """#include "cluda.h"
+/* bench %s.%d */
+KERNEL void k(GLOBAL_MEM ga_float *a, ga_size n) {
+  ga_size i;
+  for (i = LID_0 + GID_0 * LDIM_0; i < n; i += LDIM_0 * GDIM_0)
+    a[i] = a[i] * 2.0f + 1.0f;
+}
+"""
+
+_kern_types = [gpuarray.GpuArray, gpuarray.SIZE]
+
+
+def bench_kernel(r, ctx, dev):
+    if not r.enabled('kernel'):
+        return
+    # The nonce makes each source unique so they can't come from a
+    # cache unless we intend it.
+    base = '%x' % (int(default_timer() * 1e6),)
+    nonce = [1]
+
+    def compile_cold(c=ctx):
+        gpuarray.GpuKernel(_kern_src % (base, nonce[0]), 'k', _kern_types,
+                           context=c)
+        nonce[0] += 1
+
+    r.run('kernel.compile_cold', '', compile_cold, once=True)
+    r.run('kernel.compile_warm', '',
+          lambda: gpuarray.GpuKernel(_kern_src % (base, 0), 'k',
+                                     _kern_types, context=ctx))
+
+    if r.enabled('kernel.launch'):
+        buf = gpuarray.empty((1,), dtype='float32', context=ctx)
+        k = gpuarray.GpuKernel(_kern_src % (base, 0), 'k', _kern_types,
+                               context=ctx)
+        r.run('kernel.launch', '', lambda: k(buf, 1, gs=1, ls=1), buf.sync)
+
+    if not r.enabled('kernel.compile_disk'):
+        return
+    if not dev.startswith('cuda'):
+        r.skip('kernel.compile_disk', 'no disk cache for this backend')
+        return
+    d = tempfile.mkdtemp(prefix='pygpu_bench')
+    try:
+        # Populate the disk cache from one context and read it from
+        # another.
+        c1 = gpuarray.init(dev, kernel_cache_path=d)
+        nonce[0] = 100000
+        for _ in range(r.samples):
+            compile_cold(c1)
+        del c1
+        c2 = gpuarray.init(dev, kernel_cache_path=d)
+        nonce[0] = 100000
+        r.run('kernel.compile_disk', '', lambda: compile_cold(c2), once=True)
+        del c2
+    except Exception as e:
+        r.error('kernel.compile_disk', e)
+    finally:
+        shutil.rmtree(d, ignore_errors=True)
+
+
+def bench_elemwise(r, ctx):
+    if not r.enabled('elemwise'):
+        return
+    k = GpuElemwise(ctx, 'c = a + b', [arg('a', 'float32', read=True),
+                                       arg('b', 'float32', read=True),
+                                       arg('c', 'float32', write=True)])
+
+    def empty(shape):
+        return gpuarray.empty(shape, dtype='float32', context=ctx)
+
+    for n in _sizes(1 << 10, r.max_bytes // 8, 8):
+        params = 'n=%d' % (n,)
+        a, b, c = empty((n,)), empty((n,)), empty((n,))
+        r.run('elemwise.contig', params, lambda: k(a, b, c), c.sync,
+              nbytes=12 * n)
+        if r.enabled('elemwise.strided'):
+            a, b, c = (empty((2 * n,))[::2], empty((2 * n,))[::2],
+                       empty((2 * n,))[::2])
+            r.run('elemwise.strided', params, lambda: k(a, b, c), c.sync,
+                  nbytes=12 * n)
+        a, b, c = empty((n // 1024, 1024)), empty((1, 1024)), \
+            empty((n // 1024, 1024))
+        r.run('elemwise.broadcast', params,
+              lambda: k(a, b, c, broadcast=True), c.sync, nbytes=8 * n)
+        # The whole python path, including the output allocation
+        a = gpuarray.empty((n,), dtype='float32', context=ctx,
+                           cls=ndgpuarray)
+        r.run('elemwise.operator', params, *_keep_last(lambda: a + a),
+              nbytes=12 * n)
+
+
+def bench_reduction(r, ctx):
+    if not r.enabled('reduction'):
+        return
+    shape = [64, 256, 256]
+    while shape[0] > 1 and shape[0] * shape[1] * shape[2] * 4 > r.max_bytes:
+        shape[0] //= 2
+    a = gpuarray.empty(shape, dtype='float32', context=ctx)
+    for axes in ((0,), (1,), (2,), (0, 2), (1, 2), (0, 1, 2)):
+        out = gpuarray.empty([d for i, d in enumerate(shape)
+                              if i not in axes],
+                             dtype='float32', context=ctx)
+        params = 'shape=%dx%dx%d,axes=%s' % (
+            tuple(shape) + (','.join(str(ax) for ax in axes),))
+        r.run('reduction.sum', params,
+              lambda: reduce1(a, '+', '0', 'float32', axis=axes, out=out),
+              out.sync, nbytes=a.size * 4)
+
+
+def bench_take1(r, ctx):
+    if not r.enabled('take1'):
+        return
+    rows = 1024
+    while rows * 64 * 4 * 2 <= r.max_bytes:
+        v = gpuarray.empty((rows, 64), dtype='float32', context=ctx)
+        rng = numpy.random.RandomState(42)
+        idx = gpuarray.asarray(rng.randint(0, rows, rows // 2).astype('int64'),
+                               context=ctx)
+        params = 'rows=%d,cols=64,n=%d' % (rows, rows // 2)
+        for name, deferred in (('take1.deferred', True),
+                               ('take1.sync', False)):
+            r.run(name, params,
+                  *_keep_last(lambda: v.take1(idx, deferred=deferred)),
+                  nbytes=2 * (rows // 2) * 64 * 4)
+        rows *= 16
+
+
+def bench_blas(r, ctx):
+    if not r.enabled('blas'):
+        return
+    try:
+        from . import blas
+    except ImportError as e:
+        r.skip('blas', str(e))
+        return
+
+    for m, n, k in ((256, 256, 256), (1024, 1024, 1024), (2048, 2048, 2048),
+                    (8192, 8192, 64), (64, 64, 8192), (8192, 64, 1024)):
+        if (m * k + k * n + m * n) * 4 > r.max_bytes:
+            continue
+        A = gpuarray.zeros((m, k), dtype='float32', context=ctx)
+        B = gpuarray.zeros((k, n), dtype='float32', context=ctx)
+        C = gpuarray.zeros((m, n), dtype='float32', context=ctx)
+        res = r.run('blas.gemm', 'm=%d,n=%d,k=%d' % (m, n, k),
+                    lambda: blas.gemm(1.0, A, B, 0.0, C, overwrite_c=True),
+                    C.sync)
+        if res is None and r.enabled('blas.gemm'):
+            break
+
+    for m in (1024, 4096):
+        if (m * m + 2 * m) * 4 > r.max_bytes:
+            continue
+        A = gpuarray.zeros((m, m), dtype='float32', context=ctx)
+        x = gpuarray.zeros((m,), dtype='float32', context=ctx)
+        y = gpuarray.zeros((m,), dtype='float32', context=ctx)
+        res = r.run('blas.gemv', 'm=%d,n=%d' % (m, m),
+                    lambda: blas.gemv(1.0, A, x, 0.0, y, overwrite_y=True),
+                    y.sync, nbytes=m * m * 4)
+        if res is None and r.enabled('blas.gemv'):
+            break
+
+
+def bench_collectives(r, ctx):
+    # Single-rank communicator: measures the per-call overhead and the
+    # local part of the operations, not the interconnect.
+    if not r.enabled('collectives'):
+        return
+    try:
+        from .collectives import GpuCommCliqueId, GpuComm
+        comm = GpuComm(GpuCommCliqueId(context=ctx), 1, 0)
+    except Exception as e:
+        r.skip('collectives', str(e))
+        return
+    for count in _sizes(1024, r.max_bytes // 4, 16):
+        src = gpuarray.zeros((count,), dtype='float32', context=ctx)
+        dst = gpuarray.zeros((count,), dtype='float32', context=ctx)
+        params = 'ranks=1,count=%d' % (count,)
+        r.run('collectives.all_reduce', params,
+              lambda: comm.all_reduce(src, 'sum', dst), dst.sync,
+              nbytes=8 * count)
+        r.run('collectives.all_gather', params,
+              lambda: comm.all_gather(src, dst), dst.sync, nbytes=8 * count)
+        r.run('collectives.broadcast', params,
+              lambda: comm.broadcast(dst, root=0), dst.sync,
+              nbytes=4 * count)
+
+
+def run_all(r, ctx, dev):
+    """Run all the benchmarks selected in `r` on `ctx`."""
+    bench_buffer(r, ctx)
+    bench_kernel(r, ctx, dev)
+    bench_elemwise(r, ctx)
+    bench_reduction(r, ctx)
+    bench_take1(r, ctx)
+    bench_blas(r, ctx)
+    bench_collectives(r, ctx)
+
+
+def write_results(f, results, device, devname):
+    """Write `results` to the file object `f`."""
+    f.write('{\n  "device": %s,\n  "devname": %s,\n  "results": [\n' %
+            (json.dumps(device), json.dumps(devname)))
+    for i, res in enumerate(results):
+        f.write('    {"name": %s, "params": %s, "samples": %d, '
+                '"iters": %d, "min_us": %.3f, "median_us": %.3f, '
+                '"mean_us": %.3f, "bytes": %d}%s\n' % (
+                    json.dumps(res['name']), json.dumps(res['params']),
+                    res['samples'], res['iters'], res['min_us'],
+                    res['median_us'], res['mean_us'], res['bytes'],
+                    ',' if i + 1 < len(results) else ''))
+    f.write('  ]\n}\n')
+
+
+def load_results(f):
+    """Read the results from the file object `f`."""
+    return json.load(f)['results']
+
+
+def compare(results, baseline, threshold=0.1, out=sys.stdout):
+    """
+    Print the benchmarks that changed by more than `threshold`
+    relative to `baseline` and return the list of those that got
+    slower as `(result, baseline_median)` pairs.
+    """
+    base = dict(((b['name'], b['params']), b['median_us'])
+                for b in baseline)
+    slower = []
+    faster = missing = 0
+    print("\nComparison against baseline (threshold %.0f%%):" %
+          (threshold * 100,), file=out)
+    for res in results:
+        old = base.get((res['name'], res['params']))
+        if not old:
+            missing += 1
+            continue
+        ratio = res['median_us'] / old
+        if ratio > 1 + threshold:
+            slower.append((res, old))
+        elif ratio < 1 - threshold:
+            faster += 1
+        else:
+            continue
+        print("%-32s %-28s %10.2f -> %10.2f us  %+6.1f%%%s" %
+              (res['name'], res['params'], old, res['median_us'],
+               (ratio - 1) * 100, "  REGRESSION" if ratio > 1 else ""),
+              file=out)
+    print("%d slower, %d faster, %d unchanged, %d not in baseline" %
+          (len(slower), faster,
+           len(results) - len(slower) - faster - missing, missing),
+          file=out)
+    return slower
+
+
+def main(argv=None):
+    p = argparse.ArgumentParser(prog='python -m pygpu.bench',
+                                description='Run the pygpu benchmarks.')
+    p.add_argument('-d', dest='dev',
+                   default=os.environ.get('GPUARRAY_TEST_DEVICE',
+                                          os.environ.get('DEVICE')),
+                   help='device to use (default $GPUARRAY_TEST_DEVICE '
+                   'or $DEVICE)')
+    p.add_argument('-o', dest='out',
+                   help="write the results as JSON to OUT ('-' for stdout)")
+    p.add_argument('-b', dest='baseline', help='compare against BASELINE')
+    p.add_argument('-t', dest='threshold', type=float, default=0.1,
+                   help='relative slowdown reported as a regression')
+    p.add_argument('-n', dest='samples', type=int, default=10,
+                   help='number of samples per benchmark')
+    p.add_argument('-m', dest='max_mb', type=int, default=64,
+                   help='largest buffer size to use in MiB')
+    p.add_argument('-f', dest='filters', action='append', default=[],
+                   metavar='PREFIX',
+                   help='only run benchmarks starting with PREFIX')
+    args = p.parse_args(argv)
+    if args.dev is None or args.samples <= 0 or args.max_mb <= 0:
+        p.error('need a device, a positive sample count and size')
+
+    baseline = None
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = load_results(f)
+
+    ctx = gpuarray.init(args.dev)
+    r = Runner(samples=args.samples, filters=args.filters,
+               max_bytes=args.max_mb << 20)
+    run_all(r, ctx, args.dev)
+
+    if args.out == '-':
+        write_results(sys.stdout, r.results, args.dev, ctx.devname)
+    elif args.out:
+        with open(args.out, 'w') as f:
+            write_results(f, r.results, args.dev, ctx.devname)
+    slower = []
+    if baseline is not None:
+        slower = compare(r.results, baseline, args.threshold)
+    return 1 if (r.failures or slower) else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -9,7 +9,7 @@ cdef extern from "gpuarray/buffer_blas.h":
         cb_trans,
         cb_conj_trans
 
-cdef extern from "gpuarray/blas.h":
+cdef extern from "gpuarray/blas.h" nogil:
     int GpuArray_rdot(_GpuArray *X, _GpuArray *Y, _GpuArray *Z, int nocopy)
     int GpuArray_rgemv(cb_transpose transA, double alpha, _GpuArray *A,
                        _GpuArray *X, double beta, _GpuArray *Y, int nocopy)
@@ -24,7 +24,8 @@ cdef extern from "gpuarray/blas.h":
 
 cdef api int pygpu_blas_rdot(GpuArray X, GpuArray Y, GpuArray Z, bint nocopy) except -1:
     cdef int err
-    err = GpuArray_rdot(&X.ga, &Y.ga, &Z.ga, nocopy)
+    with nogil:
+        err = GpuArray_rdot(&X.ga, &Y.ga, &Z.ga, nocopy)
     if err != GA_NO_ERROR:
         raise GpuArrayException(GpuArray_error(&X.ga, err), err)
     return 0
@@ -33,7 +34,8 @@ cdef api int pygpu_blas_rgemv(cb_transpose transA, double alpha, GpuArray A,
                               GpuArray X, double beta, GpuArray Y,
                               bint nocopy) except -1:
     cdef int err
-    err = GpuArray_rgemv(transA, alpha, &A.ga, &X.ga, beta, &Y.ga, nocopy);
+    with nogil:
+        err = GpuArray_rgemv(transA, alpha, &A.ga, &X.ga, beta, &Y.ga, nocopy)
     if err != GA_NO_ERROR:
         raise GpuArrayException(GpuArray_error(&A.ga, err), err)
     return 0
@@ -42,7 +44,9 @@ cdef api int pygpu_blas_rgemm(cb_transpose transA, cb_transpose transB,
                               double alpha, GpuArray A, GpuArray B,
                               double beta, GpuArray C, bint nocopy) except -1:
     cdef int err
-    err = GpuArray_rgemm(transA, transB, alpha, &A.ga, &B.ga, beta, &C.ga, nocopy);
+    with nogil:
+        err = GpuArray_rgemm(transA, transB, alpha, &A.ga, &B.ga, beta, &C.ga,
+                             nocopy)
     if err != GA_NO_ERROR:
         raise GpuArrayException(GpuArray_error(&A.ga, err), err)
     return 0
@@ -50,7 +54,8 @@ cdef api int pygpu_blas_rgemm(cb_transpose transA, cb_transpose transB,
 cdef api int pygpu_blas_rger(double alpha, GpuArray X, GpuArray Y, GpuArray A,
                              bint nocopy) except -1:
     cdef int err
-    err = GpuArray_rger(alpha, &X.ga, &Y.ga, &A.ga, nocopy);
+    with nogil:
+        err = GpuArray_rger(alpha, &X.ga, &Y.ga, &A.ga, nocopy)
     if err != GA_NO_ERROR:
         raise GpuArrayException(GpuArray_error(&X.ga, err), err)
     return 0
@@ -59,9 +64,10 @@ cdef api int pygpu_blas_rgemmBatch_3d(cb_transpose transA, cb_transpose transB,
                                       double alpha, GpuArray A, GpuArray B,
                                       double beta, GpuArray C, bint nocopy) except -1:
     cdef int err
-    err = GpuArray_rgemmBatch_3d(transA, transB,
-                                 alpha, &A.ga, &B.ga,
-                                 beta, &C.ga, nocopy)
+    with nogil:
+        err = GpuArray_rgemmBatch_3d(transA, transB,
+                                     alpha, &A.ga, &B.ga,
+                                     beta, &C.ga, nocopy)
     if err != GA_NO_ERROR:
         raise GpuArrayException(GpuArray_error(&A.ga, err), err)
     return 0
@@ -23,6 +23,15 @@ cdef extern from "gpuarray/buffer_collectives.h":
     int gpucomm_get_count(gpucomm* comm, int* gpucount)
     int gpucomm_get_rank(gpucomm* comm, int* rank)
 
+    int gpucomm_group_start(gpucomm* comm)
+    int gpucomm_group_end(gpucomm* comm)
+
+    ctypedef struct gpucomm_request:
+        pass
+    int gpucomm_request_test(gpucomm_request* req, int* done)
+    int gpucomm_request_wait(gpucomm_request* req) nogil
+    void gpucomm_request_free(gpucomm_request* req)
+
 cdef extern from "gpuarray/collectives.h" nogil:
     int GpuArray_reduce_from(const _GpuArray* src, int opcode,
                              int root, gpucomm* comm)
@@ -34,6 +43,48 @@ cdef extern from "gpuarray/collectives.h" nogil:
                                 int opcode, gpucomm* comm)
     int GpuArray_broadcast(_GpuArray* array, int root, gpucomm* comm)
     int GpuArray_all_gather(const _GpuArray* src, _GpuArray* dest, gpucomm* comm)
+    int GpuArray_send(const _GpuArray* src, int peer, gpucomm* comm)
+    int GpuArray_recv(_GpuArray* dest, int peer, gpucomm* comm)
+    int GpuArray_all_to_all(const _GpuArray* src, _GpuArray* dest,
+                            gpucomm* comm)
+    int GpuArray_all_to_allv(const _GpuArray* src, const size_t* sendcounts,
+                             const size_t* sdispls, _GpuArray* dest,
+                             const size_t* recvcounts, const size_t* rdispls,
+                             gpucomm* comm)
+
+    enum gpucomm_compression:
+        GA_COMPRESS_HALF,
+        GA_COMPRESS_TOPK
+    int GpuArray_all_reduce_compressed(const _GpuArray* src, _GpuArray* dest,
+                                       int opcode, int mode, size_t k,
+                                       _GpuArray* residual, gpucomm* comm)
+
+    int GpuArray_reduce_from_async(const _GpuArray* src, int opcode,
+                                   int root, gpucomm* comm,
+                                   gpucomm_request** req)
+    int GpuArray_reduce_async(const _GpuArray* src, _GpuArray* dest,
+                              int opcode, int root, gpucomm* comm,
+                              gpucomm_request** req)
+    int GpuArray_all_reduce_async(const _GpuArray* src, _GpuArray* dest,
+                                  int opcode, gpucomm* comm,
+                                  gpucomm_request** req)
+    int GpuArray_reduce_scatter_async(const _GpuArray* src, _GpuArray* dest,
+                                      int opcode, gpucomm* comm,
+                                      gpucomm_request** req)
+    int GpuArray_broadcast_async(_GpuArray* array, int root, gpucomm* comm,
+                                 gpucomm_request** req)
+    int GpuArray_all_gather_async(const _GpuArray* src, _GpuArray* dest,
+                                  gpucomm* comm, gpucomm_request** req)
+
+    ctypedef struct gpucomm_bucket:
+        pass
+    int gpucomm_bucket_new(gpucomm_bucket** bucket, gpucomm* comm,
+                           int typecode, int opcode, size_t bucket_size)
+    void gpucomm_bucket_free(gpucomm_bucket* bucket)
+    int gpucomm_bucket_add(gpucomm_bucket* bucket, _GpuArray* a,
+                           unsigned int* idx)
+    int gpucomm_bucket_ready(gpucomm_bucket* bucket, unsigned int idx)
+    int gpucomm_bucket_flush(gpucomm_bucket* bucket)
 
 cdef api class GpuCommCliqueId [type PyGpuCliqueIdType, object PyGpuCliqueIdObject]:
     cdef gpucommCliqueId c_comm_id
@@ -44,6 +95,16 @@ cdef api class GpuComm [type PyGpuCommType, object PyGpuCommObject]:
     cdef gpucomm* c
     cdef object __weakref__
 
+cdef class GpuCommRequest:
+    cdef gpucomm_request* r
+    cdef readonly GpuComm comm
+    cdef tuple arrays
+
+cdef class GpuCommBucket:
+    cdef gpucomm_bucket* b
+    cdef readonly GpuComm comm
+    cdef list arrays
+
 
 cdef int to_reduce_opcode(op) except -1
 
@@ -61,6 +122,8 @@ cdef int comm_reduce_scatter(GpuComm comm, GpuArray src, GpuArray dest,
                              int opcode) except -1
 cdef int comm_broadcast(GpuComm comm, GpuArray arr, int root) except -1
 cdef int comm_all_gather(GpuComm comm, GpuArray src, GpuArray dest) except -1
+cdef GpuCommRequest comm_request(GpuComm comm, int err, gpucomm_request* req,
+                                 tuple arrays)
 
 cdef api:
     GpuArray pygpu_make_reduced(GpuComm comm, GpuArray src, int opcode)
@@ -9,7 +9,8 @@ from pygpu.gpuarray cimport (gpucontext, GpuContext, _GpuArray, GpuArray,
                              GA_NO_ERROR, get_exc, gpucontext_error,
                              GpuArray_IS_C_CONTIGUOUS,
                              GA_C_ORDER, GA_F_ORDER, GA_ANY_ORDER,
-                             pygpu_empty_like, pygpu_empty, memcpy)
+                             pygpu_empty_like, pygpu_empty, memcpy,
+                             dtype_to_typecode)
 from pygpu.gpuarray import GpuArrayException
 
 
@@ -268,6 +269,444 @@ cdef class GpuComm:
             return pygpu_make_all_gathered(self, src, nd_up)
         comm_all_gather(self, src, dest)
 
+    def send(self, GpuArray src not None, int peer):
+        """
+        send(self, src, peer)
+
+        Send `src` to rank `peer`, which must call :meth:`recv` with an
+        array of the same size.
+
+        Notes
+        -----
+        * Exchanges that go in both directions must be put inside
+          :meth:`group_start` and :meth:`group_end`.
+
+        """
+        cdef int err
+        with nogil:
+            err = GpuArray_send(&src.ga, peer, self.c)
+        if err != GA_NO_ERROR:
+            raise get_exc(err), gpucontext_error(comm_context(self), err)
+
+    def recv(self, GpuArray dest not None, int peer):
+        """
+        recv(self, dest, peer)
+
+        Receive in `dest` an array sent by rank `peer`.
+
+        """
+        cdef int err
+        with nogil:
+            err = GpuArray_recv(&dest.ga, peer, self.c)
+        if err != GA_NO_ERROR:
+            raise get_exc(err), gpucontext_error(comm_context(self), err)
+
+    def group_start(self):
+        """
+        group_start(self)
+
+        Start a group of :meth:`send` and :meth:`recv` which are issued
+        together by :meth:`group_end`.
+
+        """
+        cdef int err
+        err = gpucomm_group_start(self.c)
+        if err != GA_NO_ERROR:
+            raise get_exc(err), gpucontext_error(comm_context(self), err)
+
+    def group_end(self):
+        """
+        group_end(self)
+
+        End a group started by :meth:`group_start`.
+
+        """
+        cdef int err
+        err = gpucomm_group_end(self.c)
+        if err != GA_NO_ERROR:
+            raise get_exc(err), gpucontext_error(comm_context(self), err)
+
+    def all_to_all(self, GpuArray src not None, GpuArray dest=None):
+        """
+        all_to_all(self, src, dest=None)
+
+        AllToAll collective operation for ranks in a communicator world.
+
+        Parameters
+        ----------
+        src: GpuArray
+            C contiguous array split in `count` blocks along its
+            flattened order. Block `i` is sent to rank `i`.
+        dest: GpuArray
+            Array to receive the block from each rank in rank order.
+
+        Notes
+        -----
+        * Not providing `dest` argument for a caller will result in creating
+          a new compatible :class:`GpuArray` and returning result in it.
+
+        """
+        cdef int err
+        if dest is None:
+            dest = pygpu_empty_like(src, GA_C_ORDER, -1)
+            res = dest
+        else:
+            res = None
+        with nogil:
+            err = GpuArray_all_to_all(&src.ga, &dest.ga, self.c)
+        if err != GA_NO_ERROR:
+            raise get_exc(err), gpucontext_error(comm_context(self), err)
+        return res
+
+    def all_to_allv(self, GpuArray src not None, sendcounts,
+                    GpuArray dest not None, recvcounts, sdispls=None,
+                    rdispls=None):
+        """
+        all_to_allv(self, src, sendcounts, dest, recvcounts, sdispls=None, rdispls=None)
+
+        AllToAllv collective operation for ranks in a communicator world.
+
+        Parameters
+        ----------
+        src: GpuArray
+            C contiguous array to be scattered.
+        sendcounts: sequence of int
+            Number of elements to send to each rank.
+        dest: GpuArray
+            C contiguous array to receive the blocks.
+        recvcounts: sequence of int
+            Number of elements to receive from each rank.
+        sdispls: sequence of int
+            Position of the block for each rank in the flattened
+            `src`. By default the blocks follow each other.
+        rdispls: sequence of int
+            Position of the block from each rank in the flattened
+            `dest`. By default the blocks follow each other.
+
+        """
+        cdef int ndev
+        cdef int err
+        cdef size_t *buf
+        cdef size_t *sc
+        cdef size_t *sd
+        cdef size_t *rc
+        cdef size_t *rd
+        cdef int i
+        comm_get_count(self, &ndev)
+        if (len(sendcounts) != ndev or len(recvcounts) != ndev or
+                (sdispls is not None and len(sdispls) != ndev) or
+                (rdispls is not None and len(rdispls) != ndev)):
+            raise ValueError, "Counts and displacements need one entry per rank"
+        buf = <size_t *>malloc(4 * ndev * sizeof(size_t))
+        if buf is NULL:
+            raise MemoryError
+        sc = buf
+        sd = buf + ndev
+        rc = buf + 2 * ndev
+        rd = buf + 3 * ndev
+        try:
+            for i in range(ndev):
+                sc[i] = sendcounts[i]
+                rc[i] = recvcounts[i]
+                if sdispls is None:
+                    sd[i] = 0 if i == 0 else sd[i - 1] + sc[i - 1]
+                else:
+                    sd[i] = sdispls[i]
+                if rdispls is None:
+                    rd[i] = 0 if i == 0 else rd[i - 1] + rc[i - 1]
+                else:
+                    rd[i] = rdispls[i]
+            with nogil:
+                err = GpuArray_all_to_allv(&src.ga, sc, sd, &dest.ga, rc, rd,
+                                           self.c)
+        finally:
+            free(buf)
+        if err != GA_NO_ERROR:
+            raise get_exc(err), gpucontext_error(comm_context(self), err)
+
+    def all_reduce_compressed(self, GpuArray src not None, op,
+                              GpuArray dest=None, mode='half', size_t k=0,
+                              GpuArray residual=None):
+        """
+        all_reduce_compressed(self, src, op, dest=None, mode='half', k=0, residual=None)
+
+        AllReduce collective operation which sends a compressed
+        version of `src`.
+
+        Parameters
+        ----------
+        src: GpuArray
+            C contiguous float32 or float64 array to be reduced.
+        op: str
+            Key indicating operation type.
+        dest: GpuArray
+            Array to collect reduce operation result.
+        mode: str
+            'half' exchanges the data as float16.  'topk' exchanges
+            only the `k` elements of largest magnitude of each rank
+            and requires `op` to be 'sum'.
+        k: int
+            Number of elements sent by each rank in 'topk' mode.
+        residual: GpuArray
+            Error feedback array like `src`, initially zeros.  It is
+            added to `src` before compressing and receives what the
+            compression dropped.
+
+        Notes
+        -----
+        * Not providing `dest` argument for a caller will result in creating
+          a new compatible :class:`GpuArray` and returning result in it.
+
+        """
+        cdef int err
+        cdef int opcode
+        cdef int cmode
+        cdef _GpuArray *r = NULL
+        if mode == 'half':
+            cmode = GA_COMPRESS_HALF
+        elif mode == 'topk':
+            cmode = GA_COMPRESS_TOPK
+        else:
+            raise ValueError, "Invalid compression mode: %s" % (str(mode),)
+        if residual is not None:
+            r = &residual.ga
+        if dest is None:
+            dest = pygpu_empty_like(src, GA_C_ORDER, -1)
+            res = dest
+        else:
+            res = None
+        opcode = to_reduce_opcode(op)
+        with nogil:
+            err = GpuArray_all_reduce_compressed(&src.ga, &dest.ga,
+                                                 opcode, cmode, k, r, self.c)
+        if err != GA_NO_ERROR:
+            raise get_exc(err), gpucontext_error(comm_context(self), err)
+        return res
+
+    def reduce_async(self, GpuArray src not None, op, GpuArray dest=None,
+                     int root=-1):
+        """
+        reduce_async(self, src, op, dest=None, root=-1)
+
+        Asynchronous version of :meth:`reduce`.
+
+        Returns a :class:`GpuCommRequest` which completes with the
+        operation.  `dest` is required on the root rank.
+
+        """
+        cdef gpucomm_request* req = NULL
+        cdef int err
+        cdef int srank
+        comm_get_rank(self, &srank)
+        if root == -1:
+            root = srank
+        if root == srank:
+            if dest is None:
+                raise ValueError, "dest is required on the root rank"
+            err = GpuArray_reduce_async(&src.ga, &dest.ga,
+                                        to_reduce_opcode(op), root, self.c,
+                                        &req)
+            return comm_request(self, err, req, (src, dest))
+        err = GpuArray_reduce_from_async(&src.ga, to_reduce_opcode(op), root,
+                                         self.c, &req)
+        return comm_request(self, err, req, (src,))
+
+    def all_reduce_async(self, GpuArray src not None, op,
+                         GpuArray dest not None):
+        """
+        all_reduce_async(self, src, op, dest)
+
+        Asynchronous version of :meth:`all_reduce`.
+
+        Returns a :class:`GpuCommRequest` which completes with the
+        operation.
+
+        """
+        cdef gpucomm_request* req = NULL
+        cdef int err
+        err = GpuArray_all_reduce_async(&src.ga, &dest.ga,
+                                        to_reduce_opcode(op), self.c, &req)
+        return comm_request(self, err, req, (src, dest))
+
+    def reduce_scatter_async(self, GpuArray src not None, op,
+                             GpuArray dest not None):
+        """
+        reduce_scatter_async(self, src, op, dest)
+
+        Asynchronous version of :meth:`reduce_scatter`.
+
+        Returns a :class:`GpuCommRequest` which completes with the
+        operation.
+
+        """
+        cdef gpucomm_request* req = NULL
+        cdef int err
+        err = GpuArray_reduce_scatter_async(&src.ga, &dest.ga,
+                                            to_reduce_opcode(op), self.c,
+                                            &req)
+        return comm_request(self, err, req, (src, dest))
+
+    def broadcast_async(self, GpuArray array not None, int root=-1):
+        """
+        broadcast_async(self, array, root=-1)
+
+        Asynchronous version of :meth:`broadcast`.
+
+        Returns a :class:`GpuCommRequest` which completes with the
+        operation.
+
+        """
+        cdef gpucomm_request* req = NULL
+        cdef int err
+        if root == -1:
+            comm_get_rank(self, &root)
+        err = GpuArray_broadcast_async(&array.ga, root, self.c, &req)
+        return comm_request(self, err, req, (array,))
+
+    def all_gather_async(self, GpuArray src not None, GpuArray dest not None):
+        """
+        all_gather_async(self, src, dest)
+
+        Asynchronous version of :meth:`all_gather`.
+
+        Returns a :class:`GpuCommRequest` which completes with the
+        operation.
+
+        """
+        cdef gpucomm_request* req = NULL
+        cdef int err
+        err = GpuArray_all_gather_async(&src.ga, &dest.ga, self.c, &req)
+        return comm_request(self, err, req, (src, dest))
+
+
+cdef class GpuCommRequest:
+    """
+    Completion handle of an asynchronous collective operation.
+
+    Collectives run on a stream of their own and later operations on
+    the same arrays wait for them on the device, so waiting on the
+    request is only needed to synchronize with the host.
+
+    """
+    def __dealloc__(self):
+        gpucomm_request_free(self.r)
+
+    def __reduce__(self):
+        raise RuntimeError, "Cannot pickle %s object" % self.__class__.__name__
+
+    def test(self):
+        """
+        test(self)
+
+        Return True if the operation has completed, without blocking.
+
+        """
+        cdef int done
+        cdef int err
+        err = gpucomm_request_test(self.r, &done)
+        if err != GA_NO_ERROR:
+            raise get_exc(err), gpucontext_error(comm_context(self.comm), err)
+        return done != 0
+
+    def wait(self):
+        """
+        wait(self)
+
+        Block until the operation has completed.
+
+        """
+        cdef int err
+        with nogil:
+            err = gpucomm_request_wait(self.r)
+        if err != GA_NO_ERROR:
+            raise get_exc(err), gpucontext_error(comm_context(self.comm), err)
+
+
+cdef class GpuCommBucket:
+    """GpuCommBucket(comm, dtype, op='sum', bucket_size=0)
+
+    Group of arrays that are all-reduced in place together.
+
+    The registered arrays are packed in buckets of at most
+    `bucket_size` bytes and each bucket is reduced with a single
+    collective instead of one per array.
+
+    Parameters
+    ----------
+    comm: GpuComm
+        Communicator to use.
+    dtype: data type
+        Type of the registered arrays.
+    op: str
+        Key indicating operation type.
+    bucket_size: int
+        Upper bound on the size of a bucket in bytes (0 for the
+        default of 25MB).
+
+    Notes
+    -----
+    * All ranks must register arrays of the same sizes in the same
+      order.
+
+    """
+    def __cinit__(self, GpuComm comm not None, dtype, op='sum',
+                  size_t bucket_size=0):
+        cdef int err
+        self.comm = comm
+        self.arrays = []
+        err = gpucomm_bucket_new(&self.b, comm.c, dtype_to_typecode(dtype),
+                                 to_reduce_opcode(op), bucket_size)
+        if err != GA_NO_ERROR:
+            raise get_exc(err), gpucontext_error(comm_context(comm), err)
+
+    def __dealloc__(self):
+        gpucomm_bucket_free(self.b)
+
+    def __reduce__(self):
+        raise RuntimeError, "Cannot pickle %s object" % self.__class__.__name__
+
+    def add(self, GpuArray a not None):
+        """
+        add(self, a)
+
+        Register `a` and return its index for :meth:`ready`.
+
+        """
+        cdef unsigned int idx
+        cdef int err
+        err = gpucomm_bucket_add(self.b, &a.ga, &idx)
+        if err != GA_NO_ERROR:
+            raise get_exc(err), gpucontext_error(comm_context(self.comm), err)
+        # The bucket refers to the array structure, keep it alive
+        self.arrays.append(a)
+        return idx
+
+    def ready(self, unsigned int idx):
+        """
+        ready(self, idx)
+
+        Mark the array at `idx` as ready for this round.  Buckets are
+        reduced as soon as they are full.
+
+        """
+        cdef int err
+        err = gpucomm_bucket_ready(self.b, idx)
+        if err != GA_NO_ERROR:
+            raise get_exc(err), gpucontext_error(comm_context(self.comm), err)
+
+    def flush(self):
+        """
+        flush(self)
+
+        Reduce whatever was not reduced in this round and start a new
+        one.
+
+        """
+        cdef int err
+        err = gpucomm_bucket_flush(self.b)
+        if err != GA_NO_ERROR:
+            raise get_exc(err), gpucontext_error(comm_context(self.comm), err)
+
 
 cdef dict TO_RED_OP = {
     '+': GA_SUM,
@@ -317,42 +756,60 @@ cdef int comm_get_rank(GpuComm comm, int* gpurank) except -1:
 cdef int comm_reduce_from(GpuComm comm, GpuArray src, int opcode,
                           int root) except -1:
     cdef int err
-    err = GpuArray_reduce_from(&src.ga, opcode, root, comm.c)
+    with nogil:
+        err = GpuArray_reduce_from(&src.ga, opcode, root, comm.c)
     if err != GA_NO_ERROR:
         raise get_exc(err), gpucontext_error(comm_context(comm), err)
 
 cdef int comm_reduce(GpuComm comm, GpuArray src, GpuArray dest, int opcode,
                      int root) except -1:
     cdef int err
-    err = GpuArray_reduce(&src.ga, &dest.ga, opcode, root, comm.c)
+    with nogil:
+        err = GpuArray_reduce(&src.ga, &dest.ga, opcode, root, comm.c)
     if err != GA_NO_ERROR:
         raise get_exc(err), gpucontext_error(comm_context(comm), err)
 
 cdef int comm_all_reduce(GpuComm comm, GpuArray src, GpuArray dest,
                          int opcode) except -1:
     cdef int err
-    err = GpuArray_all_reduce(&src.ga, &dest.ga, opcode, comm.c)
+    with nogil:
+        err = GpuArray_all_reduce(&src.ga, &dest.ga, opcode, comm.c)
     if err != GA_NO_ERROR:
         raise get_exc(err), gpucontext_error(comm_context(comm), err)
 
 cdef int comm_reduce_scatter(GpuComm comm, GpuArray src, GpuArray dest,
                              int opcode) except -1:
     cdef int err
-    err = GpuArray_reduce_scatter(&src.ga, &dest.ga, opcode, comm.c)
+    with nogil:
+        err = GpuArray_reduce_scatter(&src.ga, &dest.ga, opcode, comm.c)
     if err != GA_NO_ERROR:
         raise get_exc(err), gpucontext_error(comm_context(comm), err)
 
 cdef int comm_broadcast(GpuComm comm, GpuArray arr, int root) except -1:
     cdef int err
-    err = GpuArray_broadcast(&arr.ga, root, comm.c)
+    with nogil:
+        err = GpuArray_broadcast(&arr.ga, root, comm.c)
     if err != GA_NO_ERROR:
         raise get_exc(err), gpucontext_error(comm_context(comm), err)
 
 cdef int comm_all_gather(GpuComm comm, GpuArray src, GpuArray dest) except -1:
     cdef int err
-    err = GpuArray_all_gather(&src.ga, &dest.ga, comm.c)
+    with nogil:
+        err = GpuArray_all_gather(&src.ga, &dest.ga, comm.c)
+    if err != GA_NO_ERROR:
+        raise get_exc(err), gpucontext_error(comm_context(comm), err)
+
+cdef GpuCommRequest comm_request(GpuComm comm, int err, gpucomm_request* req,
+                                 tuple arrays):
+    cdef GpuCommRequest res
     if err != GA_NO_ERROR:
         raise get_exc(err), gpucontext_error(comm_context(comm), err)
+    res = GpuCommRequest.__new__(GpuCommRequest)
+    res.r = req
+    res.comm = comm
+    # Keep the arrays alive while the operation may be running
+    res.arrays = arrays
+    return res
 
 cdef api GpuArray pygpu_make_reduced(GpuComm comm, GpuArray src, int opcode):
     cdef GpuArray res
@@ -1,7 +1,7 @@
 import numpy
 
 from .dtypes import dtype_to_ctype, get_common_dtype
-from . import gpuarray
+from . import gpuarray, _stats
 from ._elemwise import GpuElemwise, arg
 
 __all__ = ['GpuElemwise', 'arg', 'as_argument',
@@ -23,6 +23,7 @@ def as_argument(o, name, read=False, write=False):
 
 def elemwise1(a, op, oper=None, op_tmpl="res = %(op)sa", out=None,
               convert_f16=True):
+    t = _stats.start()
     args = (as_argument(a, 'res', write=True), as_argument(a, 'a', read=True))
     if out is None:
         res = a._empty_like_me()
@@ -32,14 +33,18 @@ def elemwise1(a, op, oper=None, op_tmpl="res = %(op)sa", out=None,
     if oper is None:
         oper = op_tmpl % {'op': op}
 
+    t = _stats.record('elemwise1', 'codegen', t)
     k = GpuElemwise(a.context, oper, args, convert_f16=convert_f16)
+    t = _stats.record('elemwise1', 'compile', t)
     k(res, a)
+    _stats.record('elemwise1', 'launch', t)
     return res
 
 
 def elemwise2(a, op, b, ary, odtype=None, oper=None,
               op_tmpl="res = (%(out_t)s)a %(op)s (%(out_t)s)b",
               broadcast=False, convert_f16=True):
+    t = _stats.start()
     ndim_extend = True
     if not isinstance(a, gpuarray.GpuArray):
         a = numpy.asarray(a)
@@ -73,13 +78,17 @@ def elemwise2(a, op, b, ary, odtype=None, oper=None,
             odtype = numpy.dtype('float32')
         oper = op_tmpl % {'op': op, 'out_t': dtype_to_ctype(odtype)}
 
+    t = _stats.record('elemwise2', 'codegen', t)
     k = GpuElemwise(ary.context, oper, args, convert_f16=convert_f16)
+    t = _stats.record('elemwise2', 'compile', t)
     k(res, a, b, broadcast=broadcast)
+    _stats.record('elemwise2', 'launch', t)
     return res
 
 
 def ielemwise2(a, op, b, oper=None, op_tmpl="a = a %(op)s b",
                broadcast=False, convert_f16=True):
+    t = _stats.start()
     if not isinstance(b, gpuarray.GpuArray):
         b = numpy.asarray(b)
 
@@ -91,8 +100,11 @@ def ielemwise2(a, op, b, oper=None, op_tmpl="a = a %(op)s b",
     if oper is None:
         oper = op_tmpl % {'op': op}
 
+    t = _stats.record('ielemwise2', 'codegen', t)
     k = GpuElemwise(a.context, oper, args, convert_f16=convert_f16)
+    t = _stats.record('ielemwise2', 'compile', t)
     k(a, b, broadcast=broadcast)
+    _stats.record('ielemwise2', 'launch', t)
     return a
 
 
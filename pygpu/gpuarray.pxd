@@ -83,22 +83,31 @@ cdef extern from "gpuarray/buffer.h":
     int gpucontext_props_sched(gpucontext_props *p, int sched)
     int gpucontext_props_set_single_stream(gpucontext_props *p)
     int gpucontext_props_kernel_cache(gpucontext_props *p, const char *path)
+    int gpucontext_props_kernel_bundle(gpucontext_props *p, const char *path)
+    int gpucontext_props_kernel_record(gpucontext_props *p, const char *path)
     int gpucontext_props_alloc_cache(gpucontext_props *p, size_t initial, size_t max)
     void gpucontext_props_del(gpucontext_props *p)
 
     int gpucontext_init(gpucontext **res, const char *name, gpucontext_props *p)
     void gpucontext_deref(gpucontext *ctx)
     char *gpucontext_error(gpucontext *ctx, int err)
+    int gpucontext_check_errors(gpucontext *ctx)
     int gpudata_property(gpudata *ctx, int prop_id, void *res)
     int gpucontext_property(gpucontext *ctx, int prop_id, void *res)
     int gpukernel_property(gpukernel *k, int prop_id, void *res)
     gpucontext *gpudata_context(gpudata *)
+    void gpudata_retain(gpudata *b)
+    void gpudata_release(gpudata *b)
     gpucontext *gpukernel_context(gpukernel *)
 
     int GA_CTX_SCHED_AUTO
     int GA_CTX_SCHED_SINGLE
     int GA_CTX_SCHED_MULTI
 
+    int GA_CHECK_ERROR_NONE
+    int GA_CHECK_ERROR_SYNC
+    int GA_CHECK_ERROR_DEFERRED
+
     int GA_CTX_PROP_DEVNAME
     int GA_CTX_PROP_UNIQUE_ID
     int GA_CTX_PROP_LMEMSIZE
@@ -132,13 +141,13 @@ cdef extern from "gpuarray/kernel.h":
     int GpuKernel_init(_GpuKernel *k, gpucontext *ctx,
                        unsigned int count, const char **strs,
                        const size_t *lens, const char *name,
-                       unsigned int argcount, const int *types, int flags, char **err_str)
+                       unsigned int argcount, const int *types, int flags, char **err_str) nogil
     void GpuKernel_clear(_GpuKernel *k)
     gpucontext *GpuKernel_context(_GpuKernel *k)
     int GpuKernel_sched(_GpuKernel *k, size_t n, size_t *gs, size_t *ls)
     int GpuKernel_call(_GpuKernel *k, unsigned int n,
                        const size_t *gs, const size_t *ls,
-                       size_t shared, void **args)
+                       size_t shared, void **args) nogil
 
 cdef extern from "gpuarray/array.h":
     ctypedef struct _GpuArray "GpuArray":
@@ -177,6 +186,38 @@ cdef extern from "gpuarray/array.h":
     int GpuArray_index(_GpuArray *r, _GpuArray *a, const ssize_t *starts,
                        const ssize_t *stops, const ssize_t *steps)
     int GpuArray_take1(_GpuArray *r, _GpuArray *a, _GpuArray *i, int check_err)
+
+    ctypedef enum ga_put_mode:
+        GA_PUT_SET, GA_PUT_ADD, GA_PUT_ADD_DETERMINISTIC
+
+    int GpuArray_take(_GpuArray *r, _GpuArray *v, unsigned int axis,
+                      unsigned int nidx, const _GpuArray **idx, int check_err)
+    int GpuArray_put(_GpuArray *a, _GpuArray *v, unsigned int axis,
+                     unsigned int nidx, const _GpuArray **idx,
+                     ga_put_mode mode, int check_err)
+    int GpuArray_nonzero(_GpuArray *r, _GpuArray *a)
+    int GpuArray_sort(_GpuArray *r, const _GpuArray *a, unsigned int axis,
+                      int descending)
+    int GpuArray_argsort(_GpuArray *r, const _GpuArray *a, unsigned int axis,
+                         int descending)
+    int GpuArray_sort_by_key(_GpuArray *rk, _GpuArray *rv,
+                             const _GpuArray *k, const _GpuArray *v,
+                             unsigned int axis, int descending)
+    int GpuArray_topk(_GpuArray *rv, _GpuArray *ri, const _GpuArray *a,
+                      unsigned int axis, size_t k, int largest)
+    int GpuArray_searchsorted(_GpuArray *r, const _GpuArray *s,
+                              const _GpuArray *v, int right)
+
+    int GA_SCAN_EXCLUSIVE
+    int GpuArray_scan(_GpuArray *r, const _GpuArray *a, const _GpuArray *seg,
+                      unsigned int axis, const char *preamble, const char *op,
+                      const char *neutral, int flags)
+    int GpuArray_softmax(_GpuArray *r, const _GpuArray *a, unsigned int axis)
+    int GpuArray_logsoftmax(_GpuArray *r, const _GpuArray *a,
+                            unsigned int axis)
+    int GpuArray_layernorm(_GpuArray *r, const _GpuArray *a,
+                           const _GpuArray *w, const _GpuArray *b,
+                           unsigned int axis, double eps)
     int GpuArray_setarray(_GpuArray *v, _GpuArray *a)
     int GpuArray_reshape(_GpuArray *res, _GpuArray *a, unsigned int nd,
                          const size_t *newdims, ga_order ord, int nocopy)
@@ -214,6 +255,8 @@ cdef extern from "gpuarray/extension.h":
         pass
 
     cdef int GPUARRAY_CUDA_CTX_NOFREE
+    cdef int GPUARRAY_CUDA_WAIT_READ
+    cdef int GPUARRAY_CUDA_WAIT_WRITE
 
 cdef type get_exc(int errcode)
 
@@ -243,6 +286,27 @@ cdef int array_index(GpuArray r, GpuArray a, const ssize_t *starts,
                      const ssize_t *stops, const ssize_t *steps) except -1
 cdef int array_take1(GpuArray r, GpuArray a, GpuArray i,
                      int check_err) except -1
+cdef int array_take(GpuArray r, GpuArray a, unsigned int axis, list idx,
+                    int check_err) except -1
+cdef int array_put(GpuArray a, GpuArray v, unsigned int axis, list idx,
+                   ga_put_mode mode, int check_err) except -1
+cdef int array_nonzero(GpuArray r, GpuArray a) except -1
+cdef int array_sort(GpuArray r, GpuArray a, unsigned int axis,
+                    int descending) except -1
+cdef int array_argsort(GpuArray r, GpuArray a, unsigned int axis,
+                       int descending) except -1
+cdef int array_sort_by_key(GpuArray rk, GpuArray rv, GpuArray k, GpuArray v,
+                           unsigned int axis, int descending) except -1
+cdef int array_topk(GpuArray rv, GpuArray ri, GpuArray a, unsigned int axis,
+                    size_t k, int largest) except -1
+cdef int array_searchsorted(GpuArray r, GpuArray s, GpuArray v,
+                            int right) except -1
+cdef int array_scan(GpuArray r, GpuArray a, GpuArray seg, unsigned int axis,
+                    preamble, op, neutral, int flags) except -1
+cdef int array_softmax(GpuArray r, GpuArray a, unsigned int axis,
+                       bint log) except -1
+cdef int array_layernorm(GpuArray r, GpuArray a, GpuArray w, GpuArray b,
+                         unsigned int axis, double eps) except -1
 cdef int array_setarray(GpuArray v, GpuArray a) except -1
 cdef int array_reshape(GpuArray res, GpuArray a, unsigned int nd,
                        const size_t *newdims, ga_order ord,
@@ -335,12 +399,15 @@ cdef api class GpuArray [type PyGpuArrayType, object PyGpuArrayObject]:
     cdef __index_helper(self, key, unsigned int i, ssize_t *start,
                         ssize_t *stop, ssize_t *step)
     cdef __cgetitem__(self, idx)
+    cdef __fancy_split(self, key)
 
 cdef api class GpuKernel [type PyGpuKernelType, object PyGpuKernelObject]:
     cdef _GpuKernel k
     cdef readonly GpuContext context
+    # Unused, kept for the object layout until the next major version
     cdef void **callbuf
     cdef object __weakref__
 
     cdef do_call(self, py_n, py_gs, py_ls, py_args, size_t shared)
-    cdef _setarg(self, unsigned int index, int typecode, object o)
+    cdef _setarg(self, void **callbuf, unsigned int index, int typecode,
+                 object o)
@@ -2,14 +2,25 @@ cimport libc.stdio
 from libc.stdlib cimport malloc, calloc, free
 from cpython.mem cimport PyMem_Malloc, PyMem_Free
 from libc.string cimport strncmp
+from libc.stdint cimport int64_t, uint64_t, uint8_t, uint16_t
 
 cimport numpy as np
 import numpy as np
 
 import sys
 
+from pygpu import _stats
+
+try:
+    from pickle import PickleBuffer
+except ImportError:
+    PickleBuffer = None
+
 from cpython cimport Py_INCREF, PyNumber_Index
 from cpython.object cimport Py_EQ, Py_NE
+from cpython.pycapsule cimport (PyCapsule_New, PyCapsule_IsValid,
+                                PyCapsule_GetPointer, PyCapsule_SetName,
+                                PyCapsule_Destructor)
 
 def api_version():
     """api_version()
@@ -339,6 +350,159 @@ cdef int array_take1(GpuArray r, GpuArray a, GpuArray i,
             raise IndexError, GpuArray_error(&r.ga, err)
         raise get_exc(err), GpuArray_error(&r.ga, err)
 
+cdef int array_take(GpuArray r, GpuArray a, unsigned int axis, list idx,
+                    int check_err) except -1:
+    cdef const _GpuArray **ia
+    cdef Py_ssize_t i
+    cdef int err
+    ia = <const _GpuArray **>PyMem_Malloc(sizeof(_GpuArray *) * len(idx))
+    if ia == NULL:
+        raise MemoryError()
+    try:
+        for i in range(len(idx)):
+            ia[i] = &(<GpuArray>idx[i]).ga
+        err = GpuArray_take(&r.ga, &a.ga, axis, len(idx), ia, check_err)
+    finally:
+        PyMem_Free(ia)
+    if err != GA_NO_ERROR:
+        if err == GA_VALUE_ERROR:
+            raise IndexError, GpuArray_error(&a.ga, err)
+        raise get_exc(err), GpuArray_error(&a.ga, err)
+
+cdef int array_put(GpuArray a, GpuArray v, unsigned int axis, list idx,
+                   ga_put_mode mode, int check_err) except -1:
+    cdef const _GpuArray **ia
+    cdef Py_ssize_t i
+    cdef int err
+    ia = <const _GpuArray **>PyMem_Malloc(sizeof(_GpuArray *) * len(idx))
+    if ia == NULL:
+        raise MemoryError()
+    try:
+        for i in range(len(idx)):
+            ia[i] = &(<GpuArray>idx[i]).ga
+        err = GpuArray_put(&a.ga, &v.ga, axis, len(idx), ia, mode, check_err)
+    finally:
+        PyMem_Free(ia)
+    if err != GA_NO_ERROR:
+        if err == GA_VALUE_ERROR:
+            raise IndexError, GpuArray_error(&a.ga, err)
+        raise get_exc(err), GpuArray_error(&a.ga, err)
+
+cdef int array_nonzero(GpuArray r, GpuArray a) except -1:
+    cdef int err
+    err = GpuArray_nonzero(&r.ga, &a.ga)
+    if err != GA_NO_ERROR:
+        raise get_exc(err), GpuArray_error(&a.ga, err)
+
+cdef int array_sort(GpuArray r, GpuArray a, unsigned int axis,
+                    int descending) except -1:
+    cdef int err
+    err = GpuArray_sort(&r.ga, &a.ga, axis, descending)
+    if err != GA_NO_ERROR:
+        raise get_exc(err), GpuArray_error(&a.ga, err)
+
+cdef int array_argsort(GpuArray r, GpuArray a, unsigned int axis,
+                       int descending) except -1:
+    cdef int err
+    err = GpuArray_argsort(&r.ga, &a.ga, axis, descending)
+    if err != GA_NO_ERROR:
+        raise get_exc(err), GpuArray_error(&a.ga, err)
+
+cdef int array_sort_by_key(GpuArray rk, GpuArray rv, GpuArray k, GpuArray v,
+                           unsigned int axis, int descending) except -1:
+    cdef int err
+    err = GpuArray_sort_by_key(NULL if rk is None else &rk.ga, &rv.ga,
+                               &k.ga, &v.ga, axis, descending)
+    if err != GA_NO_ERROR:
+        raise get_exc(err), GpuArray_error(&k.ga, err)
+
+cdef int array_topk(GpuArray rv, GpuArray ri, GpuArray a, unsigned int axis,
+                    size_t k, int largest) except -1:
+    cdef int err
+    err = GpuArray_topk(NULL if rv is None else &rv.ga,
+                        NULL if ri is None else &ri.ga,
+                        &a.ga, axis, k, largest)
+    if err != GA_NO_ERROR:
+        raise get_exc(err), GpuArray_error(&a.ga, err)
+
+cdef int array_searchsorted(GpuArray r, GpuArray s, GpuArray v,
+                            int right) except -1:
+    cdef int err
+    err = GpuArray_searchsorted(&r.ga, &s.ga, &v.ga, right)
+    if err != GA_NO_ERROR:
+        raise get_exc(err), GpuArray_error(&s.ga, err)
+
+cdef int array_scan(GpuArray r, GpuArray a, GpuArray seg, unsigned int axis,
+                    preamble, op, neutral, int flags) except -1:
+    cdef int err
+    cdef bytes p = _s(preamble)
+    cdef bytes o = _s(op)
+    cdef bytes n = _s(neutral)
+    err = GpuArray_scan(&r.ga, &a.ga, NULL if seg is None else &seg.ga, axis,
+                        p, o, n, flags)
+    if err != GA_NO_ERROR:
+        raise get_exc(err), GpuArray_error(&a.ga, err)
+
+cdef int array_softmax(GpuArray r, GpuArray a, unsigned int axis,
+                       bint log) except -1:
+    cdef int err
+    if log:
+        err = GpuArray_logsoftmax(&r.ga, &a.ga, axis)
+    else:
+        err = GpuArray_softmax(&r.ga, &a.ga, axis)
+    if err != GA_NO_ERROR:
+        raise get_exc(err), GpuArray_error(&a.ga, err)
+
+cdef int array_layernorm(GpuArray r, GpuArray a, GpuArray w, GpuArray b,
+                         unsigned int axis, double eps) except -1:
+    cdef int err
+    err = GpuArray_layernorm(&r.ga, &a.ga, NULL if w is None else &w.ga,
+                             NULL if b is None else &b.ga, axis, eps)
+    if err != GA_NO_ERROR:
+        raise get_exc(err), GpuArray_error(&a.ga, err)
+
+cdef bint _is_index_array(k):
+    if isinstance(k, (GpuArray, np.ndarray)):
+        return True
+    if isinstance(k, list):
+        return not any(isinstance(i, slice) or i is Ellipsis or i is None
+                       for i in k)
+    return False
+
+cdef bint _is_fancy(key):
+    if _is_index_array(key):
+        return True
+    if isinstance(key, tuple):
+        return any(_is_index_array(k) for k in key)
+    return False
+
+cdef GpuArray _index_array(k, GpuContext context):
+    if isinstance(k, GpuArray):
+        if (<GpuArray>k).context.ctx != context.ctx:
+            raise ValueError, "index array is on a different context"
+        return k
+    k = np.asarray(k)
+    if k.dtype.kind == 'f' and k.size == 0:
+        k = k.astype('int64')
+    if k.dtype.kind not in 'biu':
+        raise IndexError, "arrays used as indices must be of integer (or boolean) type"
+    return carray(k, None, False, 'A', 0, context, GpuArray)
+
+cdef tuple _bcast_shape(list shapes):
+    cdef list res = []
+    cdef Py_ssize_t nd = max(len(s) for s in shapes)
+    for s in shapes:
+        s = (1,) * (nd - len(s)) + tuple(s)
+        if len(res) == 0:
+            res = list(s)
+            continue
+        for i in range(nd):
+            if s[i] != 1:
+                if res[i] != 1 and res[i] != s[i]:
+                    raise IndexError, "shape mismatch: indexing arrays could not be broadcast together"
+                res[i] = s[i]
+    return tuple(res)
+
 cdef int array_setarray(GpuArray v, GpuArray a) except -1:
     cdef int err
     err = GpuArray_setarray(&v.ga, &a.ga)
@@ -435,8 +599,9 @@ cdef int kernel_init(GpuKernel k, gpucontext *ctx,
                      int flags) except -1:
     cdef int err
     cdef char *err_str = NULL
-    err = GpuKernel_init(&k.k, ctx, count, strs, len, name, argcount,
-                          types, flags, &err_str)
+    with nogil:
+        err = GpuKernel_init(&k.k, ctx, count, strs, len, name, argcount,
+                             types, flags, &err_str)
     if err != GA_NO_ERROR:
         if err_str != NULL:
             try:
@@ -465,7 +630,8 @@ cdef int kernel_sched(GpuKernel k, size_t n, size_t *gs, size_t *ls) except -1:
 cdef int kernel_call(GpuKernel k, unsigned int n, const size_t *gs,
                      const size_t *ls, size_t shared, void **args) except -1:
     cdef int err
-    err = GpuKernel_call(&k.k, n, gs, ls, shared, args)
+    with nogil:
+        err = GpuKernel_call(&k.k, n, gs, ls, shared, args)
     if err != GA_NO_ERROR:
         raise get_exc(err), kernel_error(k, err)
 
@@ -588,10 +754,12 @@ cdef GpuContext pygpu_init(dev, gpucontext_props *p):
     return res
 
 def init(dev, sched='default', single_stream=False, kernel_cache_path=None,
-         max_cache_size=sys.maxsize, initial_cache_size=0):
+         max_cache_size=sys.maxsize, initial_cache_size=0,
+         kernel_bundle=None, kernel_record=None):
     """
     init(dev, sched='default', single_stream=False, kernel_cache_path=None,
-         max_cache_size=sys.maxsize, initial_cache_size=0)
+         max_cache_size=sys.maxsize, initial_cache_size=0,
+         kernel_bundle=None, kernel_record=None)
 
     Creates a context from a device specifier.
 
@@ -624,11 +792,17 @@ def init(dev, sched='default', single_stream=False, kernel_cache_path=None,
         disable allocation cache (if any)
     single_stream: bool
         enable single stream mode
+    kernel_bundle: str
+        precompiled kernel bundle to load (cuda only)
+    kernel_record: str
+        manifest file to record the compiled kernels in (cuda only)
 
     """
     cdef gpucontext_props *p = NULL
     cdef int err
     cdef bytes kernel_cache_path_b
+    cdef bytes kernel_bundle_b
+    cdef bytes kernel_record_b
     err = gpucontext_props_new(&p)
     if err != GA_NO_ERROR:
         raise MemoryError
@@ -645,6 +819,12 @@ def init(dev, sched='default', single_stream=False, kernel_cache_path=None,
         if kernel_cache_path:
             kernel_cache_path_b = _s(kernel_cache_path)
             gpucontext_props_kernel_cache(p, <const char *>kernel_cache_path_b)
+        if kernel_bundle:
+            kernel_bundle_b = _s(kernel_bundle)
+            gpucontext_props_kernel_bundle(p, <const char *>kernel_bundle_b)
+        if kernel_record:
+            kernel_record_b = _s(kernel_record)
+            gpucontext_props_kernel_record(p, <const char *>kernel_record_b)
 
         err = gpucontext_props_alloc_cache(p, initial_cache_size,
                                            max_cache_size)
@@ -1081,6 +1261,24 @@ cdef class GpuContext:
     def __exit__(self, t, v, tb):
         cuda_exit(self.ctx)
 
+    def check_errors(self):
+        """
+        check_errors()
+
+        Raise the first error recorded by kernels in this context
+        since the last check.
+
+        Gathers done with `deferred=True` only record their index
+        errors on the device, which are reported here or on the next
+        synchronization point.
+        """
+        cdef int err
+        err = gpucontext_check_errors(self.ctx)
+        if err != GA_NO_ERROR:
+            if err == GA_VALUE_ERROR:
+                raise IndexError, gpucontext_error(self.ctx, err)
+            raise get_exc(err), gpucontext_error(self.ctx, err)
+
     property ptr:
         "Raw pointer value for the context object"
         def __get__(self):
@@ -1464,6 +1662,51 @@ cdef int pygpu_transfer(GpuArray res, GpuArray a) except -1:
     array_transfer(res, a)
     return 0
 
+def sort_by_key(GpuArray keys not None, GpuArray values not None,
+                int axis=-1, descending=False):
+    """
+    sort_by_key(keys, values, axis=-1, descending=False)
+
+    Sort `keys` along `axis` and reorder `values` (of the same shape
+    but any dtype) in the same way.
+
+    Returns
+    -------
+    (sorted keys, reordered values)
+    """
+    cdef GpuArray rk
+    cdef GpuArray rv
+    if axis < 0:
+        axis += keys.ga.nd
+    if axis < 0 or axis >= <int>keys.ga.nd:
+        raise ValueError, "axis out of range"
+    rk = pygpu_empty_like(keys, GA_C_ORDER, -1)
+    rv = pygpu_empty_like(values, GA_C_ORDER, -1)
+    array_sort_by_key(rk, rv, keys, values, axis, descending)
+    return rk, rv
+
+def _scan(GpuArray r not None, GpuArray a not None, GpuArray seg,
+          unsigned int axis, op, neutral, preamble='', bint exclusive=False):
+    """
+    _scan(r, a, seg, axis, op, neutral, preamble='', exclusive=False)
+    """
+    array_scan(r, a, seg, axis, preamble, op, neutral,
+               GA_SCAN_EXCLUSIVE if exclusive else 0)
+
+def _softmax(GpuArray r not None, GpuArray a not None, unsigned int axis,
+             bint log=False):
+    """
+    _softmax(r, a, axis, log=False)
+    """
+    array_softmax(r, a, axis, log)
+
+def _layernorm(GpuArray r not None, GpuArray a not None, GpuArray w,
+               GpuArray b, unsigned int axis, double eps):
+    """
+    _layernorm(r, a, w, b, axis, eps)
+    """
+    array_layernorm(r, a, w, b, axis, eps)
+
 def _split(GpuArray a, ind, unsigned int axis):
     """
     _split(a, ind, axis)
@@ -1523,9 +1766,11 @@ def _concatenate(list al, unsigned int axis, int restype, object cls,
 
 cdef int (*cuda_get_ipc_handle)(gpudata *, GpuArrayIpcMemHandle *)
 cdef gpudata *(*cuda_open_ipc_handle)(gpucontext *, GpuArrayIpcMemHandle *, size_t)
+cdef int (*cuda_get_ipc_range)(gpudata *, GpuArrayIpcMemHandle *, size_t *, size_t *)
 
 cuda_get_ipc_handle = <int (*)(gpudata *, GpuArrayIpcMemHandle *)>gpuarray_get_extension("cuda_get_ipc_handle")
 cuda_open_ipc_handle = <gpudata *(*)(gpucontext *, GpuArrayIpcMemHandle *, size_t)>gpuarray_get_extension("cuda_open_ipc_handle")
+cuda_get_ipc_range = <int (*)(gpudata *, GpuArrayIpcMemHandle *, size_t *, size_t *)>gpuarray_get_extension("cuda_get_ipc_range")
 
 def open_ipc_handle(GpuContext c, bytes hpy, size_t l):
     """
@@ -1555,6 +1800,313 @@ def open_ipc_handle(GpuContext c, bytes hpy, size_t l):
         raise GpuArrayException, gpucontext_error(c.ctx, 0)
     return <size_t>d
 
+def _rebuild_gpuarray(buf, dtype, shape, order, cls):
+    # Unpickling counterpart of GpuArray.__reduce_ex__.  `buf` is
+    # wrapped without a copy and written straight to the device.
+    cdef GpuArray res
+    host = np.frombuffer(buf, dtype=dtype).reshape(shape, order=order)
+    res = empty(shape, dtype=dtype, order=order, cls=cls)
+    res.write(host)
+    return res
+
+def _rebuild_gpuarray_ipc(bytes hpy, size_t alloc_size, size_t offset,
+                          dtype, shape, strides, cls):
+    cdef GpuContext ctx = ensure_context(None)
+    cdef GpuArrayIpcMemHandle h
+    cdef gpudata *d
+
+    if ctx.kind != b"cuda" or cuda_open_ipc_handle is NULL:
+        raise ValueError, "IPC arrays can only be loaded in a cuda context"
+    memcpy(&h, <char *>hpy, sizeof(h))
+    d = cuda_open_ipc_handle(ctx.ctx, &h, alloc_size)
+    if d is NULL:
+        raise GpuArrayException, gpucontext_error(ctx.ctx, 0)
+    try:
+        return from_gpudata(<size_t>d, offset, dtype, shape, context=ctx,
+                            strides=strides, cls=cls)
+    finally:
+        gpudata_release(d)
+
+def reduce_ipc(GpuArray a not None):
+    """
+    reduce_ipc(a)
+
+    Pickle reduction of `a` through a CUDA IPC handle.
+
+    The receiving process maps the device memory of `a` instead of
+    getting a copy of the data, so it only works between processes on
+    the same machine and `a` must be kept alive until the other side
+    is done with it.  It can be registered as the reduction for
+    :class:`GpuArray` with :mod:`multiprocessing` or :mod:`copyreg`,
+    e.g. ``ForkingPickler.register(GpuArray, reduce_ipc)``.
+
+    The array is loaded in the default context of the receiver.
+    """
+    cdef GpuArrayIpcMemHandle h
+    cdef size_t off
+    cdef size_t sz
+    cdef int err
+
+    if cuda_get_ipc_range is NULL or a.context.kind != b"cuda":
+        raise ValueError, "Only works for cuda contexts"
+    err = cuda_get_ipc_range(a.ga.data, &h, &off, &sz)
+    if err != GA_NO_ERROR:
+        raise get_exc(err), GpuArray_error(&a.ga, err)
+    # The receiver can't wait on our events
+    a.sync()
+    return (_rebuild_gpuarray_ipc,
+            (<bytes>(<char *>&h)[:sizeof(h)], sz, off + a.ga.offset,
+             a.dtype, a.shape, a.strides, type(a)))
+
+cdef int (*cuda_get_device)(gpucontext *)
+cdef void *(*cuda_get_stream)(gpucontext *)
+cdef gpudata *(*cuda_make_buf)(gpucontext *, size_t, size_t)
+cdef int (*cuda_wait)(gpudata *, int)
+cdef int (*cuda_wait_stream)(gpudata *, int, void *)
+cdef int (*cuda_record_stream)(gpudata *, int, void *)
+
+cuda_get_device = <int (*)(gpucontext *)>gpuarray_get_extension("cuda_get_device")
+cuda_get_stream = <void *(*)(gpucontext *)>gpuarray_get_extension("cuda_get_stream")
+cuda_make_buf = <gpudata *(*)(gpucontext *, size_t, size_t)>gpuarray_get_extension("cuda_make_buf")
+cuda_wait = <int (*)(gpudata *, int)>gpuarray_get_extension("cuda_wait")
+cuda_wait_stream = <int (*)(gpudata *, int, void *)>gpuarray_get_extension("cuda_wait_stream")
+cuda_record_stream = <int (*)(gpudata *, int, void *)>gpuarray_get_extension("cuda_record_stream")
+
+cdef int ctx_cuda_device(GpuContext c) except -1:
+    cdef int dev
+    if c.kind != b"cuda" or cuda_get_device is NULL:
+        raise ValueError, "Only works for cuda contexts"
+    dev = cuda_get_device(c.ctx)
+    if dev == -1:
+        raise GpuArrayException, gpucontext_error(c.ctx, 0)
+    return dev
+
+cdef GpuArray cuda_wrap_ptr(GpuContext context, size_t ptr, dtype, shape,
+                            strides, bint writable, object base, object cls,
+                            object stream):
+    # Wrap memory we don't own.  `strides` are in bytes; `base` keeps
+    # the memory alive.
+    cdef size_t *cdims = NULL
+    cdef ssize_t *cstrides = NULL
+    cdef unsigned int nd
+    cdef unsigned int i
+    cdef int typecode
+    cdef size_t elsize
+    cdef ssize_t lo = 0
+    cdef ssize_t hi
+    cdef gpudata *buf
+    cdef int err
+
+    if context.kind != b"cuda" or cuda_make_buf is NULL:
+        raise ValueError, "Only works for cuda contexts"
+    nd = <unsigned int>len(shape)
+    if strides is not None and len(strides) != nd:
+        raise ValueError, "strides must be the same length as shape"
+    typecode = dtype_to_typecode(dtype)
+    elsize = gpuarray_get_elsize(typecode)
+
+    try:
+        cdims = <size_t *>calloc(nd, sizeof(size_t))
+        cstrides = <ssize_t *>calloc(nd, sizeof(ssize_t))
+        if cdims == NULL or cstrides == NULL:
+            raise MemoryError
+        for i in range(nd):
+            cdims[i] = shape[i]
+        if strides is not None:
+            for i in range(nd):
+                cstrides[i] = strides[i]
+        else:
+            hi = elsize
+            for i in range(nd, 0, -1):
+                cstrides[i-1] = hi
+                hi *= cdims[i-1]
+        # Span of the memory we can touch, relative to `ptr`
+        hi = elsize
+        for i in range(nd):
+            if cdims[i] == 0:
+                lo = 0
+                hi = 0
+                break
+            if cstrides[i] < 0:
+                lo += cstrides[i] * <ssize_t>(cdims[i] - 1)
+            else:
+                hi += cstrides[i] * <ssize_t>(cdims[i] - 1)
+
+        buf = cuda_make_buf(context.ctx, ptr + lo, hi - lo)
+        if buf is NULL:
+            raise GpuArrayException, gpucontext_error(context.ctx, 0)
+        try:
+            if stream is not None:
+                err = cuda_record_stream(buf, GPUARRAY_CUDA_WAIT_READ |
+                                         GPUARRAY_CUDA_WAIT_WRITE,
+                                         <void *><size_t>stream)
+                if err != GA_NO_ERROR:
+                    raise get_exc(err), gpucontext_error(context.ctx, err)
+            return pygpu_fromgpudata(buf, -lo, typecode, nd, cdims, cstrides,
+                                     context, writable, base, cls)
+        finally:
+            gpudata_release(buf)
+    finally:
+        free(cdims)
+        free(cstrides)
+
+# DLPack (https://github.com/dmlc/dlpack) structures and constants
+cdef enum:
+    kDLCUDA = 2
+    kDLCUDAManaged = 13
+
+cdef enum:
+    kDLInt = 0
+    kDLUInt = 1
+    kDLFloat = 2
+    kDLComplex = 5
+    kDLBool = 6
+
+cdef struct DLDevice:
+    int device_type
+    int device_id
+
+cdef struct DLDataType:
+    uint8_t code
+    uint8_t bits
+    uint16_t lanes
+
+cdef struct DLTensor:
+    void *data
+    DLDevice device
+    int ndim
+    DLDataType dtype
+    int64_t *shape
+    int64_t *strides
+    uint64_t byte_offset
+
+cdef struct DLManagedTensor:
+    DLTensor dl_tensor
+    void *manager_ctx
+    void (*deleter)(DLManagedTensor *)
+
+cdef dict KIND_TO_DL = {'i': kDLInt, 'u': kDLUInt, 'f': kDLFloat,
+                        'c': kDLComplex, 'b': kDLBool}
+cdef dict DL_TO_KIND = dict((v, k) for k, v in KIND_TO_DL.iteritems())
+
+cdef void dlpack_deleter(DLManagedTensor *m) with gil:
+    gpudata_release(<gpudata *>m.manager_ctx)
+    free(m)
+
+cdef void dlpack_capsule_destructor(object capsule):
+    cdef DLManagedTensor *m
+    # Only called if the capsule was never consumed
+    if PyCapsule_IsValid(capsule, "dltensor"):
+        m = <DLManagedTensor *>PyCapsule_GetPointer(capsule, "dltensor")
+        m.deleter(m)
+
+cdef class _DLPackOwner:
+    """Keeps an imported DLPack tensor alive."""
+    cdef DLManagedTensor *m
+
+    def __dealloc__(self):
+        if self.m is not NULL and self.m.deleter is not NULL:
+            self.m.deleter(self.m)
+
+def from_dlpack(x, GpuContext context=None, cls=None):
+    """
+    from_dlpack(x, context=None, cls=None)
+
+    Build a GpuArray that shares the memory of a DLPack tensor.
+
+    Parameters
+    ----------
+    x: object
+        object with a `__dlpack__` method or a DLPack capsule
+    context: GpuContext
+        CUDA context on the device of the tensor
+    cls: type
+        view type of the result
+
+    Notes
+    -----
+    The producer is asked to order its pending work before the stream
+    of `context`, so the result can be used immediately.  The tensor
+    is released when the result and all its views are gone.
+
+    """
+    cdef DLManagedTensor *m
+    cdef DLTensor *t
+    cdef _DLPackOwner owner
+    cdef size_t elsize
+    cdef size_t stream
+    cdef int dev
+    cdef int i
+
+    context = ensure_context(context)
+    dev = ctx_cuda_device(context)
+    if hasattr(x, '__dlpack__'):
+        devtype, devid = x.__dlpack_device__()
+        if devtype not in (kDLCUDA, kDLCUDAManaged) or devid != dev:
+            raise ValueError, "Tensor is not on the device of the context"
+        stream = <size_t>cuda_get_stream(context.ctx)
+        # 1 is the legacy default stream for DLPack
+        capsule = x.__dlpack__(stream=stream if stream != 0 else 1)
+    else:
+        capsule = x
+    if not PyCapsule_IsValid(capsule, "dltensor"):
+        raise TypeError, "Expected an object with __dlpack__ or an unused DLPack capsule"
+    m = <DLManagedTensor *>PyCapsule_GetPointer(capsule, "dltensor")
+    # We are now responsible for calling the deleter
+    PyCapsule_SetName(capsule, "used_dltensor")
+    owner = _DLPackOwner.__new__(_DLPackOwner)
+    owner.m = m
+
+    t = &m.dl_tensor
+    if (t.device.device_type != kDLCUDA and
+            t.device.device_type != kDLCUDAManaged) or t.device.device_id != dev:
+        raise ValueError, "Tensor is not on the device of the context"
+    if (t.dtype.lanes != 1 or t.dtype.bits % 8 != 0 or
+            t.dtype.code not in DL_TO_KIND):
+        raise TypeError, "Unsupported DLPack data type (code %d, %d bits)" % (
+            t.dtype.code, t.dtype.bits)
+    elsize = t.dtype.bits // 8
+    dtype = np.dtype('%s%d' % (DL_TO_KIND[t.dtype.code], elsize))
+    shape = [t.shape[i] for i in range(t.ndim)]
+    if t.strides is NULL:
+        strides = None
+    else:
+        strides = [t.strides[i] * <int64_t>elsize for i in range(t.ndim)]
+    return cuda_wrap_ptr(context, <size_t>t.data + t.byte_offset, dtype,
+                         shape, strides, True, owner, cls, None)
+
+def from_cuda_array_interface(obj, GpuContext context=None, cls=None):
+    """
+    from_cuda_array_interface(obj, context=None, cls=None)
+
+    Build a GpuArray that shares the memory of an object exposing
+    `__cuda_array_interface__`.
+
+    Parameters
+    ----------
+    obj: object
+        object with a `__cuda_array_interface__` attribute
+    context: GpuContext
+        CUDA context on the device of the data
+    cls: type
+        view type of the result
+
+    Notes
+    -----
+    If the interface gives a stream, the stream of `context` will
+    wait for the work queued on it.  `obj` is kept alive by the
+    result.
+
+    """
+    context = ensure_context(context)
+    iface = obj.__cuda_array_interface__
+    if iface.get('mask') is not None:
+        raise ValueError, "Masked arrays are not supported"
+    ptr, readonly = iface['data']
+    return cuda_wrap_ptr(context, ptr, np.dtype(iface['typestr']),
+                         iface['shape'], iface.get('strides'), not readonly,
+                         obj, cls, iface.get('stream'))
+
 cdef class GpuArray:
     """
     Device array
@@ -1584,8 +2136,23 @@ cdef class GpuArray:
         if type(self) is GpuArray:
             raise RuntimeError, "Called raw GpuArray.__init__"
 
-    def __reduce__(self):
-        raise RuntimeError, "Cannot pickle GpuArray object"
+    def __reduce_ex__(self, protocol):
+        # Read the data once into host memory that the pickle then
+        # refers to.  With protocol 5 that memory is handed over as an
+        # out-of-band buffer so it can be written out without another
+        # copy.  The result is loaded in the default context.
+        cdef GpuArray a = self
+        if not (self.flags.aligned and (self.flags.c_contiguous or
+                                        self.flags.f_contiguous)):
+            a = pygpu_copy(self, GA_C_ORDER)
+        order = 'C' if a.flags.c_contiguous else 'F'
+        host = np.empty(a.shape, dtype=a.dtype, order=order)
+        a.read(host)
+        host = host.ravel(order='K')
+        if protocol >= 5 and PickleBuffer is not None:
+            host = PickleBuffer(host)
+        return (_rebuild_gpuarray,
+                (host, a.dtype, a.shape, order, type(self)))
 
     cdef __index_helper(self, key, unsigned int i, ssize_t *start,
                         ssize_t *stop, ssize_t *step):
@@ -1724,6 +2291,111 @@ cdef class GpuArray:
         res = <bytes>(<char *>&h)[:sizeof(h)]
         return res
 
+    def __dlpack__(self, stream=None):
+        """
+        __dlpack__(stream=None)
+
+        Export the array as a DLPack capsule, without copying.
+
+        `stream` is the CUDA stream of the consumer (1 for the legacy
+        default stream, 2 for the per-thread default stream or -1 to
+        skip synchronization).  It is made to wait for the pending
+        work on the array.
+        """
+        cdef DLManagedTensor *m
+        cdef np.dtype dt
+        cdef ssize_t elsize
+        cdef unsigned int i
+        cdef int dev
+        cdef int err
+        if self.context.kind != b"cuda":
+            raise BufferError, "DLPack export only works for cuda arrays"
+        dt = self.dtype
+        elsize = dt.itemsize
+        if dt.kind not in KIND_TO_DL:
+            raise BufferError, "Unsupported data type for DLPack: %s" % (dt,)
+        for i in range(self.ga.nd):
+            if self.ga.strides[i] % elsize != 0:
+                raise BufferError, "Strides are not a multiple of the itemsize"
+        dev = ctx_cuda_device(self.context)
+        if stream is None:
+            stream = 1
+        if stream == 0:
+            raise ValueError, "Stream 0 is ambiguous, use 1 or 2 for the default streams"
+        if stream != -1:
+            err = cuda_wait_stream(self.ga.data, GPUARRAY_CUDA_WAIT_READ |
+                                   GPUARRAY_CUDA_WAIT_WRITE,
+                                   <void *><size_t>stream)
+            if err != GA_NO_ERROR:
+                raise get_exc(err), GpuArray_error(&self.ga, err)
+
+        m = <DLManagedTensor *>malloc(sizeof(DLManagedTensor) +
+                                      2 * self.ga.nd * sizeof(int64_t))
+        if m is NULL:
+            raise MemoryError
+        m.dl_tensor.data = <void *>(<size_t>((<void **>self.ga.data)[0]) +
+                                    self.ga.offset)
+        m.dl_tensor.device.device_type = kDLCUDA
+        m.dl_tensor.device.device_id = dev
+        m.dl_tensor.ndim = self.ga.nd
+        m.dl_tensor.dtype.code = KIND_TO_DL[dt.kind]
+        m.dl_tensor.dtype.bits = elsize * 8
+        m.dl_tensor.dtype.lanes = 1
+        m.dl_tensor.shape = <int64_t *>(m + 1)
+        m.dl_tensor.strides = m.dl_tensor.shape + self.ga.nd
+        m.dl_tensor.byte_offset = 0
+        for i in range(self.ga.nd):
+            m.dl_tensor.shape[i] = self.ga.dimensions[i]
+            m.dl_tensor.strides[i] = self.ga.strides[i] // elsize
+        # The capsule keeps the memory alive until the consumer is done
+        gpudata_retain(self.ga.data)
+        m.manager_ctx = self.ga.data
+        m.deleter = dlpack_deleter
+        try:
+            return PyCapsule_New(m, "dltensor",
+                                 <PyCapsule_Destructor>dlpack_capsule_destructor)
+        except:
+            dlpack_deleter(m)
+            raise
+
+    def __dlpack_device__(self):
+        """
+        __dlpack_device__()
+
+        Return the DLPack device type and id of the array.
+        """
+        if self.context.kind != b"cuda":
+            raise BufferError, "DLPack export only works for cuda arrays"
+        return (kDLCUDA, ctx_cuda_device(self.context))
+
+    property __cuda_array_interface__:
+        """CUDA Array Interface (version 3) of the array.
+
+        The pending work on the array is ordered before the stream of
+        the context, which is given as `stream`.
+        """
+        def __get__(self):
+            cdef size_t stream
+            cdef int err
+            if self.context.kind != b"cuda" or cuda_wait is NULL:
+                raise AttributeError, "Only cuda arrays have __cuda_array_interface__"
+            err = cuda_wait(self.ga.data, GPUARRAY_CUDA_WAIT_WRITE)
+            if err != GA_NO_ERROR:
+                raise get_exc(err), GpuArray_error(&self.ga, err)
+            stream = <size_t>cuda_get_stream(self.context.ctx)
+            if self.ga.flags & GA_C_CONTIGUOUS:
+                strides = None
+            else:
+                strides = self.strides
+            return {'shape': self.shape,
+                    'typestr': self.dtype.str,
+                    'data': (<size_t>((<void **>self.ga.data)[0]) +
+                             self.ga.offset,
+                             not (self.ga.flags & GA_WRITEABLE)),
+                    'strides': strides,
+                    'stream': stream if stream != 0 else 1,
+                    'version': 3}
+
     def __array__(self, ldtype=None):
         """
         __array__(ldtype=None)
@@ -1927,28 +2599,36 @@ cdef class GpuArray:
 
     def __getitem__(self, key):
         cdef unsigned int i
+        cdef GpuArray view
+        cdef GpuArray res
+        cdef unsigned int axis
+        cdef list idx
 
         if key is Ellipsis:
             return self.__cgetitem__(key)
 
-        # A list or a sequence of list should trigger "fancy" indexing.
-        # This is not implemented yet.
-        # Conversely, if a list contains slice or Ellipsis objects, it behaves
-        # the same as a tuple.
+        # Integer or boolean arrays (or lists of integers) trigger
+        # "fancy" indexing which is done with a gather kernel.
+        if _is_fancy(key):
+            view, axis, idx = self.__fancy_split(key)
+            shape = (view.shape[:axis] +
+                     _bcast_shape([ia.shape for ia in idx]) +
+                     view.shape[axis + len(idx):])
+            res = empty(shape, dtype=self.ga.typecode, context=self.context,
+                        cls=type(self))
+            array_take(res, view, axis, idx, 1)
+            return res
+
+        # If a list contains slice or Ellipsis objects, it behaves the
+        # same as a tuple.
         if isinstance(key, list):
-            if any(isinstance(k, slice) or k is Ellipsis for k in key):
-                return self.__getitem__(tuple(key))
-            else:
-                raise NotImplementedError, "fancy indexing not supported"
+            return self.__getitem__(tuple(key))
 
         try:
             iter(key)
         except TypeError:
             key = (key,)
         else:
-            if all(isinstance(k, list) for k in key):
-                raise NotImplementedError, "fancy indexing not supported"
-
             key = tuple(key)
 
         # Need to massage Ellipsis here, to avoid packing it into a tuple.
@@ -2004,6 +2684,99 @@ cdef class GpuArray:
             new_shape.extend(sliced.shape[i:])
             return sliced.reshape(new_shape)
 
+    cdef __fancy_split(self, key):
+        # Split an advanced indexing key into a basic indexing view of
+        # this array, the first indexed axis of that view and the
+        # list of integer index arrays.
+        cdef GpuArray k
+        cdef GpuArray view
+        cdef list newkey = []
+        cdef list basic = []
+        cdef list idx = []
+        cdef list adv = []
+        cdef list advaxes = []
+        cdef list other = []
+        cdef Py_ssize_t i
+        cdef Py_ssize_t d
+        cdef Py_ssize_t nused = 0
+        cdef Py_ssize_t ell = -1
+
+        if not isinstance(key, tuple):
+            key = (key,)
+        if countis(key, None) != 0:
+            raise NotImplementedError, "newaxis combined with advanced indexing is not supported"
+
+        # A boolean mask covers as many axes as it has dimensions, so
+        # the index arrays are converted before expanding the Ellipsis.
+        for i in range(len(key)):
+            ki = key[i]
+            if ki is Ellipsis:
+                if ell != -1:
+                    raise IndexError, "cannot use more than one Ellipsis"
+                ell = i
+                newkey.append(ki)
+                continue
+            if _is_index_array(ki):
+                k = _index_array(ki, self.context)
+                nused += k.ga.nd if k.ga.typecode == GA_BOOL else 1
+                newkey.append(k)
+            else:
+                nused += 1
+                newkey.append(ki)
+        if nused > self.ga.nd:
+            raise IndexError, "too many indices"
+        if ell != -1:
+            newkey[ell:ell+1] = [slice(None)] * (self.ga.nd - nused)
+
+        # Boolean masks are converted to the integer coordinates of
+        # their true elements, one array per masked axis.
+        key = newkey
+        newkey = []
+        d = 0
+        for ki in key:
+            if isinstance(ki, GpuArray) and (<GpuArray>ki).ga.typecode == GA_BOOL:
+                k = ki
+                for i in range(k.ga.nd):
+                    if k.ga.dimensions[i] != self.ga.dimensions[d + i]:
+                        raise IndexError, ("boolean index did not match "
+                                           "indexed array along dimension "
+                                           "%d; dimension is %d but "
+                                           "corresponding boolean dimension "
+                                           "is %d" % (d + i,
+                                                      self.ga.dimensions[d + i],
+                                                      k.ga.dimensions[i]))
+                newkey.extend(k.nonzero())
+                d += k.ga.nd
+            else:
+                newkey.append(ki)
+                d += 1
+
+        # Integers count as advanced indices to decide if the index
+        # arrays are adjacent, like in numpy, but they only remove an
+        # axis from the view.
+        d = 0
+        for i in range(len(newkey)):
+            if isinstance(newkey[i], GpuArray):
+                basic.append(slice(None))
+                adv.append(i)
+                advaxes.append(d)
+                idx.append(newkey[i])
+                d += 1
+            else:
+                if isinstance(newkey[i], (int, np.integer)):
+                    adv.append(i)
+                else:
+                    other.append(d)
+                    d += 1
+                basic.append(newkey[i])
+
+        view = self.__cgetitem__(tuple(basic))
+        if adv == list(range(adv[0], adv[0] + len(adv))):
+            return view, advaxes[0], idx
+        # Otherwise the broadcast index dimensions go first
+        other.extend(range(d, view.ga.nd))
+        return view.transpose(advaxes + other), 0, idx
+
     cdef __cgetitem__(self, key):
         cdef ssize_t *starts
         cdef ssize_t *stops
@@ -2070,20 +2843,23 @@ cdef class GpuArray:
 
     def __setitem__(self, idx, v):
         cdef GpuArray tmp, gv
+        cdef unsigned int axis
+        cdef list ia
+
+        if _is_fancy(idx):
+            tmp, axis, ia = self.__fancy_split(idx)
+            gv = carray(v, self.ga.typecode, False, 'A', 0, self.context,
+                        GpuArray)
+            array_put(tmp, gv, axis, ia, GA_PUT_SET, 1)
+            return
 
         if isinstance(idx, list):
-            if any(isinstance(i, slice) or i is Ellipsis for i in idx):
-                self.__setitem__(tuple(idx), v)
-            else:
-                raise NotImplementedError, "fancy indexing not supported"
+            idx = tuple(idx)
         try:
             iter(idx)
         except TypeError:
             idx = (idx,)
         else:
-            if all(isinstance(i, list) for i in idx):
-                raise NotImplementedError, "fancy indexing not supported"
-
             idx = tuple(idx)
 
         if countis(idx, Ellipsis) > 1:
@@ -2095,9 +2871,13 @@ cdef class GpuArray:
         gv = carray(v, self.ga.typecode, False, 'A', 0, self.context, GpuArray)
         array_setarray(tmp, gv)
 
-    def take1(self, GpuArray idx):
+    def take1(self, GpuArray idx, deferred=False):
         """
-        take1(idx)
+        take1(idx, deferred=False)
+
+        If `deferred` is True, index errors are not checked right away
+        but reported on the next synchronization point (see
+        :meth:`GpuContext.check_errors`).
         """
         cdef GpuArray res
         cdef size_t odim
@@ -2109,7 +2889,173 @@ cdef class GpuArray:
             res = pygpu_empty_like(self, GA_C_ORDER, -1)
         finally:
             self.ga.dimensions[0] = odim
-        array_take1(res, self, idx, 1)
+        array_take1(res, self, idx,
+                    GA_CHECK_ERROR_DEFERRED if deferred else GA_CHECK_ERROR_SYNC)
+        return res
+
+    def take(self, indices, int axis=0):
+        """
+        take(indices, axis=0)
+
+        Take elements from the array along an axis.
+
+        This is the same as numpy.take() with an explicit axis.  The
+        indices can be a GpuArray, a numpy array or a list of integers
+        of any shape.
+
+        Parameters
+        ----------
+        indices: array-like
+            The integer indices of the values to extract.
+        axis: int
+            The axis over which to select values.
+        """
+        if axis < 0:
+            axis += self.ga.nd
+        if axis < 0 or axis >= <int>self.ga.nd:
+            raise ValueError, "axis out of range"
+        return self[(slice(None),) * axis + (indices,)]
+
+    def scatter_add(self, indices, values, int axis=0,
+                    bint deterministic=False):
+        """
+        scatter_add(indices, values, axis=0, deterministic=False)
+
+        Add `values` in-place at the positions given by `indices` along
+        `axis`, accumulating duplicate indices.
+
+        This is the in-place equivalent of numpy.add.at(self,
+        (slice(None),) * axis + (indices,), values).
+
+        Parameters
+        ----------
+        indices: array-like
+            The integer indices (any shape).
+        values: array-like
+            The values to add, broadcast to the shape of
+            self.take(indices, axis).
+        axis: int
+            The axis over which to scatter.
+        deterministic: bool
+            If True, the additions for each destination are done in
+            index order after a device sort of the indices instead of
+            using atomics.  This is slower but gives bitwise
+            reproducible results and supports all types.
+        """
+        cdef GpuArray tmp, gv
+        cdef unsigned int ax
+        cdef list ia
+        if axis < 0:
+            axis += self.ga.nd
+        if axis < 0 or axis >= <int>self.ga.nd:
+            raise ValueError, "axis out of range"
+        tmp, ax, ia = self.__fancy_split((slice(None),) * axis + (indices,))
+        gv = carray(values, self.ga.typecode, False, 'A', 0, self.context,
+                    GpuArray)
+        array_put(tmp, gv, ax, ia,
+                  GA_PUT_ADD_DETERMINISTIC if deterministic else GA_PUT_ADD, 1)
+
+    def nonzero(self):
+        """
+        nonzero()
+
+        Return a tuple of arrays with the indices of the non-zero
+        elements, one for each dimension (like numpy.nonzero()).
+
+        The selection is done on the device and only the number of
+        non-zero elements is transferred to the host.
+        """
+        cdef GpuArray r = new_GpuArray(GpuArray, self.context, None)
+        array_nonzero(r, self)
+        return tuple(r.__cgetitem__(i) for i in range(self.ga.nd))
+
+    def sort(self, int axis=-1, descending=False):
+        """
+        sort(axis=-1, descending=False)
+
+        Sort the array in-place along `axis` (like numpy.ndarray.sort()).
+
+        The sort is stable.  NaNs are placed after all the other values
+        (before them if `descending` is True).
+        """
+        if axis < 0:
+            axis += self.ga.nd
+        if axis < 0 or axis >= <int>self.ga.nd:
+            raise ValueError, "axis out of range"
+        array_sort(self, self, axis, descending)
+
+    def argsort(self, int axis=-1, descending=False):
+        """
+        argsort(axis=-1, descending=False)
+
+        Return the indices (as int64) that would sort the array along
+        `axis`.  Equal elements keep their original order.
+        """
+        cdef GpuArray res
+        if axis < 0:
+            axis += self.ga.nd
+        if axis < 0 or axis >= <int>self.ga.nd:
+            raise ValueError, "axis out of range"
+        res = pygpu_empty_like(self, GA_C_ORDER, GA_LONG)
+        array_argsort(res, self, axis, descending)
+        return res
+
+    def topk(self, size_t k, int axis=-1, largest=True):
+        """
+        topk(k, axis=-1, largest=True)
+
+        Return the `k` largest (or smallest) elements along `axis` and
+        their positions (as int64), ordered from the largest (or
+        smallest).
+
+        This does not sort the whole array.
+
+        Returns
+        -------
+        (values, indices)
+        """
+        cdef GpuArray vals
+        cdef GpuArray idx
+        cdef size_t odim
+        if axis < 0:
+            axis += self.ga.nd
+        if axis < 0 or axis >= <int>self.ga.nd:
+            raise ValueError, "axis out of range"
+        if k > self.ga.dimensions[axis]:
+            raise ValueError, "k is larger than the axis"
+        odim = self.ga.dimensions[axis]
+        try:
+            self.ga.dimensions[axis] = k
+            vals = pygpu_empty_like(self, GA_C_ORDER, -1)
+            idx = pygpu_empty_like(self, GA_C_ORDER, GA_LONG)
+        finally:
+            self.ga.dimensions[axis] = odim
+        array_topk(vals, idx, self, axis, k, largest)
+        return vals, idx
+
+    def searchsorted(self, v, side='left'):
+        """
+        searchsorted(v, side='left')
+
+        Find the positions (as int64) where the elements of `v` should
+        be inserted to keep this 1d array sorted (like
+        numpy.searchsorted()).
+
+        Parameters
+        ----------
+        v: array-like
+            Values to insert, converted to the dtype of this array.
+        side: {'left', 'right'}
+            Return the first ('left') or last ('right') suitable
+            position.
+        """
+        cdef GpuArray vals
+        cdef GpuArray res
+        if side not in ('left', 'right'):
+            raise ValueError, "side must be 'left' or 'right'"
+        vals = asarray(v, dtype=self.dtype, context=self.context)
+        res = pygpu_empty_like(vals, GA_C_ORDER, GA_LONG)
+        array_searchsorted(res, self, vals, side == 'right')
         return res
 
     def __hash__(self):
@@ -2340,24 +3286,8 @@ cdef class GpuKernel:
 
     """
     def __dealloc__(self):
-        cdef unsigned int numargs
-        cdef int *types
-        cdef unsigned int i
-        cdef int res
-        # We need to do all of this at the C level to avoid touching
-        # python stuff that could be gone and to avoid exceptions
         if self.k.k is not NULL:
-            res = gpukernel_property(self.k.k, GA_KERNEL_PROP_NUMARGS, &numargs)
-            if res != GA_NO_ERROR:
-                return
-            res = gpukernel_property(self.k.k, GA_KERNEL_PROP_TYPES, &types)
-            if res != GA_NO_ERROR:
-                return
-            for i in range(numargs):
-                if types[i] != GA_BUFFER:
-                    free(self.callbuf[i])
             kernel_clear(self)
-        free(self.callbuf)
 
     def __reduce__(self):
         raise RuntimeError, "Cannot pickle GpuKernel object"
@@ -2372,6 +3302,7 @@ cdef class GpuKernel:
         cdef int *_types
         cdef int flags = 0
 
+        t = _stats.start()
         source = _s(source)
         name = _s(name)
 
@@ -2393,9 +3324,6 @@ cdef class GpuKernel:
         s[0] = source
         l = len(source)
         numargs = <unsigned int>len(types)
-        self.callbuf = <void **>calloc(len(types), sizeof(void *))
-        if self.callbuf == NULL:
-            raise MemoryError
         _types = <int *>calloc(numargs, sizeof(int))
         if _types == NULL:
             raise MemoryError
@@ -2405,13 +3333,11 @@ cdef class GpuKernel:
                     _types[i] = GA_BUFFER
                 else:
                     _types[i] = dtype_to_typecode(types[i])
-                    self.callbuf[i] = malloc(gpuarray_get_elsize(_types[i]))
-                    if self.callbuf[i] == NULL:
-                        raise MemoryError
             kernel_init(self, self.context.ctx, 1, s, &l,
                         name, numargs, _types, flags)
         finally:
             free(_types)
+        _stats.record('GpuKernel', 'compile', t)
 
     def __call__(self, *args, n=None, gs=None, ls=None, shared=0):
         """
@@ -2422,6 +3348,8 @@ cdef class GpuKernel:
         self.do_call(n, gs, ls, args, shared)
 
     cdef do_call(self, py_n, py_gs, py_ls, py_args, size_t shared):
+        cdef void **callbuf
+        cdef long long *vals
         cdef size_t n
         cdef size_t gs[3]
         cdef size_t ls[3]
@@ -2482,44 +3410,63 @@ cdef class GpuKernel:
         if len(py_args) != numargs:
             raise TypeError, "Expected %d arguments, got %d," % (numargs, len(py_args))
         kernel_property(self, GA_KERNEL_PROP_TYPES, &types)
-        for i in range(numargs):
-            self._setarg(i, types[i], py_args[i])
         if py_n is not None:
             if nd != 1:
                 raise ValueError, "n is specified and nd != 1"
             n = py_n
             kernel_sched(self, n, &gs[0], &ls[0])
-        kernel_call(self, nd, gs, ls, shared, self.callbuf)
+        # The argument buffer is per-call since the launch runs
+        # without the GIL and other threads may call this kernel.
+        # Scalars go in 8-byte slots which fit any of the types.
+        callbuf = <void **>calloc(numargs + 1, sizeof(void *))
+        vals = <long long *>calloc(numargs + 1, sizeof(long long))
+        if callbuf == NULL or vals == NULL:
+            free(callbuf)
+            free(vals)
+            raise MemoryError
+        try:
+            t = _stats.start()
+            for i in range(numargs):
+                if types[i] != GA_BUFFER:
+                    callbuf[i] = <void *>&vals[i]
+                self._setarg(callbuf, i, types[i], py_args[i])
+            t = _stats.record('GpuKernel', 'setargs', t)
+            kernel_call(self, nd, gs, ls, shared, callbuf)
+            _stats.record('GpuKernel', 'launch', t)
+        finally:
+            free(callbuf)
+            free(vals)
 
-    cdef _setarg(self, unsigned int index, int typecode, object o):
+    cdef _setarg(self, void **callbuf, unsigned int index, int typecode,
+                 object o):
         if typecode == GA_BUFFER:
             if not isinstance(o, GpuArray):
                 raise TypeError, "expected a GpuArray"
-            self.callbuf[index] = <void *>((<GpuArray>o).ga.data)
+            callbuf[index] = <void *>((<GpuArray>o).ga.data)
         elif typecode == GA_SIZE:
-            (<size_t *>self.callbuf[index])[0] = o
+            (<size_t *>callbuf[index])[0] = o
         elif typecode == GA_SSIZE:
-            (<ssize_t *>self.callbuf[index])[0] = o
+            (<ssize_t *>callbuf[index])[0] = o
         elif typecode == GA_FLOAT:
-            (<float *>self.callbuf[index])[0] = o
+            (<float *>callbuf[index])[0] = o
         elif typecode == GA_DOUBLE:
-            (<double *>self.callbuf[index])[0] = o
+            (<double *>callbuf[index])[0] = o
         elif typecode == GA_BYTE:
-            (<signed char *>self.callbuf[index])[0] = o
+            (<signed char *>callbuf[index])[0] = o
         elif typecode == GA_UBYTE:
-            (<unsigned char *>self.callbuf[index])[0] = o
+            (<unsigned char *>callbuf[index])[0] = o
         elif typecode == GA_SHORT:
-            (<short *>self.callbuf[index])[0] = o
+            (<short *>callbuf[index])[0] = o
         elif typecode == GA_USHORT:
-            (<unsigned short *>self.callbuf[index])[0] = o
+            (<unsigned short *>callbuf[index])[0] = o
         elif typecode == GA_INT:
-            (<int *>self.callbuf[index])[0] = o
+            (<int *>callbuf[index])[0] = o
         elif typecode == GA_UINT:
-            (<unsigned int *>self.callbuf[index])[0] = o
+            (<unsigned int *>callbuf[index])[0] = o
         elif typecode == GA_LONG:
-            (<long *>self.callbuf[index])[0] = o
+            (<long *>callbuf[index])[0] = o
         elif typecode == GA_ULONG:
-            (<unsigned long *>self.callbuf[index])[0] = o
+            (<unsigned long *>callbuf[index])[0] = o
         else:
             raise ValueError("Bad typecode in _setarg: %d "
                              "(please report this, it is a bug)" % (typecode,))
@@ -5,9 +5,11 @@ from mako.template import Template
 
 import numpy
 
-from . import gpuarray
-from .tools import ScalarArg, ArrayArg, check_args, prod, lru_cache
-from .dtypes import parse_c_arg_backend
+from . import gpuarray, _stats
+from ._reduction import GpuReduction
+from .tools import (ScalarArg, ArrayArg, as_argument, check_args, prod,
+                    lru_cache)
+from .dtypes import dtype_to_ctype, parse_c_arg_backend
 
 
 def parse_c_args(arguments):
@@ -30,6 +32,68 @@ def _ceil_log2(x):
         return 0
 
 
+@lru_cache()
+def _fastdiv(d, bits=32):
+    # Multiplier and packed shifts for ga_udiv_uint() (or ga_udiv_size()
+    # for bits=64) so that the kernels don't need a hardware division
+    # to split up indices.  Same as ga_fastdiv_init().
+    d = max(d, 1)
+    l = _ceil_log2(d)
+    # _ceil_log2 goes through floats, fix it up for large d
+    while (1 << l) < d:
+        l += 1
+    while l > 0 and (1 << (l - 1)) >= d:
+        l -= 1
+    m = ((1 << bits) * ((1 << l) - d)) // d + 1
+    sh1 = min(l, 1)
+    sh2 = max(l - 1, 0)
+    return m, sh1 | (sh2 << 1)
+
+
+def _broadcast_args(args, nd):
+    # Same rules as GpuElemwise with GE_BROADCAST | GE_PADSHAPE: arrays
+    # are padded with leading dimensions of size 1 and dimensions of
+    # size 1 are repeated with a stride of 0.
+    dims = [1] * nd
+    for arg in args:
+        if isinstance(arg, gpuarray.GpuArray):
+            if arg.ndim > nd:
+                raise ValueError("Array has more dimensions than the "
+                                 "reduction")
+            shp = (1,) * (nd - arg.ndim) + arg.shape
+            for i, d in enumerate(shp):
+                if d != 1:
+                    if dims[i] != 1 and dims[i] != d:
+                        raise ValueError("Array shape differs")
+                    dims[i] = d
+    strs = []
+    offsets = []
+    for arg in args:
+        if isinstance(arg, gpuarray.GpuArray):
+            shp = (1,) * (nd - arg.ndim) + arg.shape
+            st = (0,) * (nd - arg.ndim) + arg.strides
+            strs.append(tuple(0 if d == 1 else s for d, s in zip(shp, st)))
+            offsets.append(arg.offset)
+        else:
+            strs.append(None)
+            offsets.append(None)
+    return prod(dims), nd, tuple(dims), tuple(strs), tuple(offsets)
+
+
+def _need_addr64(n, dims, strs):
+    # The 32-bit kernels need the element count and the byte span of
+    # each array to fit.  Offsets are applied to the pointers once so
+    # they don't matter.
+    if n >= 2**32 - 1:
+        return True
+    for st in strs:
+        if st is None:
+            continue
+        if sum((d - 1) * abs(s) for d, s in zip(dims, st) if d > 0) >= 2**31 - 1:
+            return True
+    return False
+
+
 basic_kernel = Template("""
 #include "cluda.h"
 
@@ -37,26 +101,30 @@ ${preamble}
 
 #define REDUCE(a, b) (${reduce_expr})
 
-KERNEL void ${name}(const unsigned int n, ${out_arg.decltype()} out,
-                    const unsigned int out_off
+KERNEL void ${name}(const ${idx} n, ${out_arg.decltype()} out,
+                    const ga_size out_off
 % for d in range(nd):
-                    , const unsigned int dim${d}
+                    , const ${idx} dim${d}
+% endfor
+% for d in range(1, nd):
+                    , const ${idx} dim${d}_m
+                    , const ga_uint dim${d}_s
 % endfor
 % for arg in arguments:
     % if arg.isarray():
                     , ${arg.decltype()} ${arg.name}_data
-                    , const unsigned int ${arg.name}_offset
+                    , const ga_size ${arg.name}_offset
         % for d in range(nd):
-                    , const int ${arg.name}_str_${d}
+                    , const ${sidx} ${arg.name}_str_${d}
         % endfor
     % else:
                     , ${arg.decltype()} ${arg.name}
     % endif
 % endfor
 ) {
-  LOCAL_MEM ${out_arg.ctype()} ldata[${local_size}];
+  LOCAL_MEM ${acc_ctype} ldata[${local_size}];
   const unsigned int lid = LID_0;
-  unsigned int i;
+  ${idx} i;
   GLOBAL_MEM char *tmp;
 
 % for arg in arguments:
@@ -72,19 +140,20 @@ KERNEL void ${name}(const unsigned int n, ${out_arg.decltype()} out,
 % for i in range(nd-1, -1, -1):
   % if not redux[i]:
     % if i > 0:
-  const unsigned int pos${i} = i % dim${i};
-  i = i / dim${i};
+  const ${idx} q${i} = ${udiv}(i, dim${i}_m, dim${i}_s);
+  const ${sidx} pos${i} = i - q${i} * dim${i};
+  i = q${i};
     % else:
-  const unsigned int pos${i} = i;
+  const ${sidx} pos${i} = i;
     % endif
   % endif
 % endfor
 
-  ${out_arg.ctype()} acc = ${neutral};
+  ${acc_ctype} acc = ${neutral};
 
   for (i = lid; i < n; i += LDIM_0) {
-    int ii = i;
-    int pos;
+    ${idx} ii = i, q;
+    ${sidx} pos;
 % for arg in arguments:
     % if arg.isarray():
         GLOBAL_MEM char *${arg.name}_p = (GLOBAL_MEM char *)${arg.name}_data;
@@ -93,8 +162,9 @@ KERNEL void ${name}(const unsigned int n, ${out_arg.decltype()} out,
 % for i in range(nd-1, -1, -1):
     % if redux[i]:
         % if i > 0:
-        pos = ii % dim${i};
-        ii = ii / dim${i};
+        q = ${udiv}(ii, dim${i}_m, dim${i}_s);
+        pos = ii - q * dim${i};
+        ii = q;
         % else:
         pos = ii;
         % endif
@@ -129,14 +199,33 @@ KERNEL void ${name}(const unsigned int n, ${out_arg.decltype()} out,
     }
   % endwhile
   local_barrier();
-  if (lid == 0) out[GID_0] = ldata[0];
+  if (lid == 0) {
+    acc = ldata[0];
+    out[GID_0] = ${post_expr};
+  }
 }
 """)
 
 
 class ReductionKernel(object):
+    """
+    ReductionKernel(context, dtype_out, neutral, reduce_expr, redux,
+                    map_expr=None, arguments=None, preamble="",
+                    init_nd=None, acc_ctype=None, acc_size=None,
+                    post_expr=None)
+
+    Reduction over the axes flagged in `redux` of `map_expr` (in terms
+    of `arguments`, indexed with `[i]`) combined with `reduce_expr` (in
+    terms of `a` and `b`) starting from `neutral`.
+
+    The accumulator is of the output type unless `acc_ctype` (a C type
+    of `acc_size` bytes, which can be a struct declared in `preamble`)
+    is given.  The value stored in the output is `post_expr`, in terms
+    of the accumulator `acc` and the number of reduced elements `n`.
+    """
     def __init__(self, context, dtype_out, neutral, reduce_expr, redux,
-                 map_expr=None, arguments=None, preamble="", init_nd=None):
+                 map_expr=None, arguments=None, preamble="", init_nd=None,
+                 acc_ctype=None, acc_size=None, post_expr=None):
         self.context = context
         self.neutral = neutral
         self.redux = tuple(redux)
@@ -153,11 +242,11 @@ class ReductionKernel(object):
         else:
             self.arguments = arguments
 
-        if (self.dtype_out == numpy.dtype('float16') or
-                any(ar.dtype == numpy.dtype('float16')
-                    for ar in self.arguments)):
-            raise NotImplementedError('float16 not supported for the '
-                                      'reduction interface')
+        # ga_half has no arithmetic, so float16 is accumulated in
+        # float32.  A map_expr has to load float16 arguments with
+        # ga_half2float() itself.
+        half = numpy.dtype('float16')
+        out_half = numpy.dtype(self.dtype_out) == half
 
         self.reduce_expr = reduce_expr
         if map_expr is None:
@@ -165,8 +254,9 @@ class ReductionKernel(object):
                 raise ValueError("Don't know what to do with more than one "
                                  "argument. Specify map_expr to explicitly "
                                  "state what you want.")
-            self.operation = "%s[i]" % (self.arguments[0].name,)
-            self.expression = "%s[0]" % (self.arguments[0].name,)
+            self.operation = _load(self.arguments[0].name,
+                                   self.arguments[0].dtype)
+            self.expression = massage_op(self.operation)
         else:
             self.operation = map_expr
             self.expression = massage_op(map_expr)
@@ -179,25 +269,42 @@ class ReductionKernel(object):
         have_small = False
         have_double = False
         have_complex = False
+        have_half = out_half
         for arg in self.arguments:
             if arg.dtype.itemsize < 4 and type(arg) == ArrayArg:
                 have_small = True
+            if arg.dtype == half:
+                have_half = True
             if arg.dtype in [numpy.float64, numpy.complex128]:
                 have_double = True
             if arg.dtype in [numpy.complex64, numpy.complex128]:
                 have_complex = True
+        if self.out_arg.dtype in [numpy.float64, numpy.complex128]:
+            have_double = True
 
         self.flags = dict(have_small=have_small, have_double=have_double,
-                          have_complex=have_complex)
+                          have_complex=have_complex, have_half=have_half)
         self.preamble = preamble
 
-        self.init_local_size = min(context.lmemsize //
-                                   self.out_arg.dtype.itemsize,
+        if acc_ctype is None:
+            acc_dtype = _acc_dtype(self.out_arg.dtype)
+            acc_ctype = dtype_to_ctype(acc_dtype)
+            acc_size = acc_dtype.itemsize
+        elif acc_size is None:
+            raise ValueError("acc_size is required with acc_ctype")
+        self.acc_ctype = acc_ctype
+        if post_expr is None:
+            post_expr = "acc"
+        if out_half:
+            post_expr = "ga_float2half(%s)" % (post_expr,)
+        self.post_expr = post_expr
+
+        self.init_local_size = min(context.lmemsize // acc_size,
                                    context.maxlsize0)
 
         # this is to prep the cache
         if init_nd is not None:
-            self._get_basic_kernel(self.init_local_size, init_nd)
+            self._get_basic_kernel(self.init_local_size, init_nd, False)
 
     def _find_kernel_ls(self, tmpl, max_ls, *tmpl_args):
         local_size = min(self.init_local_size, max_ls)
@@ -218,7 +325,14 @@ class ReductionKernel(object):
                            " Please report this along with your "
                            "reduction code.")
 
-    def _gen_basic(self, ls, nd):
+    def _gen_basic(self, ls, nd, addr64):
+        t = _stats.start()
+        if addr64:
+            idx, sidx, udiv = 'ga_size', 'ga_ssize', 'ga_udiv_size'
+            ispec, sspec = gpuarray.SIZE, gpuarray.SSIZE
+        else:
+            idx, sidx, udiv = 'ga_uint', 'ga_int', 'ga_udiv_uint'
+            ispec, sspec = 'uint32', 'int32'
         src = basic_kernel.render(preamble=self.preamble,
                                   reduce_expr=self.reduce_expr,
                                   name="reduk",
@@ -227,38 +341,58 @@ class ReductionKernel(object):
                                   local_size=ls,
                                   redux=self.redux,
                                   neutral=self.neutral,
-                                  map_expr=self.expression)
-        spec = ['uint32', gpuarray.GpuArray, 'uint32']
-        spec.extend('uint32' for _ in range(nd))
+                                  map_expr=self.expression,
+                                  acc_ctype=self.acc_ctype,
+                                  post_expr=self.post_expr,
+                                  idx=idx, sidx=sidx, udiv=udiv)
+        spec = [ispec, gpuarray.GpuArray, gpuarray.SIZE]
+        spec.extend(ispec for _ in range(nd))
+        for _ in range(nd - 1):
+            spec.extend([ispec, 'uint32'])
         for i, arg in enumerate(self.arguments):
             spec.append(arg.spec())
             if arg.isarray():
-                spec.append('uint32')
-                spec.extend('int32' for _ in range(nd))
+                spec.append(gpuarray.SIZE)
+                spec.extend(sspec for _ in range(nd))
+        t = _stats.record('ReductionKernel', 'codegen', t)
         k = gpuarray.GpuKernel(src, "reduk", spec, context=self.context,
                                **self.flags)
+        _stats.record('ReductionKernel', 'compile', t)
         return k, src, spec
 
     @lru_cache()
-    def _get_basic_kernel(self, maxls, nd):
-        return self._find_kernel_ls(self._gen_basic, maxls, nd)
+    def _get_basic_kernel(self, maxls, nd, addr64):
+        return self._find_kernel_ls(self._gen_basic, maxls, nd, addr64)
 
     def __call__(self, *args, **kwargs):
+        """
+        __call__(*args, broadcast=False, out=None)
+
+        With `broadcast`, arrays with fewer dimensions than the
+        reduction are padded with leading dimensions and dimensions of
+        size 1 are repeated, like for GpuElemwise.
+        """
+        t = _stats.start()
         broadcast = kwargs.pop('broadcast', None)
         out = kwargs.pop('out', None)
         if len(kwargs) != 0:
             raise TypeError('Unexpected keyword argument: %s' %
-                            kwargs.keys()[0])
+                            list(kwargs.keys())[0])
 
-        _, nd, dims, strs, offsets = check_args(args, collapse=False,
-                                                broadcast=broadcast)
+        if broadcast:
+            n, nd, dims, strs, offsets = _broadcast_args(args,
+                                                         len(self.redux))
+        else:
+            n, nd, dims, strs, offsets = check_args(args, collapse=False)
+        if nd != len(self.redux):
+            raise ValueError("Expected arrays with %d dimensions, got %d" %
+                             (len(self.redux), nd))
 
-        n = prod(dims)
         out_shape = tuple(d for i, d in enumerate(dims) if not self.redux[i])
         gs = prod(out_shape)
         if gs == 0:
             gs = 1
-        n /= gs
+        n //= gs
         if gs > self.context.maxgsize0:
             raise ValueError("Array too big to be reduced along the "
                              "selected axes")
@@ -272,14 +406,21 @@ class ReductionKernel(object):
                     "Out array is not of expected type (expected %s %s, "
                     "got %s %s)" % (out_shape, self.dtype_out, out.shape,
                                     out.dtype))
+        addr64 = _need_addr64(n * gs, dims, strs)
+        t = _stats.record('ReductionKernel', 'check_args', t)
         # Don't compile and cache for nothing for big size
         if self.init_local_size < n:
-            k, _, _, ls = self._get_basic_kernel(self.init_local_size, nd)
+            k, _, _, ls = self._get_basic_kernel(self.init_local_size, nd,
+                                                 addr64)
         else:
-            k, _, _, ls = self._get_basic_kernel(2**_ceil_log2(n), nd)
+            k, _, _, ls = self._get_basic_kernel(2**_ceil_log2(n), nd,
+                                                 addr64)
+        t = _stats.record('ReductionKernel', 'cache', t)
 
         kargs = [n, out, out.offset]
         kargs.extend(dims)
+        for d in dims[1:]:
+            kargs.extend(_fastdiv(d, 64 if addr64 else 32))
         for i, arg in enumerate(args):
             kargs.append(arg)
             if isinstance(arg, gpuarray.GpuArray):
@@ -287,33 +428,390 @@ class ReductionKernel(object):
                 kargs.extend(strs[i])
 
         k(*kargs, gs=gs, ls=ls)
+        _stats.record('ReductionKernel', 'launch', t)
 
         return out
 
 
-def reduce1(ary, op, neutral, out_type, axis=None, out=None, oper=None):
+@lru_cache()
+def _get_reduction(context, reduce_expr, neutral, src_type, dst_type,
+                   map_expr, acc_type):
+    return GpuReduction(context, reduce_expr, neutral, src_type, dst_type,
+                        map_expr=map_expr, acc_type=acc_type)
+
+
+def reduce1(ary, op, neutral, out_type, axis=None, out=None, oper=None,
+            map_expr=None, acc_type=None):
+    """
+    Reduce `ary` over `axis` (all axes if None) with the associative and
+    commutative operator `op` (or the expression `oper` in terms of `a`
+    and `b`) starting from `neutral`.
+
+    Elements are converted to `acc_type` (`out_type` by default, float32
+    for float16) before going through `map_expr`, if given.
+    """
+    t = _stats.start()
     nd = ary.ndim
     if axis is None:
-        redux = [True] * nd
+        axes = list(range(nd))
     else:
-        redux = [False] * nd
-
         if not isinstance(axis, (list, tuple)):
             axis = (axis,)
 
+        axes = []
         for ax in axis:
             if ax < 0:
                 ax += nd
             if ax < 0 or ax >= nd:
                 raise ValueError('axis out of bounds')
-            redux[ax] = True
+            if ax not in axes:
+                axes.append(ax)
+    if len(axes) == 0:
+        raise ValueError("Reduction is along no axes")
 
     if oper is None:
         reduce_expr = "a %s b" % (op,)
     else:
         reduce_expr = oper
 
-    r = ReductionKernel(ary.context, dtype_out=out_type, neutral=neutral,
-                        reduce_expr=reduce_expr, redux=redux,
-                        arguments=[ArrayArg(ary.dtype, 'a')])
-    return r(ary, out=out)
+    out_type = numpy.dtype(out_type)
+    out_shape = tuple(d for i, d in enumerate(ary.shape) if i not in axes)
+    if out is None:
+        out = gpuarray.empty(out_shape, context=ary.context, dtype=out_type,
+                             cls=type(ary))
+    elif out.shape != out_shape or out.dtype != out_type:
+        raise TypeError(
+            "Out array is not of expected type (expected %s %s, "
+            "got %s %s)" % (out_shape, out_type, out.shape, out.dtype))
+
+    if acc_type is not None:
+        acc_type = numpy.dtype(acc_type)
+    t = _stats.record('reduce1', 'check_args', t)
+    r = _get_reduction(ary.context, reduce_expr, neutral, ary.dtype,
+                       out_type, map_expr, acc_type)
+    t = _stats.record('reduce1', 'cache', t)
+    r(out, ary, axes)
+    _stats.record('reduce1', 'launch', t)
+    return out
+
+
+
+def _axes(nd, axis):
+    if axis is None:
+        return list(range(nd))
+    if not isinstance(axis, (list, tuple)):
+        axis = (axis,)
+    axes = []
+    for ax in axis:
+        if ax < 0:
+            ax += nd
+        if ax < 0 or ax >= nd:
+            raise ValueError('axis out of bounds')
+        if ax not in axes:
+            axes.append(ax)
+    if len(axes) == 0:
+        raise ValueError("Reduction is along no axes")
+    return axes
+
+
+def _float_dtype(dtype):
+    dtype = numpy.dtype(dtype)
+    if dtype.kind == 'f':
+        return dtype
+    return numpy.dtype('float64')
+
+
+def _acc_dtype(dtype):
+    # Type of the accumulator for results of type `dtype`
+    dtype = numpy.dtype(dtype)
+    if dtype == numpy.dtype('float16'):
+        return numpy.dtype('float32')
+    return dtype
+
+
+def _load(name, dtype, ctype=None):
+    # Expression reading `name[i]` of type `dtype`, cast to `ctype`
+    if numpy.dtype(dtype) == numpy.dtype('float16'):
+        expr = "ga_half2float(%s[i])" % (name,)
+    else:
+        expr = "%s[i]" % (name,)
+    if ctype is not None:
+        expr = "(%s)%s" % (ctype, expr)
+    return expr
+
+
+@lru_cache()
+def _get_map_reduce(context, dtype_out, neutral, reduce_expr, redux,
+                    map_expr, arguments, preamble, acc_ctype, acc_size,
+                    post_expr):
+    return ReductionKernel(context, dtype_out, neutral, reduce_expr, redux,
+                           map_expr=map_expr, arguments=list(arguments),
+                           preamble=preamble, acc_ctype=acc_ctype,
+                           acc_size=acc_size, post_expr=post_expr)
+
+
+def map_reduce(map_expr, args, axis=None, reduce_expr="a + b", neutral="0",
+               dtype=None, out=None, preamble="", acc_ctype=None,
+               acc_size=None, post_expr=None):
+    """
+    Reduce `map_expr` over `axis` (all axes if None) in a single kernel.
+
+    `args` is a sequence of (name, value) pairs (or a dict) of the
+    arrays and scalars `map_expr` refers to, with arrays indexed as
+    `name[i]`.  The arrays are broadcast together like for GpuElemwise.
+    This avoids writing out the mapped values, e.g. for
+    ``sum((a - b)**2)``::
+
+        map_reduce("(a[i] - b[i]) * (a[i] - b[i])", [('a', a), ('b', b)])
+
+    The remaining parameters are as for ReductionKernel.  The output
+    type defaults to the type of the first array.
+    """
+    t = _stats.start()
+    if isinstance(args, dict):
+        args = list(args.items())
+    arrays = [v for _, v in args if isinstance(v, gpuarray.GpuArray)]
+    if len(arrays) == 0:
+        raise TypeError("map_reduce needs at least one array argument")
+    context = arrays[0].context
+    # 0-d arrays are reduced as 1-d arrays of one element
+    nd = max(max(a.ndim for a in arrays), 1)
+    axes = _axes(nd, axis)
+    redux = tuple(i in axes for i in range(nd))
+
+    if dtype is None:
+        dtype = arrays[0].dtype
+    dtype = numpy.dtype(dtype)
+    arguments = tuple(as_argument(v, name) for name, v in args)
+    t = _stats.record('map_reduce', 'check_args', t)
+    k = _get_map_reduce(context, dtype, neutral, reduce_expr, redux,
+                        map_expr, arguments, preamble, acc_ctype, acc_size,
+                        post_expr)
+    t = _stats.record('map_reduce', 'cache', t)
+    res = k(*[v for _, v in args], broadcast=True, out=out)
+    _stats.record('map_reduce', 'launch', t)
+    return res
+
+
+def vdot(a, b, axis=None, dtype=None, out=None):
+    """
+    Sum of the products of `a` and `b` over `axis` (all axes if None),
+    without writing out the products.  `a` and `b` are broadcast
+    together.
+    """
+    if dtype is None:
+        dtype = numpy.result_type(a.dtype, b.dtype)
+    ctype = dtype_to_ctype(_acc_dtype(dtype))
+    return map_reduce("%s * %s" % (_load('a', a.dtype, ctype),
+                                   _load('b', b.dtype, ctype)),
+                      [('a', a), ('b', b)], axis=axis, dtype=dtype, out=out)
+
+
+def norm(a, axis=None, out=None):
+    """
+    Euclidean norm of `a` over `axis` (all axes if None).
+    """
+    dtype = _float_dtype(a.dtype)
+    x = _load('a', a.dtype, dtype_to_ctype(_acc_dtype(dtype)))
+    return map_reduce("%s * %s" % (x, x), [('a', a)],
+                      axis=axis, dtype=dtype, out=out, post_expr="sqrt(acc)")
+
+
+def mean(a, axis=None, dtype=None, out=None):
+    """
+    Mean of `a` over `axis` (all axes if None).
+    """
+    if dtype is None:
+        dtype = _float_dtype(a.dtype)
+    ctype = dtype_to_ctype(_acc_dtype(dtype))
+    return map_reduce(_load('a', a.dtype, ctype), [('a', a)], axis=axis,
+                      dtype=dtype, out=out,
+                      post_expr="acc / (%s)n" % (ctype,))
+
+
+welford_preamble = Template("""
+typedef struct _welford_t { ${t} n; ${t} mean; ${t} m2; } welford_t;
+
+WITHIN_KERNEL welford_t welford_init(${t} x) {
+  welford_t r;
+  r.n = 1; r.mean = x; r.m2 = 0;
+  return r;
+}
+
+WITHIN_KERNEL welford_t welford_neutral(void) {
+  welford_t r;
+  r.n = 0; r.mean = 0; r.m2 = 0;
+  return r;
+}
+
+WITHIN_KERNEL welford_t welford_combine(welford_t a, welford_t b) {
+  welford_t r;
+  ${t} d, f;
+  r.n = a.n + b.n;
+  if (r.n == 0) return a;
+  f = b.n / r.n;
+  d = b.mean - a.mean;
+  r.mean = a.mean + d * f;
+  r.m2 = a.m2 + b.m2 + d * d * a.n * f;
+  return r;
+}
+""")
+
+
+def var(a, axis=None, ddof=0, dtype=None, out=None):
+    """
+    Variance of `a` over `axis` (all axes if None), divided by
+    ``n - ddof``.
+
+    This is done in a single pass with Welford's algorithm, which
+    doesn't lose precision like accumulating the sum of squares.
+    """
+    if dtype is None:
+        dtype = _float_dtype(a.dtype)
+    acc_dtype = _acc_dtype(dtype)
+    ctype = dtype_to_ctype(acc_dtype)
+    return map_reduce("welford_init(%s)" % (_load('a', a.dtype, ctype),),
+                      [('a', a)],
+                      axis=axis, reduce_expr="welford_combine(a, b)",
+                      neutral="welford_neutral()", dtype=dtype, out=out,
+                      preamble=welford_preamble.render(t=ctype),
+                      acc_ctype="welford_t", acc_size=3 * acc_dtype.itemsize,
+                      post_expr="acc.m2 / (acc.n - %d)" % (ddof,))
+
+
+lse_preamble = Template("""
+typedef struct _lse_t { ${t} m; ${t} s; } lse_t;
+
+WITHIN_KERNEL lse_t lse_init(${t} x) {
+  lse_t r;
+  r.m = x; r.s = 1;
+  return r;
+}
+
+WITHIN_KERNEL lse_t lse_neutral(void) {
+  lse_t r;
+  r.m = -INFINITY; r.s = 0;
+  return r;
+}
+
+WITHIN_KERNEL lse_t lse_combine(lse_t a, lse_t b) {
+  lse_t r;
+  r.m = a.m > b.m ? a.m : b.m;
+  if (r.m == -INFINITY) return a;
+  r.s = a.s * exp(a.m - r.m) + b.s * exp(b.m - r.m);
+  return r;
+}
+""")
+
+
+def logsumexp(a, axis=None, out=None):
+    """
+    ``log(sum(exp(a)))`` over `axis` (all axes if None).
+
+    This is the log of the softmax denominator.  It is computed in a
+    single pass by rescaling the partial sums to the running maximum,
+    so it doesn't overflow for large inputs.
+    """
+    dtype = _float_dtype(a.dtype)
+    acc_dtype = _acc_dtype(dtype)
+    ctype = dtype_to_ctype(acc_dtype)
+    return map_reduce("lse_init(%s)" % (_load('a', a.dtype, ctype),),
+                      [('a', a)],
+                      axis=axis, reduce_expr="lse_combine(a, b)",
+                      neutral="lse_neutral()", dtype=dtype, out=out,
+                      preamble=lse_preamble.render(t=ctype),
+                      acc_ctype="lse_t", acc_size=2 * acc_dtype.itemsize,
+                      post_expr="acc.m + log(acc.s)")
+
+
+def _normalize_out(a, axis, out):
+    nd = a.ndim
+    if axis < 0:
+        axis += nd
+    if axis < 0 or axis >= nd:
+        raise ValueError('axis out of bounds')
+    if out is None:
+        out = gpuarray.empty(a.shape, context=a.context,
+                             dtype=a.dtype, cls=type(a))
+    elif out.shape != a.shape:
+        raise ValueError("Out array has the wrong shape (expected %s, "
+                         "got %s)" % (a.shape, out.shape))
+    return axis, out
+
+
+def softmax(a, axis=-1, out=None):
+    """
+    ``exp(a) / sum(exp(a))`` along `axis`.
+
+    Each row is read once to get both its maximum and the sum of the
+    exponentials, so this doesn't overflow for large inputs.  `a` must
+    be of a floating point type.  `out` can be `a`.
+    """
+    axis, out = _normalize_out(a, axis, out)
+    gpuarray._softmax(out, a, axis)
+    return out
+
+
+def logsoftmax(a, axis=-1, out=None):
+    """
+    ``a - logsumexp(a)`` along `axis`.
+
+    See softmax() for the arguments.
+    """
+    axis, out = _normalize_out(a, axis, out)
+    gpuarray._softmax(out, a, axis, log=True)
+    return out
+
+
+def layernorm(a, weight=None, bias=None, axis=-1, eps=1e-5, out=None):
+    """
+    Normalize `a` to zero mean and unit variance along `axis`, then
+    scale by `weight` and shift by `bias` if they are given.
+
+    The variance is the biased one (like var() with ``ddof=0``) and
+    `eps` is added to it.  `weight` and `bias` must be vectors of the
+    size of `axis`.  The mean and variance are computed in a single
+    pass with Welford's algorithm.
+    """
+    axis, out = _normalize_out(a, axis, out)
+    gpuarray._layernorm(out, a, weight, bias, axis, eps)
+    return out
+
+
+def scan1(ary, op, neutral, out_type, axis=None, out=None, oper=None,
+          exclusive=False, segments=None):
+    """
+    Scan `ary` along `axis` with the associative operator `op` (or the
+    expression `oper` in terms of `a` and `b`) like numpy.cumsum().
+
+    If `axis` is None the flattened array is scanned.  Each non-zero
+    element of `segments` (an array of the shape of `ary`) restarts the
+    scan.
+    """
+    if axis is None:
+        ary = ary.reshape((ary.size,))
+        if segments is not None:
+            segments = segments.reshape((segments.size,))
+        axis = 0
+    nd = ary.ndim
+    if axis < 0:
+        axis += nd
+    if axis < 0 or axis >= nd:
+        raise ValueError('axis out of bounds')
+
+    if oper is None:
+        scan_expr = "a %s b" % (op,)
+    else:
+        scan_expr = oper
+
+    out_type = numpy.dtype(out_type)
+    if out is None:
+        out = gpuarray.empty(ary.shape, context=ary.context, dtype=out_type,
+                             cls=type(ary))
+    elif out.shape != ary.shape or out.dtype != out_type:
+        raise TypeError(
+            "Out array is not of expected type (expected %s %s, "
+            "got %s %s)" % (ary.shape, out_type, out.shape, out.dtype))
+    gpuarray._scan(out, ary, segments, axis, scan_expr, neutral,
+                   exclusive=exclusive)
+    return out
@@ -0,0 +1,31 @@
+from six import StringIO
+
+from pygpu import bench
+
+from .support import context
+
+
+def test_run_and_compare():
+    out = StringIO()
+    r = bench.Runner(samples=3, max_bytes=1 << 16, sample_time=0.0005,
+                     filters=['alloc.same', 'elemwise.contig',
+                              'reduction.sum'], out=out)
+    bench.bench_buffer(r, context)
+    bench.bench_elemwise(r, context)
+    bench.bench_reduction(r, context)
+    assert r.failures == 0
+    names = set(res['name'] for res in r.results)
+    assert names == set(['alloc.same', 'elemwise.contig', 'reduction.sum'])
+
+    f = StringIO()
+    bench.write_results(f, r.results, 'dev', context.devname)
+    f.seek(0)
+    base = bench.load_results(f)
+    assert [(b['name'], b['params']) for b in base] == \
+        [(res['name'], res['params']) for res in r.results]
+
+    assert bench.compare(r.results, base, out=out) == []
+    slower = [dict(res) for res in r.results]
+    slower[0]['median_us'] = base[0]['median_us'] * 2 + 1
+    reg = bench.compare(slower, base, threshold=0.5, out=out)
+    assert [res['name'] for res, _ in reg] == [slower[0]['name']]
@@ -1,4 +1,5 @@
 import operator
+import threading
 import numpy
 from mako.template import Template
 
@@ -344,3 +345,52 @@ def infinity(dtype):
                          preamble=preamble)
     kernel(out_g)
     assert numpy.array_equal(ac, numpy.asarray(out_g))
+
+
+def test_elemwise_threads():
+    # One GpuElemwise shared by several threads, each with its own
+    # scalar argument, checks that the per-call argument buffers
+    # don't get mixed up while the GIL is released.
+    ac, ag = gen_gpuarray((1000,), 'float32', ctx=context, cls=elemary)
+    k = GpuElemwise(context, "c = a + s",
+                    [arg('a', ag.dtype, read=True),
+                     arg('s', numpy.float32, scalar=True, read=True),
+                     arg('c', ag.dtype, write=True)])
+    errors = []
+
+    def run(i):
+        out = ag._empty_like_me()
+        try:
+            for j in range(20):
+                s = numpy.float32(i * 100 + j)
+                k(ag, s, out)
+                if not numpy.array_equal(numpy.asarray(out), ac + s):
+                    errors.append((i, j))
+        except Exception as e:
+            errors.append(e)
+
+    threads = [threading.Thread(target=run, args=(i,)) for i in range(4)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    assert errors == [], errors
+
+
+def test_elemwise_specialize():
+    # The same strided geometry repeatedly, so that a specialised
+    # kernel gets built and used, then another geometry.
+    k = GpuElemwise(context, "c = a + s",
+                    [arg('a', numpy.float32, read=True),
+                     arg('s', numpy.float32, scalar=True, read=True),
+                     arg('c', numpy.float32, write=True)],
+                    specialize=True)
+    for shape in [(5, 7), (3, 4)]:
+        ac, ag = gen_gpuarray(shape, 'float32', ctx=context, cls=elemary)
+        ac = ac.T
+        ag = ag.T
+        out = gpuarray.empty(ac.shape, dtype='float32', context=context)
+        for i in range(6):
+            s = numpy.float32(i)
+            k(ag, s, out)
+            assert numpy.array_equal(numpy.asarray(out), ac + s)
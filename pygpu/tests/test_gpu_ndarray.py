@@ -9,12 +9,13 @@ import pickle
 import numpy
 
 from nose.tools import assert_raises
+from nose.plugins.skip import SkipTest
 import pygpu
 from pygpu.gpuarray import GpuArray, GpuKernel
 
-from .support import (guard_devsup, check_meta, check_flags, check_all,
-                      check_content, gen_gpuarray, context as ctx, dtypes_all,
-                      dtypes_no_complex, skip_single_f)
+from .support import (guard_devsup, check_meta, check_meta_only, check_flags,
+                      check_all, check_content, gen_gpuarray, context as ctx,
+                      dtypes_all, dtypes_no_complex, skip_single_f)
 
 
 def product(*args, **kwds):
@@ -754,6 +755,157 @@ def do_take1(shp, idx, offseted):
     check_content(rg, rc)
 
 
+def test_take1_deferred():
+    c, g = gen_gpuarray((4, 3), dtype='float32', ctx=ctx, order='c')
+    gi = pygpu.asarray(numpy.asarray([1, 7]), context=ctx)
+
+    g.take1(gi, deferred=True)
+    assert_raises(IndexError, ctx.check_errors)
+    ctx.check_errors()
+
+    rg = g.take1(gi[:1], deferred=True)
+    check_content(rg, c[1:2])
+    ctx.check_errors()
+
+
+def test_fancy_getitem():
+    yield do_fancy_getitem, (5, 4), ([3, 0, -1],)
+    yield do_fancy_getitem, (5, 4), (slice(None), [[1, 2], [0, 3]])
+    yield do_fancy_getitem, (5, 4, 3), (1, [0, 2], slice(1, 3))
+    yield do_fancy_getitem, (5, 4, 3), ([[0], [4]], [1, 2])
+    yield do_fancy_getitem, (5, 4, 3), (Ellipsis, [2, 1])
+    # non-adjacent advanced indices (integers count) go first
+    yield do_fancy_getitem, (3, 4, 5), (1, slice(None), [0, 2])
+    yield do_fancy_getitem, (3, 4, 5), ([0, 2], slice(None), [[1], [4]])
+    yield do_fancy_getitem, (3, 4, 5), (slice(None), 1, [0, 2])
+
+
+def do_fancy_getitem(shp, key):
+    c, g = gen_gpuarray(shp, dtype='float32', ctx=ctx, order='c')
+    check_content(g[key], c[key])
+    # Index arrays already on the device
+    gkey = tuple(pygpu.asarray(numpy.asarray(k), context=ctx)
+                 if isinstance(k, list) else k for k in key)
+    check_content(g[gkey], c[key])
+
+
+def test_fancy_getitem_bounds():
+    c, g = gen_gpuarray((5, 4), dtype='float32', ctx=ctx, order='c')
+    assert_raises(IndexError, g.__getitem__, [5])
+    assert_raises(IndexError, g.__getitem__, (slice(None), [-5]))
+
+
+def test_mask_getitem():
+    c, g = gen_gpuarray((6, 5), dtype='float32', ctx=ctx, order='c')
+    mask = c > 10
+    check_content(g[mask], c[mask])
+    check_content(g[pygpu.asarray(mask, context=ctx)], c[mask])
+    check_content(g[mask[:, 0]], c[mask[:, 0]])
+    # the mask must match the dimensions it indexes
+    assert_raises(IndexError, g.__getitem__, mask[:5])
+    assert_raises(IndexError, g.__getitem__,
+                  (slice(None), numpy.ones(4, dtype='bool')))
+
+
+def test_fancy_setitem():
+    c, g = gen_gpuarray((5, 4), dtype='float32', ctx=ctx, order='c')
+    c[[3, 0]] = 7
+    g[[3, 0]] = 7
+    check_content(g, c)
+    v = numpy.arange(10, dtype='float32').reshape(5, 2)
+    c[:, [1, 3]] = v
+    g[:, [1, 3]] = v
+    check_content(g, c)
+    mask = c > 5
+    c[mask] = -1
+    g[mask] = -1
+    check_content(g, c)
+    c, g = gen_gpuarray((3, 4, 5), dtype='float32', ctx=ctx, order='c')
+    v = numpy.arange(8, dtype='float32').reshape(2, 4)
+    c[1, :, [0, 2]] = v
+    g[1, :, [0, 2]] = v
+    check_content(g, c)
+
+
+def test_scatter_add():
+    for deterministic in (False, True):
+        c, g = gen_gpuarray((5, 3), dtype='float32', ctx=ctx, order='c')
+        idx = numpy.asarray([[0, 4], [0, 1]])
+        v = numpy.ones((2, 2, 3), dtype='float32')
+        numpy.add.at(c, idx, v)
+        g.scatter_add(idx, v, deterministic=deterministic)
+        check_content(g, c)
+
+
+def test_nonzero():
+    c, g = gen_gpuarray((4, 3, 2), dtype='float32', ctx=ctx, order='c')
+    mask = c > 7
+    c[mask] = 0
+    g[mask] = 0
+    for rg, rc in zip(g.nonzero(), c.nonzero()):
+        check_content(rg, rc)
+
+
+def test_sort():
+    for dtype in ['float32', 'int32', 'uint8']:
+        for axis in [0, 1, -1]:
+            yield do_sort, (5, 7, 3), dtype, axis
+
+
+def do_sort(shp, dtype, axis):
+    c, g = gen_gpuarray(shp, dtype=dtype, ctx=ctx, order='c')
+    # Make sure there are duplicates for the stability check
+    c[...] = c % 4
+    g[...] = c
+    check_content(g.argsort(axis=axis),
+                  numpy.argsort(c, axis=axis, kind='stable'))
+    g.sort(axis=axis)
+    c.sort(axis=axis)
+    check_content(g, c)
+    g.sort(axis=axis, descending=True)
+    check_content(g, numpy.flip(c, axis=axis))
+
+
+def test_sort_nan():
+    c = numpy.asarray([3, numpy.nan, -numpy.inf, 1, numpy.inf, -2],
+                      dtype='float32')
+    g = pygpu.asarray(c, context=ctx)
+    g.sort()
+    c.sort()
+    check_content(g, c)
+
+
+def test_sort_by_key():
+    k = numpy.asarray([[3, 1, 2, 1], [0, 5, 5, 4]], dtype='int16')
+    v = numpy.arange(8, dtype='float64').reshape(2, 4)
+    gk = pygpu.asarray(k, context=ctx)
+    gv = pygpu.asarray(v, context=ctx)
+    rk, rv = pygpu.gpuarray.sort_by_key(gk, gv)
+    p = numpy.argsort(k, axis=1, kind='stable')
+    check_content(rk, numpy.take_along_axis(k, p, axis=1))
+    check_content(rv, numpy.take_along_axis(v, p, axis=1))
+
+
+def test_topk():
+    c, g = gen_gpuarray((6, 50), dtype='float32', ctx=ctx, order='c')
+    for largest in [True, False]:
+        rv, ri = g.topk(5, axis=1, largest=largest)
+        ref = numpy.sort(c, axis=1)
+        ref = ref[:, ::-1][:, :5] if largest else ref[:, :5]
+        check_content(rv, ref)
+        check_content(rv, numpy.take_along_axis(c, numpy.asarray(ri),
+                                                axis=1))
+
+
+def test_searchsorted():
+    c = numpy.asarray([1, 2, 2, 2, 5, 9], dtype='float32')
+    g = pygpu.asarray(c, context=ctx)
+    v = numpy.asarray([[0, 2], [3, 10]], dtype='float32')
+    for side in ['left', 'right']:
+        check_content(g.searchsorted(v, side=side),
+                      numpy.searchsorted(c, v, side=side))
+
+
 def test_flags():
     for fl in ['C', 'F', 'W', 'B', 'O', 'A', 'U', 'CA', 'FA', 'FNC', 'FORC',
                'CARRAY', 'FARRAY', 'FORTRAN', 'BEHAVED', 'OWNDATA', 'ALIGNED',
@@ -782,21 +934,69 @@ def flag_prop(p):
     assert getattr(c3.flags, p) == getattr(g3.flags, p)
 
 
+def test_dlpack():
+    if ctx.kind != b'cuda':
+        raise SkipTest("DLPack is only for cuda")
+    for dtype in ['float32', 'float16', 'int64', 'uint8', 'bool', 'complex64']:
+        c, g = gen_gpuarray((5, 7), dtype=dtype, ctx=ctx)
+        for v in [g, g[::2, 1:], g.T]:
+            assert v.__dlpack_device__()[0] == 2
+            r = pygpu.gpuarray.from_dlpack(v, context=ctx)
+            assert r.gpudata == v.gpudata
+            check_meta_only(r, v)
+            check_content(r, numpy.asarray(v))
+    # The memory stays alive through the capsule
+    c, g = gen_gpuarray((16,), dtype='float32', ctx=ctx)
+    cap = g.__dlpack__()
+    del g
+    r = pygpu.gpuarray.from_dlpack(cap, context=ctx)
+    check_content(r, c)
+    with assert_raises(TypeError):
+        pygpu.gpuarray.from_dlpack(cap, context=ctx)
+
+
+def test_cuda_array_interface():
+    if ctx.kind != b'cuda':
+        raise SkipTest("__cuda_array_interface__ is only for cuda")
+    c, g = gen_gpuarray((5, 7), dtype='float32', ctx=ctx)
+    for v in [g, g[::2, 1:], g[:, ::-1]]:
+        iface = v.__cuda_array_interface__
+        assert iface['version'] == 3
+        assert iface['data'][0] == v.gpudata
+        r = pygpu.gpuarray.from_cuda_array_interface(v, context=ctx)
+        assert r.gpudata == v.gpudata
+        check_content(r, numpy.asarray(v))
+
+
 class TestPickle(unittest.TestCase):
     def test_GpuArray(self):
-        with self.assertRaises(RuntimeError):
-            pickle.dumps(pygpu.zeros((32,), context=ctx))
-        with self.assertRaises(RuntimeError):
-            pickle.dumps(pygpu.zeros((32,), context=ctx), protocol=0)
-        with self.assertRaises(RuntimeError):
-            pickle.dumps(pygpu.zeros((32,), context=ctx), protocol=1)
-        with self.assertRaises(RuntimeError):
-            pickle.dumps(pygpu.zeros((32,), context=ctx), protocol=2)
-        if PY3:
-            with self.assertRaises(RuntimeError):
-                pickle.dumps(pygpu.zeros((32,), context=ctx), protocol=3)
-        with self.assertRaises(RuntimeError):
-            pickle.dumps(pygpu.zeros((32,), context=ctx), protocol=-1)
+        c, g = gen_gpuarray((5, 7), dtype='float32', ctx=ctx)
+        old = pygpu.get_default_context()
+        pygpu.set_default_context(ctx)
+        try:
+            for v in [g, g.T, g[::2, 1:], g[1]]:
+                for proto in range(pickle.HIGHEST_PROTOCOL + 1):
+                    r = pickle.loads(pickle.dumps(v, protocol=proto))
+                    assert type(r) is type(v)
+                    check_content(r, numpy.asarray(v))
+        finally:
+            pygpu.set_default_context(old)
+
+    def test_GpuArray_out_of_band(self):
+        if pickle.HIGHEST_PROTOCOL < 5:
+            raise SkipTest("needs pickle protocol 5")
+        c, g = gen_gpuarray((64, 3), dtype='float32', ctx=ctx)
+        buffers = []
+        s = pickle.dumps(g, protocol=5, buffer_callback=buffers.append)
+        assert len(buffers) == 1
+        assert len(s) < c.nbytes
+        old = pygpu.get_default_context()
+        pygpu.set_default_context(ctx)
+        try:
+            r = pickle.loads(s, buffers=buffers)
+        finally:
+            pygpu.set_default_context(old)
+        check_content(r, c)
 
     def test_GpuContext(self):
         with self.assertRaises(RuntimeError):
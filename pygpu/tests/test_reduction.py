@@ -1,7 +1,5 @@
 import numpy
 
-from nose.tools import assert_raises
-
 from pygpu import gpuarray, ndgpuarray as elemary
 from pygpu.reduction import ReductionKernel
 
@@ -83,11 +81,70 @@ def red_broadcast():
 
     assert numpy.allclose(nz, numpy.asarray(gz))
 
+@guard_devsup
+def test_map_reduce_fused():
+    from pygpu.reduction import map_reduce, vdot, norm, mean, var, logsumexp
+
+    a, ga = gen_gpuarray((4, 5, 6), 'float32', ctx=context)
+    b, gb = gen_gpuarray((5, 1), 'float32', ctx=context)
+
+    for axis in [None, 0, 2, (1, 2)]:
+        r = map_reduce("(a[i] - b[i]) * (a[i] - b[i])",
+                       [('a', ga), ('b', gb)], axis=axis)
+        assert numpy.allclose(numpy.asarray(r),
+                              ((a - b)**2).sum(axis=axis), rtol=1e-4)
+        assert numpy.allclose(numpy.asarray(vdot(ga, gb, axis=axis)),
+                              (a * b).sum(axis=axis), rtol=1e-4, atol=1e-5)
+        assert numpy.allclose(numpy.asarray(norm(ga, axis=axis)),
+                              numpy.sqrt((a * a).sum(axis=axis)), rtol=1e-4)
+        assert numpy.allclose(numpy.asarray(mean(ga, axis=axis)),
+                              a.mean(axis=axis), rtol=1e-4, atol=1e-6)
+        assert numpy.allclose(numpy.asarray(var(ga, axis=axis, ddof=1)),
+                              a.var(axis=axis, ddof=1), rtol=1e-4)
+        x = a * 100
+        gx = gpuarray.asarray(x, context=context)
+        m = x.max()
+        lse = numpy.log(numpy.exp(x.astype('float64') - m).sum(axis=axis)) + m
+        assert numpy.allclose(numpy.asarray(logsumexp(gx, axis=axis)), lse,
+                              rtol=1e-4)
+
+
+@guard_devsup
+def test_var_int():
+    from pygpu.reduction import var
+
+    c, g = gen_gpuarray((7, 3), 'int32', ctx=context)
+    r = var(g, axis=0)
+    assert r.dtype == numpy.dtype('float64')
+    assert numpy.allclose(numpy.asarray(r), c.var(axis=0))
+
+
+@guard_devsup
+def test_map_reduce_half():
+    from pygpu.reduction import norm, mean, var, logsumexp
+
+    a, ga = gen_gpuarray((4, 5, 6), 'float16', ctx=context)
+    f = a.astype('float32')
+
+    for axis in [None, 0, (1, 2)]:
+        r = norm(ga, axis=axis)
+        assert r.dtype == numpy.dtype('float16')
+        assert numpy.allclose(numpy.asarray(r),
+                              numpy.sqrt((f * f).sum(axis=axis)), rtol=1e-2)
+        assert numpy.allclose(numpy.asarray(mean(ga, axis=axis)),
+                              f.mean(axis=axis), rtol=1e-2, atol=1e-2)
+        assert numpy.allclose(numpy.asarray(var(ga, axis=axis)),
+                              f.var(axis=axis), rtol=1e-2)
+        lse = numpy.log(numpy.exp(f.astype('float64')).sum(axis=axis))
+        assert numpy.allclose(numpy.asarray(logsumexp(ga, axis=axis)), lse,
+                              rtol=1e-2)
+
+
 def test_reduction_ops():
     for axis in [None, 0, 1]:
         for op in ['all', 'any']:
             yield reduction_op, op, 'bool', axis
-        for op in ['prod', 'sum']:  # 'min', 'max']:
+        for op in ['prod', 'sum', 'min', 'max']:
             for dtype in dtypes_no_complex:
                 yield reduction_op, op, dtype, axis
 
@@ -143,6 +200,108 @@ def test_reduction_0d():
 
 
 def test_reduction_f16():
-    c, g = gen_gpuarray((3,), dtype='float16', ctx=context, cls=elemary)
+    c, g = gen_gpuarray((3, 1000), dtype='float16', ctx=context, cls=elemary)
 
-    assert_raises(NotImplementedError, g.sum)
+    # accumulated in float32, so only the final rounding differs
+    for axis in [None, 1]:
+        rc = c.astype('float32').sum(axis=axis).astype('float16')
+        rg = g.sum(axis=axis)
+        assert rg.dtype == numpy.dtype('float16')
+        assert numpy.allclose(rc, numpy.asarray(rg), rtol=2e-3)
+
+    check_meta_content(g.max(axis=0), c.max(axis=0))
+
+
+@guard_devsup
+def test_reduction_big():
+    c, g = gen_gpuarray((3, 100000), dtype='float32', ctx=context, cls=elemary)
+
+    for axis in [None, 0, 1]:
+        assert numpy.allclose(numpy.asarray(g.sum(axis=axis)),
+                              c.sum(axis=axis, dtype='float64'), rtol=1e-4)
+    check_meta_content(g.min(axis=1), c.min(axis=1))
+
+
+def test_scan_ops():
+    for axis in [None, 0, 1]:
+        for op in ['cumsum', 'cumprod']:
+            for dtype in dtypes_no_complex:
+                yield scan_op, op, dtype, axis
+
+
+@guard_devsup
+def scan_op(op, dtype, axis):
+    c, g = gen_gpuarray((2, 3), dtype=dtype, ctx=context, cls=elemary)
+
+    rc = getattr(c, op)(axis=axis)
+    rg = getattr(g, op)(axis=axis)
+
+    check_meta_content(rg, rc)
+
+
+@guard_devsup
+def test_scan_big():
+    c, g = gen_gpuarray((3, 5000), dtype='int32', ctx=context, cls=elemary)
+
+    check_meta_content(g.cumsum(axis=1), c.cumsum(axis=1))
+
+
+@guard_devsup
+def test_scan_segmented():
+    from pygpu.reduction import scan1
+    c, g = gen_gpuarray((2, 10), dtype='int32', ctx=context)
+    s = numpy.zeros((2, 10), dtype='bool')
+    s[0, 4] = s[1, 0] = s[1, 7] = True
+    gs = gpuarray.asarray(s, context=context)
+
+    rg = scan1(g, '+', '0', 'int32', axis=1, segments=gs, exclusive=True)
+
+    rc = numpy.zeros_like(c)
+    for i in range(2):
+        acc = 0
+        for j in range(10):
+            if s[i, j]:
+                acc = 0
+            rc[i, j] = acc
+            acc += c[i, j]
+    assert numpy.all(rc == numpy.asarray(rg))
+
+
+@guard_devsup
+def test_softmax_layernorm():
+    from pygpu.reduction import softmax, logsoftmax, layernorm
+
+    for dtype in ['float16', 'float32', 'float64']:
+        for shape, axis in [((4, 300), -1), ((4, 5, 6), 1), ((3, 5000), 1)]:
+            c, g = gen_gpuarray(shape, dtype, ctx=context)
+            x = c.astype('float64') * 10
+            gx = gpuarray.asarray(x.astype(dtype), context=context)
+            x = x.astype(dtype).astype('float64')
+            tol = 1e-2 if dtype == 'float16' else 1e-4
+
+            e = numpy.exp(x - x.max(axis=axis, keepdims=True))
+            sm = e / e.sum(axis=axis, keepdims=True)
+            r = softmax(gx, axis=axis)
+            assert r.dtype == numpy.dtype(dtype)
+            assert numpy.allclose(numpy.asarray(r), sm, rtol=tol, atol=tol)
+            assert numpy.allclose(numpy.asarray(logsoftmax(gx, axis=axis)),
+                                  numpy.log(sm), rtol=tol, atol=tol)
+
+            n = shape[axis]
+            w = numpy.linspace(0.5, 2, n)
+            b = numpy.linspace(-1, 1, n)
+            gw = gpuarray.asarray(w.astype(dtype), context=context)
+            gb = gpuarray.asarray(b.astype(dtype), context=context)
+            bshape = [1] * len(shape)
+            bshape[axis] = n
+            ln = ((x - x.mean(axis=axis, keepdims=True)) /
+                  numpy.sqrt(x.var(axis=axis, keepdims=True) + 1e-5))
+            ln = (ln * w.astype(dtype).reshape(bshape) +
+                  b.astype(dtype).reshape(bshape))
+            r = layernorm(gx, gw, gb, axis=axis)
+            assert numpy.allclose(numpy.asarray(r), ln, rtol=tol, atol=tol)
+
+    # in place
+    c, g = gen_gpuarray((3, 7), 'float32', ctx=context)
+    softmax(g, out=g)
+    assert numpy.allclose(numpy.asarray(g).sum(axis=1), 1, rtol=1e-5)
@@ -0,0 +1,41 @@
+import numpy
+
+import pygpu
+from pygpu import _stats
+
+from .support import context, gen_gpuarray
+
+
+def test_stats():
+    _, ag = gen_gpuarray((32, 8), 'float32', ctx=context,
+                          cls=pygpu.ndgpuarray)
+    was = _stats.enabled
+    pygpu.enable_stats()
+    try:
+        pygpu.reset_stats()
+        ag + ag
+        ag.sum(axis=0)
+        s = pygpu.stats(reset=True)
+    finally:
+        pygpu.enable_stats(was)
+    assert s['enabled']
+    t = s['timers']
+    for phase in ('codegen', 'compile', 'launch'):
+        assert t['elemwise2'][phase]['count'] == 1
+    assert t['GpuElemwise']['launch']['count'] == 1
+    assert t['reduce1']['launch']['count'] == 1
+    for site in t.values():
+        for tm in site.values():
+            assert tm['min'] <= tm['mean'] <= tm['max']
+            assert sum(c for _, c in tm['histogram']) == tm['count']
+    c = s['counters']
+    assert (c.get('_get_reduction.hits', 0) +
+            c.get('_get_reduction.misses', 0)) == 1
+    assert pygpu.stats()['timers'] == {}
+
+    pygpu.enable_stats(False)
+    try:
+        numpy.asarray(ag + ag)
+        assert pygpu.stats()['timers'] == {}
+    finally:
+        pygpu.enable_stats(was)
@@ -7,6 +7,7 @@ from operator import itemgetter, mul
 
 import numpy
 
+from . import _stats
 from .dtypes import dtype_to_ctype, _fill_dtype_registry
 from .gpuarray import GpuArray
 
@@ -173,18 +174,25 @@ def lru_cache(maxsize=20):
         cache = {}
         last_use = {}
         time = [0]  # workaround for Python 2, which doesn't have nonlocal
+        site = getattr(user_function, '__qualname__', user_function.__name__)
 
         @functools.wraps(user_function)
         def wrapper(*key):
+            t = _stats.start()
             time[0] += 1
 
             try:
                 result = cache[key]
                 wrapper.hits += 1
+                _stats.count(site + '.hits')
+                _stats.record(site, 'cache', t)
             except KeyError:
                 result = user_function(*key)
                 cache[key] = result
                 wrapper.misses += 1
+                _stats.count(site + '.misses')
+                # The time of a miss is that of building the entry
+                _stats.record(site, 'miss', t)
 
                 # purge least recently used cache entries
                 if len(cache) > wrapper.maxsize:
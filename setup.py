@@ -129,6 +129,14 @@ exts = [Extension('pygpu.gpuarray',
                   extra_compile_args=ea,
                   define_macros=[('GPUARRAY_SHARED', None)]
                   ),
+        Extension('pygpu._reduction',
+                  sources=['pygpu/_reduction.pyx'],
+                  include_dirs=include_dirs,
+                  libraries=['gpuarray'],
+                  library_dirs=library_dirs,
+                  extra_compile_args=ea,
+                  define_macros=[('GPUARRAY_SHARED', None)]
+                  ),
         Extension('pygpu.collectives',
                   sources=['pygpu/collectives.pyx'],
                   include_dirs=include_dirs,
@@ -69,9 +69,9 @@ static int gettimeofday(struct timeval *tp, struct timezone *tzp) {
 
 
 #include "cache.h"
-#include "util/skein.h"
+#include "util/murmurhash3.h"
 
-#define HEXP_LEN (128 + 2)
+#define HEXP_LEN (32 + 2)
 
 typedef struct _disk_cache {
   cache c;
@@ -211,28 +211,26 @@ int ensurep(const char *dirp, const char *rpath) {
   return 0;
 }
 
+/*
+ * The entries store the full key, so this doesn't need to be a
+ * cryptographic hash.  Collisions just make the entries replace each
+ * other.
+ */
 static int key_path(disk_cache *c, const cache_key_t key, char *out) {
   strb kb = STRB_STATIC_INIT;
-  unsigned char hash[64];
-  int i;
+  uint64_t hash[2];
 
   if (c->kwrite(&kb, key)) {
     strb_clear(&kb);
     return -1;
   }
-  if (Skein_512((unsigned char *)kb.s, kb.l, hash)) {
-    strb_clear(&kb);
-    return -1;
-  }
+  MurmurHash3_x64_128(kb.s, kb.l, 42, hash);
   strb_clear(&kb);
-  if (snprintf(out, 10, "%02x%02x/%02x%02x",
-               hash[0], hash[1], hash[2], hash[3]) != 9)
+  if (snprintf(out, HEXP_LEN, "%04x/%012llx%016llx",
+               (unsigned int)(hash[0] >> 48),
+               (unsigned long long)(hash[0] & 0xffffffffffffULL),
+               (unsigned long long)hash[1]) != HEXP_LEN - 1)
     return -1;
-  for (i = 4; i < 64; i += 4) {
-    if (snprintf(out+(i * 2 + 1), 9, "%02x%02x%02x%02x",
-                 hash[i], hash[i+1], hash[i+2], hash[i+3]) != 8)
-      return -1;
-  }
   return 0;
 }
 
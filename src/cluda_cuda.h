@@ -1,6 +1,7 @@
 #ifndef CLUDA_H
 #define CLUDA_H
 #define local_barrier() __syncthreads()
+#define global_fence() __threadfence()
 #define WITHIN_KERNEL extern "C" __device__
 #define KERNEL extern "C" __global__
 #define GLOBAL_MEM /* empty */
@@ -76,6 +77,16 @@ static __device__ inline ga_half ga_float2half(float f) {
   return r;
 }
 
+/* Division by an invariant, with the magic numbers from the host */
+static __device__ inline ga_uint ga_udiv_uint(ga_uint n, ga_uint m, ga_uint s) {
+  ga_uint t = __umulhi(n, m);
+  return (t + ((n - t) >> (s & 1))) >> (s >> 1);
+}
+static __device__ inline ga_size ga_udiv_size(ga_size n, ga_size m, ga_uint s) {
+  ga_size t = __umul64hi(n, m);
+  return (t + ((n - t) >> (s & 1))) >> (s >> 1);
+}
+
 /* ga_int */
 #define atom_add_ig(a, b) atomicAdd(a, b)
 #define atom_add_il(a, b) atomicAdd(a, b)
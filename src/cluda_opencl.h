@@ -1,6 +1,7 @@
 #ifndef CLUDA_H
 #define CLUDA_H
 #define local_barrier() barrier(CLK_LOCAL_MEM_FENCE)
+#define global_fence() mem_fence(CLK_GLOBAL_MEM_FENCE)
 #define WITHIN_KERNEL /* empty */
 #define KERNEL __kernel
 #define GLOBAL_MEM __global
@@ -54,6 +55,16 @@ static inline ga_half ga_float2half(ga_float f) {
   return r;
 }
 
+/* Division by an invariant, with the magic numbers from the host */
+static inline ga_uint ga_udiv_uint(ga_uint n, ga_uint m, ga_uint s) {
+  ga_uint t = mul_hi(n, m);
+  return (t + ((n - t) >> (s & 1))) >> (s >> 1);
+}
+static inline ga_size ga_udiv_size(ga_size n, ga_size m, ga_uint s) {
+  ga_size t = mul_hi(n, m);
+  return (t + ((n - t) >> (s & 1))) >> (s >> 1);
+}
+
 #pragma OPENCL_EXTENSION cl_khr_int64_base_atomics: enable
 
 #define gen_atom32_add(name, argtype, aspace)                     \
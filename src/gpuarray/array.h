@@ -288,6 +288,9 @@ GPUARRAY_PUBLIC int GpuArray_view(GpuArray *v, const GpuArray *a);
 /**
  * Blocks until all operations (kernels, copies) involving `a` are finished.
  *
+ * This also reports errors recorded by kernels launched with
+ * GA_CHECK_ERROR_DEFERRED.
+ *
  * \param a the array to synchronize
  *
  * \return GA_NO_ERROR if the operation was succesful.
@@ -338,16 +341,18 @@ GPUARRAY_PUBLIC int GpuArray_index_inplace(GpuArray *a, const ssize_t *starts,
  * others have to match their equivalent on `v`. `i` has to have a
  * single dimension.
  *
- * If `check_error` is not 0, the function will check for indexing
- * errors in the kernel and will return GA_VALUE_ERROR in that
- * case. No other error will produce that error code. This is not
+ * If `check_error` is GA_CHECK_ERROR_SYNC, the function will check
+ * for indexing errors in the kernel and will return GA_VALUE_ERROR in
+ * that case. No other error will produce that error code. This is not
  * always done because it introduces a synchronization point which may
- * affect performance.
+ * affect performance.  With GA_CHECK_ERROR_DEFERRED the error is
+ * instead reported by the next synchronization point (see
+ * gpucontext_check_errors()).
  *
  * \param a the result array (nd)
  * \param v the source array (nd)
  * \param i the index array (1d)
- * \param check_error whether to check for index errors or not
+ * \param check_error one of the \ref check_error "error checking modes"
  *
  * \return GA_NO_ERROR if the operation was succesful.
  * \return an error code otherwise
@@ -355,6 +360,316 @@ GPUARRAY_PUBLIC int GpuArray_index_inplace(GpuArray *a, const ssize_t *starts,
 GPUARRAY_PUBLIC int GpuArray_take1(GpuArray *a, const GpuArray *v,
                                    const GpuArray *i, int check_error);
 
+/**
+ * Gather elements of an array using integer index arrays.
+ *
+ * The `nidx` index arrays select along the consecutive axes `axis`
+ * to `axis + nidx - 1` of `v` and are broadcast together (numpy
+ * rules).  The result has the shape `v.shape[:axis] + B +
+ * v.shape[axis+nidx:]` where `B` is the broadcast shape of the
+ * indices.  Negative indices count from the end of their axis.
+ *
+ * The result array `r` can have any strides but must already have
+ * the right shape and the same type as `v`.
+ *
+ * Index errors are handled as described for GpuArray_take1().
+ *
+ * \param r the result array
+ * \param v the source array
+ * \param axis first indexed axis of `v`
+ * \param nidx number of index arrays
+ * \param idx the index arrays (of an integer type)
+ * \param check_error one of the \ref check_error "error checking modes"
+ *
+ * \return GA_NO_ERROR if the operation was succesful.
+ * \return an error code otherwise
+ */
+GPUARRAY_PUBLIC int GpuArray_take(GpuArray *r, const GpuArray *v,
+                                  unsigned int axis, unsigned int nidx,
+                                  const GpuArray **idx, int check_error);
+
+/**
+ * Write mode for GpuArray_put().
+ */
+typedef enum _ga_put_mode {
+  /** Plain assignement, the winner of duplicate indices is unspecified */
+  GA_PUT_SET=0,
+  /** Scatter-add using atomics, the order of additions is unspecified */
+  GA_PUT_ADD=1,
+  /** Scatter-add where the values for each destination are summed in
+      index order after a device-side sort of the indices */
+  GA_PUT_ADD_DETERMINISTIC=2
+} ga_put_mode;
+
+/**
+ * Scatter values into an array using integer index arrays.
+ *
+ * This is the inverse of GpuArray_take(): the positions of `a`
+ * selected by the index arrays along axes `axis` to `axis + nidx -
+ * 1` receive the values of `v`.  `v` is broadcast to the shape of
+ * the selection.
+ *
+ * GA_PUT_ADD is only available for int, uint, long, ulong, half,
+ * float and double.  GA_PUT_ADD_DETERMINISTIC works for all types
+ * and always gives the same result for the same inputs.
+ *
+ * Index errors are handled as described for GpuArray_take1().
+ *
+ * \param a the destination array
+ * \param v the value array
+ * \param axis first indexed axis of `a`
+ * \param nidx number of index arrays
+ * \param idx the index arrays (of an integer type)
+ * \param mode how to write the values
+ * \param check_error one of the \ref check_error "error checking modes"
+ *
+ * \return GA_NO_ERROR if the operation was succesful.
+ * \return an error code otherwise
+ */
+GPUARRAY_PUBLIC int GpuArray_put(GpuArray *a, const GpuArray *v,
+                                 unsigned int axis, unsigned int nidx,
+                                 const GpuArray **idx, ga_put_mode mode,
+                                 int check_error);
+
+/**
+ * Compute the coordinates of the non-zero elements of an array.
+ *
+ * The result is a new C-contiguous GA_LONG array of shape `(a.nd,
+ * count)` where each row holds the coordinates along one axis, in C
+ * order.  The rows can be used directly as indices for
+ * GpuArray_take() and GpuArray_put() to do boolean mask selection.
+ *
+ * The compaction is done on the device with a prefix sum.  Only the
+ * number of selected elements is read back to allocate the result.
+ *
+ * \param r the result array (will be initialized)
+ * \param a the array to scan
+ *
+ * \return GA_NO_ERROR if the operation was succesful.
+ * \return an error code otherwise
+ */
+GPUARRAY_PUBLIC int GpuArray_nonzero(GpuArray *r, const GpuArray *a);
+
+/**
+ * Sort an array along an axis.
+ *
+ * Each row along `axis` is sorted independently with a stable radix
+ * sort.  All integer types as well as half, float and double are
+ * supported.  NaNs are sorted after all the other values (before them
+ * in descending order).
+ *
+ * `r` must have the shape and type of `a` but can have any strides.
+ * It can be `a` itself.
+ *
+ * \param r the result array
+ * \param a the array to sort
+ * \param axis the axis to sort along
+ * \param descending sort in descending order if not 0
+ *
+ * \return GA_NO_ERROR if the operation was succesful.
+ * \return an error code otherwise
+ */
+GPUARRAY_PUBLIC int GpuArray_sort(GpuArray *r, const GpuArray *a,
+                                  unsigned int axis, int descending);
+
+/**
+ * Compute the indices that would sort an array along an axis.
+ *
+ * This is the same sort as GpuArray_sort() but the position of each
+ * element along `axis` is written to `r` which must have the shape of
+ * `a` and an integer type.
+ *
+ * \param r the result array
+ * \param a the array to sort
+ * \param axis the axis to sort along
+ * \param descending sort in descending order if not 0
+ *
+ * \return GA_NO_ERROR if the operation was succesful.
+ * \return an error code otherwise
+ */
+GPUARRAY_PUBLIC int GpuArray_argsort(GpuArray *r, const GpuArray *a,
+                                     unsigned int axis, int descending);
+
+/**
+ * Sort key-value pairs along an axis.
+ *
+ * The values of `v` are reordered like the keys of `k` and written to
+ * `rv`.  The sorted keys are written to `rk` if it is not NULL.  `v`
+ * must have the shape of `k` and can be of any type.
+ *
+ * \param rk the sorted keys (can be NULL)
+ * \param rv the reordered values
+ * \param k the keys
+ * \param v the values
+ * \param axis the axis to sort along
+ * \param descending sort in descending order if not 0
+ *
+ * \return GA_NO_ERROR if the operation was succesful.
+ * \return an error code otherwise
+ */
+GPUARRAY_PUBLIC int GpuArray_sort_by_key(GpuArray *rk, GpuArray *rv,
+                                         const GpuArray *k, const GpuArray *v,
+                                         unsigned int axis, int descending);
+
+/**
+ * Find the `k` largest (or smallest) elements along an axis.
+ *
+ * This uses a radix select to find the k-th element of each row
+ * without sorting the whole row, then sorts the selected elements.
+ * The results are ordered from the largest (or smallest).  When
+ * several elements are equal to the k-th one, which of them are
+ * returned is unspecified.
+ *
+ * `rv` and `ri` must have the shape of `a` except for `axis` which
+ * must be `k`.  Either can be NULL.
+ *
+ * \param rv the selected values (of the type of `a`)
+ * \param ri the positions of the selected values (of an integer type)
+ * \param a the source array
+ * \param axis the axis to select along
+ * \param k number of elements to select
+ * \param largest select the largest elements if not 0, the
+ *                smallest otherwise
+ *
+ * \return GA_NO_ERROR if the operation was succesful.
+ * \return an error code otherwise
+ */
+GPUARRAY_PUBLIC int GpuArray_topk(GpuArray *rv, GpuArray *ri,
+                                  const GpuArray *a, unsigned int axis,
+                                  size_t k, int largest);
+
+/**
+ * Find the positions where values would be inserted in a sorted array.
+ *
+ * For each element of `v`, a binary search over `s` (sorted in
+ * ascending order, as by GpuArray_sort()) finds the first position
+ * where it could be inserted while keeping the order.  If `right` is
+ * not 0, the last such position is used instead.
+ *
+ * \param r the positions (shape of `v`, of an integer type)
+ * \param s the sorted array (1d)
+ * \param v the values to search (same type as `s`)
+ * \param right search for the last position if not 0
+ *
+ * \return GA_NO_ERROR if the operation was succesful.
+ * \return an error code otherwise
+ */
+GPUARRAY_PUBLIC int GpuArray_searchsorted(GpuArray *r, const GpuArray *s,
+                                          const GpuArray *v, int right);
+
+/**
+ * Compute the prefix combinations (scan) of an array along an axis.
+ *
+ * `op` is an expression combining two values named `a` and `b` (`a`
+ * comes first).  It must be associative and `neutral` must be its
+ * neutral element.  For example a cumulative sum uses "a + b" and "0".
+ * The values are converted to the type of `r` and combined in that
+ * type (float for half).  `preamble` is inserted before the kernels
+ * and can define the functions used in `op`.
+ *
+ * If `seg` is not NULL it must have the shape of `a` and an integer or
+ * boolean type.  Each non-zero element of `seg` starts a new segment:
+ * the scan restarts from that element as if it was the first of its
+ * row.
+ *
+ * `r` must have the shape of `a` but can have any type.  It can be `a`
+ * itself.
+ *
+ * \param r the result array
+ * \param a the source array
+ * \param seg the segment start flags (can be NULL)
+ * \param axis the axis to scan along
+ * \param preamble code inserted before the kernels (can be NULL)
+ * \param op the combining expression
+ * \param neutral the neutral element of `op`
+ * \param flags see \ref scan_flags "scan flags"
+ *
+ * \return GA_NO_ERROR if the operation was succesful.
+ * \return an error code otherwise
+ */
+GPUARRAY_PUBLIC int GpuArray_scan(GpuArray *r, const GpuArray *a,
+                                  const GpuArray *seg, unsigned int axis,
+                                  const char *preamble, const char *op,
+                                  const char *neutral, int flags);
+
+/**
+ * \defgroup scan_flags Scan flags
+ * @{
+ */
+
+/**
+ * Each element of the result does not include the matching element of
+ * the source (the first element of each segment is `neutral`).
+ */
+#define GA_SCAN_EXCLUSIVE 0x1
+
+/**
+ * @}
+ */
+
+/**
+ * Compute the softmax of an array along an axis.
+ *
+ * Each row along `axis` is replaced by `exp(x - max) / sum(exp(x -
+ * max))`.  The maximum and the sum are accumulated together in a
+ * single sweep over the row.
+ *
+ * `a` and `r` must be of a floating point type and have the same
+ * shape.  The computation is done in float (double if `a` or `r` is
+ * double).  `r` can be `a` itself.
+ *
+ * \param r the result array
+ * \param a the source array
+ * \param axis the axis to normalize along
+ *
+ * \return GA_NO_ERROR if the operation was succesful.
+ * \return an error code otherwise
+ */
+GPUARRAY_PUBLIC int GpuArray_softmax(GpuArray *r, const GpuArray *a,
+                                     unsigned int axis);
+
+/**
+ * Compute the logarithm of the softmax of an array along an axis.
+ *
+ * This is `x - max - log(sum(exp(x - max)))` which does not lose
+ * precision for the small probabilities.  See GpuArray_softmax() for
+ * the constraints on the arguments.
+ *
+ * \param r the result array
+ * \param a the source array
+ * \param axis the axis to normalize along
+ *
+ * \return GA_NO_ERROR if the operation was succesful.
+ * \return an error code otherwise
+ */
+GPUARRAY_PUBLIC int GpuArray_logsoftmax(GpuArray *r, const GpuArray *a,
+                                        unsigned int axis);
+
+/**
+ * Normalize an array to zero mean and unit variance along an axis.
+ *
+ * Each row along `axis` is replaced by `(x - mean) / sqrt(var + eps)`
+ * where `var` is the biased variance of the row.  If `w` is not NULL
+ * the result is then multiplied by it and if `b` is not NULL it is
+ * added to the result.  Both must be vectors of floating point type
+ * with the size of `axis`.
+ *
+ * See GpuArray_softmax() for the constraints on the other arguments.
+ *
+ * \param r the result array
+ * \param a the source array
+ * \param w the scale (can be NULL)
+ * \param b the shift (can be NULL)
+ * \param axis the axis to normalize along
+ * \param eps added to the variance
+ *
+ * \return GA_NO_ERROR if the operation was succesful.
+ * \return an error code otherwise
+ */
+GPUARRAY_PUBLIC int GpuArray_layernorm(GpuArray *r, const GpuArray *a,
+                                       const GpuArray *w, const GpuArray *b,
+                                       unsigned int axis, double eps);
+
 /**
  * Sets the content of an array to the content of another array.
  *
@@ -484,6 +799,9 @@ GPUARRAY_PUBLIC int GpuArray_write(GpuArray *dst, const void *src,
 /**
  * Copy data from the device memory to the host memory.
  *
+ * This also reports errors recorded by kernels launched with
+ * GA_CHECK_ERROR_DEFERRED.
+ *
  * \param dst destination host memory (contiguous block)
  * \param dst_sz size of data to copy (in bytes)
  * \param src source array (must be contiguous)
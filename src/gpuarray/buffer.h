@@ -177,6 +177,62 @@ GPUARRAY_PUBLIC int gpucontext_props_set_single_stream(gpucontext_props *p);
 GPUARRAY_PUBLIC int gpucontext_props_kernel_cache(gpucontext_props *p,
                                                   const char *path);
 
+/**
+ * Set the capacities of the kernel caches.
+ *
+ * Each context keeps the `kernels` it loaded most recently ready to
+ * use.  The compiled binaries are also kept in a cache that is
+ * shared by every context of the process, so that a new context on
+ * the same kind of device doesn't compile them again.  The first
+ * context to use the shared cache sets its capacity.  A `binaries`
+ * of 0 disables it for this context.
+ *
+ * \param p properties object
+ * \param kernels number of kernels cached per context (at least 1)
+ * \param binaries number of binaries in the shared cache
+ *
+ * \returns GA_NO_ERROR or an error code if an error occurred.
+ */
+GPUARRAY_PUBLIC int gpucontext_props_kernel_cache_size(gpucontext_props *p,
+                                                       size_t kernels,
+                                                       size_t binaries);
+
+/**
+ * Set the path of a kernel bundle to preload.
+ *
+ * A bundle holds precompiled binaries for a set of kernels, built
+ * with gpukernel_bundle_build() from the manifest recorded by
+ * gpucontext_props_kernel_record().  Kernels found in the bundle are
+ * not compiled at all.  The entries for other devices are ignored.
+ *
+ * If this is not set, the GPUARRAY_KERNEL_BUNDLE environment
+ * variable is used.
+ *
+ * \param p properties object
+ * \param path location of the bundle
+ *
+ * \returns GA_NO_ERROR or an error code if an error occurred.
+ */
+GPUARRAY_PUBLIC int gpucontext_props_kernel_bundle(gpucontext_props *p,
+                                                   const char *path);
+
+/**
+ * Record the kernels compiled by the context in a manifest.
+ *
+ * The source of every kernel that is compiled is appended to the
+ * file at `path`, which can then be used to build a bundle.
+ *
+ * If this is not set, the GPUARRAY_KERNEL_RECORD environment
+ * variable is used.
+ *
+ * \param p properties object
+ * \param path location of the manifest
+ *
+ * \returns GA_NO_ERROR or an error code if an error occurred.
+ */
+GPUARRAY_PUBLIC int gpucontext_props_kernel_record(gpucontext_props *p,
+                                                   const char *path);
+
 /**
  * Configure the allocation cache.
  *
@@ -264,6 +320,55 @@ GPUARRAY_PUBLIC int gpucontext_property(gpucontext *ctx, int prop_id,
  */
 GPUARRAY_PUBLIC const char *gpucontext_error(gpucontext *ctx, int err);
 
+/**
+ * \defgroup check_error Error checking modes
+ *
+ * Values for the `check_error` argument of the functions that run
+ * kernels able to detect invalid indices.
+ * @{
+ */
+
+/**
+ * Don't check for errors.  Errors are only recorded on the device.
+ * They show up only when the caller explicitly runs
+ * gpucontext_check_errors().  Unlike with GA_CHECK_ERROR_DEFERRED,
+ * the synchronization points don't look at them.  A later deferred
+ * check in the same context will report them, though.
+ */
+#define GA_CHECK_ERROR_NONE     0
+
+/**
+ * Check for errors right after the call.  This introduces a
+ * synchronization point.
+ */
+#define GA_CHECK_ERROR_SYNC     1
+
+/**
+ * Defer the check until the next synchronization point
+ * (GpuArray_sync(), GpuArray_read() or gpucontext_check_errors()).
+ */
+#define GA_CHECK_ERROR_DEFERRED 2
+
+/**
+ * @}
+ */
+
+/**
+ * Report errors recorded by kernels in the context.
+ *
+ * Kernels that validate their inputs (like GpuArray_take1()) record
+ * the first error they encounter in a device-resident error word.
+ * This function waits for that word to be available, resets it and
+ * reports the recorded error, if any, along with the name of the
+ * kernel that raised it.
+ *
+ * \param ctx a context
+ *
+ * \returns GA_VALUE_ERROR if a kernel recorded an error,
+ * GA_NO_ERROR if not or another error code if the check failed.
+ */
+GPUARRAY_PUBLIC int gpucontext_check_errors(gpucontext *ctx);
+
 /**
  * Allocates a buffer of size `sz` in context `ctx`.
  *
@@ -526,6 +631,199 @@ GPUARRAY_PUBLIC gpukernel *gpukernel_init(gpucontext *ctx, unsigned int count,
                                           const int *typecodes, int flags, int *ret,
                                           char **err_str);
 
+/**
+ * Kernel fingerprint.
+ *
+ * This is a 128-bit hash of the name, source and flags of a kernel.
+ * Computing it once and passing it to gpukernel_init_fp() avoids
+ * hashing the source again on each call.  The contexts keep their
+ * kernels indexed by fingerprint.
+ */
+typedef struct _gpukernel_fp {
+  uint64_t h[2];
+} gpukernel_fp;
+
+/**
+ * Compute the fingerprint of a kernel.
+ *
+ * The parameters have the same meaning as for gpukernel_init().  The
+ * fingerprint depends on how the source is split in strings.
+ *
+ * \param fp return location for the fingerprint
+ * \param count number of input strings
+ * \param strings table of string pointers
+ * \param lengths (optional) length for each string in the table
+ * \param fname name of the kernel function
+ * \param flags flags for compilation (see #ga_usefl)
+ */
+GPUARRAY_PUBLIC void gpukernel_fingerprint(gpukernel_fp *fp,
+                                           unsigned int count,
+                                           const char **strings,
+                                           const size_t *lengths,
+                                           const char *fname, int flags);
+
+/**
+ * Compile a kernel with a precomputed fingerprint.
+ *
+ * This is the same as gpukernel_init(), except that `fp` must be the
+ * fingerprint of the kernel as computed by gpukernel_fingerprint().
+ * If the kernel was already built for this context, it is returned
+ * without looking at the source.
+ */
+GPUARRAY_PUBLIC gpukernel *gpukernel_init_fp(gpucontext *ctx,
+                                             const gpukernel_fp *fp,
+                                             unsigned int count,
+                                             const char **strings,
+                                             const size_t *lengths,
+                                             const char *fname,
+                                             unsigned int numargs,
+                                             const int *typecodes, int flags,
+                                             int *ret, char **err_str);
+
+/**
+ * Kernel being compiled in the background.
+ */
+typedef struct _gpukernel_future gpukernel_future;
+
+/**
+ * Start compiling a kernel in the background.
+ *
+ * The arguments are the same as for gpukernel_init() and are copied
+ * so they don't need to remain valid after this call.  Compilation
+ * happens on a pool of worker threads (one per processor, see
+ * GPUARRAY_COMPILE_THREADS) so that independent kernels can be built
+ * in parallel.  If no worker is available the kernel is built before
+ * returning.
+ *
+ * The context is kept alive until the compilation finishes.
+ *
+ * \param ctx context to work in
+ * \param count number of input strings
+ * \param strings table of string pointers
+ * \param lengths (optional) length for each string in the table
+ * \param fname name of the kernel function (as defined in the code)
+ * \param numargs number of kernel arguments
+ * \param typecodes the type of each argument
+ * \param flags flags for compilation (see #ga_usefl)
+ * \param ret error return pointer
+ *
+ * \returns A future to pass to gpukernel_future_get() or NULL if the
+ * compilation could not be started.  `ret` will be updated with the
+ * error code if not NULL.
+ */
+GPUARRAY_PUBLIC gpukernel_future *gpukernel_init_async(
+    gpucontext *ctx, unsigned int count, const char **strings,
+    const size_t *lengths, const char *fname, unsigned int numargs,
+    const int *typecodes, int flags, int *ret);
+
+/**
+ * Check if a background compilation is finished.
+ *
+ * \returns 1 if gpukernel_future_get() won't block, 0 otherwise.
+ */
+GPUARRAY_PUBLIC int gpukernel_future_ready(gpukernel_future *f);
+
+/**
+ * Wait for a background compilation.
+ *
+ * This only blocks on the compilation of `f`, not on other queued
+ * kernels.  It can be called multiple times and returns a new
+ * reference to the kernel each time.
+ *
+ * On failure the compilation error is set in the context as if
+ * gpukernel_init() had failed.
+ *
+ * \param f future
+ * \param ret error return pointer
+ * \param err_str returns pointer to debug message from GPU backend
+ *        (if provided a non-NULL err_str)
+ *
+ * If `*err_str` is not NULL on return, the caller must call
+ * `free(*err_str)` after use.
+ *
+ * \returns the kernel or NULL if an error occured.  `ret` will be
+ * updated with the error code if not NULL.
+ */
+GPUARRAY_PUBLIC gpukernel *gpukernel_future_get(gpukernel_future *f,
+                                                int *ret, char **err_str);
+
+/**
+ * Release a future.
+ *
+ * This doesn't cancel the compilation, but its result will be
+ * dropped (it still ends up in the kernel caches).
+ */
+GPUARRAY_PUBLIC void gpukernel_future_release(gpukernel_future *f);
+
+/**
+ * Kernel description for gpukernel_init_many().
+ *
+ * The fields match the arguments of gpukernel_init().
+ */
+typedef struct _gpukernel_desc {
+  unsigned int count;
+  const char **strings;
+  const size_t *lengths;
+  const char *fname;
+  unsigned int numargs;
+  const int *typecodes;
+  int flags;
+} gpukernel_desc;
+
+/**
+ * Compile a set of kernels in parallel.
+ *
+ * This compiles all the kernels in `descs` using the background
+ * workers and waits for all of them.
+ *
+ * \param ctx context to work in
+ * \param n number of kernels
+ * \param descs description of each kernel
+ * \param res array of `n` kernels to fill
+ * \param err_str returns pointer to debug message from GPU backend
+ *        for the first kernel that failed (if provided a non-NULL
+ *        err_str)
+ *
+ * If `*err_str` is not NULL on return, the caller must call
+ * `free(*err_str)` after use.
+ *
+ * \returns GA_NO_ERROR if all the kernels were built.  Otherwise the
+ * error code of the first one that failed and all of `res` is set to
+ * NULL.
+ */
+GPUARRAY_PUBLIC int gpukernel_init_many(gpucontext *ctx, unsigned int n,
+                                        const gpukernel_desc *descs,
+                                        gpukernel **res, char **err_str);
+
+/**
+ * Build a kernel bundle from manifests.
+ *
+ * Every kernel listed in the manifests is compiled for each of the
+ * target architectures and the binaries are written to `bundle`.
+ * Duplicate kernels are only compiled once.
+ *
+ * The architectures use the same names as the binary ids of the
+ * backend (like "compute_70" for cuda).  If `narchs` is 0, the
+ * architectures recorded in the manifests are used.
+ *
+ * This is only supported by the cuda backend.
+ *
+ * \param ctx context used to compile
+ * \param nmanifests number of manifests
+ * \param manifests paths of the manifests
+ * \param bundle path of the bundle to write
+ * \param narchs number of target architectures
+ * \param archs target architectures
+ *
+ * \returns GA_NO_ERROR or an error code if an error occurred.
+ */
+GPUARRAY_PUBLIC int gpukernel_bundle_build(gpucontext *ctx,
+                                           unsigned int nmanifests,
+                                           const char **manifests,
+                                           const char *bundle,
+                                           unsigned int narchs,
+                                           const char **archs);
+
 /**
  * Retain a kernel.
  *
@@ -94,6 +94,11 @@ GPUARRAY_PUBLIC gpucontext* gpucomm_context(gpucomm* comm);
  * The id is guarenteed to be unique in the same host, but not
  * necessarily across hosts.
  *
+ * For contexts without native collectives, the ranks communicate
+ * through host memory.  By default they must all be on the same host.
+ * To span hosts, set the environment variable GPUARRAY_COMM_ADDR to
+ * the "host:port" where rank 0 will listen before generating the id.
+ *
  * \param ctx gpu context
  * \param comm_id pointer to instance containing id
  *
@@ -250,6 +255,183 @@ GPUARRAY_PUBLIC int gpucomm_all_gather(gpudata* src, size_t offsrc,
                                        size_t count, int typecode,
                                        gpucomm* comm);
 
+/**
+ * Send data to another rank [buffer level].
+ *
+ * The data is received by a matching gpucomm_recv() on `peer`.
+ * Messages between two ranks are matched in the order they are issued
+ * and must have the same size on both sides.
+ *
+ * \param src data in device's buffer to be sent
+ * \param offsrc memory offset after which data is saved in buffer
+ *               `src`
+ * \param count number of elements to send
+ * \param typecode elements' data type
+ * \param peer rank in `comm` which receives the data
+ * \param comm gpu communicator
+ *
+ * \note Outside of a group (see gpucomm_group_start()) this may block
+ *       until `peer` posts the matching receive, so exchanges between
+ *       ranks must be grouped.
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int gpucomm_send(gpudata* src, size_t offsrc, size_t count,
+                                 int typecode, int peer, gpucomm* comm);
+
+/**
+ * Receive data from another rank [buffer level].
+ *
+ * \param dest data in device's buffer to receive
+ * \param offdest memory offset after which data will be saved in
+ *                buffer `dest`
+ * \param count number of elements to receive
+ * \param typecode elements' data type
+ * \param peer rank in `comm` which sends the data
+ * \param comm gpu communicator
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int gpucomm_recv(gpudata* dest, size_t offdest, size_t count,
+                                 int typecode, int peer, gpucomm* comm);
+
+/**
+ * Start a group of point-to-point operations.
+ *
+ * The gpucomm_send() and gpucomm_recv() calls until the matching
+ * gpucomm_group_end() are issued together when it is called, which
+ * allows any pattern of exchanges without deadlocks.  Groups can be
+ * nested, in which case only the outermost one counts.
+ *
+ * \param comm gpu communicator
+ *
+ * \note Requests (see gpucomm_request_new()) can't be made inside a
+ *       group.
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int gpucomm_group_start(gpucomm* comm);
+
+/**
+ * End a group of point-to-point operations.
+ *
+ * \param comm gpu communicator
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int gpucomm_group_end(gpucomm* comm);
+
+/**
+ * AllToAll collective operation for ranks in a communicator world
+ * [buffer level].
+ *
+ * Block `i` of `src` is sent to rank `i` and the block received from
+ * rank `i` is stored in block `i` of `dest`.
+ *
+ * \param src data in device's buffer to be sent
+ * \param offsrc memory offset after which data in `src` begin
+ * \param dest data in device's buffer to receive
+ * \param offdest memory offset after which data in `dest` begin
+ * \param count number of elements in each block
+ * \param typecode elements' data type
+ * \param comm gpu communicator
+ *
+ * \note Must be called separately for each rank in `comm`.
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int gpucomm_all_to_all(gpudata* src, size_t offsrc,
+                                       gpudata* dest, size_t offdest,
+                                       size_t count, int typecode,
+                                       gpucomm* comm);
+
+/**
+ * AllToAllv collective operation for ranks in a communicator world
+ * [buffer level].
+ *
+ * Like gpucomm_all_to_all() with blocks of varying sizes and
+ * positions.  All the arrays have one entry per rank and are counted
+ * in elements.
+ *
+ * \param src data in device's buffer to be sent
+ * \param offsrc memory offset after which data in `src` begin
+ * \param sendcounts number of elements to send to each rank
+ * \param sdispls position of the block for each rank in `src`
+ * \param dest data in device's buffer to receive
+ * \param offdest memory offset after which data in `dest` begin
+ * \param recvcounts number of elements to receive from each rank,
+ *                   which must match what that rank sends
+ * \param rdispls position of the block from each rank in `dest`
+ * \param typecode elements' data type
+ * \param comm gpu communicator
+ *
+ * \note Must be called separately for each rank in `comm`.
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int gpucomm_all_to_allv(gpudata* src, size_t offsrc,
+                                        const size_t* sendcounts,
+                                        const size_t* sdispls,
+                                        gpudata* dest, size_t offdest,
+                                        const size_t* recvcounts,
+                                        const size_t* rdispls,
+                                        int typecode, gpucomm* comm);
+
+/**
+ * Completion handle for collective operations.
+ *
+ * Collective operations are queued on a stream dedicated to their
+ * communicator and return before they complete.  Device-side
+ * ordering with the other operations on the buffers involved is
+ * handled automatically; a request is only needed to know on the host
+ * when the operations are done.
+ */
+struct _gpucomm_request;
+
+typedef struct _gpucomm_request gpucomm_request;
+
+/**
+ * Create a request which completes when all the collective operations
+ * issued so far on `comm` have completed.
+ *
+ * \param req pointer to the new request
+ * \param comm gpu communicator
+ *
+ * \note The request must be freed before `comm`.
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int gpucomm_request_new(gpucomm_request** req,
+                                        gpucomm* comm);
+
+/**
+ * Check without blocking whether a request has completed.
+ *
+ * \param req request
+ * \param done set to 1 if completed and 0 otherwise
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int gpucomm_request_test(gpucomm_request* req, int* done);
+
+/**
+ * Block until a request has completed.
+ *
+ * \param req request
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int gpucomm_request_wait(gpucomm_request* req);
+
+/**
+ * Free a request.
+ *
+ * This does not wait for the operations to complete.
+ *
+ * \param req request
+ */
+GPUARRAY_PUBLIC void gpucomm_request_free(gpucomm_request* req);
+
 #ifdef __cplusplus
 }
 #endif
@@ -124,6 +124,280 @@ GPUARRAY_PUBLIC int GpuArray_broadcast(GpuArray* array, int root,
 GPUARRAY_PUBLIC int GpuArray_all_gather(const GpuArray* src, GpuArray* dest,
                                         gpucomm* comm);
 
+/**
+ * Send an array to another rank.
+ *
+ * \param src array to send
+ * \param peer rank in `comm` which receives the array
+ * \param comm gpu communicator
+ *
+ * \note `peer` must call GpuArray_recv() with an array of the same
+ *       size.  Use gpucomm_group_start() and gpucomm_group_end()
+ *       around exchanges that go in both directions.
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int GpuArray_send(const GpuArray* src, int peer,
+                                  gpucomm* comm);
+
+/**
+ * Receive an array from another rank.
+ *
+ * \param dest array to receive
+ * \param peer rank in `comm` which sends the array
+ * \param comm gpu communicator
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int GpuArray_recv(GpuArray* dest, int peer, gpucomm* comm);
+
+/**
+ * AllToAll collective operation for ranks in a communicator world.
+ *
+ * `src` and `dest` are split in as many blocks of equal size as there
+ * are ranks in `comm`, following the C order.  Block `i` of `src` is
+ * sent to rank `i` and the block received from rank `i` is stored in
+ * block `i` of `dest`.
+ *
+ * \param src array to be scattered
+ * \param dest array to receive the blocks from all ranks
+ * \param comm gpu communicator
+ *
+ * \note Must be called separately for each rank in `comm`.
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int GpuArray_all_to_all(const GpuArray* src, GpuArray* dest,
+                                        gpucomm* comm);
+
+/**
+ * AllToAllv collective operation for ranks in a communicator world.
+ *
+ * Like GpuArray_all_to_all() with blocks of varying sizes and
+ * positions, counted in elements of the flattened (C order) arrays.
+ * Each array has one entry per rank.
+ *
+ * \param src array to be scattered
+ * \param sendcounts number of elements to send to each rank
+ * \param sdispls position of the block for each rank in `src`
+ * \param dest array to receive the blocks from all ranks
+ * \param recvcounts number of elements to receive from each rank
+ * \param rdispls position of the block from each rank in `dest`
+ * \param comm gpu communicator
+ *
+ * \note Must be called separately for each rank in `comm`.
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int GpuArray_all_to_allv(const GpuArray* src,
+                                         const size_t* sendcounts,
+                                         const size_t* sdispls,
+                                         GpuArray* dest,
+                                         const size_t* recvcounts,
+                                         const size_t* rdispls,
+                                         gpucomm* comm);
+
+/*****************************************************************************
+*                         Compressed all-reduce                              *
+******************************************************************************/
+
+/**
+ * \enum gpucomm_compression
+ *
+ * \brief Compression modes for GpuArray_all_reduce_compressed()
+ */
+enum gpucomm_compression {
+  GA_COMPRESS_HALF = 1,  //!< exchange and reduce the data as float16
+  GA_COMPRESS_TOPK = 2,  //!< exchange only the `k` largest magnitudes
+};
+
+/**
+ * AllReduce collective operation which sends fewer bytes than
+ * GpuArray_all_reduce().
+ *
+ * With #GA_COMPRESS_HALF, `src` is cast to float16, all-reduced in
+ * that type and cast back into `dest`.  The casts are fused in single
+ * kernels.  The reduction itself also runs in float16, so large sums
+ * may overflow; scale the inputs if needed.
+ *
+ * With #GA_COMPRESS_TOPK, each rank sends the positions and values
+ * of its `k` elements of largest magnitude, and `dest` gets the sum
+ * of what all ranks sent.  Only #GA_SUM is supported.
+ *
+ * If `residual` is not NULL, it is added to `src` before compressing
+ * and receives what the compression lost (error feedback).  It must
+ * start as zeros and be kept between calls.
+ *
+ * \param src array to be reduced (float32 or float64, C contiguous)
+ * \param dest array to collect the result (same type and size)
+ * \param opcode reduce operation code, see #gpucomm_reduce_ops
+ * \param mode compression mode, see #gpucomm_compression
+ * \param k number of elements sent by each rank for #GA_COMPRESS_TOPK
+ * \param residual (optional) error feedback array, like `src`
+ * \param comm gpu communicator
+ *
+ * \note Must be called separately for each rank in `comm`.
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int GpuArray_all_reduce_compressed(const GpuArray* src,
+                                                   GpuArray* dest,
+                                                   int opcode, int mode,
+                                                   size_t k,
+                                                   GpuArray* residual,
+                                                   gpucomm* comm);
+
+/*****************************************************************************
+*                         Asynchronous variants                              *
+******************************************************************************/
+
+/*
+ * These issue the same operation as their synchronous counterpart and
+ * return in `req` a request which completes with it (see
+ * gpucomm_request_new()).  The request must be freed with
+ * gpucomm_request_free().
+ */
+
+/**
+ * Asynchronous GpuArray_reduce_from().
+ */
+GPUARRAY_PUBLIC int GpuArray_reduce_from_async(const GpuArray* src, int opcode,
+                                               int root, gpucomm* comm,
+                                               gpucomm_request** req);
+
+/**
+ * Asynchronous GpuArray_reduce().
+ */
+GPUARRAY_PUBLIC int GpuArray_reduce_async(const GpuArray* src, GpuArray* dest,
+                                          int opcode, int root, gpucomm* comm,
+                                          gpucomm_request** req);
+
+/**
+ * Asynchronous GpuArray_all_reduce().
+ */
+GPUARRAY_PUBLIC int GpuArray_all_reduce_async(const GpuArray* src,
+                                              GpuArray* dest, int opcode,
+                                              gpucomm* comm,
+                                              gpucomm_request** req);
+
+/**
+ * Asynchronous GpuArray_reduce_scatter().
+ */
+GPUARRAY_PUBLIC int GpuArray_reduce_scatter_async(const GpuArray* src,
+                                                  GpuArray* dest, int opcode,
+                                                  gpucomm* comm,
+                                                  gpucomm_request** req);
+
+/**
+ * Asynchronous GpuArray_broadcast().
+ */
+GPUARRAY_PUBLIC int GpuArray_broadcast_async(GpuArray* array, int root,
+                                             gpucomm* comm,
+                                             gpucomm_request** req);
+
+/**
+ * Asynchronous GpuArray_all_gather().
+ */
+GPUARRAY_PUBLIC int GpuArray_all_gather_async(const GpuArray* src,
+                                              GpuArray* dest, gpucomm* comm,
+                                              gpucomm_request** req);
+
+/*****************************************************************************
+*                          Bucketed all-reduce                               *
+******************************************************************************/
+
+struct _gpucomm_bucket;
+
+/**
+ * Group of arrays that are all-reduced in place together.
+ *
+ * The registered arrays are split, in order of registration, in
+ * buckets of bounded size.  For each bucket the arrays are packed in
+ * a flat device buffer by a single copy kernel, reduced with one
+ * collective and unpacked in the same way.  This replaces many small
+ * collectives with a few big ones.
+ *
+ * The contents are private.
+ */
+typedef struct _gpucomm_bucket gpucomm_bucket;
+
+#define GA_BUCKET_DEFAULT_SIZE (25 * 1024 * 1024)  //!< default bucket size in bytes
+
+/**
+ * Create a new bucket group.
+ *
+ * \param bucket pointer to the created group
+ * \param comm gpu communicator
+ * \param typecode type of the registered arrays
+ * \param opcode reduce operation code, see #gpucomm_reduce_ops
+ * \param bucket_size upper bound on the size of a bucket in bytes
+ *                    (0 for #GA_BUCKET_DEFAULT_SIZE).  An array
+ *                    larger than this gets a bucket of its own.
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int gpucomm_bucket_new(gpucomm_bucket** bucket,
+                                       gpucomm* comm, int typecode,
+                                       int opcode, size_t bucket_size);
+
+/**
+ * Free a bucket group.
+ *
+ * The registered arrays are not affected.
+ */
+GPUARRAY_PUBLIC void gpucomm_bucket_free(gpucomm_bucket* bucket);
+
+/**
+ * Register an array.
+ *
+ * The array (the GpuArray structure itself) must stay valid and keep
+ * its shape and strides for as long as it is registered.  It need not
+ * be contiguous.  Arrays can only be added between rounds, that is
+ * before any gpucomm_bucket_ready() call or right after a
+ * gpucomm_bucket_flush().
+ *
+ * \param bucket bucket group
+ * \param a array to register
+ * \param idx (optional) receives the index of the array, used with
+ *            gpucomm_bucket_ready()
+ *
+ * \note All ranks must register arrays of the same sizes in the same
+ *       order.
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int gpucomm_bucket_add(gpucomm_bucket* bucket, GpuArray* a,
+                                       unsigned int* idx);
+
+/**
+ * Mark a registered array as ready for this round.
+ *
+ * As soon as all the arrays of a bucket (and of every bucket before
+ * it) are ready, its collective is issued without waiting for the
+ * rest.  Marking arrays in the reverse order of registration
+ * (usually the order in which gradients become available) is fine,
+ * but only makes buckets go out early if they were registered in that
+ * order too.
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int gpucomm_bucket_ready(gpucomm_bucket* bucket,
+                                         unsigned int idx);
+
+/**
+ * Reduce all the buckets that were not reduced yet in this round and
+ * start a new round.
+ *
+ * Arrays that were not marked ready are reduced as well.  After this
+ * call every registered array holds the result of the reduction over
+ * all ranks.
+ *
+ * \note Must be called separately for each rank in `comm`.
+ *
+ * \return error code or #GA_NO_ERROR if success
+ */
+GPUARRAY_PUBLIC int gpucomm_bucket_flush(gpucomm_bucket* bucket);
+
 #ifdef __cplusplus
 }
 #endif
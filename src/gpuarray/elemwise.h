@@ -118,6 +118,12 @@ GPUARRAY_PUBLIC GpuElemwise *GpuElemwise_new(gpucontext *ctx,
  */
 #define GE_CONVERT_F16 0x0002
 
+/**
+ * Compile variants with the shape and strides baked in for the
+ * geometries that are used repeatedly.
+ */
+#define GE_SPECIALIZE  0x0004
+
 /**
  * @}
  */
@@ -132,6 +138,9 @@ GPUARRAY_PUBLIC void GpuElemwise_free(GpuElemwise *ge);
 /**
  * Run a GpuElemwise on some inputs.
  *
+ * This can be called from multiple threads on the same object, the
+ * calls will be serialized.
+ *
  * \param ge the GpuElemwise to run
  * \param args pointers to the arguments (must macth what was described by
  *             the argument descriptors)
@@ -16,13 +16,18 @@ static void (*cuda_enter)(gpucontext *);
 static void (*cuda_exit)(gpucontext *);
 static gpucontext *(*cuda_make_ctx)(CUcontext, int);
 static CUstream (*cuda_get_stream)(void *);
+static int (*cuda_get_device)(gpucontext *);
 static gpudata *(*cuda_make_buf)(void *, CUdeviceptr, size_t);
 static size_t (*cuda_get_sz)(gpudata *);
 static int (*cuda_wait)(gpudata *, int);
 static int (*cuda_record)(gpudata *, int);
+static int (*cuda_wait_stream)(gpudata *, int, CUstream);
+static int (*cuda_record_stream)(gpudata *, int, CUstream);
 static CUipcMemHandle (*cuda_get_ipc_handle)(gpudata *d);
 static gpudata *(*cuda_open_ipc_handle)(gpucontext *c, CUipcMemHandle h,
                                         size_t sz);
+static int (*cuda_get_ipc_range)(gpudata *d, CUipcMemHandle *h, size_t *off,
+                                 size_t *sz);
 /** @endcond */
 
 static void setup_ext_cuda(void) {
@@ -31,12 +36,16 @@ static void setup_ext_cuda(void) {
   cuda_exit = (void (*)(gpucontext *))gpuarray_get_extension("cuda_exit");
   cuda_make_ctx = (gpucontext *(*)(CUcontext, int))gpuarray_get_extension("cuda_make_ctx");
   cuda_get_stream = (CUstream (*)(void *))gpuarray_get_extension("cuda_get_stream");
+  cuda_get_device = (int (*)(gpucontext *))gpuarray_get_extension("cuda_get_device");
   cuda_make_buf = (gpudata *(*)(void *, CUdeviceptr, size_t))gpuarray_get_extension("cuda_make_buf");
   cuda_get_sz = (size_t (*)(gpudata *))gpuarray_get_extension("cuda_get_sz");
   cuda_wait = (int (*)(gpudata *, int))gpuarray_get_extension("cuda_wait");
   cuda_record = (int (*)(gpudata *, int))gpuarray_get_extension("cuda_record");
+  cuda_wait_stream = (int (*)(gpudata *, int, CUstream))gpuarray_get_extension("cuda_wait_stream");
+  cuda_record_stream = (int (*)(gpudata *, int, CUstream))gpuarray_get_extension("cuda_record_stream");
   cuda_get_ipc_handle = (CUipcMemHandle (*)(gpudata *))gpuarray_get_extension("cuda_get_ipc_handle");
   cuda_open_ipc_handle = (gpudata *(*)(gpucontext *c, CUipcMemHandle h, size_t sz))gpuarray_get_extension("cuda_open_ipc_handle");
+  cuda_get_ipc_range = (int (*)(gpudata *, CUipcMemHandle *, size_t *, size_t *))gpuarray_get_extension("cuda_get_ipc_range");
 }
 
 #ifdef __cplusplus
@@ -23,7 +23,8 @@ typedef struct _GpuKernel {
    */
   gpukernel *k;
   /**
-   * Argument buffer.
+   * Argument buffer, used by GpuKernel_call() when no arguments are
+   * passed in.
    */
   void **args;
 } GpuKernel;
@@ -57,6 +58,19 @@ GPUARRAY_PUBLIC int GpuKernel_init(GpuKernel *k, gpucontext *ctx,
                                    unsigned int argcount, const int *types,
                                    int flags, char **err_str);
 
+/**
+ * Initialize a kernel structure with a precomputed fingerprint.
+ *
+ * Same as GpuKernel_init(), with `fp` computed by
+ * gpukernel_fingerprint() on the same source, name and flags.
+ */
+GPUARRAY_PUBLIC int GpuKernel_init_fp(GpuKernel *k, gpucontext *ctx,
+                                      const gpukernel_fp *fp,
+                                      unsigned int count, const char **strs,
+                                      const size_t *lens, const char *name,
+                                      unsigned int argcount, const int *types,
+                                      int flags, char **err_str);
+
 /**
  * Clear and release data associated with a kernel.
  *
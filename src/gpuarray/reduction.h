@@ -0,0 +1,99 @@
+#ifndef GPUARRAY_REDUCTION_H
+#define GPUARRAY_REDUCTION_H
+/** \file reduction.h
+ *  \brief Custom reduction operations generator.
+ */
+
+#include <gpuarray/array.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#ifdef CONFUSE_EMACS
+}
+#endif
+
+struct _GpuReduction;
+
+/**
+ * Reduction generator structure.
+ *
+ * The contents are private.
+ */
+typedef struct _GpuReduction GpuReduction;
+
+/**
+ * Create a new GpuReduction.
+ *
+ * This will allocate and initialize a new GpuReduction object.  This
+ * object can be used to reduce arrays of the specified source type
+ * over any set of axes into arrays of the specified destination type.
+ *
+ * Each source element is loaded, converted to the accumulator type
+ * (float16 is always loaded as float32) and passed through the map
+ * expression, which refers to it as `a`.  The mapped values are then
+ * combined with the reduce expression, which refers to its two
+ * operands as `a` and `b` and must be associative and commutative,
+ * starting from the neutral element.  The final value is converted
+ * to the destination type.
+ *
+ * All indexing is done with 64-bit integers.
+ *
+ * \param ctx the context in which to run the operations
+ * \param preamble code to be inserted before the kernel code (can be NULL)
+ * \param map_expr the expression to apply to each element (NULL for `a`)
+ * \param reduce_expr the expression combining two values
+ * \param neutral the neutral element of reduce_expr
+ * \param srctype the typecode of the arrays to reduce
+ * \param acctype the typecode of the accumulator or -1 to use
+ *                dsttype (float32 if dsttype is float16)
+ * \param dsttype the typecode of the result arrays
+ *
+ * \returns a new GpuReduction object or NULL
+ */
+GPUARRAY_PUBLIC GpuReduction *GpuReduction_new(gpucontext *ctx,
+                                               const char *preamble,
+                                               const char *map_expr,
+                                               const char *reduce_expr,
+                                               const char *neutral,
+                                               int srctype,
+                                               int acctype,
+                                               int dsttype);
+
+/**
+ * Free all storage associated with a GpuReduction.
+ *
+ * \param gr the GpuReduction object to free.
+ */
+GPUARRAY_PUBLIC void GpuReduction_free(GpuReduction *gr);
+
+/**
+ * Run a GpuReduction on an array.
+ *
+ * The destination must have the shape of the source with the reduced
+ * axes removed.  If all axes are reduced the destination is
+ * 0-dimensional.
+ *
+ * When there are few outputs compared to the size of the reduction,
+ * the work for each output is split among the threads of one or more
+ * blocks.  Otherwise each output is computed by a single thread.
+ *
+ * \param gr the GpuReduction to run
+ * \param dst the result array
+ * \param src the array to reduce
+ * \param reduxLen the number of axes to reduce
+ * \param reduxList the list of axes to reduce (no duplicates)
+ *
+ * \returns GA_NO_ERROR if the operation was successful or an error
+ *          code otherwise
+ */
+GPUARRAY_PUBLIC int GpuReduction_call(GpuReduction *gr, GpuArray *dst,
+                                      const GpuArray *src,
+                                      unsigned int reduxLen,
+                                      const unsigned int *reduxList);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
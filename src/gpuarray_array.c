@@ -17,6 +17,7 @@
 #include "gpuarray/util.h"
 
 #include "util/error.h"
+#include "util/fastdiv.h"
 #include "util/strb.h"
 #include "util/xxhash.h"
 
@@ -39,10 +40,28 @@ static uint32_t extcopy_hash(cache_key_t k) {
   return XXH32(k, sizeof(struct extcopy_args), 42);
 }
 
+static GpuElemwise *extcopy_new(gpucontext *ctx, const struct extcopy_args *a) {
+  gpuelemwise_arg gargs[2];
+  gargs[0].name = "src";
+  gargs[0].typecode = a->itype;
+  gargs[0].flags = GE_READ;
+  gargs[1].name = "dst";
+  gargs[1].typecode = a->otype;
+  gargs[1].flags = GE_WRITE;
+  return GpuElemwise_new(ctx, "", "dst = src", 2, gargs, 0, GE_CONVERT_F16);
+}
+
+/*
+ * The lock only covers the cache lookup and insert.  There is one
+ * entry per pair of types and the cache never evicts, so a kernel we
+ * got from it stays valid until the context goes away.  The kernel
+ * is built and called without the lock so that other threads can use
+ * the context in the meantime.
+ */
 static int ga_extcopy(GpuArray *dst, const GpuArray *src) {
-  struct extcopy_args a, *aa;
   gpucontext *ctx = GpuArray_context(dst);
-  GpuElemwise *k = NULL;
+  struct extcopy_args a, *aa;
+  GpuElemwise *k = NULL, *nk;
   void *args[2];
 
   if (ctx != GpuArray_context(src))
@@ -50,38 +69,52 @@ static int ga_extcopy(GpuArray *dst, const GpuArray *src) {
 
   a.itype = src->typecode;
   a.otype = dst->typecode;
+  args[0] = (void *)src;
+  args[1] = (void *)dst;
 
+  ctx_lock(ctx);
   if (ctx->extcopy_cache != NULL)
     k = cache_get(ctx->extcopy_cache, &a);
-  if (k == NULL) {
-    gpuelemwise_arg gargs[2];
-    gargs[0].name = "src";
-    gargs[0].typecode = src->typecode;
-    gargs[0].flags = GE_READ;
-    gargs[1].name = "dst";
-    gargs[1].typecode = dst->typecode;
-    gargs[1].flags = GE_WRITE;
-    k = GpuElemwise_new(ctx, "", "dst = src", 2, gargs, 0, GE_CONVERT_F16);
-    if (k == NULL)
-      return ctx->err->code;
-    aa = memdup(&a, sizeof(a));
-    if (aa == NULL) {
-      GpuElemwise_free(k);
-      return error_sys(ctx->err, "memdup");
-    }
-    if (ctx->extcopy_cache == NULL)
-      ctx->extcopy_cache = cache_twoq(4, 8, 8, 2, extcopy_eq, extcopy_hash,
-                                      extcopy_free,
-                                      (cache_freev_fn)GpuElemwise_free,
-                                      ctx->err);
-    if (ctx->extcopy_cache == NULL)
-      return ctx->err->code;
-    if (cache_add(ctx->extcopy_cache, aa, k) != 0)
-      return error_set(ctx->err, GA_MISC_ERROR,
-                       "Could not store GpuElemwise copy kernel in context cache");
+  ctx_unlock(ctx);
+  if (k != NULL)
+    return GpuElemwise_call(k, args, GE_BROADCAST);
+
+  nk = extcopy_new(ctx, &a);
+  if (nk == NULL)
+    return ctx->err->code;
+  aa = memdup(&a, sizeof(a));
+  if (aa == NULL) {
+    GpuElemwise_free(nk);
+    return error_sys(ctx->err, "memdup");
   }
-  args[0] = (void *)src;
-  args[1] = (void *)dst;
+
+  ctx_lock(ctx);
+  if (ctx->extcopy_cache == NULL)
+    ctx->extcopy_cache = cache_lru(0, 16, extcopy_eq, extcopy_hash,
+                                   extcopy_free,
+                                   (cache_freev_fn)GpuElemwise_free,
+                                   ctx->err);
+  if (ctx->extcopy_cache == NULL) {
+    ctx_unlock(ctx);
+    GpuElemwise_free(nk);
+    free(aa);
+    return ctx->err->code;
+  }
+  /* Someone else may have built the same kernel in the meantime */
+  k = cache_get(ctx->extcopy_cache, &a);
+  if (k != NULL) {
+    GpuElemwise_free(nk);
+    free(aa);
+  } else if (cache_add(ctx->extcopy_cache, aa, nk) != 0) {
+    ctx_unlock(ctx);
+    GpuElemwise_free(nk);
+    free(aa);
+    return error_set(ctx->err, GA_MISC_ERROR,
+                     "Could not store GpuElemwise copy kernel in context cache");
+  } else {
+    k = nk;
+  }
+  ctx_unlock(ctx);
   return GpuElemwise_call(k, args, GE_BROADCAST);
 }
 
@@ -237,7 +270,12 @@ int GpuArray_view(GpuArray *v, const GpuArray *a) {
 }
 
 int GpuArray_sync(GpuArray *a) {
-  return gpudata_sync(a->data);
+  gpucontext *ctx = GpuArray_context(a);
+  int err;
+  err = gpudata_sync(a->data);
+  if (err == GA_NO_ERROR && ctx->errpending)
+    err = gpucontext_check_errors(ctx);
+  return err;
 }
 
 int GpuArray_index_inplace(GpuArray *a, const ssize_t *starts,
@@ -322,24 +360,71 @@ int GpuArray_index(GpuArray *r, const GpuArray *a, const ssize_t *starts,
   return err;
 }
 
+struct take1_args {
+  int rtype;
+  int vtype;
+  int itype;
+  unsigned int nd;
+  int addr32;
+};
+
+/*
+ * A take1 kernel along with everything needed to launch it that does
+ * not depend on the sizes of the call.
+ */
+struct take1_kernel {
+  GpuKernel k;
+  ga_fastdiv *fdiv;
+  gpudata *errbuf;
+  int errcode;
+  unsigned int nargs;
+  size_t min_l;
+  size_t target_l;
+  size_t target_g;
+};
+
+static int take1_eq(cache_key_t _k1, cache_key_t _k2) {
+  struct take1_args *k1 = _k1;
+  struct take1_args *k2 = _k2;
+  return (k1->rtype == k2->rtype && k1->vtype == k2->vtype &&
+          k1->itype == k2->itype && k1->nd == k2->nd &&
+          k1->addr32 == k2->addr32);
+}
+
+static uint32_t take1_hash(cache_key_t k) {
+  return XXH32(k, sizeof(struct take1_args), 42);
+}
+
+static void take1_free(cache_value_t v) {
+  struct take1_kernel *tk = v;
+  if (tk->k.k != NULL)
+    GpuKernel_clear(&tk->k);
+  free(tk->fdiv);
+  free(tk);
+}
+
+static unsigned int take1_nargs(unsigned int nd) {
+  return 10 + 2 * nd + (nd > 2 ? 2 * (nd - 2) : 0);
+}
+
 static int gen_take1_kernel(GpuKernel *k, gpucontext *ctx, char **err_str,
-                            GpuArray *a, const GpuArray *v,
-                            const GpuArray *ind, int addr32) {
+                            const struct take1_args *ta) {
   strb sb = STRB_STATIC_INIT;
   int *atypes;
   char *sz, *ssz;
   unsigned int i, i2;
   unsigned int nargs, apos;
+  char dn[16];
   int flags = 0;
   int res;
 
-  nargs = 9 + 2 * v->nd;
+  nargs = take1_nargs(ta->nd);
 
   atypes = calloc(nargs, sizeof(int));
   if (atypes == NULL)
     return error_set(ctx->err, GA_MEMORY_ERROR, "Out of memory");
 
-  if (addr32) {
+  if (ta->addr32) {
     sz = "ga_uint";
     ssz = "ga_int";
   } else {
@@ -351,25 +436,31 @@ static int gen_take1_kernel(GpuKernel *k, gpucontext *ctx, char **err_str,
   strb_appendf(&sb, "#include \"cluda.h\"\n"
                "KERNEL void take1(GLOBAL_MEM %s *r, ga_size r_off, "
                "GLOBAL_MEM const %s *v, ga_size v_off,",
-               gpuarray_get_type(a->typecode)->cluda_name,
-               gpuarray_get_type(v->typecode)->cluda_name);
+               gpuarray_get_type(ta->rtype)->cluda_name,
+               gpuarray_get_type(ta->vtype)->cluda_name);
   atypes[apos++] = GA_BUFFER;
   atypes[apos++] = GA_SIZE;
   atypes[apos++] = GA_BUFFER;
   atypes[apos++] = GA_SIZE;
-  for (i = 0; i < v->nd; i++) {
+  for (i = 0; i < ta->nd; i++) {
     strb_appendf(&sb, " ga_ssize s%u, ga_size d%u,", i, i);
     atypes[apos++] = GA_SSIZE;
     atypes[apos++] = GA_SIZE;
   }
+  for (i = 2; i < ta->nd; i++) {
+    strb_appendf(&sb, " %s d%u_m, ga_uint d%u_s,", sz, i, i);
+    atypes[apos++] = ta->addr32 ? GA_UINT : GA_SIZE;
+    atypes[apos++] = GA_UINT;
+  }
   strb_appendf(&sb, " GLOBAL_MEM const %s *ind, ga_size i_off, "
-               "ga_size n0, ga_size n1, GLOBAL_MEM int* err) {\n",
-               gpuarray_get_type(ind->typecode)->cluda_name);
+               "ga_size n0, ga_size n1, GLOBAL_MEM int* err, int errcode) {\n",
+               gpuarray_get_type(ta->itype)->cluda_name);
   atypes[apos++] = GA_BUFFER;
   atypes[apos++] = GA_SIZE;
   atypes[apos++] = GA_SIZE;
   atypes[apos++] = GA_SIZE;
   atypes[apos++] = GA_BUFFER;
+  atypes[apos++] = GA_INT;
   assert(apos == nargs);
   strb_appendf(&sb, "  const %s idx0 = LDIM_0 * GID_0 + LID_0;\n"
                "  const %s numThreads0 = LDIM_0 * GDIM_0;\n"
@@ -379,33 +470,35 @@ static int gen_take1_kernel(GpuKernel *k, gpucontext *ctx, char **err_str,
   strb_appends(&sb, "  if (idx0 >= n0 || idx1 >= n1) return;\n");
   strb_appendf(&sb, "  r = (GLOBAL_MEM %s *)(((GLOBAL_MEM char *)r) + r_off);\n"
                "  ind = (GLOBAL_MEM %s *)(((GLOBAL_MEM char *)ind) + i_off);\n",
-               gpuarray_get_type(a->typecode)->cluda_name,
-               gpuarray_get_type(ind->typecode)->cluda_name);
+               gpuarray_get_type(ta->rtype)->cluda_name,
+               gpuarray_get_type(ta->itype)->cluda_name);
   strb_appendf(&sb, "  for (i0 = idx0; i0 < n0; i0 += numThreads0) {\n"
                "    %s ii0 = ind[i0];\n"
                "    %s pos0 = v_off;\n"
                "    if (ii0 < 0) ii0 += d0;\n"
                "    if ((ii0 < 0) || (ii0 >= (%s)d0)) {\n"
-               "      *err = -1;\n"
+               "      if (*err == 0) *err = errcode;\n"
                "      continue;\n"
                "    }\n"
                "    pos0 += ii0 * (%s)s0;\n"
                "    for (i1 = idx1; i1 < n1; i1 += numThreads1) {\n"
                "      %s p = pos0;\n", ssz, sz, ssz, sz, sz);
-  if (v->nd > 1) {
+  if (ta->nd > 1) {
     strb_appendf(&sb, "      %s pos, ii = i1;\n", sz);
-    for (i2 = v->nd; i2 > 1; i2--) {
+    for (i2 = ta->nd; i2 > 1; i2--) {
       i = i2 - 1;
-      if (i > 1)
-        strb_appendf(&sb, "      pos = ii %% (%s)d%u;\n"
-                     "      ii /= (%s)d%u;\n", sz, i, sz, i);
-      else
+      if (i > 1) {
+        sprintf(dn, "d%u", i);
+        strb_appends(&sb, "      ");
+        ga_fastdiv_append(&sb, ta->addr32, "ii", "pos", dn);
+      } else {
         strb_appends(&sb, "      pos = ii;\n");
+      }
       strb_appendf(&sb, "      p += pos * (%s)s%u;\n", ssz, i);
     }
   }
   strb_appendf(&sb, "      r[i0*((%s)n1) + i1] = *((GLOBAL_MEM %s *)(((GLOBAL_MEM char *)v) + p));\n",
-               sz, gpuarray_get_type(v->typecode)->cluda_name);
+               sz, gpuarray_get_type(ta->vtype)->cluda_name);
   strb_appends(&sb, "    }\n"
                "  }\n"
                "}\n");
@@ -413,7 +506,7 @@ static int gen_take1_kernel(GpuKernel *k, gpucontext *ctx, char **err_str,
     res = error_set(ctx->err, GA_MEMORY_ERROR, "Out of memory");
     goto bail;
   }
-  flags |= gpuarray_type_flags(a->typecode, v->typecode, GA_BYTE, -1);
+  flags |= gpuarray_type_flags(ta->rtype, ta->vtype, GA_BYTE, -1);
   res = GpuKernel_init(k, ctx, 1, (const char **)&sb.s, &sb.l, "take1",
                        nargs, atypes, flags, err_str);
 bail:
@@ -422,20 +515,137 @@ bail:
   return res;
 }
 
+static struct take1_kernel *take1_new(gpucontext *ctx,
+                                      const struct take1_args *ta) {
+  struct take1_kernel *tk;
+  size_t max_l, max_g;
+  unsigned int numprocs;
+#if DEBUG
+  char *errstr = NULL;
+#endif
+  int err;
+
+  tk = calloc(1, sizeof(*tk));
+  if (tk == NULL) {
+    error_sys(ctx->err, "calloc");
+    return NULL;
+  }
+  err = gen_take1_kernel(&tk->k, ctx,
+#if DEBUG
+                         &errstr,
+#else
+                         NULL,
+#endif
+                         ta);
+#if DEBUG
+  if (errstr != NULL) {
+    fprintf(stderr, "%s\n", errstr);
+    free(errstr);
+  }
+#endif
+  if (err != GA_NO_ERROR) {
+    free(tk);
+    return NULL;
+  }
+  tk->nargs = take1_nargs(ta->nd);
+  tk->fdiv = calloc(ta->nd, sizeof(ga_fastdiv));
+  if (tk->fdiv == NULL) {
+    error_sys(ctx->err, "calloc");
+    take1_free(tk);
+    return NULL;
+  }
+
+  /* Same policy as GpuKernel_sched(), with the properties fetched once */
+  err = gpukernel_property(tk->k.k, GA_KERNEL_PROP_MAXLSIZE, &max_l);
+  if (err == GA_NO_ERROR)
+    err = gpukernel_property(tk->k.k, GA_KERNEL_PROP_PREFLSIZE, &tk->min_l);
+  if (err == GA_NO_ERROR)
+    err = gpukernel_property(tk->k.k, GA_CTX_PROP_NUMPROCS, &numprocs);
+  if (err == GA_NO_ERROR)
+    err = gpukernel_property(tk->k.k, GA_CTX_PROP_MAXGSIZE0, &max_g);
+  if (err == GA_NO_ERROR)
+    err = gpucontext_property(ctx, GA_CTX_PROP_ERRBUF, &tk->errbuf);
+  if (err != GA_NO_ERROR) {
+    take1_free(tk);
+    return NULL;
+  }
+  tk->target_g = numprocs * 32;
+  if (tk->target_g > max_g)
+    tk->target_g = max_g;
+  tk->target_l = 512;
+  if (tk->target_l > max_l)
+    tk->target_l = max_l;
+  tk->errcode = gpucontext_errcode(ctx, "take1");
+  return tk;
+}
+
+/*
+ * Returns the kernel for `ta`, building it if needed.  On success the
+ * context lock is held and the caller must release it once it is done
+ * with the kernel since another thread could evict it in the
+ * meantime.  The lock is not held while compiling.
+ */
+static struct take1_kernel *take1_get(gpucontext *ctx,
+                                      const struct take1_args *ta) {
+  struct take1_kernel *tk = NULL, *ntk;
+  struct take1_args *key;
+
+  ctx_lock(ctx);
+  if (ctx->take1_cache != NULL)
+    tk = cache_get(ctx->take1_cache, (cache_key_t)ta);
+  if (tk != NULL)
+    return tk;
+  ctx_unlock(ctx);
+
+  ntk = take1_new(ctx, ta);
+  if (ntk == NULL)
+    return NULL;
+  key = memdup(ta, sizeof(*ta));
+  if (key == NULL) {
+    take1_free(ntk);
+    error_sys(ctx->err, "memdup");
+    return NULL;
+  }
+
+  ctx_lock(ctx);
+  if (ctx->take1_cache == NULL)
+    ctx->take1_cache = cache_twoq(8, 16, 16, 4, take1_eq, take1_hash,
+                                  free, take1_free, ctx->err);
+  if (ctx->take1_cache == NULL) {
+    ctx_unlock(ctx);
+    take1_free(ntk);
+    free(key);
+    return NULL;
+  }
+  /* Someone else may have built the same kernel in the meantime */
+  tk = cache_get(ctx->take1_cache, key);
+  if (tk != NULL) {
+    take1_free(ntk);
+    free(key);
+    return tk;
+  }
+  if (cache_add(ctx->take1_cache, key, ntk) != 0) {
+    ctx_unlock(ctx);
+    take1_free(ntk);
+    free(key);
+    error_set(ctx->err, GA_MISC_ERROR,
+              "Could not store take1 kernel in context cache");
+    return NULL;
+  }
+  return ntk;
+}
+
 int GpuArray_take1(GpuArray *a, const GpuArray *v, const GpuArray *i,
                    int check_error) {
   gpucontext *ctx = GpuArray_context(a);
-  size_t n[2], ls[2] = {0, 0}, gs[2] = {0, 0};
+  struct take1_kernel *tk;
+  struct take1_args ta;
+  void **args;
+  size_t n[2], ls[2], gs[2];
   size_t pl;
-  gpudata *errbuf;
-#if DEBUG
-  char *errstr = NULL;
-#endif
-  GpuKernel k;
   unsigned int j;
   unsigned int argp;
-  int err, kerr = 0;
-  int addr32 = 0;
+  int err;
 
   if (!GpuArray_ISWRITEABLE(a))
     return error_set(ctx->err, GA_VALUE_ERROR, "Destination array not writeable");
@@ -473,36 +683,29 @@ int GpuArray_take1(GpuArray *a, const GpuArray *v, const GpuArray *i,
     n[1] *= v->dimensions[j];
   }
 
-  if (n[0] * n[1] < SADDR32_MAX) {
-    addr32 = 1;
+  ta.rtype = a->typecode;
+  ta.vtype = v->typecode;
+  ta.itype = i->typecode;
+  ta.nd = v->nd;
+  ta.addr32 = n[0] * n[1] < SADDR32_MAX;
+
+  tk = take1_get(ctx, &ta);
+  if (tk == NULL)
+    return ctx->err->code;
+
+  /* Like GpuKernel_sched(n[0]*n[1]) */
+  ls[1] = tk->min_l;
+  gs[1] = ((n[0] * n[1] - 1) / ls[1]) + 1;
+  if (gs[1] > tk->target_g)
+    gs[1] = tk->target_g;
+  if (n[0] * n[1] > ls[1] * gs[1]) {
+    ls[1] = ((n[0] * n[1] / tk->min_l) / gs[1]) * tk->min_l;
+    if (ls[1] > tk->target_l)
+      ls[1] = tk->target_l;
   }
 
-  err = gpudata_property(v->data, GA_CTX_PROP_ERRBUF, &errbuf);
-  if (err != GA_NO_ERROR)
-    return err;
-
-  err = gen_take1_kernel(&k, ctx,
-#if DEBUG
-                         &errstr,
-#else
-                         NULL,
-#endif
-                         a, v, i, addr32);
-#if DEBUG
-  if (errstr != NULL) {
-    fprintf(stderr, "%s\n", errstr);
-    free(errstr);
-  }
-#endif
-  if (err != GA_NO_ERROR)
-    return err;
-
-  err = GpuKernel_sched(&k, n[0]*n[1], &gs[1], &ls[1]);
-  if (err != GA_NO_ERROR)
-    goto out;
-
   /* This may not be the best scheduling, but it's good enough */
-  err = gpukernel_property(k.k, GA_KERNEL_PROP_PREFLSIZE, &pl);
+  pl = tk->min_l;
   ls[0] = ls[1] / pl;
   ls[1] = pl;
   if (n[1] > n[0]) {
@@ -515,35 +718,36 @@ int GpuArray_take1(GpuArray *a, const GpuArray *v, const GpuArray *i,
     gs[1] = 1;
   }
 
+  /* The argument buffer is ours for as long as we hold the lock */
+  args = tk->k.args;
   argp = 0;
-  GpuKernel_setarg(&k, argp++, a->data);
-  GpuKernel_setarg(&k, argp++, (void *)&a->offset);
-  GpuKernel_setarg(&k, argp++, v->data);
+  args[argp++] = a->data;
+  args[argp++] = (void *)&a->offset;
+  args[argp++] = v->data;
   /* The cast is to avoid a warning about const */
-  GpuKernel_setarg(&k, argp++, (void *)&v->offset);
+  args[argp++] = (void *)&v->offset;
   for (j = 0; j < v->nd; j++) {
-    GpuKernel_setarg(&k, argp++, &v->strides[j]);
-    GpuKernel_setarg(&k, argp++, &v->dimensions[j]);
-  }
-  GpuKernel_setarg(&k, argp++, i->data);
-  GpuKernel_setarg(&k, argp++, (void *)&i->offset);
-  GpuKernel_setarg(&k, argp++, &n[0]);
-  GpuKernel_setarg(&k, argp++, &n[1]);
-  GpuKernel_setarg(&k, argp++, errbuf);
-
-  err = GpuKernel_call(&k, 2, gs, ls, 0, NULL);
-  if (check_error && err == GA_NO_ERROR) {
-    err = gpudata_read(&kerr, errbuf, 0, sizeof(int));
-    if (err == GA_NO_ERROR && kerr != 0) {
-      err = error_set(ctx->err, GA_VALUE_ERROR, "Index out of bounds");
-      kerr = 0;
-      /* We suppose this will not fail */
-      gpudata_write(errbuf, 0, &kerr, sizeof(int));
-    }
+    args[argp++] = &v->strides[j];
+    args[argp++] = &v->dimensions[j];
   }
-
-out:
-  GpuKernel_clear(&k);
+  for (j = 2; j < v->nd; j++) {
+    ga_fastdiv_init(&tk->fdiv[j], v->dimensions[j]);
+    args[argp++] = ta.addr32 ? (void *)&tk->fdiv[j].m32 :
+      (void *)&tk->fdiv[j].m;
+    args[argp++] = &tk->fdiv[j].s;
+  }
+  args[argp++] = i->data;
+  args[argp++] = (void *)&i->offset;
+  args[argp++] = &n[0];
+  args[argp++] = &n[1];
+  args[argp++] = tk->errbuf;
+  args[argp++] = &tk->errcode;
+  assert(argp == tk->nargs);
+
+  err = GpuKernel_call(&tk->k, 2, gs, ls, 0, NULL);
+  ctx_unlock(ctx);
+  if (err == GA_NO_ERROR)
+    err = gpucontext_errcheck(ctx, check_error);
   return err;
 }
 
@@ -887,9 +1091,13 @@ int GpuArray_write(GpuArray *dst, const void *src, size_t src_sz) {
 
 int GpuArray_read(void *dst, size_t dst_sz, const GpuArray *src) {
   gpucontext *ctx = GpuArray_context(src);
+  int err;
   if (!GpuArray_ISONESEGMENT(src))
     return error_set(ctx->err, GA_UNSUPPORTED_ERROR, "Array (src) not one segment");
-  return gpudata_read(dst, src->data, src->offset, dst_sz);
+  err = gpudata_read(dst, src->data, src->offset, dst_sz);
+  if (err == GA_NO_ERROR && ctx->errpending)
+    err = gpucontext_check_errors(ctx);
+  return err;
 }
 
 int GpuArray_memset(GpuArray *a, int data) {
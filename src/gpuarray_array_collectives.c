@@ -1,7 +1,13 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "gpuarray/array.h"
 #include "gpuarray/buffer_collectives.h"
 #include "gpuarray/collectives.h"
 #include "gpuarray/error.h"
+#include "gpuarray/kernel.h"
+#include "gpuarray/util.h"
 
 #include "private.h"
 
@@ -121,3 +127,784 @@ int GpuArray_all_gather(const GpuArray* src, GpuArray* dest, gpucomm* comm) {
   return gpucomm_all_gather(src->data, src->offset, dest->data, dest->offset,
                             count, src->typecode, comm);
 }
+
+/**
+ * \brief Checks that `a` can take part in a point-to-point transfer as
+ * a flat block of memory.
+ */
+static int check_p2p_array(const GpuArray* a, int write) {
+  gpucontext *ctx = gpudata_context(a->data);
+  if (!GpuArray_ISALIGNED(a))
+    return error_set(ctx->err, GA_UNALIGNED_ERROR, "Unaligned array");
+  if (!GpuArray_IS_C_CONTIGUOUS(a))
+    return error_set(ctx->err, GA_VALUE_ERROR, "Array is not C contiguous");
+  if (write && !GpuArray_ISWRITEABLE(a))
+    return error_set(ctx->err, GA_INVALID_ERROR, "Unwritable destination");
+  return GA_NO_ERROR;
+}
+
+int GpuArray_send(const GpuArray* src, int peer, gpucomm* comm) {
+  GA_CHECK(check_p2p_array(src, 0));
+  return gpucomm_send(src->data, src->offset, find_total_elems(src),
+                      src->typecode, peer, comm);
+}
+
+int GpuArray_recv(GpuArray* dest, int peer, gpucomm* comm) {
+  GA_CHECK(check_p2p_array(dest, 1));
+  return gpucomm_recv(dest->data, dest->offset, find_total_elems(dest),
+                      dest->typecode, peer, comm);
+}
+
+int GpuArray_all_to_all(const GpuArray* src, GpuArray* dest, gpucomm* comm) {
+  gpucontext *ctx = gpudata_context(src->data);
+  size_t count = 0;
+  int ndev = 0;
+  GA_CHECK(gpucomm_get_count(comm, &ndev));
+  GA_CHECK(check_gpuarrays(1, src, 1, dest, &count));
+  GA_CHECK(check_p2p_array(src, 0));
+  GA_CHECK(check_p2p_array(dest, 1));
+  if (count % ndev != 0)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Size is not a multiple of the number of ranks");
+  return gpucomm_all_to_all(src->data, src->offset, dest->data, dest->offset,
+                            count / ndev, src->typecode, comm);
+}
+
+int GpuArray_all_to_allv(const GpuArray* src, const size_t* sendcounts,
+                         const size_t* sdispls, GpuArray* dest,
+                         const size_t* recvcounts, const size_t* rdispls,
+                         gpucomm* comm) {
+  gpucontext *ctx = gpudata_context(src->data);
+  size_t nsrc = find_total_elems(src), ndest = find_total_elems(dest);
+  int ndev = 0, i;
+  GA_CHECK(gpucomm_get_count(comm, &ndev));
+  if (src->typecode != dest->typecode)
+    return error_set(ctx->err, GA_VALUE_ERROR, "Type mismatch");
+  GA_CHECK(check_p2p_array(src, 0));
+  GA_CHECK(check_p2p_array(dest, 1));
+  for (i = 0; i < ndev; i++) {
+    if (sdispls[i] > nsrc || nsrc - sdispls[i] < sendcounts[i])
+      return error_set(ctx->err, GA_VALUE_ERROR, "Send block out of bounds");
+    if (rdispls[i] > ndest || ndest - rdispls[i] < recvcounts[i])
+      return error_set(ctx->err, GA_VALUE_ERROR, "Receive block out of bounds");
+  }
+  return gpucomm_all_to_allv(src->data, src->offset, sendcounts, sdispls,
+                             dest->data, dest->offset, recvcounts, rdispls,
+                             src->typecode, comm);
+}
+
+int GpuArray_reduce_from_async(const GpuArray* src, int opcode, int root,
+                               gpucomm* comm, gpucomm_request** req) {
+  GA_CHECK(GpuArray_reduce_from(src, opcode, root, comm));
+  return gpucomm_request_new(req, comm);
+}
+
+int GpuArray_reduce_async(const GpuArray* src, GpuArray* dest, int opcode,
+                          int root, gpucomm* comm, gpucomm_request** req) {
+  GA_CHECK(GpuArray_reduce(src, dest, opcode, root, comm));
+  return gpucomm_request_new(req, comm);
+}
+
+int GpuArray_all_reduce_async(const GpuArray* src, GpuArray* dest, int opcode,
+                              gpucomm* comm, gpucomm_request** req) {
+  GA_CHECK(GpuArray_all_reduce(src, dest, opcode, comm));
+  return gpucomm_request_new(req, comm);
+}
+
+int GpuArray_reduce_scatter_async(const GpuArray* src, GpuArray* dest,
+                                  int opcode, gpucomm* comm,
+                                  gpucomm_request** req) {
+  GA_CHECK(GpuArray_reduce_scatter(src, dest, opcode, comm));
+  return gpucomm_request_new(req, comm);
+}
+
+int GpuArray_broadcast_async(GpuArray* array, int root, gpucomm* comm,
+                             gpucomm_request** req) {
+  GA_CHECK(GpuArray_broadcast(array, root, comm));
+  return gpucomm_request_new(req, comm);
+}
+
+int GpuArray_all_gather_async(const GpuArray* src, GpuArray* dest,
+                              gpucomm* comm, gpucomm_request** req) {
+  GA_CHECK(GpuArray_all_gather(src, dest, comm));
+  return gpucomm_request_new(req, comm);
+}
+
+/*
+ * Bucketed all-reduce
+ */
+
+/* Upper bound on the number of arrays in a bucket, which bounds the
+   number of arguments of its copy kernel */
+#define BUCKET_MAX_ARRAYS 64
+
+typedef struct _bucket_array {
+  GpuArray *a;
+  unsigned int nd;
+  size_t *dims;
+  ssize_t *strides;
+  size_t count;
+  size_t off;  /* in elements from the start of its part */
+} bucket_array;
+
+typedef struct _bucket_part {
+  unsigned int first;
+  unsigned int n;
+  size_t off;      /* in elements in the flat buffer */
+  size_t count;
+  unsigned int pending;
+  GpuKernel k;
+  int kinit;
+} bucket_part;
+
+struct _gpucomm_bucket {
+  gpucomm *comm;
+  gpucontext *ctx;
+  int typecode;
+  int opcode;
+  size_t maxsize;
+  bucket_array *arrays;
+  unsigned int narrays;
+  unsigned int aalloc;
+  char *ready;
+  bucket_part *parts;
+  unsigned int nparts;
+  unsigned int next;  /* first part not reduced in this round */
+  gpudata *flat;
+  int started;        /* some arrays were marked in this round */
+};
+
+/* Unsigned type of the same size to move the elements around */
+static const char *copy_type(size_t elsize) {
+  switch (elsize) {
+  case 1: return "ga_ubyte";
+  case 2: return "ga_ushort";
+  case 4: return "ga_uint";
+  case 8: return "ga_ulong";
+  }
+  return NULL;
+}
+
+static int copy_typecode(size_t elsize) {
+  switch (elsize) {
+  case 1: return GA_UBYTE;
+  case 2: return GA_USHORT;
+  case 4: return GA_UINT;
+  }
+  return GA_ULONG;
+}
+
+static void bucket_clear_layout(gpucomm_bucket *b) {
+  unsigned int i;
+  for (i = 0; i < b->nparts; i++)
+    if (b->parts[i].kinit)
+      GpuKernel_clear(&b->parts[i].k);
+  free(b->parts);
+  b->parts = NULL;
+  b->nparts = 0;
+  if (b->flat != NULL)
+    gpudata_release(b->flat);
+  b->flat = NULL;
+}
+
+int gpucomm_bucket_new(gpucomm_bucket **bucket, gpucomm *comm, int typecode,
+                       int opcode, size_t bucket_size) {
+  gpucontext *ctx = gpucomm_context(comm);
+  gpucomm_bucket *b;
+
+  *bucket = NULL;
+  if (copy_type(gpuarray_get_elsize(typecode)) == NULL)
+    return error_set(ctx->err, GA_VALUE_ERROR, "Unsupported type for bucket");
+  b = calloc(1, sizeof(*b));
+  if (b == NULL)
+    return error_sys(ctx->err, "calloc");
+  b->comm = comm;
+  b->ctx = ctx;
+  b->typecode = typecode;
+  b->opcode = opcode;
+  b->maxsize = bucket_size == 0 ? GA_BUCKET_DEFAULT_SIZE : bucket_size;
+  *bucket = b;
+  return GA_NO_ERROR;
+}
+
+void gpucomm_bucket_free(gpucomm_bucket *b) {
+  unsigned int i;
+  if (b == NULL)
+    return;
+  bucket_clear_layout(b);
+  for (i = 0; i < b->narrays; i++) {
+    free(b->arrays[i].dims);
+    free(b->arrays[i].strides);
+  }
+  free(b->arrays);
+  free(b->ready);
+  free(b);
+}
+
+int gpucomm_bucket_add(gpucomm_bucket *b, GpuArray *a, unsigned int *idx) {
+  bucket_array *ba;
+  void *tmp;
+
+  if (b->started)
+    return error_set(b->ctx->err, GA_INVALID_ERROR,
+                     "Cannot add arrays in the middle of a round");
+  if (a->typecode != b->typecode)
+    return error_set(b->ctx->err, GA_VALUE_ERROR, "Type mismatch");
+  if (gpudata_context(a->data) != b->ctx)
+    return error_set(b->ctx->err, GA_VALUE_ERROR,
+                     "array and comm context differ");
+  if (!GpuArray_ISALIGNED(a))
+    return error_set(b->ctx->err, GA_UNALIGNED_ERROR, "Unaligned array");
+  if (!GpuArray_ISWRITEABLE(a))
+    return error_set(b->ctx->err, GA_INVALID_ERROR, "Unwritable array");
+
+  if (b->narrays == b->aalloc) {
+    unsigned int n = b->aalloc == 0 ? 16 : b->aalloc * 2;
+    tmp = realloc(b->arrays, n * sizeof(bucket_array));
+    if (tmp == NULL)
+      return error_sys(b->ctx->err, "realloc");
+    b->arrays = tmp;
+    tmp = realloc(b->ready, n);
+    if (tmp == NULL)
+      return error_sys(b->ctx->err, "realloc");
+    b->ready = tmp;
+    b->aalloc = n;
+  }
+  ba = &b->arrays[b->narrays];
+  ba->a = a;
+  ba->nd = a->nd;
+  ba->dims = calloc(a->nd + 1, sizeof(size_t));
+  ba->strides = calloc(a->nd + 1, sizeof(ssize_t));
+  if (ba->dims == NULL || ba->strides == NULL) {
+    free(ba->dims);
+    free(ba->strides);
+    return error_sys(b->ctx->err, "calloc");
+  }
+  if (a->nd != 0) {
+    memcpy(ba->dims, a->dimensions, a->nd * sizeof(size_t));
+    memcpy(ba->strides, a->strides, a->nd * sizeof(ssize_t));
+  }
+  ba->count = find_total_elems(a);
+  b->ready[b->narrays] = 0;
+  if (idx != NULL)
+    *idx = b->narrays;
+  b->narrays++;
+  /* The layout is recomputed when needed */
+  bucket_clear_layout(b);
+  return GA_NO_ERROR;
+}
+
+/*
+ * Generate the copy kernel of a part.  It moves every array of the
+ * part between its place in the flat buffer and the array itself, in
+ * the direction given by `unpack`.  Each array is walked in C order
+ * with a grid-stride loop.
+ */
+static int bucket_part_kernel(gpucomm_bucket *b, bucket_part *p) {
+  strb sb = STRB_STATIC_INIT;
+  size_t elsize = gpuarray_get_elsize(b->typecode);
+  const char *t = copy_type(elsize);
+  int *types;
+  unsigned int i, j, nargs = 3 + 2 * p->n;
+  int err;
+
+  types = calloc(nargs, sizeof(int));
+  if (types == NULL)
+    return error_sys(b->ctx->err, "calloc");
+  types[0] = GA_BUFFER;
+  types[1] = GA_SIZE;
+  types[2] = GA_UINT;
+  strb_appendf(&sb, "#include \"cluda.h\"\n"
+               "KERNEL void bucket_copy(GLOBAL_MEM %s *flat, ga_size flat_off, "
+               "ga_uint unpack", t);
+  for (i = 0; i < p->n; i++) {
+    types[3 + 2 * i] = GA_BUFFER;
+    types[4 + 2 * i] = GA_SIZE;
+    strb_appendf(&sb, ", GLOBAL_MEM char *a%u, ga_size o%u", i, i);
+  }
+  strb_appendf(&sb, ") {\n"
+               "  const ga_size tid = GID_0 * LDIM_0 + LID_0;\n"
+               "  const ga_size nt = GDIM_0 * LDIM_0;\n"
+               "  ga_size i, j;\n"
+               "  ga_ssize pos;\n"
+               "  GLOBAL_MEM %s *p;\n"
+               "  flat = (GLOBAL_MEM %s *)(((GLOBAL_MEM char *)flat) + flat_off);\n",
+               t, t);
+  for (i = 0; i < p->n; i++) {
+    bucket_array *ba = &b->arrays[p->first + i];
+    strb_appendf(&sb, "  for (i = tid; i < %" SPREFIX "u; i += nt) {\n",
+                 ba->count);
+    if (GpuArray_IS_C_CONTIGUOUS(ba->a)) {
+      strb_appendf(&sb, "    pos = (ga_ssize)i * %" SPREFIX "u;\n", elsize);
+    } else {
+      strb_appendf(&sb, "    j = i;\n    pos = 0;\n");
+      for (j = ba->nd; j > 1; j--)
+        strb_appendf(&sb, "    pos += (ga_ssize)(j %% %" SPREFIX "u) * "
+                     "%" SPREFIX "d;\n    j /= %" SPREFIX "u;\n",
+                     ba->dims[j - 1], ba->strides[j - 1], ba->dims[j - 1]);
+      if (ba->nd > 0)
+        strb_appendf(&sb, "    pos += (ga_ssize)j * %" SPREFIX "d;\n",
+                     ba->strides[0]);
+    }
+    strb_appendf(&sb, "    p = (GLOBAL_MEM %s *)(a%u + o%u + pos);\n"
+                 "    if (unpack) *p = flat[%" SPREFIX "u + i];\n"
+                 "    else flat[%" SPREFIX "u + i] = *p;\n"
+                 "  }\n", t, i, i, ba->off, ba->off);
+  }
+  strb_appendf(&sb, "}\n");
+
+  if (strb_error(&sb)) {
+    err = error_set(b->ctx->err, GA_MEMORY_ERROR, "Out of memory");
+  } else {
+    err = GpuKernel_init(&p->k, b->ctx, 1, (const char **)&sb.s, &sb.l,
+                         "bucket_copy", nargs, types,
+                         gpuarray_type_flags(copy_typecode(elsize), -1),
+                         NULL);
+    if (err == GA_NO_ERROR)
+      p->kinit = 1;
+  }
+  strb_clear(&sb);
+  free(types);
+  return err;
+}
+
+/* Split the arrays in parts and allocate the flat buffer */
+static int bucket_layout(gpucomm_bucket *b) {
+  size_t elsize = gpuarray_get_elsize(b->typecode);
+  size_t total = 0;
+  unsigned int i;
+  bucket_part *p = NULL;
+  int err;
+
+  if (b->parts != NULL || b->narrays == 0)
+    return GA_NO_ERROR;
+  b->parts = calloc(b->narrays, sizeof(bucket_part));
+  if (b->parts == NULL)
+    return error_sys(b->ctx->err, "calloc");
+  for (i = 0; i < b->narrays; i++) {
+    bucket_array *ba = &b->arrays[i];
+    if (p == NULL || p->n == BUCKET_MAX_ARRAYS ||
+        (p->count + ba->count) * elsize > b->maxsize) {
+      p = &b->parts[b->nparts++];
+      p->first = i;
+    }
+    ba->off = p->count;
+    p->n++;
+    p->count += ba->count;
+    p->pending = p->n;
+  }
+  /* A lone contiguous array is reduced in place and needs no room */
+  for (i = 0; i < b->nparts; i++) {
+    p = &b->parts[i];
+    if (p->n == 1 && GpuArray_IS_C_CONTIGUOUS(b->arrays[p->first].a))
+      continue;
+    p->off = total;
+    total += p->count;
+  }
+  if (total != 0) {
+    b->flat = gpudata_alloc(b->ctx, total * elsize, NULL, 0, &err);
+    if (b->flat == NULL) {
+      bucket_clear_layout(b);
+      return err;
+    }
+  }
+  return GA_NO_ERROR;
+}
+
+static int bucket_check_array(gpucomm_bucket *b, bucket_array *ba) {
+  if (ba->a->typecode != b->typecode || ba->a->nd != ba->nd ||
+      (ba->nd != 0 &&
+       (memcmp(ba->a->dimensions, ba->dims, ba->nd * sizeof(size_t)) != 0 ||
+        memcmp(ba->a->strides, ba->strides, ba->nd * sizeof(ssize_t)) != 0)))
+    return error_set(b->ctx->err, GA_VALUE_ERROR,
+                     "Registered array changed layout");
+  return GA_NO_ERROR;
+}
+
+static int bucket_copy(gpucomm_bucket *b, bucket_part *p, unsigned int unpack) {
+  size_t elsize = gpuarray_get_elsize(b->typecode);
+  size_t flat_off = p->off * elsize;
+  size_t gs = 0, ls = 0;
+  void **args;
+  unsigned int i;
+  int err;
+
+  if (!p->kinit) {
+    err = bucket_part_kernel(b, p);
+    if (err != GA_NO_ERROR)
+      return err;
+  }
+  args = calloc(3 + 2 * p->n, sizeof(void *));
+  if (args == NULL)
+    return error_sys(b->ctx->err, "calloc");
+  args[0] = b->flat;
+  args[1] = &flat_off;
+  args[2] = &unpack;
+  for (i = 0; i < p->n; i++) {
+    args[3 + 2 * i] = b->arrays[p->first + i].a->data;
+    args[4 + 2 * i] = &b->arrays[p->first + i].a->offset;
+  }
+  err = GpuKernel_sched(&p->k, p->count, &gs, &ls);
+  if (err == GA_NO_ERROR)
+    err = GpuKernel_call(&p->k, 1, &gs, &ls, 0, args);
+  free(args);
+  return err;
+}
+
+static int bucket_reduce_part(gpucomm_bucket *b, bucket_part *p) {
+  GpuArray *a = b->arrays[p->first].a;
+  unsigned int i;
+
+  for (i = 0; i < p->n; i++)
+    GA_CHECK(bucket_check_array(b, &b->arrays[p->first + i]));
+  if (p->count == 0)
+    return GA_NO_ERROR;
+  /* Nothing to pack for a lone contiguous array */
+  if (p->n == 1 && GpuArray_IS_C_CONTIGUOUS(a))
+    return gpucomm_all_reduce(a->data, a->offset, a->data, a->offset,
+                              p->count, b->typecode, b->opcode, b->comm);
+  GA_CHECK(bucket_copy(b, p, 0));
+  GA_CHECK(gpucomm_all_reduce(b->flat, p->off * GpuArray_ITEMSIZE(a),
+                              b->flat, p->off * GpuArray_ITEMSIZE(a),
+                              p->count, b->typecode, b->opcode, b->comm));
+  return bucket_copy(b, p, 1);
+}
+
+int gpucomm_bucket_ready(gpucomm_bucket *b, unsigned int idx) {
+  unsigned int i;
+
+  if (idx >= b->narrays)
+    return error_set(b->ctx->err, GA_VALUE_ERROR, "Invalid array index");
+  if (b->ready[idx])
+    return error_set(b->ctx->err, GA_INVALID_ERROR,
+                     "Array already marked ready in this round");
+  GA_CHECK(bucket_layout(b));
+  b->started = 1;
+  b->ready[idx] = 1;
+  for (i = 0; i < b->nparts; i++) {
+    if (idx < b->parts[i].first + b->parts[i].n) {
+      b->parts[i].pending--;
+      break;
+    }
+  }
+  /* Collectives must happen in the same order on all ranks */
+  while (b->next < b->nparts && b->parts[b->next].pending == 0) {
+    GA_CHECK(bucket_reduce_part(b, &b->parts[b->next]));
+    b->next++;
+  }
+  return GA_NO_ERROR;
+}
+
+int gpucomm_bucket_flush(gpucomm_bucket *b) {
+  unsigned int i;
+  int err = GA_NO_ERROR;
+
+  GA_CHECK(bucket_layout(b));
+  while (b->next < b->nparts && err == GA_NO_ERROR) {
+    err = bucket_reduce_part(b, &b->parts[b->next]);
+    b->next++;
+  }
+  /* Start a new round */
+  b->next = 0;
+  b->started = 0;
+  for (i = 0; i < b->nparts; i++)
+    b->parts[i].pending = b->parts[i].n;
+  memset(b->ready, 0, b->narrays);
+  return err;
+}
+
+/*
+ * Compressed all-reduce
+ */
+
+static const char compress_src[] =
+  "KERNEL void compress_prep(ga_size n, GLOBAL_MEM char *s, ga_size so,\n"
+  "                          GLOBAL_MEM char *r, ga_size ro, ga_uint use_r,\n"
+  "                          GLOBAL_MEM char *w, ga_size wo) {\n"
+  "  const ga_size tid = GID_0 * LDIM_0 + LID_0;\n"
+  "  const ga_size nt = GDIM_0 * LDIM_0;\n"
+  "  GLOBAL_MEM T *src = (GLOBAL_MEM T *)(s + so);\n"
+  "  GLOBAL_MEM T *res = (GLOBAL_MEM T *)(r + ro);\n"
+  "  ga_size i;\n"
+  "  T x;\n"
+  "#ifdef TO_HALF\n"
+  "  GLOBAL_MEM ga_half *out = (GLOBAL_MEM ga_half *)(w + wo);\n"
+  "  ga_half h;\n"
+  "#else\n"
+  "  GLOBAL_MEM T *out = (GLOBAL_MEM T *)(w + wo);\n"
+  "#endif\n"
+  "  for (i = tid; i < n; i += nt) {\n"
+  "    x = src[i];\n"
+  "    if (use_r) x += res[i];\n"
+  "#ifdef TO_HALF\n"
+  "    h = ga_float2half((ga_float)x);\n"
+  "    out[i] = h;\n"
+  "    if (use_r) res[i] = x - (T)ga_half2float(h);\n"
+  "#else\n"
+  "    if (use_r) res[i] = x;\n"
+  "    out[i] = fabs(x);\n"
+  "#endif\n"
+  "  }\n"
+  "}\n"
+  "#ifdef TO_HALF\n"
+  "KERNEL void compress_unpack(ga_size n, GLOBAL_MEM ga_half *w,\n"
+  "                            GLOBAL_MEM char *d, ga_size dof) {\n"
+  "  const ga_size tid = GID_0 * LDIM_0 + LID_0;\n"
+  "  const ga_size nt = GDIM_0 * LDIM_0;\n"
+  "  GLOBAL_MEM T *dst = (GLOBAL_MEM T *)(d + dof);\n"
+  "  ga_size i;\n"
+  "  for (i = tid; i < n; i += nt)\n"
+  "    dst[i] = (T)ga_half2float(w[i]);\n"
+  "}\n"
+  "#else\n"
+  "KERNEL void compress_gather(ga_size k, GLOBAL_MEM I *idx,\n"
+  "                            GLOBAL_MEM char *v, ga_size vo, ga_uint use_r,\n"
+  "                            GLOBAL_MEM T *vals) {\n"
+  "  const ga_size tid = GID_0 * LDIM_0 + LID_0;\n"
+  "  const ga_size nt = GDIM_0 * LDIM_0;\n"
+  "  GLOBAL_MEM T *src = (GLOBAL_MEM T *)(v + vo);\n"
+  "  ga_size i;\n"
+  "  for (i = tid; i < k; i += nt) {\n"
+  "    vals[i] = src[idx[i]];\n"
+  "    /* What is sent leaves the residual */\n"
+  "    if (use_r) src[idx[i]] = 0;\n"
+  "  }\n"
+  "}\n"
+  "KERNEL void compress_scatter(ga_size n, GLOBAL_MEM I *idx,\n"
+  "                             GLOBAL_MEM T *vals,\n"
+  "                             GLOBAL_MEM char *d, ga_size dof) {\n"
+  "  const ga_size tid = GID_0 * LDIM_0 + LID_0;\n"
+  "  const ga_size nt = GDIM_0 * LDIM_0;\n"
+  "  GLOBAL_MEM T *dst = (GLOBAL_MEM T *)(d + dof);\n"
+  "  ga_size i;\n"
+  "  for (i = tid; i < n; i += nt)\n"
+  "    ATOM_ADD(&dst[idx[i]], vals[i]);\n"
+  "}\n"
+  "#endif\n";
+
+static int compress_kernel(GpuKernel *k, gpucontext *ctx, int typecode,
+                           int half, int itype, const char *name,
+                           unsigned int nargs, const int *types) {
+  strb sb = STRB_STATIC_INIT;
+  int err;
+
+  strb_appendf(&sb, "#include \"cluda.h\"\n#define T %s\n",
+               gpuarray_get_type(typecode)->cluda_name);
+  if (half)
+    strb_appends(&sb, "#define TO_HALF\n");
+  else
+    strb_appendf(&sb, "#define I %s\n#define ATOM_ADD atom_add_%cg\n",
+                 gpuarray_get_type(itype)->cluda_name,
+                 typecode == GA_FLOAT ? 'f' : 'd');
+  strb_appends(&sb, compress_src);
+  if (strb_error(&sb)) {
+    strb_clear(&sb);
+    return error_set(ctx->err, GA_MEMORY_ERROR, "Out of memory");
+  }
+  err = GpuKernel_init(k, ctx, 1, (const char **)&sb.s, &sb.l, name, nargs,
+                       types, gpuarray_type_flags(typecode, GA_HALF, -1),
+                       NULL);
+  strb_clear(&sb);
+  return err;
+}
+
+static int compress_call(GpuKernel *k, size_t n, void **args) {
+  size_t gs = 0, ls = 0;
+  if (n == 0)
+    return GA_NO_ERROR;
+  GA_CHECK(GpuKernel_sched(k, n, &gs, &ls));
+  return GpuKernel_call(k, 1, &gs, &ls, 0, args);
+}
+
+static int all_reduce_half(const GpuArray *src, GpuArray *dest, int opcode,
+                           GpuArray *res, size_t count, gpucomm *comm) {
+  static const int prep_types[] = {GA_SIZE, GA_BUFFER, GA_SIZE, GA_BUFFER,
+                                   GA_SIZE, GA_UINT, GA_BUFFER, GA_SIZE};
+  static const int unpack_types[] = {GA_SIZE, GA_BUFFER, GA_BUFFER, GA_SIZE};
+  gpucontext *ctx = gpudata_context(src->data);
+  GpuKernel prep, unpack;
+  gpudata *wire;
+  void *args[8];
+  size_t zero = 0;
+  unsigned int use_r = res != NULL;
+  int err;
+
+  wire = gpudata_alloc(ctx, count * 2 + 1, NULL, 0, &err);
+  if (wire == NULL)
+    return err;
+  err = compress_kernel(&prep, ctx, src->typecode, 1, 0, "compress_prep",
+                        8, prep_types);
+  if (err != GA_NO_ERROR)
+    goto fail_prep;
+  err = compress_kernel(&unpack, ctx, src->typecode, 1, 0, "compress_unpack",
+                        4, unpack_types);
+  if (err != GA_NO_ERROR)
+    goto fail_unpack;
+
+  args[0] = &count;
+  args[1] = src->data;
+  args[2] = (void *)&src->offset;
+  args[3] = use_r ? res->data : src->data;
+  args[4] = use_r ? (void *)&res->offset : (void *)&zero;
+  args[5] = &use_r;
+  args[6] = wire;
+  args[7] = &zero;
+  err = compress_call(&prep, count, args);
+  if (err == GA_NO_ERROR)
+    err = gpucomm_all_reduce(wire, 0, wire, 0, count, GA_HALF, opcode, comm);
+  if (err == GA_NO_ERROR) {
+    args[0] = &count;
+    args[1] = wire;
+    args[2] = dest->data;
+    args[3] = &dest->offset;
+    err = compress_call(&unpack, count, args);
+  }
+
+  GpuKernel_clear(&unpack);
+ fail_unpack:
+  GpuKernel_clear(&prep);
+ fail_prep:
+  gpudata_release(wire);
+  return err;
+}
+
+static int all_reduce_topk(const GpuArray *src, GpuArray *dest,
+                           GpuArray *res, size_t count, size_t k,
+                           gpucomm *comm) {
+  static const int prep_types[] = {GA_SIZE, GA_BUFFER, GA_SIZE, GA_BUFFER,
+                                   GA_SIZE, GA_UINT, GA_BUFFER, GA_SIZE};
+  static const int gather_types[] = {GA_SIZE, GA_BUFFER, GA_BUFFER, GA_SIZE,
+                                     GA_UINT, GA_BUFFER};
+  static const int scatter_types[] = {GA_SIZE, GA_BUFFER, GA_BUFFER,
+                                      GA_BUFFER, GA_SIZE};
+  gpucontext *ctx = gpudata_context(src->data);
+  /* Smaller indices mean fewer bytes on the wire */
+  int itype = count <= UINT_MAX ? GA_UINT : GA_ULONG;
+  GpuKernel prep, gather, scatter;
+  GpuArray mag, idx, vals, allidx, allvals;
+  const GpuArray *v = res != NULL ? res : src;
+  void *args[8];
+  size_t zero = 0, total;
+  unsigned int use_r = res != NULL;
+  int ndev = 0;
+  int err;
+
+  GA_CHECK(gpucomm_get_count(comm, &ndev));
+  total = k * ndev;
+  GA_CHECK(GpuArray_empty(&mag, ctx, src->typecode, 1, &count, GA_C_ORDER));
+  err = GpuArray_empty(&idx, ctx, itype, 1, &k, GA_C_ORDER);
+  if (err != GA_NO_ERROR)
+    goto fail_idx;
+  err = GpuArray_empty(&vals, ctx, src->typecode, 1, &k, GA_C_ORDER);
+  if (err != GA_NO_ERROR)
+    goto fail_vals;
+  err = GpuArray_empty(&allidx, ctx, itype, 1, &total, GA_C_ORDER);
+  if (err != GA_NO_ERROR)
+    goto fail_allidx;
+  err = GpuArray_empty(&allvals, ctx, src->typecode, 1, &total, GA_C_ORDER);
+  if (err != GA_NO_ERROR)
+    goto fail_allvals;
+  err = compress_kernel(&prep, ctx, src->typecode, 0, itype, "compress_prep",
+                        8, prep_types);
+  if (err != GA_NO_ERROR)
+    goto fail_prep;
+  err = compress_kernel(&gather, ctx, src->typecode, 0, itype,
+                        "compress_gather", 6, gather_types);
+  if (err != GA_NO_ERROR)
+    goto fail_gather;
+  err = compress_kernel(&scatter, ctx, src->typecode, 0, itype,
+                        "compress_scatter", 5, scatter_types);
+  if (err != GA_NO_ERROR)
+    goto fail_scatter;
+
+  /* Magnitudes, with the residual folded in */
+  args[0] = &count;
+  args[1] = src->data;
+  args[2] = (void *)&src->offset;
+  args[3] = use_r ? res->data : src->data;
+  args[4] = use_r ? (void *)&res->offset : (void *)&zero;
+  args[5] = &use_r;
+  args[6] = mag.data;
+  args[7] = &zero;
+  err = compress_call(&prep, count, args);
+  if (err == GA_NO_ERROR)
+    err = GpuArray_topk(NULL, &idx, &mag, 0, k, 1);
+  if (err == GA_NO_ERROR) {
+    args[0] = &k;
+    args[1] = idx.data;
+    args[2] = v->data;
+    args[3] = (void *)&v->offset;
+    args[4] = &use_r;
+    args[5] = vals.data;
+    err = compress_call(&gather, k, args);
+  }
+  if (err == GA_NO_ERROR)
+    err = GpuArray_all_gather(&idx, &allidx, comm);
+  if (err == GA_NO_ERROR)
+    err = GpuArray_all_gather(&vals, &allvals, comm);
+  if (err == GA_NO_ERROR)
+    err = GpuArray_memset(dest, 0);
+  if (err == GA_NO_ERROR) {
+    args[0] = &total;
+    args[1] = allidx.data;
+    args[2] = allvals.data;
+    args[3] = dest->data;
+    args[4] = &dest->offset;
+    err = compress_call(&scatter, total, args);
+  }
+
+  GpuKernel_clear(&scatter);
+ fail_scatter:
+  GpuKernel_clear(&gather);
+ fail_gather:
+  GpuKernel_clear(&prep);
+ fail_prep:
+  GpuArray_clear(&allvals);
+ fail_allvals:
+  GpuArray_clear(&allidx);
+ fail_allidx:
+  GpuArray_clear(&vals);
+ fail_vals:
+  GpuArray_clear(&idx);
+ fail_idx:
+  GpuArray_clear(&mag);
+  return err;
+}
+
+int GpuArray_all_reduce_compressed(const GpuArray *src, GpuArray *dest,
+                                   int opcode, int mode, size_t k,
+                                   GpuArray *residual, gpucomm *comm) {
+  gpucontext *ctx = gpudata_context(src->data);
+  size_t count = 0;
+
+  GA_CHECK(check_gpuarrays(1, src, 1, dest, &count));
+  if (src->typecode != GA_FLOAT && src->typecode != GA_DOUBLE)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Compression needs float32 or float64 arrays");
+  if (!GpuArray_IS_C_CONTIGUOUS(src) || !GpuArray_IS_C_CONTIGUOUS(dest))
+    return error_set(ctx->err, GA_VALUE_ERROR, "Arrays must be C contiguous");
+  if (residual != NULL) {
+    if (residual->typecode != src->typecode ||
+        find_total_elems(residual) != count ||
+        !GpuArray_IS_C_CONTIGUOUS(residual) ||
+        !GpuArray_ISWRITEABLE(residual))
+      return error_set(ctx->err, GA_VALUE_ERROR,
+                       "Residual must be a writable C contiguous array like src");
+    if (residual->data == dest->data || residual->data == src->data)
+      return error_set(ctx->err, GA_VALUE_ERROR,
+                       "Residual can't share memory with src or dest");
+  }
+
+  switch (mode) {
+  case GA_COMPRESS_HALF:
+    return all_reduce_half(src, dest, opcode, residual, count, comm);
+  case GA_COMPRESS_TOPK:
+    if (opcode != GA_SUM)
+      return error_set(ctx->err, GA_VALUE_ERROR,
+                       "Top-k compression only supports GA_SUM");
+    if (k == 0 || k > count)
+      return error_set(ctx->err, GA_VALUE_ERROR, "Invalid k for top-k");
+    return all_reduce_topk(src, dest, residual, count, k, comm);
+  }
+  return error_set(ctx->err, GA_VALUE_ERROR, "Invalid compression mode");
+}
@@ -0,0 +1,1250 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "private.h"
+#include "gpuarray/array.h"
+#include "gpuarray/error.h"
+#include "gpuarray/kernel.h"
+#include "gpuarray/util.h"
+
+#include "util/error.h"
+#include "util/strb.h"
+
+/*
+ * Description of an advanced indexing operation.
+ *
+ * The axes [axis, axis + nidx) of the indexed array are replaced by
+ * the broadcast shape of the `nidx` index arrays (of `nb`
+ * dimensions).  `istrides` holds `nb` strides for each index array,
+ * with 0 for the broadcast dimensions.
+ */
+typedef struct _index_plan {
+  size_t *bdims;
+  ssize_t *istrides;
+  size_t nbelem;
+  unsigned int axis;
+  unsigned int nidx;
+  unsigned int nb;
+} index_plan;
+
+/* Size of the local buffers in the compaction kernels */
+#define NZ_LSIZE 256
+
+static int is_index_type(int typecode) {
+  switch (typecode) {
+  case GA_BYTE:
+  case GA_UBYTE:
+  case GA_SHORT:
+  case GA_USHORT:
+  case GA_INT:
+  case GA_UINT:
+  case GA_LONG:
+  case GA_ULONG:
+  case GA_SIZE:
+  case GA_SSIZE:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/* Type suffix for the atom_add_* functions of cluda */
+static char atom_type(int typecode) {
+  switch (typecode) {
+  case GA_INT:
+    return 'i';
+  case GA_UINT:
+    return 'I';
+  case GA_LONG:
+    return 'l';
+  case GA_ULONG:
+    return 'L';
+  case GA_FLOAT:
+    return 'f';
+  case GA_DOUBLE:
+    return 'd';
+  case GA_HALF:
+    return 'e';
+  default:
+    return '\0';
+  }
+}
+
+static void index_plan_clear(index_plan *p) {
+  free(p->bdims);
+  free(p->istrides);
+  p->bdims = NULL;
+  p->istrides = NULL;
+}
+
+static int index_plan_init(index_plan *p, gpucontext *ctx, const GpuArray *x,
+                           unsigned int axis, unsigned int nidx,
+                           const GpuArray **idx) {
+  size_t d;
+  unsigned int k, b, off;
+
+  p->bdims = NULL;
+  p->istrides = NULL;
+  p->nbelem = 1;
+  p->axis = axis;
+  p->nidx = nidx;
+  p->nb = 0;
+
+  if (nidx == 0)
+    return error_set(ctx->err, GA_VALUE_ERROR, "No index arrays");
+  if (axis + nidx > x->nd)
+    return error_fmt(ctx->err, GA_VALUE_ERROR,
+                     "Too many indices: axis = %u, nidx = %u, nd = %u",
+                     axis, nidx, x->nd);
+
+  for (k = 0; k < nidx; k++) {
+    if (GpuArray_context(idx[k]) != ctx)
+      return error_fmt(ctx->err, GA_VALUE_ERROR,
+                       "Index array %u and array context differ", k);
+    if (!is_index_type(idx[k]->typecode))
+      return error_fmt(ctx->err, GA_VALUE_ERROR,
+                       "Index array %u is not of an integer type", k);
+    if (!GpuArray_ISALIGNED(idx[k]))
+      return error_fmt(ctx->err, GA_UNALIGNED_ERROR,
+                       "Index array %u is not aligned", k);
+    if (idx[k]->nd > p->nb)
+      p->nb = idx[k]->nd;
+  }
+
+  p->bdims = calloc(p->nb + 1, sizeof(size_t));
+  p->istrides = calloc(nidx * p->nb + 1, sizeof(ssize_t));
+  if (p->bdims == NULL || p->istrides == NULL) {
+    index_plan_clear(p);
+    return error_sys(ctx->err, "calloc");
+  }
+
+  for (b = 0; b < p->nb; b++)
+    p->bdims[b] = 1;
+
+  for (k = 0; k < nidx; k++) {
+    off = p->nb - idx[k]->nd;
+    for (b = 0; b < idx[k]->nd; b++) {
+      d = idx[k]->dimensions[b];
+      if (d == 1)
+        continue;
+      if (p->bdims[off + b] != 1 && p->bdims[off + b] != d) {
+        index_plan_clear(p);
+        return error_set(ctx->err, GA_VALUE_ERROR,
+                         "Index arrays could not be broadcast together");
+      }
+      p->bdims[off + b] = d;
+    }
+  }
+
+  for (k = 0; k < nidx; k++) {
+    off = p->nb - idx[k]->nd;
+    for (b = off; b < p->nb; b++) {
+      if (idx[k]->dimensions[b - off] != 1)
+        p->istrides[k * p->nb + b] = idx[k]->strides[b - off];
+    }
+  }
+
+  for (b = 0; b < p->nb; b++)
+    p->nbelem *= p->bdims[b];
+
+  return GA_NO_ERROR;
+}
+
+/*
+ * Fill `od` with the shape of the indexing result (x->nd - nidx + nb
+ * dimensions) and return the total number of elements.
+ */
+static size_t index_out_dims(const index_plan *p, const GpuArray *x,
+                             size_t *od) {
+  unsigned int i, o = 0;
+  size_t n = 1;
+
+  for (i = 0; i < p->axis; i++)
+    od[o++] = x->dimensions[i];
+  for (i = 0; i < p->nb; i++)
+    od[o++] = p->bdims[i];
+  for (i = p->axis + p->nidx; i < x->nd; i++)
+    od[o++] = x->dimensions[i];
+  for (i = 0; i < o; i++)
+    n *= od[i];
+  return n;
+}
+
+/* Emit the code that peels the last coordinate out of `ii` into `pos` */
+static void gen_peel(strb *sb, const char *sz, const char *dim, unsigned int i,
+                     int last) {
+  if (last)
+    strb_appends(sb, "    pos = ii;\n");
+  else
+    strb_appendf(sb, "    pos = ii %% (%s)%s%u;\n"
+                 "    ii /= (%s)%s%u;\n", sz, dim, i, sz, dim, i);
+}
+
+#define MODE_TAKE -1
+
+/*
+ * Generate the kernel shared by take and put.
+ *
+ * The kernel iterates over the elements of the dense array `d` (the
+ * result for take and the values for put) and computes the matching
+ * position in the indexed array `x` from the index arrays.
+ */
+static int gen_index_kernel(GpuKernel *k, gpucontext *ctx, char **err_str,
+                            const index_plan *p, int typecode,
+                            unsigned int xnd, const GpuArray **idx, int mode,
+                            int addr32) {
+  strb sb = STRB_STATIC_INIT;
+  const char *tname = gpuarray_get_type(typecode)->cluda_name;
+  const char *kname;
+  int *atypes;
+  char *sz;
+  unsigned int ond = xnd - p->nidx + p->nb;
+  unsigned int nargs, apos;
+  unsigned int i, i2, j, kk;
+  int flags;
+  int res;
+
+  switch (mode) {
+  case MODE_TAKE:
+    kname = "take";
+    break;
+  case GA_PUT_SET:
+    kname = "put";
+    break;
+  case GA_PUT_ADD:
+    kname = "put_add";
+    break;
+  default:
+    return error_set(ctx->err, GA_VALUE_ERROR, "Unknown indexing mode");
+  }
+
+  nargs = 7 + 2 * ond + 2 * xnd + p->nidx * (2 + p->nb);
+  atypes = calloc(nargs, sizeof(int));
+  if (atypes == NULL)
+    return error_sys(ctx->err, "calloc");
+
+  sz = addr32 ? "ga_uint" : "ga_size";
+
+  apos = 0;
+  strb_appendf(&sb, "#include \"cluda.h\"\n"
+               "KERNEL void %s(GLOBAL_MEM char *d, ga_size d_off, "
+               "GLOBAL_MEM char *x, ga_size x_off, ga_size n,", kname);
+  atypes[apos++] = GA_BUFFER;
+  atypes[apos++] = GA_SIZE;
+  atypes[apos++] = GA_BUFFER;
+  atypes[apos++] = GA_SIZE;
+  atypes[apos++] = GA_SIZE;
+  for (i = 0; i < ond; i++) {
+    strb_appendf(&sb, " ga_size od%u, ga_ssize ds%u,", i, i);
+    atypes[apos++] = GA_SIZE;
+    atypes[apos++] = GA_SSIZE;
+  }
+  for (i = 0; i < xnd; i++) {
+    strb_appendf(&sb, " ga_size xd%u, ga_ssize xs%u,", i, i);
+    atypes[apos++] = GA_SIZE;
+    atypes[apos++] = GA_SSIZE;
+  }
+  for (kk = 0; kk < p->nidx; kk++) {
+    strb_appendf(&sb, " GLOBAL_MEM const char *ind%u, ga_size ind%u_off,",
+                 kk, kk);
+    atypes[apos++] = GA_BUFFER;
+    atypes[apos++] = GA_SIZE;
+    for (i = 0; i < p->nb; i++) {
+      strb_appendf(&sb, " ga_ssize is%u_%u,", kk, i);
+      atypes[apos++] = GA_SSIZE;
+    }
+  }
+  strb_appends(&sb, " GLOBAL_MEM int *err, int errcode) {\n");
+  atypes[apos++] = GA_BUFFER;
+  atypes[apos++] = GA_INT;
+  assert(apos == nargs);
+
+  strb_appendf(&sb, "  const %s idx = LDIM_0 * GID_0 + LID_0;\n"
+               "  const %s numThreads = LDIM_0 * GDIM_0;\n"
+               "  %s i;\n"
+               "  for (i = idx; i < (%s)n; i += numThreads) {\n"
+               "    %s ii = i, pos;\n"
+               "    ga_ssize dp = d_off, xp = x_off, ix;\n",
+               sz, sz, sz, sz, sz);
+  for (kk = 0; kk < p->nidx; kk++)
+    strb_appendf(&sb, "    ga_ssize ip%u = ind%u_off;\n", kk, kk);
+
+  for (i2 = ond; i2 > 0; i2--) {
+    i = i2 - 1;
+    gen_peel(&sb, sz, "od", i, i == 0);
+    strb_appendf(&sb, "    dp += pos * ds%u;\n", i);
+    if (i < p->axis) {
+      strb_appendf(&sb, "    xp += pos * xs%u;\n", i);
+    } else if (i < p->axis + p->nb) {
+      for (kk = 0; kk < p->nidx; kk++)
+        strb_appendf(&sb, "    ip%u += pos * is%u_%u;\n", kk, kk, i - p->axis);
+    } else {
+      strb_appendf(&sb, "    xp += pos * xs%u;\n", i - p->nb + p->nidx);
+    }
+  }
+  if (ond == 0)
+    strb_appends(&sb, "    (void)ii; (void)pos;\n");
+
+  for (kk = 0; kk < p->nidx; kk++) {
+    j = p->axis + kk;
+    strb_appendf(&sb, "    ix = (ga_ssize)*(GLOBAL_MEM const %s *)(ind%u + ip%u);\n"
+                 "    if (ix < 0) ix += (ga_ssize)xd%u;\n"
+                 "    if (ix < 0 || ix >= (ga_ssize)xd%u) {\n"
+                 "      if (*err == 0) *err = errcode;\n"
+                 "      continue;\n"
+                 "    }\n"
+                 "    xp += ix * xs%u;\n",
+                 gpuarray_get_type(idx[kk]->typecode)->cluda_name, kk, kk,
+                 j, j, j);
+  }
+
+  switch (mode) {
+  case MODE_TAKE:
+    strb_appendf(&sb, "    *(GLOBAL_MEM %s *)(d + dp) = "
+                 "*(GLOBAL_MEM %s *)(x + xp);\n", tname, tname);
+    break;
+  case GA_PUT_SET:
+    strb_appendf(&sb, "    *(GLOBAL_MEM %s *)(x + xp) = "
+                 "*(GLOBAL_MEM %s *)(d + dp);\n", tname, tname);
+    break;
+  case GA_PUT_ADD:
+    strb_appendf(&sb, "    atom_add_%cg((GLOBAL_MEM %s *)(x + xp), "
+                 "*(GLOBAL_MEM %s *)(d + dp));\n",
+                 atom_type(typecode), tname, tname);
+    break;
+  }
+  strb_appends(&sb, "  }\n}\n");
+
+  if (strb_error(&sb)) {
+    res = error_set(ctx->err, GA_MEMORY_ERROR, "Out of memory");
+    goto bail;
+  }
+
+  flags = gpuarray_type_flags(typecode, GA_BYTE, -1);
+  for (kk = 0; kk < p->nidx; kk++)
+    flags |= gpuarray_type_flags(idx[kk]->typecode, -1);
+
+  res = GpuKernel_init(k, ctx, 1, (const char **)&sb.s, &sb.l, kname,
+                       nargs, atypes, flags, err_str);
+bail:
+  free(atypes);
+  strb_clear(&sb);
+  return res;
+}
+
+static int index_kernel_init(GpuKernel *k, gpucontext *ctx,
+                             const index_plan *p, int typecode,
+                             unsigned int xnd, const GpuArray **idx, int mode,
+                             int addr32) {
+#if DEBUG
+  char *errstr = NULL;
+#endif
+  int err;
+
+  err = gen_index_kernel(k, ctx,
+#if DEBUG
+                         &errstr,
+#else
+                         NULL,
+#endif
+                         p, typecode, xnd, idx, mode, addr32);
+#if DEBUG
+  if (errstr != NULL) {
+    fprintf(stderr, "%s\n", errstr);
+    free(errstr);
+  }
+#endif
+  return err;
+}
+
+/*
+ * Launch the kernel from gen_index_kernel() over the `n` elements of
+ * the dense array.
+ */
+static int call_index_kernel(GpuKernel *k, const index_plan *p,
+                             GpuArray *d, const ssize_t *ds, const size_t *od,
+                             size_t n, GpuArray *x, const GpuArray **idx,
+                             gpudata *errbuf, int errcode) {
+  unsigned int ond = x->nd - p->nidx + p->nb;
+  unsigned int nargs = 7 + 2 * ond + 2 * x->nd + p->nidx * (2 + p->nb);
+  unsigned int i, kk, apos;
+  size_t gs = 0, ls = 0;
+  void **args;
+  int err;
+
+  args = calloc(nargs, sizeof(void *));
+  if (args == NULL)
+    return error_sys(GpuKernel_context(k)->err, "calloc");
+
+  apos = 0;
+  args[apos++] = d->data;
+  args[apos++] = &d->offset;
+  args[apos++] = x->data;
+  args[apos++] = &x->offset;
+  args[apos++] = &n;
+  for (i = 0; i < ond; i++) {
+    args[apos++] = (void *)&od[i];
+    args[apos++] = (void *)&ds[i];
+  }
+  for (i = 0; i < x->nd; i++) {
+    args[apos++] = &x->dimensions[i];
+    args[apos++] = &x->strides[i];
+  }
+  for (kk = 0; kk < p->nidx; kk++) {
+    args[apos++] = idx[kk]->data;
+    args[apos++] = (void *)&idx[kk]->offset;
+    for (i = 0; i < p->nb; i++)
+      args[apos++] = &p->istrides[kk * p->nb + i];
+  }
+  args[apos++] = errbuf;
+  args[apos++] = &errcode;
+  assert(apos == nargs);
+
+  err = GpuKernel_sched(k, n, &gs, &ls);
+  if (err == GA_NO_ERROR)
+    err = GpuKernel_call(k, 1, &gs, &ls, 0, args);
+  free(args);
+  return err;
+}
+
+int GpuArray_take(GpuArray *r, const GpuArray *v, unsigned int axis,
+                  unsigned int nidx, const GpuArray **idx, int check_error) {
+  gpucontext *ctx = GpuArray_context(v);
+  index_plan p;
+  GpuKernel k;
+  gpudata *errbuf;
+  size_t *od = NULL;
+  size_t n;
+  unsigned int i, ond;
+  int err;
+
+  if (GpuArray_context(r) != ctx)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Result and source context differ");
+  if (!GpuArray_ISWRITEABLE(r))
+    return error_set(ctx->err, GA_VALUE_ERROR, "Destination array not writeable");
+  if (!GpuArray_ISALIGNED(r) || !GpuArray_ISALIGNED(v))
+    return error_set(ctx->err, GA_UNALIGNED_ERROR, "Arrays are not aligned");
+  if (r->typecode != v->typecode)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Result and source arrays must have the same type");
+
+  err = index_plan_init(&p, ctx, v, axis, nidx, idx);
+  if (err != GA_NO_ERROR)
+    return err;
+
+  ond = v->nd - nidx + p.nb;
+  od = calloc(ond + 1, sizeof(size_t));
+  if (od == NULL) {
+    err = error_sys(ctx->err, "calloc");
+    goto out;
+  }
+  n = index_out_dims(&p, v, od);
+
+  if (r->nd != ond) {
+    err = error_fmt(ctx->err, GA_VALUE_ERROR, "Dimension mismatch. "
+                    "r->nd = %u, expected %u", r->nd, ond);
+    goto out;
+  }
+  for (i = 0; i < ond; i++) {
+    if (r->dimensions[i] != od[i]) {
+      err = error_fmt(ctx->err, GA_VALUE_ERROR, "Dimension mismatch. "
+                      "r->dimensions[%u] = %llu, expected %llu", i,
+                      (unsigned long long)r->dimensions[i],
+                      (unsigned long long)od[i]);
+      goto out;
+    }
+  }
+
+  if (n == 0)
+    goto out;
+
+  /* Indexing an empty axis with a non-empty index is always an error */
+  for (i = axis; i < axis + nidx; i++) {
+    if (v->dimensions[i] == 0) {
+      err = error_set(ctx->err, GA_VALUE_ERROR, "Index out of bounds");
+      goto out;
+    }
+  }
+
+  err = gpudata_property(v->data, GA_CTX_PROP_ERRBUF, &errbuf);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  err = index_kernel_init(&k, ctx, &p, v->typecode, v->nd, idx, MODE_TAKE,
+                          n < SADDR32_MAX);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  err = call_index_kernel(&k, &p, r, r->strides, od, n, (GpuArray *)v, idx,
+                          errbuf, gpucontext_errcode(ctx, "take"));
+  if (err == GA_NO_ERROR)
+    err = gpucontext_errcheck(ctx, check_error);
+
+  GpuKernel_clear(&k);
+out:
+  free(od);
+  index_plan_clear(&p);
+  return err;
+}
+
+static const char put_sort_kernel[] =
+  "#include \"cluda.h\"\n"
+  "KERNEL void put_sort(GLOBAL_MEM ga_ssize *keys, GLOBAL_MEM ga_size *perm,\n"
+  "                     ga_size n, ga_size j, ga_size k) {\n"
+  "  ga_size i;\n"
+  "  for (i = LDIM_0 * GID_0 + LID_0; i < n; i += LDIM_0 * GDIM_0) {\n"
+  "    ga_size l = i ^ j;\n"
+  "    if (l > i) {\n"
+  "      ga_ssize ki = keys[i], kl = keys[l];\n"
+  "      ga_size pi = perm[i], pl = perm[l];\n"
+  "      int gt = (ki > kl) || (ki == kl && pi > pl);\n"
+  "      if (((i & k) == 0) == gt) {\n"
+  "        keys[i] = kl; keys[l] = ki;\n"
+  "        perm[i] = pl; perm[l] = pi;\n"
+  "      }\n"
+  "    }\n"
+  "  }\n"
+  "}\n";
+
+static const int put_sort_types[5] = {GA_BUFFER, GA_BUFFER, GA_SIZE, GA_SIZE,
+                                      GA_SIZE};
+
+/*
+ * Compute, for each element of the broadcast index shape, the byte
+ * offset of the indexed position (the sort key).  Invalid indices and
+ * padding elements get a permutation entry past the end so that they
+ * are ignored by the reduction.
+ */
+static int gen_put_keys_kernel(GpuKernel *k, gpucontext *ctx,
+                               const index_plan *p, const GpuArray **idx) {
+  strb sb = STRB_STATIC_INIT;
+  int *atypes;
+  unsigned int nargs, apos;
+  unsigned int i, i2, kk;
+  int flags = 0;
+  int res;
+
+  nargs = 6 + p->nb + p->nidx * (4 + p->nb);
+  atypes = calloc(nargs, sizeof(int));
+  if (atypes == NULL)
+    return error_sys(ctx->err, "calloc");
+
+  apos = 0;
+  strb_appends(&sb, "#include \"cluda.h\"\n"
+               "KERNEL void put_keys(ga_size nb, ga_size n,");
+  atypes[apos++] = GA_SIZE;
+  atypes[apos++] = GA_SIZE;
+  for (i = 0; i < p->nb; i++) {
+    strb_appendf(&sb, " ga_size bd%u,", i);
+    atypes[apos++] = GA_SIZE;
+  }
+  for (kk = 0; kk < p->nidx; kk++) {
+    strb_appendf(&sb, " GLOBAL_MEM const char *ind%u, ga_size ind%u_off,"
+                 " ga_size xd%u, ga_ssize xs%u,", kk, kk, kk, kk);
+    atypes[apos++] = GA_BUFFER;
+    atypes[apos++] = GA_SIZE;
+    atypes[apos++] = GA_SIZE;
+    atypes[apos++] = GA_SSIZE;
+    for (i = 0; i < p->nb; i++) {
+      strb_appendf(&sb, " ga_ssize is%u_%u,", kk, i);
+      atypes[apos++] = GA_SSIZE;
+    }
+  }
+  strb_appends(&sb, " GLOBAL_MEM ga_ssize *keys, GLOBAL_MEM ga_size *perm,"
+               " GLOBAL_MEM int *err, int errcode) {\n");
+  atypes[apos++] = GA_BUFFER;
+  atypes[apos++] = GA_BUFFER;
+  atypes[apos++] = GA_BUFFER;
+  atypes[apos++] = GA_INT;
+  assert(apos == nargs);
+
+  strb_appends(&sb, "  ga_size i;\n"
+               "  for (i = LDIM_0 * GID_0 + LID_0; i < n; i += LDIM_0 * GDIM_0) {\n"
+               "    ga_size ii = i, pos;\n"
+               "    ga_ssize key = 0, ix;\n");
+  for (kk = 0; kk < p->nidx; kk++)
+    strb_appendf(&sb, "    ga_ssize ip%u = ind%u_off;\n", kk, kk);
+  strb_appends(&sb, "    keys[i] = 0;\n"
+               "    perm[i] = ~((ga_size)0);\n"
+               "    if (i >= nb) continue;\n");
+  for (i2 = p->nb; i2 > 0; i2--) {
+    i = i2 - 1;
+    gen_peel(&sb, "ga_size", "bd", i, i == 0);
+    for (kk = 0; kk < p->nidx; kk++)
+      strb_appendf(&sb, "    ip%u += pos * is%u_%u;\n", kk, kk, i);
+  }
+  if (p->nb == 0)
+    strb_appends(&sb, "    (void)ii; (void)pos;\n");
+  for (kk = 0; kk < p->nidx; kk++)
+    strb_appendf(&sb, "    ix = (ga_ssize)*(GLOBAL_MEM const %s *)(ind%u + ip%u);\n"
+                 "    if (ix < 0) ix += (ga_ssize)xd%u;\n"
+                 "    if (ix < 0 || ix >= (ga_ssize)xd%u) {\n"
+                 "      if (*err == 0) *err = errcode;\n"
+                 "      continue;\n"
+                 "    }\n"
+                 "    key += ix * xs%u;\n",
+                 gpuarray_get_type(idx[kk]->typecode)->cluda_name, kk, kk,
+                 kk, kk, kk);
+  strb_appends(&sb, "    keys[i] = key;\n"
+               "    perm[i] = i;\n"
+               "  }\n"
+               "}\n");
+
+  if (strb_error(&sb)) {
+    res = error_set(ctx->err, GA_MEMORY_ERROR, "Out of memory");
+    goto bail;
+  }
+
+  for (kk = 0; kk < p->nidx; kk++)
+    flags |= gpuarray_type_flags(idx[kk]->typecode, -1);
+
+  res = GpuKernel_init(k, ctx, 1, (const char **)&sb.s, &sb.l, "put_keys",
+                       nargs, atypes, flags, NULL);
+bail:
+  free(atypes);
+  strb_clear(&sb);
+  return res;
+}
+
+/*
+ * Sum each run of equal keys in the order of the original positions
+ * and add the result to the indexed array.  Each (run, column) pair
+ * is handled by a single thread so no atomics are needed.
+ */
+static int gen_put_reduce_kernel(GpuKernel *k, gpucontext *ctx,
+                                 const index_plan *p, int typecode,
+                                 unsigned int ncd) {
+  strb sb = STRB_STATIC_INIT;
+  const char *tname = gpuarray_get_type(typecode)->cluda_name;
+  const char *acc;
+  int *atypes;
+  unsigned int nargs, apos;
+  unsigned int i, i2;
+  int res;
+
+  nargs = 9 + 3 * ncd + 2 * p->nb;
+  atypes = calloc(nargs, sizeof(int));
+  if (atypes == NULL)
+    return error_sys(ctx->err, "calloc");
+
+  acc = typecode == GA_HALF ? "ga_float" : tname;
+
+  apos = 0;
+  strb_appends(&sb, "#include \"cluda.h\"\n"
+               "KERNEL void put_reduce(GLOBAL_MEM const char *d, ga_size d_off,"
+               " GLOBAL_MEM char *x, ga_size x_off,"
+               " GLOBAL_MEM const ga_ssize *keys, GLOBAL_MEM const ga_size *perm,"
+               " ga_size nb, ga_size n, ga_size ncol,");
+  atypes[apos++] = GA_BUFFER;
+  atypes[apos++] = GA_SIZE;
+  atypes[apos++] = GA_BUFFER;
+  atypes[apos++] = GA_SIZE;
+  atypes[apos++] = GA_BUFFER;
+  atypes[apos++] = GA_BUFFER;
+  atypes[apos++] = GA_SIZE;
+  atypes[apos++] = GA_SIZE;
+  atypes[apos++] = GA_SIZE;
+  for (i = 0; i < ncd; i++) {
+    strb_appendf(&sb, " ga_size cd%u, ga_ssize cds%u, ga_ssize cxs%u,",
+                 i, i, i);
+    atypes[apos++] = GA_SIZE;
+    atypes[apos++] = GA_SSIZE;
+    atypes[apos++] = GA_SSIZE;
+  }
+  for (i = 0; i < p->nb; i++) {
+    strb_appendf(&sb, " ga_size bd%u, ga_ssize bds%u,", i, i);
+    atypes[apos++] = GA_SIZE;
+    atypes[apos++] = GA_SSIZE;
+  }
+  assert(apos == nargs);
+  /* Remove the trailing comma */
+  sb.l--;
+  strb_appends(&sb, ") {\n");
+
+  strb_appendf(&sb, "  ga_size i;\n"
+               "  for (i = LDIM_0 * GID_0 + LID_0; i < n * ncol;"
+               " i += LDIM_0 * GDIM_0) {\n"
+               "    ga_size p = i / ncol, q, ii, pos;\n"
+               "    ga_ssize key = keys[p], dp = d_off, xp = x_off, dq;\n"
+               "    %s acc = 0;\n"
+               "    int cnt = 0;\n"
+               "    if (p > 0 && keys[p - 1] == key) continue;\n"
+               "    ii = i %% ncol;\n", acc);
+  for (i2 = ncd; i2 > 0; i2--) {
+    i = i2 - 1;
+    gen_peel(&sb, "ga_size", "cd", i, i == 0);
+    strb_appendf(&sb, "    dp += pos * cds%u;\n"
+                 "    xp += pos * cxs%u;\n", i, i);
+  }
+  strb_appends(&sb, "    for (q = p; q < n && keys[q] == key; q++) {\n"
+               "      if (perm[q] >= nb) continue;\n"
+               "      ii = perm[q];\n"
+               "      dq = dp;\n");
+  for (i2 = p->nb; i2 > 0; i2--) {
+    i = i2 - 1;
+    if (i == 0)
+      strb_appends(&sb, "      pos = ii;\n");
+    else
+      strb_appendf(&sb, "      pos = ii %% bd%u;\n"
+                   "      ii /= bd%u;\n", i, i);
+    strb_appendf(&sb, "      dq += pos * bds%u;\n", i);
+  }
+  if (typecode == GA_HALF)
+    strb_appends(&sb, "      acc += ga_half2float(*(GLOBAL_MEM const ga_half *)(d + dq));\n");
+  else
+    strb_appendf(&sb, "      acc += *(GLOBAL_MEM const %s *)(d + dq);\n", tname);
+  strb_appends(&sb, "      cnt = 1;\n"
+               "    }\n"
+               "    if (!cnt) continue;\n"
+               "    xp += key;\n");
+  if (typecode == GA_HALF)
+    strb_appends(&sb, "    *(GLOBAL_MEM ga_half *)(x + xp) = ga_float2half("
+                 "ga_half2float(*(GLOBAL_MEM ga_half *)(x + xp)) + acc);\n");
+  else
+    strb_appendf(&sb, "    *(GLOBAL_MEM %s *)(x + xp) += acc;\n", tname);
+  strb_appends(&sb, "  }\n}\n");
+
+  if (strb_error(&sb)) {
+    res = error_set(ctx->err, GA_MEMORY_ERROR, "Out of memory");
+    goto bail;
+  }
+
+  res = GpuKernel_init(k, ctx, 1, (const char **)&sb.s, &sb.l, "put_reduce",
+                       nargs, atypes,
+                       gpuarray_type_flags(typecode, GA_BYTE, -1), NULL);
+bail:
+  free(atypes);
+  strb_clear(&sb);
+  return res;
+}
+
+static int put_add_deterministic(GpuArray *a, const GpuArray *v,
+                                 const index_plan *p, const ssize_t *ds,
+                                 const size_t *od, const GpuArray **idx,
+                                 gpudata *errbuf) {
+  gpucontext *ctx = GpuArray_context(a);
+  GpuKernel kk, ks, kr;
+  const char *sort_src = put_sort_kernel;
+  gpudata *keys = NULL, *perm = NULL;
+  size_t *cd = NULL;
+  ssize_t *cds = NULL, *cxs = NULL;
+  void **args = NULL;
+  size_t n2, ncol, nt, j, st;
+  size_t gs, ls;
+  unsigned int ond = a->nd - p->nidx + p->nb;
+  unsigned int ncd = ond - p->nb;
+  unsigned int nargs, apos, i, c, q;
+  int errcode = gpucontext_errcode(ctx, "put_keys");
+  int err;
+
+  kk.k = NULL;
+  ks.k = NULL;
+  kr.k = NULL;
+  kk.args = ks.args = kr.args = NULL;
+
+  n2 = 1;
+  while (n2 < p->nbelem)
+    n2 <<= 1;
+
+  cd = calloc(ncd + 1, sizeof(size_t));
+  cds = calloc(ncd + 1, sizeof(ssize_t));
+  cxs = calloc(ncd + 1, sizeof(ssize_t));
+  nargs = 6 + p->nb + p->nidx * (4 + p->nb);
+  if (nargs < 9 + 3 * ncd + 2 * p->nb)
+    nargs = 9 + 3 * ncd + 2 * p->nb;
+  args = calloc(nargs, sizeof(void *));
+  if (cd == NULL || cds == NULL || cxs == NULL || args == NULL) {
+    err = error_sys(ctx->err, "calloc");
+    goto out;
+  }
+
+  /* The columns are the non-indexed axes of the destination */
+  ncol = 1;
+  c = 0;
+  for (i = 0; i < ond; i++) {
+    if (i >= p->axis && i < p->axis + p->nb)
+      continue;
+    cd[c] = od[i];
+    cds[c] = ds[i];
+    cxs[c] = a->strides[i < p->axis ? i : i - p->nb + p->nidx];
+    ncol *= cd[c];
+    c++;
+  }
+  assert(c == ncd);
+
+  keys = gpudata_alloc(ctx, n2 * sizeof(ssize_t), NULL, 0, &err);
+  if (keys == NULL)
+    goto out;
+  perm = gpudata_alloc(ctx, n2 * sizeof(size_t), NULL, 0, &err);
+  if (perm == NULL)
+    goto out;
+
+  err = gen_put_keys_kernel(&kk, ctx, p, idx);
+  if (err != GA_NO_ERROR)
+    goto out;
+  apos = 0;
+  args[apos++] = (void *)&p->nbelem;
+  args[apos++] = &n2;
+  for (i = 0; i < p->nb; i++)
+    args[apos++] = &p->bdims[i];
+  for (q = 0; q < p->nidx; q++) {
+    args[apos++] = idx[q]->data;
+    args[apos++] = (void *)&idx[q]->offset;
+    args[apos++] = &a->dimensions[p->axis + q];
+    args[apos++] = &a->strides[p->axis + q];
+    for (i = 0; i < p->nb; i++)
+      args[apos++] = &p->istrides[q * p->nb + i];
+  }
+  args[apos++] = keys;
+  args[apos++] = perm;
+  args[apos++] = errbuf;
+  args[apos++] = &errcode;
+  gs = ls = 0;
+  err = GpuKernel_sched(&kk, n2, &gs, &ls);
+  if (err != GA_NO_ERROR)
+    goto out;
+  err = GpuKernel_call(&kk, 1, &gs, &ls, 0, args);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  if (n2 > 1) {
+    err = GpuKernel_init(&ks, ctx, 1, &sort_src, NULL,
+                         "put_sort", 5, put_sort_types, 0, NULL);
+    if (err != GA_NO_ERROR)
+      goto out;
+    gs = ls = 0;
+    err = GpuKernel_sched(&ks, n2, &gs, &ls);
+    if (err != GA_NO_ERROR)
+      goto out;
+    args[0] = keys;
+    args[1] = perm;
+    args[2] = &n2;
+    args[3] = &j;
+    args[4] = &st;
+    for (st = 2; st <= n2; st <<= 1) {
+      for (j = st >> 1; j > 0; j >>= 1) {
+        err = GpuKernel_call(&ks, 1, &gs, &ls, 0, args);
+        if (err != GA_NO_ERROR)
+          goto out;
+      }
+    }
+  }
+
+  err = gen_put_reduce_kernel(&kr, ctx, p, a->typecode, ncd);
+  if (err != GA_NO_ERROR)
+    goto out;
+  apos = 0;
+  args[apos++] = v->data;
+  args[apos++] = (void *)&v->offset;
+  args[apos++] = a->data;
+  args[apos++] = &a->offset;
+  args[apos++] = keys;
+  args[apos++] = perm;
+  args[apos++] = (void *)&p->nbelem;
+  args[apos++] = &n2;
+  args[apos++] = &ncol;
+  for (i = 0; i < ncd; i++) {
+    args[apos++] = &cd[i];
+    args[apos++] = &cds[i];
+    args[apos++] = &cxs[i];
+  }
+  for (i = 0; i < p->nb; i++) {
+    args[apos++] = &p->bdims[i];
+    args[apos++] = (void *)&ds[p->axis + i];
+  }
+  nt = n2 * ncol;
+  gs = ls = 0;
+  err = GpuKernel_sched(&kr, nt, &gs, &ls);
+  if (err != GA_NO_ERROR)
+    goto out;
+  err = GpuKernel_call(&kr, 1, &gs, &ls, 0, args);
+
+out:
+  if (kk.k != NULL) GpuKernel_clear(&kk);
+  if (ks.k != NULL) GpuKernel_clear(&ks);
+  if (kr.k != NULL) GpuKernel_clear(&kr);
+  if (keys != NULL) gpudata_release(keys);
+  if (perm != NULL) gpudata_release(perm);
+  free(args);
+  free(cd);
+  free(cds);
+  free(cxs);
+  return err;
+}
+
+int GpuArray_put(GpuArray *a, const GpuArray *v, unsigned int axis,
+                 unsigned int nidx, const GpuArray **idx, ga_put_mode mode,
+                 int check_error) {
+  gpucontext *ctx = GpuArray_context(a);
+  index_plan p;
+  GpuKernel k;
+  gpudata *errbuf;
+  size_t *od = NULL;
+  ssize_t *ds = NULL;
+  size_t n;
+  unsigned int i, off, ond;
+  int err;
+
+  if (GpuArray_context(v) != ctx)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Destination and value context differ");
+  if (!GpuArray_ISWRITEABLE(a))
+    return error_set(ctx->err, GA_VALUE_ERROR, "Destination array not writeable");
+  if (!GpuArray_ISALIGNED(a) || !GpuArray_ISALIGNED(v))
+    return error_set(ctx->err, GA_UNALIGNED_ERROR, "Arrays are not aligned");
+  if (a->typecode != v->typecode)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Destination and value arrays must have the same type");
+  if (mode == GA_PUT_ADD && atom_type(a->typecode) == '\0')
+    return error_fmt(ctx->err, GA_UNSUPPORTED_ERROR,
+                     "Atomic add is not supported for type %s, "
+                     "use GA_PUT_ADD_DETERMINISTIC",
+                     gpuarray_get_type(a->typecode)->cluda_name);
+
+  err = index_plan_init(&p, ctx, a, axis, nidx, idx);
+  if (err != GA_NO_ERROR)
+    return err;
+
+  ond = a->nd - nidx + p.nb;
+  od = calloc(ond + 1, sizeof(size_t));
+  ds = calloc(ond + 1, sizeof(ssize_t));
+  if (od == NULL || ds == NULL) {
+    err = error_sys(ctx->err, "calloc");
+    goto out;
+  }
+  n = index_out_dims(&p, a, od);
+
+  /* The values are broadcast to the shape of the indexing result */
+  if (v->nd > ond) {
+    err = error_fmt(ctx->err, GA_VALUE_ERROR, "Dimension mismatch. "
+                    "v->nd = %u, expected at most %u", v->nd, ond);
+    goto out;
+  }
+  off = ond - v->nd;
+  for (i = 0; i < v->nd; i++) {
+    if (v->dimensions[i] == od[off + i]) {
+      ds[off + i] = od[off + i] == 1 ? 0 : v->strides[i];
+    } else if (v->dimensions[i] != 1) {
+      err = error_fmt(ctx->err, GA_VALUE_ERROR, "Dimension mismatch. "
+                      "v->dimensions[%u] = %llu, expected %llu", i,
+                      (unsigned long long)v->dimensions[i],
+                      (unsigned long long)od[off + i]);
+      goto out;
+    }
+  }
+
+  if (n == 0)
+    goto out;
+
+  for (i = axis; i < axis + nidx; i++) {
+    if (a->dimensions[i] == 0) {
+      err = error_set(ctx->err, GA_VALUE_ERROR, "Index out of bounds");
+      goto out;
+    }
+  }
+
+  err = gpudata_property(a->data, GA_CTX_PROP_ERRBUF, &errbuf);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  if (mode == GA_PUT_ADD_DETERMINISTIC) {
+    err = put_add_deterministic(a, v, &p, ds, od, idx, errbuf);
+  } else {
+    err = index_kernel_init(&k, ctx, &p, a->typecode, a->nd, idx, mode,
+                            n < SADDR32_MAX);
+    if (err != GA_NO_ERROR)
+      goto out;
+    err = call_index_kernel(&k, &p, (GpuArray *)v, ds, od, n, a, idx,
+                            errbuf, gpucontext_errcode(ctx, mode == GA_PUT_SET ?
+                                                       "put" : "put_add"));
+    GpuKernel_clear(&k);
+  }
+  if (err == GA_NO_ERROR)
+    err = gpucontext_errcheck(ctx, check_error);
+
+out:
+  free(od);
+  free(ds);
+  index_plan_clear(&p);
+  return err;
+}
+
+/*
+ * The compaction is done in three passes: each group counts the
+ * non-zero elements of its chunk, a single thread scans the counts
+ * and each group then writes the coordinates of its elements at its
+ * offset using a local prefix sum.
+ */
+static int gen_nonzero_kernel(GpuKernel *k, gpucontext *ctx,
+                              const GpuArray *a, int write) {
+  strb sb = STRB_STATIC_INIT;
+  const char *tname = gpuarray_get_type(a->typecode)->cluda_name;
+  const char *kname = write ? "nz_write" : "nz_count";
+  int *atypes;
+  unsigned int nargs, apos;
+  unsigned int i, i2;
+  int res;
+
+  nargs = 5 + 2 * a->nd + (write ? 3 : 0);
+  atypes = calloc(nargs, sizeof(int));
+  if (atypes == NULL)
+    return error_sys(ctx->err, "calloc");
+
+  apos = 0;
+  strb_appendf(&sb, "#include \"cluda.h\"\n"
+               "KERNEL void %s(GLOBAL_MEM const char *a, ga_size a_off,"
+               " ga_size n, ga_size chunk,", kname);
+  atypes[apos++] = GA_BUFFER;
+  atypes[apos++] = GA_SIZE;
+  atypes[apos++] = GA_SIZE;
+  atypes[apos++] = GA_SIZE;
+  for (i = 0; i < a->nd; i++) {
+    strb_appendf(&sb, " ga_size ad%u, ga_ssize as%u,", i, i);
+    atypes[apos++] = GA_SIZE;
+    atypes[apos++] = GA_SSIZE;
+  }
+  strb_appends(&sb, " GLOBAL_MEM ga_size *counts");
+  atypes[apos++] = GA_BUFFER;
+  if (write) {
+    strb_appends(&sb, ", GLOBAL_MEM ga_long *r, ga_size r_off, ga_size total");
+    atypes[apos++] = GA_BUFFER;
+    atypes[apos++] = GA_SIZE;
+    atypes[apos++] = GA_SIZE;
+  }
+  assert(apos == nargs);
+  strb_appendf(&sb, ") {\n"
+               "  LOCAL_MEM ga_size buf[%u];\n"
+               "  ga_size start = GID_0 * chunk;\n"
+               "  ga_size end = start + chunk;\n"
+               "  ga_size i, ii, pos, flag, s, t;\n"
+               "  ga_ssize p;\n"
+               "  if (end > n) end = n;\n", NZ_LSIZE);
+  for (i = 0; i < a->nd; i++)
+    strb_appendf(&sb, "  ga_size c%u;\n", i);
+  if (write)
+    strb_appends(&sb, "  ga_size base = counts[GID_0];\n"
+                 "  r = (GLOBAL_MEM ga_long *)(((GLOBAL_MEM char *)r) + r_off);\n"
+                 "  for (t = start; t < end; t += LDIM_0) {\n"
+                 "    i = t + LID_0;\n"
+                 "    flag = 0;\n"
+                 "    if (i < end) {\n");
+  else
+    strb_appends(&sb, "  flag = 0;\n"
+                 "  for (t = start; t < end; t += LDIM_0) {\n"
+                 "    i = t + LID_0;\n"
+                 "    if (i < end) {\n");
+  strb_appends(&sb, "      ii = i;\n"
+               "      p = a_off;\n");
+  for (i2 = a->nd; i2 > 0; i2--) {
+    i = i2 - 1;
+    if (i == 0)
+      strb_appends(&sb, "      pos = ii;\n");
+    else
+      strb_appendf(&sb, "      pos = ii %% ad%u;\n"
+                   "      ii /= ad%u;\n", i, i);
+    strb_appendf(&sb, "      c%u = pos;\n"
+                 "      p += pos * as%u;\n", i, i);
+  }
+  if (a->typecode == GA_HALF)
+    strb_appends(&sb, "      if (ga_half2float(*(GLOBAL_MEM const ga_half *)(a + p)) != 0)");
+  else
+    strb_appendf(&sb, "      if (*(GLOBAL_MEM const %s *)(a + p) != 0)", tname);
+  strb_appends(&sb, " flag++;\n"
+               "    }\n");
+  if (write) {
+    strb_appends(&sb, "    buf[LID_0] = flag;\n"
+                 "    local_barrier();\n"
+                 "    for (s = 1; s < LDIM_0; s <<= 1) {\n"
+                 "      ga_size v = (LID_0 >= s) ? buf[LID_0 - s] : 0;\n"
+                 "      local_barrier();\n"
+                 "      buf[LID_0] += v;\n"
+                 "      local_barrier();\n"
+                 "    }\n"
+                 "    if (flag) {\n"
+                 "      pos = base + buf[LID_0] - 1;\n");
+    for (i = 0; i < a->nd; i++)
+      strb_appendf(&sb, "      r[%u * total + pos] = c%u;\n", i, i);
+    strb_appends(&sb, "    }\n"
+                 "    base += buf[LDIM_0 - 1];\n"
+                 "    local_barrier();\n"
+                 "  }\n"
+                 "}\n");
+  } else {
+    strb_appends(&sb, "  }\n"
+                 "  buf[LID_0] = flag;\n"
+                 "  local_barrier();\n"
+                 "  for (s = LDIM_0 / 2; s > 0; s >>= 1) {\n"
+                 "    if (LID_0 < s) buf[LID_0] += buf[LID_0 + s];\n"
+                 "    local_barrier();\n"
+                 "  }\n"
+                 "  if (LID_0 == 0) counts[GID_0] = buf[0];\n"
+                 "}\n");
+  }
+
+  if (strb_error(&sb)) {
+    res = error_set(ctx->err, GA_MEMORY_ERROR, "Out of memory");
+    goto bail;
+  }
+
+  res = GpuKernel_init(k, ctx, 1, (const char **)&sb.s, &sb.l, kname,
+                       nargs, atypes,
+                       gpuarray_type_flags(a->typecode, GA_BYTE, GA_LONG, -1),
+                       NULL);
+bail:
+  free(atypes);
+  strb_clear(&sb);
+  return res;
+}
+
+static const char nz_scan_kernel[] =
+  "#include \"cluda.h\"\n"
+  "KERNEL void nz_scan(GLOBAL_MEM ga_size *counts, ga_size ng) {\n"
+  "  ga_size i, c, acc = 0;\n"
+  "  if (LID_0 != 0 || GID_0 != 0) return;\n"
+  "  for (i = 0; i < ng; i++) {\n"
+  "    c = counts[i];\n"
+  "    counts[i] = acc;\n"
+  "    acc += c;\n"
+  "  }\n"
+  "  counts[ng] = acc;\n"
+  "}\n";
+
+static const int nz_scan_types[2] = {GA_BUFFER, GA_SIZE};
+
+/*
+ * The local reduction and scan need a power of two group size.  Start
+ * from the preferred multiple and grow up to what the kernel allows.
+ */
+static int nz_lsize(GpuKernel *k, size_t *ls) {
+  size_t maxl, pref;
+  int err;
+
+  err = gpukernel_property(k->k, GA_KERNEL_PROP_MAXLSIZE, &maxl);
+  if (err != GA_NO_ERROR)
+    return err;
+  err = gpukernel_property(k->k, GA_KERNEL_PROP_PREFLSIZE, &pref);
+  if (err != GA_NO_ERROR)
+    return err;
+  if (maxl > NZ_LSIZE)
+    maxl = NZ_LSIZE;
+  *ls = 1;
+  while (*ls * 2 <= pref)
+    *ls <<= 1;
+  while (*ls > maxl)
+    *ls >>= 1;
+  while (*ls * 2 <= maxl)
+    *ls <<= 1;
+  return GA_NO_ERROR;
+}
+
+int GpuArray_nonzero(GpuArray *r, const GpuArray *a) {
+  gpucontext *ctx = GpuArray_context(a);
+  GpuKernel kc, ks, kw;
+  const char *scan_src = nz_scan_kernel;
+  gpudata *counts = NULL;
+  void **args = NULL;
+  size_t n, ng, chunk, ls, one = 1;
+  size_t total = 0;
+  size_t dims[2];
+  unsigned int i, apos;
+  int err;
+
+  kc.k = ks.k = kw.k = NULL;
+  kc.args = ks.args = kw.args = NULL;
+
+  if (a->nd == 0)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "nonzero is not defined for 0-d arrays");
+  if (!GpuArray_ISALIGNED(a))
+    return error_set(ctx->err, GA_UNALIGNED_ERROR, "Array is not aligned");
+
+  n = 1;
+  for (i = 0; i < a->nd; i++)
+    n *= a->dimensions[i];
+
+  if (n == 0)
+    goto alloc;
+
+  args = calloc(8 + 2 * a->nd, sizeof(void *));
+  if (args == NULL)
+    return error_sys(ctx->err, "calloc");
+
+  err = gen_nonzero_kernel(&kc, ctx, a, 0);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  err = nz_lsize(&kc, &ls);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  /* Each group handles a chunk of at least 16 rounds */
+  ng = (n + ls * 16 - 1) / (ls * 16);
+  if (ng > 1024)
+    ng = 1024;
+  chunk = (n + ng - 1) / ng;
+  ng = (n + chunk - 1) / chunk;
+
+  counts = gpudata_alloc(ctx, (ng + 1) * sizeof(size_t), NULL, 0, &err);
+  if (counts == NULL)
+    goto out;
+
+  apos = 0;
+  args[apos++] = a->data;
+  args[apos++] = (void *)&a->offset;
+  args[apos++] = &n;
+  args[apos++] = &chunk;
+  for (i = 0; i < a->nd; i++) {
+    args[apos++] = &a->dimensions[i];
+    args[apos++] = &a->strides[i];
+  }
+  args[apos++] = counts;
+  err = GpuKernel_call(&kc, 1, &ng, &ls, 0, args);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  err = GpuKernel_init(&ks, ctx, 1, &scan_src, NULL,
+                       "nz_scan", 2, nz_scan_types, 0, NULL);
+  if (err != GA_NO_ERROR)
+    goto out;
+  GpuKernel_setarg(&ks, 0, counts);
+  GpuKernel_setarg(&ks, 1, &ng);
+  err = GpuKernel_call(&ks, 1, &one, &one, 0, NULL);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  /* The size of the result depends on the data */
+  err = gpudata_read(&total, counts, ng * sizeof(size_t), sizeof(size_t));
+  if (err != GA_NO_ERROR)
+    goto out;
+
+alloc:
+  dims[0] = a->nd;
+  dims[1] = total;
+  err = GpuArray_empty(r, ctx, GA_LONG, 2, dims, GA_C_ORDER);
+  if (err != GA_NO_ERROR || total == 0)
+    goto out;
+
+  err = gen_nonzero_kernel(&kw, ctx, a, 1);
+  if (err != GA_NO_ERROR)
+    goto fail;
+  /* The groups only need to agree on the chunks, not on their size */
+  err = nz_lsize(&kw, &ls);
+  if (err != GA_NO_ERROR)
+    goto fail;
+  args[apos++] = r->data;
+  args[apos++] = &r->offset;
+  args[apos++] = &total;
+  err = GpuKernel_call(&kw, 1, &ng, &ls, 0, args);
+fail:
+  if (err != GA_NO_ERROR)
+    GpuArray_clear(r);
+out:
+  if (kc.k != NULL) GpuKernel_clear(&kc);
+  if (ks.k != NULL) GpuKernel_clear(&ks);
+  if (kw.k != NULL) GpuKernel_clear(&kw);
+  if (counts != NULL) gpudata_release(counts);
+  free(args);
+  return err;
+}
@@ -0,0 +1,599 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "private.h"
+#include "gpuarray/array.h"
+#include "gpuarray/error.h"
+#include "gpuarray/kernel.h"
+#include "gpuarray/util.h"
+
+#include "util/error.h"
+#include "util/fastdiv.h"
+#include "util/strb.h"
+#include "util/xxhash.h"
+
+/*
+ * Row-wise normalisations.  The normalised axis is moved last (as a
+ * view) and each group handles whole rows.
+ *
+ * In the first sweep over a row every thread keeps a running summary
+ * of its elements: the maximum and the sum of the exponentials scaled
+ * to that maximum for softmax, or the count, mean and sum of squared
+ * deviations (Welford) for layer normalisation.  The summaries are
+ * then combined in local memory and the second sweep writes the
+ * results.  When the row fits in local memory the elements are kept
+ * there during the first sweep so the source is only read once.
+ *
+ * Half values are loaded and combined as float.  Double is used when
+ * the source or the result is double.
+ */
+
+/* Maximum number of threads in a group (a power of 2) */
+#define NORM_LSIZE 256
+
+/* Size of the local row cache, in bytes */
+#define NORM_CACHE_BYTES 16384
+
+/* Upper bound on the number of arguments of the kernel */
+#define NORM_NARGS(nd) (12 + 5 * (nd))
+
+enum norm_mode {
+  NORM_SOFTMAX,
+  NORM_LOGSOFTMAX,
+  NORM_LAYER
+};
+
+/*
+ * Arrays of a normalisation, with the normalised axis last.  `w` and
+ * `b` can be NULL.
+ */
+typedef struct _norm_arrays {
+  const GpuArray *r;
+  const GpuArray *a;
+  const GpuArray *w;
+  const GpuArray *b;
+  unsigned int nd;
+} norm_arrays;
+
+/*
+ * Everything the generated kernel depends on.  `wtype` and `btype` are
+ * -1 when there is no weight or bias.
+ */
+struct norm_args {
+  int mode;
+  int rtype;
+  int atype;
+  int wtype;
+  int btype;
+  unsigned int nd;
+  int cache;
+};
+
+static int norm_eq(cache_key_t _k1, cache_key_t _k2) {
+  struct norm_args *k1 = _k1;
+  struct norm_args *k2 = _k2;
+  return (k1->mode == k2->mode && k1->rtype == k2->rtype &&
+          k1->atype == k2->atype && k1->wtype == k2->wtype &&
+          k1->btype == k2->btype && k1->nd == k2->nd &&
+          k1->cache == k2->cache);
+}
+
+static uint32_t norm_hash(cache_key_t k) {
+  return XXH32(k, sizeof(struct norm_args), 42);
+}
+
+static void norm_free(cache_value_t v) {
+  GpuKernel *k = v;
+  GpuKernel_clear(k);
+  free(k);
+}
+
+static void gen_load(strb *sb, const char *name, int typecode) {
+  if (typecode == GA_HALF)
+    strb_appendf(sb, "#define %s(p) ((ACC_T)ga_half2float("
+                 "*(GLOBAL_MEM const ga_half *)(p)))\n", name);
+  else
+    strb_appendf(sb, "#define %s(p) ((ACC_T)*(GLOBAL_MEM const %s *)(p))\n",
+                 name, gpuarray_get_type(typecode)->cluda_name);
+}
+
+static int gen_norm_kernel(GpuKernel *k, gpucontext *ctx,
+                           const norm_arrays *na, enum norm_mode mode,
+                           int acctype, size_t cache, int flags) {
+  strb sb = STRB_STATIC_INIT;
+  int *types;
+  const char *rt = gpuarray_get_type(na->r->typecode)->cluda_name;
+  unsigned int i, n, l = na->nd - 1;
+  char dn[16];
+#if DEBUG
+  char *errstr = NULL;
+#endif
+  int err;
+
+  types = calloc(NORM_NARGS(na->nd), sizeof(int));
+  if (types == NULL)
+    return error_sys(ctx->err, "calloc");
+
+  strb_appends(&sb, "#include \"cluda.h\"\n");
+  strb_appendf(&sb, "#define ACC_T %s\n",
+               gpuarray_get_type(acctype)->cluda_name);
+  gen_load(&sb, "LOAD_A", na->a->typecode);
+  if (na->w != NULL)
+    gen_load(&sb, "LOAD_W", na->w->typecode);
+  if (na->b != NULL)
+    gen_load(&sb, "LOAD_B", na->b->typecode);
+  if (na->r->typecode == GA_HALF)
+    strb_appends(&sb, "#define STORE_R(p, x) (*(GLOBAL_MEM ga_half *)(p) = "
+                 "ga_float2half(x))\n");
+  else
+    strb_appendf(&sb, "#define STORE_R(p, x) (*(GLOBAL_MEM %s *)(p) = "
+                 "(%s)(x))\n", rt, rt);
+
+  n = 0;
+  strb_appends(&sb, "KERNEL void normalize(GLOBAL_MEM char *r, ga_size r_off, "
+               "GLOBAL_MEM const char *a, ga_size a_off, ");
+  types[n++] = GA_BUFFER;
+  types[n++] = GA_SIZE;
+  types[n++] = GA_BUFFER;
+  types[n++] = GA_SIZE;
+  if (na->w != NULL) {
+    strb_appends(&sb, "GLOBAL_MEM const char *w, ga_size w_off, "
+                 "ga_ssize ws, ");
+    types[n++] = GA_BUFFER;
+    types[n++] = GA_SIZE;
+    types[n++] = GA_SSIZE;
+  }
+  if (na->b != NULL) {
+    strb_appends(&sb, "GLOBAL_MEM const char *b, ga_size b_off, "
+                 "ga_ssize bs, ");
+    types[n++] = GA_BUFFER;
+    types[n++] = GA_SIZE;
+    types[n++] = GA_SSIZE;
+  }
+  for (i = 0; i < na->nd; i++) {
+    strb_appendf(&sb, "ga_size d%u, ga_ssize rs%u, ga_ssize as%u, ",
+                 i, i, i);
+    types[n++] = GA_SIZE;
+    types[n++] = GA_SSIZE;
+    types[n++] = GA_SSIZE;
+  }
+  /* Magic numbers to split the row index, see ga_fastdiv_append() */
+  for (i = 1; i + 1 < na->nd; i++) {
+    strb_appendf(&sb, "ga_size d%u_m, ga_uint d%u_s, ", i, i);
+    types[n++] = GA_SIZE;
+    types[n++] = GA_UINT;
+  }
+  strb_appends(&sb, "ga_size nrows, ACC_T eps) {\n");
+  types[n++] = GA_SIZE;
+  types[n++] = acctype;
+
+  strb_appendf(&sb, "  LOCAL_MEM ACC_T l0[%u];\n"
+               "  LOCAL_MEM ACC_T l1[%u];\n", NORM_LSIZE, NORM_LSIZE);
+  if (mode == NORM_LAYER)
+    strb_appendf(&sb, "  LOCAL_MEM ACC_T l2[%u];\n", NORM_LSIZE);
+  if (cache != 0)
+    strb_appendf(&sb, "  LOCAL_MEM ACC_T cache[%" SPREFIX "u];\n", cache);
+  strb_appends(&sb, "  GLOBAL_MEM char *rp;\n"
+               "  GLOBAL_MEM const char *ap;\n"
+               "  ga_size row, ii, pos, j, off;\n"
+               "  ACC_T x, m, s, om, os;\n");
+  if (mode == NORM_LAYER)
+    strb_appends(&sb, "  ACC_T c, d, g, oc;\n");
+  strb_appends(&sb, "  for (row = GID_0; row < nrows; row += GDIM_0) {\n"
+               "    rp = r + r_off;\n"
+               "    ap = a + a_off;\n"
+               "    ii = row;\n");
+  for (i = l; i > 0; i--) {
+    if (i > 1) {
+      sprintf(dn, "d%u", i - 1);
+      strb_appends(&sb, "    ");
+      ga_fastdiv_append(&sb, 0, "ii", "pos", dn);
+    } else {
+      strb_appends(&sb, "    pos = ii;\n");
+    }
+    strb_appendf(&sb, "    rp += (ga_ssize)pos * rs%u;\n"
+                 "    ap += (ga_ssize)pos * as%u;\n", i - 1, i - 1);
+  }
+
+  /* First sweep: per-thread summaries */
+  if (mode == NORM_LAYER)
+    strb_appends(&sb, "    c = 0; m = 0; s = 0;\n");
+  else
+    strb_appends(&sb, "    m = -INFINITY; s = 0;\n");
+  strb_appendf(&sb, "    for (j = LID_0; j < d%u; j += LDIM_0) {\n"
+               "      x = LOAD_A(ap + (ga_ssize)j * as%u);\n", l, l);
+  if (cache != 0)
+    strb_appends(&sb, "      cache[j] = x;\n");
+  if (mode == NORM_LAYER)
+    strb_appends(&sb, "      c += 1;\n"
+                 "      d = x - m;\n"
+                 "      m += d / c;\n"
+                 "      s += d * (x - m);\n");
+  else
+    strb_appends(&sb, "      if (x > m) {\n"
+                 "        s = s * exp(m - x) + 1;\n"
+                 "        m = x;\n"
+                 "      } else if (m != -INFINITY) {\n"
+                 "        s += exp(x - m);\n"
+                 "      }\n");
+  strb_appends(&sb, "    }\n");
+
+  /* Combine them */
+  strb_appends(&sb, "    l0[LID_0] = m;\n"
+               "    l1[LID_0] = s;\n");
+  if (mode == NORM_LAYER)
+    strb_appends(&sb, "    l2[LID_0] = c;\n");
+  strb_appends(&sb, "    local_barrier();\n"
+               "    for (off = LDIM_0 >> 1; off > 0; off >>= 1) {\n"
+               "      if (LID_0 < off) {\n"
+               "        om = l0[LID_0 + off];\n"
+               "        os = l1[LID_0 + off];\n");
+  if (mode == NORM_LAYER)
+    strb_appends(&sb, "        oc = l2[LID_0 + off];\n"
+                 "        if (oc > 0) {\n"
+                 "          d = om - m;\n"
+                 "          g = oc / (c + oc);\n"
+                 "          m += d * g;\n"
+                 "          s += os + d * d * c * g;\n"
+                 "          c += oc;\n"
+                 "        }\n"
+                 "        l2[LID_0] = c;\n");
+  else
+    strb_appends(&sb, "        if (om > m) {\n"
+                 "          s = s * exp(m - om) + os;\n"
+                 "          m = om;\n"
+                 "        } else if (om != -INFINITY) {\n"
+                 "          s += os * exp(om - m);\n"
+                 "        }\n");
+  strb_appends(&sb, "        l0[LID_0] = m;\n"
+               "        l1[LID_0] = s;\n"
+               "      }\n"
+               "      local_barrier();\n"
+               "    }\n"
+               "    m = l0[0];\n"
+               "    s = l1[0];\n");
+  switch (mode) {
+  case NORM_SOFTMAX:
+    strb_appends(&sb, "    s = 1 / s;\n");
+    break;
+  case NORM_LOGSOFTMAX:
+    strb_appends(&sb, "    s = m + log(s);\n");
+    break;
+  case NORM_LAYER:
+    strb_appends(&sb, "    s = 1 / sqrt(s / l2[0] + eps);\n");
+    break;
+  }
+
+  /* Second sweep: write the results */
+  strb_appendf(&sb, "    for (j = LID_0; j < d%u; j += LDIM_0) {\n", l);
+  if (cache != 0)
+    strb_appends(&sb, "      x = cache[j];\n");
+  else
+    strb_appendf(&sb, "      x = LOAD_A(ap + (ga_ssize)j * as%u);\n", l);
+  switch (mode) {
+  case NORM_SOFTMAX:
+    strb_appends(&sb, "      x = exp(x - m) * s;\n");
+    break;
+  case NORM_LOGSOFTMAX:
+    strb_appends(&sb, "      x = x - s;\n");
+    break;
+  case NORM_LAYER:
+    strb_appends(&sb, "      x = (x - m) * s;\n");
+    if (na->w != NULL)
+      strb_appends(&sb, "      x *= LOAD_W(w + w_off + (ga_ssize)j * ws);\n");
+    if (na->b != NULL)
+      strb_appends(&sb, "      x += LOAD_B(b + b_off + (ga_ssize)j * bs);\n");
+    break;
+  }
+  strb_appendf(&sb, "      STORE_R(rp + (ga_ssize)j * rs%u, x);\n"
+               "    }\n"
+               /* Don't overwrite the summaries before everyone read them */
+               "    local_barrier();\n"
+               "  }\n"
+               "}\n", l);
+
+  if (strb_error(&sb)) {
+    strb_clear(&sb);
+    free(types);
+    return error_set(ctx->err, GA_MEMORY_ERROR, "Out of memory");
+  }
+  err = GpuKernel_init(k, ctx, 1, (const char **)&sb.s, &sb.l, "normalize",
+                       n, types, flags,
+#if DEBUG
+                       &errstr
+#else
+                       NULL
+#endif
+                       );
+#if DEBUG
+  if (errstr != NULL) {
+    fprintf(stderr, "%s\n", errstr);
+    free(errstr);
+  }
+#endif
+  strb_clear(&sb);
+  free(types);
+  return err;
+}
+
+/*
+ * Returns the kernel for `nargs`, building it if needed.  On success
+ * the context lock is held and the caller must release it once it is
+ * done with the kernel since another thread could evict it in the
+ * meantime.  The lock is not held while compiling.
+ */
+static GpuKernel *norm_get(gpucontext *ctx, const struct norm_args *nargs,
+                           const norm_arrays *na, int acctype, size_t cache,
+                           int flags) {
+  GpuKernel *k = NULL, *nk;
+  struct norm_args *key;
+
+  ctx_lock(ctx);
+  if (ctx->norm_cache != NULL)
+    k = cache_get(ctx->norm_cache, (cache_key_t)nargs);
+  if (k != NULL)
+    return k;
+  ctx_unlock(ctx);
+
+  nk = malloc(sizeof(*nk));
+  if (nk == NULL) {
+    error_sys(ctx->err, "malloc");
+    return NULL;
+  }
+  if (gen_norm_kernel(nk, ctx, na, (enum norm_mode)nargs->mode, acctype,
+                      cache, flags) != GA_NO_ERROR) {
+    free(nk);
+    return NULL;
+  }
+  key = memdup(nargs, sizeof(*nargs));
+  if (key == NULL) {
+    norm_free(nk);
+    error_sys(ctx->err, "memdup");
+    return NULL;
+  }
+
+  ctx_lock(ctx);
+  if (ctx->norm_cache == NULL)
+    ctx->norm_cache = cache_twoq(8, 16, 16, 4, norm_eq, norm_hash,
+                                 free, norm_free, ctx->err);
+  if (ctx->norm_cache == NULL) {
+    ctx_unlock(ctx);
+    norm_free(nk);
+    free(key);
+    return NULL;
+  }
+  /* Someone else may have built the same kernel in the meantime */
+  k = cache_get(ctx->norm_cache, key);
+  if (k != NULL) {
+    norm_free(nk);
+    free(key);
+    return k;
+  }
+  if (cache_add(ctx->norm_cache, key, nk) != 0) {
+    ctx_unlock(ctx);
+    norm_free(nk);
+    free(key);
+    error_set(ctx->err, GA_MISC_ERROR,
+              "Could not store normalize kernel in context cache");
+    return NULL;
+  }
+  return nk;
+}
+
+static int is_float_type(int typecode) {
+  return typecode == GA_HALF || typecode == GA_FLOAT || typecode == GA_DOUBLE;
+}
+
+static int check_shape(gpucontext *ctx, const char *name, const GpuArray *x,
+                       const GpuArray *a) {
+  unsigned int i;
+
+  if (x->nd != a->nd)
+    return error_fmt(ctx->err, GA_VALUE_ERROR, "Dimension mismatch. "
+                     "%s->nd = %u, a->nd = %u", name, x->nd, a->nd);
+  for (i = 0; i < a->nd; i++)
+    if (x->dimensions[i] != a->dimensions[i])
+      return error_fmt(ctx->err, GA_VALUE_ERROR, "Dimension mismatch. "
+                       "%s->dimensions[%u] = %llu, a->dimensions[%u] = %llu",
+                       name, i, (unsigned long long)x->dimensions[i],
+                       i, (unsigned long long)a->dimensions[i]);
+  return GA_NO_ERROR;
+}
+
+static int check_affine(gpucontext *ctx, const char *name, const GpuArray *x,
+                        size_t len) {
+  if (x->nd != 1 || x->dimensions[0] != len)
+    return error_fmt(ctx->err, GA_VALUE_ERROR, "%s must be a vector of the "
+                     "size of the normalised axis (%llu)", name,
+                     (unsigned long long)len);
+  if (!is_float_type(x->typecode))
+    return error_fmt(ctx->err, GA_VALUE_ERROR, "%s must be of a floating "
+                     "point type", name);
+  if (!GpuArray_ISALIGNED(x))
+    return error_fmt(ctx->err, GA_UNALIGNED_ERROR, "%s is not aligned", name);
+  return GA_NO_ERROR;
+}
+
+static int norm_call(GpuKernel *k, gpucontext *ctx, const norm_arrays *na,
+                     int acctype, size_t len, size_t nrows, double eps) {
+  void **args;
+  ga_fastdiv *fdiv;
+  size_t ls, gs, m;
+  float epsf = (float)eps;
+  unsigned int i, n;
+  int err;
+
+  err = gpukernel_property(k->k, GA_KERNEL_PROP_MAXLSIZE, &m);
+  if (err != GA_NO_ERROR)
+    return err;
+  if (m > NORM_LSIZE)
+    m = NORM_LSIZE;
+  /* The combining step needs a power of 2 */
+  for (ls = 1; ls * 2 <= m && ls < len; ls *= 2);
+  err = gpucontext_property(ctx, GA_CTX_PROP_MAXGSIZE0, &m);
+  if (err != GA_NO_ERROR)
+    return err;
+  gs = nrows < m ? nrows : m;
+
+  args = calloc(NORM_NARGS(na->nd), sizeof(void *));
+  fdiv = calloc(na->nd, sizeof(ga_fastdiv));
+  if (args == NULL || fdiv == NULL) {
+    free(args);
+    free(fdiv);
+    return error_sys(ctx->err, "calloc");
+  }
+  n = 0;
+  args[n++] = na->r->data;
+  args[n++] = (void *)&na->r->offset;
+  args[n++] = na->a->data;
+  args[n++] = (void *)&na->a->offset;
+  if (na->w != NULL) {
+    args[n++] = na->w->data;
+    args[n++] = (void *)&na->w->offset;
+    args[n++] = (void *)&na->w->strides[0];
+  }
+  if (na->b != NULL) {
+    args[n++] = na->b->data;
+    args[n++] = (void *)&na->b->offset;
+    args[n++] = (void *)&na->b->strides[0];
+  }
+  for (i = 0; i < na->nd; i++) {
+    args[n++] = (void *)&na->a->dimensions[i];
+    args[n++] = (void *)&na->r->strides[i];
+    args[n++] = (void *)&na->a->strides[i];
+  }
+  for (i = 1; i + 1 < na->nd; i++) {
+    ga_fastdiv_init(&fdiv[i], na->a->dimensions[i]);
+    args[n++] = &fdiv[i].m;
+    args[n++] = &fdiv[i].s;
+  }
+  args[n++] = &nrows;
+  args[n++] = acctype == GA_DOUBLE ? (void *)&eps : (void *)&epsf;
+  err = GpuKernel_call(k, 1, &gs, &ls, 0, args);
+  free(fdiv);
+  free(args);
+  return err;
+}
+
+static int normalize(GpuArray *r, const GpuArray *a, const GpuArray *w,
+                     const GpuArray *b, unsigned int axis, double eps,
+                     enum norm_mode mode) {
+  gpucontext *ctx = GpuArray_context(a);
+  norm_arrays na;
+  struct norm_args nargs;
+  GpuArray rv, av;
+  GpuKernel *k;
+  unsigned int *axes;
+  size_t len, nrows, lmem, cache, accsize;
+  unsigned int i, j;
+  int acctype, flags;
+  int err;
+
+  if (a->nd == 0)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Cannot normalize a 0-d array");
+  if (axis >= a->nd)
+    return error_fmt(ctx->err, GA_VALUE_ERROR, "Invalid axis %u for an array "
+                     "of %u dimensions", axis, a->nd);
+  if (!is_float_type(a->typecode) || !is_float_type(r->typecode))
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Only half, float and double arrays are supported");
+  if (!GpuArray_ISWRITEABLE(r))
+    return error_set(ctx->err, GA_VALUE_ERROR, "Output array not writeable");
+  if (!GpuArray_ISALIGNED(r) || !GpuArray_ISALIGNED(a))
+    return error_set(ctx->err, GA_UNALIGNED_ERROR, "Arrays are not aligned");
+  err = check_shape(ctx, "r", r, a);
+  if (err != GA_NO_ERROR)
+    return err;
+  len = a->dimensions[axis];
+  if (w != NULL)
+    err = check_affine(ctx, "w", w, len);
+  if (err == GA_NO_ERROR && b != NULL)
+    err = check_affine(ctx, "b", b, len);
+  if (err != GA_NO_ERROR)
+    return err;
+
+  nrows = 1;
+  for (i = 0; i < a->nd; i++)
+    if (i != axis)
+      nrows *= a->dimensions[i];
+  if (len == 0 || nrows == 0)
+    return GA_NO_ERROR;
+
+  /* Move the normalised axis last */
+  axes = calloc(a->nd, sizeof(unsigned int));
+  if (axes == NULL)
+    return error_sys(ctx->err, "calloc");
+  for (i = 0, j = 0; i < a->nd; i++)
+    if (i != axis)
+      axes[j++] = i;
+  axes[j] = axis;
+
+  err = GpuArray_transpose(&rv, r, axes);
+  if (err == GA_NO_ERROR) {
+    err = GpuArray_transpose(&av, a, axes);
+    if (err != GA_NO_ERROR)
+      GpuArray_clear(&rv);
+  }
+  free(axes);
+  if (err != GA_NO_ERROR)
+    return err;
+  na.r = &rv;
+  na.a = &av;
+  na.w = w;
+  na.b = b;
+  na.nd = a->nd;
+
+  acctype = (a->typecode == GA_DOUBLE || r->typecode == GA_DOUBLE) ?
+    GA_DOUBLE : GA_FLOAT;
+  accsize = gpuarray_get_elsize(acctype);
+  /* gpuarray_type_flags() stops at the first -1 */
+  flags = gpuarray_type_flags(r->typecode, a->typecode, acctype, -1);
+  if (w != NULL)
+    flags |= gpuarray_type_flags(w->typecode, -1);
+  if (b != NULL)
+    flags |= gpuarray_type_flags(b->typecode, -1);
+
+  /* Keep the row in local memory if it fits next to the summaries */
+  cache = 0;
+  err = gpucontext_property(ctx, GA_CTX_PROP_LMEMSIZE, &lmem);
+  if (err != GA_NO_ERROR)
+    goto out;
+  if (lmem >= NORM_CACHE_BYTES + 3 * NORM_LSIZE * accsize &&
+      len <= NORM_CACHE_BYTES / accsize)
+    cache = NORM_CACHE_BYTES / accsize;
+
+  nargs.mode = mode;
+  nargs.rtype = r->typecode;
+  nargs.atype = a->typecode;
+  nargs.wtype = w != NULL ? w->typecode : -1;
+  nargs.btype = b != NULL ? b->typecode : -1;
+  nargs.nd = a->nd;
+  nargs.cache = cache != 0;
+
+  k = norm_get(ctx, &nargs, &na, acctype, cache, flags);
+  if (k == NULL) {
+    err = ctx->err->code;
+    goto out;
+  }
+  err = norm_call(k, ctx, &na, acctype, len, nrows, eps);
+  ctx_unlock(ctx);
+
+out:
+  GpuArray_clear(&av);
+  GpuArray_clear(&rv);
+  return err;
+}
+
+int GpuArray_softmax(GpuArray *r, const GpuArray *a, unsigned int axis) {
+  return normalize(r, a, NULL, NULL, axis, 0, NORM_SOFTMAX);
+}
+
+int GpuArray_logsoftmax(GpuArray *r, const GpuArray *a, unsigned int axis) {
+  return normalize(r, a, NULL, NULL, axis, 0, NORM_LOGSOFTMAX);
+}
+
+int GpuArray_layernorm(GpuArray *r, const GpuArray *a, const GpuArray *w,
+                       const GpuArray *b, unsigned int axis, double eps) {
+  return normalize(r, a, w, b, axis, eps, NORM_LAYER);
+}
@@ -0,0 +1,783 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "private.h"
+#include "gpuarray/array.h"
+#include "gpuarray/error.h"
+#include "gpuarray/kernel.h"
+#include "gpuarray/util.h"
+
+#include "util/error.h"
+#include "util/strb.h"
+
+/*
+ * The scanned axis is moved last (as a view) and each row along it is
+ * split in tiles of SCAN_ITEMS elements per thread.  A group scans a
+ * tile in local memory and only needs the combination of all the
+ * previous tiles of its row (its prefix) to write the results.
+ *
+ * When the device allows it the prefix is found in a single pass with
+ * a decoupled look-back: groups take tiles in order from an atomic
+ * counter, publish their aggregate as soon as it is known and walk
+ * back over the flags of the previous tiles until they find an
+ * inclusive prefix.  Otherwise the aggregates are computed, scanned
+ * and applied in three passes.
+ *
+ * Segments are carried as a flag along with each partial value.  A
+ * flagged value starts a new segment so it replaces what comes before
+ * it instead of being combined with it.
+ */
+
+/* Size of the local buffers */
+#define SCAN_LSIZE 256
+
+/* Number of consecutive elements handled by each thread */
+#define SCAN_ITEMS 4
+
+/* Upper bound on the number of arguments of the kernels */
+#define SCAN_NARGS(nd) (10 + 4 * (nd))
+
+/* Tile status for the look-back */
+#define STATUS_AGGREGATE 1
+#define STATUS_PREFIX    2
+
+static int scan_kernel_init(GpuKernel *k, gpucontext *ctx, strb *sb,
+                            const char *name, unsigned int nargs,
+                            const int *types, int flags) {
+#if DEBUG
+  char *errstr = NULL;
+#endif
+  int err;
+
+  if (strb_error(sb)) {
+    strb_clear(sb);
+    return error_set(ctx->err, GA_MEMORY_ERROR, "Out of memory");
+  }
+  err = GpuKernel_init(k, ctx, 1, (const char **)&sb->s, &sb->l, name,
+                       nargs, types, flags,
+#if DEBUG
+                       &errstr
+#else
+                       NULL
+#endif
+                       );
+#if DEBUG
+  if (errstr != NULL) {
+    fprintf(stderr, "%s\n", errstr);
+    free(errstr);
+  }
+#endif
+  strb_clear(sb);
+  return err;
+}
+
+static int is_seg_type(int typecode) {
+  switch (typecode) {
+  case GA_BOOL:
+  case GA_BYTE:
+  case GA_UBYTE:
+  case GA_SHORT:
+  case GA_USHORT:
+  case GA_INT:
+  case GA_UINT:
+  case GA_LONG:
+  case GA_ULONG:
+  case GA_SIZE:
+  case GA_SSIZE:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/*
+ * Arrays of a scan, all with the scanned axis last.  `s` is NULL for
+ * an unsegmented scan.
+ */
+typedef struct _scan_arrays {
+  const GpuArray *r;
+  const GpuArray *a;
+  const GpuArray *s;
+  unsigned int nd;
+} scan_arrays;
+
+static void gen_scan_header(strb *sb, const scan_arrays *sa,
+                            const char *preamble, const char *op,
+                            const char *neutral) {
+  const char *rt = gpuarray_get_type(sa->r->typecode)->cluda_name;
+  const char *at = gpuarray_get_type(sa->a->typecode)->cluda_name;
+
+  strb_appends(sb, "#include \"cluda.h\"\n");
+  if (preamble != NULL)
+    strb_appendf(sb, "%s\n", preamble);
+  /* Half values are accumulated as floats */
+  strb_appendf(sb, "#define SCAN_T %s\n"
+               "#define OP(a, b) (%s)\n"
+               "#define NEUTRAL ((SCAN_T)(%s))\n"
+               "#define SCAN_ITEMS %u\n",
+               sa->r->typecode == GA_HALF ? "ga_float" : rt, op, neutral,
+               SCAN_ITEMS);
+  if (sa->a->typecode == GA_HALF)
+    strb_appends(sb, "#define LOAD_A(p) ((SCAN_T)ga_half2float("
+                 "*(GLOBAL_MEM const ga_half *)(p)))\n");
+  else
+    strb_appendf(sb, "#define LOAD_A(p) ((SCAN_T)*(GLOBAL_MEM const %s *)(p))\n",
+                 at);
+  if (sa->r->typecode == GA_HALF)
+    strb_appends(sb, "#define STORE_R(p, x) (*(GLOBAL_MEM ga_half *)(p) = "
+                 "ga_float2half(x))\n");
+  else
+    strb_appendf(sb, "#define STORE_R(p, x) (*(GLOBAL_MEM %s *)(p) = (%s)(x))\n",
+                 rt, rt);
+  if (sa->s != NULL)
+    strb_appendf(sb, "#define LOAD_S(p) (*(GLOBAL_MEM const %s *)(p) != 0)\n",
+                 gpuarray_get_type(sa->s->typecode)->cluda_name);
+  else
+    strb_appends(sb, "#define LOAD_S(p) 0\n");
+}
+
+/* Arguments shared by all the kernels that read the arrays */
+static void gen_array_params(strb *sb, const scan_arrays *sa) {
+  unsigned int i;
+
+  strb_appends(sb, "GLOBAL_MEM char *r, ga_size r_off, "
+               "GLOBAL_MEM const char *a, ga_size a_off, ");
+  if (sa->s != NULL)
+    strb_appends(sb, "GLOBAL_MEM const char *s, ga_size s_off, ");
+  for (i = 0; i < sa->nd; i++) {
+    strb_appendf(sb, "ga_size d%u, ga_ssize rs%u, ga_ssize as%u, ", i, i, i);
+    if (sa->s != NULL)
+      strb_appendf(sb, "ga_ssize ss%u, ", i);
+  }
+  strb_appends(sb, "ga_size ntiles, ga_size ntot");
+}
+
+static unsigned int array_params_types(int *types, const scan_arrays *sa) {
+  unsigned int i, n = 0;
+
+  types[n++] = GA_BUFFER;
+  types[n++] = GA_SIZE;
+  types[n++] = GA_BUFFER;
+  types[n++] = GA_SIZE;
+  if (sa->s != NULL) {
+    types[n++] = GA_BUFFER;
+    types[n++] = GA_SIZE;
+  }
+  for (i = 0; i < sa->nd; i++) {
+    types[n++] = GA_SIZE;
+    types[n++] = GA_SSIZE;
+    types[n++] = GA_SSIZE;
+    if (sa->s != NULL)
+      types[n++] = GA_SSIZE;
+  }
+  types[n++] = GA_SIZE;
+  types[n++] = GA_SIZE;
+  return n;
+}
+
+static unsigned int array_params_args(void **args, const scan_arrays *sa,
+                                      size_t *ntiles, size_t *ntot) {
+  unsigned int i, n = 0;
+
+  args[n++] = sa->r->data;
+  args[n++] = (void *)&sa->r->offset;
+  args[n++] = sa->a->data;
+  args[n++] = (void *)&sa->a->offset;
+  if (sa->s != NULL) {
+    args[n++] = sa->s->data;
+    args[n++] = (void *)&sa->s->offset;
+  }
+  for (i = 0; i < sa->nd; i++) {
+    args[n++] = (void *)&sa->a->dimensions[i];
+    args[n++] = (void *)&sa->r->strides[i];
+    args[n++] = (void *)&sa->a->strides[i];
+    if (sa->s != NULL)
+      args[n++] = (void *)&sa->s->strides[i];
+  }
+  args[n++] = ntiles;
+  args[n++] = ntot;
+  return n;
+}
+
+static void gen_tile_decls(strb *sb) {
+  strb_appendf(sb, "  LOCAL_MEM SCAN_T lv[%u];\n"
+               "  LOCAL_MEM ga_ubyte lf[%u];\n"
+               "  GLOBAL_MEM char *rp;\n"
+               "  GLOBAL_MEM const char *ap;\n"
+               "  GLOBAL_MEM const char *sp;\n"
+               "  SCAN_T v[SCAN_ITEMS];\n"
+               "  ga_ubyte f[SCAN_ITEMS];\n"
+               "  SCAN_T tv, pv, pre, acc;\n"
+               "  ga_ubyte tf, pf;\n"
+               "  ga_size tile, row, t, base, j, k, off, ii, pos;\n",
+               SCAN_LSIZE, SCAN_LSIZE);
+}
+
+/*
+ * Inclusive scan of the (tv, tf) pairs of the threads into lv and lf.
+ */
+static void gen_local_scan(strb *sb) {
+  strb_appends(sb, "    lv[LID_0] = tv;\n"
+               "    lf[LID_0] = tf;\n"
+               "    local_barrier();\n"
+               "    for (off = 1; off < LDIM_0; off <<= 1) {\n"
+               "      if (LID_0 >= off) {\n"
+               "        pv = lv[LID_0 - off];\n"
+               "        pf = lf[LID_0 - off];\n"
+               "      }\n"
+               "      local_barrier();\n"
+               "      if (LID_0 >= off) {\n"
+               "        if (!tf) tv = OP(pv, tv);\n"
+               "        tf |= pf;\n"
+               "        lv[LID_0] = tv;\n"
+               "        lf[LID_0] = tf;\n"
+               "      }\n"
+               "      local_barrier();\n"
+               "    }\n");
+}
+
+/*
+ * Load the elements of the thread for `tile` and scan the thread
+ * aggregates.  The aggregate of the tile ends in lv[LDIM_0 - 1] and
+ * lf[LDIM_0 - 1].
+ */
+static void gen_tile_load(strb *sb, const scan_arrays *sa) {
+  unsigned int i, l = sa->nd - 1;
+
+  strb_appends(sb, "    row = tile / ntiles;\n"
+               "    t = tile % ntiles;\n"
+               "    rp = r + r_off;\n"
+               "    ap = a + a_off;\n");
+  if (sa->s != NULL)
+    strb_appends(sb, "    sp = s + s_off;\n");
+  else
+    strb_appends(sb, "    sp = NULL;\n");
+  strb_appends(sb, "    ii = row;\n");
+  for (i = l; i > 0; i--) {
+    if (i > 1)
+      strb_appendf(sb, "    pos = ii %% d%u;\n"
+                   "    ii /= d%u;\n", i - 1, i - 1);
+    else
+      strb_appends(sb, "    pos = ii;\n");
+    strb_appendf(sb, "    rp += (ga_ssize)pos * rs%u;\n"
+                 "    ap += (ga_ssize)pos * as%u;\n", i - 1, i - 1);
+    if (sa->s != NULL)
+      strb_appendf(sb, "    sp += (ga_ssize)pos * ss%u;\n", i - 1);
+  }
+  strb_appendf(sb, "    base = t * (LDIM_0 * SCAN_ITEMS) + LID_0 * SCAN_ITEMS;\n"
+               "    tv = NEUTRAL;\n"
+               "    tf = 0;\n"
+               "    for (k = 0; k < SCAN_ITEMS; k++) {\n"
+               "      j = base + k;\n"
+               "      if (j < d%u) {\n"
+               "        v[k] = LOAD_A(ap + (ga_ssize)j * as%u);\n", l, l);
+  if (sa->s != NULL)
+    strb_appendf(sb, "        f[k] = LOAD_S(sp + (ga_ssize)j * ss%u);\n", l);
+  else
+    strb_appends(sb, "        f[k] = 0;\n");
+  strb_appends(sb, "      } else {\n"
+               "        v[k] = NEUTRAL;\n"
+               "        f[k] = 0;\n"
+               "      }\n"
+               "      tv = f[k] ? v[k] : OP(tv, v[k]);\n"
+               "      tf |= f[k];\n"
+               "    }\n");
+  gen_local_scan(sb);
+}
+
+/*
+ * Write the results of the tile loaded by gen_tile_load() given the
+ * combination of the previous tiles of the row in `pre`.
+ */
+static void gen_tile_store(strb *sb, const scan_arrays *sa, int exclusive) {
+  unsigned int l = sa->nd - 1;
+
+  strb_appendf(sb, "    if (LID_0 == 0)\n"
+               "      acc = pre;\n"
+               "    else if (lf[LID_0 - 1])\n"
+               "      acc = lv[LID_0 - 1];\n"
+               "    else\n"
+               "      acc = OP(pre, lv[LID_0 - 1]);\n"
+               "    for (k = 0; k < SCAN_ITEMS; k++) {\n"
+               "      j = base + k;\n"
+               "      if (j >= d%u) break;\n"
+               "      if (f[k]) acc = NEUTRAL;\n", l);
+  if (exclusive)
+    strb_appendf(sb, "      STORE_R(rp + (ga_ssize)j * rs%u, acc);\n"
+                 "      acc = OP(acc, v[k]);\n", l);
+  else
+    strb_appendf(sb, "      acc = OP(acc, v[k]);\n"
+                 "      STORE_R(rp + (ga_ssize)j * rs%u, acc);\n", l);
+  strb_appends(sb, "    }\n"
+               "    local_barrier();\n");
+}
+
+/*
+ * Single pass kernel.  status[0] is the tile counter and status[1 +
+ * tile] the status of each tile.  part[2 * tile] holds the aggregate
+ * of the tile and part[2 * tile + 1] its inclusive prefix.
+ */
+static int gen_lookback_kernel(GpuKernel *k, gpucontext *ctx,
+                               const scan_arrays *sa, const char *preamble,
+                               const char *op, const char *neutral,
+                               int exclusive, int flags) {
+  strb sb = STRB_STATIC_INIT;
+  int *types;
+  unsigned int n;
+  int err;
+
+  types = calloc(SCAN_NARGS(sa->nd), sizeof(int));
+  if (types == NULL)
+    return error_sys(ctx->err, "calloc");
+  gen_scan_header(&sb, sa, preamble, op, neutral);
+  strb_appends(&sb, "KERNEL void scan_lookback(");
+  gen_array_params(&sb, sa);
+  strb_appends(&sb, ", GLOBAL_MEM ga_uint *status, GLOBAL_MEM SCAN_T *part) {\n");
+  gen_tile_decls(&sb);
+  strb_appends(&sb, "  LOCAL_MEM ga_size ltile;\n"
+               "  LOCAL_MEM SCAN_T lpre;\n"
+               "  volatile GLOBAL_MEM ga_uint *st = status + 1;\n"
+               "  volatile GLOBAL_MEM SCAN_T *vp = part;\n"
+               "  ga_size p;\n"
+               "  ga_uint x;\n"
+               "  for (;;) {\n"
+               "    if (LID_0 == 0)\n"
+               "      ltile = atom_add_Ig(status, 1);\n"
+               "    local_barrier();\n"
+               "    tile = ltile;\n"
+               "    if (tile >= ntot) return;\n");
+  gen_tile_load(&sb, sa);
+  strb_appendf(&sb, "    if (LID_0 == 0) {\n"
+               "      pv = lv[LDIM_0 - 1];\n"
+               "      pre = NEUTRAL;\n"
+               "      if (t == 0 || lf[LDIM_0 - 1]) {\n"
+               "        vp[2 * tile + 1] = pv;\n"
+               "        global_fence();\n"
+               "        st[tile] = %u;\n"
+               "      } else {\n"
+               "        vp[2 * tile] = pv;\n"
+               "        global_fence();\n"
+               "        st[tile] = %u;\n"
+               "      }\n"
+               "      if (t != 0) {\n"
+               "        p = tile;\n"
+               "        do {\n"
+               "          p--;\n"
+               "          while ((x = st[p]) == 0);\n"
+               "          global_fence();\n"
+               "          pre = OP(vp[2 * p + (x == %u)], pre);\n"
+               "        } while (x != %u);\n"
+               "        if (!lf[LDIM_0 - 1]) {\n"
+               "          vp[2 * tile + 1] = OP(pre, pv);\n"
+               "          global_fence();\n"
+               "          st[tile] = %u;\n"
+               "        }\n"
+               "      }\n"
+               "      lpre = pre;\n"
+               "    }\n"
+               "    local_barrier();\n"
+               "    pre = lpre;\n", STATUS_PREFIX, STATUS_AGGREGATE,
+               STATUS_PREFIX, STATUS_PREFIX, STATUS_PREFIX);
+  gen_tile_store(&sb, sa, exclusive);
+  strb_appends(&sb, "  }\n"
+               "}\n");
+
+  n = array_params_types(types, sa);
+  types[n++] = GA_BUFFER;
+  types[n++] = GA_BUFFER;
+  err = scan_kernel_init(k, ctx, &sb, "scan_lookback", n, types, flags);
+  free(types);
+  return err;
+}
+
+/* Multi-pass kernels: aggregates of the tiles */
+static int gen_reduce_kernel(GpuKernel *k, gpucontext *ctx,
+                             const scan_arrays *sa, const char *preamble,
+                             const char *op, const char *neutral, int flags) {
+  strb sb = STRB_STATIC_INIT;
+  int *types;
+  unsigned int n;
+  int err;
+
+  types = calloc(SCAN_NARGS(sa->nd), sizeof(int));
+  if (types == NULL)
+    return error_sys(ctx->err, "calloc");
+  gen_scan_header(&sb, sa, preamble, op, neutral);
+  strb_appends(&sb, "KERNEL void scan_reduce(");
+  gen_array_params(&sb, sa);
+  strb_appends(&sb, ", GLOBAL_MEM SCAN_T *part, GLOBAL_MEM ga_ubyte *pflag) {\n");
+  gen_tile_decls(&sb);
+  strb_appends(&sb, "  for (tile = GID_0; tile < ntot; tile += GDIM_0) {\n");
+  gen_tile_load(&sb, sa);
+  strb_appends(&sb, "    if (LID_0 == 0) {\n"
+               "      part[tile] = lv[LDIM_0 - 1];\n"
+               "      pflag[tile] = lf[LDIM_0 - 1];\n"
+               "    }\n"
+               "    local_barrier();\n"
+               "  }\n"
+               "}\n");
+
+  n = array_params_types(types, sa);
+  types[n++] = GA_BUFFER;
+  types[n++] = GA_BUFFER;
+  err = scan_kernel_init(k, ctx, &sb, "scan_reduce", n, types, flags);
+  free(types);
+  return err;
+}
+
+static const int scan_tiles_types[4] = {GA_BUFFER, GA_BUFFER, GA_SIZE,
+                                        GA_SIZE};
+
+/*
+ * Multi-pass kernels: replace the aggregates of the tiles of each row
+ * by their exclusive prefix.
+ */
+static int gen_tiles_kernel(GpuKernel *k, gpucontext *ctx,
+                            const scan_arrays *sa, const char *preamble,
+                            const char *op, const char *neutral, int flags) {
+  strb sb = STRB_STATIC_INIT;
+
+  gen_scan_header(&sb, sa, preamble, op, neutral);
+  strb_appendf(&sb, "KERNEL void scan_tiles(GLOBAL_MEM SCAN_T *part, "
+               "GLOBAL_MEM const ga_ubyte *pflag, ga_size ntiles, "
+               "ga_size nrows) {\n"
+               "  LOCAL_MEM SCAN_T lv[%u];\n"
+               "  LOCAL_MEM ga_ubyte lf[%u];\n"
+               "  const ga_size chunk = (ntiles + LDIM_0 - 1) / LDIM_0;\n"
+               "  GLOBAL_MEM SCAN_T *c;\n"
+               "  GLOBAL_MEM const ga_ubyte *cf;\n"
+               "  SCAN_T tv, pv;\n"
+               "  ga_ubyte tf, pf;\n"
+               "  ga_size row, b, e, i, off;\n"
+               "  for (row = GID_0; row < nrows; row += GDIM_0) {\n"
+               "    c = part + row * ntiles;\n"
+               "    cf = pflag + row * ntiles;\n"
+               "    b = LID_0 * chunk;\n"
+               "    e = b + chunk;\n"
+               "    if (e > ntiles) e = ntiles;\n"
+               "    tv = NEUTRAL;\n"
+               "    tf = 0;\n"
+               "    for (i = b; i < e; i++) {\n"
+               "      tv = cf[i] ? c[i] : OP(tv, c[i]);\n"
+               "      tf |= cf[i];\n"
+               "    }\n", SCAN_LSIZE, SCAN_LSIZE);
+  gen_local_scan(&sb);
+  strb_appends(&sb, "    pv = (LID_0 == 0) ? NEUTRAL : lv[LID_0 - 1];\n"
+               "    for (i = b; i < e; i++) {\n"
+               "      tv = c[i];\n"
+               "      c[i] = pv;\n"
+               "      pv = cf[i] ? tv : OP(pv, tv);\n"
+               "    }\n"
+               "    local_barrier();\n"
+               "  }\n"
+               "}\n");
+  return scan_kernel_init(k, ctx, &sb, "scan_tiles", 4, scan_tiles_types,
+                          flags);
+}
+
+/* Multi-pass kernels: scan each tile starting from its prefix */
+static int gen_apply_kernel(GpuKernel *k, gpucontext *ctx,
+                            const scan_arrays *sa, const char *preamble,
+                            const char *op, const char *neutral,
+                            int exclusive, int flags) {
+  strb sb = STRB_STATIC_INIT;
+  int *types;
+  unsigned int n;
+  int err;
+
+  types = calloc(SCAN_NARGS(sa->nd), sizeof(int));
+  if (types == NULL)
+    return error_sys(ctx->err, "calloc");
+  gen_scan_header(&sb, sa, preamble, op, neutral);
+  strb_appends(&sb, "KERNEL void scan_apply(");
+  gen_array_params(&sb, sa);
+  strb_appends(&sb, ", GLOBAL_MEM const SCAN_T *part) {\n");
+  gen_tile_decls(&sb);
+  strb_appends(&sb, "  for (tile = GID_0; tile < ntot; tile += GDIM_0) {\n");
+  gen_tile_load(&sb, sa);
+  strb_appends(&sb, "    pre = part[tile];\n");
+  gen_tile_store(&sb, sa, exclusive);
+  strb_appends(&sb, "  }\n"
+               "}\n");
+
+  n = array_params_types(types, sa);
+  types[n++] = GA_BUFFER;
+  err = scan_kernel_init(k, ctx, &sb, "scan_apply", n, types, flags);
+  free(types);
+  return err;
+}
+
+static int scan_lsize(GpuKernel *k, size_t *ls) {
+  size_t m;
+  int err;
+
+  err = gpukernel_property(k->k, GA_KERNEL_PROP_MAXLSIZE, &m);
+  if (err != GA_NO_ERROR)
+    return err;
+  if (m < *ls)
+    *ls = m;
+  return GA_NO_ERROR;
+}
+
+static int scan_gsize(gpucontext *ctx, size_t n, size_t *gs) {
+  size_t m;
+  int err;
+
+  err = gpucontext_property(ctx, GA_CTX_PROP_MAXGSIZE0, &m);
+  if (err != GA_NO_ERROR)
+    return err;
+  *gs = n < m ? n : m;
+  return GA_NO_ERROR;
+}
+
+static int scan_lookback(gpucontext *ctx, GpuKernel *k, const scan_arrays *sa,
+                         size_t len, size_t nrows) {
+  gpudata *status = NULL, *part = NULL;
+  void **args = NULL;
+  size_t ls = SCAN_LSIZE, gs, ntiles, ntot, elsize;
+  unsigned int n;
+  int err;
+
+  err = scan_lsize(k, &ls);
+  if (err != GA_NO_ERROR)
+    return err;
+  ntiles = (len + ls * SCAN_ITEMS - 1) / (ls * SCAN_ITEMS);
+  ntot = ntiles * nrows;
+  /* The tile counter is 32 bits, let the caller use the multi-pass scan */
+  if (ntot >= 0xFFFFFFFF)
+    return error_set(ctx->err, GA_DEVSUP_ERROR,
+                     "Too many tiles for the single-pass scan");
+  elsize = gpuarray_get_elsize(sa->r->typecode == GA_HALF ? GA_FLOAT :
+                               sa->r->typecode);
+
+  status = gpudata_alloc(ctx, (ntot + 1) * sizeof(uint32_t), NULL, 0, &err);
+  if (status == NULL)
+    return err;
+  err = gpudata_memset(status, 0, 0);
+  if (err != GA_NO_ERROR)
+    goto out;
+  part = gpudata_alloc(ctx, 2 * ntot * elsize, NULL, 0, &err);
+  if (part == NULL)
+    goto out;
+
+  err = scan_gsize(ctx, ntot, &gs);
+  if (err != GA_NO_ERROR)
+    goto out;
+  args = calloc(SCAN_NARGS(sa->nd), sizeof(void *));
+  if (args == NULL) {
+    err = error_sys(ctx->err, "calloc");
+    goto out;
+  }
+  n = array_params_args(args, sa, &ntiles, &ntot);
+  args[n++] = status;
+  args[n++] = part;
+  err = GpuKernel_call(k, 1, &gs, &ls, 0, args);
+
+out:
+  free(args);
+  if (part != NULL) gpudata_release(part);
+  gpudata_release(status);
+  return err;
+}
+
+static int scan_multipass(gpucontext *ctx, const scan_arrays *sa,
+                          const char *preamble, const char *op,
+                          const char *neutral, int exclusive, int flags,
+                          size_t len, size_t nrows) {
+  GpuKernel kr, kt, ka;
+  gpudata *part = NULL, *pflag = NULL;
+  void **args = NULL;
+  size_t ls = SCAN_LSIZE, tls = SCAN_LSIZE, gs, ntiles, ntot, elsize;
+  unsigned int n;
+  int err;
+
+  kr.k = kt.k = ka.k = NULL;
+  kr.args = kt.args = ka.args = NULL;
+
+  err = gen_reduce_kernel(&kr, ctx, sa, preamble, op, neutral, flags);
+  if (err != GA_NO_ERROR)
+    goto out;
+  err = gen_tiles_kernel(&kt, ctx, sa, preamble, op, neutral, flags);
+  if (err != GA_NO_ERROR)
+    goto out;
+  err = gen_apply_kernel(&ka, ctx, sa, preamble, op, neutral, exclusive,
+                         flags);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  /* The first and last passes must agree on the tiles */
+  err = scan_lsize(&kr, &ls);
+  if (err == GA_NO_ERROR)
+    err = scan_lsize(&ka, &ls);
+  if (err == GA_NO_ERROR)
+    err = scan_lsize(&kt, &tls);
+  if (err != GA_NO_ERROR)
+    goto out;
+  ntiles = (len + ls * SCAN_ITEMS - 1) / (ls * SCAN_ITEMS);
+  ntot = ntiles * nrows;
+  elsize = gpuarray_get_elsize(sa->r->typecode == GA_HALF ? GA_FLOAT :
+                               sa->r->typecode);
+
+  part = gpudata_alloc(ctx, ntot * elsize, NULL, 0, &err);
+  if (part == NULL)
+    goto out;
+  pflag = gpudata_alloc(ctx, ntot, NULL, 0, &err);
+  if (pflag == NULL)
+    goto out;
+  args = calloc(SCAN_NARGS(sa->nd), sizeof(void *));
+  if (args == NULL) {
+    err = error_sys(ctx->err, "calloc");
+    goto out;
+  }
+
+  err = scan_gsize(ctx, ntot, &gs);
+  if (err != GA_NO_ERROR)
+    goto out;
+  n = array_params_args(args, sa, &ntiles, &ntot);
+  args[n++] = part;
+  args[n++] = pflag;
+  err = GpuKernel_call(&kr, 1, &gs, &ls, 0, args);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  err = scan_gsize(ctx, nrows, &gs);
+  if (err != GA_NO_ERROR)
+    goto out;
+  args[0] = part;
+  args[1] = pflag;
+  args[2] = &ntiles;
+  args[3] = &nrows;
+  err = GpuKernel_call(&kt, 1, &gs, &tls, 0, args);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  err = scan_gsize(ctx, ntot, &gs);
+  if (err != GA_NO_ERROR)
+    goto out;
+  n = array_params_args(args, sa, &ntiles, &ntot);
+  args[n++] = part;
+  err = GpuKernel_call(&ka, 1, &gs, &ls, 0, args);
+
+out:
+  free(args);
+  if (part != NULL) gpudata_release(part);
+  if (pflag != NULL) gpudata_release(pflag);
+  GpuKernel_clear(&kr);
+  GpuKernel_clear(&kt);
+  GpuKernel_clear(&ka);
+  return err;
+}
+
+static int check_shape(gpucontext *ctx, const char *name, const GpuArray *x,
+                       const GpuArray *a) {
+  unsigned int i;
+
+  if (x->nd != a->nd)
+    return error_fmt(ctx->err, GA_VALUE_ERROR, "Dimension mismatch. "
+                     "%s->nd = %u, a->nd = %u", name, x->nd, a->nd);
+  for (i = 0; i < a->nd; i++)
+    if (x->dimensions[i] != a->dimensions[i])
+      return error_fmt(ctx->err, GA_VALUE_ERROR, "Dimension mismatch. "
+                       "%s->dimensions[%u] = %llu, a->dimensions[%u] = %llu",
+                       name, i, (unsigned long long)x->dimensions[i],
+                       i, (unsigned long long)a->dimensions[i]);
+  return GA_NO_ERROR;
+}
+
+int GpuArray_scan(GpuArray *r, const GpuArray *a, const GpuArray *seg,
+                  unsigned int axis, const char *preamble, const char *op,
+                  const char *neutral, int flags) {
+  gpucontext *ctx = GpuArray_context(a);
+  scan_arrays sa;
+  GpuArray rv, av, sv;
+  GpuKernel k;
+  unsigned int *axes = NULL;
+  size_t len, nrows;
+  unsigned int i, j;
+  int tflags;
+  int err;
+
+  if (a->nd == 0)
+    return error_set(ctx->err, GA_VALUE_ERROR, "Cannot scan a 0-d array");
+  if (axis >= a->nd)
+    return error_fmt(ctx->err, GA_VALUE_ERROR, "Invalid axis %u for an array "
+                     "of %u dimensions", axis, a->nd);
+  if (op == NULL || neutral == NULL)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "The operator and its neutral element are required");
+  if (!GpuArray_ISWRITEABLE(r))
+    return error_set(ctx->err, GA_VALUE_ERROR, "Output array not writeable");
+  if (!GpuArray_ISALIGNED(r) || !GpuArray_ISALIGNED(a) ||
+      (seg != NULL && !GpuArray_ISALIGNED(seg)))
+    return error_set(ctx->err, GA_UNALIGNED_ERROR, "Arrays are not aligned");
+  err = check_shape(ctx, "r", r, a);
+  if (err == GA_NO_ERROR && seg != NULL)
+    err = check_shape(ctx, "seg", seg, a);
+  if (err != GA_NO_ERROR)
+    return err;
+  if (seg != NULL && !is_seg_type(seg->typecode))
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Segment flags must be of an integer or boolean type");
+
+  len = a->dimensions[axis];
+  nrows = 1;
+  for (i = 0; i < a->nd; i++)
+    if (i != axis)
+      nrows *= a->dimensions[i];
+  if (len == 0 || nrows == 0)
+    return GA_NO_ERROR;
+
+  /* Move the scanned axis last */
+  axes = calloc(a->nd, sizeof(unsigned int));
+  if (axes == NULL)
+    return error_sys(ctx->err, "calloc");
+  for (i = 0, j = 0; i < a->nd; i++)
+    if (i != axis)
+      axes[j++] = i;
+  axes[j] = axis;
+
+  err = GpuArray_transpose(&rv, r, axes);
+  if (err != GA_NO_ERROR)
+    goto out_axes;
+  err = GpuArray_transpose(&av, a, axes);
+  if (err != GA_NO_ERROR)
+    goto out_r;
+  if (seg != NULL) {
+    err = GpuArray_transpose(&sv, seg, axes);
+    if (err != GA_NO_ERROR)
+      goto out_a;
+  }
+  sa.r = &rv;
+  sa.a = &av;
+  sa.s = seg != NULL ? &sv : NULL;
+  sa.nd = a->nd;
+
+  tflags = gpuarray_type_flags(r->typecode, a->typecode,
+                               seg != NULL ? seg->typecode : -1, -1);
+
+  /*
+   * The look-back needs global atomics and the forward progress of the
+   * groups that already took a tile.  Only CUDA guarantees this.
+   */
+  err = gen_lookback_kernel(&k, ctx, &sa, preamble, op, neutral,
+                            flags & GA_SCAN_EXCLUSIVE, tflags | GA_USE_CUDA);
+  if (err == GA_NO_ERROR) {
+    err = scan_lookback(ctx, &k, &sa, len, nrows);
+    GpuKernel_clear(&k);
+  }
+  if (err == GA_DEVSUP_ERROR) {
+    err = scan_multipass(ctx, &sa, preamble, op, neutral,
+                         flags & GA_SCAN_EXCLUSIVE, tflags, len, nrows);
+  }
+
+  if (seg != NULL)
+    GpuArray_clear(&sv);
+out_a:
+  GpuArray_clear(&av);
+out_r:
+  GpuArray_clear(&rv);
+out_axes:
+  free(axes);
+  return err;
+}
@@ -0,0 +1,1233 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "private.h"
+#include "gpuarray/array.h"
+#include "gpuarray/error.h"
+#include "gpuarray/kernel.h"
+#include "gpuarray/util.h"
+
+#include "util/error.h"
+#include "util/strb.h"
+
+/*
+ * All the operations here work on the bit patterns of the elements.
+ * They are first mapped to unsigned keys whose unsigned order is the
+ * order of the values (see gen_key_macros()), with the sorted axis
+ * moved last so that each segment is a contiguous row.  The keys are
+ * then sorted with a least significant digit radix sort or, for
+ * top-k, searched for the k-th key with a most significant digit
+ * radix select.
+ */
+
+/* Number of bits handled by each pass */
+#define RADIX_BITS 4
+#define RADIX (1 << RADIX_BITS)
+
+/* Size of the local buffers in the block kernels */
+#define SORT_LSIZE 256
+
+#define KEY_UNSIGNED 0
+#define KEY_SIGNED   1
+#define KEY_FLOAT    2
+
+typedef struct _sort_key {
+  /* unsigned type holding the bits of an element */
+  const char *raw;
+  int rawtype;
+  /* type of the keys during the passes */
+  const char *work;
+  int worktype;
+  unsigned int bits;
+  int kind;
+} sort_key;
+
+static int sort_key_init(sort_key *sk, int typecode) {
+  switch (typecode) {
+  case GA_BOOL:
+  case GA_UBYTE:
+  case GA_USHORT:
+  case GA_UINT:
+  case GA_ULONG:
+  case GA_SIZE:
+    sk->kind = KEY_UNSIGNED;
+    break;
+  case GA_BYTE:
+  case GA_SHORT:
+  case GA_INT:
+  case GA_LONG:
+  case GA_SSIZE:
+    sk->kind = KEY_SIGNED;
+    break;
+  case GA_HALF:
+  case GA_FLOAT:
+  case GA_DOUBLE:
+    sk->kind = KEY_FLOAT;
+    break;
+  default:
+    return -1;
+  }
+  sk->bits = gpuarray_get_elsize(typecode) * 8;
+  switch (sk->bits) {
+  case 8:
+    sk->raw = "ga_ubyte";
+    sk->rawtype = GA_UBYTE;
+    break;
+  case 16:
+    sk->raw = "ga_ushort";
+    sk->rawtype = GA_USHORT;
+    break;
+  case 32:
+    sk->raw = "ga_uint";
+    sk->rawtype = GA_UINT;
+    break;
+  case 64:
+    sk->raw = "ga_ulong";
+    sk->rawtype = GA_ULONG;
+    break;
+  default:
+    return -1;
+  }
+  if (sk->bits <= 32) {
+    sk->work = "ga_uint";
+    sk->worktype = GA_UINT;
+  } else {
+    sk->work = "ga_ulong";
+    sk->worktype = GA_ULONG;
+  }
+  return 0;
+}
+
+static int is_int_type(int typecode) {
+  switch (typecode) {
+  case GA_BYTE:
+  case GA_UBYTE:
+  case GA_SHORT:
+  case GA_USHORT:
+  case GA_INT:
+  case GA_UINT:
+  case GA_LONG:
+  case GA_ULONG:
+  case GA_SIZE:
+  case GA_SSIZE:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static uint64_t key_mask(unsigned int bits) {
+  return bits >= 64 ? ~(uint64_t)0 : (((uint64_t)1) << bits) - 1;
+}
+
+/*
+ * Define TO_KEY(u) and FROM_KEY(k) to go between the bits of an
+ * element (in the work type) and its key.
+ *
+ * Signed integers get their sign bit flipped.  Positive floats get
+ * their sign bit set and negative ones have all their bits flipped.
+ * NaNs are all mapped to the largest key so they end up last like in
+ * numpy.  Descending order flips all the bits of the key.
+ */
+static void gen_key_macros(strb *sb, const sort_key *sk, int descending) {
+  uint64_t m = key_mask(sk->bits);
+  uint64_t s = ((uint64_t)1) << (sk->bits - 1);
+  uint64_t e;
+
+  strb_appendf(sb, "#define KEY_M ((%s)0x%llx)\n"
+               "#define KEY_S ((%s)0x%llx)\n",
+               sk->work, (unsigned long long)m,
+               sk->work, (unsigned long long)s);
+  switch (sk->kind) {
+  case KEY_UNSIGNED:
+    strb_appends(sb, "#define KEY_ORD(u) (u)\n"
+                 "#define KEY_UNORD(k) (k)\n");
+    break;
+  case KEY_SIGNED:
+    strb_appends(sb, "#define KEY_ORD(u) ((u) ^ KEY_S)\n"
+                 "#define KEY_UNORD(k) ((k) ^ KEY_S)\n");
+    break;
+  case KEY_FLOAT:
+    /* exponent bits */
+    if (sk->bits == 16)
+      e = 0x7C00;
+    else if (sk->bits == 32)
+      e = 0x7F800000;
+    else
+      e = ((uint64_t)0x7FF) << 52;
+    strb_appendf(sb, "#define KEY_E ((%s)0x%llx)\n"
+                 "#define KEY_ORD(u) ((((u) & ~KEY_S) > KEY_E) ? KEY_M : "
+                 "(((u) & KEY_S) ? (~(u) & KEY_M) : ((u) | KEY_S)))\n"
+                 "#define KEY_UNORD(k) (((k) & KEY_S) ? ((k) ^ KEY_S) : "
+                 "(~(k) & KEY_M))\n", sk->work, (unsigned long long)e);
+    break;
+  }
+  if (descending)
+    strb_appends(sb, "#define TO_KEY(u) (~KEY_ORD(u) & KEY_M)\n"
+                 "#define FROM_KEY(k) KEY_UNORD(~(k) & KEY_M)\n");
+  else
+    strb_appends(sb, "#define TO_KEY(u) KEY_ORD(u)\n"
+                 "#define FROM_KEY(k) KEY_UNORD(k)\n");
+}
+
+static int sort_kernel_init(GpuKernel *k, gpucontext *ctx, strb *sb,
+                            const char *name, unsigned int nargs,
+                            const int *types, int flags) {
+#if DEBUG
+  char *errstr = NULL;
+#endif
+  int err;
+
+  if (strb_error(sb)) {
+    strb_clear(sb);
+    return error_set(ctx->err, GA_MEMORY_ERROR, "Out of memory");
+  }
+  err = GpuKernel_init(k, ctx, 1, (const char **)&sb->s, &sb->l, name,
+                       nargs, types, flags,
+#if DEBUG
+                       &errstr
+#else
+                       NULL
+#endif
+                       );
+#if DEBUG
+  if (errstr != NULL) {
+    fprintf(stderr, "%s\n", errstr);
+    free(errstr);
+  }
+#endif
+  strb_clear(sb);
+  return err;
+}
+
+/* Group size for the kernels that use local buffers */
+static int block_lsize(GpuKernel *k, size_t *ls) {
+  int err;
+
+  err = gpukernel_property(k->k, GA_KERNEL_PROP_MAXLSIZE, ls);
+  if (err != GA_NO_ERROR)
+    return err;
+  if (*ls > SORT_LSIZE)
+    *ls = SORT_LSIZE;
+  return GA_NO_ERROR;
+}
+
+/* Number of groups for `n` blocks, the kernels loop over the rest */
+static int block_gsize(gpucontext *ctx, size_t n, size_t *gs) {
+  size_t m;
+  int err;
+
+  err = gpucontext_property(ctx, GA_CTX_PROP_MAXGSIZE0, &m);
+  if (err != GA_NO_ERROR)
+    return err;
+  *gs = n < m ? n : m;
+  return GA_NO_ERROR;
+}
+
+static int call_flat(GpuKernel *k, size_t n, void **args) {
+  size_t gs = 0, ls = 0;
+  int err;
+
+  err = GpuKernel_sched(k, n, &gs, &ls);
+  if (err == GA_NO_ERROR)
+    err = GpuKernel_call(k, 1, &gs, &ls, 0, args);
+  return err;
+}
+
+static const int sort_keys_types[6] = {GA_BUFFER, GA_SIZE, GA_SIZE, GA_SIZE,
+                                       GA_BUFFER, GA_BUFFER};
+
+static int gen_keys_kernel(GpuKernel *k, gpucontext *ctx, const sort_key *sk,
+                           int descending) {
+  strb sb = STRB_STATIC_INIT;
+
+  strb_appends(&sb, "#include \"cluda.h\"\n");
+  gen_key_macros(&sb, sk, descending);
+  strb_appendf(&sb, "KERNEL void sort_keys(GLOBAL_MEM const %s *a, "
+               "ga_size a_off, ga_size n, ga_size len, "
+               "GLOBAL_MEM %s *keys, GLOBAL_MEM ga_uint *perm) {\n"
+               "  ga_size i;\n"
+               "  %s u;\n"
+               "  a = (GLOBAL_MEM const %s *)(((GLOBAL_MEM const char *)a) + a_off);\n"
+               "  for (i = LDIM_0 * GID_0 + LID_0; i < n; i += LDIM_0 * GDIM_0) {\n"
+               "    u = (%s)a[i];\n"
+               "    keys[i] = TO_KEY(u);\n"
+               "    perm[i] = (ga_uint)(i %% len);\n"
+               "  }\n"
+               "}\n", sk->raw, sk->work, sk->work, sk->raw, sk->work);
+  return sort_kernel_init(k, ctx, &sb, "sort_keys", 6, sort_keys_types,
+                          gpuarray_type_flags(sk->rawtype, GA_UINT, -1));
+}
+
+static const int radix_hist_types[6] = {GA_BUFFER, GA_SIZE, GA_SIZE, GA_SIZE,
+                                        GA_UINT, GA_BUFFER};
+
+/*
+ * Count the digits of each block of LDIM_0 keys.  The counts are laid
+ * out as [segment][digit][block] so that an exclusive scan over each
+ * segment gives the destination of the first key of each digit and
+ * block.  The `ng` (segment, block) pairs are spread over the groups.
+ */
+static int gen_hist_kernel(GpuKernel *k, gpucontext *ctx, const sort_key *sk) {
+  strb sb = STRB_STATIC_INIT;
+
+  strb_appendf(&sb, "#include \"cluda.h\"\n"
+               "KERNEL void radix_hist(GLOBAL_MEM const %s *keys, ga_size len, "
+               "ga_size nblk, ga_size ng, ga_uint shift, "
+               "GLOBAL_MEM ga_uint *counts) {\n"
+               "  LOCAL_MEM ga_uint hist[%u];\n"
+               "  ga_size g, seg, blk, i, j;\n"
+               "  for (g = GID_0; g < ng; g += GDIM_0) {\n"
+               "    seg = g / nblk;\n"
+               "    blk = g %% nblk;\n"
+               "    i = blk * LDIM_0 + LID_0;\n"
+               "    for (j = LID_0; j < %u; j += LDIM_0)\n"
+               "      hist[j] = 0;\n"
+               "    local_barrier();\n"
+               "    if (i < len)\n"
+               "      atom_add_Il(&hist[(keys[seg * len + i] >> shift) & %u], 1);\n"
+               "    local_barrier();\n"
+               "    for (j = LID_0; j < %u; j += LDIM_0)\n"
+               "      counts[(seg * %u + j) * nblk + blk] = hist[j];\n"
+               "    local_barrier();\n"
+               "  }\n"
+               "}\n", sk->work, RADIX, RADIX, RADIX - 1, RADIX, RADIX);
+  return sort_kernel_init(k, ctx, &sb, "radix_hist", 6, radix_hist_types,
+                          gpuarray_type_flags(sk->worktype, -1));
+}
+
+static const int radix_scan_types[3] = {GA_BUFFER, GA_SIZE, GA_SIZE};
+
+/*
+ * Exclusive scan of the `m` counts of each of the `nseg` segments,
+ * one group at a time per segment.
+ */
+static int gen_scan_kernel(GpuKernel *k, gpucontext *ctx) {
+  strb sb = STRB_STATIC_INIT;
+
+  strb_appendf(&sb, "#include \"cluda.h\"\n"
+               "KERNEL void radix_scan(GLOBAL_MEM ga_uint *counts, ga_size m, "
+               "ga_size nseg) {\n"
+               "  LOCAL_MEM ga_uint part[%u];\n"
+               "  GLOBAL_MEM ga_uint *c;\n"
+               "  const ga_size chunk = (m + LDIM_0 - 1) / LDIM_0;\n"
+               "  const ga_size b = LID_0 * chunk;\n"
+               "  ga_size g, i, e, off;\n"
+               "  ga_uint s, t;\n"
+               "  e = b + chunk;\n"
+               "  if (e > m) e = m;\n"
+               "  for (g = GID_0; g < nseg; g += GDIM_0) {\n"
+               "    c = counts + g * m;\n"
+               "    s = 0;\n"
+               "    for (i = b; i < e; i++)\n"
+               "      s += c[i];\n"
+               "    part[LID_0] = s;\n"
+               "    local_barrier();\n"
+               "    for (off = 1; off < LDIM_0; off <<= 1) {\n"
+               "      t = (LID_0 >= off) ? part[LID_0 - off] : 0;\n"
+               "      local_barrier();\n"
+               "      part[LID_0] += t;\n"
+               "      local_barrier();\n"
+               "    }\n"
+               "    t = part[LID_0] - s;\n"
+               "    for (i = b; i < e; i++) {\n"
+               "      s = c[i];\n"
+               "      c[i] = t;\n"
+               "      t += s;\n"
+               "    }\n"
+               "    local_barrier();\n"
+               "  }\n"
+               "}\n", SORT_LSIZE);
+  return sort_kernel_init(k, ctx, &sb, "radix_scan", 3, radix_scan_types,
+                          0);
+}
+
+static const int radix_scatter_types[9] = {GA_BUFFER, GA_BUFFER, GA_BUFFER,
+                                           GA_BUFFER, GA_SIZE, GA_SIZE,
+                                           GA_SIZE, GA_UINT, GA_BUFFER};
+
+/*
+ * Move each key (and its payload) to its place for this pass.  The
+ * rank of a key in its block is the number of keys before it with the
+ * same digit, which keeps the sort stable.  It comes from an exclusive
+ * scan of one flag per digit and thread, laid out as [digit][thread]:
+ * the scanned flag of a key minus the scanned flag of thread 0 for the
+ * same digit counts the keys with that digit before it.  Each thread
+ * sums RADIX consecutive flags and the partial sums are scanned like
+ * in radix_scan.
+ */
+static int gen_scatter_kernel(GpuKernel *k, gpucontext *ctx,
+                              const sort_key *sk) {
+  strb sb = STRB_STATIC_INIT;
+
+  strb_appendf(&sb, "#include \"cluda.h\"\n"
+               "KERNEL void radix_scatter(GLOBAL_MEM const %s *kin, "
+               "GLOBAL_MEM const ga_uint *pin, GLOBAL_MEM %s *kout, "
+               "GLOBAL_MEM ga_uint *pout, ga_size len, ga_size nblk, "
+               "ga_size ng, ga_uint shift, GLOBAL_MEM const ga_uint *counts) {\n"
+               "  LOCAL_MEM ga_uint flag[%u];\n"
+               "  LOCAL_MEM ga_uint part[%u];\n"
+               "  ga_size g, seg, blk, i, j;\n"
+               "  %s k;\n"
+               "  ga_uint d, s, t, r;\n"
+               "  for (g = GID_0; g < ng; g += GDIM_0) {\n"
+               "    seg = g / nblk;\n"
+               "    blk = g %% nblk;\n"
+               "    i = blk * LDIM_0 + LID_0;\n"
+               "    k = 0;\n"
+               "    d = 0;\n"
+               "    for (j = 0; j < %u; j++)\n"
+               "      flag[j * LDIM_0 + LID_0] = 0;\n"
+               "    if (i < len) {\n"
+               "      k = kin[seg * len + i];\n"
+               "      d = (ga_uint)(k >> shift) & %u;\n"
+               "      flag[d * LDIM_0 + LID_0] = 1;\n"
+               "    }\n"
+               "    local_barrier();\n"
+               "    s = 0;\n"
+               "    for (j = 0; j < %u; j++)\n"
+               "      s += flag[LID_0 * %u + j];\n"
+               "    part[LID_0] = s;\n"
+               "    local_barrier();\n"
+               "    for (j = 1; j < LDIM_0; j <<= 1) {\n"
+               "      t = (LID_0 >= j) ? part[LID_0 - j] : 0;\n"
+               "      local_barrier();\n"
+               "      part[LID_0] += t;\n"
+               "      local_barrier();\n"
+               "    }\n"
+               "    t = part[LID_0] - s;\n"
+               "    for (j = 0; j < %u; j++) {\n"
+               "      s = flag[LID_0 * %u + j];\n"
+               "      flag[LID_0 * %u + j] = t;\n"
+               "      t += s;\n"
+               "    }\n"
+               "    local_barrier();\n"
+               "    if (i < len) {\n"
+               "      r = flag[d * LDIM_0 + LID_0] - flag[d * LDIM_0];\n"
+               "      j = seg * len + counts[(seg * %u + d) * nblk + blk] + r;\n"
+               "      kout[j] = k;\n"
+               "      pout[j] = pin[seg * len + i];\n"
+               "    }\n"
+               "    local_barrier();\n"
+               "  }\n"
+               "}\n", sk->work, sk->work, RADIX * SORT_LSIZE, SORT_LSIZE,
+               sk->work, RADIX, RADIX - 1, RADIX, RADIX, RADIX, RADIX, RADIX,
+               RADIX);
+  return sort_kernel_init(k, ctx, &sb, "radix_scatter", 9,
+                          radix_scatter_types,
+                          gpuarray_type_flags(sk->worktype, -1));
+}
+
+/*
+ * Sort the `nseg` rows of `len` keys in `keys[0]` along with their
+ * payload in `perm[0]`.  `keys[1]` and `perm[1]` are used as
+ * scratch.  Since every key size is a multiple of 2 * RADIX_BITS, the
+ * result ends up back in `keys[0]` and `perm[0]`.
+ */
+static int radix_sort(gpucontext *ctx, const sort_key *sk, gpudata **keys,
+                      gpudata **perm, size_t nseg, size_t len) {
+  GpuKernel kh, ks, kx;
+  gpudata *counts = NULL;
+  void *args[9];
+  size_t ls, sls, nblk, ng, gs, sgs, m;
+  unsigned int shift, src;
+  int err;
+
+  kh.k = ks.k = kx.k = NULL;
+  kh.args = ks.args = kx.args = NULL;
+
+  err = gen_hist_kernel(&kh, ctx, sk);
+  if (err != GA_NO_ERROR)
+    goto out;
+  err = gen_scan_kernel(&ks, ctx);
+  if (err != GA_NO_ERROR)
+    goto out;
+  err = gen_scatter_kernel(&kx, ctx, sk);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  /* The histogram and scatter passes must agree on the block size */
+  err = block_lsize(&kh, &ls);
+  if (err != GA_NO_ERROR)
+    goto out;
+  err = block_lsize(&kx, &m);
+  if (err != GA_NO_ERROR)
+    goto out;
+  if (m < ls)
+    ls = m;
+  err = block_lsize(&ks, &sls);
+  if (err != GA_NO_ERROR)
+    goto out;
+  nblk = (len + ls - 1) / ls;
+  ng = nseg * nblk;
+  m = RADIX * nblk;
+  err = block_gsize(ctx, ng, &gs);
+  if (err == GA_NO_ERROR)
+    err = block_gsize(ctx, nseg, &sgs);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  counts = gpudata_alloc(ctx, nseg * m * sizeof(uint32_t), NULL, 0, &err);
+  if (counts == NULL)
+    goto out;
+
+  assert(sk->bits % (2 * RADIX_BITS) == 0);
+  src = 0;
+  for (shift = 0; shift < sk->bits; shift += RADIX_BITS) {
+    args[0] = keys[src];
+    args[1] = &len;
+    args[2] = &nblk;
+    args[3] = &ng;
+    args[4] = &shift;
+    args[5] = counts;
+    err = GpuKernel_call(&kh, 1, &gs, &ls, 0, args);
+    if (err != GA_NO_ERROR)
+      goto out;
+
+    args[0] = counts;
+    args[1] = &m;
+    args[2] = &nseg;
+    err = GpuKernel_call(&ks, 1, &sgs, &sls, 0, args);
+    if (err != GA_NO_ERROR)
+      goto out;
+
+    args[0] = keys[src];
+    args[1] = perm[src];
+    args[2] = keys[1 - src];
+    args[3] = perm[1 - src];
+    args[4] = &len;
+    args[5] = &nblk;
+    args[6] = &ng;
+    args[7] = &shift;
+    args[8] = counts;
+    err = GpuKernel_call(&kx, 1, &gs, &ls, 0, args);
+    if (err != GA_NO_ERROR)
+      goto out;
+    src = 1 - src;
+  }
+  assert(src == 0);
+
+out:
+  if (counts != NULL) gpudata_release(counts);
+  if (kh.k != NULL) GpuKernel_clear(&kh);
+  if (ks.k != NULL) GpuKernel_clear(&ks);
+  if (kx.k != NULL) GpuKernel_clear(&kx);
+  return err;
+}
+
+static const int topk_select_types[6] = {GA_BUFFER, GA_BUFFER, GA_BUFFER,
+                                         GA_UINT, GA_SIZE, GA_SIZE};
+
+static const int topk_gather_types[9] = {GA_BUFFER, GA_SIZE, GA_SIZE, GA_SIZE,
+                                         GA_BUFFER, GA_BUFFER, GA_BUFFER,
+                                         GA_BUFFER, GA_BUFFER};
+
+/*
+ * Kernels for the radix select.  `prefix` holds the digits of the
+ * k-th smallest key of each segment found so far and `below` the
+ * number of keys known to be smaller.  topk_hist counts the digits of
+ * the keys that match the prefix on the bits above `shift` (selected
+ * by `hmask`) and topk_select picks the digit that contains the k-th
+ * key.
+ */
+static int gen_topk_kernels(GpuKernel *kh, GpuKernel *ks, GpuKernel *kg,
+                            gpucontext *ctx, const sort_key *sk) {
+  strb sb = STRB_STATIC_INIT;
+  int types[8];
+  int flags = gpuarray_type_flags(sk->worktype, -1);
+  int err;
+
+  strb_appendf(&sb, "#include \"cluda.h\"\n"
+               "KERNEL void topk_hist(GLOBAL_MEM const %s *keys, ga_size len, "
+               "ga_size nblk, ga_size ng, ga_uint shift, %s hmask, "
+               "GLOBAL_MEM const %s *prefix, GLOBAL_MEM ga_uint *hist) {\n"
+               "  LOCAL_MEM ga_uint lh[%u];\n"
+               "  ga_size g, seg, i, j;\n"
+               "  %s k;\n"
+               "  for (g = GID_0; g < ng; g += GDIM_0) {\n"
+               "    seg = g / nblk;\n"
+               "    i = (g %% nblk) * LDIM_0 + LID_0;\n"
+               "    for (j = LID_0; j < %u; j += LDIM_0)\n"
+               "      lh[j] = 0;\n"
+               "    local_barrier();\n"
+               "    if (i < len) {\n"
+               "      k = keys[seg * len + i];\n"
+               "      if (((k ^ prefix[seg]) & hmask) == 0)\n"
+               "        atom_add_Il(&lh[(k >> shift) & %u], 1);\n"
+               "    }\n"
+               "    local_barrier();\n"
+               "    for (j = LID_0; j < %u; j += LDIM_0)\n"
+               "      if (lh[j] != 0)\n"
+               "        atom_add_Ig(&hist[seg * %u + j], lh[j]);\n"
+               "    local_barrier();\n"
+               "  }\n"
+               "}\n", sk->work, sk->work, sk->work, RADIX, sk->work, RADIX,
+               RADIX - 1, RADIX, RADIX);
+  types[0] = GA_BUFFER;
+  types[1] = GA_SIZE;
+  types[2] = GA_SIZE;
+  types[3] = GA_SIZE;
+  types[4] = GA_UINT;
+  types[5] = sk->worktype;
+  types[6] = GA_BUFFER;
+  types[7] = GA_BUFFER;
+  err = sort_kernel_init(kh, ctx, &sb, "topk_hist", 8, types, flags);
+  if (err != GA_NO_ERROR)
+    return err;
+
+  strb_appendf(&sb, "#include \"cluda.h\"\n"
+               "KERNEL void topk_select(GLOBAL_MEM %s *prefix, "
+               "GLOBAL_MEM ga_uint *below, GLOBAL_MEM ga_uint *hist, "
+               "ga_uint shift, ga_size nseg, ga_size k) {\n"
+               "  GLOBAL_MEM ga_uint *h;\n"
+               "  ga_size s, c;\n"
+               "  ga_uint d;\n"
+               "  for (s = LDIM_0 * GID_0 + LID_0; s < nseg; s += LDIM_0 * GDIM_0) {\n"
+               "    h = hist + s * %u;\n"
+               "    c = below[s];\n"
+               "    for (d = 0; d < %u; d++) {\n"
+               "      if (c + h[d] >= k) break;\n"
+               "      c += h[d];\n"
+               "    }\n"
+               "    prefix[s] |= ((%s)d) << shift;\n"
+               "    below[s] = (ga_uint)c;\n"
+               "    for (d = 0; d < %u; d++)\n"
+               "      h[d] = 0;\n"
+               "  }\n"
+               "}\n", sk->work, RADIX, RADIX - 1, sk->work, RADIX);
+  err = sort_kernel_init(ks, ctx, &sb, "topk_select", 6, topk_select_types,
+                         flags);
+  if (err != GA_NO_ERROR)
+    return err;
+
+  /* Ties with the k-th key are taken in an unspecified order */
+  strb_appendf(&sb, "#include \"cluda.h\"\n"
+               "KERNEL void topk_gather(GLOBAL_MEM const %s *keys, ga_size n, "
+               "ga_size len, ga_size k, GLOBAL_MEM const %s *prefix, "
+               "GLOBAL_MEM const ga_uint *below, GLOBAL_MEM ga_uint *cnt, "
+               "GLOBAL_MEM %s *outk, GLOBAL_MEM ga_uint *outp) {\n"
+               "  ga_size i, seg;\n"
+               "  ga_uint slot;\n"
+               "  %s key, t;\n"
+               "  for (i = LDIM_0 * GID_0 + LID_0; i < n; i += LDIM_0 * GDIM_0) {\n"
+               "    seg = i / len;\n"
+               "    key = keys[i];\n"
+               "    t = prefix[seg];\n"
+               "    if (key < t) {\n"
+               "      slot = atom_add_Ig(&cnt[2 * seg], 1);\n"
+               "    } else if (key == t) {\n"
+               "      slot = atom_add_Ig(&cnt[2 * seg + 1], 1);\n"
+               "      if (slot >= k - below[seg]) continue;\n"
+               "      slot += below[seg];\n"
+               "    } else {\n"
+               "      continue;\n"
+               "    }\n"
+               "    outk[seg * k + slot] = key;\n"
+               "    outp[seg * k + slot] = (ga_uint)(i - seg * len);\n"
+               "  }\n"
+               "}\n", sk->work, sk->work, sk->work, sk->work);
+  return sort_kernel_init(kg, ctx, &sb, "topk_gather", 9, topk_gather_types,
+                          flags);
+}
+
+/*
+ * Find the `k` smallest keys of each of the `nseg` rows of `len` keys
+ * and store them, unordered, in rows of `k` in `outk` with their
+ * position in `outp`.
+ */
+static int radix_select(gpucontext *ctx, const sort_key *sk, gpudata *keys,
+                        size_t nseg, size_t len, size_t k,
+                        gpudata *outk, gpudata *outp) {
+  GpuKernel kh, ks, kg;
+  gpudata *prefix = NULL, *below = NULL, *hist = NULL, *cnt = NULL;
+  void *args[9];
+  size_t ls, nblk, ng, gs, n = nseg * len;
+  uint64_t hm;
+  uint32_t hm32;
+  unsigned int shift;
+  int err;
+
+  kh.k = ks.k = kg.k = NULL;
+  kh.args = ks.args = kg.args = NULL;
+
+  err = gen_topk_kernels(&kh, &ks, &kg, ctx, sk);
+  if (err != GA_NO_ERROR)
+    goto out;
+  err = block_lsize(&kh, &ls);
+  if (err != GA_NO_ERROR)
+    goto out;
+  nblk = (len + ls - 1) / ls;
+  ng = nseg * nblk;
+  err = block_gsize(ctx, ng, &gs);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  prefix = gpudata_alloc(ctx, nseg * (sk->bits <= 32 ? 4 : 8), NULL, 0, &err);
+  if (prefix == NULL)
+    goto out;
+  below = gpudata_alloc(ctx, nseg * sizeof(uint32_t), NULL, 0, &err);
+  if (below == NULL)
+    goto out;
+  hist = gpudata_alloc(ctx, nseg * RADIX * sizeof(uint32_t), NULL, 0, &err);
+  if (hist == NULL)
+    goto out;
+  cnt = gpudata_alloc(ctx, 2 * nseg * sizeof(uint32_t), NULL, 0, &err);
+  if (cnt == NULL)
+    goto out;
+  err = gpudata_memset(prefix, 0, 0);
+  if (err == GA_NO_ERROR)
+    err = gpudata_memset(below, 0, 0);
+  if (err == GA_NO_ERROR)
+    err = gpudata_memset(hist, 0, 0);
+  if (err == GA_NO_ERROR)
+    err = gpudata_memset(cnt, 0, 0);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  for (shift = sk->bits; shift > 0;) {
+    shift -= RADIX_BITS;
+    hm = key_mask(sk->bits) & ~key_mask(shift + RADIX_BITS);
+    hm32 = (uint32_t)hm;
+    args[0] = keys;
+    args[1] = &len;
+    args[2] = &nblk;
+    args[3] = &ng;
+    args[4] = &shift;
+    args[5] = sk->worktype == GA_UINT ? (void *)&hm32 : (void *)&hm;
+    args[6] = prefix;
+    args[7] = hist;
+    err = GpuKernel_call(&kh, 1, &gs, &ls, 0, args);
+    if (err != GA_NO_ERROR)
+      goto out;
+
+    args[0] = prefix;
+    args[1] = below;
+    args[2] = hist;
+    args[3] = &shift;
+    args[4] = &nseg;
+    args[5] = &k;
+    err = call_flat(&ks, nseg, args);
+    if (err != GA_NO_ERROR)
+      goto out;
+  }
+
+  args[0] = keys;
+  args[1] = &n;
+  args[2] = &len;
+  args[3] = &k;
+  args[4] = prefix;
+  args[5] = below;
+  args[6] = cnt;
+  args[7] = outk;
+  args[8] = outp;
+  err = call_flat(&kg, n, args);
+
+out:
+  if (prefix != NULL) gpudata_release(prefix);
+  if (below != NULL) gpudata_release(below);
+  if (hist != NULL) gpudata_release(hist);
+  if (cnt != NULL) gpudata_release(cnt);
+  if (kh.k != NULL) GpuKernel_clear(&kh);
+  if (ks.k != NULL) GpuKernel_clear(&ks);
+  if (kg.k != NULL) GpuKernel_clear(&kg);
+  return err;
+}
+
+/*
+ * Write the results for rows of `m` sorted keys taken from rows of
+ * `len` elements.  Any of the outputs (and `v` with `rv`) can be
+ * NULL.  They must be C-contiguous.
+ */
+static int sort_finish(gpucontext *ctx, const sort_key *sk, int descending,
+                       gpudata *keys, gpudata *perm, size_t nseg, size_t m,
+                       size_t len, GpuArray *r, GpuArray *ri,
+                       const GpuArray *v, GpuArray *rv) {
+  strb sb = STRB_STATIC_INIT;
+  GpuKernel k;
+  void *args[11];
+  int types[11];
+  size_t n = nseg * m;
+  unsigned int nargs = 0;
+  int flags = gpuarray_type_flags(sk->rawtype, sk->worktype, -1);
+  int err;
+
+  strb_appends(&sb, "#include \"cluda.h\"\n");
+  gen_key_macros(&sb, sk, descending);
+  strb_appendf(&sb, "KERNEL void sort_finish(GLOBAL_MEM const %s *keys, "
+               "GLOBAL_MEM const ga_uint *perm, ga_size n, ga_size m, "
+               "ga_size len", sk->work);
+  args[nargs] = keys;
+  types[nargs++] = GA_BUFFER;
+  args[nargs] = perm;
+  types[nargs++] = GA_BUFFER;
+  args[nargs] = &n;
+  types[nargs++] = GA_SIZE;
+  args[nargs] = &m;
+  types[nargs++] = GA_SIZE;
+  args[nargs] = &len;
+  types[nargs++] = GA_SIZE;
+  if (r != NULL) {
+    strb_appendf(&sb, ", GLOBAL_MEM %s *r, ga_size r_off", sk->raw);
+    args[nargs] = r->data;
+    types[nargs++] = GA_BUFFER;
+    args[nargs] = &r->offset;
+    types[nargs++] = GA_SIZE;
+  }
+  if (ri != NULL) {
+    strb_appendf(&sb, ", GLOBAL_MEM %s *ri, ga_size ri_off",
+                 gpuarray_get_type(ri->typecode)->cluda_name);
+    args[nargs] = ri->data;
+    types[nargs++] = GA_BUFFER;
+    args[nargs] = &ri->offset;
+    types[nargs++] = GA_SIZE;
+    flags |= gpuarray_type_flags(ri->typecode, -1);
+  }
+  if (rv != NULL) {
+    strb_appendf(&sb, ", GLOBAL_MEM const %s *v, ga_size v_off, "
+                 "GLOBAL_MEM %s *rv, ga_size rv_off",
+                 gpuarray_get_type(v->typecode)->cluda_name,
+                 gpuarray_get_type(rv->typecode)->cluda_name);
+    args[nargs] = v->data;
+    types[nargs++] = GA_BUFFER;
+    args[nargs] = (void *)&v->offset;
+    types[nargs++] = GA_SIZE;
+    args[nargs] = rv->data;
+    types[nargs++] = GA_BUFFER;
+    args[nargs] = &rv->offset;
+    types[nargs++] = GA_SIZE;
+    flags |= gpuarray_type_flags(v->typecode, -1);
+  }
+  strb_appendf(&sb, ") {\n"
+               "  ga_size i;\n"
+               "  %s k;\n", sk->work);
+  if (r != NULL)
+    strb_appendf(&sb, "  r = (GLOBAL_MEM %s *)(((GLOBAL_MEM char *)r) + r_off);\n",
+                 sk->raw);
+  if (ri != NULL)
+    strb_appendf(&sb, "  ri = (GLOBAL_MEM %s *)(((GLOBAL_MEM char *)ri) + ri_off);\n",
+                 gpuarray_get_type(ri->typecode)->cluda_name);
+  if (rv != NULL)
+    strb_appendf(&sb, "  v = (GLOBAL_MEM const %s *)(((GLOBAL_MEM const char *)v) + v_off);\n"
+                 "  rv = (GLOBAL_MEM %s *)(((GLOBAL_MEM char *)rv) + rv_off);\n",
+                 gpuarray_get_type(v->typecode)->cluda_name,
+                 gpuarray_get_type(rv->typecode)->cluda_name);
+  strb_appends(&sb, "  for (i = LDIM_0 * GID_0 + LID_0; i < n; i += LDIM_0 * GDIM_0) {\n"
+               "    k = keys[i];\n");
+  if (r != NULL)
+    strb_appendf(&sb, "    r[i] = (%s)FROM_KEY(k);\n", sk->raw);
+  if (ri != NULL)
+    strb_appendf(&sb, "    ri[i] = (%s)perm[i];\n",
+                 gpuarray_get_type(ri->typecode)->cluda_name);
+  if (rv != NULL)
+    strb_appends(&sb, "    rv[i] = v[(i / m) * len + perm[i]];\n");
+  strb_appends(&sb, "  }\n"
+               "}\n");
+
+  err = sort_kernel_init(&k, ctx, &sb, "sort_finish", nargs, types, flags);
+  if (err != GA_NO_ERROR)
+    return err;
+  err = call_flat(&k, n, args);
+  GpuKernel_clear(&k);
+  return err;
+}
+
+/*
+ * Get a C-contiguous version of `a` with the axes in the order of
+ * `axes` (or unchanged if NULL).  This is a view if possible.
+ */
+static int sort_input(GpuArray *res, const GpuArray *a,
+                      const unsigned int *axes) {
+  GpuArray t;
+  int err;
+
+  if (axes == NULL)
+    err = GpuArray_view(&t, a);
+  else
+    err = GpuArray_transpose(&t, a, axes);
+  if (err != GA_NO_ERROR)
+    return err;
+  if (GpuArray_IS_C_CONTIGUOUS(&t)) {
+    memcpy(res, &t, sizeof(GpuArray));
+    return GA_NO_ERROR;
+  }
+  err = GpuArray_copy(res, &t, GA_C_ORDER);
+  GpuArray_clear(&t);
+  return err;
+}
+
+/*
+ * An output of the kernels.  They write to `dst` which is either a
+ * C-contiguous `view` of the output with the axes reordered or a
+ * temporary that gets copied to `view` by sort_output_end().
+ */
+typedef struct _sort_output {
+  GpuArray view;
+  GpuArray tmp;
+  GpuArray *dst;
+} sort_output;
+
+static int sort_output_begin(sort_output *o, GpuArray *x,
+                             const unsigned int *axes) {
+  int err;
+
+  o->dst = NULL;
+  if (x == NULL)
+    return GA_NO_ERROR;
+  if (axes == NULL)
+    err = GpuArray_view(&o->view, x);
+  else
+    err = GpuArray_transpose(&o->view, x, axes);
+  if (err != GA_NO_ERROR)
+    return err;
+  if (GpuArray_IS_C_CONTIGUOUS(&o->view)) {
+    o->dst = &o->view;
+    return GA_NO_ERROR;
+  }
+  err = GpuArray_empty(&o->tmp, GpuArray_context(x), x->typecode,
+                       o->view.nd, o->view.dimensions, GA_C_ORDER);
+  if (err != GA_NO_ERROR) {
+    GpuArray_clear(&o->view);
+    return err;
+  }
+  o->dst = &o->tmp;
+  return GA_NO_ERROR;
+}
+
+static int sort_output_end(sort_output *o, int err) {
+  if (o->dst == NULL)
+    return err;
+  if (o->dst == &o->tmp) {
+    if (err == GA_NO_ERROR)
+      err = GpuArray_setarray(&o->view, &o->tmp);
+    GpuArray_clear(&o->tmp);
+  }
+  GpuArray_clear(&o->view);
+  o->dst = NULL;
+  return err;
+}
+
+static int check_output(gpucontext *ctx, const char *name, const GpuArray *r,
+                        const GpuArray *a, unsigned int axis, size_t m) {
+  unsigned int i;
+
+  if (r == NULL)
+    return GA_NO_ERROR;
+  if (!GpuArray_ISWRITEABLE(r))
+    return error_fmt(ctx->err, GA_VALUE_ERROR, "Output array (%s) not writeable",
+                     name);
+  if (!GpuArray_ISALIGNED(r))
+    return error_fmt(ctx->err, GA_UNALIGNED_ERROR,
+                     "Output array (%s) not aligned", name);
+  if (r->nd != a->nd)
+    return error_fmt(ctx->err, GA_VALUE_ERROR, "Dimension mismatch. "
+                     "%s->nd = %u, a->nd = %u", name, r->nd, a->nd);
+  for (i = 0; i < a->nd; i++) {
+    if (r->dimensions[i] != (i == axis ? m : a->dimensions[i]))
+      return error_fmt(ctx->err, GA_VALUE_ERROR, "Dimension mismatch. "
+                       "%s->dimensions[%u] = %llu, expected %llu", name, i,
+                       (unsigned long long)r->dimensions[i],
+                       (unsigned long long)(i == axis ? m : a->dimensions[i]));
+  }
+  return GA_NO_ERROR;
+}
+
+/*
+ * Sort `a` along `axis` and write the sorted keys to `rk`, the
+ * original positions to `ri` and the matching values of `v` to `rv`.
+ * If `topk` is not 0, only the first `topk` elements of each sorted
+ * row are computed.
+ */
+static int sort_common(GpuArray *rk, GpuArray *ri, GpuArray *rv,
+                       const GpuArray *a, const GpuArray *v,
+                       unsigned int axis, int descending, size_t topk) {
+  gpucontext *ctx = GpuArray_context(a);
+  sort_key sk;
+  GpuArray ac, vc;
+  sort_output ok, oi, ov;
+  gpudata *keys[2] = {NULL, NULL};
+  gpudata *perm[2] = {NULL, NULL};
+  unsigned int *axes = NULL;
+  size_t len, m, nseg, n, wsize;
+  unsigned int i, j;
+  int err;
+
+  ac.data = vc.data = NULL;
+  ok.dst = oi.dst = ov.dst = NULL;
+
+  if (a->nd == 0)
+    return error_set(ctx->err, GA_VALUE_ERROR, "Cannot sort a 0-d array");
+  if (axis >= a->nd)
+    return error_fmt(ctx->err, GA_VALUE_ERROR, "Invalid axis %u for an array "
+                     "of %u dimensions", axis, a->nd);
+  if (sort_key_init(&sk, a->typecode) != 0)
+    return error_fmt(ctx->err, GA_UNSUPPORTED_ERROR, "Cannot sort arrays "
+                     "of type %s", gpuarray_get_type(a->typecode)->cluda_name);
+  if (!GpuArray_ISALIGNED(a) || (v != NULL && !GpuArray_ISALIGNED(v)))
+    return error_set(ctx->err, GA_UNALIGNED_ERROR, "Input arrays not aligned");
+
+  len = a->dimensions[axis];
+  m = topk == 0 ? len : topk;
+  if (m > len)
+    return error_fmt(ctx->err, GA_VALUE_ERROR, "k (%llu) is larger than the "
+                     "axis (%llu)", (unsigned long long)m,
+                     (unsigned long long)len);
+  if (len > 0xFFFFFFFF)
+    return error_set(ctx->err, GA_UNSUPPORTED_ERROR,
+                     "Cannot sort along an axis of 2**32 elements or more");
+
+  err = check_output(ctx, "rk", rk, a, axis, m);
+  if (err == GA_NO_ERROR)
+    err = check_output(ctx, "ri", ri, a, axis, m);
+  if (err == GA_NO_ERROR)
+    err = check_output(ctx, "rv", rv, a, axis, m);
+  if (err == GA_NO_ERROR && v != NULL)
+    err = check_output(ctx, "v", v, a, axis, len);
+  if (err != GA_NO_ERROR)
+    return err;
+  if (rk != NULL && rk->typecode != a->typecode)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Sorted keys must have the type of the input");
+  if (ri != NULL && !is_int_type(ri->typecode))
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Indices must be of an integer type");
+  if (rv != NULL && rv->typecode != v->typecode)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Sorted values must have the type of the input values");
+
+  nseg = 1;
+  for (i = 0; i < a->nd; i++)
+    if (i != axis)
+      nseg *= a->dimensions[i];
+  n = nseg * len;
+  if (nseg == 0 || m == 0)
+    return GA_NO_ERROR;
+
+  /* Move the sorted axis last */
+  axes = calloc(a->nd, sizeof(unsigned int));
+  if (axes == NULL)
+    return error_sys(ctx->err, "calloc");
+  for (i = 0, j = 0; i < a->nd; i++)
+    if (i != axis)
+      axes[j++] = i;
+  axes[j] = axis;
+
+  err = sort_input(&ac, a, axes);
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  wsize = sk.bits <= 32 ? 4 : 8;
+  for (i = 0; i < 2; i++) {
+    keys[i] = gpudata_alloc(ctx, n * wsize, NULL, 0, &err);
+    if (keys[i] == NULL)
+      goto out;
+    perm[i] = gpudata_alloc(ctx, n * sizeof(uint32_t), NULL, 0, &err);
+    if (perm[i] == NULL)
+      goto out;
+  }
+
+  {
+    GpuKernel kk;
+    void *args[6];
+
+    err = gen_keys_kernel(&kk, ctx, &sk, descending);
+    if (err != GA_NO_ERROR)
+      goto out;
+    args[0] = ac.data;
+    args[1] = &ac.offset;
+    args[2] = &n;
+    args[3] = &len;
+    args[4] = keys[0];
+    args[5] = perm[0];
+    err = call_flat(&kk, n, args);
+    GpuKernel_clear(&kk);
+    if (err != GA_NO_ERROR)
+      goto out;
+  }
+
+  if (topk != 0) {
+    gpudata *tk[2], *tp[2];
+
+    /* The selected keys go in the second buffers and get sorted there */
+    err = radix_select(ctx, &sk, keys[0], nseg, len, m, keys[1], perm[1]);
+    if (err != GA_NO_ERROR)
+      goto out;
+    tk[0] = keys[1];
+    tk[1] = keys[0];
+    tp[0] = perm[1];
+    tp[1] = perm[0];
+    err = radix_sort(ctx, &sk, tk, tp, nseg, m);
+    if (err != GA_NO_ERROR)
+      goto out;
+    keys[0] = tk[0];
+    keys[1] = tk[1];
+    perm[0] = tp[0];
+    perm[1] = tp[1];
+  } else {
+    err = radix_sort(ctx, &sk, keys, perm, nseg, len);
+    if (err != GA_NO_ERROR)
+      goto out;
+  }
+
+  if (rv != NULL) {
+    err = sort_input(&vc, v, axes);
+    if (err != GA_NO_ERROR)
+      goto out;
+  }
+  err = sort_output_begin(&ok, rk, axes);
+  if (err == GA_NO_ERROR)
+    err = sort_output_begin(&oi, ri, axes);
+  if (err == GA_NO_ERROR)
+    err = sort_output_begin(&ov, rv, axes);
+  if (err == GA_NO_ERROR)
+    err = sort_finish(ctx, &sk, descending, keys[0], perm[0], nseg, m, len,
+                      ok.dst, oi.dst, rv != NULL ? &vc : NULL, ov.dst);
+
+out:
+  err = sort_output_end(&ok, err);
+  err = sort_output_end(&oi, err);
+  err = sort_output_end(&ov, err);
+  if (vc.data != NULL) GpuArray_clear(&vc);
+  if (ac.data != NULL) GpuArray_clear(&ac);
+  for (i = 0; i < 2; i++) {
+    if (keys[i] != NULL) gpudata_release(keys[i]);
+    if (perm[i] != NULL) gpudata_release(perm[i]);
+  }
+  free(axes);
+  return err;
+}
+
+int GpuArray_sort(GpuArray *r, const GpuArray *a, unsigned int axis,
+                  int descending) {
+  return sort_common(r, NULL, NULL, a, NULL, axis, descending, 0);
+}
+
+int GpuArray_argsort(GpuArray *r, const GpuArray *a, unsigned int axis,
+                     int descending) {
+  return sort_common(NULL, r, NULL, a, NULL, axis, descending, 0);
+}
+
+int GpuArray_sort_by_key(GpuArray *rk, GpuArray *rv, const GpuArray *k,
+                         const GpuArray *v, unsigned int axis,
+                         int descending) {
+  return sort_common(rk, NULL, rv, k, v, axis, descending, 0);
+}
+
+int GpuArray_topk(GpuArray *rv, GpuArray *ri, const GpuArray *a,
+                  unsigned int axis, size_t k, int largest) {
+  /* The outputs are empty along axis */
+  if (k == 0)
+    return GA_NO_ERROR;
+  return sort_common(rv, ri, NULL, a, NULL, axis, largest, k);
+}
+
+static const int searchsorted_types[9] = {GA_BUFFER, GA_SIZE, GA_SSIZE,
+                                          GA_SIZE, GA_BUFFER, GA_SIZE,
+                                          GA_SIZE, GA_BUFFER, GA_SIZE};
+
+int GpuArray_searchsorted(GpuArray *r, const GpuArray *s, const GpuArray *v,
+                          int right) {
+  gpucontext *ctx = GpuArray_context(s);
+  strb sb = STRB_STATIC_INIT;
+  sort_key sk;
+  sort_output o;
+  GpuArray vc;
+  GpuKernel k;
+  void *args[9];
+  size_t n;
+  unsigned int i;
+  int err;
+
+  if (s->nd != 1)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "The sorted array must have one dimension");
+  if (s->typecode != v->typecode)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "The sorted array and the values must have the same type");
+  if (sort_key_init(&sk, s->typecode) != 0)
+    return error_fmt(ctx->err, GA_UNSUPPORTED_ERROR, "Cannot search arrays "
+                     "of type %s", gpuarray_get_type(s->typecode)->cluda_name);
+  if (!is_int_type(r->typecode))
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Indices must be of an integer type");
+  if (!GpuArray_ISALIGNED(s) || !GpuArray_ISALIGNED(v) ||
+      !GpuArray_ISALIGNED(r))
+    return error_set(ctx->err, GA_UNALIGNED_ERROR, "Arrays are not aligned");
+  if (!GpuArray_ISWRITEABLE(r))
+    return error_set(ctx->err, GA_VALUE_ERROR, "Output array not writeable");
+  if (r->nd != v->nd)
+    return error_fmt(ctx->err, GA_VALUE_ERROR, "Dimension mismatch. "
+                     "r->nd = %u, v->nd = %u", r->nd, v->nd);
+  n = 1;
+  for (i = 0; i < v->nd; i++) {
+    if (r->dimensions[i] != v->dimensions[i])
+      return error_fmt(ctx->err, GA_VALUE_ERROR, "Dimension mismatch. "
+                       "r->dimensions[%u] = %llu, v->dimensions[%u] = %llu",
+                       i, (unsigned long long)r->dimensions[i],
+                       i, (unsigned long long)v->dimensions[i]);
+    n *= v->dimensions[i];
+  }
+  if (n == 0)
+    return GA_NO_ERROR;
+
+  strb_appends(&sb, "#include \"cluda.h\"\n");
+  gen_key_macros(&sb, &sk, 0);
+  strb_appendf(&sb, "KERNEL void searchsorted(GLOBAL_MEM const char *s, "
+               "ga_size s_off, ga_ssize s_str, ga_size len, "
+               "GLOBAL_MEM const %s *v, ga_size v_off, ga_size n, "
+               "GLOBAL_MEM %s *r, ga_size r_off) {\n"
+               "  ga_size i, lo, hi, mid;\n"
+               "  %s u, x, y;\n"
+               "  s += s_off;\n"
+               "  v = (GLOBAL_MEM const %s *)(((GLOBAL_MEM const char *)v) + v_off);\n"
+               "  r = (GLOBAL_MEM %s *)(((GLOBAL_MEM char *)r) + r_off);\n"
+               "  for (i = LDIM_0 * GID_0 + LID_0; i < n; i += LDIM_0 * GDIM_0) {\n"
+               "    u = (%s)v[i];\n"
+               "    x = TO_KEY(u);\n"
+               "    lo = 0;\n"
+               "    hi = len;\n"
+               "    while (lo < hi) {\n"
+               "      mid = lo + (hi - lo) / 2;\n"
+               "      u = (%s)*(GLOBAL_MEM const %s *)(s + (ga_ssize)mid * s_str);\n"
+               "      y = TO_KEY(u);\n"
+               "      if (y %s x)\n"
+               "        lo = mid + 1;\n"
+               "      else\n"
+               "        hi = mid;\n"
+               "    }\n"
+               "    r[i] = (%s)lo;\n"
+               "  }\n"
+               "}\n", sk.raw, gpuarray_get_type(r->typecode)->cluda_name,
+               sk.work, sk.raw, gpuarray_get_type(r->typecode)->cluda_name,
+               sk.work, sk.work, sk.raw, right ? "<=" : "<",
+               gpuarray_get_type(r->typecode)->cluda_name);
+  err = sort_kernel_init(&k, ctx, &sb, "searchsorted", 9, searchsorted_types,
+                         gpuarray_type_flags(sk.rawtype, sk.worktype,
+                                             r->typecode, -1));
+  if (err != GA_NO_ERROR)
+    return err;
+
+  err = sort_input(&vc, v, NULL);
+  if (err != GA_NO_ERROR)
+    goto out_k;
+  err = sort_output_begin(&o, r, NULL);
+  if (err != GA_NO_ERROR)
+    goto out_v;
+
+  args[0] = s->data;
+  args[1] = (void *)&s->offset;
+  args[2] = (void *)&s->strides[0];
+  args[3] = (void *)&s->dimensions[0];
+  args[4] = vc.data;
+  args[5] = &vc.offset;
+  args[6] = &n;
+  args[7] = o.dst->data;
+  args[8] = &o.dst->offset;
+  err = call_flat(&k, n, args);
+  err = sort_output_end(&o, err);
+out_v:
+  GpuArray_clear(&vc);
+out_k:
+  GpuKernel_clear(&k);
+  return err;
+}
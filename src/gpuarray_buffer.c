@@ -7,6 +7,8 @@
 #include "gpuarray/error.h"
 
 #include "util/error.h"
+#include "util/murmurhash3.h"
+#include "util/workq.h"
 #include "private.h"
 
 extern const gpuarray_buffer_ops cuda_ops;
@@ -44,6 +46,10 @@ int gpucontext_props_new(gpucontext_props **res) {
   r->sched = GA_CTX_SCHED_AUTO;
   r->flags = 0;
   r->kernel_cache_path = NULL;
+  r->kernel_bundle_path = NULL;
+  r->kernel_record_path = NULL;
+  r->kernel_cache_size = 64;
+  r->binary_cache_size = 256;
   r->initial_cache_size = 0;
   r->max_cache_size = (size_t)-1;
   *res = r;
@@ -89,6 +95,26 @@ int gpucontext_props_kernel_cache(gpucontext_props *p, const char *path) {
   return GA_NO_ERROR;
 }
 
+int gpucontext_props_kernel_cache_size(gpucontext_props *p, size_t kernels,
+                                       size_t binaries) {
+  if (kernels == 0)
+    return error_set(global_err, GA_VALUE_ERROR,
+                     "The kernel cache needs at least one entry");
+  p->kernel_cache_size = kernels;
+  p->binary_cache_size = binaries;
+  return GA_NO_ERROR;
+}
+
+int gpucontext_props_kernel_bundle(gpucontext_props *p, const char *path) {
+  p->kernel_bundle_path = path;
+  return GA_NO_ERROR;
+}
+
+int gpucontext_props_kernel_record(gpucontext_props *p, const char *path) {
+  p->kernel_record_path = path;
+  return GA_NO_ERROR;
+}
+
 int gpucontext_props_alloc_cache(gpucontext_props *p, size_t initial, size_t max) {
   if (initial > max)
     return error_set(global_err, GA_VALUE_ERROR, "Initial size can't be bigger than max size");
@@ -115,6 +141,11 @@ int gpucontext_init(gpucontext **res, const char *name, gpucontext_props *p) {
   if (r == NULL) return global_err->code;
   r->ops = ops;
   r->extcopy_cache = NULL;
+  r->kernel_fps = NULL;
+  r->take1_cache = NULL;
+  r->norm_cache = NULL;
+  memset(r->errkern, 0, sizeof(r->errkern));
+  r->errpending = 0;
   *res = r;
   return GA_NO_ERROR;
 }
@@ -126,6 +157,18 @@ void gpucontext_deref(gpucontext *ctx) {
     cache_destroy(ctx->extcopy_cache);
     ctx->extcopy_cache = NULL;
   }
+  if (ctx->take1_cache != NULL) {
+    cache_destroy(ctx->take1_cache);
+    ctx->take1_cache = NULL;
+  }
+  if (ctx->norm_cache != NULL) {
+    cache_destroy(ctx->norm_cache);
+    ctx->norm_cache = NULL;
+  }
+  if (ctx->kernel_fps != NULL) {
+    cache_destroy(ctx->kernel_fps);
+    ctx->kernel_fps = NULL;
+  }
   ctx->ops->buffer_deinit(ctx);
 }
 
@@ -140,6 +183,59 @@ const char *gpucontext_error(gpucontext *ctx, int err) {
     return ctx->ops->ctx_error(ctx);
 }
 
+int gpucontext_check_errors(gpucontext *ctx) {
+  const int zero = 0;
+  int kerr = 0;
+  int err;
+
+  /* Read and reset the error buffer in one step with respect to
+     other threads. */
+  ctx_lock(ctx);
+  ctx->errpending = 0;
+  err = gpudata_read(&kerr, ctx->errbuf, 0, sizeof(int));
+  if (err != GA_NO_ERROR || kerr == 0) {
+    ctx_unlock(ctx);
+    return err;
+  }
+  /* We suppose this will not fail */
+  gpudata_write(ctx->errbuf, 0, &zero, sizeof(int));
+  ctx_unlock(ctx);
+  if (kerr > 0 && kerr <= GA_ERRKERN_MAX && ctx->errkern[kerr - 1] != NULL)
+    return error_fmt(ctx->err, GA_VALUE_ERROR,
+                     "Index out of bounds (in kernel %s)",
+                     ctx->errkern[kerr - 1]);
+  return error_set(ctx->err, GA_VALUE_ERROR, "Index out of bounds");
+}
+
+int gpucontext_errcode(gpucontext *ctx, const char *kname) {
+  unsigned int i;
+  int res = -1;
+
+  ctx_lock(ctx);
+  for (i = 0; i < GA_ERRKERN_MAX; i++) {
+    if (ctx->errkern[i] == NULL)
+      ctx->errkern[i] = kname;
+    if (strcmp(ctx->errkern[i], kname) == 0) {
+      res = i + 1;
+      break;
+    }
+  }
+  ctx_unlock(ctx);
+  return res;
+}
+
+int gpucontext_errcheck(gpucontext *ctx, int check_error) {
+  switch (check_error) {
+  case GA_CHECK_ERROR_NONE:
+    return GA_NO_ERROR;
+  case GA_CHECK_ERROR_DEFERRED:
+    ctx->errpending = 1;
+    return GA_NO_ERROR;
+  default:
+    return gpucontext_check_errors(ctx);
+  }
+}
+
 gpudata *gpudata_alloc(gpucontext *ctx, size_t sz, void *data, int flags,
                        int *ret) {
   gpudata *res = ctx->ops->buffer_alloc(ctx, sz, data, flags);
@@ -228,15 +324,308 @@ gpukernel *gpukernel_init(gpucontext *ctx, unsigned int count,
                           const char *fname, unsigned int numargs,
                           const int *typecodes, int flags, int *ret,
                           char **err_str) {
+  gpukernel_fp fp;
+  gpukernel_fingerprint(&fp, count, strings, lengths, fname, flags);
+  return gpukernel_init_fp(ctx, &fp, count, strings, lengths, fname,
+                           numargs, typecodes, flags, ret, err_str);
+}
+
+/*
+ * Each string is hashed on its own and the fingerprint is the hash of
+ * those hashes with the name and flags.  This way we never have to
+ * concatenate the source.
+ */
+void gpukernel_fingerprint(gpukernel_fp *fp, unsigned int count,
+                           const char **strings, const size_t *lengths,
+                           const char *fname, int flags) {
+  uint64_t part[2];
+  uint64_t acc[2] = {0, 0};
+  uint64_t tail[4];
+  size_t l;
+  unsigned int i;
+
+  for (i = 0; i < count; i++) {
+    l = (lengths == NULL || lengths[i] == 0) ? strlen(strings[i]) :
+      lengths[i];
+    MurmurHash3_x64_128(strings[i], l, i, part);
+    /* Mix in the position so that reordering the strings matters */
+    acc[0] = (acc[0] ^ part[0]) * 0x9e3779b97f4a7c15ULL + i;
+    acc[1] = (acc[1] ^ part[1]) * 0xc2b2ae3d27d4eb4fULL + i;
+  }
+  MurmurHash3_x64_128(fname, strlen(fname), (uint32_t)flags, part);
+  tail[0] = acc[0];
+  tail[1] = acc[1];
+  tail[2] = part[0];
+  tail[3] = part[1];
+  MurmurHash3_x64_128(tail, sizeof(tail), count, fp->h);
+}
+
+static int fp_eq(gpukernel_fp *k1, gpukernel_fp *k2) {
+  return k1->h[0] == k2->h[0] && k1->h[1] == k2->h[1];
+}
+
+static uint32_t fp_hash(gpukernel_fp *k) {
+  return (uint32_t)k->h[0];
+}
+
+gpukernel *gpukernel_init_fp(gpucontext *ctx, const gpukernel_fp *fp,
+                             unsigned int count, const char **strings,
+                             const size_t *lengths, const char *fname,
+                             unsigned int numargs, const int *typecodes,
+                             int flags, int *ret, char **err_str) {
   gpukernel *res = NULL;
+  gpukernel_fp *key;
   int err;
+
+  ctx_lock(ctx);
+  if (ctx->kernel_fps != NULL) {
+    res = cache_get(ctx->kernel_fps, (cache_key_t)fp);
+    if (res != NULL) {
+      /* Take our ref before anyone can evict it */
+      gpukernel_retain(res);
+      ctx_unlock(ctx);
+      return res;
+    }
+  }
+  ctx_unlock(ctx);
+
   err = ctx->ops->kernel_alloc(&res, ctx, count, strings, lengths, fname,
                                numargs, typecodes, flags, err_str);
-  if (err != GA_NO_ERROR && ret != NULL)
-    *ret = ctx->err->code;
+  if (err != GA_NO_ERROR) {
+    if (ret != NULL)
+      *ret = ctx->err->code;
+    return NULL;
+  }
+
+  key = memdup(fp, sizeof(*fp));
+  if (key == NULL)
+    return res;
+  ctx_lock(ctx);
+  if (ctx->kernel_fps == NULL)
+    ctx->kernel_fps = cache_twoq(64, 128, 64, 8,
+                                 (cache_eq_fn)fp_eq,
+                                 (cache_hash_fn)fp_hash,
+                                 (cache_freek_fn)free,
+                                 (cache_freev_fn)gpukernel_release,
+                                 ctx->err);
+  if (ctx->kernel_fps != NULL) {
+    /* One ref for the cache */
+    gpukernel_retain(res);
+    if (cache_add(ctx->kernel_fps, key, res) != 0) {
+      gpukernel_release(res);
+      free(key);
+    }
+  } else {
+    free(key);
+  }
+  ctx_unlock(ctx);
   return res;
 }
 
+struct _gpukernel_future {
+  ga_lock lock;
+  ga_cond cond;
+  unsigned int refcnt; /* One for the caller and one for the job */
+  int done;
+  gpucontext *ctx;
+  /* Copy of the arguments */
+  char *src;
+  size_t src_len;
+  char *fname;
+  int *types;
+  unsigned int numargs;
+  int flags;
+  /* Result */
+  gpukernel *k;
+  int err;
+  char *msg;
+  char *err_str;
+};
+
+static void future_unref(gpukernel_future *f) {
+  unsigned int refcnt;
+
+  ga_lock_acquire(&f->lock);
+  refcnt = --f->refcnt;
+  ga_lock_release(&f->lock);
+  if (refcnt != 0)
+    return;
+  if (f->k != NULL)
+    gpukernel_release(f->k);
+  if (f->ctx != NULL)
+    f->ctx->ops->buffer_deinit(f->ctx);
+  free(f->src);
+  free(f->fname);
+  free(f->types);
+  free(f->msg);
+  free(f->err_str);
+  ga_cond_destroy(&f->cond);
+  ga_lock_destroy(&f->lock);
+  free(f);
+}
+
+static void future_run(void *p) {
+  gpukernel_future *f = (gpukernel_future *)p;
+  gpucontext *ctx = f->ctx;
+  gpukernel *k = NULL;
+  char *err_str = NULL;
+  char *msg = NULL;
+  int err = GA_NO_ERROR;
+
+  k = gpukernel_init(ctx, 1, (const char **)&f->src, &f->src_len, f->fname,
+                     f->numargs, f->types, f->flags, &err, &err_str);
+  if (err != GA_NO_ERROR) {
+    /* The context error can be overwritten by other threads, so keep
+       our own copy for gpukernel_future_get(). */
+    msg = strdup(ctx->err->msg);
+    k = NULL;
+  }
+  ga_lock_acquire(&f->lock);
+  f->k = k;
+  f->err = err;
+  f->msg = msg;
+  f->err_str = err_str;
+  f->done = 1;
+  ga_cond_broadcast(&f->cond);
+  ga_lock_release(&f->lock);
+  future_unref(f);
+}
+
+gpukernel_future *gpukernel_init_async(gpucontext *ctx, unsigned int count,
+                                       const char **strings,
+                                       const size_t *lengths,
+                                       const char *fname,
+                                       unsigned int numargs,
+                                       const int *typecodes, int flags,
+                                       int *ret) {
+  gpukernel_future *f;
+  strb sb = STRB_STATIC_INIT;
+  unsigned int i;
+
+  f = calloc(1, sizeof(*f));
+  if (f == NULL) {
+    error_sys(ctx->err, "calloc");
+    FAIL(NULL, ctx->err);
+  }
+  if (ga_lock_init(&f->lock)) {
+    free(f);
+    error_set(ctx->err, GA_SYS_ERROR, "Could not create future lock");
+    FAIL(NULL, ctx->err);
+  }
+  if (ga_cond_init(&f->cond)) {
+    ga_lock_destroy(&f->lock);
+    free(f);
+    error_set(ctx->err, GA_SYS_ERROR, "Could not create future condition");
+    FAIL(NULL, ctx->err);
+  }
+  /* Until the job is queued this is the only reference */
+  f->refcnt = 1;
+
+  for (i = 0; i < count; i++) {
+    if (lengths == NULL || lengths[i] == 0)
+      strb_appends(&sb, strings[i]);
+    else
+      strb_appendn(&sb, strings[i], lengths[i]);
+  }
+  f->src = strb_cstr(&sb);
+  f->src_len = sb.l;
+  f->fname = strdup(fname);
+  f->types = calloc(numargs ? numargs : 1, sizeof(int));
+  if (f->src == NULL || f->fname == NULL || f->types == NULL) {
+    future_unref(f);
+    error_sys(ctx->err, "alloc");
+    FAIL(NULL, ctx->err);
+  }
+  memcpy(f->types, typecodes, numargs * sizeof(int));
+  f->numargs = numargs;
+  f->flags = flags;
+
+  ctx_lock(ctx);
+  ctx->refcnt++;
+  ctx_unlock(ctx);
+  f->ctx = ctx;
+
+  f->refcnt++;
+  if (ga_workq_submit(future_run, f) != 0)
+    future_run(f);
+  return f;
+}
+
+int gpukernel_future_ready(gpukernel_future *f) {
+  int done;
+  ga_lock_acquire(&f->lock);
+  done = f->done;
+  ga_lock_release(&f->lock);
+  return done;
+}
+
+gpukernel *gpukernel_future_get(gpukernel_future *f, int *ret,
+                                char **err_str) {
+  ga_lock_acquire(&f->lock);
+  while (!f->done)
+    ga_cond_wait(&f->cond, &f->lock);
+  if (f->err != GA_NO_ERROR) {
+    if (err_str != NULL) {
+      *err_str = f->err_str;
+      f->err_str = NULL;
+    }
+    ga_lock_release(&f->lock);
+    error_set(f->ctx->err, f->err,
+              f->msg != NULL ? f->msg : "Kernel compilation failed");
+    FAIL(NULL, f->ctx->err);
+  }
+  ga_lock_release(&f->lock);
+  gpukernel_retain(f->k);
+  return f->k;
+}
+
+void gpukernel_future_release(gpukernel_future *f) {
+  future_unref(f);
+}
+
+int gpukernel_init_many(gpucontext *ctx, unsigned int n,
+                        const gpukernel_desc *descs, gpukernel **res,
+                        char **err_str) {
+  gpukernel_future **fs;
+  unsigned int i, first;
+  int err = GA_NO_ERROR;
+
+  fs = calloc(n ? n : 1, sizeof(*fs));
+  if (fs == NULL)
+    return error_sys(ctx->err, "calloc");
+  for (i = 0; i < n; i++) {
+    res[i] = NULL;
+    fs[i] = gpukernel_init_async(ctx, descs[i].count, descs[i].strings,
+                                 descs[i].lengths, descs[i].fname,
+                                 descs[i].numargs, descs[i].typecodes,
+                                 descs[i].flags, &err);
+    if (fs[i] == NULL)
+      break;
+  }
+
+  /* Wait for everything that was started, even after a failure, so
+     that nothing is still writing to the context error when we
+     return. */
+  first = n;
+  for (i = 0; i < n && fs[i] != NULL; i++) {
+    res[i] = gpukernel_future_get(fs[i], NULL, NULL);
+    if (res[i] == NULL && first == n)
+      first = i;
+  }
+  if (first != n)
+    gpukernel_future_get(fs[first], &err, err_str);
+
+  for (i = 0; i < n && fs[i] != NULL; i++) {
+    if (err != GA_NO_ERROR && res[i] != NULL) {
+      gpukernel_release(res[i]);
+      res[i] = NULL;
+    }
+    gpukernel_future_release(fs[i]);
+  }
+  free(fs);
+  return err;
+}
+
 void gpukernel_retain(gpukernel *k) {
   ((partial_gpukernel *)k)->ctx->ops->kernel_retain(k);
 }
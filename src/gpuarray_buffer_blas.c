@@ -3,9 +3,13 @@
 #include <gpuarray/error.h>
 
 int gpublas_setup(gpucontext *ctx) {
+  int err;
   if (ctx->blas_ops == NULL)
     return error_set(ctx->err, GA_UNSUPPORTED_ERROR, "Missing Blas library");
-  return ctx->blas_ops->setup(ctx);
+  ctx_lock(ctx);
+  err = ctx->blas_ops->setup(ctx);
+  ctx_unlock(ctx);
+  return err;
 }
 
 void gpublas_teardown(gpucontext *ctx) {
@@ -17,20 +21,30 @@ const char *gpublas_error(gpucontext *ctx) {
   return ctx->err->msg;
 }
 
+/*
+ * The blas handle keeps per-call state (pointer mode, stream,
+ * workspace kernels) so calls on a context are serialized.
+ */
 #define BLAS_OP(buf, name, args)                                        \
   gpucontext *ctx = gpudata_context(buf);                               \
-  if (ctx->blas_ops->name)                                              \
-    return ctx->blas_ops->name args;                                    \
-  else                                                                  \
-    return error_fmt(ctx->err, GA_DEVSUP_ERROR, "Blas operation not supported by device or missing library: %s", #name)
+  int err;                                                              \
+  if (ctx->blas_ops->name == NULL)                                      \
+    return error_fmt(ctx->err, GA_DEVSUP_ERROR, "Blas operation not supported by device or missing library: %s", #name); \
+  ctx_lock(ctx);                                                        \
+  err = ctx->blas_ops->name args;                                       \
+  ctx_unlock(ctx);                                                      \
+  return err
 
 #define BLAS_OPF(buf, name, args)                                       \
   gpucontext *ctx = gpudata_context(buf);                               \
+  int err;                                                              \
   if (flags != 0) return error_set(ctx->err, GA_INVALID_ERROR, "flags is not 0"); \
-  if (ctx->blas_ops->name)						\
-    return ctx->blas_ops->name args;                                    \
-  else                                                                  \
-    return error_fmt(ctx->err, GA_DEVSUP_ERROR, "Blas operation not supported by device or missing library: %s", #name)
+  if (ctx->blas_ops->name == NULL)                                      \
+    return error_fmt(ctx->err, GA_DEVSUP_ERROR, "Blas operation not supported by device or missing library: %s", #name); \
+  ctx_lock(ctx);                                                        \
+  err = ctx->blas_ops->name args;                                       \
+  ctx_unlock(ctx);                                                      \
+  return err
 
 
 int gpublas_hdot(
@@ -140,22 +154,28 @@ int gpublas_dger(cb_order order, size_t M, size_t N, double alpha,
 
 #define BLAS_OPB(l, name, args)                                         \
   gpucontext *ctx;                                                      \
+  int err;                                                              \
   if (batchCount == 0) return GA_NO_ERROR;                              \
   ctx = gpudata_context(l[0]);                                          \
-  if (ctx->blas_ops->name)                                              \
-    return ctx->blas_ops->name args;                                    \
-  else                                                                  \
-    return error_fmt(ctx->err, GA_DEVSUP_ERROR, "Blas operation not supported by library in use: %s", #name)
+  if (ctx->blas_ops->name == NULL)                                      \
+    return error_fmt(ctx->err, GA_DEVSUP_ERROR, "Blas operation not supported by library in use: %s", #name); \
+  ctx_lock(ctx);                                                        \
+  err = ctx->blas_ops->name args;                                       \
+  ctx_unlock(ctx);                                                      \
+  return err
 
 #define BLAS_OPBF(l, name, args)                                        \
   gpucontext *ctx;                                                      \
+  int err;                                                              \
   if (batchCount == 0) return GA_NO_ERROR;                              \
   ctx = gpudata_context(l[0]);                                          \
   if (flags != 0) return error_set(ctx->err, GA_INVALID_ERROR, "flags is not 0"); \
-  if (ctx->blas_ops->name)                                              \
-    return ctx->blas_ops->name args;                                    \
-  else                                                                  \
-    return error_fmt(ctx->err, GA_DEVSUP_ERROR, "Blas operation not supported by library in use: %s", #name)
+  if (ctx->blas_ops->name == NULL)                                      \
+    return error_fmt(ctx->err, GA_DEVSUP_ERROR, "Blas operation not supported by library in use: %s", #name); \
+  ctx_lock(ctx);                                                        \
+  err = ctx->blas_ops->name args;                                       \
+  ctx_unlock(ctx);                                                      \
+  return err
 
 int gpublas_hgemmBatch(
     cb_order order, cb_transpose transA, cb_transpose transB,
@@ -262,13 +282,16 @@ int gpublas_dgerBatch(cb_order order, size_t M, size_t N, double alpha,
 
 #define BLAS_OP3F(b, name, args)                                        \
   gpucontext *ctx;                                                      \
+  int err;                                                              \
   if (batchCount == 0) return GA_NO_ERROR;                              \
   ctx = gpudata_context(b);                                             \
   if (flags != 0) return error_set(ctx->err, GA_INVALID_ERROR, "flags is not 0"); \
-  if (ctx->blas_ops->name)                                              \
-    return ctx->blas_ops->name args;                                    \
-  else                                                                  \
-    return error_fmt(ctx->err, GA_DEVSUP_ERROR, "Blas operation not supported by library in use: %s", #name)
+  if (ctx->blas_ops->name == NULL)                                      \
+    return error_fmt(ctx->err, GA_DEVSUP_ERROR, "Blas operation not supported by library in use: %s", #name); \
+  ctx_lock(ctx);                                                        \
+  err = ctx->blas_ops->name args;                                       \
+  ctx_unlock(ctx);                                                      \
+  return err
 
 int gpublas_hgemm3D(
     cb_order order, cb_transpose transA, cb_transpose transB,
@@ -1,6 +1,9 @@
+#include <stdlib.h>
+
 #include "gpuarray/buffer.h"
 #include "gpuarray/buffer_collectives.h"
 #include "gpuarray/error.h"
+#include "gpuarray/util.h"
 
 #include "private.h"
 
@@ -95,3 +98,129 @@ int gpucomm_all_gather(gpudata* src, size_t offsrc, gpudata* dest,
   return ctx->comm_ops->all_gather(src, offsrc, dest, offdest, count, typecode,
                                    comm);
 }
+
+int gpucomm_send(gpudata* src, size_t offsrc, size_t count, int typecode,
+                 int peer, gpucomm* comm) {
+  gpucontext* ctx = gpucomm_context(comm);
+  if (ctx->comm_ops == NULL || ctx->comm_ops->send == NULL)
+    return error_set(ctx->err, GA_DEVSUP_ERROR, "Point-to-point unavailable");
+  return ctx->comm_ops->send(src, offsrc, count, typecode, peer, comm);
+}
+
+int gpucomm_recv(gpudata* dest, size_t offdest, size_t count, int typecode,
+                 int peer, gpucomm* comm) {
+  gpucontext* ctx = gpucomm_context(comm);
+  if (ctx->comm_ops == NULL || ctx->comm_ops->recv == NULL)
+    return error_set(ctx->err, GA_DEVSUP_ERROR, "Point-to-point unavailable");
+  return ctx->comm_ops->recv(dest, offdest, count, typecode, peer, comm);
+}
+
+int gpucomm_group_start(gpucomm* comm) {
+  gpucontext* ctx = gpucomm_context(comm);
+  if (ctx->comm_ops == NULL || ctx->comm_ops->group_start == NULL)
+    return error_set(ctx->err, GA_DEVSUP_ERROR, "Point-to-point unavailable");
+  return ctx->comm_ops->group_start(comm);
+}
+
+int gpucomm_group_end(gpucomm* comm) {
+  gpucontext* ctx = gpucomm_context(comm);
+  if (ctx->comm_ops == NULL || ctx->comm_ops->group_end == NULL)
+    return error_set(ctx->err, GA_DEVSUP_ERROR, "Point-to-point unavailable");
+  return ctx->comm_ops->group_end(comm);
+}
+
+/*
+ * The all-to-all operations are a group of sends and receives with
+ * every rank, which both NCCL and the host transport can schedule
+ * together.
+ */
+
+int gpucomm_all_to_allv(gpudata* src, size_t offsrc, const size_t* sendcounts,
+                        const size_t* sdispls, gpudata* dest, size_t offdest,
+                        const size_t* recvcounts, const size_t* rdispls,
+                        int typecode, gpucomm* comm) {
+  size_t esz = gpuarray_get_elsize(typecode);
+  int ndev = 0, i, err = GA_NO_ERROR, err2;
+
+  GA_CHECK(gpucomm_get_count(comm, &ndev));
+  GA_CHECK(gpucomm_group_start(comm));
+  for (i = 0; i < ndev && err == GA_NO_ERROR; i++) {
+    err = gpucomm_send(src, offsrc + sdispls[i] * esz, sendcounts[i],
+                       typecode, i, comm);
+    if (err == GA_NO_ERROR)
+      err = gpucomm_recv(dest, offdest + rdispls[i] * esz, recvcounts[i],
+                         typecode, i, comm);
+  }
+  /* Always close the group, but report the first error */
+  err2 = gpucomm_group_end(comm);
+  return err != GA_NO_ERROR ? err : err2;
+}
+
+int gpucomm_all_to_all(gpudata* src, size_t offsrc, gpudata* dest,
+                       size_t offdest, size_t count, int typecode,
+                       gpucomm* comm) {
+  size_t sz = count * gpuarray_get_elsize(typecode);
+  int ndev = 0, i, err = GA_NO_ERROR, err2;
+
+  GA_CHECK(gpucomm_get_count(comm, &ndev));
+  GA_CHECK(gpucomm_group_start(comm));
+  for (i = 0; i < ndev && err == GA_NO_ERROR; i++) {
+    err = gpucomm_send(src, offsrc + i * sz, count, typecode, i, comm);
+    if (err == GA_NO_ERROR)
+      err = gpucomm_recv(dest, offdest + i * sz, count, typecode, i, comm);
+  }
+  err2 = gpucomm_group_end(comm);
+  return err != GA_NO_ERROR ? err : err2;
+}
+
+struct _gpucomm_request {
+  gpucomm* comm;
+  void* ev;  /* NULL when complete on creation */
+};
+
+int gpucomm_request_new(gpucomm_request** req, gpucomm* comm) {
+  gpucontext* ctx = gpucomm_context(comm);
+  gpucomm_request* res;
+  int err;
+  *req = NULL;
+  if (ctx->comm_ops == NULL)
+    return error_set(ctx->err, GA_DEVSUP_ERROR, "Collectives unavailable");
+  res = calloc(1, sizeof(*res));
+  if (res == NULL)
+    return error_sys(ctx->err, "calloc");
+  res->comm = comm;
+  if (ctx->comm_ops->request_new != NULL) {
+    err = ctx->comm_ops->request_new(comm, &res->ev);
+    if (err != GA_NO_ERROR) {
+      free(res);
+      return err;
+    }
+  }
+  *req = res;
+  return GA_NO_ERROR;
+}
+
+int gpucomm_request_test(gpucomm_request* req, int* done) {
+  gpucontext* ctx = gpucomm_context(req->comm);
+  if (req->ev == NULL) {
+    *done = 1;
+    return GA_NO_ERROR;
+  }
+  return ctx->comm_ops->request_test(req->comm, req->ev, done);
+}
+
+int gpucomm_request_wait(gpucomm_request* req) {
+  gpucontext* ctx = gpucomm_context(req->comm);
+  if (req->ev == NULL)
+    return GA_NO_ERROR;
+  return ctx->comm_ops->request_wait(req->comm, req->ev);
+}
+
+void gpucomm_request_free(gpucomm_request* req) {
+  gpucontext* ctx;
+  if (req == NULL) return;
+  ctx = gpucomm_context(req->comm);
+  if (req->ev != NULL)
+    ctx->comm_ops->request_free(req->comm, req->ev);
+  free(req);
+}
@@ -47,13 +47,12 @@ const gpuarray_buffer_ops cuda_ops;
 
 static void cuda_freekernel(gpukernel *);
 static int cuda_property(gpucontext *, gpudata *, gpukernel *, int, void *);
-static int cuda_waits(gpudata *, int, CUstream);
-static int cuda_records(gpudata *, int, CUstream);
 static gpudata *cuda_alloc(gpucontext *c, size_t size, void *data, int flags);
 static void cuda_free(gpudata *);
 
 static int detect_arch(const char *prefix, char *ret, error *e);
 static gpudata *new_gpudata(cuda_context *ctx, CUdeviceptr ptr, size_t size);
+static ga_shmidx *open_disk_idx(const char *cache_path);
 
 typedef struct _disk_key {
   uint8_t version;
@@ -156,6 +155,16 @@ static strb *kernel_read(const strb *b) {
 static int setup_done = 0;
 static int major = -1;
 static int minor = -1;
+
+/*
+ * Binaries shared by all the contexts of the process.  The keys are
+ * the same as for the disk cache, so they include the arch.
+ */
+static ga_lock bin_lock;
+static cache *bin_cache = NULL;
+
+/* How long to wait (in ms) for another process compiling a kernel we need */
+#define DISK_IDX_WAIT 30000
 static int setup_lib(void) {
   CUresult err;
   int res, tmp;
@@ -195,6 +204,8 @@ static int setup_lib(void) {
     if (res != GA_NO_ERROR)
       // Return the error from the original attempt
       return load_libnvrtc(orig_major, orig_minor, global_err);
+    if (ga_lock_init(&bin_lock))
+      return error_set(global_err, GA_SYS_ERROR, "Could not create lock");
     setup_done = 1;
   }
   return GA_NO_ERROR;
@@ -218,10 +229,78 @@ static int cuda_get_device_count(unsigned int platform,
   return GA_NO_ERROR;
 }
 
+/*
+ * Load the entries of the bundle at `path` that match our arch.
+ *
+ * The keys don't include the compiler version since the binaries were
+ * built ahead of time.
+ */
+static cache *load_bundle(const char *path, const char *bin_id, error *e) {
+  cache *c = NULL;
+  bundle_entry *ents;
+  disk_key *k;
+  strb *v;
+  size_t i, n;
+#ifdef DEBUG
+  const int debug = 1;
+#else
+  const int debug = 0;
+#endif
+
+  if (kernel_bundle_read(path, bin_id, &ents, &n, e) != GA_NO_ERROR)
+    return NULL;
+  if (n == 0) {
+    error_fmt(e, GA_VALUE_ERROR, "No kernels for %s in bundle %s",
+              bin_id, path);
+    goto out;
+  }
+  c = cache_lru(n, 8, (cache_eq_fn)disk_eq, (cache_hash_fn)disk_hash,
+                (cache_freek_fn)disk_free, (cache_freev_fn)strb_free, e);
+  if (c == NULL)
+    goto out;
+  for (i = 0; i < n; i++) {
+    if ((ents[i].flags & 1) != debug)
+      continue;
+    k = calloc(1, sizeof(*k));
+    v = strb_alloc(ents[i].bin.l);
+    if (k == NULL || v == NULL) {
+      free(k);
+      strb_free(v);
+      error_sys(e, "calloc");
+      cache_destroy(c);
+      c = NULL;
+      goto out;
+    }
+    k->debug = debug;
+    memcpy(k->bin_id, ents[i].bin_id, sizeof(k->bin_id));
+    strb_appendb(&k->src, &ents[i].src);
+    strb_append0(&k->src);
+    strb_appendb(v, &ents[i].bin);
+    if (strb_error(&k->src) || strb_error(v)) {
+      disk_free((cache_key_t)k);
+      strb_free(v);
+      error_sys(e, "strb");
+      cache_destroy(c);
+      c = NULL;
+      goto out;
+    }
+    if (cache_add(c, k, v) != 0) {
+      disk_free((cache_key_t)k);
+      strb_free(v);
+    }
+  }
+ out:
+  for (i = 0; i < n; i++)
+    bundle_entry_clear(&ents[i]);
+  free(ents);
+  return c;
+}
+
 cuda_context *cuda_make_ctx(CUcontext ctx, gpucontext_props *p) {
   cuda_context *res;
   cache *mem_cache;
   const char *cache_path;
+  const char *path;
   void *pp;
   CUdevice dev;
   CUresult err;
@@ -258,10 +337,14 @@ cuda_context *cuda_make_ctx(CUcontext ctx, gpucontext_props *p) {
   res->refcnt = 1;
   res->flags = p->flags;
   res->max_cache_size = p->max_cache_size;
-  res->enter = 0;
   res->major = major;
   res->minor = minor;
   res->freeblocks = NULL;
+  if (ga_lock_init(&res->lock)) {
+    error_set(global_err, GA_SYS_ERROR, "Could not create context lock");
+    free(res);
+    return NULL;
+  }
   if (error_alloc(&res->err)) {
     error_set(global_err, GA_SYS_ERROR, "Could not create error context");
     goto fail_errmsg;
@@ -288,7 +371,9 @@ cuda_context *cuda_make_ctx(CUcontext ctx, gpucontext_props *p) {
     }
   }
 
-  res->kernel_cache = cache_twoq(64, 128, 64, 8,
+  res->kernel_cache = cache_twoq(p->kernel_cache_size,
+                                 p->kernel_cache_size * 2,
+                                 p->kernel_cache_size, 8,
                                  (cache_eq_fn)kernel_eq,
                                  (cache_hash_fn)kernel_hash,
                                  (cache_freek_fn)kernel_free,
@@ -325,11 +410,50 @@ cuda_context *cuda_make_ctx(CUcontext ctx, gpucontext_props *p) {
       cache_destroy(mem_cache);
       goto fail_disk_cache;
     }
+    res->disk_idx = open_disk_idx(cache_path);
   } else {
   fail_disk_cache:
     res->disk_cache = NULL;
   }
 
+  if (p->binary_cache_size != 0) {
+    ga_lock_acquire(&bin_lock);
+    if (bin_cache == NULL) {
+      bin_cache = cache_lru(p->binary_cache_size, 8,
+                            (cache_eq_fn)disk_eq,
+                            (cache_hash_fn)disk_hash,
+                            (cache_freek_fn)disk_free,
+                            (cache_freev_fn)strb_free,
+                            global_err);
+      if (bin_cache == NULL)
+        fprintf(stderr, "Error initializing shared kernel cache: %s\n",
+                global_err->msg);
+    }
+    ga_lock_release(&bin_lock);
+    res->flags |= CUDA_SHARED_BINS;
+  }
+
+  path = p->kernel_bundle_path;
+  if (path == NULL)
+    path = getenv("GPUARRAY_KERNEL_BUNDLE");
+  if (path != NULL && *path != '\0') {
+    res->bundle_cache = load_bundle(path, res->bin_id, global_err);
+    if (res->bundle_cache == NULL)
+      fprintf(stderr, "Error loading kernel bundle, ignoring: %s\n",
+              global_err->msg);
+  }
+
+  path = p->kernel_record_path;
+  if (path == NULL)
+    path = getenv("GPUARRAY_KERNEL_RECORD");
+  if (path != NULL && *path != '\0') {
+    res->record_path = strdup(path);
+    if (res->record_path == NULL) {
+      error_sys(global_err, "strdup");
+      goto fail_record;
+    }
+  }
+
   err = cuMemAllocHost(&pp, 16);
   if (err != CUDA_SUCCESS) {
     error_cuda(global_err, "cuMemAllocHost", err);
@@ -355,6 +479,12 @@ cuda_context *cuda_make_ctx(CUcontext ctx, gpucontext_props *p) {
  fail_end:
   cuMemFreeHost(pp);
  fail_errbuf:
+  free(res->record_path);
+ fail_record:
+  if (res->bundle_cache)
+    cache_destroy(res->bundle_cache);
+  if (res->disk_idx)
+    ga_shmidx_close(res->disk_idx);
   if (res->disk_cache)
     cache_destroy(res->disk_cache);
   cache_destroy(res->kernel_cache);
@@ -366,6 +496,7 @@ cuda_context *cuda_make_ctx(CUcontext ctx, gpucontext_props *p) {
  fail_stream:
   error_free(res->err);
  fail_errmsg:
+  ga_lock_destroy(&res->lock);
   free(res);
   return NULL;
 }
@@ -377,9 +508,14 @@ static void cuda_free_ctx(cuda_context *ctx) {
   CUdevice dev;
 
   ASSERT_CTX(ctx);
+  ctx_lock((gpucontext *)ctx);
   ctx->refcnt--;
-  if (ctx->refcnt == 0) {
-    assert(ctx->enter == 0 && "Context was active when freed!");
+  if (ctx->refcnt != 0) {
+    ctx_unlock((gpucontext *)ctx);
+  } else {
+    /* Nobody else holds a reference, so nobody else can be waiting
+       on the lock either. */
+    ctx_unlock((gpucontext *)ctx);
     if (ctx->blas_handle != NULL) {
       ctx->blas_ops->teardown((gpucontext *)ctx);
     }
@@ -399,6 +535,11 @@ static void cuda_free_ctx(cuda_context *ctx) {
     cache_destroy(ctx->kernel_cache);
     if (ctx->disk_cache)
       cache_destroy(ctx->disk_cache);
+    if (ctx->bundle_cache)
+      cache_destroy(ctx->bundle_cache);
+    if (ctx->disk_idx)
+      ga_shmidx_close(ctx->disk_idx);
+    free(ctx->record_path);
     error_free(ctx->err);
 
     if (!(ctx->flags & DONTFREE)) {
@@ -407,6 +548,7 @@ static void cuda_free_ctx(cuda_context *ctx) {
       cuCtxPopCurrent(NULL);
       cuDevicePrimaryCtxRelease(dev);
     }
+    ga_lock_destroy(&ctx->lock);
     CLEAR(ctx);
     free(ctx);
   }
@@ -417,19 +559,33 @@ CUstream cuda_get_stream(cuda_context *ctx) {
   return ctx->s;
 }
 
+int cuda_get_device(cuda_context *ctx) {
+  CUdevice dev;
+  CUresult err;
+  ASSERT_CTX(ctx);
+  cuda_enter(ctx);
+  err = cuCtxGetDevice(&dev);
+  cuda_exit(ctx);
+  if (err != CUDA_SUCCESS) {
+    error_cuda(ctx->err, "cuCtxGetDevice", err);
+    return -1;
+  }
+  return (int)dev;
+}
+
+/*
+ * The CUDA context stack is per-thread so this always pushes, which
+ * keeps enter/exit pairs independent between threads sharing a
+ * context.
+ */
 void cuda_enter(cuda_context *ctx) {
   ASSERT_CTX(ctx);
-  if (!ctx->enter)
-    cuCtxPushCurrent(ctx->ctx);
-  ctx->enter++;
+  cuCtxPushCurrent(ctx->ctx);
 }
 
 void cuda_exit(cuda_context *ctx) {
   ASSERT_CTX(ctx);
-  assert(ctx->enter > 0);
-  ctx->enter--;
-  if (!ctx->enter)
-    cuCtxPopCurrent(NULL);
+  cuCtxPopCurrent(NULL);
 }
 
 static gpudata *new_gpudata(cuda_context *ctx, CUdeviceptr ptr, size_t size) {
@@ -448,6 +604,8 @@ static gpudata *new_gpudata(cuda_context *ctx, CUdeviceptr ptr, size_t size) {
 
   res->flags = 0;
   res->ls = NULL;
+  res->cev = NULL;
+  res->cs = NULL;
 
   cuda_enter(ctx);
 
@@ -487,7 +645,9 @@ gpudata *cuda_make_buf(cuda_context *ctx, CUdeviceptr p, size_t sz) {
 
   res->refcnt = 1;
   res->flags |= DONTFREE;
+  ctx_lock((gpucontext *)ctx);
   res->ctx->refcnt++;
+  ctx_unlock((gpucontext *)ctx);
 
   return res;
 }
@@ -557,6 +717,7 @@ static cuda_context *do_init(CUdevice dev, gpucontext_props *p, error *e) {
     res->blas_ops = NULL;
   }
 
+  /* NCCL is loaded on the first gpucomm call, see setup_lib() */
   res->comm_ops = &nccl_ops;
 
   /* Don't leave the context on the thread stack */
@@ -627,9 +788,11 @@ static size_t largest_size(cuda_context *ctx) {
    /* We guess that we can allocate at least a quarter of the free size
      in a single block. This might be wrong though. */
   sz /= 4;
+  ctx_lock((gpucontext *)ctx);
   for (temp = ctx->freeblocks; temp; temp = temp->next) {
     if (temp->sz > sz) sz = temp->sz;
   }
+  ctx_unlock((gpucontext *)ctx);
   return sz;
 }
 
@@ -637,6 +800,8 @@ static size_t largest_size(cuda_context *ctx) {
  * Allocate a new block and place in on the freelist. Will allocate
  * the bigger of the requested size and BLOCK_SIZE to avoid allocating
  * multiple small blocks.
+ *
+ * This and extract() must be called with the context lock held.
  */
 static int allocate(cuda_context *ctx, gpudata **res, gpudata **prev,
                     size_t size) {
@@ -756,6 +921,7 @@ static gpudata *cuda_alloc(gpucontext *c, size_t size, void *data, int flags) {
    * to a multiple of FRAG_SIZE.  This also ensures that if we split a
    * block, the next block starts properly aligned for any data type.
    */
+  ctx_lock(c);
   if (ctx->max_cache_size != 0) {
     asize = roundup(size, FRAG_SIZE);
     find_best(ctx, &res, &prev, asize);
@@ -763,16 +929,17 @@ static gpudata *cuda_alloc(gpucontext *c, size_t size, void *data, int flags) {
     asize = size;
   }
 
-  if (res == NULL && allocate(ctx, &res, &prev, asize) != GA_NO_ERROR)
-    return NULL;
-
-  if (extract(res, prev, asize) != GA_NO_ERROR)
+  if ((res == NULL && allocate(ctx, &res, &prev, asize) != GA_NO_ERROR) ||
+      extract(res, prev, asize) != GA_NO_ERROR) {
+    ctx_unlock(c);
     return NULL;
+  }
 
   /* It's out of the freelist, so add a ref */
   res->ctx->refcnt++;
   /* We consider this buffer allocated and ready to go */
   res->refcnt = 1;
+  ctx_unlock(c);
 
   if (flags & GA_BUFFER_INIT) {
     if (cuda_write(res, 0, data, size) != GA_NO_ERROR) {
@@ -793,6 +960,24 @@ int cuda_get_ipc_handle(gpudata *d, GpuArrayIpcMemHandle *h) {
   return GA_NO_ERROR;
 }
 
+/*
+ * IPC handles refer to a whole device allocation, but buffers from
+ * the cache are usually in the middle of one.  This returns the
+ * handle of the enclosing allocation with the offset of the buffer
+ * in it and the size of the allocation.
+ */
+int cuda_get_ipc_range(gpudata *d, GpuArrayIpcMemHandle *h, size_t *off,
+                       size_t *sz) {
+  CUdeviceptr base;
+  ASSERT_BUF(d);
+  cuda_enter(d->ctx);
+  CUDA_EXIT_ON_ERROR(d->ctx, cuMemGetAddressRange(&base, sz, d->ptr));
+  CUDA_EXIT_ON_ERROR(d->ctx, cuIpcGetMemHandle((CUipcMemHandle *)h, base));
+  cuda_exit(d->ctx);
+  *off = d->ptr - base;
+  return GA_NO_ERROR;
+}
+
 gpudata *cuda_open_ipc_handle(gpucontext *c, GpuArrayIpcMemHandle *h, size_t sz) {
   CUdeviceptr p;
   cuda_context *ctx = (cuda_context *)c;
@@ -810,18 +995,25 @@ gpudata *cuda_open_ipc_handle(gpucontext *c, GpuArrayIpcMemHandle *h, size_t sz)
   d = cuda_make_buf(ctx, p, sz);
   if (d != NULL)
     d->flags |= CUDA_IPC_MEMORY;
+  else
+    cuIpcCloseMemHandle(p);
+  cuda_exit(ctx);
   return d;
 }
 
 static void cuda_retain(gpudata *d) {
   ASSERT_BUF(d);
+  ctx_lock((gpucontext *)d->ctx);
   d->refcnt++;
+  ctx_unlock((gpucontext *)d->ctx);
 }
 
 static void deallocate(gpudata *d) {
   cuda_enter(d->ctx);
   cuEventDestroy(d->rev);
   cuEventDestroy(d->wev);
+  if (d->cev != NULL)
+    cuEventDestroy(d->cev);
   cuda_exit(d->ctx);
   CLEAR(d);
   free(d);
@@ -829,12 +1021,16 @@ static void deallocate(gpudata *d) {
 
 static void cuda_free(gpudata *d) {
   /* We ignore errors on free */
+  cuda_context *ctx;
   ASSERT_BUF(d);
+  /* Keep a reference to the context since we may deallocate the
+   * gpudata object */
+  ctx = d->ctx;
+  ctx_lock((gpucontext *)ctx);
   d->refcnt--;
-  if (d->refcnt == 0) {
-    /* Keep a reference to the context since we deallocate the gpudata
-     * object */
-    cuda_context *ctx = d->ctx;
+  if (d->refcnt != 0) {
+    ctx_unlock((gpucontext *)ctx);
+  } else {
     if (d->flags & DONTFREE) {
       /* This is the path for "external" buffers */
       deallocate(d);
@@ -880,6 +1076,7 @@ static void cuda_free(gpudata *d) {
         d->next = next;
       }
     }
+    ctx_unlock((gpucontext *)ctx);
     /* We keep this at the end since the freed buffer could be the
      * last reference to the context and therefore clearing the
      * reference could trigger the freeing if the whole context
@@ -896,7 +1093,7 @@ static int cuda_share(gpudata *a, gpudata *b) {
            (b->ptr <= a->ptr && b->ptr + b->sz > a->ptr)));
 }
 
-static int cuda_waits(gpudata *a, int flags, CUstream s) {
+int cuda_waits(gpudata *a, int flags, CUstream s) {
   ASSERT_BUF(a);
 
   /* Never skip the wait if CUDA_WAIT_FORCE */
@@ -904,6 +1101,15 @@ static int cuda_waits(gpudata *a, int flags, CUstream s) {
     if (ISSET(a->ctx->flags, GA_CTX_SINGLE_STREAM))
       return GA_NO_ERROR;
 
+    /* Later reads on other streams overwrite rev and ls, so a write
+     * has to wait for the last side stream use on its own. */
+    if (ISSET(flags, CUDA_WAIT_WRITE) && a->cs != NULL && a->cs != s &&
+        a->ls != a->cs) {
+      cuda_enter(a->ctx);
+      CUDA_EXIT_ON_ERROR(a->ctx, cuStreamWaitEvent(s, a->cev, 0));
+      cuda_exit(a->ctx);
+    }
+
     /* If the last stream to touch this buffer is the same, we don't
      * need to wait for anything. */
     if (a->ls == s)
@@ -926,7 +1132,7 @@ int cuda_wait(gpudata *a, int flags) {
   return cuda_waits(a, flags, a->ctx->s);
 }
 
-static int cuda_records(gpudata *a, int flags, CUstream s) {
+int cuda_records(gpudata *a, int flags, CUstream s) {
   ASSERT_BUF(a);
   if (ISCLR(flags, CUDA_WAIT_FORCE) &&
       ISSET(a->ctx->flags, GA_CTX_SINGLE_STREAM))
@@ -936,6 +1142,16 @@ static int cuda_records(gpudata *a, int flags, CUstream s) {
     CUDA_EXIT_ON_ERROR(a->ctx, cuEventRecord(a->rev, s));
   if (ISSET(flags, CUDA_WAIT_WRITE))
     CUDA_EXIT_ON_ERROR(a->ctx, cuEventRecord(a->wev, s));
+  if (s != a->ctx->s && s != a->ctx->mem_s) {
+    if (a->cev == NULL) {
+      int fl = CU_EVENT_DISABLE_TIMING;
+      if (a->ctx->flags & GA_CTX_MULTI_THREAD)
+        fl |= CU_EVENT_BLOCKING_SYNC;
+      CUDA_EXIT_ON_ERROR(a->ctx, cuEventCreate(&a->cev, fl));
+    }
+    CUDA_EXIT_ON_ERROR(a->ctx, cuEventRecord(a->cev, s));
+    a->cs = s;
+  }
   cuda_exit(a->ctx);
   a->ls = s;
   return GA_NO_ERROR;
@@ -945,6 +1161,28 @@ int cuda_record(gpudata *a, int flags) {
   return cuda_records(a, flags, a->ctx->s);
 }
 
+/*
+ * These two are for sharing buffers with code that runs on streams
+ * we don't manage.  They always go through the events, even in
+ * single stream mode.
+ */
+
+/* Make the foreign stream `s` wait for the pending work on `a` */
+int cuda_wait_stream(gpudata *a, int flags, CUstream s) {
+  ASSERT_BUF(a);
+  /* The events are not kept up to date in single stream mode */
+  if (ISSET(a->ctx->flags, GA_CTX_SINGLE_STREAM))
+    GA_CHECK(cuda_records(a, flags|CUDA_WAIT_FORCE, a->ctx->s));
+  return cuda_waits(a, flags|CUDA_WAIT_FORCE, s);
+}
+
+/* Mark `a` as used on the foreign stream `s` and make ours wait for it */
+int cuda_record_stream(gpudata *a, int flags, CUstream s) {
+  ASSERT_BUF(a);
+  GA_CHECK(cuda_records(a, flags|CUDA_WAIT_FORCE, s));
+  return cuda_waits(a, flags|CUDA_WAIT_FORCE, a->ctx->s);
+}
+
 static int cuda_move(gpudata *dst, size_t dstoff, gpudata *src,
                      size_t srcoff, size_t sz) {
     cuda_context *ctx = dst->ctx;
@@ -1105,7 +1343,8 @@ static inline int error_nvrtc(error *e, const char *msg, nvrtcResult err) {
   return error_fmt(e, GA_IMPL_ERROR, "%s: %s", msg, nvrtcGetErrorString(err));
 }
 
-static int call_compiler(cuda_context *ctx, strb *src, strb *ptx, strb *log) {
+static int call_compiler(cuda_context *ctx, const char *arch, strb *src,
+                         strb *ptx, strb *log) {
   nvrtcProgram prog;
   size_t buflen;
   const char *heads[1] = {"cluda.h"};
@@ -1118,7 +1357,7 @@ static int call_compiler(cuda_context *ctx, strb *src, strb *ptx, strb *log) {
   };
   nvrtcResult err;
 
-  opts[1] = ctx->bin_id;
+  opts[1] = arch;
 
   hsrc[0] = cluda_cuda_h;
   err = nvrtcCreateProgram(&prog, src->s, NULL, 1, hsrc, heads);
@@ -1163,7 +1402,8 @@ static int call_compiler(cuda_context *ctx, strb *src, strb *ptx, strb *log) {
   return GA_NO_ERROR;
 }
 
-static int make_bin(cuda_context *ctx, const strb *ptx, strb *bin, strb *log) {
+static int make_bin(cuda_context *ctx, const char *arch, const strb *ptx,
+                    strb *bin, strb *log) {
   char info_log[2048] = "";
   char error_log[2048] = "";
   void *out;
@@ -1177,21 +1417,31 @@ static int make_bin(cuda_context *ctx, const strb *ptx, strb *bin, strb *log) {
     CU_JIT_LOG_VERBOSE,
     CU_JIT_GENERATE_DEBUG_INFO,
     CU_JIT_GENERATE_LINE_INFO,
+    CU_JIT_TARGET,
   };
   void *cujit_opt_vals[] = {
     (void *)sizeof(info_log), info_log,
     (void *)sizeof(error_log), error_log,
 #ifdef DEBUG
-    (void *)1, (void *)1, (void *)1
+    (void *)1, (void *)1, (void *)1,
 #else
-    (void *)0, (void *)0, (void *)0
+    (void *)0, (void *)0, (void *)0,
 #endif
+    NULL
   };
+  unsigned int nopts = sizeof(cujit_opts)/sizeof(cujit_opts[0]) - 1;
   CUresult err;
   int res = GA_NO_ERROR;
 
-  err = cuLinkCreate(sizeof(cujit_opts)/sizeof(cujit_opts[0]),
-                          cujit_opts, cujit_opt_vals, &st);
+  /* The values of CUjit_target are the compute capability (as in
+     compute_XY) */
+  if (strcmp(arch, ctx->bin_id) != 0) {
+    cujit_opt_vals[nopts] = (void *)(size_t)atoi(arch +
+                                                 sizeof(ARCH_PREFIX) - 1);
+    nopts++;
+  }
+
+  err = cuLinkCreate(nopts, cujit_opts, cujit_opt_vals, &st);
   if (err != CUDA_SUCCESS)
     return error_cuda(ctx->err, "cuLinkCreate", err);
   err = cuLinkAddData(st, CU_JIT_INPUT_PTX, ptx->s, ptx->l,
@@ -1216,11 +1466,107 @@ out:
   return res;
 }
 
+/* Make copies of `k` and `bin` that can be added to a cache */
+static int dup_entry(cuda_context *ctx, const disk_key *k, const strb *bin,
+                     disk_key **pk, strb **pbin) {
+  *pk = calloc(sizeof(disk_key), 1);
+  if (*pk == NULL)
+    return error_sys(ctx->err, "calloc");
+  memcpy(*pk, k, DISK_KEY_MM);
+  strb_appendb(&(*pk)->src, &k->src);
+  if (strb_error(&(*pk)->src)) {
+    disk_free((cache_key_t)*pk);
+    return error_sys(ctx->err, "strb_appendb");
+  }
+  *pbin = strb_alloc(bin->l);
+  if (*pbin == NULL) {
+    disk_free((cache_key_t)*pk);
+    return error_sys(ctx->err, "strb_alloc");
+  }
+  strb_appendb(*pbin, bin);
+  if (strb_error(*pbin)) {
+    disk_free((cache_key_t)*pk);
+    strb_free(*pbin);
+    return error_sys(ctx->err, "strb_appendb");
+  }
+  return GA_NO_ERROR;
+}
+
+static int shared_get(cuda_context *ctx, disk_key *k, strb *bin) {
+  strb *cbin;
+  int found = 0;
+
+  if (ISCLR(ctx->flags, CUDA_SHARED_BINS))
+    return 0;
+  ga_lock_acquire(&bin_lock);
+  if (bin_cache != NULL) {
+    cbin = cache_get(bin_cache, k);
+    if (cbin != NULL) {
+      strb_appendb(bin, cbin);
+      found = 1;
+    }
+  }
+  ga_lock_release(&bin_lock);
+  return found;
+}
+
+static void shared_add(cuda_context *ctx, disk_key *k, strb *bin) {
+  disk_key *pk;
+  strb *cbin;
+
+  if (ISCLR(ctx->flags, CUDA_SHARED_BINS) || bin_cache == NULL)
+    return;
+  if (dup_entry(ctx, k, bin, &pk, &cbin) != GA_NO_ERROR)
+    return;
+  ga_lock_acquire(&bin_lock);
+  if (cache_add(bin_cache, pk, cbin) != 0) {
+    disk_free((cache_key_t)pk);
+    strb_free(cbin);
+  }
+  ga_lock_release(&bin_lock);
+}
+
+static ga_shmidx *open_disk_idx(const char *cache_path) {
+  strb path = STRB_STATIC_INIT;
+  ga_shmidx *res;
+
+  strb_appends(&path, cache_path);
+  if (path.l != 0 && path.s[path.l - 1] != '/')
+    strb_appendc(&path, '/');
+  strb_appends(&path, "index");
+  strb_append0(&path);
+  if (strb_error(&path))
+    return NULL;
+  res = ga_shmidx_open(path.s);
+  strb_clear(&path);
+  return res;
+}
+
+static uint64_t disk_idx_hash(disk_key *k) {
+  uint64_t h = ((uint64_t)disk_hash(k) << 32) |
+    XXH32(k->src.s, k->src.l, 43);
+  return h == 0 ? 1 : h;
+}
+
+static int disk_lookup(cuda_context *ctx, disk_key *k, strb *bin) {
+  strb *cbin;
+
+  ctx_lock((gpucontext *)ctx);
+  cbin = cache_get(ctx->disk_cache, k);
+  if (cbin != NULL)
+    strb_appendb(bin, cbin);
+  ctx_unlock((gpucontext *)ctx);
+  return cbin != NULL;
+}
+
 static int compile(cuda_context *ctx, strb *src, strb* bin, strb *log) {
   strb ptx = STRB_STATIC_INIT;
   strb *cbin;
   disk_key k;
   disk_key *pk;
+  uint64_t h = 0;
+  int claim = GA_SHMIDX_BUILD;
+  int res;
 
   memset(&k, 0, sizeof(k));
   k.version = 0;
@@ -1232,67 +1578,123 @@ static int compile(cuda_context *ctx, strb *src, strb* bin, strb *log) {
   memcpy(k.bin_id, ctx->bin_id, 64);
   memcpy(&k.src, src, sizeof(strb));
 
-  // Look up the binary in the disk cache
-  if (ctx->disk_cache) {
-    cbin = cache_get(ctx->disk_cache, &k);
+  // Look up the binary in the preloaded bundle
+  if (ctx->bundle_cache) {
+    k.major = 0;
+    k.minor = 0;
+    ctx_lock((gpucontext *)ctx);
+    cbin = cache_get(ctx->bundle_cache, &k);
     if (cbin != NULL) {
       strb_appendb(bin, cbin);
+      ctx_unlock((gpucontext *)ctx);
       return GA_NO_ERROR;
     }
+    ctx_unlock((gpucontext *)ctx);
+    k.major = ctx->major;
+    k.minor = ctx->minor;
   }
 
-  GA_CHECK(call_compiler(ctx, src, &ptx, log));
-
-  GA_CHECK(make_bin(ctx, &ptx, bin, log));
-
-  strb_clear(&ptx);
+  // Look up the binary in the other contexts of the process
+  if (shared_get(ctx, &k, bin))
+    return GA_NO_ERROR;
 
+  // Look up the binary in the disk cache
   if (ctx->disk_cache) {
-    pk = calloc(sizeof(disk_key), 1);
-    if (pk == NULL) {
-      error_sys(ctx->err, "calloc");
-      fprintf(stderr, "Error adding kernel to disk cache: %s\n",
-              ctx->err->msg);
+    if (disk_lookup(ctx, &k, bin)) {
+      shared_add(ctx, &k, bin);
       return GA_NO_ERROR;
     }
-    memcpy(pk, &k, DISK_KEY_MM);
-    strb_appendb(&pk->src, src);
-    if (strb_error(&pk->src)) {
-      error_sys(ctx->err, "strb_appendb");
-      fprintf(stderr, "Error adding kernel to disk cache %s\n",
-              ctx->err->msg);
-      disk_free((cache_key_t)pk);
-      return GA_NO_ERROR;
+    // Wait if another process is compiling it
+    if (ctx->disk_idx) {
+      h = disk_idx_hash(&k);
+      claim = ga_shmidx_acquire(ctx->disk_idx, h, DISK_IDX_WAIT);
+      if (claim == GA_SHMIDX_READY) {
+        if (disk_lookup(ctx, &k, bin)) {
+          shared_add(ctx, &k, bin);
+          return GA_NO_ERROR;
+        }
+        claim = GA_SHMIDX_BUILD;
+      }
     }
-    cbin = strb_alloc(bin->l);
-    if (cbin == NULL) {
-      error_sys(ctx->err, "strb_alloc");
+  }
+
+  res = call_compiler(ctx, ctx->bin_id, src, &ptx, log);
+  if (res == GA_NO_ERROR)
+    res = make_bin(ctx, ctx->bin_id, &ptx, bin, log);
+  strb_clear(&ptx);
+  if (res != GA_NO_ERROR) {
+    if (claim == GA_SHMIDX_CLAIMED)
+      ga_shmidx_abandon(ctx->disk_idx, h);
+    return res;
+  }
+
+  if (ctx->disk_cache) {
+    if (dup_entry(ctx, &k, bin, &pk, &cbin) != GA_NO_ERROR) {
       fprintf(stderr, "Error adding kernel to disk cache: %s\n",
               ctx->err->msg);
-      disk_free((cache_key_t)pk);
-      return GA_NO_ERROR;
-    }
-    strb_appendb(cbin, bin);
-    if (strb_error(cbin)) {
-      error_sys(ctx->err, "strb_appendb");
-      fprintf(stderr, "Error adding kernel to disk cache %s\n",
-              ctx->err->msg);
-      disk_free((cache_key_t)pk);
-      strb_free(cbin);
-      return GA_NO_ERROR;
-    }
-    if (cache_add(ctx->disk_cache, pk, cbin)) {
-      // TODO use better error messages
-      fprintf(stderr, "Error adding kernel to disk cache\n");
+    } else {
+      ctx_lock((gpucontext *)ctx);
+      if (cache_add(ctx->disk_cache, pk, cbin)) {
+        // TODO use better error messages
+        fprintf(stderr, "Error adding kernel to disk cache\n");
+      }
+      ctx_unlock((gpucontext *)ctx);
     }
+    if (claim == GA_SHMIDX_CLAIMED)
+      ga_shmidx_publish(ctx->disk_idx, h);
   }
 
+  shared_add(ctx, &k, bin);
   return GA_NO_ERROR;
 }
 
+/*
+ * Compile `src` for `arch` without using the caches.  This is used to
+ * build kernel bundles.
+ */
+int cuda_bundle_compile(gpucontext *c, const char *arch, const strb *src,
+                        strb *bin, char **err_str) {
+  cuda_context *ctx = (cuda_context *)c;
+  strb csrc = STRB_STATIC_INIT;
+  strb ptx = STRB_STATIC_INIT;
+  strb log = STRB_STATIC_INIT;
+  int res;
+
+  if (strncmp(arch, ARCH_PREFIX, sizeof(ARCH_PREFIX) - 1) != 0 ||
+      strlen(arch) >= sizeof(ctx->bin_id))
+    return error_fmt(ctx->err, GA_VALUE_ERROR, "Invalid arch: %s", arch);
+
+  strb_appendb(&csrc, src);
+  strb_append0(&csrc);
+  if (strb_error(&csrc)) {
+    strb_clear(&csrc);
+    return error_sys(ctx->err, "strb");
+  }
+
+  cuda_enter(ctx);
+  res = call_compiler(ctx, arch, &csrc, &ptx, &log);
+  if (res == GA_NO_ERROR)
+    res = make_bin(ctx, arch, &ptx, bin, &log);
+  cuda_exit(ctx);
+  if (res == GA_NO_ERROR && strb_error(bin))
+    res = error_sys(ctx->err, "strb");
+  if (res != GA_NO_ERROR && err_str != NULL)
+    *err_str = strb_cstr(&log);
+  else
+    strb_clear(&log);
+  strb_clear(&ptx);
+  strb_clear(&csrc);
+  return res;
+}
+
 static void _cuda_freekernel(gpukernel *k) {
-  k->refcnt--;
-  if (k->refcnt == 0) {
+  unsigned int refcnt;
+  if (k->ctx != NULL)
+    ctx_lock((gpucontext *)k->ctx);
+  refcnt = --k->refcnt;
+  if (k->ctx != NULL)
+    ctx_unlock((gpucontext *)k->ctx);
+  if (refcnt == 0) {
     if (k->ctx != NULL) {
       cuda_enter(k->ctx);
       cuModuleUnload(k->m);
@@ -1337,8 +1739,10 @@ static int cuda_newkernel(gpukernel **k, gpucontext *c, unsigned int count,
       return error_cuda(ctx->err, "cuCtxGetDevice", err);
     }
 
-    if (get_cc(dev, &major, &minor, ctx->err) != GA_NO_ERROR)
+    if (get_cc(dev, &major, &minor, ctx->err) != GA_NO_ERROR) {
+      cuda_exit(ctx);
       return ctx->err->code;
+    }
 
     // GA_USE_SMALL will always work
     // GA_USE_HALF should always work
@@ -1377,13 +1781,17 @@ static int cuda_newkernel(gpukernel **k, gpucontext *c, unsigned int count,
     k_key.fname = fname;
     k_key.src = src;
 
+    ctx_lock(c);
     res = (gpukernel *)cache_get(ctx->kernel_cache, &k_key);
     if (res != NULL) {
       res->refcnt++;
+      ctx_unlock(c);
       strb_clear(&src);
+      cuda_exit(ctx);
       *k = res;
       return GA_NO_ERROR;
     }
+    ctx_unlock(c);
 
     if (compile(ctx, &src, &bin, &log) != GA_NO_ERROR) {
       if (err_str != NULL) {
@@ -1404,6 +1812,14 @@ static int cuda_newkernel(gpukernel **k, gpucontext *c, unsigned int count,
     }
     strb_clear(&log);
 
+    if (ctx->record_path != NULL) {
+      ctx_lock(c);
+      if (kernel_manifest_add(ctx->record_path, ctx->bin_id, fname, src.s,
+                              src.l - 1, flags, ctx->err) != GA_NO_ERROR)
+        fprintf(stderr, "Error recording kernel: %s\n", ctx->err->msg);
+      ctx_unlock(c);
+    }
+
     if (strb_error(&bin)) {
       strb_clear(&src);
       strb_clear(&bin);
@@ -1457,6 +1873,7 @@ static int cuda_newkernel(gpukernel **k, gpucontext *c, unsigned int count,
       return error_cuda(ctx->err, "cuModuleGetFunction", err);
     }
 
+    ctx_lock(c);
     res->ctx = ctx;
     ctx->refcnt++;
     cuda_exit(ctx);
@@ -1477,13 +1894,16 @@ static int cuda_newkernel(gpukernel **k, gpucontext *c, unsigned int count,
     } else {
       strb_clear(&src);
     }
+    ctx_unlock(c);
     *k = res;
     return GA_NO_ERROR;
 }
 
 static void cuda_retainkernel(gpukernel *k) {
   ASSERT_KER(k);
+  ctx_lock((gpucontext *)k->ctx);
   k->refcnt++;
+  ctx_unlock((gpucontext *)k->ctx);
 }
 
 static void cuda_freekernel(gpukernel *k) {
@@ -22,6 +22,9 @@
 
 extern gpuarray_blas_ops clblas_ops;
 extern gpuarray_blas_ops clblast_ops;
+#ifdef HAVE_HOST_COMM
+extern gpuarray_comm_ops host_comm_ops;
+#endif
 
 const gpuarray_buffer_ops opencl_ops;
 
@@ -33,6 +36,7 @@ static int cl_newkernel(gpukernel **k, gpucontext *ctx, unsigned int count,
                         const char **strings, const size_t *lengths,
                         const char *fname, unsigned int argcount,
                         const int *types, int flags, char **err_str);
+static const char *memset_src[4];
 static const char CL_CONTEXT_PREAMBLE[] =
 "-D __GA_WARP_SIZE=%lu";  // to be filled by cl_make_ctx()
 
@@ -121,7 +125,7 @@ cl_ctx *cl_make_ctx(cl_context ctx, gpucontext_props *p) {
   int64_t v = 0;
   int e = 0;
   size_t warp_size;
-  int ret;
+  int ret, i;
   const char dummy_kern[] = "__kernel void kdummy(__global float *f) { f[0] = 0; }\n";
   strb context_preamble = STRB_STATIC_INIT;
   const char *rlk[1];
@@ -170,16 +174,25 @@ cl_ctx *cl_make_ctx(cl_context ctx, gpucontext_props *p) {
 
   res->ctx = ctx;
   res->ops = &opencl_ops;
+  if (ga_lock_init(&res->lock)) {
+    error_set(global_err, GA_SYS_ERROR, "Could not create context lock");
+    free(res);
+    return NULL;
+  }
   if (error_alloc(&res->err)) {
     error_set(global_err, GA_SYS_ERROR, "Could not create error context");
+    ga_lock_destroy(&res->lock);
     free(res);
     return NULL;
   }
 
   res->refcnt = 1;
   res->exts = NULL;
+  memset(res->errkern, 0, sizeof(res->errkern));
+  res->errpending = 0;
   res->blas_handle = NULL;
   res->options = NULL;
+  res->memset_fp = NULL;
   res->q = clCreateCommandQueue(
     ctx, id,
     ISSET(p->flags, GA_CTX_SINGLE_STREAM) ? 0 : qprop&CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE,
@@ -187,6 +200,7 @@ cl_ctx *cl_make_ctx(cl_context ctx, gpucontext_props *p) {
   if (res->q == NULL) {
     error_cl(global_err, "clCreateCommandQueue", err);
     error_free(res->err);
+    ga_lock_destroy(&res->lock);
     free(res);
     return NULL;
   }
@@ -230,7 +244,21 @@ cl_ctx *cl_make_ctx(cl_context ctx, gpucontext_props *p) {
     res->blas_ops = NULL;
   }
 
+#ifdef HAVE_HOST_COMM
+  res->comm_ops = &host_comm_ops;
+#else
   res->comm_ops = NULL;
+#endif
+
+  /* The memset sources never change, so hash them only once */
+  res->memset_fp = calloc(4, sizeof(*res->memset_fp));
+  if (res->memset_fp == NULL) {
+    error_sys(res->err, "calloc");
+    goto fail;
+  }
+  for (i = 0; i < 4; i++)
+    gpukernel_fingerprint(&res->memset_fp[i], 1, &memset_src[i], NULL,
+                          "kmemset", 0);
 
   return res;
 
@@ -248,9 +276,13 @@ cl_command_queue cl_get_stream(gpucontext *ctx) {
 static void cl_free_ctx(cl_ctx *ctx) {
   ASSERT_CTX(ctx);
 
+  ctx_lock((gpucontext *)ctx);
   assert(ctx->refcnt != 0);
   ctx->refcnt--;
-  if (ctx->refcnt == 0) {
+  if (ctx->refcnt != 0) {
+    ctx_unlock((gpucontext *)ctx);
+  } else {
+    ctx_unlock((gpucontext *)ctx);
     if (ctx->errbuf != NULL) {
       ctx->refcnt = 2; /* Avoid recursive release */
       cl_release(ctx->errbuf);
@@ -259,7 +291,9 @@ static void cl_free_ctx(cl_ctx *ctx) {
     clReleaseContext(ctx->ctx);
     if (ctx->options != NULL)
       free(ctx->options);
+    free(ctx->memset_fp);
     error_free(ctx->err);
+    ga_lock_destroy(&ctx->lock);
     CLEAR(ctx);
     free(ctx);
   }
@@ -295,7 +329,9 @@ gpudata *cl_make_buf(gpucontext *c, cl_mem buf) {
     return NULL;
   }
   res->ctx = ctx;
+  ctx_lock(c);
   res->ctx->refcnt++;
+  ctx_unlock(c);
 
   TAG_BUF(res);
   return res;
@@ -533,7 +569,9 @@ static gpudata *cl_alloc(gpucontext *c, size_t size, void *data, int flags) {
   }
 
   res->ctx = ctx;
+  ctx_lock(c);
   ctx->refcnt++;
+  ctx_unlock(c);
 
   TAG_BUF(res);
   return res;
@@ -541,13 +579,18 @@ static gpudata *cl_alloc(gpucontext *c, size_t size, void *data, int flags) {
 
 static void cl_retain(gpudata *b) {
   ASSERT_BUF(b);
+  ctx_lock((gpucontext *)b->ctx);
   b->refcnt++;
+  ctx_unlock((gpucontext *)b->ctx);
 }
 
 static void cl_release(gpudata *b) {
+  unsigned int refcnt;
   ASSERT_BUF(b);
-  b->refcnt--;
-  if (b->refcnt == 0) {
+  ctx_lock((gpucontext *)b->ctx);
+  refcnt = --b->refcnt;
+  ctx_unlock((gpucontext *)b->ctx);
+  if (refcnt == 0) {
     CLEAR(b);
     clReleaseMemObject(b->buf);
     if (b->ev != NULL)
@@ -681,20 +724,42 @@ static int cl_write(gpudata *dst, size_t dstoff, const void *src, size_t sz) {
   return GA_NO_ERROR;
 }
 
+/*
+ * The memset kernels take the offset, size and pattern as arguments so
+ * that they are only built once per context.
+ */
+static const char *memset_src[4] = {
+  "__kernel void kmemset(__global uint4 *mem, ulong off, ulong n, uint p) {"
+  "ulong i; mem = (__global uint4 *)((__global char *)mem + off);"
+  "for (i = get_global_id(0); i < n; i += get_global_size(0))"
+  " mem[i] = (uint4)(p, p, p, p); }",
+  "__kernel void kmemset(__global uint2 *mem, ulong off, ulong n, uint p) {"
+  "ulong i; mem = (__global uint2 *)((__global char *)mem + off);"
+  "for (i = get_global_id(0); i < n; i += get_global_size(0))"
+  " mem[i] = (uint2)(p, p); }",
+  "__kernel void kmemset(__global uint *mem, ulong off, ulong n, uint p) {"
+  "ulong i; mem = (__global uint *)((__global char *)mem + off);"
+  "for (i = get_global_id(0); i < n; i += get_global_size(0))"
+  " mem[i] = p; }",
+  "__kernel void kmemset(__global uchar *mem, ulong off, ulong n, uint p) {"
+  "ulong i; mem += off;"
+  "for (i = get_global_id(0); i < n; i += get_global_size(0))"
+  " mem[i] = (uchar)p; }",
+};
+
 static int cl_memset(gpudata *dst, size_t offset, int data) {
-  char local_kern[256];
+  static const int types[4] = {GA_BUFFER, GA_SIZE, GA_SIZE, GA_UINT};
   cl_ctx *ctx = dst->ctx;
-  const char *rlk[1];
-  void *args[1];
-  size_t sz, bytes, n, ls, gs;
+  void *args[4];
+  size_t bytes, n, ls, gs;
   gpukernel *m;
   cl_mem_flags fl;
-  int type;
-  int r, res;
+  cl_uint pattern;
+  int r, res, kind;
 
   unsigned char val = (unsigned char)data;
-  cl_uint pattern = (cl_uint)val & (cl_uint)val >> 8 & \
-    (cl_uint)val >> 16 & (cl_uint)val >> 24;
+  pattern = (cl_uint)val | (cl_uint)val << 8 | (cl_uint)val << 16 |
+    (cl_uint)val << 24;
 
   ASSERT_BUF(dst);
   ASSERT_CTX(ctx);
@@ -713,52 +778,24 @@ static int cl_memset(gpudata *dst, size_t offset, int data) {
   if (bytes == 0) return GA_NO_ERROR;
 
   if ((bytes % 16) == 0) {
+    kind = 0;
     n = bytes/16;
-    r = snprintf(local_kern, sizeof(local_kern),
-                 "__kernel void kmemset(__global uint4 *mem) {"
-                 "unsigned int i; __global char *tmp = (__global char *)mem;"
-                 "tmp += %" SPREFIX "u; mem = (__global uint4 *)tmp;"
-                 "for (i = get_global_id(0); i < %" SPREFIX "u; "
-                 "i += get_global_size(0)) {mem[i] = (uint4)(%u,%u,%u,%u); }}",
-                 offset, n, pattern, pattern, pattern, pattern);
   } else if ((bytes % 8) == 0) {
+    kind = 1;
     n = bytes/8;
-    r = snprintf(local_kern, sizeof(local_kern),
-                 "__kernel void kmemset(__global uint2 *mem) {"
-                 "unsigned int i; __global char *tmp = (__global char *)mem;"
-                 "tmp += %" SPREFIX "u; mem = (__global uint2 *)tmp;"
-                 "for (i = get_global_id(0); i < %" SPREFIX "u;"
-                 "i += get_global_size(0)) {mem[i] = (uint2)(%u,%u); }}",
-                 offset, n, pattern, pattern);
   } else if ((bytes % 4) == 0) {
+    kind = 2;
     n = bytes/4;
-    r = snprintf(local_kern, sizeof(local_kern),
-                 "__kernel void kmemset(__global unsigned int *mem) {"
-                 "unsigned int i; __global char *tmp = (__global char *)mem;"
-                 "tmp += %" SPREFIX "u; mem = (__global unsigned int *)tmp;"
-                 "for (i = get_global_id(0); i < %" SPREFIX "u;"
-                 "i += get_global_size(0)) {mem[i] = %u; }}",
-                 offset, n, pattern);
   } else {
     GA_CHECK(check_ext(ctx, CL_SMALL));
+    kind = 3;
     n = bytes;
-    r = snprintf(local_kern, sizeof(local_kern),
-                 "__kernel void kmemset(__global unsigned char *mem) {"
-                 "unsigned int i; mem += %" SPREFIX "u;"
-                 "for (i = get_global_id(0); i < %" SPREFIX "u;"
-                 "i += get_global_size(0)) {mem[i] = %u; }}",
-                 offset, n, val);
-  }
-  /* If this assert fires, increase the size of local_kern above. */
-  assert(r <= (int)sizeof(local_kern));
-  _unused(r);
-
-  sz = strlen(local_kern);
-  rlk[0] = local_kern;
-  type = GA_BUFFER;
-
-  r = cl_newkernel(&m, (gpucontext *)ctx, 1, rlk, &sz, "kmemset", 1, &type, 0, NULL);
-  if (r != GA_NO_ERROR)
+  }
+
+  m = gpukernel_init_fp((gpucontext *)ctx, &ctx->memset_fp[kind], 1,
+                        &memset_src[kind], NULL, "kmemset", 4, types, 0, &r,
+                        NULL);
+  if (m == NULL)
     return r;
 
   /* Cheap kernel scheduling */
@@ -766,6 +803,9 @@ static int cl_memset(gpudata *dst, size_t offset, int data) {
   if (res != GA_NO_ERROR) goto fail;
   gs = ((n-1) / ls) + 1;
   args[0] = dst;
+  args[1] = &offset;
+  args[2] = &n;
+  args[3] = &pattern;
   res = cl_callkernel(m, 1, &gs, &ls, 0, args);
 
  fail:
@@ -934,7 +974,9 @@ static int cl_newkernel(gpukernel **k, gpucontext *c, unsigned int count,
   res->types = NULL;  /* This avoids a crash in cl_releasekernel */
   res->evr = NULL;   /* This avoids a crash in cl_releasekernel */
   res->ctx = ctx;
+  ctx_lock(c);
   ctx->refcnt++;
+  ctx_unlock(c);
   clReleaseProgram(p);
   TAG_KER(res);
   if (err != CL_SUCCESS) {
@@ -960,14 +1002,19 @@ static int cl_newkernel(gpukernel **k, gpucontext *c, unsigned int count,
 
 static void cl_retainkernel(gpukernel *k) {
   ASSERT_KER(k);
+  ctx_lock((gpucontext *)k->ctx);
   k->refcnt++;
+  ctx_unlock((gpucontext *)k->ctx);
 }
 
 static void cl_releasekernel(gpukernel *k) {
+  unsigned int refcnt;
   ASSERT_KER(k);
 
-  k->refcnt--;
-  if (k->refcnt == 0) {
+  ctx_lock((gpucontext *)k->ctx);
+  refcnt = --k->refcnt;
+  ctx_unlock((gpucontext *)k->ctx);
+  if (refcnt == 0) {
     CLEAR(k);
     if (k->ev != NULL) clReleaseEvent(k->ev);
     if (k->k) clReleaseKernel(k->k);
@@ -1006,9 +1053,9 @@ static int cl_setkernelarg(gpukernel *k, unsigned int i, void *a) {
   return GA_NO_ERROR;
 }
 
-static int cl_callkernel(gpukernel *k, unsigned int n,
-                         const size_t *gs, const size_t *ls,
-                         size_t shared, void **args) {
+static int _cl_callkernel(gpukernel *k, unsigned int n,
+                          const size_t *gs, const size_t *ls,
+                          size_t shared, void **args) {
   cl_ctx *ctx = k->ctx;
   size_t _gs[3];
   cl_event ev;
@@ -1084,6 +1131,22 @@ static int cl_callkernel(gpukernel *k, unsigned int n,
   return GA_NO_ERROR;
 }
 
+/*
+ * Kernel arguments are set on the cl_kernel object itself so the
+ * setup and the enqueue have to happen under the context lock.
+ */
+static int cl_callkernel(gpukernel *k, unsigned int n,
+                         const size_t *gs, const size_t *ls,
+                         size_t shared, void **args) {
+  int err;
+
+  ASSERT_KER(k);
+  ctx_lock((gpucontext *)k->ctx);
+  err = _cl_callkernel(k, n, gs, ls, shared, args);
+  ctx_unlock((gpucontext *)k->ctx);
+  return err;
+}
+
 static int cl_sync(gpudata *b) {
   cl_ctx *ctx = (cl_ctx *)b->ctx;
 
@@ -0,0 +1,405 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpuarray/error.h"
+
+#include "util/error.h"
+#include "util/strb.h"
+#include "util/xxhash.h"
+#include "private.h"
+
+extern const gpuarray_buffer_ops cuda_ops;
+
+/*
+ * Kernel manifests and bundles.
+ *
+ * A manifest lists the kernel sources a program compiled.  Records
+ * are appended as kernels are built, so several runs can share one
+ * file (duplicates are removed when building the bundle).  A bundle
+ * holds the binaries built from manifests for a set of
+ * architectures.
+ *
+ * All integers are stored little-endian.
+ *
+ * manifest record:
+ *   "GAKM" flags:u32 bin_id_len:u32 fname_len:u32 src_len:u64
+ *   bin_id fname src
+ *
+ * bundle:
+ *   "GABUNDLE" version:u32 count:u32
+ *   count * (bin_id_len:u32 flags:u32 src_len:u64 bin_len:u64
+ *            bin_id src bin)
+ */
+
+#define MANIFEST_MAGIC "GAKM"
+#define BUNDLE_MAGIC "GABUNDLE"
+#define BUNDLE_VERSION 1
+
+static void put32(strb *sb, uint32_t v) {
+  char b[4];
+  b[0] = v & 0xff;
+  b[1] = (v >> 8) & 0xff;
+  b[2] = (v >> 16) & 0xff;
+  b[3] = (v >> 24) & 0xff;
+  strb_appendn(sb, b, 4);
+}
+
+static void put64(strb *sb, uint64_t v) {
+  put32(sb, (uint32_t)(v & 0xffffffff));
+  put32(sb, (uint32_t)(v >> 32));
+}
+
+static int get32(FILE *f, uint32_t *v) {
+  unsigned char b[4];
+  if (fread(b, 1, 4, f) != 4)
+    return -1;
+  *v = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) |
+    ((uint32_t)b[3] << 24);
+  return 0;
+}
+
+static int get64(FILE *f, uint64_t *v) {
+  uint32_t lo, hi;
+  if (get32(f, &lo) || get32(f, &hi))
+    return -1;
+  *v = (uint64_t)lo | ((uint64_t)hi << 32);
+  return 0;
+}
+
+/* Read `l` bytes from `f` into `sb` (replacing its content) */
+static int get_bytes(FILE *f, strb *sb, uint64_t l) {
+  sb->l = 0;
+  if ((size_t)l != l || strb_ensure(sb, (size_t)l))
+    return -1;
+  if (fread(sb->s, 1, (size_t)l, f) != (size_t)l)
+    return -1;
+  sb->l = (size_t)l;
+  return 0;
+}
+
+static int write_all(const char *path, const char *mode, const strb *sb,
+                     error *e) {
+  FILE *f = fopen(path, mode);
+  if (f == NULL)
+    return error_fmt(e, GA_SYS_ERROR, "Could not open %s: %s", path,
+                     strerror(errno));
+  if (fwrite(sb->s, 1, sb->l, f) != sb->l) {
+    fclose(f);
+    return error_fmt(e, GA_SYS_ERROR, "Could not write to %s", path);
+  }
+  if (fclose(f) != 0)
+    return error_fmt(e, GA_SYS_ERROR, "Could not write to %s", path);
+  return GA_NO_ERROR;
+}
+
+int kernel_manifest_add(const char *path, const char *bin_id,
+                        const char *fname, const char *src, size_t src_len,
+                        int flags, error *e) {
+  strb sb = STRB_STATIC_INIT;
+  int res;
+
+  strb_appendn(&sb, MANIFEST_MAGIC, 4);
+  put32(&sb, (uint32_t)flags);
+  put32(&sb, (uint32_t)strlen(bin_id));
+  put32(&sb, (uint32_t)strlen(fname));
+  put64(&sb, src_len);
+  strb_appends(&sb, bin_id);
+  strb_appends(&sb, fname);
+  strb_appendn(&sb, src, src_len);
+  if (strb_error(&sb)) {
+    strb_clear(&sb);
+    return error_sys(e, "strb");
+  }
+  /* One write per record so that concurrent writers don't mix their
+     records in append mode. */
+  res = write_all(path, "ab", &sb, e);
+  strb_clear(&sb);
+  return res;
+}
+
+int kernel_manifest_read(const char *path, manifest_fn fn, void *arg,
+                         error *e) {
+  FILE *f;
+  char magic[4];
+  strb bin_id = STRB_STATIC_INIT;
+  strb fname = STRB_STATIC_INIT;
+  strb src = STRB_STATIC_INIT;
+  uint32_t flags, bl, fl;
+  uint64_t sl;
+  size_t n;
+  int res = GA_NO_ERROR;
+
+  f = fopen(path, "rb");
+  if (f == NULL)
+    return error_fmt(e, GA_SYS_ERROR, "Could not open %s: %s", path,
+                     strerror(errno));
+  while ((n = fread(magic, 1, 4, f)) == 4) {
+    if (memcmp(magic, MANIFEST_MAGIC, 4) != 0 || get32(f, &flags) ||
+        get32(f, &bl) || get32(f, &fl) || get64(f, &sl) ||
+        get_bytes(f, &bin_id, bl) || get_bytes(f, &fname, fl) ||
+        get_bytes(f, &src, sl)) {
+      res = error_fmt(e, GA_VALUE_ERROR, "Bad manifest record in %s", path);
+      break;
+    }
+    strb_append0(&bin_id);
+    strb_append0(&fname);
+    if (strb_error(&bin_id) || strb_error(&fname)) {
+      res = error_sys(e, "strb");
+      break;
+    }
+    res = fn(arg, bin_id.s, fname.s, &src, (int)flags);
+    if (res != GA_NO_ERROR)
+      break;
+  }
+  if (res == GA_NO_ERROR && n != 0)
+    res = error_fmt(e, GA_VALUE_ERROR, "Truncated manifest %s", path);
+  fclose(f);
+  strb_clear(&bin_id);
+  strb_clear(&fname);
+  strb_clear(&src);
+  return res;
+}
+
+void bundle_entry_clear(bundle_entry *ent) {
+  strb_clear(&ent->src);
+  strb_clear(&ent->bin);
+}
+
+int kernel_bundle_write(const char *path, const bundle_entry *ents,
+                        size_t n, error *e) {
+  strb sb = STRB_STATIC_INIT;
+  size_t i;
+  int res;
+
+  strb_appendn(&sb, BUNDLE_MAGIC, 8);
+  put32(&sb, BUNDLE_VERSION);
+  put32(&sb, (uint32_t)n);
+  for (i = 0; i < n; i++) {
+    put32(&sb, (uint32_t)strlen(ents[i].bin_id));
+    put32(&sb, (uint32_t)ents[i].flags);
+    put64(&sb, ents[i].src.l);
+    put64(&sb, ents[i].bin.l);
+    strb_appends(&sb, ents[i].bin_id);
+    strb_appendb(&sb, &ents[i].src);
+    strb_appendb(&sb, &ents[i].bin);
+  }
+  if (strb_error(&sb)) {
+    strb_clear(&sb);
+    return error_sys(e, "strb");
+  }
+  res = write_all(path, "wb", &sb, e);
+  strb_clear(&sb);
+  return res;
+}
+
+int kernel_bundle_read(const char *path, const char *bin_id,
+                       bundle_entry **_ents, size_t *_n, error *e) {
+  FILE *f;
+  char magic[8];
+  strb id = STRB_STATIC_INIT;
+  bundle_entry *ents = NULL;
+  uint32_t version, count, bl, flags, i;
+  uint64_t sl, cl;
+  size_t n = 0;
+  int res = GA_NO_ERROR;
+
+  f = fopen(path, "rb");
+  if (f == NULL)
+    return error_fmt(e, GA_SYS_ERROR, "Could not open %s: %s", path,
+                     strerror(errno));
+  if (fread(magic, 1, 8, f) != 8 || memcmp(magic, BUNDLE_MAGIC, 8) != 0 ||
+      get32(f, &version) || get32(f, &count)) {
+    fclose(f);
+    return error_fmt(e, GA_VALUE_ERROR, "%s is not a kernel bundle", path);
+  }
+  if (version != BUNDLE_VERSION) {
+    fclose(f);
+    return error_fmt(e, GA_UNSUPPORTED_ERROR,
+                     "Unsupported kernel bundle version %u in %s",
+                     version, path);
+  }
+  ents = calloc(count ? count : 1, sizeof(*ents));
+  if (ents == NULL) {
+    fclose(f);
+    return error_sys(e, "calloc");
+  }
+  for (i = 0; i < count; i++) {
+    if (get32(f, &bl) || get32(f, &flags) || get64(f, &sl) ||
+        get64(f, &cl) || bl >= sizeof(ents[n].bin_id) ||
+        get_bytes(f, &id, bl) || get_bytes(f, &ents[n].src, sl) ||
+        get_bytes(f, &ents[n].bin, cl)) {
+      bundle_entry_clear(&ents[n]);
+      res = error_fmt(e, GA_VALUE_ERROR, "Corrupted kernel bundle %s", path);
+      break;
+    }
+    memset(ents[n].bin_id, 0, sizeof(ents[n].bin_id));
+    memcpy(ents[n].bin_id, id.s, bl);
+    ents[n].flags = (int)flags;
+    if (bin_id != NULL && strcmp(ents[n].bin_id, bin_id) != 0) {
+      bundle_entry_clear(&ents[n]);
+      continue;
+    }
+    n++;
+  }
+  fclose(f);
+  strb_clear(&id);
+  if (res != GA_NO_ERROR) {
+    for (i = 0; i < n; i++)
+      bundle_entry_clear(&ents[i]);
+    free(ents);
+    return res;
+  }
+  *_ents = ents;
+  *_n = n;
+  return GA_NO_ERROR;
+}
+
+typedef struct _build_src {
+  uint32_t h;
+  char *fname;
+  strb src;
+} build_src;
+
+typedef struct _build_state {
+  build_src *srcs;
+  size_t nsrcs;
+  size_t asrcs;
+  char (*archs)[64];
+  unsigned int narchs;
+  unsigned int aarchs;
+  int want_archs;
+  error *e;
+} build_state;
+
+static int build_add(void *arg, const char *bin_id, const char *fname,
+                     const strb *src, int flags) {
+  build_state *st = (build_state *)arg;
+  uint32_t h = XXH32(src->s, src->l, 42);
+  size_t i;
+  void *tmp;
+
+  if (st->want_archs && strlen(bin_id) < sizeof(st->archs[0])) {
+    for (i = 0; i < st->narchs; i++)
+      if (strcmp(st->archs[i], bin_id) == 0)
+        break;
+    if (i == st->narchs) {
+      if (st->narchs == st->aarchs) {
+        tmp = realloc(st->archs, sizeof(*st->archs) * (st->aarchs * 2 + 4));
+        if (tmp == NULL)
+          return error_sys(st->e, "realloc");
+        st->archs = tmp;
+        st->aarchs = st->aarchs * 2 + 4;
+      }
+      strcpy(st->archs[st->narchs++], bin_id);
+    }
+  }
+
+  for (i = 0; i < st->nsrcs; i++)
+    if (st->srcs[i].h == h && st->srcs[i].src.l == src->l &&
+        memcmp(st->srcs[i].src.s, src->s, src->l) == 0)
+      return GA_NO_ERROR;
+
+  if (st->nsrcs == st->asrcs) {
+    tmp = realloc(st->srcs, sizeof(*st->srcs) * (st->asrcs * 2 + 16));
+    if (tmp == NULL)
+      return error_sys(st->e, "realloc");
+    st->srcs = tmp;
+    st->asrcs = st->asrcs * 2 + 16;
+  }
+  st->srcs[st->nsrcs].h = h;
+  st->srcs[st->nsrcs].fname = strdup(fname);
+  memset(&st->srcs[st->nsrcs].src, 0, sizeof(strb));
+  strb_appendb(&st->srcs[st->nsrcs].src, src);
+  if (st->srcs[st->nsrcs].fname == NULL ||
+      strb_error(&st->srcs[st->nsrcs].src)) {
+    free(st->srcs[st->nsrcs].fname);
+    strb_clear(&st->srcs[st->nsrcs].src);
+    return error_sys(st->e, "strdup");
+  }
+  st->nsrcs++;
+  return GA_NO_ERROR;
+}
+
+int gpukernel_bundle_build(gpucontext *ctx, unsigned int nmanifests,
+                           const char **manifests, const char *bundle,
+                           unsigned int narchs, const char **archs) {
+  build_state st;
+  bundle_entry *ents = NULL;
+  char *log = NULL;
+  size_t i, n = 0;
+  unsigned int j;
+  int res = GA_NO_ERROR;
+
+  if (ctx->ops != &cuda_ops)
+    return error_set(ctx->err, GA_DEVSUP_ERROR,
+                     "Kernel bundles are only supported with cuda");
+
+  memset(&st, 0, sizeof(st));
+  st.want_archs = (narchs == 0);
+  st.e = ctx->err;
+  for (j = 0; j < nmanifests; j++) {
+    res = kernel_manifest_read(manifests[j], build_add, &st, ctx->err);
+    if (res != GA_NO_ERROR)
+      goto out;
+  }
+  if (narchs == 0)
+    narchs = st.narchs;
+  if (narchs == 0 || st.nsrcs == 0) {
+    res = error_set(ctx->err, GA_VALUE_ERROR,
+                    "No kernels or architectures for the bundle");
+    goto out;
+  }
+
+  ents = calloc(st.nsrcs * narchs, sizeof(*ents));
+  if (ents == NULL) {
+    res = error_sys(ctx->err, "calloc");
+    goto out;
+  }
+  for (j = 0; j < narchs; j++) {
+    const char *arch = archs != NULL && st.want_archs == 0 ? archs[j] :
+      st.archs[j];
+    for (i = 0; i < st.nsrcs; i++, n++) {
+      if (strlen(arch) >= sizeof(ents[n].bin_id)) {
+        res = error_fmt(ctx->err, GA_VALUE_ERROR, "Invalid arch: %s", arch);
+        goto out;
+      }
+      strcpy(ents[n].bin_id, arch);
+#ifdef DEBUG
+      ents[n].flags = 1;
+#endif
+      strb_appendb(&ents[n].src, &st.srcs[i].src);
+      if (strb_error(&ents[n].src)) {
+        n++;
+        res = error_sys(ctx->err, "strb");
+        goto out;
+      }
+      res = cuda_bundle_compile(ctx, arch, &st.srcs[i].src, &ents[n].bin,
+                                &log);
+      if (res != GA_NO_ERROR) {
+        char *msg = strdup(ctx->err->msg);
+        n++;
+        res = error_fmt(ctx->err, res, "Could not compile %s for %s: %s\n%s",
+                        st.srcs[i].fname, arch, msg ? msg : "",
+                        log ? log : "");
+        free(msg);
+        goto out;
+      }
+    }
+  }
+  res = kernel_bundle_write(bundle, ents, n, ctx->err);
+
+ out:
+  free(log);
+  for (i = 0; i < n; i++)
+    bundle_entry_clear(&ents[i]);
+  free(ents);
+  for (i = 0; i < st.nsrcs; i++) {
+    free(st.srcs[i].fname);
+    strb_clear(&st.srcs[i].src);
+  }
+  free(st.srcs);
+  free(st.archs);
+  return res;
+}
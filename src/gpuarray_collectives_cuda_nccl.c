@@ -54,17 +54,42 @@ extern const gpuarray_buffer_ops cuda_ops;
 struct _gpucomm {
   cuda_context* ctx;  // Start after the context
   ncclComm_t c;
+  CUstream s;  // stream for the collectives, ctx->s in single stream mode
+  int group;   // nesting depth of gpucomm_group_start()
+  gpudata **pend;  // buffers to record at the end of the group
+  int *pendfl;
+  size_t npend;
+  size_t apend;
 #ifdef DEBUG
   char tag[8];
 #endif
 };
 
+extern gpuarray_comm_ops nccl_ops;
+#ifdef HAVE_HOST_COMM
+extern gpuarray_comm_ops host_comm_ops;
+#endif
+
 static int setup_done = 0;
 
-static int setup_lib(error *e) {
+/**
+ * \brief Load NCCL on first use.
+ *
+ * If it can't be loaded and the host backend is built, switch `ctx` over
+ * to it.  Callers must then forward to `ctx->comm_ops`.
+ */
+static int setup_lib(gpucontext *ctx) {
   if (setup_done)
     return GA_NO_ERROR;
-  GA_CHECK(load_libnccl(e));
+  if (load_libnccl(ctx->err) != GA_NO_ERROR) {
+#ifdef HAVE_HOST_COMM
+    /* Without nccl, go through host memory */
+    ctx->comm_ops = &host_comm_ops;
+    return GA_NO_ERROR;
+#else
+    return ctx->err->code;
+#endif
+  }
   setup_done = 1;
   return GA_NO_ERROR;
 }
@@ -73,6 +98,16 @@ static int setup_lib(error *e) {
  * \brief Helper function to dereference a `comm`'s context and free memory
  */
 static void comm_clear(gpucomm *comm) {
+  size_t i;
+  for (i = 0; i < comm->npend; i++)
+    gpudata_release(comm->pend[i]);
+  free(comm->pend);
+  free(comm->pendfl);
+  if (comm->s != NULL && comm->s != comm->ctx->s) {
+    cuda_enter(comm->ctx);
+    cuStreamDestroy(comm->s);
+    cuda_exit(comm->ctx);
+  }
   gpucontext_deref((gpucontext *)comm->ctx);
   CLEAR(comm);
   free(comm);
@@ -88,7 +123,9 @@ static int comm_new(gpucomm **comm_ptr, gpucontext *ctx,
 
   ASSERT_CTX(ctx);
 
-  GA_CHECK(setup_lib(ctx->err));
+  GA_CHECK(setup_lib(ctx));
+  if (ctx->comm_ops != &nccl_ops)
+    return ctx->comm_ops->comm_new(comm_ptr, ctx, comm_id, ndev, rank);
 
   comm = calloc(1, sizeof(*comm));  // Allocate memory
   if (comm == NULL) {
@@ -97,11 +134,28 @@ static int comm_new(gpucomm **comm_ptr, gpucontext *ctx,
   }
   comm->ctx = (cuda_context *)ctx;  // convert to underlying cuda context
   // So that context would not be destroyed before communicator
+  ctx_lock(ctx);
   comm->ctx->refcnt++;
+  ctx_unlock(ctx);
+  TAG_COMM(comm);
+  if (ISSET(ctx->flags, GA_CTX_SINGLE_STREAM)) {
+    comm->s = comm->ctx->s;
+  } else {
+    CUresult cerr;
+    cuda_enter(comm->ctx);
+    /* Same flags as the context streams */
+    cerr = cuStreamCreate(&comm->s, 0);
+    cuda_exit(comm->ctx);
+    if (cerr != CUDA_SUCCESS) {
+      *comm_ptr = NULL;
+      comm->s = NULL;
+      comm_clear(comm);
+      return error_cuda(ctx->err, "cuStreamCreate", cerr);
+    }
+  }
   cuda_enter(comm->ctx);  // Use device
   err = ncclCommInitRank(&comm->c, ndev, *((ncclUniqueId *)&comm_id), rank);
   cuda_exit(comm->ctx);
-  TAG_COMM(comm);
   if (err != ncclSuccess) {
     *comm_ptr = NULL;  // Set to NULL if failed
     comm_clear(comm);
@@ -128,7 +182,9 @@ static void comm_free(gpucomm *comm) {
 static int generate_clique_id(gpucontext *c, gpucommCliqueId *comm_id) {
   ASSERT_CTX(c);
 
-  GA_CHECK(setup_lib(c->err));
+  GA_CHECK(setup_lib(c));
+  if (c->comm_ops != &nccl_ops)
+    return c->comm_ops->generate_clique_id(c, comm_id);
   NCCL_CHKFAIL(c, ncclGetUniqueId((ncclUniqueId *)comm_id));
 }
 
@@ -230,6 +286,36 @@ static inline int check_restrictions(gpudata *src, size_t offsrc,
   return GA_NO_ERROR;
 }
 
+/**
+ * \brief Helper function to record the events of a buffer used by an
+ * operation on the communicator's stream.
+ *
+ * Inside a group, NCCL only enqueues the operations when the group
+ * ends, so the recording is deferred until then.
+ */
+static int comm_record(gpucomm *comm, gpudata *b, int flags) {
+  if (comm->group == 0)
+    return cuda_records(b, flags, comm->s);
+  if (comm->npend == comm->apend) {
+    size_t na = comm->apend == 0 ? 8 : comm->apend * 2;
+    gpudata **p = realloc(comm->pend, na * sizeof(*p));
+    int *f;
+    if (p == NULL)
+      return error_sys(comm->ctx->err, "realloc");
+    comm->pend = p;
+    f = realloc(comm->pendfl, na * sizeof(*f));
+    if (f == NULL)
+      return error_sys(comm->ctx->err, "realloc");
+    comm->pendfl = f;
+    comm->apend = na;
+  }
+  gpudata_retain(b);
+  comm->pend[comm->npend] = b;
+  comm->pendfl[comm->npend] = flags;
+  comm->npend++;
+  return GA_NO_ERROR;
+}
+
 /**
  * \brief NCCL implementation of \ref gpucomm_reduce.
  */
@@ -257,23 +343,23 @@ static int reduce(gpudata *src, size_t offsrc, gpudata *dest, size_t offdest,
   cuda_enter(ctx);
 
   // sync: wait till a write has finished (out of concurrent kernels)
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_wait(src, CUDA_WAIT_READ));
+  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_waits(src, CUDA_WAIT_READ, comm->s));
   // sync: wait till a read/write has finished (out of concurrent kernels)
   if (rank == root)
-    GA_CUDA_EXIT_ON_ERROR(ctx, cuda_wait(dest, CUDA_WAIT_WRITE));
+    GA_CUDA_EXIT_ON_ERROR(ctx, cuda_waits(dest, CUDA_WAIT_WRITE, comm->s));
 
-  // change stream of nccl ops to enable concurrency
+  // on the communicator's stream to overlap with compute on ctx->s
   if (rank == root)
     NCCL_EXIT_ON_ERROR(ctx, ncclReduce((void *)(src->ptr + offsrc),
                                        (void *)(dest->ptr + offdest), count,
-                                       datatype, op, root, comm->c, ctx->s));
+                                       datatype, op, root, comm->c, comm->s));
   else
     NCCL_EXIT_ON_ERROR(ctx, ncclReduce((void *)(src->ptr + offsrc), NULL, count,
-                                       datatype, op, root, comm->c, ctx->s));
+                                       datatype, op, root, comm->c, comm->s));
 
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_record(src, CUDA_WAIT_READ));
+  GA_CUDA_EXIT_ON_ERROR(ctx, comm_record(comm, src, CUDA_WAIT_READ));
   if (rank == root)
-    GA_CUDA_EXIT_ON_ERROR(ctx, cuda_record(dest, CUDA_WAIT_WRITE));
+    GA_CUDA_EXIT_ON_ERROR(ctx, comm_record(comm, dest, CUDA_WAIT_WRITE));
 
   cuda_exit(ctx);
 
@@ -301,17 +387,17 @@ static int all_reduce(gpudata *src, size_t offsrc, gpudata *dest,
   cuda_enter(ctx);
 
   // sync: wait till a write has finished (out of concurrent kernels)
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_wait(src, CUDA_WAIT_READ));
+  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_waits(src, CUDA_WAIT_READ, comm->s));
   // sync: wait till a read/write has finished (out of concurrent kernels)
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_wait(dest, CUDA_WAIT_WRITE));
+  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_waits(dest, CUDA_WAIT_WRITE, comm->s));
 
-  // change stream of nccl ops to enable concurrency
+  // on the communicator's stream to overlap with compute on ctx->s
   NCCL_EXIT_ON_ERROR(ctx, ncclAllReduce((void *)(src->ptr + offsrc),
                                         (void *)(dest->ptr + offdest), count,
-                                        datatype, op, comm->c, ctx->s));
+                                        datatype, op, comm->c, comm->s));
 
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_record(src, CUDA_WAIT_READ));
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_record(dest, CUDA_WAIT_WRITE));
+  GA_CUDA_EXIT_ON_ERROR(ctx, comm_record(comm, src, CUDA_WAIT_READ));
+  GA_CUDA_EXIT_ON_ERROR(ctx, comm_record(comm, dest, CUDA_WAIT_WRITE));
 
   cuda_exit(ctx);
 
@@ -348,17 +434,17 @@ static int reduce_scatter(gpudata *src, size_t offsrc, gpudata *dest,
   cuda_enter(ctx);
 
   // sync: wait till a write has finished (out of concurrent kernels)
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_wait(src, CUDA_WAIT_READ));
+  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_waits(src, CUDA_WAIT_READ, comm->s));
   // sync: wait till a read/write has finished (out of concurrent kernels)
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_wait(dest, CUDA_WAIT_WRITE));
+  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_waits(dest, CUDA_WAIT_WRITE, comm->s));
 
-  // change stream of nccl ops to enable concurrency
+  // on the communicator's stream to overlap with compute on ctx->s
   NCCL_EXIT_ON_ERROR(ctx, ncclReduceScatter((void *)(src->ptr + offsrc),
                                             (void *)(dest->ptr + offdest), count,
-                                            datatype, op, comm->c, ctx->s));
+                                            datatype, op, comm->c, comm->s));
 
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_record(src, CUDA_WAIT_READ));
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_record(dest, CUDA_WAIT_WRITE));
+  GA_CUDA_EXIT_ON_ERROR(ctx, comm_record(comm, src, CUDA_WAIT_READ));
+  GA_CUDA_EXIT_ON_ERROR(ctx, comm_record(comm, dest, CUDA_WAIT_WRITE));
 
   cuda_exit(ctx);
 
@@ -386,18 +472,18 @@ static int broadcast(gpudata *array, size_t offset, size_t count, int typecode,
 
   // sync: wait till a write has finished (out of concurrent kernels)
   if (rank == root)
-    GA_CUDA_EXIT_ON_ERROR(ctx, cuda_wait(array, CUDA_WAIT_READ));
+    GA_CUDA_EXIT_ON_ERROR(ctx, cuda_waits(array, CUDA_WAIT_READ, comm->s));
   else
-    GA_CUDA_EXIT_ON_ERROR(ctx, cuda_wait(array, CUDA_WAIT_WRITE));
+    GA_CUDA_EXIT_ON_ERROR(ctx, cuda_waits(array, CUDA_WAIT_WRITE, comm->s));
 
-  // change stream of nccl ops to enable concurrency
+  // on the communicator's stream to overlap with compute on ctx->s
   NCCL_EXIT_ON_ERROR(ctx, ncclBcast((void *)(array->ptr + offset), count,
-                                    datatype, root, comm->c, ctx->s));
+                                    datatype, root, comm->c, comm->s));
 
   if (rank == root)
-    GA_CUDA_EXIT_ON_ERROR(ctx, cuda_record(array, CUDA_WAIT_READ));
+    GA_CUDA_EXIT_ON_ERROR(ctx, comm_record(comm, array, CUDA_WAIT_READ));
   else
-    GA_CUDA_EXIT_ON_ERROR(ctx, cuda_record(array, CUDA_WAIT_WRITE));
+    GA_CUDA_EXIT_ON_ERROR(ctx, comm_record(comm, array, CUDA_WAIT_WRITE));
 
   cuda_exit(ctx);
 
@@ -433,23 +519,211 @@ static int all_gather(gpudata *src, size_t offsrc, gpudata *dest,
   cuda_enter(ctx);
 
   // sync: wait till a write has finished (out of concurrent kernels)
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_wait(src, CUDA_WAIT_READ));
+  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_waits(src, CUDA_WAIT_READ, comm->s));
   // sync: wait till a read/write has finished (out of concurrent kernels)
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_wait(dest, CUDA_WAIT_WRITE));
+  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_waits(dest, CUDA_WAIT_WRITE, comm->s));
 
-  // change stream of nccl ops to enable concurrency
+  // on the communicator's stream to overlap with compute on ctx->s
   NCCL_EXIT_ON_ERROR(
       ctx, ncclAllGather((void *)(src->ptr + offsrc),
-			 (void *)(dest->ptr + offdest), count, datatype, comm->c, ctx->s));
+			 (void *)(dest->ptr + offdest), count, datatype, comm->c, comm->s));
+
+  GA_CUDA_EXIT_ON_ERROR(ctx, comm_record(comm, src, CUDA_WAIT_READ));
+  GA_CUDA_EXIT_ON_ERROR(ctx, comm_record(comm, dest, CUDA_WAIT_WRITE));
+
+  cuda_exit(ctx);
+
+  return GA_NO_ERROR;
+}
+
+/**
+ * \brief Helper function to check the arguments of point-to-point
+ * operations.
+ */
+static int check_p2p(gpudata *buf, size_t off, size_t count, int typecode,
+                     int peer, gpucomm *comm, size_t *sz) {
+  int ndev = 0;
+  if (ncclSend == NULL || ncclRecv == NULL)
+    return error_set(comm->ctx->err, GA_UNSUPPORTED_ERROR,
+                     "Point-to-point operations require NCCL 2.7");
+  if (buf->ctx != comm->ctx)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "buffer and comm context differ");
+  GA_CHECK(get_count(comm, &ndev));
+  if (peer < 0 || peer >= ndev)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "Invalid peer");
+  if (gpuarray_get_type(typecode) == NULL)
+    return error_set(comm->ctx->err, GA_INVALID_ERROR, "Invalid data type");
+  // Sent as bytes, so any type works
+  *sz = count * gpuarray_get_elsize(typecode);
+  if (off > buf->sz || (buf->sz - off) < *sz)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "buffer too small for operation");
+  return GA_NO_ERROR;
+}
+
+/**
+ * \brief NCCL implementation of \ref gpucomm_send.
+ */
+static int send(gpudata *src, size_t offsrc, size_t count, int typecode,
+                int peer, gpucomm *comm) {
+  cuda_context *ctx;
+  size_t sz;
+
+  ASSERT_BUF(src);
+  ASSERT_COMM(comm);
+  GA_CHECK(check_p2p(src, offsrc, count, typecode, peer, comm, &sz));
+
+  ctx = comm->ctx;
+  cuda_enter(ctx);
+
+  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_waits(src, CUDA_WAIT_READ, comm->s));
+  NCCL_EXIT_ON_ERROR(ctx, ncclSend((void *)(src->ptr + offsrc), sz, ncclChar,
+                                   peer, comm->c, comm->s));
+  GA_CUDA_EXIT_ON_ERROR(ctx, comm_record(comm, src, CUDA_WAIT_READ));
+
+  cuda_exit(ctx);
+
+  return GA_NO_ERROR;
+}
+
+/**
+ * \brief NCCL implementation of \ref gpucomm_recv.
+ */
+static int recv(gpudata *dest, size_t offdest, size_t count, int typecode,
+                int peer, gpucomm *comm) {
+  cuda_context *ctx;
+  size_t sz;
+
+  ASSERT_BUF(dest);
+  ASSERT_COMM(comm);
+  GA_CHECK(check_p2p(dest, offdest, count, typecode, peer, comm, &sz));
+
+  ctx = comm->ctx;
+  cuda_enter(ctx);
+
+  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_waits(dest, CUDA_WAIT_WRITE, comm->s));
+  NCCL_EXIT_ON_ERROR(ctx, ncclRecv((void *)(dest->ptr + offdest), sz,
+                                   ncclChar, peer, comm->c, comm->s));
+  GA_CUDA_EXIT_ON_ERROR(ctx, comm_record(comm, dest, CUDA_WAIT_WRITE));
+
+  cuda_exit(ctx);
+
+  return GA_NO_ERROR;
+}
+
+/**
+ * \brief NCCL implementation of \ref gpucomm_group_start.
+ */
+static int group_start(gpucomm *comm) {
+  ASSERT_COMM(comm);
+  cuda_enter(comm->ctx);
+  NCCL_EXIT_ON_ERROR(comm->ctx, ncclGroupStart());
+  cuda_exit(comm->ctx);
+  comm->group++;
+  return GA_NO_ERROR;
+}
+
+/**
+ * \brief NCCL implementation of \ref gpucomm_group_end.
+ */
+static int group_end(gpucomm *comm) {
+  cuda_context *ctx = comm->ctx;
+  ncclResult_t err;
+  int res = GA_NO_ERROR;
+  size_t i;
+
+  ASSERT_COMM(comm);
+  if (comm->group == 0)
+    return error_set(ctx->err, GA_VALUE_ERROR, "No group in progress");
+  cuda_enter(ctx);
+  err = ncclGroupEnd();
+  comm->group--;
+  if (err != ncclSuccess)
+    res = error_nccl(ctx->err, "ncclGroupEnd", err);
+  if (comm->group == 0) {
+    // The operations are now enqueued
+    for (i = 0; i < comm->npend; i++) {
+      if (res == GA_NO_ERROR)
+        res = cuda_records(comm->pend[i], comm->pendfl[i], comm->s);
+      gpudata_release(comm->pend[i]);
+    }
+    comm->npend = 0;
+  }
+  cuda_exit(ctx);
+  return res;
+}
+
+/**
+ * \brief NCCL implementation of \ref gpucomm_request_new.
+ *
+ * Records an event on the communicator's stream.
+ */
+static int request_new(gpucomm *comm, void **ev) {
+  cuda_context *ctx = comm->ctx;
+  CUevent e;
+  CUresult err;
+  int fl = CU_EVENT_DISABLE_TIMING;
+
+  ASSERT_COMM(comm);
+  if (comm->group != 0)
+    return error_set(ctx->err, GA_VALUE_ERROR,
+                     "Cannot make a request inside a group");
+  if (ctx->flags & GA_CTX_MULTI_THREAD)
+    fl |= CU_EVENT_BLOCKING_SYNC;
+
+  cuda_enter(ctx);
+  CUDA_EXIT_ON_ERROR(ctx, cuEventCreate(&e, fl));
+  err = cuEventRecord(e, comm->s);
+  if (err != CUDA_SUCCESS) {
+    cuEventDestroy(e);
+    cuda_exit(ctx);
+    return error_cuda(ctx->err, "cuEventRecord", err);
+  }
+  cuda_exit(ctx);
+  *ev = e;
+  return GA_NO_ERROR;
+}
 
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_record(src, CUDA_WAIT_READ));
-  GA_CUDA_EXIT_ON_ERROR(ctx, cuda_record(dest, CUDA_WAIT_WRITE));
+/**
+ * \brief NCCL implementation of \ref gpucomm_request_test.
+ */
+static int request_test(gpucomm *comm, void *ev, int *done) {
+  cuda_context *ctx = comm->ctx;
+  CUresult err;
 
+  cuda_enter(ctx);
+  err = cuEventQuery((CUevent)ev);
   cuda_exit(ctx);
+  if (err == CUDA_ERROR_NOT_READY) {
+    *done = 0;
+    return GA_NO_ERROR;
+  }
+  if (err != CUDA_SUCCESS)
+    return error_cuda(ctx->err, "cuEventQuery", err);
+  *done = 1;
+  return GA_NO_ERROR;
+}
 
+/**
+ * \brief NCCL implementation of \ref gpucomm_request_wait.
+ */
+static int request_wait(gpucomm *comm, void *ev) {
+  cuda_context *ctx = comm->ctx;
+
+  cuda_enter(ctx);
+  CUDA_EXIT_ON_ERROR(ctx, cuEventSynchronize((CUevent)ev));
+  cuda_exit(ctx);
   return GA_NO_ERROR;
 }
 
+/**
+ * \brief NCCL implementation of \ref gpucomm_request_free.
+ */
+static void request_free(gpucomm *comm, void *ev) {
+  cuda_enter(comm->ctx);
+  cuEventDestroy((CUevent)ev);
+  cuda_exit(comm->ctx);
+}
+
 /**
  * Instance of `gpuarray_comm_ops` which contains NCCL implementations. To be
  * linked in \ref gpuarray_buffer_cuda.c, in order to fill a /ref gpucontext's
@@ -457,4 +731,6 @@ static int all_gather(gpudata *src, size_t offsrc, gpudata *dest,
  */
 gpuarray_comm_ops nccl_ops = {
     comm_new, comm_free,  generate_clique_id, get_count, get_rank,
-    reduce,   all_reduce, reduce_scatter,     broadcast, all_gather};
+    reduce,   all_reduce, reduce_scatter,     broadcast, all_gather,
+    send,     recv,       group_start,        group_end,
+    request_new, request_test, request_wait, request_free};
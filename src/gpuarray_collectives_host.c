@@ -0,0 +1,1328 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "gpuarray/buffer.h"
+#include "gpuarray/buffer_collectives.h"
+#include "gpuarray/error.h"
+#include "gpuarray/types.h"
+#include "gpuarray/util.h"
+
+#include "private.h"
+
+/*
+ * Collectives that go through host memory.
+ *
+ * Data is staged from the device into a host buffer with
+ * gpudata_read(), exchanged between the ranks and written back with
+ * gpudata_write(), so this works for any backend.  Ranks on a single
+ * node talk through a POSIX shared memory segment, ranks on different
+ * nodes through TCP sockets.  Which one is used is decided when the
+ * clique id is generated: if GPUARRAY_COMM_ADDR is set to the
+ * "host:port" of the rank 0 process, TCP is used, otherwise shared
+ * memory.
+ *
+ * Large transfers use rings (all_reduce, reduce_scatter, all_gather)
+ * or pipelined chains (reduce, broadcast) and are cut in chunks of
+ * CHUNK_SIZE bytes so that the ranks work on different chunks at the
+ * same time.  Small reduces and broadcasts use binomial trees.
+ */
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+//!< Size of the pieces in which transfers are pipelined
+#define CHUNK_SIZE (128 * 1024)
+//!< Capacity of each point-to-point queue in the shared segment
+#define SHM_CHAN_SIZE (256 * 1024)
+//!< Seconds to wait for all the ranks to join a communicator
+#define JOIN_TIMEOUT 120
+
+#define ID_SHM "gahost:shm:"
+#define ID_TCP "gahost:tcp:"
+#define TOKEN_LEN 48
+
+/*
+ * One-way queue between two ranks in the shared segment.  `head` is
+ * only written by the sender and `tail` only by the receiver.  Both
+ * count bytes since the start and never wrap.
+ */
+typedef struct _shm_chan {
+  volatile size_t head;
+  char pad1[64 - sizeof(size_t)];
+  volatile size_t tail;
+  char pad2[64 - sizeof(size_t)];
+  char data[SHM_CHAN_SIZE];
+} shm_chan;
+
+typedef struct _shm_header {
+  volatile unsigned int joined;
+  char pad[64 - sizeof(unsigned int)];
+} shm_header;
+
+/* Handshake message for the TCP connections, in network byte order */
+typedef struct _tcp_hello {
+  char token[TOKEN_LEN];
+  uint32_t rank;
+  uint32_t ndev;
+  uint32_t addr;
+  uint32_t port;
+} tcp_hello;
+
+/* Point-to-point operation waiting for the end of its group */
+typedef struct _p2p_op {
+  gpudata *buf;
+  size_t off;
+  size_t sz;
+  size_t done;  // bytes transferred so far
+  char *host;   // staging area
+  int peer;
+  int send;
+} p2p_op;
+
+/**
+ * Definition of struct _gpucomm
+ *
+ * \note This must be the only "module" which manages the definition's contents.
+ */
+struct _gpucomm {
+  gpucontext *ctx;  // Start after the context
+  int ndev;
+  int rank;
+  int *socks;       // TCP: socket connected to each peer (-1 for self)
+  char *shm;        // shared memory: the mapped segment
+  size_t shm_size;
+  char *buf;        // staging area for the data
+  size_t bufsz;
+  char *tmp;        // CHUNK_SIZE bytes to receive partial results
+  p2p_op *ops;      // queued point-to-point operations
+  unsigned int nops;
+  unsigned int aops;
+  int group;        // nesting depth of gpucomm_group_start()
+};
+
+/*
+ * Low-level transfers
+ */
+
+static shm_chan *chan(gpucomm *comm, int from, int to) {
+  return (shm_chan *)(comm->shm + sizeof(shm_header) +
+                      ((size_t)from * comm->ndev + to) * sizeof(shm_chan));
+}
+
+static ssize_t shm_try_send(gpucomm *comm, int peer, const char *p, size_t n) {
+  shm_chan *c = chan(comm, comm->rank, peer);
+  size_t head = c->head;
+  size_t space = SHM_CHAN_SIZE - (head - c->tail);
+  size_t pos, first;
+
+  if (n > space)
+    n = space;
+  if (n == 0)
+    return 0;
+  /* Don't overwrite data before the reader is done with it */
+  __sync_synchronize();
+  pos = head % SHM_CHAN_SIZE;
+  first = SHM_CHAN_SIZE - pos;
+  if (first > n)
+    first = n;
+  memcpy(c->data + pos, p, first);
+  memcpy(c->data, p + first, n - first);
+  __sync_synchronize();
+  c->head = head + n;
+  return n;
+}
+
+static ssize_t shm_try_recv(gpucomm *comm, int peer, char *p, size_t n) {
+  shm_chan *c = chan(comm, peer, comm->rank);
+  size_t tail = c->tail;
+  size_t avail = c->head - tail;
+  size_t pos, first;
+
+  if (n > avail)
+    n = avail;
+  if (n == 0)
+    return 0;
+  __sync_synchronize();
+  pos = tail % SHM_CHAN_SIZE;
+  first = SHM_CHAN_SIZE - pos;
+  if (first > n)
+    first = n;
+  memcpy(p, c->data + pos, first);
+  memcpy(p + first, c->data, n - first);
+  __sync_synchronize();
+  c->tail = tail + n;
+  return n;
+}
+
+static ssize_t tcp_try_send(gpucomm *comm, int peer, const char *p, size_t n) {
+  ssize_t r = send(comm->socks[peer], p, n, MSG_NOSIGNAL);
+  if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return 0;
+  return r;
+}
+
+static ssize_t tcp_try_recv(gpucomm *comm, int peer, char *p, size_t n) {
+  ssize_t r = recv(comm->socks[peer], p, n, 0);
+  if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return 0;
+  if (r == 0) {
+    errno = ECONNRESET;
+    return -1;
+  }
+  return r;
+}
+
+/* Block until one of the pending transfers can make progress */
+static int comm_wait(gpucomm *comm, int speer, int rpeer) {
+  struct pollfd p[2];
+  nfds_t np = 0;
+
+  if (comm->socks == NULL) {
+    sched_yield();
+    return GA_NO_ERROR;
+  }
+  if (speer >= 0) {
+    p[np].fd = comm->socks[speer];
+    p[np].events = POLLOUT;
+    np++;
+  }
+  if (rpeer >= 0) {
+    p[np].fd = comm->socks[rpeer];
+    p[np].events = POLLIN;
+    np++;
+  }
+  if (poll(p, np, -1) < 0 && errno != EINTR)
+    return error_sys(comm->ctx->err, "poll");
+  return GA_NO_ERROR;
+}
+
+/*
+ * Send `sn` bytes to `speer` while receiving `rn` bytes from `rpeer`.
+ *
+ * Both sides progress together so that rings don't deadlock when the
+ * messages are bigger than what the transport can buffer.
+ */
+static int sendrecv(gpucomm *comm, int speer, const char *sbuf, size_t sn,
+                    int rpeer, char *rbuf, size_t rn) {
+  ssize_t r;
+  int progress;
+
+  while (sn != 0 || rn != 0) {
+    progress = 0;
+    if (sn != 0) {
+      if (comm->socks != NULL)
+        r = tcp_try_send(comm, speer, sbuf, sn);
+      else
+        r = shm_try_send(comm, speer, sbuf, sn);
+      if (r < 0)
+        return error_sys(comm->ctx->err, "send");
+      sbuf += r;
+      sn -= r;
+      progress |= (r != 0);
+    }
+    if (rn != 0) {
+      if (comm->socks != NULL)
+        r = tcp_try_recv(comm, rpeer, rbuf, rn);
+      else
+        r = shm_try_recv(comm, rpeer, rbuf, rn);
+      if (r < 0)
+        return error_sys(comm->ctx->err, "recv");
+      rbuf += r;
+      rn -= r;
+      progress |= (r != 0);
+    }
+    if (!progress)
+      GA_CHECK(comm_wait(comm, sn != 0 ? speer : -1, rn != 0 ? rpeer : -1));
+  }
+  return GA_NO_ERROR;
+}
+
+/*
+ * Host-side reductions
+ */
+
+static float half2float(uint16_t h) {
+  union {
+    float f;
+    uint32_t bits;
+  } bf;
+  uint32_t h_exp = h & 0x7c00u, f_sgn = ((uint32_t)h & 0x8000u) << 16;
+  uint32_t h_sig;
+
+  if (h_exp == 0x0000u) {
+    /* 0 or subnormal */
+    h_sig = h & 0x03ffu;
+    if (h_sig == 0) {
+      bf.bits = f_sgn;
+    } else {
+      h_sig <<= 1;
+      while ((h_sig & 0x0400u) == 0) {
+        h_sig <<= 1;
+        h_exp++;
+      }
+      bf.bits = f_sgn + (((uint32_t)(127 - 15 - h_exp)) << 23) +
+        (((uint32_t)(h_sig & 0x03ffu)) << 13);
+    }
+  } else if (h_exp == 0x7c00u) {
+    /* inf or NaN */
+    bf.bits = f_sgn + 0x7f800000u + (((uint32_t)(h & 0x03ffu)) << 13);
+  } else {
+    bf.bits = f_sgn + (((uint32_t)(h & 0x7fffu) + 0x1c000u) << 13);
+  }
+  return bf.f;
+}
+
+#define OP_SUM(a, b) ((a) + (b))
+#define OP_PROD(a, b) ((a) * (b))
+#define OP_MAX(a, b) ((a) > (b) ? (a) : (b))
+#define OP_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define REDUCE_LOOP(T, OP)                      \
+  do {                                          \
+    T *a = (T *)acc;                            \
+    const T *b = (const T *)in;                 \
+    for (i = 0; i < n; i++)                     \
+      a[i] = (T)OP(a[i], b[i]);                 \
+  } while (0)
+
+#define REDUCE_TYPE(T)                                  \
+  switch (opcode) {                                     \
+  case GA_SUM: REDUCE_LOOP(T, OP_SUM); break;           \
+  case GA_PROD: REDUCE_LOOP(T, OP_PROD); break;         \
+  case GA_MAX: REDUCE_LOOP(T, OP_MAX); break;           \
+  case GA_MIN: REDUCE_LOOP(T, OP_MIN); break;           \
+  }
+
+/* acc[i] = op(acc[i], in[i]) for the first `n` elements */
+static void host_reduce(void *acc, const void *in, size_t n, int typecode,
+                        int opcode) {
+  size_t i;
+  float x, y;
+
+  switch (typecode) {
+  case GA_BYTE: REDUCE_TYPE(int8_t); break;
+  case GA_UBYTE: REDUCE_TYPE(uint8_t); break;
+  case GA_SHORT: REDUCE_TYPE(int16_t); break;
+  case GA_USHORT: REDUCE_TYPE(uint16_t); break;
+  case GA_INT: REDUCE_TYPE(int32_t); break;
+  case GA_UINT: REDUCE_TYPE(uint32_t); break;
+  case GA_LONG: REDUCE_TYPE(int64_t); break;
+  case GA_ULONG: REDUCE_TYPE(uint64_t); break;
+  case GA_FLOAT: REDUCE_TYPE(float); break;
+  case GA_DOUBLE: REDUCE_TYPE(double); break;
+  case GA_HALF:
+    for (i = 0; i < n; i++) {
+      x = half2float(((uint16_t *)acc)[i]);
+      y = half2float(((const uint16_t *)in)[i]);
+      switch (opcode) {
+      case GA_SUM: x = OP_SUM(x, y); break;
+      case GA_PROD: x = OP_PROD(x, y); break;
+      case GA_MAX: x = OP_MAX(x, y); break;
+      case GA_MIN: x = OP_MIN(x, y); break;
+      }
+      ((ga_half_t *)acc)[i] = ga_float2half(x);
+    }
+    break;
+  }
+}
+
+static int valid_type(int typecode) {
+  switch (typecode) {
+  case GA_BYTE: case GA_UBYTE: case GA_SHORT: case GA_USHORT:
+  case GA_INT: case GA_UINT: case GA_LONG: case GA_ULONG:
+  case GA_FLOAT: case GA_DOUBLE: case GA_HALF:
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Communicator setup
+ */
+
+static void comm_clear(gpucomm *comm) {
+  int i;
+  if (comm->socks != NULL) {
+    for (i = 0; i < comm->ndev; i++)
+      if (comm->socks[i] >= 0)
+        close(comm->socks[i]);
+    free(comm->socks);
+  }
+  if (comm->shm != NULL)
+    munmap(comm->shm, comm->shm_size);
+  free(comm->buf);
+  free(comm->tmp);
+  free(comm->ops);
+  gpucontext_deref(comm->ctx);
+  free(comm);
+}
+
+static int shm_join(gpucomm *comm, const char *name) {
+  shm_header *hdr;
+  time_t start;
+  int fd;
+
+  comm->shm_size = sizeof(shm_header) +
+    (size_t)comm->ndev * comm->ndev * sizeof(shm_chan);
+  fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+  if (fd < 0)
+    return error_sys(comm->ctx->err, "shm_open");
+  if (ftruncate(fd, comm->shm_size) != 0) {
+    close(fd);
+    return error_sys(comm->ctx->err, "ftruncate");
+  }
+  comm->shm = mmap(NULL, comm->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+  close(fd);
+  if (comm->shm == MAP_FAILED) {
+    comm->shm = NULL;
+    return error_sys(comm->ctx->err, "mmap");
+  }
+
+  hdr = (shm_header *)comm->shm;
+  __sync_fetch_and_add(&hdr->joined, 1);
+  start = time(NULL);
+  while (hdr->joined < (unsigned int)comm->ndev) {
+    if (time(NULL) - start > JOIN_TIMEOUT) {
+      if (comm->rank == 0)
+        shm_unlink(name);
+      return error_set(comm->ctx->err, GA_COMM_ERROR,
+                       "Timed out waiting for the other ranks");
+    }
+    sched_yield();
+  }
+  /* Everybody has it mapped now, so the name is not needed anymore */
+  if (comm->rank == 0)
+    shm_unlink(name);
+  return GA_NO_ERROR;
+}
+
+static int sock_write(int fd, const void *p, size_t n) {
+  const char *c = (const char *)p;
+  ssize_t r;
+  while (n != 0) {
+    r = send(fd, c, n, MSG_NOSIGNAL);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    c += r;
+    n -= r;
+  }
+  return 0;
+}
+
+static int sock_read(int fd, void *p, size_t n) {
+  char *c = (char *)p;
+  ssize_t r;
+  while (n != 0) {
+    r = recv(fd, c, n, 0);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (r == 0) {
+      errno = ECONNRESET;
+      return -1;
+    }
+    c += r;
+    n -= r;
+  }
+  return 0;
+}
+
+static int sock_listen(error *e, uint16_t port, int *fd) {
+  struct sockaddr_in sa;
+  int one = 1;
+
+  *fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (*fd < 0)
+    return error_sys(e, "socket");
+  setsockopt(*fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_ANY);
+  sa.sin_port = htons(port);
+  if (bind(*fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 ||
+      listen(*fd, SOMAXCONN) != 0) {
+    close(*fd);
+    *fd = -1;
+    return error_sys(e, "bind");
+  }
+  return GA_NO_ERROR;
+}
+
+/* Connect to `sa`, retrying while the other side is not listening yet */
+static int sock_connect(error *e, const struct sockaddr_in *sa, int *fd) {
+  time_t start = time(NULL);
+  struct timespec ts;
+
+  for (;;) {
+    *fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (*fd < 0)
+      return error_sys(e, "socket");
+    if (connect(*fd, (const struct sockaddr *)sa, sizeof(*sa)) == 0)
+      return GA_NO_ERROR;
+    close(*fd);
+    *fd = -1;
+    if ((errno != ECONNREFUSED && errno != EINTR && errno != ETIMEDOUT) ||
+        time(NULL) - start > JOIN_TIMEOUT)
+      return error_sys(e, "connect");
+    ts.tv_sec = 0;
+    ts.tv_nsec = 100000000;
+    nanosleep(&ts, NULL);
+  }
+}
+
+/* Accept a connection from a peer and check its handshake */
+static int sock_accept(gpucomm *comm, int lfd, const char *token,
+                       tcp_hello *hello, int *fd) {
+  struct pollfd p;
+  int r;
+
+  p.fd = lfd;
+  p.events = POLLIN;
+  do {
+    r = poll(&p, 1, JOIN_TIMEOUT * 1000);
+  } while (r < 0 && errno == EINTR);
+  if (r < 0)
+    return error_sys(comm->ctx->err, "poll");
+  if (r == 0)
+    return error_set(comm->ctx->err, GA_COMM_ERROR,
+                     "Timed out waiting for the other ranks");
+  *fd = accept(lfd, NULL, NULL);
+  if (*fd < 0)
+    return error_sys(comm->ctx->err, "accept");
+  if (sock_read(*fd, hello, sizeof(*hello)) != 0)
+    return error_sys(comm->ctx->err, "recv");
+  if (strncmp(hello->token, token, TOKEN_LEN) != 0 ||
+      ntohl(hello->ndev) != (uint32_t)comm->ndev ||
+      ntohl(hello->rank) >= (uint32_t)comm->ndev ||
+      ntohl(hello->rank) == (uint32_t)comm->rank ||
+      comm->socks[ntohl(hello->rank)] != -1)
+    return error_set(comm->ctx->err, GA_COMM_ERROR,
+                     "Unexpected connection while setting up communicator");
+  return GA_NO_ERROR;
+}
+
+static int tcp_join(gpucomm *comm, const char *spec) {
+  char host[GA_COMM_ID_BYTES];
+  char port[GA_COMM_ID_BYTES];
+  char token[TOKEN_LEN];
+  const char *colon, *tok;
+  struct addrinfo hints, *ai;
+  struct sockaddr_in sa;
+  socklen_t salen;
+  tcp_hello me, *table = NULL;
+  int lfd = -1, fd = -1, one = 1;
+  int i, err;
+
+  /* spec is "host:port/token" */
+  tok = strrchr(spec, '/');
+  colon = strrchr(spec, ':');
+  if (tok == NULL || colon == NULL || colon > tok ||
+      strlen(tok + 1) >= TOKEN_LEN)
+    return error_set(comm->ctx->err, GA_INVALID_ERROR, "Invalid clique id");
+  memcpy(host, spec, colon - spec);
+  host[colon - spec] = '\0';
+  memcpy(port, colon + 1, tok - colon - 1);
+  port[tok - colon - 1] = '\0';
+  memset(token, 0, sizeof(token));
+  strcpy(token, tok + 1);
+
+  comm->socks = malloc(comm->ndev * sizeof(int));
+  if (comm->socks == NULL)
+    return error_sys(comm->ctx->err, "malloc");
+  for (i = 0; i < comm->ndev; i++)
+    comm->socks[i] = -1;
+
+  memset(&me, 0, sizeof(me));
+  memcpy(me.token, token, TOKEN_LEN);
+  me.rank = htonl(comm->rank);
+  me.ndev = htonl(comm->ndev);
+
+  if (comm->rank == 0) {
+    table = calloc(comm->ndev, sizeof(tcp_hello));
+    if (table == NULL)
+      return error_sys(comm->ctx->err, "calloc");
+    err = sock_listen(comm->ctx->err, (uint16_t)atoi(port), &lfd);
+    if (err != GA_NO_ERROR)
+      goto fail;
+    table[0] = me;
+    for (i = 1; i < comm->ndev; i++) {
+      tcp_hello hello;
+      err = sock_accept(comm, lfd, token, &hello, &fd);
+      if (err != GA_NO_ERROR)
+        goto fail;
+      comm->socks[ntohl(hello.rank)] = fd;
+      table[ntohl(hello.rank)] = hello;
+      fd = -1;
+    }
+    for (i = 1; i < comm->ndev; i++) {
+      if (sock_write(comm->socks[i], table,
+                     comm->ndev * sizeof(tcp_hello)) != 0) {
+        err = error_sys(comm->ctx->err, "send");
+        goto fail;
+      }
+    }
+  } else {
+    table = calloc(comm->ndev, sizeof(tcp_hello));
+    if (table == NULL)
+      return error_sys(comm->ctx->err, "calloc");
+    err = sock_listen(comm->ctx->err, 0, &lfd);
+    if (err != GA_NO_ERROR)
+      goto fail;
+    salen = sizeof(sa);
+    getsockname(lfd, (struct sockaddr *)&sa, &salen);
+    me.port = htonl(ntohs(sa.sin_port));
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &ai) != 0) {
+      err = error_fmt(comm->ctx->err, GA_COMM_ERROR,
+                      "Could not resolve %s", host);
+      goto fail;
+    }
+    memcpy(&sa, ai->ai_addr, sizeof(sa));
+    freeaddrinfo(ai);
+    err = sock_connect(comm->ctx->err, &sa, &comm->socks[0]);
+    if (err != GA_NO_ERROR)
+      goto fail;
+    /* Other ranks reach us on the interface we use to reach rank 0 */
+    salen = sizeof(sa);
+    getsockname(comm->socks[0], (struct sockaddr *)&sa, &salen);
+    me.addr = sa.sin_addr.s_addr;
+    if (sock_write(comm->socks[0], &me, sizeof(me)) != 0 ||
+        sock_read(comm->socks[0], table,
+                  comm->ndev * sizeof(tcp_hello)) != 0) {
+      err = error_sys(comm->ctx->err, "rank 0");
+      goto fail;
+    }
+    /* Connect to the lower ranks, then wait for the higher ones */
+    for (i = 1; i < comm->rank; i++) {
+      memset(&sa, 0, sizeof(sa));
+      sa.sin_family = AF_INET;
+      sa.sin_addr.s_addr = table[i].addr;
+      sa.sin_port = htons((uint16_t)ntohl(table[i].port));
+      err = sock_connect(comm->ctx->err, &sa, &comm->socks[i]);
+      if (err != GA_NO_ERROR)
+        goto fail;
+      if (sock_write(comm->socks[i], &me, sizeof(me)) != 0) {
+        err = error_sys(comm->ctx->err, "send");
+        goto fail;
+      }
+    }
+    for (i = comm->rank + 1; i < comm->ndev; i++) {
+      tcp_hello hello;
+      err = sock_accept(comm, lfd, token, &hello, &fd);
+      if (err != GA_NO_ERROR)
+        goto fail;
+      comm->socks[ntohl(hello.rank)] = fd;
+      fd = -1;
+    }
+  }
+
+  for (i = 0; i < comm->ndev; i++) {
+    if (comm->socks[i] < 0)
+      continue;
+    setsockopt(comm->socks[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(comm->socks[i], F_SETFL, fcntl(comm->socks[i], F_GETFL) | O_NONBLOCK);
+  }
+  err = GA_NO_ERROR;
+
+ fail:
+  if (fd >= 0)
+    close(fd);
+  if (lfd >= 0)
+    close(lfd);
+  free(table);
+  return err;
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_new.
+ */
+static int comm_new(gpucomm **comm_ptr, gpucontext *ctx,
+                    gpucommCliqueId comm_id, int ndev, int rank) {
+  gpucomm *comm;
+  char id[GA_COMM_ID_BYTES + 1];
+  int err;
+
+  *comm_ptr = NULL;
+  if (ndev <= 0 || rank < 0 || rank >= ndev)
+    return error_set(ctx->err, GA_VALUE_ERROR, "Invalid rank or count");
+  memcpy(id, comm_id.internal, GA_COMM_ID_BYTES);
+  id[GA_COMM_ID_BYTES] = '\0';
+
+  comm = calloc(1, sizeof(*comm));
+  if (comm == NULL)
+    return error_sys(ctx->err, "calloc");
+  comm->ctx = ctx;
+  // So that context would not be destroyed before communicator
+  ctx_lock(ctx);
+  ctx->refcnt++;
+  ctx_unlock(ctx);
+  comm->ndev = ndev;
+  comm->rank = rank;
+  comm->tmp = malloc(CHUNK_SIZE);
+  if (comm->tmp == NULL) {
+    err = error_sys(ctx->err, "malloc");
+    goto fail;
+  }
+
+  if (strncmp(id, ID_SHM, strlen(ID_SHM)) == 0)
+    err = shm_join(comm, id + strlen(ID_SHM));
+  else if (strncmp(id, ID_TCP, strlen(ID_TCP)) == 0)
+    err = tcp_join(comm, id + strlen(ID_TCP));
+  else
+    err = error_set(ctx->err, GA_INVALID_ERROR,
+                    "Clique id was not generated for host collectives");
+  if (err != GA_NO_ERROR)
+    goto fail;
+
+  *comm_ptr = comm;
+  return GA_NO_ERROR;
+ fail:
+  comm_clear(comm);
+  return err;
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_free.
+ */
+static void comm_free(gpucomm *comm) {
+  comm_clear(comm);
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_gen_clique_id.
+ */
+static int generate_clique_id(gpucontext *c, gpucommCliqueId *comm_id) {
+  static unsigned int counter = 0;
+  const char *addr = getenv("GPUARRAY_COMM_ADDR");
+  char token[TOKEN_LEN];
+  int n;
+
+  snprintf(token, sizeof(token), "%lx.%lx.%x", (unsigned long)getpid(),
+           (unsigned long)time(NULL), __sync_fetch_and_add(&counter, 1));
+  memset(comm_id->internal, 0, GA_COMM_ID_BYTES);
+  if (addr == NULL || addr[0] == '\0')
+    n = snprintf(comm_id->internal, GA_COMM_ID_BYTES, ID_SHM "/gpuarray.%s",
+                 token);
+  else
+    n = snprintf(comm_id->internal, GA_COMM_ID_BYTES, ID_TCP "%s/%s",
+                 addr, token);
+  if (n < 0 || n >= GA_COMM_ID_BYTES)
+    return error_set(c->err, GA_VALUE_ERROR, "GPUARRAY_COMM_ADDR too long");
+  return GA_NO_ERROR;
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_get_count.
+ */
+static int get_count(const gpucomm *comm, int *gpucount) {
+  *gpucount = comm->ndev;
+  return GA_NO_ERROR;
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_get_rank.
+ */
+static int get_rank(const gpucomm *comm, int *rank) {
+  *rank = comm->rank;
+  return GA_NO_ERROR;
+}
+
+/*
+ * Algorithms.  They work on elements of `esz` bytes in comm->buf.
+ */
+
+static int reserve_buf(gpucomm *comm, size_t sz) {
+  char *tmp;
+  if (comm->bufsz >= sz)
+    return GA_NO_ERROR;
+  tmp = realloc(comm->buf, sz);
+  if (tmp == NULL)
+    return error_sys(comm->ctx->err, "realloc");
+  comm->buf = tmp;
+  comm->bufsz = sz;
+  return GA_NO_ERROR;
+}
+
+/* Split `total` elements as evenly as possible in ndev blocks */
+static void block(const gpucomm *comm, size_t total, int b,
+                  size_t *lo, size_t *len) {
+  size_t q = total / comm->ndev, r = total % comm->ndev;
+  *lo = q * b + ((size_t)b < r ? (size_t)b : r);
+  *len = q + ((size_t)b < r ? 1 : 0);
+}
+
+#define PEER(comm, r) (((r) + 2 * (comm)->ndev) % (comm)->ndev)
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/*
+ * Ring reduce-scatter.  At the end, block `rank` of the buffer holds
+ * the reduction of that block across all ranks.
+ */
+static int ring_reduce_scatter(gpucomm *comm, size_t total, size_t esz,
+                               int typecode, int opcode) {
+  size_t ce = CHUNK_SIZE / esz;
+  size_t slo, slen, rlo, rlen, off, sn, rn;
+  int next = PEER(comm, comm->rank + 1), prev = PEER(comm, comm->rank - 1);
+  int s;
+
+  for (s = 0; s < comm->ndev - 1; s++) {
+    block(comm, total, PEER(comm, comm->rank - s - 1), &slo, &slen);
+    block(comm, total, PEER(comm, comm->rank - s - 2), &rlo, &rlen);
+    for (off = 0; off < slen || off < rlen; off += ce) {
+      sn = off < slen ? MIN(ce, slen - off) : 0;
+      rn = off < rlen ? MIN(ce, rlen - off) : 0;
+      GA_CHECK(sendrecv(comm, next, comm->buf + (slo + off) * esz, sn * esz,
+                        prev, comm->tmp, rn * esz));
+      host_reduce(comm->buf + (rlo + off) * esz, comm->tmp, rn, typecode,
+                  opcode);
+    }
+  }
+  return GA_NO_ERROR;
+}
+
+/*
+ * Ring all-gather.  Each rank starts with its own block and ends
+ * with all of them.
+ */
+static int ring_all_gather(gpucomm *comm, size_t total, size_t esz) {
+  size_t ce = CHUNK_SIZE / esz;
+  size_t slo, slen, rlo, rlen, off, sn, rn;
+  int next = PEER(comm, comm->rank + 1), prev = PEER(comm, comm->rank - 1);
+  int s;
+
+  for (s = 0; s < comm->ndev - 1; s++) {
+    block(comm, total, PEER(comm, comm->rank - s), &slo, &slen);
+    block(comm, total, PEER(comm, comm->rank - s - 1), &rlo, &rlen);
+    for (off = 0; off < slen || off < rlen; off += ce) {
+      sn = off < slen ? MIN(ce, slen - off) : 0;
+      rn = off < rlen ? MIN(ce, rlen - off) : 0;
+      GA_CHECK(sendrecv(comm, next, comm->buf + (slo + off) * esz, sn * esz,
+                        prev, comm->buf + (rlo + off) * esz, rn * esz));
+    }
+  }
+  return GA_NO_ERROR;
+}
+
+/* Binomial tree reduce for messages of at most CHUNK_SIZE bytes */
+static int tree_reduce(gpucomm *comm, size_t count, size_t esz,
+                       int typecode, int opcode, int root) {
+  int v = PEER(comm, comm->rank - root);
+  int mask;
+
+  for (mask = 1; mask < comm->ndev; mask <<= 1) {
+    if (v & mask) {
+      return sendrecv(comm, PEER(comm, v - mask + root), comm->buf,
+                      count * esz, -1, NULL, 0);
+    } else if (v + mask < comm->ndev) {
+      GA_CHECK(sendrecv(comm, -1, NULL, 0, PEER(comm, v + mask + root),
+                        comm->tmp, count * esz));
+      host_reduce(comm->buf, comm->tmp, count, typecode, opcode);
+    }
+  }
+  return GA_NO_ERROR;
+}
+
+/* Binomial tree broadcast for messages of at most CHUNK_SIZE bytes */
+static int tree_broadcast(gpucomm *comm, size_t count, size_t esz, int root) {
+  int v = PEER(comm, comm->rank - root);
+  int mask;
+
+  for (mask = 1; mask < comm->ndev; mask <<= 1) {
+    if (v & mask) {
+      GA_CHECK(sendrecv(comm, -1, NULL, 0, PEER(comm, v - mask + root),
+                        comm->buf, count * esz));
+      break;
+    }
+  }
+  for (mask >>= 1; mask > 0; mask >>= 1) {
+    if (v + mask < comm->ndev)
+      GA_CHECK(sendrecv(comm, PEER(comm, v + mask + root), comm->buf,
+                        count * esz, -1, NULL, 0));
+  }
+  return GA_NO_ERROR;
+}
+
+/*
+ * Pipelined chain reduce towards `root`.  Chunks are read from `src`
+ * as they are needed and the root writes them to `dst` as soon as
+ * they are done, so the device transfers overlap with the rest of
+ * the chain.
+ */
+static int chain_reduce(gpucomm *comm, gpudata *src, size_t offsrc,
+                        gpudata *dst, size_t offdst, size_t count,
+                        size_t esz, int typecode, int opcode, int root) {
+  size_t ce = CHUNK_SIZE / esz;
+  size_t nchunks = (count + ce - 1) / ce;
+  size_t k, off, n, poff = 0, pn = 0;
+  int v = PEER(comm, comm->rank - root);
+  int from = v + 1 < comm->ndev ? PEER(comm, v + 1 + root) : -1;
+  int to = v > 0 ? PEER(comm, v - 1 + root) : -1;
+
+  for (k = 0; k <= nchunks; k++) {
+    off = k * ce;
+    n = k < nchunks ? MIN(ce, count - off) : 0;
+    if (n != 0)
+      GA_CHECK(gpudata_read(comm->buf + off * esz, src, offsrc + off * esz,
+                            n * esz));
+    /* Pass on the previous chunk while receiving this one */
+    GA_CHECK(sendrecv(comm, to, comm->buf + poff * esz,
+                      to >= 0 ? pn * esz : 0,
+                      from, comm->tmp, from >= 0 ? n * esz : 0));
+    if (from >= 0)
+      host_reduce(comm->buf + off * esz, comm->tmp, n, typecode, opcode);
+    if (to < 0 && n != 0)
+      GA_CHECK(gpudata_write(dst, offdst + off * esz, comm->buf + off * esz,
+                             n * esz));
+    poff = off;
+    pn = n;
+  }
+  return GA_NO_ERROR;
+}
+
+/* Pipelined chain broadcast from `root`, staging chunk by chunk */
+static int chain_broadcast(gpucomm *comm, gpudata *array, size_t offset,
+                           size_t count, size_t esz, int root) {
+  size_t ce = CHUNK_SIZE / esz;
+  size_t nchunks = (count + ce - 1) / ce;
+  size_t k, off, n, poff = 0, pn = 0;
+  int v = PEER(comm, comm->rank - root);
+  int from = v > 0 ? PEER(comm, v - 1 + root) : -1;
+  int to = v + 1 < comm->ndev ? PEER(comm, v + 1 + root) : -1;
+
+  for (k = 0; k <= nchunks; k++) {
+    off = k * ce;
+    n = k < nchunks ? MIN(ce, count - off) : 0;
+    if (from < 0 && n != 0)
+      GA_CHECK(gpudata_read(comm->buf + off * esz, array, offset + off * esz,
+                            n * esz));
+    GA_CHECK(sendrecv(comm, to, comm->buf + poff * esz,
+                      to >= 0 ? pn * esz : 0,
+                      from, comm->buf + off * esz, from >= 0 ? n * esz : 0));
+    if (from >= 0 && n != 0)
+      GA_CHECK(gpudata_write(array, offset + off * esz, comm->buf + off * esz,
+                             n * esz));
+    poff = off;
+    pn = n;
+  }
+  return GA_NO_ERROR;
+}
+
+static size_t buffer_size(gpudata *b) {
+  size_t sz = 0;
+  gpudata_property(b, GA_BUFFER_PROP_SIZE, &sz);
+  return sz;
+}
+
+/**
+ * \brief Helper function to check for restrictions on `gpudata` to be used in
+ * host collective operations.
+ */
+static int check_restrictions(gpudata *src, size_t offsrc,
+                              gpudata *dest, size_t offdest,
+                              size_t count, int typecode,
+                              int opcode, gpucomm *comm) {
+  size_t op_size;
+  // src, dest and comm must refer to the same context
+  if (gpudata_context(src) != comm->ctx)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "source and comm context differ");
+  if (dest != NULL && gpudata_context(dest) != comm->ctx)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "destination and comm context differ");
+  if (!valid_type(typecode))
+    return error_set(comm->ctx->err, GA_INVALID_ERROR, "Invalid data type");
+  if (opcode != GA_SUM && opcode != GA_PROD && opcode != GA_MAX &&
+      opcode != GA_MIN)
+    return error_set(comm->ctx->err, GA_INVALID_ERROR, "Invalid reduce op");
+  // size to operate upon must be able to fit inside the gpudata (incl offsets)
+  op_size = count * gpuarray_get_elsize(typecode);
+  if (buffer_size(src) < offsrc ||
+      (buffer_size(src) - offsrc) < op_size)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "source too small for operation");
+  if (dest != NULL && (buffer_size(dest) < offdest ||
+                       (buffer_size(dest) - offdest) < op_size))
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "destination too small for operation");
+  return reserve_buf(comm, op_size);
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_reduce.
+ */
+static int reduce(gpudata *src, size_t offsrc, gpudata *dest, size_t offdest,
+                  size_t count, int typecode, int opcode, int root,
+                  gpucomm *comm) {
+  size_t esz = gpuarray_get_elsize(typecode);
+
+  if (root < 0 || root >= comm->ndev)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "Invalid root");
+  GA_CHECK(check_restrictions(src, offsrc, comm->rank == root ? dest : NULL,
+                              offdest, count, typecode, opcode, comm));
+  if (count * esz > CHUNK_SIZE)
+    return chain_reduce(comm, src, offsrc, dest, offdest, count, esz,
+                        typecode, opcode, root);
+  GA_CHECK(gpudata_read(comm->buf, src, offsrc, count * esz));
+  GA_CHECK(tree_reduce(comm, count, esz, typecode, opcode, root));
+  if (comm->rank == root)
+    GA_CHECK(gpudata_write(dest, offdest, comm->buf, count * esz));
+  return GA_NO_ERROR;
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_all_reduce.
+ */
+static int all_reduce(gpudata *src, size_t offsrc, gpudata *dest,
+                      size_t offdest, size_t count, int typecode, int opcode,
+                      gpucomm *comm) {
+  size_t esz = gpuarray_get_elsize(typecode);
+
+  GA_CHECK(check_restrictions(src, offsrc, dest, offdest, count, typecode,
+                              opcode, comm));
+  GA_CHECK(gpudata_read(comm->buf, src, offsrc, count * esz));
+  if (count * esz > CHUNK_SIZE) {
+    GA_CHECK(ring_reduce_scatter(comm, count, esz, typecode, opcode));
+    GA_CHECK(ring_all_gather(comm, count, esz));
+  } else {
+    /* Fewer steps than the ring, which matters for small messages */
+    GA_CHECK(tree_reduce(comm, count, esz, typecode, opcode, 0));
+    GA_CHECK(tree_broadcast(comm, count, esz, 0));
+  }
+  return gpudata_write(dest, offdest, comm->buf, count * esz);
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_reduce_scatter.
+ */
+static int reduce_scatter(gpudata *src, size_t offsrc, gpudata *dest,
+                          size_t offdest, size_t count, int typecode,
+                          int opcode, gpucomm *comm) {
+  size_t esz = gpuarray_get_elsize(typecode);
+  size_t resc_size = count * esz;
+
+  GA_CHECK(check_restrictions(src, offsrc, NULL, 0, count * comm->ndev,
+                              typecode, opcode, comm));
+  if (gpudata_context(dest) != comm->ctx)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "destination and comm context differ");
+  if (buffer_size(dest) < offdest ||
+      (buffer_size(dest) - offdest) < resc_size)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "destination too small for operation");
+
+  GA_CHECK(gpudata_read(comm->buf, src, offsrc, resc_size * comm->ndev));
+  GA_CHECK(ring_reduce_scatter(comm, count * comm->ndev, esz, typecode,
+                               opcode));
+  return gpudata_write(dest, offdest, comm->buf + resc_size * comm->rank,
+                       resc_size);
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_broadcast.
+ */
+static int broadcast(gpudata *array, size_t offset, size_t count, int typecode,
+                     int root, gpucomm *comm) {
+  size_t esz = gpuarray_get_elsize(typecode);
+
+  if (root < 0 || root >= comm->ndev)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "Invalid root");
+  GA_CHECK(check_restrictions(array, offset, NULL, 0, count, typecode, GA_SUM,
+                              comm));
+  if (count * esz > CHUNK_SIZE)
+    return chain_broadcast(comm, array, offset, count, esz, root);
+  if (comm->rank == root)
+    GA_CHECK(gpudata_read(comm->buf, array, offset, count * esz));
+  GA_CHECK(tree_broadcast(comm, count, esz, root));
+  if (comm->rank != root)
+    GA_CHECK(gpudata_write(array, offset, comm->buf, count * esz));
+  return GA_NO_ERROR;
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_all_gather.
+ */
+static int all_gather(gpudata *src, size_t offsrc, gpudata *dest,
+                      size_t offdest, size_t count, int typecode,
+                      gpucomm *comm) {
+  size_t esz = gpuarray_get_elsize(typecode);
+  size_t sz = count * esz;
+
+  GA_CHECK(check_restrictions(src, offsrc, NULL, 0, count, typecode, GA_SUM,
+                              comm));
+  if (gpudata_context(dest) != comm->ctx)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "destination and comm context differ");
+  if (buffer_size(dest) < offdest ||
+      (buffer_size(dest) - offdest) < sz * comm->ndev)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "destination too small for operation");
+  GA_CHECK(reserve_buf(comm, sz * comm->ndev));
+
+  GA_CHECK(gpudata_read(comm->buf + sz * comm->rank, src, offsrc, sz));
+  GA_CHECK(ring_all_gather(comm, count * comm->ndev, esz));
+  return gpudata_write(dest, offdest, comm->buf, sz * comm->ndev);
+}
+
+/*
+ * Point-to-point.  The operations of a group are queued and all
+ * progress together when it ends, so that ranks can exchange data in
+ * both directions without deadlocking.  Outside of a group they run
+ * immediately.  Messages between two ranks are matched in order and
+ * must have the same size on both sides.
+ */
+
+static ssize_t try_send(gpucomm *comm, int peer, const char *p, size_t n) {
+  if (comm->socks != NULL)
+    return tcp_try_send(comm, peer, p, n);
+  return shm_try_send(comm, peer, p, n);
+}
+
+static ssize_t try_recv(gpucomm *comm, int peer, char *p, size_t n) {
+  if (comm->socks != NULL)
+    return tcp_try_recv(comm, peer, p, n);
+  return shm_try_recv(comm, peer, p, n);
+}
+
+/* Match the messages from this rank to itself */
+static int p2p_self(gpucomm *comm) {
+  unsigned int i, j = 0;
+  p2p_op *s, *r;
+
+  for (i = 0; i < comm->nops; i++) {
+    s = &comm->ops[i];
+    if (!s->send || s->peer != comm->rank)
+      continue;
+    while (j < comm->nops && (comm->ops[j].send ||
+                              comm->ops[j].peer != comm->rank))
+      j++;
+    if (j == comm->nops)
+      return error_set(comm->ctx->err, GA_VALUE_ERROR,
+                       "Send to self without matching receive");
+    r = &comm->ops[j++];
+    if (r->sz != s->sz)
+      return error_set(comm->ctx->err, GA_VALUE_ERROR,
+                       "Size mismatch between send and receive to self");
+    memcpy(r->host, s->host, s->sz);
+    s->done = s->sz;
+    r->done = r->sz;
+  }
+  for (; j < comm->nops; j++)
+    if (!comm->ops[j].send && comm->ops[j].peer == comm->rank &&
+        comm->ops[j].done != comm->ops[j].sz)
+      return error_set(comm->ctx->err, GA_VALUE_ERROR,
+                       "Receive from self without matching send");
+  return GA_NO_ERROR;
+}
+
+static int p2p_progress(gpucomm *comm) {
+  struct pollfd *pfd = NULL;
+  char *busy;
+  unsigned int i, left = 0;
+  nfds_t np;
+  ssize_t r;
+  int progress, slot;
+  p2p_op *op;
+
+  /* One transfer at a time in each direction with each peer */
+  busy = malloc(2 * comm->ndev);
+  if (busy == NULL)
+    return error_sys(comm->ctx->err, "malloc");
+  if (comm->socks != NULL) {
+    pfd = calloc(comm->nops, sizeof(*pfd));
+    if (pfd == NULL) {
+      free(busy);
+      return error_sys(comm->ctx->err, "calloc");
+    }
+  }
+  for (i = 0; i < comm->nops; i++)
+    if (comm->ops[i].done != comm->ops[i].sz)
+      left++;
+
+  while (left != 0) {
+    progress = 0;
+    np = 0;
+    memset(busy, 0, 2 * comm->ndev);
+    for (i = 0; i < comm->nops; i++) {
+      op = &comm->ops[i];
+      if (op->done == op->sz)
+        continue;
+      slot = op->peer * 2 + op->send;
+      if (busy[slot])
+        continue;
+      busy[slot] = 1;
+      if (op->send)
+        r = try_send(comm, op->peer, op->host + op->done, op->sz - op->done);
+      else
+        r = try_recv(comm, op->peer, op->host + op->done, op->sz - op->done);
+      if (r < 0) {
+        free(busy);
+        free(pfd);
+        return error_sys(comm->ctx->err, op->send ? "send" : "recv");
+      }
+      op->done += r;
+      progress |= (r != 0);
+      if (op->done == op->sz) {
+        left--;
+      } else if (pfd != NULL) {
+        pfd[np].fd = comm->socks[op->peer];
+        pfd[np].events = op->send ? POLLOUT : POLLIN;
+        np++;
+      }
+    }
+    if (!progress && left != 0) {
+      if (pfd == NULL) {
+        sched_yield();
+      } else if (poll(pfd, np, -1) < 0 && errno != EINTR) {
+        free(busy);
+        free(pfd);
+        return error_sys(comm->ctx->err, "poll");
+      }
+    }
+  }
+  free(busy);
+  free(pfd);
+  return GA_NO_ERROR;
+}
+
+/* Run the queued operations and empty the queue */
+static int p2p_run(gpucomm *comm) {
+  unsigned int i;
+  p2p_op *op;
+  int err = GA_NO_ERROR;
+
+  for (i = 0; i < comm->nops && err == GA_NO_ERROR; i++) {
+    op = &comm->ops[i];
+    op->host = malloc(op->sz != 0 ? op->sz : 1);
+    if (op->host == NULL)
+      err = error_sys(comm->ctx->err, "malloc");
+    else if (op->send && op->sz != 0)
+      err = gpudata_read(op->host, op->buf, op->off, op->sz);
+  }
+  if (err == GA_NO_ERROR)
+    err = p2p_self(comm);
+  if (err == GA_NO_ERROR)
+    err = p2p_progress(comm);
+  for (i = 0; i < comm->nops && err == GA_NO_ERROR; i++) {
+    op = &comm->ops[i];
+    if (!op->send && op->sz != 0)
+      err = gpudata_write(op->buf, op->off, op->host, op->sz);
+  }
+  for (i = 0; i < comm->nops; i++) {
+    free(comm->ops[i].host);
+    gpudata_release(comm->ops[i].buf);
+  }
+  comm->nops = 0;
+  return err;
+}
+
+static int p2p_queue(gpudata *buf, size_t off, size_t count, int typecode,
+                     int peer, int send, gpucomm *comm) {
+  p2p_op *op;
+  size_t sz;
+
+  if (gpudata_context(buf) != comm->ctx)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "buffer and comm context differ");
+  if (peer < 0 || peer >= comm->ndev)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "Invalid peer");
+  if (gpuarray_get_type(typecode) == NULL)
+    return error_set(comm->ctx->err, GA_INVALID_ERROR, "Invalid data type");
+  sz = count * gpuarray_get_elsize(typecode);
+  if (buffer_size(buf) < off || (buffer_size(buf) - off) < sz)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "buffer too small for operation");
+
+  if (comm->nops == comm->aops) {
+    unsigned int na = comm->aops == 0 ? 8 : comm->aops * 2;
+    p2p_op *tmp = realloc(comm->ops, na * sizeof(*tmp));
+    if (tmp == NULL)
+      return error_sys(comm->ctx->err, "realloc");
+    comm->ops = tmp;
+    comm->aops = na;
+  }
+  op = &comm->ops[comm->nops++];
+  gpudata_retain(buf);
+  op->buf = buf;
+  op->off = off;
+  op->sz = sz;
+  op->done = 0;
+  op->host = NULL;
+  op->peer = peer;
+  op->send = send;
+  if (comm->group == 0)
+    return p2p_run(comm);
+  return GA_NO_ERROR;
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_send.
+ */
+static int p2p_send(gpudata *src, size_t offsrc, size_t count, int typecode,
+                    int peer, gpucomm *comm) {
+  return p2p_queue(src, offsrc, count, typecode, peer, 1, comm);
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_recv.
+ */
+static int p2p_recv(gpudata *dest, size_t offdest, size_t count, int typecode,
+                    int peer, gpucomm *comm) {
+  return p2p_queue(dest, offdest, count, typecode, peer, 0, comm);
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_group_start.
+ */
+static int group_start(gpucomm *comm) {
+  comm->group++;
+  return GA_NO_ERROR;
+}
+
+/**
+ * \brief Host implementation of \ref gpucomm_group_end.
+ */
+static int group_end(gpucomm *comm) {
+  if (comm->group == 0)
+    return error_set(comm->ctx->err, GA_VALUE_ERROR, "No group in progress");
+  if (--comm->group == 0)
+    return p2p_run(comm);
+  return GA_NO_ERROR;
+}
+
+//!< Host implementation of collective operations, used when nothing
+//!< better is available for a context.
+gpuarray_comm_ops host_comm_ops = {comm_new,
+                                   comm_free,
+                                   generate_clique_id,
+                                   get_count,
+                                   get_rank,
+                                   reduce,
+                                   all_reduce,
+                                   reduce_scatter,
+                                   broadcast,
+                                   all_gather,
+                                   p2p_send,
+                                   p2p_recv,
+                                   group_start,
+                                   group_end,
+                                   NULL,
+                                   NULL,
+                                   NULL,
+                                   NULL};
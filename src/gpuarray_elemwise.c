@@ -7,32 +7,83 @@
 #include <gpuarray/util.h>
 
 #include "private.h"
+#include "util/fastdiv.h"
 #include "util/strb.h"
+#include "util/xxhash.h"
 
 struct _GpuElemwise {
   const char *expr; /* Expression code (to be able to build kernels on-demand) */
   const char *preamble; /* Preamble code */
   gpuelemwise_arg *args; /* Argument descriptors */
   GpuKernel k_contig; /* Contiguous kernel */
+  GpuKernel k_contig_32; /* Contiguous kernel with 32-bit indices */
   GpuKernel *k_basic; /* Normal basic kernels */
   GpuKernel *k_basic_32; /* 32-bit address basic kernels */
   size_t *dims; /* Preallocated shape buffer for dimension collapsing */
+  ga_fastdiv *fdiv; /* Division magic for the dims of the basic kernels */
   ssize_t **strides; /* Preallocated strides buffer for dimension collapsing */
   unsigned int nd; /* Current maximum number of dimensions allocated */
   unsigned int n; /* Number of arguments */
   unsigned int narray; /* Number of array arguments */
   int flags; /* Flags for the operation (none at the moment */
+  cache *spec; /* Shape-specialised kernels (GE_SPECIALIZE) */
+  ssize_t *skey; /* Preallocated lookup key for spec */
+  ga_lock lock; /* Protects the buffers above and the kernel arguments */
 };
 
 #define GEN_ADDR32      0x1
 #define GEN_CONVERT_F16 0x2
 
+/* Number of calls with the same geometry before we specialise for it */
+#define SPEC_THRESHOLD 3
+
 /* This makes sure we have the same value for those flags since we use some shortcuts */
 STATIC_ASSERT(GEN_CONVERT_F16 == GE_CONVERT_F16, same_flags_value_elem1);
 
 #define is_array(a) (ISCLR((a).flags, GE_SCALAR))
 #define is_output(a) (ISSET((a).flags, GE_WRITE))
 
+/* Generated kernel, ready to be compiled */
+typedef struct _ksrc {
+  strb sb;
+  int *types;
+  unsigned int numargs;
+  int flags;
+} ksrc;
+
+static void ksrc_clear(ksrc *ks) {
+  strb_clear(&ks->sb);
+  free(ks->types);
+  ks->types = NULL;
+}
+
+static void ksrc_desc(ksrc *ks, gpukernel_desc *d) {
+  d->count = 1;
+  d->strings = (const char **)&ks->sb.s;
+  d->lengths = &ks->sb.l;
+  d->fname = "elem";
+  d->numargs = ks->numargs;
+  d->typecodes = ks->types;
+  d->flags = ks->flags;
+}
+
+static int ksrc_build(GpuKernel *k, gpucontext *ctx, ksrc *ks,
+                      char **err_str) {
+  return GpuKernel_init(k, ctx, 1, (const char **)&ks->sb.s, &ks->sb.l,
+                        "elem", ks->numargs, ks->types, ks->flags, err_str);
+}
+
+/* Wrap a kernel from gpukernel_init_many() */
+static int ksrc_wrap(GpuKernel *k, gpucontext *ctx, ksrc *ks, gpukernel *gk) {
+  k->args = calloc(ks->numargs, sizeof(void *));
+  if (k->args == NULL) {
+    gpukernel_release(gk);
+    return error_sys(ctx->err, "calloc");
+  }
+  k->k = gk;
+  return GA_NO_ERROR;
+}
+
 static inline int k_initialized(GpuKernel *k) {
   return k->k != NULL;
 }
@@ -110,7 +161,12 @@ static int ge_grow(GpuElemwise *ge, unsigned int nd) {
 
   if (reallocaz((void **)&ge->k_basic, sizeof(GpuKernel), ge->nd, nd) ||
       reallocaz((void **)&ge->k_basic_32, sizeof(GpuKernel), ge->nd, nd) ||
-      reallocaz((void **)&ge->dims, sizeof(size_t), ge->nd, nd))
+      reallocaz((void **)&ge->dims, sizeof(size_t), ge->nd, nd) ||
+      reallocaz((void **)&ge->fdiv, sizeof(ga_fastdiv), ge->nd, nd))
+    return 1;
+  if (ISSET(ge->flags, GE_SPECIALIZE) &&
+      reallocaz((void **)&ge->skey, sizeof(ssize_t),
+                3 + ge->nd * (1 + ge->narray), 3 + nd * (1 + ge->narray)))
     return 1;
   for (i = 0; i < ge->narray; i++) {
     if (reallocaz((void **)&ge->strides[i], sizeof(ssize_t), ge->nd, nd))
@@ -120,21 +176,29 @@ static int ge_grow(GpuElemwise *ge, unsigned int nd) {
   return 0;
 }
 
-static int gen_elemwise_basic_kernel(GpuKernel *k, gpucontext *ctx,
-                                     char **err_str,
+/*
+ * If `cdims` is not NULL, the total size, the dimensions and the
+ * strides (`cstrs`) are baked into the source as constants instead of
+ * being passed as arguments.  This lets the compiler strength-reduce
+ * the index computations and drop broadcast dimensions.
+ */
+static int gen_elemwise_basic_kernel(ksrc *ks, gpucontext *ctx,
                                      const char *preamble,
                                      const char *expr,
                                      unsigned int nd, /* Number of dims */
                                      unsigned int n, /* Length of args */
                                      gpuelemwise_arg *args,
-                                     int gen_flags) {
-  strb sb = STRB_STATIC_INIT;
-  unsigned int i, _i, j;
+                                     int gen_flags,
+                                     const size_t *cdims,
+                                     ssize_t **cstrs) {
+  strb *sb = &ks->sb;
+  unsigned int i, _i, j, l;
+  size_t cn;
+  char dn[16];
   int *ktypes;
   char *size = "ga_size", *ssize = "ga_ssize";
   unsigned int p;
   int flags = 0;
-  int res;
 
   if (ISSET(gen_flags, GEN_ADDR32)) {
     size = "ga_uint";
@@ -143,9 +207,14 @@ static int gen_elemwise_basic_kernel(GpuKernel *k, gpucontext *ctx,
 
   flags |= gpuarray_type_flagsa(n, args);
 
-  p = 1 + nd;
-  for (j = 0; j < n; j++) {
-    p += ISSET(args[j].flags, GE_SCALAR) ? 1 : (2 + nd);
+  if (cdims == NULL) {
+    p = 1 + nd + (nd > 0 ? 2 * (nd - 1) : 0);
+    for (j = 0; j < n; j++)
+      p += ISSET(args[j].flags, GE_SCALAR) ? 1 : (2 + nd);
+  } else {
+    p = 0;
+    for (j = 0; j < n; j++)
+      p += ISSET(args[j].flags, GE_SCALAR) ? 1 : 2;
   }
 
   ktypes = calloc(p, sizeof(int));
@@ -154,99 +223,138 @@ static int gen_elemwise_basic_kernel(GpuKernel *k, gpucontext *ctx,
 
   p = 0;
 
-  strb_appends(&sb, "#include \"cluda.h\"\n");
+  strb_appends(sb, "#include \"cluda.h\"\n");
   if (preamble)
-    strb_appends(&sb, preamble);
-  strb_appends(&sb, "\nKERNEL void elem(const ga_size n, ");
-  ktypes[p++] = GA_SIZE;
-  for (i = 0; i < nd; i++) {
-    strb_appendf(&sb, "const ga_size dim%u, ", i);
+    strb_appends(sb, preamble);
+  if (cdims == NULL) {
+    strb_appends(sb, "\nKERNEL void elem(const ga_size n, ");
     ktypes[p++] = GA_SIZE;
+    for (i = 0; i < nd; i++) {
+      strb_appendf(sb, "const ga_size dim%u, ", i);
+      ktypes[p++] = GA_SIZE;
+    }
+    for (i = 1; i < nd; i++) {
+      strb_appendf(sb, "const %s dim%u_m, const ga_uint dim%u_s, ",
+                   size, i, i);
+      ktypes[p++] = ISSET(gen_flags, GEN_ADDR32) ? GA_UINT : GA_SIZE;
+      ktypes[p++] = GA_UINT;
+    }
+  } else {
+    strb_appends(sb, "\nKERNEL void elem(");
   }
   for (j = 0; j < n; j++) {
     if (is_array(args[j])) {
-      strb_appendf(&sb, "GLOBAL_MEM %s *%s_data, const ga_size %s_offset%s",
+      strb_appendf(sb, "GLOBAL_MEM %s *%s_data, const ga_size %s_offset%s",
                    ctype(args[j].typecode), args[j].name, args[j].name,
-                   nd == 0 ? "" : ", ");
+                   (nd == 0 || cdims != NULL) ? "" : ", ");
       ktypes[p++] = GA_BUFFER;
       ktypes[p++] = GA_SIZE;
 
-      for (i = 0; i < nd; i++) {
-        strb_appendf(&sb, "const ga_ssize %s_str_%u%s", args[j].name, i,
+      for (i = 0; i < nd && cdims == NULL; i++) {
+        strb_appendf(sb, "const ga_ssize %s_str_%u%s", args[j].name, i,
                      (i == (nd - 1)) ? "": ", ");
         ktypes[p++] = GA_SSIZE;
       }
     } else {
-      strb_appendf(&sb, "%s %s", ctype(args[j].typecode), args[j].name);
+      strb_appendf(sb, "%s %s", ctype(args[j].typecode), args[j].name);
       ktypes[p++] = args[j].typecode;
     }
-    if (j != (n - 1)) strb_appends(&sb, ", ");
+    if (j != (n - 1)) strb_appends(sb, ", ");
   }
-  strb_appendf(&sb, ") {\n"
+  strb_appendf(sb, ") {\n"
                "const %s idx = LDIM_0 * GID_0 + LID_0;\n"
                "const %s numThreads = LDIM_0 * GDIM_0;\n"
                "%s i;\n", size, size, size);
+  /* The offsets are applied once here so that they don't have to fit
+     in the index type, only the distances inside each array do. */
+  for (j = 0; j < n; j++) {
+    if (is_array(args[j]))
+      strb_appendf(sb, "%s_data = (GLOBAL_MEM %s *)(((GLOBAL_MEM char *)"
+                   "%s_data) + %s_offset);\n", args[j].name,
+                   ctype(args[j].typecode), args[j].name, args[j].name);
+  }
+  if (cdims != NULL) {
+    cn = 1;
+    for (i = 0; i < nd; i++)
+      cn *= cdims[i];
+    strb_appendf(sb, "const %s n = %" SPREFIX "u;\n", size, cn);
+  }
 
-  strb_appends(&sb, "for(i = idx; i < n; i += numThreads) {\n");
+  strb_appends(sb, "for(i = idx; i < n; i += numThreads) {\n");
   if (nd > 0)
-    strb_appendf(&sb, "%s ii = i;\n%s pos;\n", size, size);
+    strb_appendf(sb, "%s ii = i;\n%s pos;\n", size, size);
   for (j = 0; j < n; j++) {
     if (is_array(args[j]))
-      strb_appendf(&sb, "%s %s_p = %s_offset;\n",
-                   size, args[j].name, args[j].name);
+      strb_appendf(sb, "%s %s_p = 0;\n", ssize, args[j].name);
   }
   for (_i = nd; _i > 0; _i--) {
     i = _i - 1;
-    if (i > 0)
-      strb_appendf(&sb, "pos = ii %% (%s)dim%u;\nii = ii / (%s)dim%u;\n", size, i, size, i);
-    else
-      strb_appends(&sb, "pos = ii;\n");
+    if (cdims == NULL) {
+      if (i > 0) {
+        sprintf(dn, "dim%u", i);
+        ga_fastdiv_append(sb, ISSET(gen_flags, GEN_ADDR32), "ii", "pos", dn);
+      } else {
+        strb_appends(sb, "pos = ii;\n");
+      }
+    } else {
+      if (i > 0)
+        strb_appendf(sb, "pos = ii %% (%s)%" SPREFIX "u;\n"
+                     "ii = ii / (%s)%" SPREFIX "u;\n",
+                     size, cdims[i], size, cdims[i]);
+      else
+        strb_appends(sb, "pos = ii;\n");
+    }
+    l = 0;
     for (j = 0; j < n; j++) {
-      if (is_array(args[j]))
-        strb_appendf(&sb, "%s_p += pos * (%s)%s_str_%u;\n", args[j].name,
-                     ssize, args[j].name, i);
+      if (is_array(args[j])) {
+        if (cstrs == NULL)
+          strb_appendf(sb, "%s_p += pos * (%s)%s_str_%u;\n", args[j].name,
+                       ssize, args[j].name, i);
+        else if (cstrs[l][i] != 0)
+          strb_appendf(sb, "%s_p += pos * (%s)%" SPREFIX "d;\n",
+                       args[j].name, ssize, cstrs[l][i]);
+        l++;
+      }
     }
   }
   for (j = 0; j < n; j++) {
     if (is_array(args[j])) {
-      strb_appendf(&sb, "%s %s;", ctype(ISSET(gen_flags, GEN_CONVERT_F16) && args[j].typecode == GA_HALF ?
+      strb_appendf(sb, "%s %s;", ctype(ISSET(gen_flags, GEN_CONVERT_F16) && args[j].typecode == GA_HALF ?
                                         GA_FLOAT : args[j].typecode), args[j].name);
       if (ISSET(args[j].flags, GE_READ)) {
         if (args[j].typecode == GA_HALF && ISSET(gen_flags, GEN_CONVERT_F16)) {
-          strb_appendf(&sb, "%s = ga_half2float(*(GLOBAL_MEM ga_half *)(((GLOBAL_MEM char *)%s_data) + %s_p));\n",
+          strb_appendf(sb, "%s = ga_half2float(*(GLOBAL_MEM ga_half *)(((GLOBAL_MEM char *)%s_data) + %s_p));\n",
                        args[j].name, args[j].name, args[j].name);
         } else {
-          strb_appendf(&sb, "%s = *(GLOBAL_MEM %s *)(((GLOBAL_MEM char *)%s_data) + %s_p);\n",
+          strb_appendf(sb, "%s = *(GLOBAL_MEM %s *)(((GLOBAL_MEM char *)%s_data) + %s_p);\n",
                        args[j].name, ctype(args[j].typecode), args[j].name, args[j].name);
         }
       }
     }
   }
-  strb_appends(&sb, expr);
-  strb_appends(&sb, ";\n");
+  strb_appends(sb, expr);
+  strb_appends(sb, ";\n");
   for (j = 0; j < n; j++) {
     if (is_array(args[j]) && ISSET(args[j].flags, GE_WRITE)) {
       if (args[j].typecode == GA_HALF && ISSET(gen_flags, GEN_CONVERT_F16)) {
-        strb_appendf(&sb, "*(GLOBAL_MEM ga_half *)(((GLOBAL_MEM char *)%s_data) + %s_p) = ga_float2half(%s);\n",
+        strb_appendf(sb, "*(GLOBAL_MEM ga_half *)(((GLOBAL_MEM char *)%s_data) + %s_p) = ga_float2half(%s);\n",
                      args[j].name, args[j].name, args[j].name);
       } else {
-        strb_appendf(&sb, "*(GLOBAL_MEM %s *)(((GLOBAL_MEM char *)%s_data) + %s_p) = %s;\n",
+        strb_appendf(sb, "*(GLOBAL_MEM %s *)(((GLOBAL_MEM char *)%s_data) + %s_p) = %s;\n",
                      ctype(args[j].typecode), args[j].name, args[j].name, args[j].name);
       }
     }
   }
-  strb_appends(&sb, "}\n}\n");
-  if (strb_error(&sb)) {
-    res = GA_MEMORY_ERROR;
-    goto bail;
+  strb_appends(sb, "}\n}\n");
+  ks->types = ktypes;
+  ks->numargs = p;
+  ks->flags = flags;
+  if (strb_error(sb)) {
+    ksrc_clear(ks);
+    return error_set(ctx->err, GA_MEMORY_ERROR,
+                     "Formatting error creating kernel source");
   }
-
-  res = GpuKernel_init(k, ctx, 1, (const char **)&sb.s, &sb.l, "elem",
-                       p, ktypes, flags, err_str);
- bail:
-  free(ktypes);
-  strb_clear(&sb);
-  return res;
+  return GA_NO_ERROR;
 }
 
 static ssize_t **strides_array(unsigned int num, unsigned int nd) {
@@ -279,6 +387,7 @@ static int check_basic(GpuElemwise *ge, void **args, int flags,
   int call32 = 1;
   unsigned int nd_i = 0;
   size_t v_dim_j = 0;
+  size_t ext, s;
 
   /* Go through the list and grab some info */
   for (i = 0; i < ge->n; i++) {
@@ -357,7 +466,6 @@ static int check_basic(GpuElemwise *ge, void **args, int flags,
         if (v_dim_j == 1) {
           ge->strides[p][j] = 0;
         }
-        call32 &= v->offset < ADDR32_MAX;
         call32 &= (SADDR32_MIN < ge->strides[p][j] &&
                    ge->strides[p][j] < SADDR32_MAX);
         p++;
@@ -369,6 +477,20 @@ static int check_basic(GpuElemwise *ge, void **args, int flags,
 
   call32 &= n < ADDR32_MAX;
 
+  /* The offsets are applied outside of the index computations, so
+     for 32-bit addressing we only need the span of each array to fit
+     in a ga_int. */
+  for (p = 0; p < num_arrays && call32; p++) {
+    ext = 0;
+    for (j = 0; j < nd && call32; j++) {
+      if (ge->dims[j] == 0)
+        break;
+      s = ge->strides[p][j] < 0 ? -ge->strides[p][j] : ge->strides[p][j];
+      ext += (ge->dims[j] - 1) * s;
+      call32 &= ext < SADDR32_MAX;
+    }
+  }
+
   if (ISCLR(flags, GE_NOCOLLAPSE) && nd > 1) {
     gpuarray_elemwise_collapse(num_arrays, &nd, ge->dims, ge->strides);
   }
@@ -382,25 +504,176 @@ static int check_basic(GpuElemwise *ge, void **args, int flags,
   return GA_NO_ERROR;
 }
 
+/*
+ * Specialised kernels are keyed by the collapsed geometry of the call:
+ * {number of words, nd, call32, dims[nd], strides[narray][nd]}.
+ */
+struct spec {
+  unsigned int hits;
+  int state; /* 0: counting, 1: built, -1: failed to build */
+  GpuKernel k;
+};
+
+static int spec_eq(cache_key_t _k1, cache_key_t _k2) {
+  ssize_t *k1 = _k1;
+  ssize_t *k2 = _k2;
+  return k1[0] == k2[0] && memcmp(k1, k2, k1[0] * sizeof(ssize_t)) == 0;
+}
+
+static uint32_t spec_hash(cache_key_t k) {
+  return XXH32(k, ((ssize_t *)k)[0] * sizeof(ssize_t), 42);
+}
+
+static void spec_free(cache_value_t v) {
+  struct spec *sp = v;
+  if (k_initialized(&sp->k))
+    GpuKernel_clear(&sp->k);
+  free(sp);
+}
+
+/*
+ * Returns the specialised kernel for this geometry, or NULL if the
+ * generic one should be used.  A kernel is only built once its
+ * geometry was seen SPEC_THRESHOLD times, so that varying shapes don't
+ * cause a compile on every call.  Failures are not reported since we
+ * can always fall back to the generic kernel.
+ */
+static GpuKernel *spec_get(GpuElemwise *ge, gpucontext *ctx, unsigned int nd,
+                           size_t *dims, ssize_t **strs, int call32) {
+  ksrc ks = {STRB_STATIC_INIT, NULL, 0, 0};
+  struct spec *sp;
+  ssize_t *key = ge->skey;
+  unsigned int i, l, w;
+
+  w = 0;
+  key[w++] = 3 + nd * (1 + ge->narray);
+  key[w++] = nd;
+  key[w++] = call32;
+  for (i = 0; i < nd; i++)
+    key[w++] = dims[i];
+  for (l = 0; l < ge->narray; l++)
+    for (i = 0; i < nd; i++)
+      key[w++] = strs[l][i];
+
+  sp = cache_get(ge->spec, key);
+  if (sp == NULL) {
+    sp = calloc(1, sizeof(*sp));
+    key = memdup(key, w * sizeof(ssize_t));
+    if (sp == NULL || key == NULL || cache_add(ge->spec, key, sp) != 0) {
+      free(sp);
+      free(key);
+    } else {
+      sp->hits = 1;
+    }
+    return NULL;
+  }
+  if (sp->state == 1)
+    return &sp->k;
+  if (sp->state < 0 || ++sp->hits < SPEC_THRESHOLD)
+    return NULL;
+
+  if (gen_elemwise_basic_kernel(&ks, ctx, ge->preamble, ge->expr, nd,
+                                ge->n, ge->args,
+                                ((call32 ? GEN_ADDR32 : 0) |
+                                 (ge->flags & GE_CONVERT_F16)),
+                                dims, strs) != GA_NO_ERROR) {
+    sp->state = -1;
+    return NULL;
+  }
+  sp->state = ksrc_build(&sp->k, ctx, &ks, NULL) == GA_NO_ERROR ? 1 : -1;
+  ksrc_clear(&ks);
+  return sp->state == 1 ? &sp->k : NULL;
+}
+
+/*
+ * The 32-bit kernels step their index by gs*ls, so the index past the
+ * last element must still fit.
+ */
+static int fits32(size_t n, size_t gs, size_t ls) {
+  return gs * ls <= ADDR32_MAX && n <= ADDR32_MAX - gs * ls;
+}
+
+static int call_spec(GpuElemwise *ge, GpuKernel *k, void **args, size_t n,
+                     size_t gs, size_t ls) {
+  GpuArray *a;
+  unsigned int i, p;
+  int err;
+
+  p = 0;
+  for (i = 0; i < ge->n; i++) {
+    if (is_array(ge->args[i])) {
+      a = (GpuArray *)args[i];
+      err = GpuKernel_setarg(k, p++, a->data);
+      if (err != GA_NO_ERROR) return err;
+      err = GpuKernel_setarg(k, p++, &a->offset);
+      if (err != GA_NO_ERROR) return err;
+    } else {
+      err = GpuKernel_setarg(k, p++, args[i]);
+      if (err != GA_NO_ERROR) return err;
+    }
+  }
+  return GpuKernel_call(k, 1, &gs, &ls, 0, NULL);
+}
+
+static int build_basic(GpuElemwise *ge, gpucontext *ctx, GpuKernel *k,
+                       unsigned int nd, int call32) {
+  ksrc ks = {STRB_STATIC_INIT, NULL, 0, 0};
+  int err;
+
+  if (k_initialized(k))
+    return GA_NO_ERROR;
+  err = gen_elemwise_basic_kernel(&ks, ctx, ge->preamble, ge->expr, nd,
+                                  ge->n, ge->args,
+                                  ((call32 ? GEN_ADDR32 : 0) |
+                                   (ge->flags & GE_CONVERT_F16)),
+                                  NULL, NULL);
+  if (err != GA_NO_ERROR)
+    return err;
+  err = ksrc_build(k, ctx, &ks, NULL);
+  ksrc_clear(&ks);
+  return err;
+}
+
 static int call_basic(GpuElemwise *ge, void **args, size_t n, unsigned int nd,
                       size_t *dims, ssize_t **strs, int call32) {
+  gpucontext *ctx = GpuKernel_context(&ge->k_contig);
   GpuKernel *k;
   size_t ls = 0, gs = 0;
   unsigned int p = 0, i, j, l;
   int err;
 
-  if (nd == 0) return error_set(GpuKernel_context(&ge->k_contig)->err, GA_VALUE_ERROR, "nd == 0");
+  if (nd == 0) return error_set(ctx->err, GA_VALUE_ERROR, "nd == 0");
 
-  if (call32)
+  if (call32) {
     k = &ge->k_basic_32[nd-1];
-  else
-    k = &ge->k_basic[nd-1];
+    err = build_basic(ge, ctx, k, nd, 1);
+    if (err != GA_NO_ERROR)
+      return err;
+    err = GpuKernel_sched(k, n, &gs, &ls);
+    if (err != GA_NO_ERROR)
+      return err;
+    call32 = fits32(n, gs, ls);
+  }
 
-  if (!k_initialized(k)) {
-    err = gen_elemwise_basic_kernel(k, GpuKernel_context(&ge->k_contig), NULL,
-                                    ge->preamble, ge->expr, nd, ge->n,
-                                    ge->args, ((call32 ? GEN_ADDR32 : 0) |
-                                               (ge->flags & GE_CONVERT_F16)));
+  if (ge->spec != NULL) {
+    k = spec_get(ge, ctx, nd, dims, strs, call32);
+    if (k != NULL) {
+      size_t sgs = 0, sls = 0;
+      err = GpuKernel_sched(k, n, &sgs, &sls);
+      if (err != GA_NO_ERROR)
+        return err;
+      if (!call32 || fits32(n, sgs, sls))
+        return call_spec(ge, k, args, n, sgs, sls);
+      call32 = 0;
+    }
+  }
+
+  if (call32) {
+    k = &ge->k_basic_32[nd-1];
+  } else {
+    k = &ge->k_basic[nd-1];
+    gs = ls = 0;
+    err = build_basic(ge, ctx, k, nd, 0);
     if (err != GA_NO_ERROR)
       return err;
   }
@@ -412,6 +685,14 @@ static int call_basic(GpuElemwise *ge, void **args, size_t n, unsigned int nd,
     err = GpuKernel_setarg(k, p++, &dims[i]);
     if (err != GA_NO_ERROR) goto error_call_basic;
   }
+  for (i = 1; i < nd; i++) {
+    ga_fastdiv_init(&ge->fdiv[i], dims[i]);
+    err = GpuKernel_setarg(k, p++, call32 ? (void *)&ge->fdiv[i].m32 :
+                           (void *)&ge->fdiv[i].m);
+    if (err != GA_NO_ERROR) goto error_call_basic;
+    err = GpuKernel_setarg(k, p++, &ge->fdiv[i].s);
+    if (err != GA_NO_ERROR) goto error_call_basic;
+  }
 
   /* l is the number of arrays to date */
   l = 0;
@@ -433,27 +714,31 @@ static int call_basic(GpuElemwise *ge, void **args, size_t n, unsigned int nd,
     }
   }
 
-  err = GpuKernel_sched(k, n, &gs, &ls);
-  if (err != GA_NO_ERROR) goto error_call_basic;
+  if (gs == 0) {
+    err = GpuKernel_sched(k, n, &gs, &ls);
+    if (err != GA_NO_ERROR) goto error_call_basic;
+  }
 
   err = GpuKernel_call(k, 1, &gs, &ls, 0, NULL);
  error_call_basic:
   return err;
 }
 
-static int gen_elemwise_contig_kernel(GpuKernel *k,
-                                      gpucontext *ctx, char **err_str,
+static int gen_elemwise_contig_kernel(ksrc *ks, gpucontext *ctx,
                                       const char *preamble,
                                       const char *expr,
                                       unsigned int n,
                                       gpuelemwise_arg *args,
                                       int gen_flags) {
-  strb sb = STRB_STATIC_INIT;
+  strb *sb = &ks->sb;
   int *ktypes = NULL;
+  const char *size = "ga_size";
   unsigned int p;
   unsigned int j;
   int flags = 0;
-  int res;
+
+  if (ISSET(gen_flags, GEN_ADDR32))
+    size = "ga_uint";
 
   flags |= gpuarray_type_flagsa(n, args);
 
@@ -462,86 +747,80 @@ static int gen_elemwise_contig_kernel(GpuKernel *k,
     p += ISSET(args[j].flags, GE_SCALAR) ? 1 : 2;
 
   ktypes = calloc(p, sizeof(int));
-  if (ktypes == NULL) {
-    res = error_sys(ctx->err, "calloc");
-    goto bail;
-  }
+  if (ktypes == NULL)
+    return error_sys(ctx->err, "calloc");
 
   p = 0;
 
-  strb_appends(&sb, "#include \"cluda.h\"\n");
+  strb_appends(sb, "#include \"cluda.h\"\n");
   if (preamble)
-    strb_appends(&sb, preamble);
-  strb_appends(&sb, "\nKERNEL void elem(const ga_size n, ");
-  ktypes[p++] = GA_SIZE;
+    strb_appends(sb, preamble);
+  strb_appendf(sb, "\nKERNEL void elem(const %s n, ", size);
+  ktypes[p++] = ISSET(gen_flags, GEN_ADDR32) ? GA_UINT : GA_SIZE;
   for (j = 0; j < n; j++) {
     if (is_array(args[j])) {
-      strb_appendf(&sb, "GLOBAL_MEM %s *%s_p,  const ga_size %s_offset",
+      strb_appendf(sb, "GLOBAL_MEM %s *%s_p,  const ga_size %s_offset",
                    ctype(args[j].typecode), args[j].name, args[j].name);
       ktypes[p++] = GA_BUFFER;
       ktypes[p++] = GA_SIZE;
     } else {
-      strb_appendf(&sb, "%s %s", ctype(args[j].typecode), args[j].name);
+      strb_appendf(sb, "%s %s", ctype(args[j].typecode), args[j].name);
       ktypes[p++] = args[j].typecode;
     }
     if (j != (n - 1))
-      strb_appends(&sb, ", ");
+      strb_appends(sb, ", ");
   }
-  strb_appends(&sb, ") {\n"
-               "const ga_size idx = LDIM_0 * GID_0 + LID_0;\n"
-               "const ga_size numThreads = LDIM_0 * GDIM_0;\n"
-               "ga_size i;\n"
-               "GLOBAL_MEM char *tmp;\n\n");
+  strb_appendf(sb, ") {\n"
+               "const %s idx = LDIM_0 * GID_0 + LID_0;\n"
+               "const %s numThreads = LDIM_0 * GDIM_0;\n"
+               "%s i;\n"
+               "GLOBAL_MEM char *tmp;\n\n", size, size, size);
   for (j = 0; j < n; j++) {
     if (is_array(args[j])) {
-      strb_appendf(&sb, "tmp = (GLOBAL_MEM char *)%s_p;"
+      strb_appendf(sb, "tmp = (GLOBAL_MEM char *)%s_p;"
                    "tmp += %s_offset; %s_p = (GLOBAL_MEM %s *)tmp;",
                    args[j].name, args[j].name, args[j].name,
                    ctype(args[j].typecode));
     }
   }
 
-  strb_appends(&sb, "for (i = idx; i < n; i += numThreads) {\n");
+  strb_appends(sb, "for (i = idx; i < n; i += numThreads) {\n");
   for (j = 0; j < n; j++) {
     if (is_array(args[j])) {
-      strb_appendf(&sb, "%s %s;\n", ctype(ISSET(gen_flags, GEN_CONVERT_F16) && args[j].typecode == GA_HALF ?
+      strb_appendf(sb, "%s %s;\n", ctype(ISSET(gen_flags, GEN_CONVERT_F16) && args[j].typecode == GA_HALF ?
                                           GA_FLOAT : args[j].typecode), args[j].name);
       if (ISSET(args[j].flags, GE_READ)) {
         if (args[j].typecode == GA_HALF && ISSET(gen_flags, GEN_CONVERT_F16)) {
-          strb_appendf(&sb, "%s = ga_half2float(%s_p[i]);\n", args[j].name, args[j].name);
+          strb_appendf(sb, "%s = ga_half2float(%s_p[i]);\n", args[j].name, args[j].name);
         } else {
-          strb_appendf(&sb, "%s = %s_p[i];\n", args[j].name, args[j].name);
+          strb_appendf(sb, "%s = %s_p[i];\n", args[j].name, args[j].name);
         }
       }
     }
   }
-  strb_appends(&sb, expr);
-  strb_appends(&sb, ";\n");
+  strb_appends(sb, expr);
+  strb_appends(sb, ";\n");
 
   for (j = 0; j < n; j++) {
     if (is_array(args[j])) {
       if (ISSET(args[j].flags, GE_WRITE)) {
         if (args[j].typecode == GA_HALF && ISSET(gen_flags, GEN_CONVERT_F16)) {
-          strb_appendf(&sb, "%s_p[i] = ga_float2half(%s);\n", args[j].name, args[j].name);
+          strb_appendf(sb, "%s_p[i] = ga_float2half(%s);\n", args[j].name, args[j].name);
         } else {
-          strb_appendf(&sb, "%s_p[i] = %s;\n", args[j].name, args[j].name);
+          strb_appendf(sb, "%s_p[i] = %s;\n", args[j].name, args[j].name);
         }
       }
     }
   }
-  strb_appends(&sb, "}\n}\n");
-
-  if (strb_error(&sb)) {
-    res = error_set(ctx->err, GA_MISC_ERROR, "Formatting error creating kernel source");
-    goto bail;
+  strb_appends(sb, "}\n}\n");
+  ks->types = ktypes;
+  ks->numargs = p;
+  ks->flags = flags;
+  if (strb_error(sb)) {
+    ksrc_clear(ks);
+    return error_set(ctx->err, GA_MISC_ERROR, "Formatting error creating kernel source");
   }
-
-  res = GpuKernel_init(k, ctx, 1, (const char **)&sb.s, &sb.l, "elem",
-                       p, ktypes, flags, err_str);
- bail:
-  strb_clear(&sb);
-  free(ktypes);
-  return res;
+  return GA_NO_ERROR;
 }
 
 static int check_contig(GpuElemwise *ge, void **args,
@@ -576,29 +855,137 @@ static int check_contig(GpuElemwise *ge, void **args,
 }
 
 static int call_contig(GpuElemwise *ge, void **args, size_t n) {
+  GpuKernel *k = &ge->k_contig;
   GpuArray *a;
   size_t ls = 0, gs = 0;
   unsigned int i, p;
+  unsigned int n32;
   int err;
 
   p = 0;
-  err = GpuKernel_setarg(&ge->k_contig, p++, &n);
+  /* Only the element count matters here, the offsets are applied to
+     the pointers before the loop. */
+  if (n <= ADDR32_MAX && k_initialized(&ge->k_contig_32)) {
+    err = GpuKernel_sched(&ge->k_contig_32, n, &gs, &ls);
+    if (err != GA_NO_ERROR) return err;
+    if (fits32(n, gs, ls))
+      k = &ge->k_contig_32;
+    else
+      gs = ls = 0;
+  }
+  if (k == &ge->k_contig_32) {
+    n32 = n;
+    err = GpuKernel_setarg(k, p++, &n32);
+  } else {
+    err = GpuKernel_sched(k, n, &gs, &ls);
+    if (err != GA_NO_ERROR) return err;
+    err = GpuKernel_setarg(k, p++, &n);
+  }
   if (err != GA_NO_ERROR) return err;
   for (i = 0; i < ge->n; i++) {
     if (is_array(ge->args[i])) {
       a = (GpuArray *)args[i];
-      err = GpuKernel_setarg(&ge->k_contig, p++, a->data);
+      err = GpuKernel_setarg(k, p++, a->data);
       if (err != GA_NO_ERROR) return err;
-      err = GpuKernel_setarg(&ge->k_contig, p++, &a->offset);
+      err = GpuKernel_setarg(k, p++, &a->offset);
       if (err != GA_NO_ERROR) return err;
     } else {
-      err = GpuKernel_setarg(&ge->k_contig, p++, args[i]);
+      err = GpuKernel_setarg(k, p++, args[i]);
       if (err != GA_NO_ERROR) return err;
     }
   }
-  err = GpuKernel_sched(&ge->k_contig, n, &gs, &ls);
-  if (err != GA_NO_ERROR) return err;
-  return GpuKernel_call(&ge->k_contig, 1, &gs, &ls, 0, NULL);
+  return GpuKernel_call(k, 1, &gs, &ls, 0, NULL);
+}
+
+/*
+ * Build the contiguous kernels and the basic kernels up to `nd`
+ * dimensions.  They are independent so they are compiled in parallel.
+ */
+static int build_kernels(GpuElemwise *ge, gpucontext *ctx, unsigned int nd) {
+  GpuKernel **dst;
+  ksrc *ks;
+  gpukernel_desc *descs;
+  gpukernel **gks;
+#ifdef DEBUG
+  char *errstr = NULL;
+#endif
+  unsigned int i, num;
+  int err;
+
+  num = 2 + nd + (ISCLR(ge->flags, GE_NOADDR64) ? nd : 0);
+  dst = calloc(num, sizeof(*dst));
+  ks = calloc(num, sizeof(*ks));
+  descs = calloc(num, sizeof(*descs));
+  gks = calloc(num, sizeof(*gks));
+  if (dst == NULL || ks == NULL || descs == NULL || gks == NULL) {
+    err = error_sys(ctx->err, "calloc");
+    goto out;
+  }
+
+  dst[0] = &ge->k_contig;
+  err = gen_elemwise_contig_kernel(&ks[0], ctx, ge->preamble, ge->expr,
+                                   ge->n, ge->args,
+                                   (ge->flags & GE_CONVERT_F16));
+  num = 1;
+  if (err == GA_NO_ERROR) {
+    dst[num] = &ge->k_contig_32;
+    err = gen_elemwise_contig_kernel(&ks[num++], ctx, ge->preamble,
+                                     ge->expr, ge->n, ge->args,
+                                     GEN_ADDR32 |
+                                     (ge->flags & GE_CONVERT_F16));
+  }
+  for (i = 0; i < nd && err == GA_NO_ERROR; i++) {
+    dst[num] = &ge->k_basic_32[i];
+    err = gen_elemwise_basic_kernel(&ks[num++], ctx, ge->preamble,
+                                    ge->expr, i+1, ge->n, ge->args,
+                                    GEN_ADDR32 |
+                                    (ge->flags & GE_CONVERT_F16),
+                                    NULL, NULL);
+  }
+  if (ISCLR(ge->flags, GE_NOADDR64)) {
+    for (i = 0; i < nd && err == GA_NO_ERROR; i++) {
+      dst[num] = &ge->k_basic[i];
+      err = gen_elemwise_basic_kernel(&ks[num++], ctx, ge->preamble,
+                                      ge->expr, i+1, ge->n, ge->args,
+                                      (ge->flags & GE_CONVERT_F16),
+                                      NULL, NULL);
+    }
+  }
+  if (err != GA_NO_ERROR)
+    goto out;
+
+  for (i = 0; i < num; i++)
+    ksrc_desc(&ks[i], &descs[i]);
+  err = gpukernel_init_many(ctx, num, descs, gks,
+#ifdef DEBUG
+                            &errstr
+#else
+                            NULL
+#endif
+                            );
+#ifdef DEBUG
+  if (errstr != NULL)
+    fprintf(stderr, "%s\n", errstr);
+  free(errstr);
+#endif
+  if (err != GA_NO_ERROR)
+    goto out;
+  for (i = 0; i < num; i++) {
+    if (err == GA_NO_ERROR)
+      err = ksrc_wrap(dst[i], ctx, &ks[i], gks[i]);
+    else
+      gpukernel_release(gks[i]);
+  }
+
+ out:
+  if (ks != NULL)
+    for (i = 0; i < num; i++)
+      ksrc_clear(&ks[i]);
+  free(gks);
+  free(descs);
+  free(ks);
+  free(dst);
+  return err;
 }
 
 GpuElemwise *GpuElemwise_new(gpucontext *ctx,
@@ -606,17 +993,18 @@ GpuElemwise *GpuElemwise_new(gpucontext *ctx,
                              unsigned int n, gpuelemwise_arg *args,
                              unsigned int nd, int flags) {
   GpuElemwise *res;
-#ifdef DEBUG
-  char *errstr = NULL;
-#endif
   unsigned int i;
-  int ret;
 
   res = calloc(1, sizeof(*res));
   if (res == NULL) {
     error_sys(ctx->err, "calloc");
     return NULL;
   }
+  if (ga_lock_init(&res->lock)) {
+    error_set(ctx->err, GA_SYS_ERROR, "Could not create elemwise lock");
+    free(res);
+    return NULL;
+  }
 
   res->flags = flags;
   res->nd = 8;
@@ -652,6 +1040,11 @@ GpuElemwise *GpuElemwise_new(gpucontext *ctx,
     error_sys(ctx->err, "calloc");
     goto fail;
   }
+  res->fdiv = calloc(res->nd, sizeof(ga_fastdiv));
+  if (res->fdiv == NULL) {
+    error_sys(ctx->err, "calloc");
+    goto fail;
+  }
   res->strides = strides_array(res->narray, res->nd);
   if (res->strides == NULL) {
     error_sys(ctx->err, "strides_array");
@@ -669,66 +1062,21 @@ GpuElemwise *GpuElemwise_new(gpucontext *ctx,
     goto fail;
   }
 
-  ret = gen_elemwise_contig_kernel(&res->k_contig, ctx,
-#ifdef DEBUG
-                                   &errstr,
-#else
-                                   NULL,
-#endif
-                                   res->preamble, res->expr,
-                                   res->n, res->args,
-                                   (res->flags & GE_CONVERT_F16));
-  if (ret != GA_NO_ERROR) {
-#ifdef DEBUG
-    if (errstr != NULL)
-      fprintf(stderr, "%s\n", errstr);
-    free(errstr);
-#endif
-    goto fail;
-  }
-
-  if (ISCLR(flags, GE_NOADDR64)) {
-    for (i = 0; i < nd; i++) {
-      ret = gen_elemwise_basic_kernel(&res->k_basic[i], ctx,
-#ifdef DEBUG
-                                      &errstr,
-#else
-                                      NULL,
-#endif
-                                      res->preamble, res->expr,
-                                      i+1, res->n, res->args,
-                                      (res->flags & GE_CONVERT_F16));
-      if (ret != GA_NO_ERROR) {
-#ifdef DEBUG
-        if (errstr != NULL)
-          fprintf(stderr, "%s\n", errstr);
-        free(errstr);
-#endif
-        goto fail;
-      }
-    }
-  }
-
-  for (i = 0; i < nd; i++) {
-    ret = gen_elemwise_basic_kernel(&res->k_basic_32[i], ctx,
-#ifdef DEBUG
-                                    &errstr,
-#else
-                                    NULL,
-#endif
-                                    res->preamble, res->expr,
-                                    i+1, res->n, res->args,
-                                    GEN_ADDR32 | (res->flags & GE_CONVERT_F16));
-    if (ret != GA_NO_ERROR) {
-#ifdef DEBUG
-      if (errstr != NULL)
-        fprintf(stderr, "%s\n", errstr);
-      free(errstr);
-#endif
+  if (ISSET(flags, GE_SPECIALIZE)) {
+    res->skey = calloc(3 + res->nd * (1 + res->narray), sizeof(ssize_t));
+    if (res->skey == NULL) {
+      error_sys(ctx->err, "calloc");
       goto fail;
     }
+    res->spec = cache_lru(16, 4, spec_eq, spec_hash, free, spec_free,
+                          ctx->err);
+    if (res->spec == NULL)
+      goto fail;
   }
 
+  if (build_kernels(res, ctx, nd) != GA_NO_ERROR)
+    goto fail;
+
   return res;
 
  fail:
@@ -754,13 +1102,20 @@ void GpuElemwise_free(GpuElemwise *ge) {
     }
   if (k_initialized(&ge->k_contig))
     GpuKernel_clear(&ge->k_contig);
+  if (k_initialized(&ge->k_contig_32))
+    GpuKernel_clear(&ge->k_contig_32);
+  if (ge->spec != NULL)
+    cache_destroy(ge->spec);
+  free(ge->skey);
   free(ge->k_basic_32);
   free(ge->k_basic);
   free_args(ge->n, ge->args);
   free((void *)ge->preamble);
   free((void *)ge->expr);
   free(ge->dims);
+  free(ge->fdiv);
   free(ge->strides);
+  ga_lock_destroy(&ge->lock);
   free(ge);
 }
 
@@ -773,15 +1128,16 @@ int GpuElemwise_call(GpuElemwise *ge, void **args, int flags) {
   int call32 = 0;
   int err;
 
+  ga_lock_acquire(&ge->lock);
   err = check_contig(ge, args, &n, &contig);
   if (err == GA_NO_ERROR && contig) {
-    if (n == 0) return GA_NO_ERROR;
-    return call_contig(ge, args, n);
-  }
-  err = check_basic(ge, args, flags, &n, &nd, &dims, &strides, &call32);
-  if (err == GA_NO_ERROR) {
-    if (n == 0) return GA_NO_ERROR;
-    return call_basic(ge, args, n, nd, dims, strides, call32);
+    if (n != 0)
+      err = call_contig(ge, args, n);
+  } else {
+    err = check_basic(ge, args, flags, &n, &nd, &dims, &strides, &call32);
+    if (err == GA_NO_ERROR && n != 0)
+      err = call_basic(ge, args, n, nd, dims, strides, call32);
   }
+  ga_lock_release(&ge->lock);
   return err;
 }
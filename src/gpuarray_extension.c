@@ -11,12 +11,16 @@ extern void cuda_enter(void);
 extern void cuda_exit(void);
 extern void *cuda_make_ctx(void);
 extern void *cuda_get_stream(void);
+extern void *cuda_get_device(void);
 extern void *cuda_make_buf(void);
 extern void *cuda_get_sz(void);
 extern void *cuda_wait(void);
 extern void *cuda_record(void);
+extern void *cuda_wait_stream(void);
+extern void *cuda_record_stream(void);
 extern void *cuda_get_ipc_handle(void);
 extern void *cuda_open_ipc_handle(void);
+extern void *cuda_get_ipc_range(void);
 
 extern void *cl_make_ctx(void);
 extern void *cl_get_stream(void);
@@ -28,12 +32,16 @@ static ext ext_list[] = {
   {"cuda_exit", cuda_exit},
   {"cuda_make_ctx", cuda_make_ctx},
   {"cuda_get_stream", cuda_get_stream},
+  {"cuda_get_device", cuda_get_device},
   {"cuda_make_buf", cuda_make_buf},
   {"cuda_get_sz", cuda_get_sz},
   {"cuda_wait", cuda_wait},
   {"cuda_record", cuda_record},
+  {"cuda_wait_stream", cuda_wait_stream},
+  {"cuda_record_stream", cuda_record_stream},
   {"cuda_get_ipc_handle", cuda_get_ipc_handle},
   {"cuda_open_ipc_handle", cuda_open_ipc_handle},
+  {"cuda_get_ipc_range", cuda_get_ipc_range},
 
   {"cl_make_ctx", cl_make_ctx},
   {"cl_get_stream", cl_get_stream},
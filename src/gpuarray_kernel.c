@@ -23,6 +23,23 @@ int GpuKernel_init(GpuKernel *k, gpucontext *ctx, unsigned int count,
   return res;
 }
 
+int GpuKernel_init_fp(GpuKernel *k, gpucontext *ctx, const gpukernel_fp *fp,
+                      unsigned int count, const char **strs,
+                      const size_t *lens, const char *name,
+                      unsigned int argcount, const int *types, int flags,
+                      char **err_str) {
+  int res = GA_NO_ERROR;
+
+  k->args = calloc(argcount, sizeof(void *));
+  if (k->args == NULL)
+    return error_sys(ctx->err, "calloc");
+  k->k = gpukernel_init_fp(ctx, fp, count, strs, lens, name, argcount, types,
+                           flags, &res, err_str);
+  if (res != GA_NO_ERROR)
+    GpuKernel_clear(k);
+  return res;
+}
+
 void GpuKernel_clear(GpuKernel *k) {
   if (k->k)
     gpukernel_release(k->k);
@@ -88,14 +105,30 @@ int GpuKernel_sched(GpuKernel *k, size_t n, size_t *gs, size_t *ls) {
   return GA_NO_ERROR;
 }
 
+/*
+ * The backend kernel may be shared between GpuKernel objects (through
+ * the kernel cache) and threads, so the arguments are kept in the
+ * wrapper and handed over at call time.
+ */
 int GpuKernel_setarg(GpuKernel *k, unsigned int i, void *a) {
-  return gpukernel_setarg(k->k, i, a);
+  unsigned int argcount;
+  int err;
+
+  err = gpukernel_property(k->k, GA_KERNEL_PROP_NUMARGS, &argcount);
+  if (err != GA_NO_ERROR)
+    return err;
+  if (i >= argcount)
+    return error_set(gpukernel_context(k->k)->err, GA_VALUE_ERROR,
+                     "index is beyond the last argument");
+  k->args[i] = a;
+  return GA_NO_ERROR;
 }
 
 int GpuKernel_call(GpuKernel *k, unsigned int n,
                    const size_t *gs, const size_t *ls,
                    size_t shared, void **args) {
-  return gpukernel_call(k->k, n, gs, ls, shared, args);
+  return gpukernel_call(k->k, n, gs, ls, shared,
+                        args != NULL ? args : k->args);
 }
 
 const char *GpuKernel_error(const GpuKernel *k, int err) {
@@ -15,17 +15,52 @@
 #include "gpuarray/array.h"
 #include "gpuarray/error.h"
 #include "gpuarray/kernel.h"
+#include "gpuarray/reduction.h"
 #include "gpuarray/util.h"
 
 #include "util/strb.h"
+#include "util/error.h"
+#include "util/fastdiv.h"
 #include "util/integerfactoring.h"
 
 
+/* Defines */
+#define REDUX_LSIZE           256 /* Maximum block size of the split kernels. */
+#define REDUX_ITEMS           8   /* Minimum elements per thread when splitting a reduction. */
+#define REDUX_GROUPS_PER_PROC 4   /* Target number of blocks per multiprocessor. */
+#define REDUX_SPLIT_MIN       64  /* Minimum reduction size to split a contiguous reduction. */
+
+
 /* Datatypes */
-struct maxandargmax_ctx{
+struct _GpuReduction{
+	gpucontext*     gpuCtx;
+	char*           preamble;
+	char*           mapExpr;
+	char*           reduceExpr;
+	char*           neutral;
+	int             srcTypeCode;
+	int             accTypeCode;
+	int             dstTypeCode;
+
+	/* Kernels compiled for the last source code generated. */
+	char*           kSource;
+	GpuKernel       k;
+	GpuKernel       kParts;
+	int             kPartsInit;
+};
+
+struct redux_args{
+	int*            types;
+	void**          args;
+	unsigned        n;
+};
+typedef struct redux_args redux_args;
+
+struct redux_ctx{
 	/* Function Arguments. */
-	GpuArray*       dstMax;
-	GpuArray*       dstArgmax;
+	GpuReduction*   gr;          /* NULL for max-and-argmax. */
+	GpuArray*       dst;
+	GpuArray*       dstArg;
 	const GpuArray* src;
 	int             reduxLen;
 	const int*      reduxList;
@@ -36,30 +71,39 @@ struct maxandargmax_ctx{
 	gpucontext*     gpuCtx;
 
 	/* Source code Generator. */
-	const char*     dstMaxType;
-	const char*     dstArgmaxType;
+	const char*     srcType;
+	const char*     accType;
+	const char*     dstType;
+	const char*     dstArgType;
 	int             ndd;
 	int             ndr;
 	int             nds;
 	int             ndh;
+	int             split;
 	strb            s;
 	char*           sourceCode;
-	GpuKernel       kernel;
+	ga_fastdiv*     fdiv;        /* Division magic for the internal axes. */
+	redux_args      kArgs;
+	redux_args      pArgs;
+	GpuKernel*      kernel;
+	GpuKernel*      partsKernel;
+	GpuKernel       kernelSTACK;
 
 	/* Scheduler */
 	int             hwAxisList[3];
 	size_t          blockSize [3];
 	size_t          gridSize  [3];
 	size_t          chunkSize [3];
+	size_t          partsBlockSize;
+	size_t          partsGridSize;
+	size_t          dstSize;
+	size_t          rdxSize;
+	size_t          numParts;
 
 	/* Invoker */
-	gpudata*        srcStepsGD;
-	gpudata*        srcSizeGD;
-	gpudata*        chunkSizeGD;
-	gpudata*        dstMaxStepsGD;
-	gpudata*        dstArgmaxStepsGD;
+	gpudata*        partsGD;
 };
-typedef struct maxandargmax_ctx maxandargmax_ctx;
+typedef struct redux_ctx redux_ctx;
 
 
 
@@ -75,25 +119,47 @@ static void  appendIdxes                        (strb*              s,
                                                  int                endIdx,
                                                  const char*        suffix,
                                                  const char*        epilogue);
-static int   maxandargmaxCheckargs              (maxandargmax_ctx*  ctx);
-static int   maxandargmaxSelectHwAxes           (maxandargmax_ctx*  ctx);
-static int   maxandargmaxGenSource              (maxandargmax_ctx*  ctx);
-static void  maxandargmaxAppendKernel           (maxandargmax_ctx*  ctx);
-static void  maxandargmaxAppendTypedefs         (maxandargmax_ctx*  ctx);
-static void  maxandargmaxAppendPrototype        (maxandargmax_ctx*  ctx);
-static void  maxandargmaxAppendOffsets          (maxandargmax_ctx*  ctx);
-static void  maxandargmaxAppendIndexDeclarations(maxandargmax_ctx*  ctx);
-static void  maxandargmaxAppendRangeCalculations(maxandargmax_ctx*  ctx);
-static void  maxandargmaxAppendLoops            (maxandargmax_ctx*  ctx);
-static void  maxandargmaxAppendLoopMacroDefs    (maxandargmax_ctx*  ctx);
-static void  maxandargmaxAppendLoopOuter        (maxandargmax_ctx*  ctx);
-static void  maxandargmaxAppendLoopInner        (maxandargmax_ctx*  ctx);
-static void  maxandargmaxAppendLoopMacroUndefs  (maxandargmax_ctx*  ctx);
-static void  maxandargmaxComputeAxisList        (maxandargmax_ctx*  ctx);
-static int   maxandargmaxCompile                (maxandargmax_ctx*  ctx);
-static int   maxandargmaxSchedule               (maxandargmax_ctx*  ctx);
-static int   maxandargmaxInvoke                 (maxandargmax_ctx*  ctx);
-static int   maxandargmaxCleanup                (maxandargmax_ctx*  ctx);
+static int   reduxRun                           (redux_ctx*         ctx);
+static int   reduxCheckargs                     (redux_ctx*         ctx);
+static int   reduxSelectHwAxes                  (redux_ctx*         ctx);
+static int   reduxSelectSplit                   (redux_ctx*         ctx);
+static int   reduxGenSource                     (redux_ctx*         ctx);
+static void  reduxAppendTypedefs                (redux_ctx*         ctx);
+static void  reduxAppendArg                     (redux_ctx*         ctx,
+                                                 redux_args*        l,
+                                                 int                typecode,
+                                                 void*              arg,
+                                                 const char*        decl,
+                                                 int                idx);
+static void  reduxAppendKernel                  (redux_ctx*         ctx);
+static void  reduxAppendPrototype               (redux_ctx*         ctx);
+static void  reduxAppendOffsets                 (redux_ctx*         ctx);
+static void  reduxAppendIndexDeclarations       (redux_ctx*         ctx);
+static void  reduxAppendRangeCalculations       (redux_ctx*         ctx);
+static void  reduxAppendLoops                   (redux_ctx*         ctx);
+static void  reduxAppendLoopMacroDefs           (redux_ctx*         ctx);
+static void  reduxAppendLoopOuter               (redux_ctx*         ctx);
+static void  reduxAppendLoopInner               (redux_ctx*         ctx);
+static void  reduxAppendLoopMacroUndefs         (redux_ctx*         ctx);
+static void  reduxAppendSplitKernel             (redux_ctx*         ctx);
+static void  reduxAppendPartsKernel             (redux_ctx*         ctx);
+static void  reduxAppendSizeProduct             (redux_ctx*         ctx,
+                                                 const char*        name,
+                                                 int                startIdx,
+                                                 int                endIdx);
+static void  reduxAppendDecompose               (redux_ctx*         ctx,
+                                                 const char*        var,
+                                                 int                startIdx,
+                                                 int                endIdx,
+                                                 const char*        srcIdx,
+                                                 const char*        dstIdx);
+static void  reduxAppendBlockReduce             (redux_ctx*         ctx);
+static void  reduxComputeAxisList               (redux_ctx*         ctx);
+static int   reduxCompile                       (redux_ctx*         ctx);
+static int   reduxSchedule                      (redux_ctx*         ctx);
+static int   reduxScheduleSplit                 (redux_ctx*         ctx);
+static int   reduxInvoke                        (redux_ctx*         ctx);
+static int   reduxCleanup                       (redux_ctx*         ctx);
 
 
 /* Function implementation */
@@ -102,24 +168,122 @@ GPUARRAY_PUBLIC int GpuArray_maxandargmax       (GpuArray*       dstMax,
                                                  const GpuArray* src,
                                                  unsigned        reduxLen,
                                                  const unsigned* reduxList){
-	maxandargmax_ctx  ctxSTACK = {0};
-	maxandargmax_ctx  *ctx = &ctxSTACK;
+	redux_ctx  ctxSTACK = {0};
+	redux_ctx  *ctx = &ctxSTACK;
+
+	ctxSTACK.gr        = NULL;
+	ctxSTACK.dst       = dstMax;
+	ctxSTACK.dstArg    = dstArgmax;
+	ctxSTACK.src       = src;
+	ctxSTACK.reduxLen  = (int)reduxLen;
+	ctxSTACK.reduxList = (const int*)reduxList;
+
+	return reduxRun(ctx);
+}
+
+GPUARRAY_PUBLIC GpuReduction* GpuReduction_new  (gpucontext*     ctx,
+                                                 const char*     preamble,
+                                                 const char*     map_expr,
+                                                 const char*     reduce_expr,
+                                                 const char*     neutral,
+                                                 int             srctype,
+                                                 int             acctype,
+                                                 int             dsttype){
+	GpuReduction* gr;
+
+	if(acctype < 0){
+		acctype = dsttype == GA_HALF ? GA_FLOAT : dsttype;
+	}
+	if(srctype < 0 || !gpuarray_get_type(srctype)->cluda_name ||
+	   dsttype < 0 || !gpuarray_get_type(dsttype)->cluda_name ||
+	   !gpuarray_get_type(acctype)->cluda_name){
+		error_set(ctx->err, GA_VALUE_ERROR, "Unknown type for reduction");
+		return NULL;
+	}
+	if(acctype == GA_HALF){
+		error_set(ctx->err, GA_VALUE_ERROR, "Cannot accumulate in float16");
+		return NULL;
+	}
+	if(!reduce_expr || !neutral){
+		error_set(ctx->err, GA_VALUE_ERROR, "Missing reduce expression or neutral element");
+		return NULL;
+	}
+
+	gr = calloc(1, sizeof(*gr));
+	if(!gr){
+		error_sys(ctx->err, "calloc");
+		return NULL;
+	}
+
+	gr->gpuCtx      = ctx;
+	gr->srcTypeCode = srctype;
+	gr->accTypeCode = acctype;
+	gr->dstTypeCode = dsttype;
+	gr->preamble    = strdup(preamble ? preamble : "");
+	gr->mapExpr     = strdup(map_expr ? map_expr : "a");
+	gr->reduceExpr  = strdup(reduce_expr);
+	gr->neutral     = strdup(neutral);
+	if(!gr->preamble || !gr->mapExpr || !gr->reduceExpr || !gr->neutral){
+		error_sys(ctx->err, "strdup");
+		GpuReduction_free(gr);
+		return NULL;
+	}
 
-  ctxSTACK.dstMax = dstMax;
-	ctxSTACK.dstArgmax = dstArgmax;
-	ctxSTACK.src = src;
-	ctxSTACK.reduxLen = (int)reduxLen;
+	return gr;
+}
+
+GPUARRAY_PUBLIC void GpuReduction_free          (GpuReduction*   gr){
+	if(!gr){
+		return;
+	}
+	if(gr->kSource){
+		GpuKernel_clear(&gr->k);
+	}
+	if(gr->kPartsInit){
+		GpuKernel_clear(&gr->kParts);
+	}
+	free(gr->kSource);
+	free(gr->preamble);
+	free(gr->mapExpr);
+	free(gr->reduceExpr);
+	free(gr->neutral);
+	free(gr);
+}
+
+GPUARRAY_PUBLIC int GpuReduction_call           (GpuReduction*   gr,
+                                                 GpuArray*       dst,
+                                                 const GpuArray* src,
+                                                 unsigned int    reduxLen,
+                                                 const unsigned* reduxList){
+	redux_ctx  ctxSTACK = {0};
+	redux_ctx  *ctx = &ctxSTACK;
+
+	ctxSTACK.gr        = gr;
+	ctxSTACK.dst       = dst;
+	ctxSTACK.dstArg    = NULL;
+	ctxSTACK.src       = src;
+	ctxSTACK.reduxLen  = (int)reduxLen;
 	ctxSTACK.reduxList = (const int*)reduxList;
 
-	if(maxandargmaxCheckargs   (ctx) == GA_NO_ERROR &&
-	   maxandargmaxSelectHwAxes(ctx) == GA_NO_ERROR &&
-	   maxandargmaxGenSource   (ctx) == GA_NO_ERROR &&
-	   maxandargmaxCompile     (ctx) == GA_NO_ERROR &&
-	   maxandargmaxSchedule    (ctx) == GA_NO_ERROR &&
-	   maxandargmaxInvoke      (ctx) == GA_NO_ERROR){
-		return maxandargmaxCleanup(ctx);
+	return reduxRun(ctx);
+}
+
+/**
+ * @brief Run the whole reduction pipeline over an initialized context.
+ */
+
+static int   reduxRun                           (redux_ctx*         ctx){
+	if(reduxCheckargs   (ctx) == GA_NO_ERROR &&
+	   ctx->dstSize          >  0            &&
+	   reduxSelectHwAxes(ctx) == GA_NO_ERROR &&
+	   reduxSelectSplit (ctx) == GA_NO_ERROR &&
+	   reduxGenSource   (ctx) == GA_NO_ERROR &&
+	   reduxCompile     (ctx) == GA_NO_ERROR &&
+	   reduxSchedule    (ctx) == GA_NO_ERROR &&
+	   reduxInvoke      (ctx) == GA_NO_ERROR){
+		return reduxCleanup(ctx);
 	}else{
-		return maxandargmaxCleanup(ctx);
+		return reduxCleanup(ctx);
 	}
 }
 
@@ -188,15 +352,17 @@ static void  appendIdxes                        (strb*              s,
 
 /**
  * @brief Check the sanity of the arguments, in agreement with the
- *        documentation for GpuArray_maxandargmax().
+ *        documentation for GpuArray_maxandargmax() and
+ *        GpuReduction_call().
  *
  *        Also initialize certain parts of the context.
  *
- * @return GA_INVALID_ERROR if arguments invalid; GA_NO_ERROR otherwise.
+ * @return GA_INVALID_ERROR or GA_VALUE_ERROR if arguments invalid;
+ *         GA_NO_ERROR otherwise.
  */
 
-static int   maxandargmaxCheckargs              (maxandargmax_ctx*  ctx){
-	int i;
+static int   reduxCheckargs                     (redux_ctx*         ctx){
+	int i, f;
 
 	/**
 	 * We initialize certain parts of the context.
@@ -206,45 +372,78 @@ static int   maxandargmaxCheckargs              (maxandargmax_ctx*  ctx){
 	ctx->axisList      = NULL;
 	ctx->gpuCtx        = NULL;
 
-	ctx->dstMaxType    = ctx->dstArgmaxType = NULL;
+	ctx->srcType       = ctx->accType = ctx->dstType = ctx->dstArgType = NULL;
 	ctx->ndh           = 0;
+	ctx->split         = 0;
 	ctx->sourceCode    = NULL;
+	ctx->kernel        = NULL;
+	ctx->partsKernel   = NULL;
 
 	ctx->hwAxisList[0] = ctx->hwAxisList[1] = ctx->hwAxisList[2] = 0;
 	ctx->blockSize [0] = ctx->blockSize [1] = ctx->blockSize [2] = 1;
 	ctx->gridSize  [0] = ctx->gridSize  [1] = ctx->gridSize  [2] = 1;
 	ctx->chunkSize [0] = ctx->chunkSize [1] = ctx->chunkSize [2] = 1;
+	ctx->partsBlockSize = ctx->partsGridSize = 1;
+	ctx->dstSize       = ctx->rdxSize  = ctx->numParts = 1;
 
-	ctx->srcStepsGD    = ctx->srcSizeGD     = ctx->chunkSizeGD   =
-	ctx->dstMaxStepsGD = ctx->dstArgmaxStepsGD = NULL;
+	ctx->partsGD       = NULL;
 
 
-	/* Insane src or reduxLen? */
-	if(!ctx->dstMax || !ctx->dstArgmax || !ctx->src || ctx->src->nd == 0 ||
-	    ctx->reduxLen == 0 || ctx->reduxLen > (int)ctx->src->nd){
+	/* Insane src or dst? */
+	if(!ctx->src || !ctx->dst || (!ctx->gr && !ctx->dstArg)){
+		return ctx->ret=GA_INVALID_ERROR;
+	}
+
+	/* GPU context non-existent? */
+	ctx->gpuCtx        = GpuArray_context(ctx->src);
+	if(!ctx->gpuCtx){
 		return ctx->ret=GA_INVALID_ERROR;
 	}
 
+	/* Insane reduxLen? */
+	if(ctx->src->nd == 0 || ctx->reduxLen == 0 ||
+	   ctx->reduxLen > (int)ctx->src->nd){
+		return ctx->ret=error_set(ctx->gpuCtx->err, GA_INVALID_ERROR,
+		                          "Invalid number of axes to reduce");
+	}
+
 	/* Insane or duplicate list entry? */
 	for(i=0;i<ctx->reduxLen;i++){
 		if(ctx->reduxList[i] <  0                            ||
 		   ctx->reduxList[i] >= (int)ctx->src->nd            ||
 		   axisInSet(ctx->reduxList[i], ctx->reduxList, i, 0)){
-			return ctx->ret=GA_INVALID_ERROR;
+			return ctx->ret=error_fmt(ctx->gpuCtx->err, GA_INVALID_ERROR,
+			                          "Invalid or duplicate reduction axis %d",
+			                          ctx->reduxList[i]);
 		}
 	}
 
-	/* Unknown type? */
-	ctx->dstMaxType    = gpuarray_get_type(ctx->src->typecode)->cluda_name;
-	ctx->dstArgmaxType = gpuarray_get_type(GA_SSIZE)          ->cluda_name;
-	if(!ctx->dstMaxType || !ctx->dstArgmaxType){
-		return ctx->ret=GA_INVALID_ERROR;
+	/* Unknown or mismatched type? */
+	if(ctx->gr){
+		if(ctx->gr->gpuCtx      != ctx->gpuCtx                 ||
+		   GpuArray_context(ctx->dst) != ctx->gpuCtx){
+			return ctx->ret=error_set(ctx->gpuCtx->err, GA_VALUE_ERROR,
+			                          "Arrays and reduction are on different contexts");
+		}
+		if(ctx->gr->srcTypeCode != ctx->src->typecode          ||
+		   ctx->gr->dstTypeCode != ctx->dst->typecode){
+			return ctx->ret=error_set(ctx->gpuCtx->err, GA_VALUE_ERROR,
+			                          "Array types do not match the reduction");
+		}
+		ctx->srcType    = gpuarray_get_type(ctx->gr->srcTypeCode)->cluda_name;
+		ctx->accType    = gpuarray_get_type(ctx->gr->accTypeCode)->cluda_name;
+		ctx->dstType    = gpuarray_get_type(ctx->gr->dstTypeCode)->cluda_name;
+	}else{
+		ctx->srcType    = gpuarray_get_type(ctx->src->typecode)->cluda_name;
+		ctx->accType    = ctx->dstType = ctx->srcType;
+		ctx->dstArgType = gpuarray_get_type(GA_SSIZE)->cluda_name;
+		if(!ctx->dstArgType){
+			return ctx->ret=GA_INVALID_ERROR;
+		}
 	}
-
-	/* GPU context non-existent? */
-	ctx->gpuCtx        = GpuArray_context(ctx->src);
-	if(!ctx->gpuCtx){
-		return ctx->ret=GA_INVALID_ERROR;
+	if(!ctx->srcType || !ctx->accType || !ctx->dstType){
+		return ctx->ret=error_set(ctx->gpuCtx->err, GA_INVALID_ERROR,
+		                          "Unknown type for reduction");
 	}
 
 
@@ -257,6 +456,32 @@ static int   maxandargmaxCheckargs              (maxandargmax_ctx*  ctx){
 	ctx->ndr = ctx->reduxLen;
 	ctx->ndd = ctx->nds - ctx->ndr;
 
+	/* Destination shapes must be the free axes of the source, in order. */
+	if(ctx->dst->nd != (unsigned)ctx->ndd ||
+	   (ctx->dstArg && ctx->dstArg->nd != (unsigned)ctx->ndd)){
+		return ctx->ret=error_set(ctx->gpuCtx->err, GA_VALUE_ERROR,
+		                          "Destination has the wrong number of dimensions");
+	}
+	for(i=0,f=0;i<ctx->nds;i++){
+		if(axisInSet(i, ctx->reduxList, ctx->ndr, 0)){
+			ctx->rdxSize *= ctx->src->dimensions[i];
+			continue;
+		}
+		if(ctx->dst->dimensions[f] != ctx->src->dimensions[i] ||
+		   (ctx->dstArg && ctx->dstArg->dimensions[f] != ctx->src->dimensions[i])){
+			return ctx->ret=error_set(ctx->gpuCtx->err, GA_VALUE_ERROR,
+			                          "Destination shape does not match the free axes");
+		}
+		ctx->dstSize *= ctx->src->dimensions[i];
+		f++;
+	}
+
+	/* There is no argmax of an empty set. */
+	if(!ctx->gr && ctx->rdxSize == 0 && ctx->dstSize > 0){
+		return ctx->ret=error_set(ctx->gpuCtx->err, GA_VALUE_ERROR,
+		                          "Zero-size reduction has no argmax");
+	}
+
 	return ctx->ret;
 }
 
@@ -265,7 +490,7 @@ static int   maxandargmaxCheckargs              (maxandargmax_ctx*  ctx){
  *        dimensions.
  */
 
-static int   maxandargmaxSelectHwAxes           (maxandargmax_ctx*  ctx){
+static int   reduxSelectHwAxes                  (redux_ctx*         ctx){
 	int    i, j, maxI = 0;
 	size_t maxV;
 
@@ -295,24 +520,122 @@ static int   maxandargmaxSelectHwAxes           (maxandargmax_ctx*  ctx){
 }
 
 /**
- * @brief Generate the kernel code for MaxAndArgmax.
+ * @brief Decide whether the work for each output is split among the
+ *        threads of one or more blocks, and among how many blocks.
+ *
+ * This is the case when there are few outputs compared to the size of
+ * the reduction or when the reduction runs over the contiguous axis.
+ * Otherwise every output is reduced by a single thread.  The
+ * max-and-argmax reduction always uses the latter.
+ */
+
+static int   reduxSelectSplit                   (redux_ctx*         ctx){
+	int          i, innermost = -1;
+	ssize_t      minStride = 0, stride;
+	size_t       maxL0, ls, maxParts;
+	unsigned int numProcs;
+
+	if(!ctx->gr){
+		return ctx->ret=GA_NO_ERROR;
+	}
+
+	for(i=0;i<ctx->nds;i++){
+		stride = ctx->src->strides[i] < 0 ? -ctx->src->strides[i] : ctx->src->strides[i];
+		if(ctx->src->dimensions[i] > 1 && (innermost < 0 || stride < minStride)){
+			innermost = i;
+			minStride = stride;
+		}
+	}
+
+	ctx->split = ctx->ndd == 0                 ||
+	             ctx->dstSize < ctx->rdxSize   ||
+	             (innermost >= 0                                   &&
+	              axisInSet(innermost, ctx->reduxList, ctx->ndr, 0) &&
+	              ctx->rdxSize >= REDUX_SPLIT_MIN);
+	if(!ctx->split){
+		return ctx->ret=GA_NO_ERROR;
+	}
+
+	ctx->ret = gpucontext_property(ctx->gpuCtx, GA_CTX_PROP_NUMPROCS, &numProcs);
+	if(ctx->ret != GA_NO_ERROR){
+		return ctx->ret;
+	}
+	ctx->ret = gpucontext_property(ctx->gpuCtx, GA_CTX_PROP_MAXLSIZE0, &maxL0);
+	if(ctx->ret != GA_NO_ERROR){
+		return ctx->ret;
+	}
+	for(ls=1;ls*2<=maxL0 && ls*2<=REDUX_LSIZE;ls*=2){}
+
+	/**
+	 * Split each reduction over more blocks when there aren't enough
+	 * outputs to occupy the device, as long as every thread still gets a
+	 * few elements.
+	 */
+
+	ctx->numParts = 1;
+	if(ctx->dstSize < (size_t)numProcs*REDUX_GROUPS_PER_PROC){
+		ctx->numParts = ((size_t)numProcs*REDUX_GROUPS_PER_PROC + ctx->dstSize - 1)/ctx->dstSize;
+		maxParts      = (ctx->rdxSize + ls*REDUX_ITEMS - 1)/(ls*REDUX_ITEMS);
+		if(ctx->numParts > maxParts){
+			ctx->numParts = maxParts;
+		}
+		if(ctx->numParts < 1){
+			ctx->numParts = 1;
+		}
+	}
+
+	if(ctx->numParts > 1){
+		ctx->partsGD = gpudata_alloc(ctx->gpuCtx,
+		                             ctx->dstSize*ctx->numParts*gpuarray_get_elsize(ctx->gr->accTypeCode),
+		                             NULL, 0, &ctx->ret);
+		if(!ctx->partsGD){
+			return ctx->ret;
+		}
+	}
+
+	return ctx->ret=GA_NO_ERROR;
+}
+
+/**
+ * @brief Generate the kernel code for the reduction.
  *
  * @return GA_MEMORY_ERROR if not enough memory left; GA_NO_ERROR otherwise.
  */
 
-static int   maxandargmaxGenSource              (maxandargmax_ctx*  ctx){
+static int   reduxGenSource                     (redux_ctx*         ctx){
+	int i;
+
 	/* Compute internal axis remapping. */
 	ctx->axisList = malloc(ctx->nds * sizeof(unsigned));
 	if(!ctx->axisList){
 		return ctx->ret=GA_MEMORY_ERROR;
 	}
-	maxandargmaxComputeAxisList(ctx);
+	reduxComputeAxisList(ctx);
+
+	/* Allocate the kernel argument lists. */
+	ctx->kArgs.types = calloc(16 + 6*ctx->nds, sizeof(int));
+	ctx->kArgs.args  = calloc(16 + 6*ctx->nds, sizeof(void*));
+	ctx->pArgs.types = calloc(16 + 6*ctx->nds, sizeof(int));
+	ctx->pArgs.args  = calloc(16 + 6*ctx->nds, sizeof(void*));
+	ctx->fdiv        = calloc(ctx->nds ? ctx->nds : 1, sizeof(ga_fastdiv));
+	if(!ctx->kArgs.types || !ctx->kArgs.args ||
+	   !ctx->pArgs.types || !ctx->pArgs.args || !ctx->fdiv){
+		return ctx->ret=GA_MEMORY_ERROR;
+	}
+	for(i=0;i<ctx->nds;i++){
+		ga_fastdiv_init(&ctx->fdiv[i], ctx->src->dimensions[ctx->axisList[i]]);
+	}
 
 	/* Generate kernel proper. */
 	strb_ensure(&ctx->s, 5*1024);
-	maxandargmaxAppendKernel(ctx);
-	free(ctx->axisList);
-	ctx->axisList   = NULL;
+	strb_appends(&ctx->s, "#include \"cluda.h\"\n");
+	reduxAppendTypedefs(ctx);
+	if(ctx->split){
+		reduxAppendSplitKernel(ctx);
+		reduxAppendPartsKernel(ctx);
+	}else{
+		reduxAppendKernel(ctx);
+	}
 	ctx->sourceCode = strb_cstr(&ctx->s);
 	if(!ctx->sourceCode){
 		return ctx->ret=GA_MEMORY_ERROR;
@@ -321,98 +644,145 @@ static int   maxandargmaxGenSource              (maxandargmax_ctx*  ctx){
 	/* Return it. */
 	return ctx->ret=GA_NO_ERROR;
 }
-static void  maxandargmaxAppendKernel           (maxandargmax_ctx*  ctx){
-	strb_appends           (&ctx->s, "#include \"cluda.h\"\n");
-	maxandargmaxAppendTypedefs         (ctx);
-	maxandargmaxAppendPrototype        (ctx);
-	strb_appends           (&ctx->s, "{\n");
-	maxandargmaxAppendOffsets          (ctx);
-	maxandargmaxAppendIndexDeclarations(ctx);
-	maxandargmaxAppendRangeCalculations(ctx);
-	maxandargmaxAppendLoops            (ctx);
-	strb_appends           (&ctx->s, "}\n");
-}
-static void  maxandargmaxAppendTypedefs         (maxandargmax_ctx*  ctx){
+static void  reduxAppendTypedefs                (redux_ctx*         ctx){
+	GpuReduction* gr = ctx->gr;
+
 	strb_appends(&ctx->s, "/* Typedefs */\n");
-	strb_appendf(&ctx->s, "typedef %s     T;/* The type of the array being processed. */\n", ctx->dstMaxType);
-	strb_appendf(&ctx->s, "typedef %s     X;/* Index type: signed 32/64-bit. */\n",          ctx->dstArgmaxType);
+	strb_appendf(&ctx->s, "typedef %s     S;/* The type of the array being reduced. */\n", ctx->srcType);
+	strb_appendf(&ctx->s, "typedef %s     A;/* The type of the accumulator. */\n",         ctx->accType);
+	strb_appendf(&ctx->s, "typedef %s     T;/* The type of the destination array. */\n",   ctx->dstType);
+	strb_appendf(&ctx->s, "typedef %s     X;/* Index type: signed 64-bit. */\n",           gpuarray_get_type(GA_SSIZE)->cluda_name);
 	strb_appends(&ctx->s, "\n");
+
+	if(gr){
+		strb_appends(&ctx->s, "/* Reduction */\n");
+		strb_appendf(&ctx->s, "#define REDUX_LSIZE  %u\n",   REDUX_LSIZE);
+		strb_appendf(&ctx->s, "#define NEUTRAL      (%s)\n", gr->neutral);
+		strb_appendf(&ctx->s, "#define MAP(a)       (%s)\n", gr->mapExpr);
+		strb_appendf(&ctx->s, "#define REDUCE(a, b) (%s)\n", gr->reduceExpr);
+		if(gr->srcTypeCode == GA_HALF){
+			strb_appends(&ctx->s, "#define LOADS(v)     ((A)ga_half2float(v))\n");
+		}else{
+			strb_appends(&ctx->s, "#define LOADS(v)     ((A)(v))\n");
+		}
+		if(gr->dstTypeCode == GA_HALF){
+			strb_appends(&ctx->s, "#define STORED(p, v) ((p) = ga_float2half((ga_float)(v)))\n");
+		}else{
+			strb_appends(&ctx->s, "#define STORED(p, v) ((p) = (T)(v))\n");
+		}
+		strb_appends(&ctx->s, "\n");
+		strb_appends(&ctx->s, gr->preamble);
+		strb_appends(&ctx->s, "\n");
+	}
+
 	strb_appends(&ctx->s, "\n");
 	strb_appends(&ctx->s, "\n");
 }
-static void  maxandargmaxAppendPrototype        (maxandargmax_ctx*  ctx){
-	strb_appends(&ctx->s, "KERNEL void maxandargmax(const GLOBAL_MEM T*        src,\n");
-	strb_appends(&ctx->s, "                         const X         srcOff,\n");
-	strb_appends(&ctx->s, "                         const GLOBAL_MEM X*        srcSteps,\n");
-	strb_appends(&ctx->s, "                         const GLOBAL_MEM X*        srcSize,\n");
-	strb_appends(&ctx->s, "                         const GLOBAL_MEM X*        chunkSize,\n");
-	strb_appends(&ctx->s, "                         GLOBAL_MEM T*              dstMax,\n");
-	strb_appends(&ctx->s, "                         const X         dstMaxOff,\n");
-	strb_appends(&ctx->s, "                         const GLOBAL_MEM X*        dstMaxSteps,\n");
-	strb_appends(&ctx->s, "                         GLOBAL_MEM X*              dstArgmax,\n");
-	strb_appends(&ctx->s, "                         const X         dstArgmaxOff,\n");
-	strb_appends(&ctx->s, "                         const GLOBAL_MEM X*        dstArgmaxSteps)");
-}
-static void  maxandargmaxAppendOffsets          (maxandargmax_ctx*  ctx){
+
+/**
+ * @brief Append one parameter to the kernel prototype being generated
+ *        and record its typecode and the address of its value.
+ *
+ * @param [in]  l         The argument list of the kernel.
+ * @param [in]  typecode  The typecode of the argument.
+ * @param [in]  arg       The argument as expected by GpuKernel_call().
+ * @param [in]  decl      Format of the declaration, with at most one %d.
+ * @param [in]  idx       Integer substituted in decl.
+ */
+
+static void  reduxAppendArg                     (redux_ctx*         ctx,
+                                                 redux_args*        l,
+                                                 int                typecode,
+                                                 void*              arg,
+                                                 const char*        decl,
+                                                 int                idx){
+	if(l->n > 0){
+		strb_appends(&ctx->s, ",\n                         ");
+	}
+	strb_appendf(&ctx->s, decl, idx);
+	l->types[l->n] = typecode;
+	l->args [l->n] = arg;
+	l->n++;
+}
+static void  reduxAppendKernel                  (redux_ctx*         ctx){
+	reduxAppendPrototype        (ctx);
+	strb_appends(&ctx->s, "{\n");
+	reduxAppendOffsets          (ctx);
+	reduxAppendIndexDeclarations(ctx);
+	reduxAppendRangeCalculations(ctx);
+	reduxAppendLoops            (ctx);
+	strb_appends(&ctx->s, "}\n");
+}
+static void  reduxAppendPrototype               (redux_ctx*         ctx){
+	redux_args* l = &ctx->kArgs;
+	int         i;
+
+	strb_appendf(&ctx->s, "KERNEL void %s(", ctx->gr ? "redux" : "maxandargmax");
+	reduxAppendArg(ctx, l, GA_BUFFER, (void*) ctx->src->data,   "const GLOBAL_MEM S*        src", 0);
+	reduxAppendArg(ctx, l, GA_SIZE,   (void*)&ctx->src->offset, "const X         srcOff", 0);
+	for(i=0;i<ctx->nds;i++){
+		reduxAppendArg(ctx, l, GA_SIZE,  (void*)&ctx->src->dimensions[ctx->axisList[i]], "const X         i%dDim", i);
+	}
+	for(i=0;i<ctx->nds;i++){
+		reduxAppendArg(ctx, l, GA_SSIZE, (void*)&ctx->src->strides[ctx->axisList[i]],    "const X         i%dSStep", i);
+	}
+	for(i=0;i<ctx->ndh;i++){
+		reduxAppendArg(ctx, l, GA_SIZE,  (void*)&ctx->chunkSize[i],                      "const X         ci%d", i);
+	}
+	reduxAppendArg(ctx, l, GA_BUFFER, (void*) ctx->dst->data,   "GLOBAL_MEM T*              dst", 0);
+	reduxAppendArg(ctx, l, GA_SIZE,   (void*)&ctx->dst->offset, "const X         dstOff", 0);
+	for(i=0;i<ctx->ndd;i++){
+		reduxAppendArg(ctx, l, GA_SSIZE, (void*)&ctx->dst->strides[i],                   "const X         i%dMStep", i);
+	}
+	if(ctx->dstArg){
+		reduxAppendArg(ctx, l, GA_BUFFER, (void*) ctx->dstArg->data,   "GLOBAL_MEM X*              dstArgmax", 0);
+		reduxAppendArg(ctx, l, GA_SIZE,   (void*)&ctx->dstArg->offset, "const X         dstArgmaxOff", 0);
+		for(i=0;i<ctx->ndd;i++){
+			reduxAppendArg(ctx, l, GA_SSIZE, (void*)&ctx->dstArg->strides[i],               "const X         i%dAStep", i);
+		}
+	}
+	strb_appends(&ctx->s, ")");
+}
+static void  reduxAppendOffsets                 (redux_ctx*         ctx){
 	strb_appends(&ctx->s, "\t/* Add offsets */\n");
-	strb_appends(&ctx->s, "\tsrc       = (const GLOBAL_MEM T*)((const GLOBAL_MEM char*)src       + srcOff);\n");
-	strb_appends(&ctx->s, "\tdstMax    = (GLOBAL_MEM T*)      ((GLOBAL_MEM char*)      dstMax    + dstMaxOff);\n");
-	strb_appends(&ctx->s, "\tdstArgmax = (GLOBAL_MEM X*)      ((GLOBAL_MEM char*)      dstArgmax + dstArgmaxOff);\n");
+	strb_appends(&ctx->s, "\tsrc       = (const GLOBAL_MEM S*)((const GLOBAL_MEM char*)src       + srcOff);\n");
+	strb_appends(&ctx->s, "\tdst       = (GLOBAL_MEM T*)      ((GLOBAL_MEM char*)      dst       + dstOff);\n");
+	if(ctx->dstArg){
+		strb_appends(&ctx->s, "\tdstArgmax = (GLOBAL_MEM X*)      ((GLOBAL_MEM char*)      dstArgmax + dstArgmaxOff);\n");
+	}
 	strb_appends(&ctx->s, "\t\n");
 	strb_appends(&ctx->s, "\t\n");
 }
-static void  maxandargmaxAppendIndexDeclarations(maxandargmax_ctx*  ctx){
-	int i;
+static void  reduxAppendIndexDeclarations       (redux_ctx*         ctx){
 	strb_appends(&ctx->s, "\t/* GPU kernel coordinates. Always 3D. */\n");
 
 	strb_appends(&ctx->s, "\tX bi0 = GID_0,        bi1 = GID_1,        bi2 = GID_2;\n");
 	strb_appends(&ctx->s, "\tX bd0 = LDIM_0,       bd1 = LDIM_1,       bd2 = LDIM_2;\n");
 	strb_appends(&ctx->s, "\tX ti0 = LID_0,        ti1 = LID_1,        ti2 = LID_2;\n");
 	strb_appends(&ctx->s, "\tX gi0 = bi0*bd0+ti0,  gi1 = bi1*bd1+ti1,  gi2 = bi2*bd2+ti2;\n");
-	if(ctx->ndh>0){
-		strb_appends(&ctx->s, "\tX ");
-		for(i=0;i<ctx->ndh;i++){
-			strb_appendf(&ctx->s, "ci%u = chunkSize[%u]%s",
-			             i, i, (i==ctx->ndh-1) ? ";\n" : ", ");
-		}
-	}
 
 	strb_appends(&ctx->s, "\t\n");
 	strb_appends(&ctx->s, "\t\n");
 	strb_appends(&ctx->s, "\t/* Free indices & Reduction indices */\n");
 
 	if(ctx->nds > 0){appendIdxes (&ctx->s, "\tX ", "i", 0,               ctx->nds, "",        ";\n");}
-	if(ctx->nds > 0){appendIdxes (&ctx->s, "\tX ", "i", 0,               ctx->nds, "Dim",     ";\n");}
 	if(ctx->nds > 0){appendIdxes (&ctx->s, "\tX ", "i", 0,               ctx->nds, "Start",   ";\n");}
 	if(ctx->nds > 0){appendIdxes (&ctx->s, "\tX ", "i", 0,               ctx->nds, "End",     ";\n");}
-	if(ctx->nds > 0){appendIdxes (&ctx->s, "\tX ", "i", 0,               ctx->nds, "SStep",   ";\n");}
-	if(ctx->ndd > 0){appendIdxes (&ctx->s, "\tX ", "i", 0,               ctx->ndd, "MStep",   ";\n");}
-	if(ctx->ndd > 0){appendIdxes (&ctx->s, "\tX ", "i", 0,               ctx->ndd, "AStep",   ";\n");}
-	if(ctx->nds > ctx->ndd){appendIdxes (&ctx->s, "\tX ", "i", ctx->ndd, ctx->nds, "PDim",    ";\n");}
+	if(ctx->dstArg && ctx->nds > ctx->ndd){
+		appendIdxes (&ctx->s, "\tX ", "i", ctx->ndd, ctx->nds, "PDim",    ";\n");
+	}
 
 	strb_appends(&ctx->s, "\t\n");
 	strb_appends(&ctx->s, "\t\n");
 }
-static void  maxandargmaxAppendRangeCalculations(maxandargmax_ctx*  ctx){
+static void  reduxAppendRangeCalculations       (redux_ctx*         ctx){
 	size_t hwDim;
 	int    i;
 
 	/* Use internal remapping when computing the ranges for this thread. */
 	strb_appends(&ctx->s, "\t/* Compute ranges for this thread. */\n");
 
-	for(i=0;i<ctx->nds;i++){
-		strb_appendf(&ctx->s, "\ti%dDim     = srcSize[%d];\n", i, ctx->axisList[i]);
-	}
-	for(i=0;i<ctx->nds;i++){
-		strb_appendf(&ctx->s, "\ti%dSStep   = srcSteps[%d];\n", i, ctx->axisList[i]);
-	}
-	for(i=0;i<ctx->ndd;i++){
-		strb_appendf(&ctx->s, "\ti%dMStep   = dstMaxSteps[%d];\n", i, i);
-	}
-	for(i=0;i<ctx->ndd;i++){
-		strb_appendf(&ctx->s, "\ti%dAStep   = dstArgmaxSteps[%d];\n", i, i);
-	}
-	for(i=ctx->nds-1;i>=ctx->ndd;i--){
+	for(i=ctx->nds-1;ctx->dstArg && i>=ctx->ndd;i--){
 		/**
 		 * If this is the last index, it's the first cumulative dimension
 		 * product we generate, and thus we initialize to 1.
@@ -452,17 +822,17 @@ static void  maxandargmaxAppendRangeCalculations(maxandargmax_ctx*  ctx){
 	strb_appends(&ctx->s, "\t\n");
 	strb_appends(&ctx->s, "\t\n");
 }
-static void  maxandargmaxAppendLoops            (maxandargmax_ctx*  ctx){
+static void  reduxAppendLoops                   (redux_ctx*         ctx){
 	strb_appends(&ctx->s, "\t/**\n");
 	strb_appends(&ctx->s, "\t * FREE LOOPS.\n");
 	strb_appends(&ctx->s, "\t */\n");
 	strb_appends(&ctx->s, "\t\n");
 
-	maxandargmaxAppendLoopMacroDefs  (ctx);
-	maxandargmaxAppendLoopOuter      (ctx);
-	maxandargmaxAppendLoopMacroUndefs(ctx);
+	reduxAppendLoopMacroDefs  (ctx);
+	reduxAppendLoopOuter      (ctx);
+	reduxAppendLoopMacroUndefs(ctx);
 }
-static void  maxandargmaxAppendLoopMacroDefs    (maxandargmax_ctx*  ctx){
+static void  reduxAppendLoopMacroDefs           (redux_ctx*         ctx){
 	int i;
 
 	/**
@@ -481,7 +851,7 @@ static void  maxandargmaxAppendLoopMacroDefs    (maxandargmax_ctx*  ctx){
 	 * SRCINDEXER Macro
 	 */
 
-	appendIdxes (&ctx->s, "#define SRCINDEXER(", "i", 0, ctx->nds, "", ")   (*(GLOBAL_MEM T*)((GLOBAL_MEM char*)src + ");
+	appendIdxes (&ctx->s, "#define SRCINDEXER(", "i", 0, ctx->nds, "", ")   (*(const GLOBAL_MEM S*)((const GLOBAL_MEM char*)src + ");
 	for(i=0;i<ctx->nds;i++){
 		strb_appendf(&ctx->s, "i%d*i%dSStep + \\\n                                            ", i, i);
 	}
@@ -491,17 +861,19 @@ static void  maxandargmaxAppendLoopMacroDefs    (maxandargmax_ctx*  ctx){
 	 * RDXINDEXER Macro
 	 */
 
-	appendIdxes (&ctx->s, "#define RDXINDEXER(", "i", ctx->ndd, ctx->nds, "", ")              (");
-	for(i=ctx->ndd;i<ctx->nds;i++){
-		strb_appendf(&ctx->s, "i%d*i%dPDim + \\\n                                        ", i, i);
+	if(ctx->dstArg){
+		appendIdxes (&ctx->s, "#define RDXINDEXER(", "i", ctx->ndd, ctx->nds, "", ")              (");
+		for(i=ctx->ndd;i<ctx->nds;i++){
+			strb_appendf(&ctx->s, "i%d*i%dPDim + \\\n                                        ", i, i);
+		}
+		strb_appends(&ctx->s, "0)\n");
 	}
-	strb_appends(&ctx->s, "0)\n");
 
 	/**
-	 * DSTMINDEXER Macro
+	 * DSTINDEXER Macro
 	 */
 
-	appendIdxes (&ctx->s, "#define DSTMINDEXER(", "i", 0, ctx->ndd, "", ")        (*(GLOBAL_MEM T*)((GLOBAL_MEM char*)dstMax + ");
+	appendIdxes (&ctx->s, "#define DSTINDEXER(", "i", 0, ctx->ndd, "", ")         (*(GLOBAL_MEM T*)((GLOBAL_MEM char*)dst + ");
 	for(i=0;i<ctx->ndd;i++){
 		strb_appendf(&ctx->s, "i%d*i%dMStep + \\\n                                                  ", i, i);
 	}
@@ -511,13 +883,15 @@ static void  maxandargmaxAppendLoopMacroDefs    (maxandargmax_ctx*  ctx){
 	 * DSTAINDEXER Macro
 	 */
 
-	appendIdxes (&ctx->s, "#define DSTAINDEXER(", "i", 0, ctx->ndd, "", ")        (*(GLOBAL_MEM X*)((GLOBAL_MEM char*)dstArgmax + ");
-	for(i=0;i<ctx->ndd;i++){
-		strb_appendf(&ctx->s, "i%d*i%dAStep + \\\n                                                     ", i, i);
+	if(ctx->dstArg){
+		appendIdxes (&ctx->s, "#define DSTAINDEXER(", "i", 0, ctx->ndd, "", ")        (*(GLOBAL_MEM X*)((GLOBAL_MEM char*)dstArgmax + ");
+		for(i=0;i<ctx->ndd;i++){
+			strb_appendf(&ctx->s, "i%d*i%dAStep + \\\n                                                     ", i, i);
+		}
+		strb_appends(&ctx->s, "0))\n");
 	}
-	strb_appends(&ctx->s, "0))\n");
 }
-static void  maxandargmaxAppendLoopOuter        (maxandargmax_ctx*  ctx){
+static void  reduxAppendLoopOuter               (redux_ctx*         ctx){
 	int i;
 
 	/**
@@ -532,7 +906,7 @@ static void  maxandargmaxAppendLoopOuter        (maxandargmax_ctx*  ctx){
 	 * Inner Loop Generation
 	 */
 
-	maxandargmaxAppendLoopInner(ctx);
+	reduxAppendLoopInner(ctx);
 
 	/**
 	 * Outer Loop Trailer Generation
@@ -542,7 +916,7 @@ static void  maxandargmaxAppendLoopOuter        (maxandargmax_ctx*  ctx){
 		strb_appends(&ctx->s, "\t}\n");
 	}
 }
-static void  maxandargmaxAppendLoopInner        (maxandargmax_ctx*  ctx){
+static void  reduxAppendLoopInner               (redux_ctx*         ctx){
 	int i;
 
 	/**
@@ -554,11 +928,15 @@ static void  maxandargmaxAppendLoopInner        (maxandargmax_ctx*  ctx){
 	strb_appends(&ctx->s, "\t */\n");
 	strb_appends(&ctx->s, "\t\n");
 
-	appendIdxes (&ctx->s, "\tT maxV = SRCINDEXER(", "i", 0, ctx->ndd, "", "");
-	if(ctx->ndd && ctx->ndr){strb_appends(&ctx->s, ",");}
-	appendIdxes (&ctx->s, "", "i", ctx->ndd, ctx->nds, "Start", ");\n");
+	if(ctx->dstArg){
+		appendIdxes (&ctx->s, "\tT maxV = SRCINDEXER(", "i", 0, ctx->ndd, "", "");
+		if(ctx->ndd && ctx->ndr){strb_appends(&ctx->s, ",");}
+		appendIdxes (&ctx->s, "", "i", ctx->ndd, ctx->nds, "Start", ");\n");
 
-	appendIdxes (&ctx->s, "\tX maxI = RDXINDEXER(", "i", ctx->ndd, ctx->nds, "Start", ");\n");
+		appendIdxes (&ctx->s, "\tX maxI = RDXINDEXER(", "i", ctx->ndd, ctx->nds, "Start", ");\n");
+	}else{
+		strb_appends(&ctx->s, "\tA acc  = NEUTRAL;\n");
+	}
 
 	strb_appends(&ctx->s, "\t\n");
 	strb_appends(&ctx->s, "\t/**\n");
@@ -578,12 +956,17 @@ static void  maxandargmaxAppendLoopInner        (maxandargmax_ctx*  ctx){
 	 * Inner Loop Body Generation
 	 */
 
-	appendIdxes (&ctx->s, "\tT V = SRCINDEXER(", "i", 0, ctx->nds, "", ");\n");
-	strb_appends(&ctx->s, "\t\n");
-	strb_appends(&ctx->s, "\tif(V > maxV){\n");
-	strb_appends(&ctx->s, "\t\tmaxV = V;\n");
-	appendIdxes (&ctx->s, "\t\tmaxI = RDXINDEXER(", "i", ctx->ndd, ctx->nds, "", ");\n");
-	strb_appends(&ctx->s, "\t}\n");
+	if(ctx->dstArg){
+		appendIdxes (&ctx->s, "\tT V = SRCINDEXER(", "i", 0, ctx->nds, "", ");\n");
+		strb_appends(&ctx->s, "\t\n");
+		strb_appends(&ctx->s, "\tif(V > maxV){\n");
+		strb_appends(&ctx->s, "\t\tmaxV = V;\n");
+		appendIdxes (&ctx->s, "\t\tmaxI = RDXINDEXER(", "i", ctx->ndd, ctx->nds, "", ");\n");
+		strb_appends(&ctx->s, "\t}\n");
+	}else{
+		appendIdxes (&ctx->s, "\tA V = LOADS(SRCINDEXER(", "i", 0, ctx->nds, "", "));\n");
+		strb_appends(&ctx->s, "\tacc = REDUCE(acc, MAP(V));\n");
+	}
 
 	/**
 	 * Inner Loop Trailer Generation
@@ -602,19 +985,223 @@ static void  maxandargmaxAppendLoopInner        (maxandargmax_ctx*  ctx){
 	strb_appends(&ctx->s, "\t * Destination writeback.\n");
 	strb_appends(&ctx->s, "\t */\n");
 	strb_appends(&ctx->s, "\t\n");
-	appendIdxes (&ctx->s, "\tDSTMINDEXER(", "i", 0, ctx->ndd, "", ") = maxV;\n");
-	appendIdxes (&ctx->s, "\tDSTAINDEXER(", "i", 0, ctx->ndd, "", ") = maxI;\n");
+	if(ctx->dstArg){
+		appendIdxes (&ctx->s, "\tDSTINDEXER(", "i", 0, ctx->ndd, "", ") = maxV;\n");
+		appendIdxes (&ctx->s, "\tDSTAINDEXER(", "i", 0, ctx->ndd, "", ") = maxI;\n");
+	}else{
+		appendIdxes (&ctx->s, "\tSTORED(DSTINDEXER(", "i", 0, ctx->ndd, "", "), acc);\n");
+	}
 }
-static void  maxandargmaxAppendLoopMacroUndefs  (maxandargmax_ctx*  ctx){
+static void  reduxAppendLoopMacroUndefs         (redux_ctx*         ctx){
 	strb_appends(&ctx->s, "#undef FOROVER\n");
 	strb_appends(&ctx->s, "#undef ESCAPE\n");
 	strb_appends(&ctx->s, "#undef SRCINDEXER\n");
-	strb_appends(&ctx->s, "#undef RDXINDEXER\n");
-	strb_appends(&ctx->s, "#undef DSTMINDEXER\n");
-	strb_appends(&ctx->s, "#undef DSTAINDEXER\n");
+	strb_appends(&ctx->s, "#undef DSTINDEXER\n");
+	if(ctx->dstArg){
+		strb_appends(&ctx->s, "#undef RDXINDEXER\n");
+		strb_appends(&ctx->s, "#undef DSTAINDEXER\n");
+	}
+}
+
+/**
+ * @brief Generate the kernel used when the work for each output is split
+ *        among the threads of a block.
+ *
+ * Block g reduces part g % numParts of output g / numParts, walking the
+ * flattened reduction range with a stride of the block size, then
+ * combines the values of its threads in local memory.  With a single
+ * part the result is written straight to the destination; otherwise it
+ * goes to the parts buffer, to be combined by reduxparts.
+ */
+
+static void  reduxAppendSplitKernel             (redux_ctx*         ctx){
+	redux_args* l = &ctx->kArgs;
+	int         i;
+
+	strb_appends(&ctx->s, "KERNEL void redux(");
+	reduxAppendArg(ctx, l, GA_BUFFER, (void*) ctx->src->data,   "const GLOBAL_MEM S*        src", 0);
+	reduxAppendArg(ctx, l, GA_SIZE,   (void*)&ctx->src->offset, "const X         srcOff", 0);
+	for(i=0;i<ctx->nds;i++){
+		reduxAppendArg(ctx, l, GA_SIZE,  (void*)&ctx->src->dimensions[ctx->axisList[i]], "const X         i%dDim", i);
+	}
+	for(i=0;i<ctx->nds;i++){
+		reduxAppendArg(ctx, l, GA_SIZE,  (void*)&ctx->fdiv[i].m,    "const ga_size   i%dDim_m", i);
+		reduxAppendArg(ctx, l, GA_UINT,  (void*)&ctx->fdiv[i].s,    "const ga_uint   i%dDim_s", i);
+	}
+	for(i=0;i<ctx->nds;i++){
+		reduxAppendArg(ctx, l, GA_SSIZE, (void*)&ctx->src->strides[ctx->axisList[i]],    "const X         i%dSStep", i);
+	}
+	reduxAppendArg(ctx, l, GA_BUFFER, (void*) ctx->dst->data,   "GLOBAL_MEM T*              dst", 0);
+	reduxAppendArg(ctx, l, GA_SIZE,   (void*)&ctx->dst->offset, "const X         dstOff", 0);
+	for(i=0;i<ctx->ndd;i++){
+		reduxAppendArg(ctx, l, GA_SSIZE, (void*)&ctx->dst->strides[i],                   "const X         i%dMStep", i);
+	}
+	/* The parts buffer is unused with a single part, but must be valid. */
+	reduxAppendArg(ctx, l, GA_BUFFER, (void*)(ctx->partsGD ? ctx->partsGD : ctx->dst->data),
+	                                                            "GLOBAL_MEM A*              parts", 0);
+	reduxAppendArg(ctx, l, GA_SIZE,   (void*)&ctx->numParts,    "const X         numParts", 0);
+	strb_appends(&ctx->s, "){\n");
+
+	strb_appends(&ctx->s, "\tLOCAL_MEM A ldata[REDUX_LSIZE];\n");
+	strb_appends(&ctx->s, "\tX lid = LID_0, ldim = LDIM_0;\n");
+	strb_appends(&ctx->s, "\tX g, d, p, r, rEnd, rr, pos, k, chunk, srcBase, srcIdx, dstIdx;\n");
+	reduxAppendSizeProduct(ctx, "dstSize", 0,        ctx->ndd);
+	reduxAppendSizeProduct(ctx, "rdxSize", ctx->ndd, ctx->nds);
+	strb_appends(&ctx->s, "\tA acc, V;\n");
+	strb_appends(&ctx->s, "\t\n");
+	strb_appends(&ctx->s, "\tsrc   = (const GLOBAL_MEM S*)((const GLOBAL_MEM char*)src + srcOff);\n");
+	strb_appends(&ctx->s, "\tdst   = (GLOBAL_MEM T*)      ((GLOBAL_MEM char*)      dst + dstOff);\n");
+	strb_appends(&ctx->s, "\tchunk = (rdxSize + numParts - 1)/numParts;\n");
+	strb_appends(&ctx->s, "\t\n");
+	strb_appends(&ctx->s, "\tfor(g=GID_0;g<dstSize*numParts;g+=GDIM_0){\n");
+	strb_appends(&ctx->s, "\t\td       = g / numParts;\n");
+	strb_appends(&ctx->s, "\t\tp       = g % numParts;\n");
+	strb_appends(&ctx->s, "\t\trr      = d;\n");
+	strb_appends(&ctx->s, "\t\tsrcBase = 0;\n");
+	strb_appends(&ctx->s, "\t\tdstIdx  = 0;\n");
+	reduxAppendDecompose(ctx, "rr", 0, ctx->ndd, "srcBase", "dstIdx");
+	strb_appends(&ctx->s, "\t\trEnd    = (p+1)*chunk < rdxSize ? (p+1)*chunk : rdxSize;\n");
+	strb_appends(&ctx->s, "\t\tacc     = NEUTRAL;\n");
+	strb_appends(&ctx->s, "\t\tfor(r=p*chunk+lid;r<rEnd;r+=ldim){\n");
+	strb_appends(&ctx->s, "\t\trr      = r;\n");
+	strb_appends(&ctx->s, "\t\tsrcIdx  = srcBase;\n");
+	reduxAppendDecompose(ctx, "rr", ctx->ndd, ctx->nds, "srcIdx", NULL);
+	strb_appends(&ctx->s, "\t\tV       = LOADS(*(const GLOBAL_MEM S*)((const GLOBAL_MEM char*)src + srcIdx));\n");
+	strb_appends(&ctx->s, "\t\tacc     = REDUCE(acc, MAP(V));\n");
+	strb_appends(&ctx->s, "\t\t}\n");
+	reduxAppendBlockReduce(ctx);
+	strb_appends(&ctx->s, "\t\tif(lid == 0){\n");
+	strb_appends(&ctx->s, "\t\t\tif(numParts == 1){\n");
+	strb_appends(&ctx->s, "\t\t\t\tSTORED(*(GLOBAL_MEM T*)((GLOBAL_MEM char*)dst + dstIdx), ldata[0]);\n");
+	strb_appends(&ctx->s, "\t\t\t}else{\n");
+	strb_appends(&ctx->s, "\t\t\t\tparts[g] = ldata[0];\n");
+	strb_appends(&ctx->s, "\t\t\t}\n");
+	strb_appends(&ctx->s, "\t\t}\n");
+	strb_appends(&ctx->s, "\t\tlocal_barrier();\n");
+	strb_appends(&ctx->s, "\t}\n");
+	strb_appends(&ctx->s, "}\n");
+	strb_appends(&ctx->s, "\n");
+}
+
+/**
+ * @brief Generate the kernel combining the parts of every output.
+ */
+
+static void  reduxAppendPartsKernel             (redux_ctx*         ctx){
+	redux_args* l = &ctx->pArgs;
+	int         i;
+
+	strb_appends(&ctx->s, "KERNEL void reduxparts(");
+	reduxAppendArg(ctx, l, GA_BUFFER, (void*) ctx->partsGD,     "const GLOBAL_MEM A*        parts", 0);
+	reduxAppendArg(ctx, l, GA_SIZE,   (void*)&ctx->numParts,    "const X         numParts", 0);
+	for(i=0;i<ctx->ndd;i++){
+		reduxAppendArg(ctx, l, GA_SIZE,  (void*)&ctx->src->dimensions[ctx->axisList[i]], "const X         i%dDim", i);
+	}
+	for(i=0;i<ctx->ndd;i++){
+		reduxAppendArg(ctx, l, GA_SIZE,  (void*)&ctx->fdiv[i].m,    "const ga_size   i%dDim_m", i);
+		reduxAppendArg(ctx, l, GA_UINT,  (void*)&ctx->fdiv[i].s,    "const ga_uint   i%dDim_s", i);
+	}
+	reduxAppendArg(ctx, l, GA_BUFFER, (void*) ctx->dst->data,   "GLOBAL_MEM T*              dst", 0);
+	reduxAppendArg(ctx, l, GA_SIZE,   (void*)&ctx->dst->offset, "const X         dstOff", 0);
+	for(i=0;i<ctx->ndd;i++){
+		reduxAppendArg(ctx, l, GA_SSIZE, (void*)&ctx->dst->strides[i],                   "const X         i%dMStep", i);
+	}
+	strb_appends(&ctx->s, "){\n");
+
+	strb_appends(&ctx->s, "\tLOCAL_MEM A ldata[REDUX_LSIZE];\n");
+	strb_appends(&ctx->s, "\tX lid = LID_0, ldim = LDIM_0;\n");
+	strb_appends(&ctx->s, "\tX d, p, rr, pos, k, dstIdx;\n");
+	reduxAppendSizeProduct(ctx, "dstSize", 0, ctx->ndd);
+	strb_appends(&ctx->s, "\tA acc;\n");
+	strb_appends(&ctx->s, "\t\n");
+	strb_appends(&ctx->s, "\tdst = (GLOBAL_MEM T*)((GLOBAL_MEM char*)dst + dstOff);\n");
+	strb_appends(&ctx->s, "\t\n");
+	strb_appends(&ctx->s, "\tfor(d=GID_0;d<dstSize;d+=GDIM_0){\n");
+	strb_appends(&ctx->s, "\t\tacc     = NEUTRAL;\n");
+	strb_appends(&ctx->s, "\t\tfor(p=lid;p<numParts;p+=ldim){\n");
+	strb_appends(&ctx->s, "\t\t\tacc = REDUCE(acc, parts[d*numParts+p]);\n");
+	strb_appends(&ctx->s, "\t\t}\n");
+	reduxAppendBlockReduce(ctx);
+	strb_appends(&ctx->s, "\t\tif(lid == 0){\n");
+	strb_appends(&ctx->s, "\t\trr      = d;\n");
+	strb_appends(&ctx->s, "\t\tdstIdx  = 0;\n");
+	reduxAppendDecompose(ctx, "rr", 0, ctx->ndd, NULL, "dstIdx");
+	strb_appends(&ctx->s, "\t\t\tSTORED(*(GLOBAL_MEM T*)((GLOBAL_MEM char*)dst + dstIdx), ldata[0]);\n");
+	strb_appends(&ctx->s, "\t\t}\n");
+	strb_appends(&ctx->s, "\t\tlocal_barrier();\n");
+	strb_appends(&ctx->s, "\t}\n");
+	strb_appends(&ctx->s, "}\n");
+}
+static void  reduxAppendSizeProduct             (redux_ctx*         ctx,
+                                                 const char*        name,
+                                                 int                startIdx,
+                                                 int                endIdx){
+	int i;
+
+	strb_appendf(&ctx->s, "\tX %s = 1", name);
+	for(i=startIdx;i<endIdx;i++){
+		strb_appendf(&ctx->s, "*i%dDim", i);
+	}
+	strb_appends(&ctx->s, ";\n");
 }
-static void  maxandargmaxComputeAxisList        (maxandargmax_ctx*  ctx){
-	int i, f=0;
+
+/**
+ * @brief Generate the code splitting a flattened index over the internal
+ *        axes [startIdx, endIdx), last axis fastest, and accumulating the
+ *        byte offsets in the source and/or destination.
+ */
+
+static void  reduxAppendDecompose               (redux_ctx*         ctx,
+                                                 const char*        var,
+                                                 int                startIdx,
+                                                 int                endIdx,
+                                                 const char*        srcIdx,
+                                                 const char*        dstIdx){
+	char dn[16];
+	int i;
+
+	for(i=endIdx-1;i>=startIdx;i--){
+		sprintf(dn, "i%dDim", i);
+		strb_appends(&ctx->s, "\t\t");
+		ga_fastdiv_append(&ctx->s, 0, var, "pos", dn);
+		if(srcIdx){
+			strb_appendf(&ctx->s, "\t\t%s += pos*i%dSStep;\n", srcIdx, i);
+		}
+		if(dstIdx){
+			strb_appendf(&ctx->s, "\t\t%s += pos*i%dMStep;\n", dstIdx, i);
+		}
+	}
+}
+
+/**
+ * @brief Generate the tree combining the accumulators of a block into
+ *        ldata[0]. The block size is a power of two.
+ */
+
+static void  reduxAppendBlockReduce             (redux_ctx*         ctx){
+	strb_appends(&ctx->s, "\t\tldata[lid] = acc;\n");
+	strb_appends(&ctx->s, "\t\tlocal_barrier();\n");
+	strb_appends(&ctx->s, "\t\tfor(k=ldim/2;k>0;k/=2){\n");
+	strb_appends(&ctx->s, "\t\t\tif(lid < k){\n");
+	strb_appends(&ctx->s, "\t\t\t\tldata[lid] = REDUCE(ldata[lid], ldata[lid+k]);\n");
+	strb_appends(&ctx->s, "\t\t\t}\n");
+	strb_appends(&ctx->s, "\t\t\tlocal_barrier();\n");
+	strb_appends(&ctx->s, "\t\t}\n");
+}
+
+/**
+ * @brief Compute the internal axis ordering: free axes first, in order,
+ *        then reduction axes.
+ *
+ * For max-and-argmax the reduction axes keep the order given by the
+ * caller, which defines the flattened argmax index. Other reductions
+ * order them by decreasing stride so the innermost loop walks memory
+ * contiguously.
+ */
+
+static void  reduxComputeAxisList               (redux_ctx*         ctx){
+	int     i, j, f=0, t;
+	ssize_t si, sj;
 
 	for(i=0;i<ctx->nds;i++){
 		if(axisInSet(i, ctx->reduxList, ctx->ndr, 0)){
@@ -623,54 +1210,121 @@ static void  maxandargmaxComputeAxisList        (maxandargmax_ctx*  ctx){
 		ctx->axisList[f++] = i;
 	}
 	memcpy(&ctx->axisList[f], ctx->reduxList, ctx->ndr * sizeof(*ctx->reduxList));
+
+	if(ctx->dstArg){
+		return;
+	}
+	for(i=f+1;i<ctx->nds;i++){
+		for(j=i;j>f;j--){
+			si = ctx->src->strides[ctx->axisList[j]];
+			sj = ctx->src->strides[ctx->axisList[j-1]];
+			si = si < 0 ? -si : si;
+			sj = sj < 0 ? -sj : sj;
+			if(sj >= si){
+				break;
+			}
+			t                  = ctx->axisList[j];
+			ctx->axisList[j]   = ctx->axisList[j-1];
+			ctx->axisList[j-1] = t;
+		}
+	}
 }
 
 /**
  * @brief Compile the kernel from source code.
  *
+ * A GpuReduction keeps the kernels of the last source it compiled and
+ * reuses them while the arrays it is called on have the same layout.
+ *
  * @return
  */
 
-static int   maxandargmaxCompile                (maxandargmax_ctx*  ctx){
-	const int    ARG_TYPECODES[]   = {
-		GA_BUFFER, /* src */
-		GA_SIZE,   /* srcOff */
-		GA_BUFFER, /* srcSteps */
-		GA_BUFFER, /* srcSize */
-		GA_BUFFER, /* chnkSize */
-		GA_BUFFER, /* dstMax */
-		GA_SIZE,   /* dstMaxOff */
-		GA_BUFFER, /* dstMaxSteps */
-		GA_BUFFER, /* dstArgmax */
-		GA_SIZE,   /* dstArgmaxOff */
-		GA_BUFFER  /* dstArgmaxSteps */
-	};
-	const unsigned int ARG_TYPECODES_LEN = sizeof(ARG_TYPECODES)/sizeof(*ARG_TYPECODES);
-	const char*  SRCS[1];
-
-	SRCS[0] = ctx->sourceCode;
-
-	ctx->ret = GpuKernel_init(&ctx->kernel,
-	                          ctx->gpuCtx,
-	                          1,
-	                          SRCS,
-	                          NULL,
-	                          "maxandargmax",
-	                          ARG_TYPECODES_LEN,
-	                          ARG_TYPECODES,
-	                          0,
-	                          (char**)0);
-	free(ctx->sourceCode);
-	ctx->sourceCode = NULL;
+static int   reduxCompile                       (redux_ctx*         ctx){
+	GpuReduction* gr = ctx->gr;
+	const char*   SRCS[1];
+	int           flags;
+
+	if(!gr){
+		SRCS[0]     = ctx->sourceCode;
+		ctx->kernel = &ctx->kernelSTACK;
+		ctx->ret    = GpuKernel_init(ctx->kernel,
+		                             ctx->gpuCtx,
+		                             1,
+		                             SRCS,
+		                             NULL,
+		                             "maxandargmax",
+		                             ctx->kArgs.n,
+		                             ctx->kArgs.types,
+		                             gpuarray_type_flags(ctx->src->typecode, -1),
+		                             (char**)0);
+		if(ctx->ret != GA_NO_ERROR){
+			ctx->kernel = NULL;
+		}
+		return ctx->ret;
+	}
 
-	return ctx->ret;
+	flags = gpuarray_type_flags(gr->srcTypeCode, gr->accTypeCode,
+	                            gr->dstTypeCode, -1);
+
+	if(!gr->kSource || strcmp(gr->kSource, ctx->sourceCode) != 0){
+		if(gr->kSource){
+			GpuKernel_clear(&gr->k);
+			free(gr->kSource);
+			gr->kSource = NULL;
+		}
+		if(gr->kPartsInit){
+			GpuKernel_clear(&gr->kParts);
+			gr->kPartsInit = 0;
+		}
+
+		SRCS[0]  = ctx->sourceCode;
+		ctx->ret = GpuKernel_init(&gr->k,
+		                          ctx->gpuCtx,
+		                          1,
+		                          SRCS,
+		                          NULL,
+		                          "redux",
+		                          ctx->kArgs.n,
+		                          ctx->kArgs.types,
+		                          flags,
+		                          (char**)0);
+		if(ctx->ret != GA_NO_ERROR){
+			return ctx->ret;
+		}
+		gr->kSource     = ctx->sourceCode;
+		ctx->sourceCode = NULL;
+	}
+	ctx->kernel = &gr->k;
+
+	if(ctx->numParts > 1){
+		if(!gr->kPartsInit){
+			SRCS[0]  = gr->kSource;
+			ctx->ret = GpuKernel_init(&gr->kParts,
+			                          ctx->gpuCtx,
+			                          1,
+			                          SRCS,
+			                          NULL,
+			                          "reduxparts",
+			                          ctx->pArgs.n,
+			                          ctx->pArgs.types,
+			                          flags,
+			                          (char**)0);
+			if(ctx->ret != GA_NO_ERROR){
+				return ctx->ret;
+			}
+			gr->kPartsInit = 1;
+		}
+		ctx->partsKernel = &gr->kParts;
+	}
+
+	return ctx->ret=GA_NO_ERROR;
 }
 
 /**
  * Compute a good thread block size / grid size / software chunk size for Nvidia.
  */
 
-static int   maxandargmaxSchedule               (maxandargmax_ctx*  ctx){
+static int   reduxSchedule                      (redux_ctx*         ctx){
 	int            i;
 	size_t         warpMod;
 	size_t         bestWarpMod  = 1;
@@ -693,8 +1347,13 @@ static int   maxandargmaxSchedule               (maxandargmax_ctx*  ctx){
 	size_t warpSize,
 	       maxL, maxL0, maxL1, maxL2,  /* Maximum total and per-dimension thread/block sizes */
 	       maxG, maxG0, maxG1, maxG2;  /* Maximum total and per-dimension block /grid  sizes */
-	gpukernel_property(ctx->kernel.k,  GA_KERNEL_PROP_PREFLSIZE, &warpSize);
-	gpukernel_property(ctx->kernel.k,  GA_KERNEL_PROP_MAXLSIZE,  &maxL);
+
+	if(ctx->split){
+		return reduxScheduleSplit(ctx);
+	}
+
+	gpukernel_property(ctx->kernel->k, GA_KERNEL_PROP_PREFLSIZE, &warpSize);
+	gpukernel_property(ctx->kernel->k, GA_KERNEL_PROP_MAXLSIZE,  &maxL);
 	gpudata_property  (ctx->src->data, GA_CTX_PROP_MAXLSIZE0,    &maxL0);
 	gpudata_property  (ctx->src->data, GA_CTX_PROP_MAXLSIZE1,    &maxL1);
 	gpudata_property  (ctx->src->data, GA_CTX_PROP_MAXLSIZE2,    &maxL2);
@@ -776,59 +1435,50 @@ static int   maxandargmaxSchedule               (maxandargmax_ctx*  ctx){
 }
 
 /**
- * Invoke the kernel.
+ * Compute the block and grid sizes of the split kernels. The block size
+ * must be a power of two for the in-block tree.
  */
 
-static int   maxandargmaxInvoke                 (maxandargmax_ctx*  ctx){
-	void* args[11];
+static int   reduxScheduleSplit                 (redux_ctx*         ctx){
+	size_t maxL, maxG0, ls;
 
-	/**
-	 * Argument Marshalling. This the grossest gross thing in here.
-	 */
+	gpukernel_property(ctx->kernel->k, GA_KERNEL_PROP_MAXLSIZE,  &maxL);
+	gpudata_property  (ctx->src->data, GA_CTX_PROP_MAXGSIZE0,    &maxG0);
 
-	const int flags       = GA_BUFFER_READ_ONLY|GA_BUFFER_INIT;
-	ctx->srcStepsGD       = gpudata_alloc(ctx->gpuCtx, ctx->nds    * sizeof(size_t),
-	                                      ctx->src->strides,       flags, 0);
-	ctx->srcSizeGD        = gpudata_alloc(ctx->gpuCtx, ctx->nds    * sizeof(size_t),
-	                                      ctx->src->dimensions,    flags, 0);
-	ctx->chunkSizeGD      = gpudata_alloc(ctx->gpuCtx, ctx->ndh * sizeof(size_t),
-	                                      ctx->chunkSize,          flags, 0);
-	ctx->dstMaxStepsGD    = gpudata_alloc(ctx->gpuCtx, ctx->ndd * sizeof(size_t),
-	                                      ctx->dstMax->strides,    flags, 0);
-	ctx->dstArgmaxStepsGD = gpudata_alloc(ctx->gpuCtx, ctx->ndd * sizeof(size_t),
-	                                      ctx->dstArgmax->strides, flags, 0);
-	args[ 0] = (void*) ctx->src->data;
-	args[ 1] = (void*)&ctx->src->offset;
-	args[ 2] = (void*) ctx->srcStepsGD;
-	args[ 3] = (void*) ctx->srcSizeGD;
-	args[ 4] = (void*) ctx->chunkSizeGD;
-	args[ 5] = (void*) ctx->dstMax->data;
-	args[ 6] = (void*)&ctx->dstMax->offset;
-	args[ 7] = (void*) ctx->dstMaxStepsGD;
-	args[ 8] = (void*) ctx->dstArgmax->data;
-	args[ 9] = (void*)&ctx->dstArgmax->offset;
-	args[10] = (void*) ctx->dstArgmaxStepsGD;
-
-	if(ctx->srcStepsGD      &&
-	   ctx->srcSizeGD       &&
-	   ctx->chunkSizeGD     &&
-	   ctx->dstMaxStepsGD   &&
-	   ctx->dstArgmaxStepsGD){
-		ctx->ret = GpuKernel_call(&ctx->kernel,
-		                          ctx->ndh>0 ? ctx->ndh : 1,
-		                          ctx->gridSize,
-		                          ctx->blockSize,
-		                          0,
-		                          args);
-	}else{
-		ctx->ret = GA_MEMORY_ERROR;
+	for(ls=1;ls*2<=maxL && ls*2<=REDUX_LSIZE;ls*=2){}
+	ctx->blockSize[0] = ls;
+	ctx->gridSize [0] = ctx->dstSize*ctx->numParts < maxG0 ? ctx->dstSize*ctx->numParts : maxG0;
+
+	if(ctx->partsKernel){
+		gpukernel_property(ctx->partsKernel->k, GA_KERNEL_PROP_MAXLSIZE, &maxL);
+		for(ls=1;ls*2<=maxL && ls*2<=REDUX_LSIZE && ls < ctx->numParts;ls*=2){}
+		ctx->partsBlockSize = ls;
+		ctx->partsGridSize  = ctx->dstSize < maxG0 ? ctx->dstSize : maxG0;
 	}
 
-	gpudata_release(ctx->srcStepsGD);
-	gpudata_release(ctx->srcSizeGD);
-	gpudata_release(ctx->chunkSizeGD);
-	gpudata_release(ctx->dstMaxStepsGD);
-	gpudata_release(ctx->dstArgmaxStepsGD);
+	return ctx->ret=GA_NO_ERROR;
+}
+
+/**
+ * Invoke the kernel.
+ */
+
+static int   reduxInvoke                        (redux_ctx*         ctx){
+	ctx->ret = GpuKernel_call(ctx->kernel,
+	                          ctx->ndh>0 && !ctx->split ? ctx->ndh : 1,
+	                          ctx->gridSize,
+	                          ctx->blockSize,
+	                          0,
+	                          ctx->kArgs.args);
+
+	if(ctx->ret == GA_NO_ERROR && ctx->partsKernel){
+		ctx->ret = GpuKernel_call(ctx->partsKernel,
+		                          1,
+		                          &ctx->partsGridSize,
+		                          &ctx->partsBlockSize,
+		                          0,
+		                          ctx->pArgs.args);
+	}
 
 	return ctx->ret;
 }
@@ -837,11 +1487,26 @@ static int   maxandargmaxInvoke                 (maxandargmax_ctx*  ctx){
  * Cleanup
  */
 
-static int   maxandargmaxCleanup                (maxandargmax_ctx*  ctx){
+static int   reduxCleanup                       (redux_ctx*         ctx){
+	if(ctx->kernel == &ctx->kernelSTACK){
+		GpuKernel_clear(ctx->kernel);
+	}
+	if(ctx->partsGD){
+		gpudata_release(ctx->partsGD);
+	}
 	free(ctx->axisList);
+	free(ctx->fdiv);
 	free(ctx->sourceCode);
+	free(ctx->kArgs.types);
+	free(ctx->kArgs.args);
+	free(ctx->pArgs.types);
+	free(ctx->pArgs.args);
 	ctx->axisList       = NULL;
+	ctx->fdiv           = NULL;
 	ctx->sourceCode     = NULL;
+	ctx->kernel         = NULL;
+	ctx->partsKernel    = NULL;
+	ctx->partsGD        = NULL;
 
 	return ctx->ret;
 }
@@ -12,7 +12,8 @@
 #endif
 
 typedef enum {
-  CUDA_SUCCESS = 0
+  CUDA_SUCCESS = 0,
+  CUDA_ERROR_NOT_READY = 600
 } CUresult;
 
 #if defined(_WIN64) || defined(__LP64__)
@@ -10,6 +10,9 @@
 
 #undef DEF_PROC
 
+tncclSend *ncclSend;
+tncclRecv *ncclRecv;
+
 #if defined(WIN32) || defined(_WIN32) || defined(WIN64) || defined(_WIN64) || defined(__APPLE__)
 /* As far as we know, nccl is not available or buildable on platforms
    other than linux */
@@ -29,6 +32,7 @@ static const char libname[] = "libnccl.so";
 static int loaded = 0;
 
 int load_libnccl(error *e) {
+  error opt;
   void *lib;
 
   if (loaded)
@@ -38,11 +42,15 @@ int load_libnccl(error *e) {
   if (lib == NULL)
     return e->code;
 
-  #include "libnccl.fn"
-
   if (ga_func_ptr(lib, "ncclGroupStart", e) == NULL)
     return error_set(e, GA_LOAD_ERROR, "Found NCCL 1.0 but NCCL 2.0 required");
 
+  #include "libnccl.fn"
+
+  /* Optional, checked when used */
+  ncclSend = (tncclSend *)ga_func_ptr(lib, "ncclSend", &opt);
+  ncclRecv = (tncclRecv *)ga_func_ptr(lib, "ncclRecv", &opt);
+
   loaded = 1;
   return GA_NO_ERROR;
 }
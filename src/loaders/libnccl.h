@@ -49,6 +49,12 @@ int load_libnccl(error *e);
 
 #undef DEF_PROC
 
+/* Point-to-point, only in NCCL 2.7 and later.  NULL if unavailable. */
+typedef ncclResult_t tncclSend(const void* sendbuff, size_t count, ncclDataType_t datatype, int peer, ncclComm_t comm, cudaStream_t stream);
+typedef ncclResult_t tncclRecv(void* recvbuff, size_t count, ncclDataType_t datatype, int peer, ncclComm_t comm, cudaStream_t stream);
+extern tncclSend *ncclSend;
+extern tncclRecv *ncclRecv;
+
 /** @endcond */
 
 #endif
@@ -18,6 +18,7 @@
 
 #include "util/strb.h"
 #include "util/error.h"
+#include "util/lock.h"
 #include "cache.h"
 
 #ifdef __cplusplus
@@ -40,6 +41,9 @@ typedef struct _gpuarray_blas_ops gpuarray_blas_ops;
 struct _gpuarray_comm_ops;
 typedef struct _gpuarray_comm_ops gpuarray_comm_ops;
 
+/* Number of distinct kernel names that can be reported by the error buffer */
+#define GA_ERRKERN_MAX 16
+
 #define GPUCONTEXT_HEAD                         \
   const gpuarray_buffer_ops *ops;               \
   const gpuarray_blas_ops *blas_ops;            \
@@ -50,7 +54,13 @@ typedef struct _gpuarray_comm_ops gpuarray_comm_ops;
   int flags;                                    \
   struct _gpudata *errbuf;                      \
   cache *extcopy_cache;                         \
+  cache *kernel_fps;                            \
+  cache *take1_cache;                           \
+  cache *norm_cache;                            \
+  const char *errkern[GA_ERRKERN_MAX];          \
+  int errpending;                               \
   char bin_id[64];                              \
+  ga_lock lock;                                 \
   char tag[8]
 
 /* These will go away eventually but are kept to ease the transition for now */
@@ -62,6 +72,10 @@ struct _gpucontext_props {
   int sched;
   int flags;
   const char *kernel_cache_path;
+  const char *kernel_bundle_path;
+  const char *kernel_record_path;
+  size_t kernel_cache_size;
+  size_t binary_cache_size;
   size_t max_cache_size;
   size_t initial_cache_size;
 };
@@ -273,6 +287,18 @@ struct _gpuarray_comm_ops {
                     gpudata* dest, size_t offdest,
                     size_t count, int typecode,
                     gpucomm* comm);
+  // point-to-point
+  int (*send)(gpudata* src, size_t offsrc, size_t count, int typecode,
+              int peer, gpucomm* comm);
+  int (*recv)(gpudata* dest, size_t offdest, size_t count, int typecode,
+              int peer, gpucomm* comm);
+  int (*group_start)(gpucomm* comm);
+  int (*group_end)(gpucomm* comm);
+  // completion tracking, may be NULL if the ops above are synchronous
+  int (*request_new)(gpucomm* comm, void** ev);
+  int (*request_test)(gpucomm* comm, void* ev, int* done);
+  int (*request_wait)(gpucomm* comm, void* ev);
+  void (*request_free)(gpucomm* comm, void* ev);
 };
 
 #define STATIC_ASSERT(COND, MSG) typedef char static_assertion_##MSG[2*(!!(COND))-1]
@@ -284,6 +310,31 @@ static inline void *memdup(const void *p, size_t s) {
   return res;
 }
 
+/*
+ * Returns the code a kernel named `kname` should store in the context
+ * error buffer to report an error.  `kname` must be a static string.
+ */
+int gpucontext_errcode(gpucontext *ctx, const char *kname);
+
+/*
+ * Recursive lock over the mutable state of a context (reference
+ * counts, allocation and kernel caches, shared kernel arguments).
+ * Device work submitted while holding it should be kept short.
+ */
+static inline void ctx_lock(gpucontext *ctx) {
+  ga_lock_acquire(&ctx->lock);
+}
+
+static inline void ctx_unlock(gpucontext *ctx) {
+  ga_lock_release(&ctx->lock);
+}
+
+/*
+ * Handles the `check_error` argument of the indexing functions after
+ * a kernel that may record errors was launched.
+ */
+int gpucontext_errcheck(gpucontext *ctx, int check_error);
+
 int GpuArray_is_c_contiguous(const GpuArray *a);
 int GpuArray_is_f_contiguous(const GpuArray *a);
 int GpuArray_is_aligned(const GpuArray *a);
@@ -305,6 +356,31 @@ void gpukernel_source_with_line_numbers(unsigned int count,
                                         size_t *newl,
                                         strb *src);
 
+/* Kernel manifests and bundles (see gpuarray_bundle.c) */
+typedef struct _bundle_entry {
+  char bin_id[64];
+  int flags;
+  strb src;
+  strb bin;
+} bundle_entry;
+
+typedef int (*manifest_fn)(void *arg, const char *bin_id, const char *fname,
+                           const strb *src, int flags);
+
+int kernel_manifest_add(const char *path, const char *bin_id,
+                        const char *fname, const char *src, size_t src_len,
+                        int flags, error *e);
+int kernel_manifest_read(const char *path, manifest_fn fn, void *arg,
+                         error *e);
+void bundle_entry_clear(bundle_entry *ent);
+int kernel_bundle_write(const char *path, const bundle_entry *ents,
+                        size_t n, error *e);
+int kernel_bundle_read(const char *path, const char *bin_id,
+                       bundle_entry **ents, size_t *n, error *e);
+
+int cuda_bundle_compile(gpucontext *ctx, const char *arch, const strb *src,
+                        strb *bin, char **err_str);
+
 static inline uint16_t float_to_half(float value) {
 #define ga__shift 13
 #define ga__shiftSign 16
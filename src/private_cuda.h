@@ -6,6 +6,7 @@
 #include <cache.h>
 
 #include "private.h"
+#include "util/shmidx.h"
 
 #include "gpuarray/buffer.h"
 
@@ -41,6 +42,8 @@
 
 /* Keep in sync with the copy in gpuarray/extension.h */
 #define DONTFREE 0x10000000
+/* The context uses the binary cache shared by the process */
+#define CUDA_SHARED_BINS 0x20000000
 
 static inline int error_cuda(error *e, const char *msg, CUresult err) {
   const char *name, *descr;
@@ -77,7 +80,9 @@ typedef struct _cuda_context {
   size_t max_cache_size;
   cache *kernel_cache;
   cache *disk_cache; // This is per-context to avoid lock contention
-  unsigned int enter;
+  cache *bundle_cache;
+  char *record_path;
+  ga_shmidx *disk_idx;
   unsigned char major;
   unsigned char minor;
 } cuda_context;
@@ -106,6 +111,7 @@ STATIC_ASSERT(sizeof(cuda_context) <= sizeof(gpucontext),
 
 cuda_context *cuda_make_ctx(CUcontext ctx, gpucontext_props *p);
 CUstream cuda_get_stream(cuda_context *ctx);
+int cuda_get_device(cuda_context *ctx);
 void cuda_enter(cuda_context *ctx);
 void cuda_exit(cuda_context *ctx);
 
@@ -117,6 +123,8 @@ struct _gpudata {
   CUevent rev;
   CUevent wev;
   CUstream ls; /* last stream used */
+  CUevent cev; /* last use on a side stream (collectives), created lazily */
+  CUstream cs; /* that side stream */
   unsigned int refcnt;
   int flags;
   size_t sz;
@@ -130,6 +138,10 @@ gpudata *cuda_make_buf(cuda_context *c, CUdeviceptr p, size_t sz);
 size_t cuda_get_sz(gpudata *g);
 int cuda_wait(gpudata *, int);
 int cuda_record(gpudata *, int);
+int cuda_waits(gpudata *, int, CUstream);
+int cuda_records(gpudata *, int, CUstream);
+int cuda_wait_stream(gpudata *, int, CUstream);
+int cuda_record_stream(gpudata *, int, CUstream);
 
 /* private flags are in the upper 16 bits */
 #define CUDA_WAIT_READ  0x10000
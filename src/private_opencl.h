@@ -72,6 +72,7 @@ typedef struct _cl_ctx {
   cl_command_queue q;
   char *exts;
   char *options;
+  gpukernel_fp *memset_fp; /* fingerprints of the memset kernels */
 } cl_ctx;
 
 /** @cond NEVER */
@@ -0,0 +1,57 @@
+#include "util/fastdiv.h"
+
+/* ceil(log2(d)) for d > 0 */
+static unsigned int clog2(size_t d) {
+  unsigned int l = 0;
+  while (l < sizeof(size_t) * 8 && ((size_t)1 << l) < d)
+    l++;
+  return l;
+}
+
+/*
+ * floor(2^bits * (2^l - d) / d) + 1, which always fits in `bits` bits
+ * since 2^l - d < d.  This is done as a long division to avoid
+ * needing an integer type twice as wide as size_t.
+ */
+static size_t magic(size_t d, unsigned int l, unsigned int bits) {
+  size_t r, q = 0;
+  unsigned int i;
+  int carry;
+
+  r = (l == sizeof(size_t) * 8) ? (size_t)0 - d : ((size_t)1 << l) - d;
+  for (i = 0; i < bits; i++) {
+    carry = (r >> (sizeof(size_t) * 8 - 1)) != 0;
+    r <<= 1;
+    q <<= 1;
+    if (carry || r >= d) {
+      r -= d;
+      q |= 1;
+    }
+  }
+  return q + 1;
+}
+
+void ga_fastdiv_init(ga_fastdiv *f, size_t d) {
+  unsigned int l, sh1, sh2;
+
+  if (d == 0)
+    d = 1;
+  if (f->d == d)
+    return;
+  l = clog2(d);
+  sh1 = l < 1 ? l : 1;
+  sh2 = l < 1 ? 0 : l - 1;
+  f->d = d;
+  f->m = magic(d, l, sizeof(size_t) * 8);
+  f->m32 = d <= UINT32_MAX ? (uint32_t)magic(d, l, 32) : 0;
+  f->s = sh1 | (sh2 << 1);
+}
+
+void ga_fastdiv_append(strb *sb, int addr32, const char *var,
+                       const char *rem, const char *d) {
+  const char *t = addr32 ? "ga_uint" : "ga_size";
+  strb_appendf(sb, "{ %s _q = ga_udiv_%s(%s, %s_m, %s_s); "
+               "%s = %s - _q * (%s)%s; %s = _q; }\n",
+               t, addr32 ? "uint" : "size", var, d, d,
+               rem, var, t, d, var);
+}
@@ -0,0 +1,46 @@
+#ifndef UTIL_FASTDIV_H
+#define UTIL_FASTDIV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util/strb.h"
+
+/*
+ * Division by a runtime-invariant divisor using a multiply-high and
+ * shifts (Granlund & Montgomery, "Division by Invariant Integers using
+ * Multiplication", fig. 4.1).
+ *
+ * The magic numbers are computed on the host and passed to the
+ * kernels, which use ga_udiv_uint() or ga_udiv_size() from cluda.h.
+ * This is exact for every dividend of the type and every divisor
+ * except 0.
+ */
+
+typedef struct _ga_fastdiv {
+  size_t d;      /* Divisor the rest was computed for (0 for none) */
+  uint32_t m32;  /* Magic for ga_uint dividends (if d fits) */
+  size_t m;      /* Magic for ga_size dividends */
+  uint32_t s;    /* Shifts, as expected by ga_udiv_*() */
+} ga_fastdiv;
+
+/*
+ * Set up `f` for divisor `d`.  This does nothing if `f` already is
+ * for `d` so it can be called before every launch.  A divisor of 0
+ * is treated as 1 since nothing will be divided by it.
+ */
+void ga_fastdiv_init(ga_fastdiv *f, size_t d);
+
+/*
+ * Append code to a kernel source that does
+ *
+ *   rem = var % d; var = var / d;
+ *
+ * where `var` and `rem` are variables of type ga_uint (if `addr32`)
+ * or ga_size.  `d` is the name of the divisor, its magic numbers are
+ * expected in `d`_m (of the same type as `var`) and `d`_s (ga_uint).
+ */
+void ga_fastdiv_append(strb *sb, int addr32, const char *var,
+                       const char *rem, const char *d);
+
+#endif
@@ -0,0 +1,90 @@
+#include "util/lock.h"
+
+#ifdef _WIN32
+
+int ga_lock_init(ga_lock *l) {
+  InitializeCriticalSection(l);
+  return 0;
+}
+
+void ga_lock_destroy(ga_lock *l) {
+  DeleteCriticalSection(l);
+}
+
+void ga_lock_acquire(ga_lock *l) {
+  EnterCriticalSection(l);
+}
+
+void ga_lock_release(ga_lock *l) {
+  LeaveCriticalSection(l);
+}
+
+int ga_cond_init(ga_cond *c) {
+  InitializeConditionVariable(c);
+  return 0;
+}
+
+void ga_cond_destroy(ga_cond *c) {
+  /* Nothing to do for windows condition variables */
+}
+
+void ga_cond_wait(ga_cond *c, ga_lock *l) {
+  SleepConditionVariableCS(c, l, INFINITE);
+}
+
+void ga_cond_signal(ga_cond *c) {
+  WakeConditionVariable(c);
+}
+
+void ga_cond_broadcast(ga_cond *c) {
+  WakeAllConditionVariable(c);
+}
+
+#else
+
+int ga_lock_init(ga_lock *l) {
+  pthread_mutexattr_t attr;
+  int res;
+
+  if (pthread_mutexattr_init(&attr) != 0)
+    return -1;
+  res = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  if (res == 0)
+    res = pthread_mutex_init(l, &attr);
+  pthread_mutexattr_destroy(&attr);
+  return res == 0 ? 0 : -1;
+}
+
+void ga_lock_destroy(ga_lock *l) {
+  pthread_mutex_destroy(l);
+}
+
+void ga_lock_acquire(ga_lock *l) {
+  pthread_mutex_lock(l);
+}
+
+void ga_lock_release(ga_lock *l) {
+  pthread_mutex_unlock(l);
+}
+
+int ga_cond_init(ga_cond *c) {
+  return pthread_cond_init(c, NULL) == 0 ? 0 : -1;
+}
+
+void ga_cond_destroy(ga_cond *c) {
+  pthread_cond_destroy(c);
+}
+
+void ga_cond_wait(ga_cond *c, ga_lock *l) {
+  pthread_cond_wait(c, l);
+}
+
+void ga_cond_signal(ga_cond *c) {
+  pthread_cond_signal(c);
+}
+
+void ga_cond_broadcast(ga_cond *c) {
+  pthread_cond_broadcast(c);
+}
+
+#endif
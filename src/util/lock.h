@@ -0,0 +1,34 @@
+#ifndef UTIL_LOCK_H
+#define UTIL_LOCK_H
+
+/*
+ * Recursive mutex.  The same thread can take it multiple times as
+ * long as it releases it as many times.
+ */
+
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION ga_lock;
+typedef CONDITION_VARIABLE ga_cond;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t ga_lock;
+typedef pthread_cond_t ga_cond;
+#endif
+
+int ga_lock_init(ga_lock *l);
+void ga_lock_destroy(ga_lock *l);
+void ga_lock_acquire(ga_lock *l);
+void ga_lock_release(ga_lock *l);
+
+/*
+ * Condition variable.  The lock passed to ga_cond_wait() must be held
+ * exactly once by the calling thread.
+ */
+int ga_cond_init(ga_cond *c);
+void ga_cond_destroy(ga_cond *c);
+void ga_cond_wait(ga_cond *c, ga_lock *l);
+void ga_cond_signal(ga_cond *c);
+void ga_cond_broadcast(ga_cond *c);
+
+#endif
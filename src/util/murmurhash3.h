@@ -0,0 +1,19 @@
+#ifndef MURMURHASH3_H
+#define MURMURHASH3_H
+
+/*
+ * MurmurHash3 was written by Austin Appleby, and is placed in the
+ * public domain.  The author hereby disclaims copyright to this
+ * source code.
+ *
+ * This is the x64_128 variant, adapted to C89.  The result is the
+ * same on every platform (the input is read as little-endian).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+void MurmurHash3_x64_128(const void *key, size_t len, uint32_t seed,
+                         uint64_t out[2]);
+
+#endif
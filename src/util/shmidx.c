@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/shmidx.h"
+
+#ifdef _WIN32
+
+/* Not implemented, the callers build every entry themselves */
+
+ga_shmidx *ga_shmidx_open(const char *path) {
+  return NULL;
+}
+
+void ga_shmidx_close(ga_shmidx *idx) {
+}
+
+int ga_shmidx_acquire(ga_shmidx *idx, uint64_t h, unsigned int timeout) {
+  return GA_SHMIDX_BUILD;
+}
+
+void ga_shmidx_publish(ga_shmidx *idx, uint64_t h) {
+}
+
+void ga_shmidx_abandon(ga_shmidx *idx, uint64_t h) {
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util/xxhash.h"
+
+#define IDX_MAGIC 0x31584449414741ULL /* "GAIDX1" */
+#define IDX_SLOTS 4096
+#define IDX_PROBES 16
+/* Published slots older than this (in seconds) can be reused */
+#define IDX_REUSE 3600
+
+enum {
+  SLOT_EMPTY = 0, /* Claimed, but not set up yet */
+  SLOT_BUSY,
+  SLOT_READY
+};
+
+/*
+ * Every field is only changed with atomic operations.  A slot is
+ * claimed by swapping its hash from 0 (or from a stale value), so
+ * there is only one owner at a time.
+ */
+typedef struct _slot {
+  volatile uint64_t h;
+  volatile uint32_t state;
+  volatile uint32_t host;
+  volatile int32_t pid;
+  volatile uint32_t stamp;
+} slot;
+
+typedef struct _header {
+  uint64_t magic;
+  uint64_t nslots;
+} header;
+
+struct _ga_shmidx {
+  void *map;
+  size_t len;
+  slot *slots;
+  uint32_t host;
+};
+
+static uint32_t now(void) {
+  return (uint32_t)time(NULL);
+}
+
+/* Part of the file can be on a shared drive, so we tag the slots with
+   the host to know if the pid can be checked. */
+static uint32_t host_id(void) {
+  char name[256];
+  if (gethostname(name, sizeof(name)) != 0)
+    return 0;
+  name[sizeof(name) - 1] = '\0';
+  return XXH32(name, strlen(name), 42);
+}
+
+ga_shmidx *ga_shmidx_open(const char *path) {
+  ga_shmidx *idx;
+  struct stat st;
+  header *hd;
+  size_t len = sizeof(header) + IDX_SLOTS * sizeof(slot);
+  int fd;
+
+  fd = open(path, O_RDWR|O_CREAT, 0666);
+  if (fd == -1)
+    return NULL;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return NULL;
+  }
+  /* Every creator extends it to the same size with zeros */
+  if ((size_t)st.st_size < len && ftruncate(fd, len) != 0) {
+    close(fd);
+    return NULL;
+  }
+  idx = malloc(sizeof(*idx));
+  if (idx == NULL) {
+    close(fd);
+    return NULL;
+  }
+  idx->map = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (idx->map == MAP_FAILED) {
+    free(idx);
+    return NULL;
+  }
+  idx->len = len;
+  hd = (header *)idx->map;
+  __sync_bool_compare_and_swap(&hd->nslots, 0, IDX_SLOTS);
+  __sync_bool_compare_and_swap(&hd->magic, 0, IDX_MAGIC);
+  if (hd->magic != IDX_MAGIC || hd->nslots != IDX_SLOTS) {
+    ga_shmidx_close(idx);
+    return NULL;
+  }
+  idx->slots = (slot *)(hd + 1);
+  idx->host = host_id();
+  return idx;
+}
+
+void ga_shmidx_close(ga_shmidx *idx) {
+  munmap(idx->map, idx->len);
+  free(idx);
+}
+
+static void take(ga_shmidx *idx, slot *s) {
+  s->pid = (int32_t)getpid();
+  s->host = idx->host;
+  s->stamp = now();
+  __sync_synchronize();
+  s->state = SLOT_BUSY;
+  __sync_synchronize();
+}
+
+/* Is the builder of a busy slot gone? */
+static int abandoned(ga_shmidx *idx, slot *s, unsigned int timeout) {
+  uint32_t age = now() - s->stamp;
+  if (s->host == idx->host && kill(s->pid, 0) != 0 && errno == ESRCH)
+    return 1;
+  return age > timeout / 1000 + 1;
+}
+
+static void pause_ms(unsigned int ms) {
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000L;
+  nanosleep(&ts, NULL);
+}
+
+/* Wait for the slot to change from busy, returns its final state */
+static int wait_slot(ga_shmidx *idx, slot *s, uint64_t h,
+                     unsigned int timeout) {
+  unsigned int waited = 0;
+  unsigned int step = 1;
+  uint32_t st;
+
+  for (;;) {
+    if (s->h != h)
+      return GA_SHMIDX_BUILD;
+    st = s->state;
+    if (st == SLOT_READY)
+      return GA_SHMIDX_READY;
+    if (st == SLOT_BUSY && abandoned(idx, s, timeout)) {
+      /* Take over from the dead builder */
+      if (__sync_bool_compare_and_swap(&s->state, SLOT_BUSY, SLOT_EMPTY)) {
+        take(idx, s);
+        return GA_SHMIDX_CLAIMED;
+      }
+      continue;
+    }
+    if (waited >= timeout) {
+      /* Claimed but never set up, the owner died right away */
+      if (st == SLOT_EMPTY)
+        __sync_bool_compare_and_swap(&s->h, h, 0);
+      return GA_SHMIDX_BUILD;
+    }
+    pause_ms(step);
+    waited += step;
+    if (step < 64)
+      step *= 2;
+  }
+}
+
+int ga_shmidx_acquire(ga_shmidx *idx, uint64_t h, unsigned int timeout) {
+  slot *s;
+  uint64_t cur;
+  unsigned int i;
+
+  for (i = 0; i < IDX_PROBES; i++) {
+    s = &idx->slots[(h + i) % IDX_SLOTS];
+    cur = s->h;
+    if (cur == h)
+      return wait_slot(idx, s, h, timeout);
+    if (cur == 0) {
+      if (__sync_bool_compare_and_swap(&s->h, 0, h)) {
+        take(idx, s);
+        return GA_SHMIDX_CLAIMED;
+      }
+      /* Someone else got it first, maybe for the same entry */
+      if (s->h == h)
+        return wait_slot(idx, s, h, timeout);
+    } else if (s->state == SLOT_READY && now() - s->stamp > IDX_REUSE) {
+      /* Anyone looking for the old entry will stop waiting when the
+         hash changes. */
+      if (__sync_bool_compare_and_swap(&s->state, SLOT_READY, SLOT_EMPTY)) {
+        s->stamp = now();
+        __sync_synchronize();
+        s->h = h;
+        take(idx, s);
+        return GA_SHMIDX_CLAIMED;
+      }
+    }
+  }
+  return GA_SHMIDX_BUILD;
+}
+
+static slot *find(ga_shmidx *idx, uint64_t h) {
+  slot *s;
+  unsigned int i;
+
+  for (i = 0; i < IDX_PROBES; i++) {
+    s = &idx->slots[(h + i) % IDX_SLOTS];
+    if (s->h == h && s->pid == (int32_t)getpid() && s->host == idx->host)
+      return s;
+  }
+  return NULL;
+}
+
+void ga_shmidx_publish(ga_shmidx *idx, uint64_t h) {
+  slot *s = find(idx, h);
+  if (s != NULL) {
+    s->stamp = now();
+    __sync_synchronize();
+    s->state = SLOT_READY;
+    __sync_synchronize();
+  }
+}
+
+void ga_shmidx_abandon(ga_shmidx *idx, uint64_t h) {
+  slot *s = find(idx, h);
+  if (s != NULL) {
+    s->state = SLOT_EMPTY;
+    __sync_bool_compare_and_swap(&s->h, h, 0);
+  }
+}
+
+#endif
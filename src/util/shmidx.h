@@ -0,0 +1,51 @@
+#ifndef UTIL_SHMIDX_H
+#define UTIL_SHMIDX_H
+
+#include <stdint.h>
+
+/*
+ * Index of the entries being built for a shared cache.
+ *
+ * This is a small hash table in a file that every process using the
+ * cache maps in memory.  A process that is about to build an entry
+ * claims it in the index.  Another process that needs the same entry
+ * in the meantime waits for it to be published instead of building
+ * it a second time.
+ *
+ * The index is only a hint: when it is full, unavailable or when a
+ * builder takes too long, the callers go ahead and build the entry
+ * themselves.
+ */
+
+typedef struct _ga_shmidx ga_shmidx;
+
+/* The entry is in the cache, go look for it */
+#define GA_SHMIDX_READY 0
+/* The caller has to build the entry and then call publish or abandon */
+#define GA_SHMIDX_CLAIMED 1
+/* The caller has to build the entry, but without calling publish */
+#define GA_SHMIDX_BUILD 2
+
+/*
+ * Open (or create) the index at `path`.
+ *
+ * Returns NULL if the index can't be used, in which case the caller
+ * should work without it.
+ */
+ga_shmidx *ga_shmidx_open(const char *path);
+
+void ga_shmidx_close(ga_shmidx *idx);
+
+/*
+ * Look up the entry `h` (which must not be 0), waiting up to
+ * `timeout` milliseconds for another process to finish building it.
+ */
+int ga_shmidx_acquire(ga_shmidx *idx, uint64_t h, unsigned int timeout);
+
+/* Mark a claimed entry as present in the cache */
+void ga_shmidx_publish(ga_shmidx *idx, uint64_t h);
+
+/* Release a claimed entry that could not be built */
+void ga_shmidx_abandon(ga_shmidx *idx, uint64_t h);
+
+#endif
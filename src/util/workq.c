@@ -0,0 +1,182 @@
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "util/lock.h"
+#include "util/workq.h"
+
+typedef struct _job {
+  struct _job *next;
+  ga_job_fn fn;
+  void *arg;
+} job;
+
+static ga_lock q_lock;
+static ga_cond q_cond;
+static job *q_head;
+static job *q_tail;
+static unsigned int q_len; /* Jobs in the queue */
+static unsigned int q_threads; /* Workers started */
+static unsigned int q_idle; /* Workers waiting for a job */
+static unsigned int q_max; /* Maximum number of workers */
+static int q_ok;
+
+static unsigned int ncpus(void) {
+#ifdef _WIN32
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  return si.dwNumberOfProcessors;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n < 1 ? 1 : (unsigned int)n;
+#endif
+}
+
+static void q_run(void) {
+  job *j;
+
+  ga_lock_acquire(&q_lock);
+  for (;;) {
+    while (q_head == NULL) {
+      q_idle++;
+      ga_cond_wait(&q_cond, &q_lock);
+      q_idle--;
+    }
+    j = q_head;
+    q_head = j->next;
+    if (q_head == NULL)
+      q_tail = NULL;
+    q_len--;
+    ga_lock_release(&q_lock);
+    j->fn(j->arg);
+    free(j);
+    ga_lock_acquire(&q_lock);
+  }
+}
+
+#ifdef _WIN32
+
+static DWORD WINAPI q_main(LPVOID unused) {
+  q_run();
+  return 0;
+}
+
+static int q_start(void) {
+  HANDLE t = CreateThread(NULL, 0, q_main, NULL, 0, NULL);
+  if (t == NULL)
+    return -1;
+  CloseHandle(t);
+  return 0;
+}
+
+#else
+
+static void *q_main(void *unused) {
+  q_run();
+  return NULL;
+}
+
+static int q_start(void) {
+  pthread_t t;
+  if (pthread_create(&t, NULL, q_main, NULL) != 0)
+    return -1;
+  pthread_detach(t);
+  return 0;
+}
+
+/*
+ * Only the forking thread survives in the child.  The queued jobs
+ * are dropped since they refer to device contexts which can't be used
+ * there anyway.
+ */
+static void q_child(void) {
+  ga_lock_init(&q_lock);
+  ga_cond_init(&q_cond);
+  q_head = q_tail = NULL;
+  q_len = q_threads = q_idle = 0;
+}
+
+#endif
+
+static void q_init(void) {
+  const char *s = getenv("GPUARRAY_COMPILE_THREADS");
+  char *end;
+  long n;
+
+  q_max = ncpus();
+  if (s != NULL && *s != '\0') {
+    n = strtol(s, &end, 10);
+    if (*end == '\0' && n >= 0)
+      q_max = (unsigned int)n;
+  }
+  if (ga_lock_init(&q_lock))
+    return;
+  if (ga_cond_init(&q_cond)) {
+    ga_lock_destroy(&q_lock);
+    return;
+  }
+#ifndef _WIN32
+  pthread_atfork(NULL, NULL, q_child);
+#endif
+  q_ok = 1;
+}
+
+#ifdef _WIN32
+static INIT_ONCE q_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK q_init_once(PINIT_ONCE o, PVOID p, PVOID *c) {
+  q_init();
+  return TRUE;
+}
+
+static void q_setup(void) {
+  InitOnceExecuteOnce(&q_once, q_init_once, NULL, NULL);
+}
+#else
+static pthread_once_t q_once = PTHREAD_ONCE_INIT;
+
+static void q_setup(void) {
+  pthread_once(&q_once, q_init);
+}
+#endif
+
+unsigned int ga_workq_size(void) {
+  q_setup();
+  return q_ok ? q_max : 0;
+}
+
+int ga_workq_submit(ga_job_fn fn, void *arg) {
+  job *j;
+
+  if (ga_workq_size() == 0)
+    return -1;
+  j = malloc(sizeof(*j));
+  if (j == NULL)
+    return -1;
+  j->next = NULL;
+  j->fn = fn;
+  j->arg = arg;
+
+  ga_lock_acquire(&q_lock);
+  /* Start a worker unless there is an idle one for this job */
+  if (q_len >= q_idle && q_threads < q_max) {
+    if (q_start() == 0) {
+      q_threads++;
+    } else if (q_threads == 0) {
+      ga_lock_release(&q_lock);
+      free(j);
+      return -1;
+    }
+  }
+  if (q_tail == NULL)
+    q_head = j;
+  else
+    q_tail->next = j;
+  q_tail = j;
+  q_len++;
+  ga_cond_signal(&q_cond);
+  ga_lock_release(&q_lock);
+  return 0;
+}
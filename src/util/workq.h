@@ -0,0 +1,27 @@
+#ifndef UTIL_WORKQ_H
+#define UTIL_WORKQ_H
+
+/*
+ * Process-wide queue of background jobs.
+ *
+ * Jobs are run in submission order by a pool of worker threads that
+ * is started on demand.  The number of workers is the number of
+ * processors, unless overridden by the GPUARRAY_COMPILE_THREADS
+ * environment variable.  Setting it to 0 disables the workers.
+ */
+
+typedef void (*ga_job_fn)(void *arg);
+
+/*
+ * Queue `fn(arg)` to be run by a worker.
+ *
+ * Returns 0 on success and -1 if the job could not be queued (no
+ * workers, or out of memory), in which case the caller should run it
+ * itself.
+ */
+int ga_workq_submit(ga_job_fn fn, void *arg);
+
+/* Number of workers the queue will use (0 if disabled) */
+unsigned int ga_workq_size(void);
+
+#endif
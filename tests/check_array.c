@@ -1,5 +1,7 @@
 #include <limits.h>
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <check.h>
 
@@ -277,6 +279,548 @@ START_TEST(test_take1_offset) {
 }
 END_TEST
 
+START_TEST(test_take1_deferred) {
+  const uint32_t data[4] = {0, 1, 2, 3};
+  const size_t data_dims[1] = {4};
+  const size_t out_dims[1] = {2};
+  const uint32_t idx[2] = {1, 20};
+  uint32_t buf[2];
+  GpuArray v;
+  GpuArray i;
+  GpuArray r;
+
+  ga_assert_ok(GpuArray_empty(&v, ctx, GA_UINT, 1, data_dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&v, data, sizeof(data)));
+
+  ga_assert_ok(GpuArray_empty(&i, ctx, GA_UINT, 1, out_dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&i, idx, sizeof(idx)));
+
+  ga_assert_ok(GpuArray_empty(&r, ctx, GA_UINT, 1, out_dims, GA_C_ORDER));
+
+  /* The error is only reported at the next synchronization point */
+  ga_assert_ok(GpuArray_take1(&r, &v, &i, GA_CHECK_ERROR_DEFERRED));
+  ck_assert_int_eq(GpuArray_read(buf, sizeof(buf), &r), GA_VALUE_ERROR);
+  ck_assert_ptr_ne(strstr(gpucontext_error(ctx, GA_VALUE_ERROR), "take1"),
+                   NULL);
+
+  /* and only once */
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &r));
+  ga_assert_ok(gpucontext_check_errors(ctx));
+
+  /* Errors recorded without checking stay until explicitly checked */
+  ga_assert_ok(GpuArray_take1(&r, &v, &i, GA_CHECK_ERROR_NONE));
+  ga_assert_ok(GpuArray_sync(&r));
+  ck_assert_int_eq(gpucontext_check_errors(ctx), GA_VALUE_ERROR);
+  ga_assert_ok(gpucontext_check_errors(ctx));
+
+  GpuArray_clear(&r);
+  GpuArray_clear(&i);
+  GpuArray_clear(&v);
+}
+END_TEST
+
+START_TEST(test_take1_reuse) {
+  const uint32_t data[6] = {0, 1, 2, 3, 4, 5};
+  const size_t dims2[2] = {3, 2};
+  const size_t dims1[1] = {2};
+  const size_t out_dims[2] = {2, 2};
+  const size_t big_dims[2] = {4, 2};
+  const uint32_t idx[4] = {2, 0, 1, 1};
+  uint32_t buf[8];
+  GpuArray v;
+  GpuArray i;
+  GpuArray r;
+
+  ga_assert_ok(GpuArray_empty(&v, ctx, GA_UINT, 2, dims2, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&v, data, sizeof(data)));
+
+  ga_assert_ok(GpuArray_empty(&i, ctx, GA_UINT, 1, dims1, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&i, idx, 2 * sizeof(uint32_t)));
+  ga_assert_ok(GpuArray_empty(&r, ctx, GA_UINT, 2, out_dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_take1(&r, &v, &i, 1));
+  ga_assert_ok(GpuArray_read(buf, 4 * sizeof(uint32_t), &r));
+  ck_assert_int_eq(buf[0], 4);
+  ck_assert_int_eq(buf[1], 5);
+  ck_assert_int_eq(buf[2], 0);
+  ck_assert_int_eq(buf[3], 1);
+  GpuArray_clear(&r);
+  GpuArray_clear(&i);
+
+  /* Same kernel, different sizes: nothing from the first call may stick */
+  ga_assert_ok(GpuArray_empty(&i, ctx, GA_UINT, 1, &big_dims[0], GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&i, idx, sizeof(idx)));
+  ga_assert_ok(GpuArray_empty(&r, ctx, GA_UINT, 2, big_dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_take1(&r, &v, &i, 1));
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &r));
+  ck_assert_int_eq(buf[0], 4);
+  ck_assert_int_eq(buf[1], 5);
+  ck_assert_int_eq(buf[2], 0);
+  ck_assert_int_eq(buf[3], 1);
+  ck_assert_int_eq(buf[4], 2);
+  ck_assert_int_eq(buf[5], 3);
+  ck_assert_int_eq(buf[6], 2);
+  ck_assert_int_eq(buf[7], 3);
+
+  GpuArray_clear(&r);
+  GpuArray_clear(&i);
+  GpuArray_clear(&v);
+}
+END_TEST
+
+START_TEST(test_take_axis1) {
+  const uint32_t data[12] = {0, 1,  2,  3,
+                             4, 5,  6,  7,
+                             8, 9, 10, 11};
+  const long indexes[3] = {2, 0, -1};
+  const long bad_index = 4;
+  const size_t data_dims[2] = {3, 4};
+  const size_t idx_dims[1] = {3};
+  const size_t out_dims[2] = {3, 3};
+  uint32_t buf[9];
+  const GpuArray *ia[1];
+  GpuArray v;
+  GpuArray i;
+  GpuArray r;
+
+  ga_assert_ok(GpuArray_empty(&v, ctx, GA_UINT, 2, data_dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&v, data, sizeof(data)));
+  ga_assert_ok(GpuArray_empty(&i, ctx, GA_LONG, 1, idx_dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&i, indexes, sizeof(indexes)));
+  ga_assert_ok(GpuArray_empty(&r, ctx, GA_UINT, 2, out_dims, GA_C_ORDER));
+
+  /* test v[:, [2, 0, -1]] */
+  ia[0] = &i;
+  ga_assert_ok(GpuArray_take(&r, &v, 1, 1, ia, 1));
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &r));
+
+  ck_assert(buf[0] == 2);
+  ck_assert(buf[1] == 0);
+  ck_assert(buf[2] == 3);
+  ck_assert(buf[3] == 6);
+  ck_assert(buf[4] == 4);
+  ck_assert(buf[5] == 7);
+  ck_assert(buf[6] == 10);
+  ck_assert(buf[7] == 8);
+  ck_assert(buf[8] == 11);
+
+  /* out of bounds */
+  ga_assert_ok(GpuArray_write(&i, &bad_index, sizeof(long)));
+  ck_assert_int_eq(GpuArray_take(&r, &v, 1, 1, ia, 1), GA_VALUE_ERROR);
+}
+END_TEST
+
+START_TEST(test_put_add) {
+  const float data[6] = {0, 1, 2, 3, 4, 5};
+  const float vals[6] = {1, 2, 3, 4, 5, 6};
+  const long indexes[3] = {0, 2, 0};
+  const size_t data_dims[2] = {3, 2};
+  const size_t idx_dims[1] = {3};
+  const float expected[6] = {6, 9, 2, 3, 7, 9};
+  float buf[6];
+  const GpuArray *ia[1];
+  GpuArray a;
+  GpuArray v;
+  GpuArray i;
+  unsigned int j;
+
+  ga_assert_ok(GpuArray_empty(&a, ctx, GA_FLOAT, 2, data_dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_empty(&v, ctx, GA_FLOAT, 2, data_dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&v, vals, sizeof(vals)));
+  ga_assert_ok(GpuArray_empty(&i, ctx, GA_LONG, 1, idx_dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&i, indexes, sizeof(indexes)));
+  ia[0] = &i;
+
+  /* a[[0, 2, 0]] += v */
+  ga_assert_ok(GpuArray_write(&a, data, sizeof(data)));
+  ga_assert_ok(GpuArray_put(&a, &v, 0, 1, ia, GA_PUT_ADD, 1));
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &a));
+  for (j = 0; j < 6; j++)
+    ck_assert(buf[j] == expected[j]);
+
+  ga_assert_ok(GpuArray_write(&a, data, sizeof(data)));
+  ga_assert_ok(GpuArray_put(&a, &v, 0, 1, ia, GA_PUT_ADD_DETERMINISTIC, 1));
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &a));
+  for (j = 0; j < 6; j++)
+    ck_assert(buf[j] == expected[j]);
+}
+END_TEST
+
+START_TEST(test_nonzero) {
+  const uint8_t mask[6] = {1, 0, 0,
+                           0, 1, 1};
+  const size_t mask_dims[2] = {2, 3};
+  long buf[6];
+  GpuArray m;
+  GpuArray r;
+
+  ga_assert_ok(GpuArray_empty(&m, ctx, GA_BOOL, 2, mask_dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&m, mask, sizeof(mask)));
+  ga_assert_ok(GpuArray_nonzero(&r, &m));
+
+  ck_assert(r.nd == 2);
+  ck_assert(r.dimensions[0] == 2);
+  ck_assert(r.dimensions[1] == 3);
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &r));
+
+  ck_assert(buf[0] == 0);
+  ck_assert(buf[1] == 1);
+  ck_assert(buf[2] == 1);
+  ck_assert(buf[3] == 0);
+  ck_assert(buf[4] == 1);
+  ck_assert(buf[5] == 2);
+}
+END_TEST
+
+START_TEST(test_sort_axis0) {
+  const float data[8] = { 3.0f, -1.0f,
+                         -2.0f,  5.0f,
+                          3.0f,  0.5f,
+                          0.0f, -1.0f};
+  const float sorted[8] = {-2.0f, -1.0f,
+                            0.0f, -1.0f,
+                            3.0f,  0.5f,
+                            3.0f,  5.0f};
+  const long order[8] = {1, 0,
+                         3, 3,
+                         0, 2,
+                         2, 1};
+  const size_t dims[2] = {4, 2};
+  float fbuf[8];
+  long lbuf[8];
+  GpuArray a;
+  GpuArray r;
+  GpuArray i;
+  unsigned int j;
+
+  ga_assert_ok(GpuArray_empty(&a, ctx, GA_FLOAT, 2, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&a, data, sizeof(data)));
+  ga_assert_ok(GpuArray_empty(&r, ctx, GA_FLOAT, 2, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_empty(&i, ctx, GA_LONG, 2, dims, GA_C_ORDER));
+
+  ga_assert_ok(GpuArray_sort(&r, &a, 0, 0));
+  ga_assert_ok(GpuArray_read(fbuf, sizeof(fbuf), &r));
+  ga_assert_ok(GpuArray_argsort(&i, &a, 0, 0));
+  ga_assert_ok(GpuArray_read(lbuf, sizeof(lbuf), &i));
+
+  for (j = 0; j < 8; j++) {
+    ck_assert(fbuf[j] == sorted[j]);
+    /* The sort is stable */
+    ck_assert(lbuf[j] == order[j]);
+  }
+
+  GpuArray_clear(&i);
+  GpuArray_clear(&r);
+  GpuArray_clear(&a);
+}
+END_TEST
+
+START_TEST(test_topk) {
+  const int data[10] = {4, 9, -3, 7, 7, 0, 12, -8, 5, 1};
+  const size_t dims[1] = {10};
+  const size_t kdims[1] = {3};
+  int vbuf[3];
+  uint32_t ibuf[3];
+  GpuArray a;
+  GpuArray v;
+  GpuArray i;
+
+  ga_assert_ok(GpuArray_empty(&a, ctx, GA_INT, 1, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&a, data, sizeof(data)));
+  ga_assert_ok(GpuArray_empty(&v, ctx, GA_INT, 1, kdims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_empty(&i, ctx, GA_UINT, 1, kdims, GA_C_ORDER));
+
+  ga_assert_ok(GpuArray_topk(&v, &i, &a, 0, 3, 1));
+  ga_assert_ok(GpuArray_read(vbuf, sizeof(vbuf), &v));
+  ga_assert_ok(GpuArray_read(ibuf, sizeof(ibuf), &i));
+  ck_assert(vbuf[0] == 12 && ibuf[0] == 6);
+  ck_assert(vbuf[1] == 9 && ibuf[1] == 1);
+  /* Either of the 7s */
+  ck_assert(vbuf[2] == 7 && (ibuf[2] == 3 || ibuf[2] == 4));
+
+  ga_assert_ok(GpuArray_topk(&v, NULL, &a, 0, 3, 0));
+  ga_assert_ok(GpuArray_read(vbuf, sizeof(vbuf), &v));
+  ck_assert(vbuf[0] == -8);
+  ck_assert(vbuf[1] == -3);
+  ck_assert(vbuf[2] == 0);
+
+  GpuArray_clear(&i);
+  GpuArray_clear(&v);
+  GpuArray_clear(&a);
+}
+END_TEST
+
+START_TEST(test_searchsorted) {
+  const double sorted[5] = {-1.0, 0.0, 0.0, 2.5, 7.0};
+  const double values[4] = {0.0, -5.0, 2.5, 100.0};
+  const size_t sdims[1] = {5};
+  const size_t vdims[1] = {4};
+  long buf[4];
+  GpuArray s;
+  GpuArray v;
+  GpuArray r;
+
+  ga_assert_ok(GpuArray_empty(&s, ctx, GA_DOUBLE, 1, sdims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&s, sorted, sizeof(sorted)));
+  ga_assert_ok(GpuArray_empty(&v, ctx, GA_DOUBLE, 1, vdims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&v, values, sizeof(values)));
+  ga_assert_ok(GpuArray_empty(&r, ctx, GA_LONG, 1, vdims, GA_C_ORDER));
+
+  ga_assert_ok(GpuArray_searchsorted(&r, &s, &v, 0));
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &r));
+  ck_assert(buf[0] == 1);
+  ck_assert(buf[1] == 0);
+  ck_assert(buf[2] == 3);
+  ck_assert(buf[3] == 5);
+
+  ga_assert_ok(GpuArray_searchsorted(&r, &s, &v, 1));
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &r));
+  ck_assert(buf[0] == 3);
+  ck_assert(buf[1] == 0);
+  ck_assert(buf[2] == 4);
+  ck_assert(buf[3] == 5);
+
+  GpuArray_clear(&r);
+  GpuArray_clear(&v);
+  GpuArray_clear(&s);
+}
+END_TEST
+
+START_TEST(test_scan) {
+  const int data[2][6] = {{1, 2, 3, 4, 5, 6},
+                          {6, 5, 4, 3, 2, 1}};
+  const unsigned char heads[2][6] = {{0, 0, 1, 0, 0, 1},
+                                     {1, 0, 0, 0, 1, 0}};
+  const size_t dims[2] = {2, 6};
+  long lbuf[12];
+  int ibuf[12];
+  GpuArray a;
+  GpuArray s;
+  GpuArray r;
+  GpuArray ri;
+
+  ga_assert_ok(GpuArray_empty(&a, ctx, GA_INT, 2, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&a, data, sizeof(data)));
+  ga_assert_ok(GpuArray_empty(&s, ctx, GA_UBYTE, 2, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&s, heads, sizeof(heads)));
+  ga_assert_ok(GpuArray_empty(&r, ctx, GA_LONG, 2, dims, GA_F_ORDER));
+  ga_assert_ok(GpuArray_empty(&ri, ctx, GA_INT, 2, dims, GA_C_ORDER));
+
+  /* cumsum along the rows, F-ordered output */
+  ga_assert_ok(GpuArray_scan(&r, &a, NULL, 1, NULL, "a + b", "0", 0));
+  ga_assert_ok(GpuArray_read(lbuf, sizeof(lbuf), &r));
+  ck_assert(lbuf[0] == 1 && lbuf[1] == 6);
+  ck_assert(lbuf[2] == 3 && lbuf[3] == 11);
+  ck_assert(lbuf[10] == 21 && lbuf[11] == 21);
+
+  /* exclusive along the columns */
+  ga_assert_ok(GpuArray_scan(&r, &a, NULL, 0, NULL, "a + b", "0",
+                             GA_SCAN_EXCLUSIVE));
+  ga_assert_ok(GpuArray_read(lbuf, sizeof(lbuf), &r));
+  ck_assert(lbuf[0] == 0 && lbuf[1] == 1);
+  ck_assert(lbuf[10] == 0 && lbuf[11] == 6);
+
+  /* segmented running max */
+  ga_assert_ok(GpuArray_scan(&ri, &a, &s, 1, NULL, "a > b ? a : b",
+                             "-2147483647 - 1", 0));
+  ga_assert_ok(GpuArray_read(ibuf, sizeof(ibuf), &ri));
+  ck_assert_int_eq(ibuf[1], 2);
+  ck_assert_int_eq(ibuf[2], 3);
+  ck_assert_int_eq(ibuf[4], 5);
+  ck_assert_int_eq(ibuf[5], 6);
+  ck_assert_int_eq(ibuf[9], 6);
+  ck_assert_int_eq(ibuf[10], 2);
+  ck_assert_int_eq(ibuf[11], 2);
+
+  GpuArray_clear(&ri);
+  GpuArray_clear(&r);
+  GpuArray_clear(&s);
+  GpuArray_clear(&a);
+}
+END_TEST
+
+START_TEST(test_setarray_convert) {
+  const float data[2][3] = {{1.5f, -2.0f, 3.0f},
+                            {4.0f, 5.25f, -6.0f}};
+  const size_t dims[2] = {2, 3};
+  int buf[6];
+  GpuArray a;
+  GpuArray r;
+
+  /* Make sure the copy kernel is built on the compile threads */
+  setenv("GPUARRAY_COMPILE_THREADS", "2", 0);
+
+  ga_assert_ok(GpuArray_empty(&a, ctx, GA_FLOAT, 2, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&a, data, sizeof(data)));
+  ga_assert_ok(GpuArray_empty(&r, ctx, GA_INT, 2, dims, GA_F_ORDER));
+
+  ga_assert_ok(GpuArray_setarray(&r, &a));
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &r));
+  ck_assert_int_eq(buf[0], 1);
+  ck_assert_int_eq(buf[1], 4);
+  ck_assert_int_eq(buf[2], -2);
+  ck_assert_int_eq(buf[5], -6);
+
+  /* Second time through the cache */
+  ga_assert_ok(GpuArray_setarray(&r, &a));
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &r));
+  ck_assert_int_eq(buf[3], 5);
+
+  GpuArray_clear(&r);
+  GpuArray_clear(&a);
+}
+END_TEST
+
+START_TEST(test_softmax) {
+  const float data[2][3] = {{1, 2, 3},
+                            {-1000, 0, 1000}};
+  const size_t dims[2] = {2, 3};
+  const size_t ldims[1] = {5000};
+  const size_t tdims[3] = {2, 3, 2};
+  float *lbuf;
+  float buf[6];
+  float tbuf[12];
+  double e0, e1, e2;
+  size_t i;
+  GpuArray a;
+  GpuArray r;
+  GpuArray l;
+  GpuArray t;
+
+  ga_assert_ok(GpuArray_empty(&a, ctx, GA_FLOAT, 2, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&a, data, sizeof(data)));
+  ga_assert_ok(GpuArray_empty(&r, ctx, GA_FLOAT, 2, dims, GA_F_ORDER));
+
+  e0 = exp(-2.0);
+  e1 = exp(-1.0);
+  e2 = 1.0 / (1 + e0 + e1);
+
+  /* along the rows, F-ordered output */
+  ga_assert_ok(GpuArray_softmax(&r, &a, 1));
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &r));
+  ck_assert(fabs(buf[0] - e0 * e2) < 1e-6);
+  ck_assert(fabs(buf[2] - e1 * e2) < 1e-6);
+  ck_assert(fabs(buf[4] - e2) < 1e-6);
+  /* no overflow for large values */
+  ck_assert(buf[1] == 0 && buf[3] == 0 && buf[5] == 1);
+
+  ga_assert_ok(GpuArray_logsoftmax(&r, &a, 1));
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &r));
+  ck_assert(fabs(buf[4] - log(e2)) < 1e-5);
+  ck_assert(fabs(buf[1] + 2000) < 1e-2);
+
+  /* along the columns, in place */
+  ga_assert_ok(GpuArray_softmax(&a, &a, 0));
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &a));
+  ck_assert(fabs(buf[0] - 1) < 1e-6 && buf[3] == 0);
+  ck_assert(fabs(buf[1] + buf[4] - 1) < 1e-6);
+  ck_assert(buf[2] == 0 && buf[5] == 1);
+
+  /* rows spread over several dimensions */
+  for (i = 0; i < 6; i++) {
+    tbuf[2 * i] = 0;
+    tbuf[2 * i + 1] = (float)i;
+  }
+  ga_assert_ok(GpuArray_empty(&t, ctx, GA_FLOAT, 3, tdims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&t, tbuf, sizeof(tbuf)));
+  ga_assert_ok(GpuArray_softmax(&t, &t, 2));
+  ga_assert_ok(GpuArray_read(tbuf, sizeof(tbuf), &t));
+  for (i = 0; i < 6; i++)
+    ck_assert(fabs(tbuf[2 * i + 1] - 1 / (1 + exp(-(double)i))) < 1e-6);
+  GpuArray_clear(&t);
+
+  /* a row that does not fit in local memory */
+  lbuf = calloc(ldims[0], sizeof(float));
+  ck_assert(lbuf != NULL);
+  for (i = 0; i < ldims[0]; i++)
+    lbuf[i] = (float)(i % 7);
+  ga_assert_ok(GpuArray_empty(&l, ctx, GA_FLOAT, 1, ldims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&l, lbuf, ldims[0] * sizeof(float)));
+  ga_assert_ok(GpuArray_logsoftmax(&l, &l, 0));
+  ga_assert_ok(GpuArray_read(lbuf, ldims[0] * sizeof(float), &l));
+  e0 = 0;
+  for (i = 0; i < 7; i++)
+    e0 += exp((double)i);
+  /* 5000 = 714 * 7 + 2 */
+  e0 = log(714 * e0 + exp(0.0) + exp(1.0));
+  ck_assert(fabs(lbuf[0] + e0) < 1e-4);
+  ck_assert(fabs(lbuf[4999] - (1 - e0)) < 1e-4);
+  free(lbuf);
+
+  GpuArray_clear(&l);
+  GpuArray_clear(&r);
+  GpuArray_clear(&a);
+}
+END_TEST
+
+START_TEST(test_layernorm) {
+  const double data[2][4] = {{1, 2, 3, 4},
+                             {5, 5, 5, 5}};
+  const float wdata[4] = {1, 2, 1, 1};
+  const float bdata[4] = {0, 0, 0, 10};
+  const float fdata[2][4] = {{1, 2, 3, 4},
+                             {5, 5, 5, 5}};
+  const double ddata[4] = {0, 0, 0, 10};
+  const size_t dims[2] = {2, 4};
+  const size_t wdims[1] = {4};
+  double buf[8];
+  float fbuf[8];
+  double inv;
+  GpuArray a;
+  GpuArray r;
+  GpuArray w;
+  GpuArray b;
+
+  ga_assert_ok(GpuArray_empty(&a, ctx, GA_DOUBLE, 2, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&a, data, sizeof(data)));
+  ga_assert_ok(GpuArray_empty(&r, ctx, GA_DOUBLE, 2, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_empty(&w, ctx, GA_FLOAT, 1, wdims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&w, wdata, sizeof(wdata)));
+  ga_assert_ok(GpuArray_empty(&b, ctx, GA_FLOAT, 1, wdims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&b, bdata, sizeof(bdata)));
+
+  /* mean 2.5, variance 1.25 */
+  inv = 1 / sqrt(1.25 + 1e-5);
+  ga_assert_ok(GpuArray_layernorm(&r, &a, NULL, NULL, 1, 1e-5));
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &r));
+  ck_assert(fabs(buf[0] + 1.5 * inv) < 1e-12);
+  ck_assert(fabs(buf[3] - 1.5 * inv) < 1e-12);
+  /* constant rows go to 0 */
+  ck_assert(buf[4] == 0 && buf[7] == 0);
+
+  ga_assert_ok(GpuArray_layernorm(&r, &a, &w, &b, 1, 1e-5));
+  ga_assert_ok(GpuArray_read(buf, sizeof(buf), &r));
+  ck_assert(fabs(buf[1] + inv) < 1e-6);
+  ck_assert(fabs(buf[3] - (1.5 * inv + 10)) < 1e-6);
+  ck_assert(fabs(buf[7] - 10) < 1e-6);
+
+  /* the affine vectors must match the axis */
+  ck_assert_int_eq(GpuArray_layernorm(&r, &a, &w, NULL, 0, 1e-5),
+                   GA_VALUE_ERROR);
+
+  GpuArray_clear(&b);
+  GpuArray_clear(&w);
+  GpuArray_clear(&r);
+  GpuArray_clear(&a);
+
+  /* a double bias without a weight still needs double support */
+  ga_assert_ok(GpuArray_empty(&a, ctx, GA_FLOAT, 2, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&a, fdata, sizeof(fdata)));
+  ga_assert_ok(GpuArray_empty(&r, ctx, GA_FLOAT, 2, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_empty(&b, ctx, GA_DOUBLE, 1, wdims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&b, ddata, sizeof(ddata)));
+
+  ga_assert_ok(GpuArray_layernorm(&r, &a, NULL, &b, 1, 1e-5));
+  ga_assert_ok(GpuArray_read(fbuf, sizeof(fbuf), &r));
+  ck_assert(fabs(fbuf[0] + 1.5 * inv) < 1e-5);
+  ck_assert(fabs(fbuf[3] - (1.5 * inv + 10)) < 1e-5);
+  ck_assert(fabs(fbuf[7] - 10) < 1e-5);
+
+  GpuArray_clear(&b);
+  GpuArray_clear(&r);
+  GpuArray_clear(&a);
+}
+END_TEST
+
 START_TEST(test_reshape_0) {
   /* This tests that we don't segfault when reshaping 0-sized arrays */
   const size_t odims[3] = {24, 0, 33};
@@ -298,6 +842,18 @@ Suite *get_suite(void) {
   tcase_set_timeout(tc, 8.0);
   tcase_add_test(tc, test_take1_ok);
   tcase_add_test(tc, test_take1_offset);
+  tcase_add_test(tc, test_take1_deferred);
+  tcase_add_test(tc, test_take1_reuse);
+  tcase_add_test(tc, test_take_axis1);
+  tcase_add_test(tc, test_put_add);
+  tcase_add_test(tc, test_nonzero);
+  tcase_add_test(tc, test_sort_axis0);
+  tcase_add_test(tc, test_topk);
+  tcase_add_test(tc, test_searchsorted);
+  tcase_add_test(tc, test_scan);
+  tcase_add_test(tc, test_setarray_convert);
+  tcase_add_test(tc, test_softmax);
+  tcase_add_test(tc, test_layernorm);
   tcase_add_test(tc, test_reshape_0);
   suite_add_tcase(s, tc);
   return s;
@@ -176,6 +176,123 @@ START_TEST(test_buffer_move) {
 }
 END_TEST
 
+static const char *kern_src[] = {
+  "#include \"cluda.h\"\n",
+  "KERNEL void k(GLOBAL_MEM float *a) { a[0] = 3.0f; }\n",
+  "KERNEL void k(GLOBAL_MEM float *a) { a[0] = not_defined; }\n",
+};
+static const int kern_types[] = {GA_BUFFER};
+
+static void run_kernel(gpukernel *k) {
+  const size_t one = 1;
+  float val = 0.0f;
+  void *args[1];
+  gpudata *d;
+  int err;
+
+  d = gpudata_alloc(ctx, sizeof(float), NULL, 0, NULL);
+  ck_assert(d != NULL);
+  args[0] = d;
+  err = gpukernel_call(k, 1, &one, &one, 0, args);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  err = gpudata_read(&val, d, 0, sizeof(float));
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  ck_assert(val == 3.0f);
+  gpudata_release(d);
+}
+
+START_TEST(test_kernel_async) {
+  const char *good[2], *bad[2];
+  gpukernel_future *f1, *f2;
+  gpukernel *k;
+  int err;
+
+  good[0] = bad[0] = kern_src[0];
+  good[1] = kern_src[1];
+  bad[1] = kern_src[2];
+
+  f1 = gpukernel_init_async(ctx, 2, good, NULL, "k", 1, kern_types, 0, &err);
+  ck_assert(f1 != NULL);
+  f2 = gpukernel_init_async(ctx, 2, bad, NULL, "k", 1, kern_types, 0, &err);
+  ck_assert(f2 != NULL);
+
+  k = gpukernel_future_get(f2, &err, NULL);
+  ck_assert(k == NULL);
+  ck_assert_int_ne(err, GA_NO_ERROR);
+
+  k = gpukernel_future_get(f1, &err, NULL);
+  ck_assert(k != NULL);
+  ck_assert(gpukernel_future_ready(f1));
+  gpukernel_future_release(f1);
+  gpukernel_future_release(f2);
+  run_kernel(k);
+  gpukernel_release(k);
+}
+END_TEST
+
+START_TEST(test_kernel_many) {
+  const char *good[2], *bad[2];
+  gpukernel_desc d[3];
+  gpukernel *ks[3];
+  unsigned int i;
+  int err;
+
+  good[0] = bad[0] = kern_src[0];
+  good[1] = kern_src[1];
+  bad[1] = kern_src[2];
+
+  for (i = 0; i < 3; i++) {
+    d[i].count = 2;
+    d[i].strings = good;
+    d[i].lengths = NULL;
+    d[i].fname = "k";
+    d[i].numargs = 1;
+    d[i].typecodes = kern_types;
+    d[i].flags = 0;
+  }
+  err = gpukernel_init_many(ctx, 3, d, ks, NULL);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  for (i = 0; i < 3; i++) {
+    run_kernel(ks[i]);
+    gpukernel_release(ks[i]);
+  }
+
+  d[1].strings = bad;
+  err = gpukernel_init_many(ctx, 3, d, ks, NULL);
+  ck_assert_int_ne(err, GA_NO_ERROR);
+  for (i = 0; i < 3; i++)
+    ck_assert(ks[i] == NULL);
+}
+END_TEST
+
+START_TEST(test_kernel_fingerprint) {
+  gpukernel_fp fp, fp2;
+  gpukernel *k, *k2;
+  int err;
+
+  gpukernel_fingerprint(&fp, 2, kern_src, NULL, "k", 0);
+  gpukernel_fingerprint(&fp2, 2, kern_src, NULL, "k", 0);
+  ck_assert(fp.h[0] == fp2.h[0] && fp.h[1] == fp2.h[1]);
+  gpukernel_fingerprint(&fp2, 2, kern_src, NULL, "k", GA_USE_DOUBLE);
+  ck_assert(fp.h[0] != fp2.h[0] || fp.h[1] != fp2.h[1]);
+  gpukernel_fingerprint(&fp2, 2, kern_src, NULL, "j", 0);
+  ck_assert(fp.h[0] != fp2.h[0] || fp.h[1] != fp2.h[1]);
+  gpukernel_fingerprint(&fp2, 2, kern_src + 1, NULL, "k", 0);
+  ck_assert(fp.h[0] != fp2.h[0] || fp.h[1] != fp2.h[1]);
+
+  k = gpukernel_init_fp(ctx, &fp, 2, kern_src, NULL, "k", 1, kern_types, 0,
+                        &err, NULL);
+  ck_assert_ptr_ne(k, NULL);
+  /* The same kernel comes back without compiling again */
+  k2 = gpukernel_init(ctx, 2, kern_src, NULL, "k", 1, kern_types, 0,
+                      &err, NULL);
+  ck_assert_ptr_eq(k, k2);
+  run_kernel(k2);
+  gpukernel_release(k2);
+  gpukernel_release(k);
+}
+END_TEST
+
 Suite *get_suite(void) {
   Suite *s = suite_create("buffer");
   TCase *tc = tcase_create("API");
@@ -185,6 +302,9 @@ Suite *get_suite(void) {
   tcase_add_test(tc, test_buffer_share);
   tcase_add_test(tc, test_buffer_read_write);
   tcase_add_test(tc, test_buffer_move);
+  tcase_add_test(tc, test_kernel_async);
+  tcase_add_test(tc, test_kernel_many);
+  tcase_add_test(tc, test_kernel_fingerprint);
   suite_add_tcase(s, tc);
   return s;
 }
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include "gpuarray/error.h"
+
+#include "private.h"
+
+static char manifest[] = "/tmp/ga_manifest_XXXXXX";
+static char bundle[] = "/tmp/ga_bundle_XXXXXX";
+
+static void tmpfile_name(char *templ) {
+  int fd = mkstemp(templ);
+  ck_assert_int_ne(fd, -1);
+  close(fd);
+}
+
+static const char src1[] = "KERNEL void k1(GLOBAL_MEM float *a) { a[0] = 1; }";
+static const char src2[] = "KERNEL void k2(GLOBAL_MEM float *a) { a[0] = 2; }";
+
+typedef struct _seen {
+  unsigned int n;
+  char fname[4][8];
+  char bin_id[4][16];
+  int flags[4];
+  size_t len[4];
+} seen;
+
+static int collect(void *arg, const char *bin_id, const char *fname,
+                   const strb *src, int flags) {
+  seen *s = (seen *)arg;
+  ck_assert(s->n < 4);
+  strcpy(s->fname[s->n], fname);
+  strcpy(s->bin_id[s->n], bin_id);
+  s->flags[s->n] = flags;
+  s->len[s->n] = src->l;
+  s->n++;
+  return GA_NO_ERROR;
+}
+
+START_TEST(test_manifest) {
+  seen s;
+  FILE *f;
+
+  tmpfile_name(manifest);
+  ck_assert_int_eq(kernel_manifest_add(manifest, "compute_70", "k1", src1,
+                                       sizeof(src1) - 1, GA_USE_DOUBLE,
+                                       global_err), GA_NO_ERROR);
+  ck_assert_int_eq(kernel_manifest_add(manifest, "compute_80", "k2", src2,
+                                       sizeof(src2) - 1, 0, global_err),
+                   GA_NO_ERROR);
+
+  memset(&s, 0, sizeof(s));
+  ck_assert_int_eq(kernel_manifest_read(manifest, collect, &s, global_err),
+                   GA_NO_ERROR);
+  ck_assert_uint_eq(s.n, 2);
+  ck_assert_str_eq(s.fname[0], "k1");
+  ck_assert_str_eq(s.bin_id[0], "compute_70");
+  ck_assert_int_eq(s.flags[0], GA_USE_DOUBLE);
+  ck_assert_uint_eq(s.len[0], sizeof(src1) - 1);
+  ck_assert_str_eq(s.fname[1], "k2");
+  ck_assert_str_eq(s.bin_id[1], "compute_80");
+
+  /* A partial record is an error */
+  f = fopen(manifest, "ab");
+  ck_assert_ptr_ne(f, NULL);
+  fwrite("GAKM", 1, 4, f);
+  fclose(f);
+  memset(&s, 0, sizeof(s));
+  ck_assert_int_eq(kernel_manifest_read(manifest, collect, &s, global_err),
+                   GA_VALUE_ERROR);
+  ck_assert_uint_eq(s.n, 2);
+  unlink(manifest);
+}
+END_TEST
+
+START_TEST(test_bundle) {
+  bundle_entry in[3];
+  bundle_entry *out;
+  size_t i, n;
+  FILE *f;
+
+  tmpfile_name(bundle);
+  memset(in, 0, sizeof(in));
+  strcpy(in[0].bin_id, "compute_70");
+  strb_appends(&in[0].src, src1);
+  strb_appendn(&in[0].bin, "\0bin1", 5);
+  strcpy(in[1].bin_id, "compute_80");
+  strb_appends(&in[1].src, src1);
+  strb_appends(&in[1].bin, "bin1-80");
+  strcpy(in[2].bin_id, "compute_70");
+  in[2].flags = 1;
+  strb_appends(&in[2].src, src2);
+  strb_appends(&in[2].bin, "bin2");
+  ck_assert_int_eq(kernel_bundle_write(bundle, in, 3, global_err),
+                   GA_NO_ERROR);
+
+  ck_assert_int_eq(kernel_bundle_read(bundle, NULL, &out, &n, global_err),
+                   GA_NO_ERROR);
+  ck_assert_uint_eq(n, 3);
+  for (i = 0; i < n; i++) {
+    ck_assert_str_eq(out[i].bin_id, in[i].bin_id);
+    ck_assert_int_eq(out[i].flags, in[i].flags);
+    ck_assert_uint_eq(out[i].src.l, in[i].src.l);
+    ck_assert(memcmp(out[i].src.s, in[i].src.s, in[i].src.l) == 0);
+    ck_assert_uint_eq(out[i].bin.l, in[i].bin.l);
+    ck_assert(memcmp(out[i].bin.s, in[i].bin.s, in[i].bin.l) == 0);
+    bundle_entry_clear(&out[i]);
+  }
+  free(out);
+
+  /* Only the entries for the requested arch */
+  ck_assert_int_eq(kernel_bundle_read(bundle, "compute_70", &out, &n,
+                                      global_err), GA_NO_ERROR);
+  ck_assert_uint_eq(n, 2);
+  ck_assert_uint_eq(out[0].bin.l, 5);
+  ck_assert_uint_eq(out[1].src.l, sizeof(src2) - 1);
+  for (i = 0; i < n; i++)
+    bundle_entry_clear(&out[i]);
+  free(out);
+
+  for (i = 0; i < 3; i++)
+    bundle_entry_clear(&in[i]);
+
+  /* Truncated file */
+  ck_assert_int_eq(truncate(bundle, 40), 0);
+  ck_assert_int_eq(kernel_bundle_read(bundle, NULL, &out, &n, global_err),
+                   GA_VALUE_ERROR);
+
+  /* Not a bundle */
+  f = fopen(bundle, "wb");
+  ck_assert_ptr_ne(f, NULL);
+  fputs("GAKM not a bundle", f);
+  fclose(f);
+  ck_assert_int_eq(kernel_bundle_read(bundle, NULL, &out, &n, global_err),
+                   GA_VALUE_ERROR);
+  unlink(bundle);
+}
+END_TEST
+
+Suite *get_suite(void) {
+  Suite *s = suite_create("bundle");
+  TCase *tc = tcase_create("All");
+  tcase_add_test(tc, test_manifest);
+  tcase_add_test(tc, test_bundle);
+  suite_add_tcase(s, tc);
+  return s;
+}
@@ -152,6 +152,72 @@ START_TEST(test_GpuArray_all_reduce) {
 }
 END_TEST
 
+START_TEST(test_GpuArray_all_reduce_async) {
+  gpucomm_request* req;
+  int res, done;
+  INIT_ARRAYS(ROWS, COLS, ROWS, COLS);
+
+  err = GpuArray_all_reduce_async(&Adev, &RESdev, GA_SUM, comm, &req);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  err = gpucomm_request_test(req, &done);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  err = gpucomm_request_wait(req);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  err = gpucomm_request_test(req, &done);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  ck_assert_int_eq(done, 1);
+  gpucomm_request_free(req);
+
+  err = MPI_Allreduce(A, EXP, ROWS * COLS, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  ck_assert_msg(err == MPI_SUCCESS, "openmpi error: cannot produced expected");
+
+  // The read must see the result without an explicit sync
+  err = GpuArray_read(RES, outsize, &RESdev);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  COUNT_ERRORS(RES, EXP, ROWS, COLS, res);
+  ck_assert_msg(res == 0,
+                "GpuArray_all_reduce_async with %s op produced errors in %d places",
+                STR(GA_SUM), res);
+
+  DESTROY_ARRAYS();
+}
+END_TEST
+
+START_TEST(test_GpuArray_all_reduce_reuse) {
+  GpuArray Cdev;
+  int res;
+  INIT_ARRAYS(ROWS, COLS, ROWS, COLS);
+
+  err = GpuArray_all_reduce(&Adev, &RESdev, GA_SUM, comm);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  // Read then overwrite the source on the compute stream without a sync.
+  // The overwrite must still wait for the collective to read it.
+  err = GpuArray_copy(&Cdev, &Adev, GA_C_ORDER);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  err = GpuArray_memset(&Adev, 0);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+
+  err = MPI_Allreduce(A, EXP, ROWS * COLS, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  ck_assert_msg(err == MPI_SUCCESS, "openmpi error: cannot produced expected");
+
+  err = GpuArray_read(RES, outsize, &RESdev);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  COUNT_ERRORS(RES, EXP, ROWS, COLS, res);
+  ck_assert_msg(res == 0,
+                "GpuArray_all_reduce followed by a write produced errors in %d places",
+                res);
+
+  err = GpuArray_read(RES, outsize, &Cdev);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  COUNT_ERRORS(RES, A, ROWS, COLS, res);
+  ck_assert_msg(res == 0, "copy of the source produced errors in %d places",
+                res);
+
+  GpuArray_clear(&Cdev);
+  DESTROY_ARRAYS();
+}
+END_TEST
+
 /**
  * \note Untested for `not proper element count` , `not agreeing typecode`, `not
  * aligned`.
@@ -249,15 +315,147 @@ START_TEST(test_GpuArray_all_gather) {
 }
 END_TEST
 
+START_TEST(test_GpuArray_send_recv) {
+  int res;
+  int next = (comm_rank + 1) % comm_ndev;
+  int prev = (comm_rank + comm_ndev - 1) % comm_ndev;
+  INIT_ARRAYS(ROWS, COLS, ROWS, COLS);
+
+  // Ring shift: everyone sends and receives, so it must be grouped
+  err = gpucomm_group_start(comm);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  err = GpuArray_send(&Adev, next, comm);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  err = GpuArray_recv(&RESdev, prev, comm);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  err = gpucomm_group_end(comm);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+
+  for (i = 0; i < ROWS; ++i)
+    for (j = 0; j < COLS; ++j)
+      EXP[i][j] = prev + 2;
+
+  err = GpuArray_read(RES, outsize, &RESdev);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  COUNT_ERRORS(RES, EXP, ROWS, COLS, res);
+  ck_assert_msg(res == 0, "GpuArray_send/recv produced errors in %d places",
+                res);
+
+  DESTROY_ARRAYS();
+}
+END_TEST
+
+START_TEST(test_GpuArray_all_to_all) {
+  int res;
+  // Blocks are split along the first axis, like all_gather
+  INIT_ARRAYS(ROWS, COLS, ROWS, COLS);
+
+  for (i = 0; i < ROWS; ++i)
+    for (j = 0; j < COLS; ++j)
+      A[i][j] = comm_rank * ROWS * COLS + (int)(i * COLS + j);
+  err = GpuArray_write(&Adev, A, sizeof(*A) * ROWS);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+
+  err = GpuArray_all_to_all(&Adev, &RESdev, comm);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+
+  err = MPI_Alltoall(A, ROWS * COLS / comm_ndev, MPI_INT, EXP,
+                     ROWS * COLS / comm_ndev, MPI_INT, MPI_COMM_WORLD);
+  ck_assert_msg(err == MPI_SUCCESS, "openmpi error: cannot produced expected");
+
+  err = GpuArray_read(RES, outsize, &RESdev);
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  COUNT_ERRORS(RES, EXP, ROWS, COLS, res);
+  ck_assert_msg(res == 0, "GpuArray_all_to_all produced errors in %d places",
+                res);
+
+  DESTROY_ARRAYS();
+}
+END_TEST
+
+START_TEST(test_gpucomm_bucket) {
+  /* Small arrays, a large one and a transposed view, with buckets
+     small enough that they get split */
+  const size_t dims[4][2] = {{3, 5}, {ROWS, COLS}, {1, 1}, {COLS, ROWS}};
+  GpuArray base[4], views[4];
+  gpucomm_bucket *b;
+  int *A, *RES;
+  unsigned int k, idx, round;
+  size_t i, n;
+  int err;
+
+  err = gpucomm_bucket_new(&b, comm, GA_INT, GA_SUM, ROWS * sizeof(int));
+  ck_assert_int_eq(err, GA_NO_ERROR);
+  for (k = 0; k < 4; k++) {
+    err = GpuArray_empty(&base[k], ctx, GA_INT, ND, dims[k], GA_C_ORDER);
+    ck_assert_int_eq(err, GA_NO_ERROR);
+    err = GpuArray_view(&views[k], &base[k]);
+    ck_assert_int_eq(err, GA_NO_ERROR);
+    if (k == 3) {
+      err = GpuArray_transpose_inplace(&views[k], NULL);
+      ck_assert_int_eq(err, GA_NO_ERROR);
+    }
+    err = gpucomm_bucket_add(b, &views[k], &idx);
+    ck_assert_int_eq(err, GA_NO_ERROR);
+    ck_assert_int_eq(idx, k);
+  }
+
+  for (round = 0; round < 2; round++) {
+    for (k = 0; k < 4; k++) {
+      n = dims[k][0] * dims[k][1];
+      A = calloc(n, sizeof(int));
+      ck_assert_ptr_ne(A, NULL);
+      for (i = 0; i < n; i++)
+        A[i] = (comm_rank + 1) * (int)(i + k + round);
+      err = GpuArray_write(&base[k], A, n * sizeof(int));
+      ck_assert_int_eq(err, GA_NO_ERROR);
+      free(A);
+    }
+    /* Buckets go out as they fill in the second round */
+    if (round == 1) {
+      for (k = 0; k < 4; k++) {
+        err = gpucomm_bucket_ready(b, k);
+        ck_assert_int_eq(err, GA_NO_ERROR);
+      }
+    }
+    err = gpucomm_bucket_flush(b);
+    ck_assert_int_eq(err, GA_NO_ERROR);
+
+    for (k = 0; k < 4; k++) {
+      n = dims[k][0] * dims[k][1];
+      RES = calloc(n, sizeof(int));
+      ck_assert_ptr_ne(RES, NULL);
+      err = GpuArray_read(RES, n * sizeof(int), &base[k]);
+      ck_assert_int_eq(err, GA_NO_ERROR);
+      for (i = 0; i < n; i++)
+        ck_assert_int_eq(RES[i], comm_ndev * (comm_ndev + 1) / 2 *
+                         (int)(i + k + round));
+      free(RES);
+    }
+  }
+
+  gpucomm_bucket_free(b);
+  for (k = 0; k < 4; k++) {
+    GpuArray_clear(&views[k]);
+    GpuArray_clear(&base[k]);
+  }
+}
+END_TEST
+
 Suite* get_suite(void) {
   Suite* s = suite_create("collectives");
   TCase* tc = tcase_create("API");
   tcase_add_checked_fixture(tc, setup_comm, teardown_comm);
   tcase_add_test(tc, test_GpuArray_reduce);
   tcase_add_test(tc, test_GpuArray_all_reduce);
+  tcase_add_test(tc, test_GpuArray_all_reduce_async);
+  tcase_add_test(tc, test_GpuArray_all_reduce_reuse);
   tcase_add_test(tc, test_GpuArray_reduce_scatter);
   tcase_add_test(tc, test_GpuArray_broadcast);
   tcase_add_test(tc, test_GpuArray_all_gather);
+  tcase_add_test(tc, test_GpuArray_send_recv);
+  tcase_add_test(tc, test_GpuArray_all_to_all);
+  tcase_add_test(tc, test_gpucomm_bucket);
   suite_add_tcase(s, tc);
   return s;
 }
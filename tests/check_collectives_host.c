@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <check.h>
+
+#include "gpuarray/array.h"
+#include "gpuarray/buffer.h"
+#include "gpuarray/buffer_collectives.h"
+#include "gpuarray/collectives.h"
+#include "gpuarray/error.h"
+#include "gpuarray/types.h"
+
+#include "private.h"
+
+#define NRANKS 3
+
+extern gpuarray_comm_ops host_comm_ops;
+extern int get_env_dev(const char **name, gpucontext_props *p);
+
+/*
+ * The ranks are forked processes which each open their own context.
+ * Rank 0 generates the clique id and passes it to the others through
+ * a pipe.
+ */
+
+static gpucontext *open_ctx(void) {
+  const char *name = NULL;
+  gpucontext_props *p;
+  gpucontext *c = NULL;
+  if (gpucontext_props_new(&p) != GA_NO_ERROR ||
+      get_env_dev(&name, p) != 0 ||
+      gpucontext_init(&c, name, p) != GA_NO_ERROR)
+    return NULL;
+  /* Force the host implementation even if the backend has another one */
+  c->comm_ops = &host_comm_ops;
+  return c;
+}
+
+static float val(int rank, size_t i) {
+  return (float)(rank + 1) * (float)(i % 7);
+}
+
+#define CHECK_EQ(a, b, msg)                     \
+  do {                                          \
+    if ((a) != (b)) {                           \
+      fprintf(stderr, "rank %d: %s\n", rank, msg); \
+      return 1;                                 \
+    }                                           \
+  } while (0)
+
+static int check_count(gpucomm *comm, int rank, size_t c) {
+  gpucontext *ctx = gpucomm_context(comm);
+  float *h = malloc(c * sizeof(float) * NRANKS);
+  float *o = malloc(c * sizeof(float) * NRANKS);
+  float total = (float)(NRANKS * (NRANKS + 1) / 2);
+  gpudata *s, *d;
+  gpucomm_request *req;
+  size_t i;
+  int r, done;
+
+  s = gpudata_alloc(ctx, c * sizeof(float) * NRANKS, NULL, 0, NULL);
+  d = gpudata_alloc(ctx, c * sizeof(float) * NRANKS, NULL, 0, NULL);
+  if (h == NULL || o == NULL || s == NULL || d == NULL)
+    return 1;
+  for (i = 0; i < c * NRANKS; i++)
+    h[i] = val(rank, i);
+  CHECK_EQ(gpudata_write(s, 0, h, c * sizeof(float) * NRANKS), GA_NO_ERROR,
+           "write");
+
+  CHECK_EQ(gpucomm_all_reduce(s, 0, d, 0, c, GA_FLOAT, GA_SUM, comm),
+           GA_NO_ERROR, "all_reduce");
+  CHECK_EQ(gpudata_read(o, d, 0, c * sizeof(float)), GA_NO_ERROR, "read");
+  for (i = 0; i < c; i++)
+    CHECK_EQ(o[i], total * (float)(i % 7), "all_reduce value");
+
+  /* The host transport completes the operations before returning */
+  CHECK_EQ(gpucomm_request_new(&req, comm), GA_NO_ERROR, "request_new");
+  CHECK_EQ(gpucomm_request_test(req, &done), GA_NO_ERROR, "request_test");
+  CHECK_EQ(done, 1, "request done");
+  CHECK_EQ(gpucomm_request_wait(req), GA_NO_ERROR, "request_wait");
+  gpucomm_request_free(req);
+
+  CHECK_EQ(gpucomm_all_reduce(s, 0, d, 0, c, GA_FLOAT, GA_MAX, comm),
+           GA_NO_ERROR, "all_reduce max");
+  CHECK_EQ(gpudata_read(o, d, 0, c * sizeof(float)), GA_NO_ERROR, "read");
+  for (i = 0; i < c; i++)
+    CHECK_EQ(o[i], val(NRANKS - 1, i), "all_reduce max value");
+
+  for (r = 0; r < NRANKS; r++) {
+    CHECK_EQ(gpucomm_reduce(s, 0, d, 0, c, GA_FLOAT, GA_SUM, r, comm),
+             GA_NO_ERROR, "reduce");
+    CHECK_EQ(gpudata_read(o, d, 0, c * sizeof(float)), GA_NO_ERROR, "read");
+    if (rank == r)
+      for (i = 0; i < c; i++)
+        CHECK_EQ(o[i], total * (float)(i % 7), "reduce value");
+
+    CHECK_EQ(gpudata_write(d, 0, h, c * sizeof(float)), GA_NO_ERROR, "write");
+    CHECK_EQ(gpucomm_broadcast(d, 0, c, GA_FLOAT, r, comm), GA_NO_ERROR,
+             "broadcast");
+    CHECK_EQ(gpudata_read(o, d, 0, c * sizeof(float)), GA_NO_ERROR, "read");
+    for (i = 0; i < c; i++)
+      CHECK_EQ(o[i], val(r, i), "broadcast value");
+  }
+
+  CHECK_EQ(gpucomm_reduce_scatter(s, 0, d, 0, c, GA_FLOAT, GA_SUM, comm),
+           GA_NO_ERROR, "reduce_scatter");
+  CHECK_EQ(gpudata_read(o, d, 0, c * sizeof(float)), GA_NO_ERROR, "read");
+  for (i = 0; i < c; i++)
+    CHECK_EQ(o[i], total * (float)((rank * c + i) % 7), "reduce_scatter value");
+
+  CHECK_EQ(gpucomm_all_gather(s, 0, d, 0, c, GA_FLOAT, comm), GA_NO_ERROR,
+           "all_gather");
+  CHECK_EQ(gpudata_read(o, d, 0, c * sizeof(float) * NRANKS), GA_NO_ERROR,
+           "read");
+  for (r = 0; r < NRANKS; r++)
+    for (i = 0; i < c; i++)
+      CHECK_EQ(o[r * c + i], val(r, i), "all_gather value");
+
+  gpudata_release(s);
+  gpudata_release(d);
+  free(h);
+  free(o);
+  return 0;
+}
+
+static int check_p2p(gpucomm *comm, int rank, size_t c) {
+  gpucontext *ctx = gpucomm_context(comm);
+  float *h = malloc(c * sizeof(float) * NRANKS);
+  float *o = malloc(c * sizeof(float) * NRANKS);
+  size_t sc[NRANKS], sd[NRANKS], rc[NRANKS], rd[NRANKS];
+  gpudata *s, *d;
+  size_t i, pos;
+  int r, next = (rank + 1) % NRANKS, prev = (rank + NRANKS - 1) % NRANKS;
+
+  s = gpudata_alloc(ctx, c * sizeof(float) * NRANKS, NULL, 0, NULL);
+  d = gpudata_alloc(ctx, c * sizeof(float) * NRANKS, NULL, 0, NULL);
+  if (h == NULL || o == NULL || s == NULL || d == NULL)
+    return 1;
+  for (i = 0; i < c * NRANKS; i++)
+    h[i] = val(rank, i);
+  CHECK_EQ(gpudata_write(s, 0, h, c * sizeof(float) * NRANKS), GA_NO_ERROR,
+           "write");
+
+  /* Ring shift in both directions at once */
+  CHECK_EQ(gpucomm_group_start(comm), GA_NO_ERROR, "group_start");
+  CHECK_EQ(gpucomm_send(s, 0, c, GA_FLOAT, next, comm), GA_NO_ERROR, "send");
+  CHECK_EQ(gpucomm_send(s, 0, c, GA_FLOAT, prev, comm), GA_NO_ERROR, "send");
+  CHECK_EQ(gpucomm_recv(d, 0, c, GA_FLOAT, prev, comm), GA_NO_ERROR, "recv");
+  CHECK_EQ(gpucomm_recv(d, c * sizeof(float), c, GA_FLOAT, next, comm),
+           GA_NO_ERROR, "recv");
+  CHECK_EQ(gpucomm_group_end(comm), GA_NO_ERROR, "group_end");
+  CHECK_EQ(gpudata_read(o, d, 0, 2 * c * sizeof(float)), GA_NO_ERROR, "read");
+  for (i = 0; i < c; i++) {
+    CHECK_EQ(o[i], val(prev, i), "recv value");
+    CHECK_EQ(o[c + i], val(next, i), "recv value");
+  }
+
+  CHECK_EQ(gpucomm_all_to_all(s, 0, d, 0, c, GA_FLOAT, comm), GA_NO_ERROR,
+           "all_to_all");
+  CHECK_EQ(gpudata_read(o, d, 0, c * sizeof(float) * NRANKS), GA_NO_ERROR,
+           "read");
+  for (r = 0; r < NRANKS; r++)
+    for (i = 0; i < c; i++)
+      CHECK_EQ(o[r * c + i], val(r, rank * c + i), "all_to_all value");
+
+  /* Rank r sends its first r + 1 elements to everyone */
+  pos = 0;
+  for (r = 0; r < NRANKS; r++) {
+    sc[r] = (size_t)rank + 1;
+    sd[r] = 0;
+    rc[r] = (size_t)r + 1;
+    rd[r] = pos;
+    pos += rc[r];
+  }
+  CHECK_EQ(gpucomm_all_to_allv(s, 0, sc, sd, d, 0, rc, rd, GA_FLOAT, comm),
+           GA_NO_ERROR, "all_to_allv");
+  CHECK_EQ(gpudata_read(o, d, 0, pos * sizeof(float)), GA_NO_ERROR, "read");
+  for (r = 0; r < NRANKS; r++)
+    for (i = 0; i < rc[r]; i++)
+      CHECK_EQ(o[rd[r] + i], val(r, i), "all_to_allv value");
+
+  gpudata_release(s);
+  gpudata_release(d);
+  free(h);
+  free(o);
+  return 0;
+}
+
+static int check_compressed(gpucomm *comm, int rank, size_t c) {
+  gpucontext *ctx = gpucomm_context(comm);
+  float *h = malloc(c * sizeof(float));
+  float *o = malloc(c * sizeof(float));
+  float total = (float)(NRANKS * (NRANKS + 1) / 2);
+  GpuArray s, d, res;
+  size_t k = 5;
+  size_t i;
+
+  if (h == NULL || o == NULL)
+    return 1;
+  CHECK_EQ(GpuArray_empty(&s, ctx, GA_FLOAT, 1, &c, GA_C_ORDER), GA_NO_ERROR,
+           "empty");
+  CHECK_EQ(GpuArray_empty(&d, ctx, GA_FLOAT, 1, &c, GA_C_ORDER), GA_NO_ERROR,
+           "empty");
+  CHECK_EQ(GpuArray_zeros(&res, ctx, GA_FLOAT, 1, &c, GA_C_ORDER),
+           GA_NO_ERROR, "zeros");
+
+  /* Small integers are exact in float16 */
+  for (i = 0; i < c; i++)
+    h[i] = val(rank, i);
+  CHECK_EQ(GpuArray_write(&s, h, c * sizeof(float)), GA_NO_ERROR, "write");
+  CHECK_EQ(GpuArray_all_reduce_compressed(&s, &d, GA_SUM, GA_COMPRESS_HALF,
+                                          0, NULL, comm),
+           GA_NO_ERROR, "all_reduce half");
+  CHECK_EQ(GpuArray_read(o, c * sizeof(float), &d), GA_NO_ERROR, "read");
+  for (i = 0; i < c; i++)
+    CHECK_EQ(o[i], total * (float)(i % 7), "all_reduce half value");
+
+  /* Every rank sends its last k elements, the rest stays in residual */
+  for (i = 0; i < c; i++)
+    h[i] = (float)((rank + 1) * i);
+  CHECK_EQ(GpuArray_write(&s, h, c * sizeof(float)), GA_NO_ERROR, "write");
+  CHECK_EQ(GpuArray_all_reduce_compressed(&s, &d, GA_SUM, GA_COMPRESS_TOPK,
+                                          k, &res, comm),
+           GA_NO_ERROR, "all_reduce topk");
+  CHECK_EQ(GpuArray_read(o, c * sizeof(float), &d), GA_NO_ERROR, "read");
+  for (i = 0; i < c; i++)
+    CHECK_EQ(o[i], i < c - k ? 0.0f : total * (float)i,
+             "all_reduce topk value");
+  CHECK_EQ(GpuArray_read(o, c * sizeof(float), &res), GA_NO_ERROR, "read");
+  for (i = 0; i < c; i++)
+    CHECK_EQ(o[i], i < c - k ? h[i] : 0.0f, "residual value");
+
+  CHECK_EQ(GpuArray_all_reduce_compressed(&s, &d, GA_MAX, GA_COMPRESS_TOPK,
+                                          k, NULL, comm),
+           GA_VALUE_ERROR, "all_reduce topk max");
+
+  GpuArray_clear(&s);
+  GpuArray_clear(&d);
+  GpuArray_clear(&res);
+  free(h);
+  free(o);
+  return 0;
+}
+
+static int run_rank(int rank, int *fds) {
+  gpucontext *ctx = open_ctx();
+  gpucommCliqueId comm_id;
+  gpucomm *comm;
+  int i, res;
+
+  if (ctx == NULL)
+    return 1;
+  if (rank == 0) {
+    if (gpucomm_gen_clique_id(ctx, &comm_id) != GA_NO_ERROR)
+      return 1;
+    for (i = 1; i < NRANKS; i++)
+      if (write(fds[1], &comm_id, sizeof(comm_id)) != sizeof(comm_id))
+        return 1;
+  } else {
+    if (read(fds[0], &comm_id, sizeof(comm_id)) != sizeof(comm_id))
+      return 1;
+  }
+  if (gpucomm_new(&comm, ctx, comm_id, NRANKS, rank) != GA_NO_ERROR) {
+    fprintf(stderr, "rank %d: %s\n", rank, gpucontext_error(ctx, 0));
+    return 1;
+  }
+  /* One message below the pipelining threshold and one above */
+  res = check_count(comm, rank, 37) || check_count(comm, rank, 100003) ||
+        check_p2p(comm, rank, 37) || check_p2p(comm, rank, 100003) ||
+        check_compressed(comm, rank, 37);
+  gpucomm_free(comm);
+  gpucontext_deref(ctx);
+  return res;
+}
+
+static int run_ranks(void) {
+  int fds[2];
+  int i, status, failed = 0;
+
+  if (pipe(fds) != 0)
+    return -1;
+  for (i = 0; i < NRANKS; i++) {
+    if (fork() == 0)
+      _exit(run_rank(i, fds));
+  }
+  for (i = 0; i < NRANKS; i++) {
+    wait(&status);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      failed++;
+  }
+  close(fds[0]);
+  close(fds[1]);
+  return failed;
+}
+
+START_TEST(test_host_collectives_shm) {
+  unsetenv("GPUARRAY_COMM_ADDR");
+  ck_assert_int_eq(run_ranks(), 0);
+}
+END_TEST
+
+START_TEST(test_host_collectives_tcp) {
+  char addr[32];
+  snprintf(addr, sizeof(addr), "127.0.0.1:%d", 20000 + (int)(getpid() % 20000));
+  setenv("GPUARRAY_COMM_ADDR", addr, 1);
+  ck_assert_int_eq(run_ranks(), 0);
+}
+END_TEST
+
+Suite *get_suite(void) {
+  Suite *s = suite_create("collectives_host");
+  TCase *tc = tcase_create("All");
+  tcase_set_timeout(tc, 60);
+  tcase_add_test(tc, test_host_collectives_shm);
+  tcase_add_test(tc, test_host_collectives_tcp);
+  suite_add_tcase(s, tc);
+  return s;
+}
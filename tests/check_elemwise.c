@@ -197,6 +197,75 @@ START_TEST(test_contig_0) {
 }
 END_TEST
 
+START_TEST(test_contig_offset) {
+  GpuArray a;
+  GpuArray b;
+  GpuArray c;
+
+  GpuElemwise *ge;
+
+  static const uint32_t data1[6] = {1, 2, 3, 4, 5, 6};
+  static const uint32_t data2[3] = {7, 8, 9};
+  uint32_t data3[3] = {0};
+
+  size_t dims[1];
+
+  gpuelemwise_arg args[3] = {{0}};
+  void *rargs[3];
+
+  ssize_t starts[1];
+  ssize_t stops[1];
+  ssize_t steps[1];
+
+  dims[0] = 6;
+
+  ga_assert_ok(GpuArray_empty(&a, ctx, GA_UINT, 1, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&a, data1, sizeof(data1)));
+
+  starts[0] = 3;
+  stops[0] = 6;
+  steps[0] = 1;
+
+  ga_assert_ok(GpuArray_index_inplace(&a, starts, stops, steps));
+  ck_assert(GpuArray_IS_C_CONTIGUOUS(&a));
+
+  dims[0] = 3;
+
+  ga_assert_ok(GpuArray_empty(&b, ctx, GA_UINT, 1, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&b, data2, sizeof(data2)));
+
+  ga_assert_ok(GpuArray_empty(&c, ctx, GA_UINT, 1, dims, GA_C_ORDER));
+
+  args[0].name = "a";
+  args[0].typecode = GA_UINT;
+  args[0].flags = GE_READ;
+
+  args[1].name = "b";
+  args[1].typecode = GA_UINT;
+  args[1].flags = GE_READ;
+
+  args[2].name = "c";
+  args[2].typecode = GA_UINT;
+  args[2].flags = GE_WRITE;
+
+  ge = GpuElemwise_new(ctx, "", "c = a + b", 3, args, 1, 0);
+
+  ck_assert_ptr_ne(ge, NULL);
+
+  rargs[0] = &a;
+  rargs[1] = &b;
+  rargs[2] = &c;
+
+  ga_assert_ok(GpuElemwise_call(ge, rargs, 0));
+
+  ga_assert_ok(GpuArray_read(data3, sizeof(data3), &c));
+
+  ck_assert_int_eq(data3[0], 11);
+  ck_assert_int_eq(data3[1], 13);
+  ck_assert_int_eq(data3[2], 15);
+}
+END_TEST
+
 START_TEST(test_basic_simple) {
   GpuArray a;
   GpuArray b;
@@ -638,6 +707,85 @@ START_TEST(test_basic_broadcast) {
 }
 END_TEST
 
+START_TEST(test_basic_specialize) {
+  GpuArray a;
+  GpuArray b;
+  GpuArray c;
+
+  GpuElemwise *ge;
+
+  static const uint32_t data1[3] = {1, 2, 3};
+  uint32_t data2[2];
+  uint32_t data3[6] = {0};
+
+  size_t dims[2];
+  unsigned int i;
+
+  gpuelemwise_arg args[3] = {{0}};
+  void *rargs[3];
+
+  dims[0] = 1;
+  dims[1] = 3;
+
+  ga_assert_ok(GpuArray_empty(&a, ctx, GA_UINT, 2, dims, GA_C_ORDER));
+  ga_assert_ok(GpuArray_write(&a, data1, sizeof(data1)));
+
+  dims[0] = 2;
+  dims[1] = 1;
+
+  ga_assert_ok(GpuArray_empty(&b, ctx, GA_UINT, 2, dims, GA_F_ORDER));
+
+  dims[0] = 2;
+  dims[1] = 3;
+
+  ga_assert_ok(GpuArray_empty(&c, ctx, GA_UINT, 2, dims, GA_C_ORDER));
+
+  args[0].name = "a";
+  args[0].typecode = GA_UINT;
+  args[0].flags = GE_READ;
+
+  args[1].name = "b";
+  args[1].typecode = GA_UINT;
+  args[1].flags = GE_READ;
+
+  args[2].name = "c";
+  args[2].typecode = GA_UINT;
+  args[2].flags = GE_WRITE;
+
+  ge = GpuElemwise_new(ctx, "", "c = a + b", 3, args, 2, GE_SPECIALIZE);
+
+  ck_assert_ptr_ne(ge, NULL);
+
+  rargs[0] = &a;
+  rargs[1] = &b;
+  rargs[2] = &c;
+
+  /* Enough calls to go over the threshold, with different data each
+     time to make sure the arguments are still passed in. */
+  for (i = 0; i < 6; i++) {
+    data2[0] = 4 * i;
+    data2[1] = 4 * i + 1;
+    ga_assert_ok(GpuArray_write(&b, data2, sizeof(data2)));
+
+    ga_assert_ok(GpuElemwise_call(ge, rargs, GE_BROADCAST));
+
+    ga_assert_ok(GpuArray_read(data3, sizeof(data3), &c));
+
+    ck_assert_int_eq(data3[0], 4 * i + 1);
+    ck_assert_int_eq(data3[1], 4 * i + 2);
+    ck_assert_int_eq(data3[2], 4 * i + 3);
+    ck_assert_int_eq(data3[3], 4 * i + 2);
+    ck_assert_int_eq(data3[4], 4 * i + 3);
+    ck_assert_int_eq(data3[5], 4 * i + 4);
+  }
+
+  GpuElemwise_free(ge);
+  GpuArray_clear(&c);
+  GpuArray_clear(&b);
+  GpuArray_clear(&a);
+}
+END_TEST
+
 START_TEST(test_basic_padshape) {
   GpuArray a;
   GpuArray b;
@@ -887,6 +1035,7 @@ Suite *get_suite(void) {
   tcase_add_test(tc, test_contig_simple);
   tcase_add_test(tc, test_contig_f16);
   tcase_add_test(tc, test_contig_0);
+  tcase_add_test(tc, test_contig_offset);
   suite_add_tcase(s, tc);
   tc = tcase_create("basic");
   tcase_set_timeout(tc, 8.0);
@@ -898,6 +1047,7 @@ Suite *get_suite(void) {
   tcase_add_test(tc, test_basic_offset);
   tcase_add_test(tc, test_basic_remove1);
   tcase_add_test(tc, test_basic_broadcast);
+  tcase_add_test(tc, test_basic_specialize);
   tcase_add_test(tc, test_basic_padshape);
   tcase_add_test(tc, test_basic_collapse);
   tcase_add_test(tc, test_basic_neg_strides);
@@ -3,8 +3,10 @@
 #include <gpuarray/buffer.h>
 #include <gpuarray/array.h>
 #include <gpuarray/error.h>
+#include <gpuarray/reduction.h>
 #include <gpuarray/types.h>
 
+#include <math.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdlib.h>
@@ -430,6 +432,262 @@ START_TEST(test_alldimsreduced){
 	GpuArray_clear(&gaArgmax);
 }END_TEST
 
+START_TEST(test_sum){
+	/**
+	 * We test here sums of some random 3D tensor on the first and third
+	 * dimensions (few outputs, split among threads) and on the second
+	 * dimension (one thread per output).
+	 */
+
+	GpuReduction* gr;
+	GpuArray gaSrc;
+	GpuArray gaDst1;
+	GpuArray gaDst2;
+	size_t i,j,k;
+	size_t dims[3]  = {32,50,79};
+	size_t dims2[2] = {32,79};
+	size_t prodDims = dims[0]*dims[1]*dims[2];
+	const unsigned reduxList1[] = {0,2};
+	const unsigned reduxList2[] = {1};
+
+	float *pSrc  = calloc(sizeof(*pSrc),  prodDims);
+	float *pDst1 = calloc(sizeof(*pDst1), dims[1]);
+	float *pDst2 = calloc(sizeof(*pDst2), dims[0]*dims[2]);
+
+	ck_assert_ptr_ne(pSrc,  NULL);
+	ck_assert_ptr_ne(pDst1, NULL);
+	ck_assert_ptr_ne(pDst2, NULL);
+
+
+	/**
+	 * Initialize source data.
+	 */
+
+	pcgSeed(1);
+	for(i=0;i<prodDims;i++){
+		pSrc[i] = pcgRand01();
+	}
+
+
+	/**
+	 * Run the kernels.
+	 */
+
+	gr = GpuReduction_new(ctx, NULL, NULL, "a + b", "0", GA_FLOAT, GA_DOUBLE, GA_FLOAT);
+	ck_assert_ptr_ne(gr, NULL);
+
+	ga_assert_ok(GpuArray_empty(&gaSrc,  ctx, GA_FLOAT, 3, dims,     GA_C_ORDER));
+	ga_assert_ok(GpuArray_empty(&gaDst1, ctx, GA_FLOAT, 1, &dims[1], GA_C_ORDER));
+	ga_assert_ok(GpuArray_empty(&gaDst2, ctx, GA_FLOAT, 2, dims2,    GA_F_ORDER));
+
+	ga_assert_ok(GpuArray_write(&gaSrc, pSrc, sizeof(*pSrc)*prodDims));
+
+	ga_assert_ok(GpuReduction_call(gr, &gaDst1, &gaSrc, 2, reduxList1));
+	ga_assert_ok(GpuReduction_call(gr, &gaDst2, &gaSrc, 1, reduxList2));
+
+	ga_assert_ok(GpuArray_read(pDst1, sizeof(*pDst1)*dims[1],         &gaDst1));
+	ga_assert_ok(GpuArray_read(pDst2, sizeof(*pDst2)*dims[0]*dims[2], &gaDst2));
+
+
+	/**
+	 * Check that the destination tensors are correct.
+	 */
+
+	for(j=0;j<dims[1];j++){
+		double gtSum = 0;
+
+		for(i=0;i<dims[0];i++){
+			for(k=0;k<dims[2];k++){
+				gtSum += pSrc[(i*dims[1] + j)*dims[2] + k];
+			}
+		}
+
+		ck_assert_msg(fabs(gtSum - pDst1[j]) < 1e-3, "Sum value mismatch!");
+	}
+	for(i=0;i<dims[0];i++){
+		for(k=0;k<dims[2];k++){
+			double gtSum = 0;
+
+			for(j=0;j<dims[1];j++){
+				gtSum += pSrc[(i*dims[1] + j)*dims[2] + k];
+			}
+
+			ck_assert_msg(fabs(gtSum - pDst2[k*dims[0] + i]) < 1e-4, "Sum value mismatch!");
+		}
+	}
+
+	/**
+	 * Deallocate.
+	 */
+
+	free(pSrc);
+	free(pDst1);
+	free(pDst2);
+	GpuArray_clear(&gaSrc);
+	GpuArray_clear(&gaDst1);
+	GpuArray_clear(&gaDst2);
+	GpuReduction_free(gr);
+}END_TEST
+
+START_TEST(test_mapmin){
+	/**
+	 * We test here a minimum and a sum of squares along the long first
+	 * axis of a 2D integer tensor, accumulated into 64-bit integers.
+	 */
+
+	GpuReduction* grMin;
+	GpuReduction* grSsq;
+	GpuArray gaSrc;
+	GpuArray gaMin;
+	GpuArray gaSsq;
+	size_t i,j;
+	size_t dims[2]  = {5000,7};
+	size_t prodDims = dims[0]*dims[1];
+	const unsigned reduxList[] = {0};
+
+	int32_t *pSrc = calloc(sizeof(*pSrc), prodDims);
+	int32_t *pMin = calloc(sizeof(*pMin), dims[1]);
+	int64_t *pSsq = calloc(sizeof(*pSsq), dims[1]);
+
+	ck_assert_ptr_ne(pSrc, NULL);
+	ck_assert_ptr_ne(pMin, NULL);
+	ck_assert_ptr_ne(pSsq, NULL);
+
+
+	/**
+	 * Initialize source data.
+	 */
+
+	pcgSeed(1);
+	for(i=0;i<prodDims;i++){
+		pSrc[i] = (int32_t)(pcgRand() % 200001) - 100000;
+	}
+
+
+	/**
+	 * Run the kernels.
+	 */
+
+	grMin = GpuReduction_new(ctx, "#define MYMIN(x, y) ((x) < (y) ? (x) : (y))",
+	                         NULL, "MYMIN(a, b)", "2147483647",
+	                         GA_INT, -1, GA_INT);
+	grSsq = GpuReduction_new(ctx, NULL, "a*a", "a + b", "0",
+	                         GA_INT, -1, GA_LONG);
+	ck_assert_ptr_ne(grMin, NULL);
+	ck_assert_ptr_ne(grSsq, NULL);
+
+	ga_assert_ok(GpuArray_empty(&gaSrc, ctx, GA_INT,  2, dims,     GA_C_ORDER));
+	ga_assert_ok(GpuArray_empty(&gaMin, ctx, GA_INT,  1, &dims[1], GA_C_ORDER));
+	ga_assert_ok(GpuArray_empty(&gaSsq, ctx, GA_LONG, 1, &dims[1], GA_C_ORDER));
+
+	ga_assert_ok(GpuArray_write(&gaSrc, pSrc, sizeof(*pSrc)*prodDims));
+
+	ga_assert_ok(GpuReduction_call(grMin, &gaMin, &gaSrc, 1, reduxList));
+	ga_assert_ok(GpuReduction_call(grSsq, &gaSsq, &gaSrc, 1, reduxList));
+
+	ga_assert_ok(GpuArray_read(pMin, sizeof(*pMin)*dims[1], &gaMin));
+	ga_assert_ok(GpuArray_read(pSsq, sizeof(*pSsq)*dims[1], &gaSsq));
+
+	/* The types of the arrays must match the reduction. */
+	ck_assert_int_eq(GpuReduction_call(grMin, &gaSsq, &gaSrc, 1, reduxList), GA_VALUE_ERROR);
+
+
+	/**
+	 * Check that the destination tensors are correct.
+	 */
+
+	for(j=0;j<dims[1];j++){
+		int32_t gtMin = 2147483647;
+		int64_t gtSsq = 0;
+
+		for(i=0;i<dims[0];i++){
+			int32_t v = pSrc[i*dims[1] + j];
+
+			gtMin  = v < gtMin ? v : gtMin;
+			gtSsq += (int64_t)v*v;
+		}
+
+		ck_assert_msg(gtMin == pMin[j], "Min value mismatch!");
+		ck_assert_msg(gtSsq == pSsq[j], "Sum of squares mismatch!");
+	}
+
+	/**
+	 * Deallocate.
+	 */
+
+	free(pSrc);
+	free(pMin);
+	free(pSsq);
+	GpuArray_clear(&gaSrc);
+	GpuArray_clear(&gaMin);
+	GpuArray_clear(&gaSsq);
+	GpuReduction_free(grMin);
+	GpuReduction_free(grSsq);
+}END_TEST
+
+START_TEST(test_halfsum){
+	/**
+	 * We test here a sum over all dimensions of a float16 tensor, which is
+	 * accumulated in float32.
+	 */
+
+	GpuReduction* gr;
+	GpuArray gaSrc;
+	GpuArray gaDst;
+	size_t i;
+	size_t dims[2]  = {100,300};
+	size_t prodDims = dims[0]*dims[1];
+	const unsigned reduxList[] = {0,1};
+	float  sum;
+
+	uint16_t *pSrc = calloc(sizeof(*pSrc), prodDims);
+
+	ck_assert_ptr_ne(pSrc, NULL);
+
+
+	/**
+	 * Initialize source data. 0x3c00 is 1.0 and 0x4000 is 2.0; the total
+	 * is far beyond the range of float16.
+	 */
+
+	for(i=0;i<prodDims;i++){
+		pSrc[i] = i%2 ? 0x4000 : 0x3c00;
+	}
+
+
+	/**
+	 * Run the kernel.
+	 */
+
+	gr = GpuReduction_new(ctx, NULL, NULL, "a + b", "0", GA_HALF, -1, GA_FLOAT);
+	ck_assert_ptr_ne(gr, NULL);
+
+	ga_assert_ok(GpuArray_empty(&gaSrc, ctx, GA_HALF,  2, dims, GA_C_ORDER));
+	ga_assert_ok(GpuArray_empty(&gaDst, ctx, GA_FLOAT, 0, NULL, GA_C_ORDER));
+
+	ga_assert_ok(GpuArray_write(&gaSrc, pSrc, sizeof(*pSrc)*prodDims));
+
+	ga_assert_ok(GpuReduction_call(gr, &gaDst, &gaSrc, 2, reduxList));
+
+	ga_assert_ok(GpuArray_read(&sum, sizeof(sum), &gaDst));
+
+
+	/**
+	 * Check that the destination tensor is correct.
+	 */
+
+	ck_assert_msg(sum == 1.5f*prodDims, "Sum value mismatch!");
+
+	/**
+	 * Deallocate.
+	 */
+
+	free(pSrc);
+	GpuArray_clear(&gaSrc);
+	GpuArray_clear(&gaDst);
+	GpuReduction_free(gr);
+}END_TEST
+
 Suite *get_suite(void) {
 	Suite *s  = suite_create("reduction");
 	TCase *tc = tcase_create("basic");
@@ -440,6 +698,9 @@ Suite *get_suite(void) {
 	tcase_add_test(tc, test_idxtranspose);
 	tcase_add_test(tc, test_veryhighrank);
 	tcase_add_test(tc, test_alldimsreduced);
+	tcase_add_test(tc, test_sum);
+	tcase_add_test(tc, test_mapmin);
+	tcase_add_test(tc, test_halfsum);
 
 	suite_add_tcase(s, tc);
 	return s;
@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "util/fastdiv.h"
+
+/* Host versions of ga_udiv_uint() and ga_udiv_size() from cluda.h */
+static uint32_t udiv32(uint32_t n, uint32_t m, uint32_t s) {
+  uint32_t t = (uint32_t)(((uint64_t)n * m) >> 32);
+  return (t + ((n - t) >> (s & 1))) >> (s >> 1);
+}
+
+static uint64_t mulhi64(uint64_t a, uint64_t b) {
+  uint64_t al = a & 0xffffffff, ah = a >> 32;
+  uint64_t bl = b & 0xffffffff, bh = b >> 32;
+  uint64_t ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+  uint64_t mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+  return hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+}
+
+static uint64_t udiv64(uint64_t n, uint64_t m, uint32_t s) {
+  uint64_t t = mulhi64(n, m);
+  return (t + ((n - t) >> (s & 1))) >> (s >> 1);
+}
+
+static const uint32_t divs32[] = {
+  1, 2, 3, 5, 6, 7, 10, 12, 25, 64, 100, 641, 1000, 65535, 65536, 65537,
+  1000003, 0x7fffffff, 0x80000000, 0x80000001, 0xfffffffe, 0xffffffff,
+};
+
+static const uint32_t nums32[] = {
+  0, 1, 2, 3, 7, 99, 100, 101, 65535, 65536, 1000000, 0x7fffffff,
+  0x80000000, 0x80000001, 0xfffffffe, 0xffffffff,
+};
+
+START_TEST(test_fastdiv_32) {
+  ga_fastdiv f;
+  unsigned int i, j;
+  uint32_t d, n;
+
+  memset(&f, 0, sizeof(f));
+  for (i = 0; i < sizeof(divs32)/sizeof(divs32[0]); i++) {
+    ga_fastdiv_init(&f, divs32[i]);
+    ck_assert_uint_eq(f.d, divs32[i]);
+    for (j = 0; j < sizeof(nums32)/sizeof(nums32[0]); j++) {
+      n = nums32[j];
+      ck_assert_uint_eq(udiv32(n, f.m32, f.s), n / divs32[i]);
+      ck_assert_uint_eq(udiv32(n + divs32[i] / 2, f.m32, f.s),
+                        (uint32_t)(n + divs32[i] / 2) / divs32[i]);
+    }
+  }
+  srand(42);
+  for (i = 0; i < 10000; i++) {
+    d = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    d >>= rand() % 32;
+    if (d == 0) continue;
+    ga_fastdiv_init(&f, d);
+    for (j = 0; j < 16; j++) {
+      n = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+      ck_assert_uint_eq(udiv32(n, f.m32, f.s), n / d);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_fastdiv_size) {
+  ga_fastdiv f;
+  unsigned int i, j;
+  size_t d, n;
+
+  if (sizeof(size_t) != 8) return;
+  memset(&f, 0, sizeof(f));
+  srand(43);
+  for (i = 0; i < 10000; i++) {
+    d = ((size_t)rand() << 40) ^ ((size_t)rand() << 20) ^ (size_t)rand();
+    d >>= rand() % 64;
+    if (d == 0) continue;
+    ga_fastdiv_init(&f, d);
+    for (j = 0; j < 16; j++) {
+      n = ((size_t)rand() << 40) ^ ((size_t)rand() << 20) ^ (size_t)rand();
+      ck_assert_uint_eq(udiv64(n, f.m, f.s), n / d);
+      ck_assert_uint_eq(udiv64(n >> (j * 4), f.m, f.s), (n >> (j * 4)) / d);
+    }
+    ck_assert_uint_eq(udiv64((size_t)-1, f.m, f.s), (size_t)-1 / d);
+  }
+}
+END_TEST
+
+START_TEST(test_fastdiv_zero) {
+  ga_fastdiv f;
+
+  memset(&f, 0, sizeof(f));
+  ga_fastdiv_init(&f, 0);
+  ck_assert_uint_eq(f.d, 1);
+  ck_assert_uint_eq(udiv32(12345, f.m32, f.s), 12345);
+}
+END_TEST
+
+Suite *get_suite(void) {
+  Suite *s = suite_create("util_fastdiv");
+  TCase *tc = tcase_create("All");
+  tcase_add_test(tc, test_fastdiv_32);
+  tcase_add_test(tc, test_fastdiv_size);
+  tcase_add_test(tc, test_fastdiv_zero);
+  suite_add_tcase(s, tc);
+  return s;
+}
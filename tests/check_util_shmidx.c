@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <check.h>
+
+#include "util/shmidx.h"
+
+static char path[32];
+
+static ga_shmidx *open_idx(void) {
+  ga_shmidx *idx = ga_shmidx_open(path);
+  ck_assert_ptr_ne(idx, NULL);
+  return idx;
+}
+
+static void setup_idx(void) {
+  int fd;
+  strcpy(path, "/tmp/ga_shmidx_XXXXXX");
+  fd = mkstemp(path);
+  ck_assert_int_ne(fd, -1);
+  close(fd);
+}
+
+static void teardown_idx(void) {
+  unlink(path);
+}
+
+START_TEST(test_shmidx_claim) {
+  ga_shmidx *idx = open_idx();
+
+  ck_assert_int_eq(ga_shmidx_acquire(idx, 42, 0), GA_SHMIDX_CLAIMED);
+  /* Still being built and we don't wait */
+  ck_assert_int_eq(ga_shmidx_acquire(idx, 42, 0), GA_SHMIDX_BUILD);
+  ga_shmidx_publish(idx, 42);
+  ck_assert_int_eq(ga_shmidx_acquire(idx, 42, 0), GA_SHMIDX_READY);
+
+  ck_assert_int_eq(ga_shmidx_acquire(idx, 43, 0), GA_SHMIDX_CLAIMED);
+  ga_shmidx_abandon(idx, 43);
+  ck_assert_int_eq(ga_shmidx_acquire(idx, 43, 0), GA_SHMIDX_CLAIMED);
+  ga_shmidx_close(idx);
+}
+END_TEST
+
+START_TEST(test_shmidx_wait) {
+  ga_shmidx *idx;
+  pid_t pid;
+  int st;
+
+  idx = open_idx();
+  ck_assert_int_eq(ga_shmidx_acquire(idx, 7, 0), GA_SHMIDX_CLAIMED);
+  pid = fork();
+  ck_assert_int_ne(pid, -1);
+  if (pid == 0) {
+    ga_shmidx *c = ga_shmidx_open(path);
+    _exit(c != NULL &&
+          ga_shmidx_acquire(c, 7, 10000) == GA_SHMIDX_READY ? 0 : 1);
+  }
+  usleep(50000);
+  ga_shmidx_publish(idx, 7);
+  ck_assert_int_eq(waitpid(pid, &st, 0), pid);
+  ck_assert(WIFEXITED(st));
+  ck_assert_int_eq(WEXITSTATUS(st), 0);
+  ga_shmidx_close(idx);
+}
+END_TEST
+
+START_TEST(test_shmidx_dead_owner) {
+  ga_shmidx *idx;
+  pid_t pid;
+  int st;
+
+  pid = fork();
+  ck_assert_int_ne(pid, -1);
+  if (pid == 0) {
+    ga_shmidx *c = ga_shmidx_open(path);
+    _exit(c != NULL &&
+          ga_shmidx_acquire(c, 9, 0) == GA_SHMIDX_CLAIMED ? 0 : 1);
+  }
+  ck_assert_int_eq(waitpid(pid, &st, 0), pid);
+  ck_assert_int_eq(WEXITSTATUS(st), 0);
+
+  /* The builder is gone, so we take over */
+  idx = open_idx();
+  ck_assert_int_eq(ga_shmidx_acquire(idx, 9, 10000), GA_SHMIDX_CLAIMED);
+  ga_shmidx_publish(idx, 9);
+  ck_assert_int_eq(ga_shmidx_acquire(idx, 9, 0), GA_SHMIDX_READY);
+  ga_shmidx_close(idx);
+}
+END_TEST
+
+Suite *get_suite(void) {
+  Suite *s = suite_create("util_shmidx");
+  TCase *tc = tcase_create("All");
+  tcase_add_checked_fixture(tc, setup_idx, teardown_idx);
+  tcase_add_test(tc, test_shmidx_claim);
+  tcase_add_test(tc, test_shmidx_wait);
+  tcase_add_test(tc, test_shmidx_dead_owner);
+  suite_add_tcase(s, tc);
+  return s;
+}
@@ -0,0 +1,100 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpuarray/buffer.h"
+#include "gpuarray/error.h"
+
+/*
+ * Build a kernel bundle from the manifests recorded with
+ * GPUARRAY_KERNEL_RECORD.
+ *
+ * The compilation uses a cuda device, but the binaries can target any
+ * architecture supported by the driver.
+ */
+
+#define MAX_ARCHS 32
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [options] MANIFEST...\n"
+          "  -d DEV     device to use (default $GPUARRAY_TEST_DEVICE or $DEVICE)\n"
+          "  -o FILE    bundle to write (required)\n"
+          "  -a ARCH    target architecture, like compute_70 (repeatable,\n"
+          "             default is the architectures in the manifests)\n",
+          prog);
+}
+
+int main(int argc, char *argv[]) {
+  const char *archs[MAX_ARCHS];
+  unsigned int narchs = 0;
+  const char *dev;
+  const char *out = NULL;
+  gpucontext_props *p;
+  gpucontext *ctx;
+  char *end;
+  long no;
+  int i, err;
+
+  dev = getenv("GPUARRAY_TEST_DEVICE");
+  if (dev == NULL)
+    dev = getenv("DEVICE");
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if (argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 == argc) {
+      usage(argv[0]);
+      return 2;
+    }
+    switch (argv[i][1]) {
+    case 'd': dev = argv[++i]; break;
+    case 'o': out = argv[++i]; break;
+    case 'a':
+      if (narchs == MAX_ARCHS) {
+        fprintf(stderr, "too many architectures\n");
+        return 2;
+      }
+      archs[narchs++] = argv[++i];
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (dev == NULL || out == NULL || i == argc) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (strncmp(dev, "cuda", 4) != 0) {
+    fprintf(stderr, "Kernel bundles need a cuda device\n");
+    return 2;
+  }
+  no = strtol(dev + 4, &end, 10);
+  if (end == dev + 4 || *end != '\0' || no < 0 || no > INT_MAX) {
+    fprintf(stderr, "Invalid device name: %s\n", dev);
+    return 2;
+  }
+
+  if ((err = gpucontext_props_new(&p)) != GA_NO_ERROR) {
+    fprintf(stderr, "%s\n", gpucontext_error(NULL, err));
+    return 1;
+  }
+  gpucontext_props_cuda_dev(p, (int)no);
+  /* This takes ownership of the props */
+  err = gpucontext_init(&ctx, "cuda", p);
+  if (err != GA_NO_ERROR) {
+    fprintf(stderr, "Could not open device %s: %s\n", dev,
+            gpucontext_error(NULL, err));
+    return 1;
+  }
+
+  err = gpukernel_bundle_build(ctx, (unsigned int)(argc - i),
+                               (const char **)argv + i, out, narchs,
+                               narchs ? archs : NULL);
+  if (err != GA_NO_ERROR)
+    fprintf(stderr, "Could not build the bundle: %s\n",
+            gpucontext_error(ctx, err));
+  gpucontext_deref(ctx);
+  return err == GA_NO_ERROR ? 0 : 1;
+}